@@ -115,6 +115,11 @@
 #define PICOPROBE_UART_INTERFACE uart1
 #define PICOPROBE_UART_BAUDRATE  115200
 
+// additional target UARTs on PIO (OPT_PIO_UART_N), one entry per UART
+#define PIO_UART_TX_PINS         { 8, 20 }
+#define PIO_UART_RX_PINS         { 9, 21 }
+#define PIO_UART_BAUDRATE        115200
+
 //
 // Other pin definitions
 // - LED     actual handling is done in led.c, pin definition is PICOPROBE_LED / PICO_DEFAULT_LED_PIN
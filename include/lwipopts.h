@@ -73,10 +73,12 @@
 #define TCP_SND_QUEUELEN                       16
 #define TCP_SNDQUEUELOWAT                      (TCP_SND_QUEUELEN / 2)
 #define MEMP_NUM_TCP_SEG                       32
+#define MEMP_NUM_PBUF                          (2 * TCP_SND_QUEUELEN)  // SystemView server: tcp_write() without copy uses PBUF_ROM
 
 //--------------------------------------
 // memory
 #define MEM_SIZE                               20000
+#define LWIP_SUPPORT_CUSTOM_PBUF               1                   // NCM hands received datagrams to lwIP without copy
 //#define MEMP_OVERFLOW_CHECK                    1
 //#define LWIP_ALLOW_MEM_FREE_FROM_OTHER_CONTEXT 1
 
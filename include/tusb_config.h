@@ -94,6 +94,20 @@
 #else
     #define CFG_TUD_CDC_SYSVIEW       0
 #endif
+#if OPT_PIO_UART_N                                 // CDCs for additional target UARTs on PIO
+    #if OPT_PIO_UART_N > 2
+        #error "OPT_PIO_UART_N must be 0..2"
+    #endif
+    #define CFG_TUD_CDC_PIO_UART      OPT_PIO_UART_N
+#else
+    #define CFG_TUD_CDC_PIO_UART      0
+#endif
+
+#if OPT_EVENT_STREAM                               // CDC for the merged event stream
+    #define CFG_TUD_CDC_EVENTS        1
+#else
+    #define CFG_TUD_CDC_EVENTS        0
+#endif
 
 #if OPT_CMSIS_DAPV1                                // CMSIS-DAPv1
     #define CFG_TUD_HID               1
@@ -110,7 +124,8 @@
 #else
     #define CFG_TUD_MSC               0
 #endif
-#define CFG_TUD_CDC                   (CFG_TUD_CDC_UART + CFG_TUD_CDC_SIGROK + CFG_TUD_CDC_DEBUG + CFG_TUD_CDC_SYSVIEW)
+#define CFG_TUD_CDC                   (CFG_TUD_CDC_UART + CFG_TUD_CDC_SIGROK + CFG_TUD_CDC_DEBUG + CFG_TUD_CDC_SYSVIEW \
+                                       + CFG_TUD_CDC_PIO_UART + CFG_TUD_CDC_EVENTS)
 #if OPT_NET
     #if OPT_NET_PROTO_ECM  ||  OPT_NET_PROTO_RNDIS
         #define CFG_TUD_ECM_RNDIS     1            // RNDIS under Windows works only if it's the only class, so we try NCM for Linux
@@ -135,6 +150,12 @@
 #if OPT_CDC_SYSVIEW
     #define CDC_SYSVIEW_N             (CFG_TUD_CDC_UART + CFG_TUD_CDC_SIGROK + CFG_TUD_CDC_DEBUG + CFG_TUD_CDC_SYSVIEW - 1)
 #endif
+#if OPT_PIO_UART_N
+    #define CDC_PIO_UART_N(n)         (CFG_TUD_CDC_UART + CFG_TUD_CDC_SIGROK + CFG_TUD_CDC_DEBUG + CFG_TUD_CDC_SYSVIEW + (n))
+#endif
+#if OPT_EVENT_STREAM
+    #define CDC_EVENTS_N              (CFG_TUD_CDC - 1)
+#endif
 
 //------------- BUFFER SIZES -------------//
 
@@ -45,6 +45,8 @@
 
 #include "picoprobe_config.h"
 #include "minIni/minIni.h"
+#include "stats_counter.h"
+#include "stats_histogram.h"
 
 
 #define STREAM_PRINTF_SIZE    4096
@@ -255,6 +257,12 @@ static void cdc_debug_command_if(uint8_t ch)
             else if (strcmp(cmd, "show") == 0) {
                 ini_print_all();
             }
+            else if (strcmp(cmd, "hist") == 0) {
+                stats_hist_print();
+            }
+            else if (strcmp(cmd, "hist_reset") == 0) {
+                stats_hist_reset();
+            }
             else if (strcmp(cmd, "killall") == 0) {
                 multicore_reset_core1();
                 taskDISABLE_INTERRUPTS();
@@ -305,9 +313,11 @@ static void cdc_debug_put_into_stream(const void *data, size_t len)
                 break;
             }
             available += n;
+            stats_add(STATS_DROP_DEBUG, n);
         }
     }
-    xStreamBufferSend(stream_printf, data, len, 0);
+    size_t sent = xStreamBufferSend(stream_printf, data, len, 0);
+    stats_add(STATS_DROP_DEBUG, len - sent);
 }   // cdc_debug_put_into_stream
 
 
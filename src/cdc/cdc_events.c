@@ -0,0 +1,147 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+/**
+ * Output of the merged event stream (see event_stream.h) to TCP or CDC.
+ *
+ * Frames are released by event_stream_read() only after the other sources have caught up,
+ * so the stream is polled periodically instead of being triggered by new data.
+ * If nobody is listening, frames are dropped.
+ */
+
+#include <pico/stdlib.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "event_groups.h"
+
+#include "tusb.h"
+
+#include "picoprobe_config.h"
+#include "cdc_events.h"
+#include "event_stream.h"
+#if OPT_NET_EVENTS_SERVER
+    #include "net/net_events.h"
+#endif
+
+
+#define EVENTS_POLL_MS           5
+
+static TaskHandle_t              task_events = NULL;
+
+static volatile bool m_connected = false;
+
+
+#define EV_TX_COMPLETE           0x01
+
+/// event flags
+static EventGroupHandle_t     events;
+
+
+
+static uint32_t host_write_available(void)
+{
+#if OPT_NET_EVENTS_SERVER
+    if (net_events_is_connected()) {
+        return net_events_send(NULL, 0);
+    }
+#endif
+    if (m_connected) {
+        return tud_cdc_n_write_available(CDC_EVENTS_N);
+    }
+    return UINT32_MAX;
+}   // host_write_available
+
+
+
+static void host_write(const uint8_t *buf, uint32_t cnt)
+{
+#if OPT_NET_EVENTS_SERVER
+    if (net_events_is_connected()) {
+        net_events_send(buf, cnt);
+        return;
+    }
+#endif
+    if (m_connected) {
+        tud_cdc_n_write(CDC_EVENTS_N, buf, cnt);
+    }
+}   // host_write
+
+
+
+static void cdc_thread(void *ptr)
+{
+    static uint8_t tx_buf[CFG_TUD_CDC_TX_BUFSIZE];
+
+    static_assert(sizeof(tx_buf) >= EVENT_STREAM_HEADER_SIZE + EVENT_STREAM_PAYLOAD_MAX, "tx_buf too small for a frame");
+
+    for (;;) {
+        uint32_t cnt;
+
+        xEventGroupWaitBits(events, EV_TX_COMPLETE, pdTRUE, pdFALSE, pdMS_TO_TICKS(EVENTS_POLL_MS));
+
+        do {
+            cnt = event_stream_read(tx_buf, MIN(host_write_available(), sizeof(tx_buf)));
+            if (cnt != 0) {
+                host_write(tx_buf, cnt);
+            }
+        } while (cnt != 0);
+
+        if (m_connected) {
+            tud_cdc_n_write_flush(CDC_EVENTS_N);
+        }
+    }
+}   // cdc_thread
+
+
+
+void cdc_events_line_state_cb(bool dtr, bool rts)
+/**
+ * Flush tinyusb buffers on connect/disconnect.
+ */
+{
+    tud_cdc_n_write_clear(CDC_EVENTS_N);
+    tud_cdc_n_read_flush(CDC_EVENTS_N);
+    m_connected = (dtr  ||  rts);
+    xEventGroupSetBits(events, EV_TX_COMPLETE);
+}   // cdc_events_line_state_cb
+
+
+
+void cdc_events_tx_complete_cb(void)
+{
+    xEventGroupSetBits(events, EV_TX_COMPLETE);
+}   // cdc_events_tx_complete_cb
+
+
+
+void cdc_events_init(uint32_t task_prio)
+{
+    events = xEventGroupCreate();
+
+    xTaskCreate(cdc_thread, "CDC-Events", configMINIMAL_STACK_SIZE, NULL, task_prio, &task_events);
+    cdc_events_line_state_cb(false, false);
+}   // cdc_events_init
@@ -0,0 +1,460 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+/**
+ * Additional target UARTs on spare PIO state machines, each one with its own CDC (and TCP port if
+ * OPT_NET_UART_SERVER is set).
+ *
+ * * every channel needs two state machines (TX + RX) of the same PIO, format is fixed to 8N1,
+ *   only the baudrate can be changed
+ * * pio0 is shared with SWD (PROBE_SM), pio1 is used only if sigrok is disabled, because sigrok
+ *   takes over the whole instruction memory.  SM0 of pio1 is left to WS2812
+ * * target -> probe: DMA from the RX FIFO into the ring \a rx_ring, the write index is published
+ *   periodically by pio_uart_timer_cb(), like the target UART does in cdc_uart.c
+ * * probe -> target: data is read in blocks into \a tx_buf and transferred via DMA into the TX FIFO
+ * * a single thread serves all channels
+ */
+
+#include <pico/stdlib.h>
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+#include "task.h"
+#include "event_groups.h"
+
+#include "tusb.h"
+
+#include "picoprobe_config.h"
+#include "cdc_pio_uart.h"
+#include "stats_counter.h"
+#include "dma_rx_ring.h"
+#include "pio_uart.pio.h"
+#if OPT_NET_UART_SERVER
+    #include "net/net_uart.h"
+#endif
+
+
+#if !defined(PIO_UART_TX_PINS)  ||  !defined(PIO_UART_RX_PINS)  ||  !defined(PIO_UART_BAUDRATE)
+    #error "board does not define PIO_UART_TX_PINS/PIO_UART_RX_PINS/PIO_UART_BAUDRATE"
+#endif
+
+
+#define PIO_UART_RX_RING_BITS     10
+#define PIO_UART_RX_RING_SIZE     (1U << PIO_UART_RX_RING_BITS)
+#define PIO_UART_RX_MARGIN        128                  // DMA may run ahead of the published write index by one poll period
+#define PIO_UART_POLL_US          1000
+#define PIO_UART_RX_DMA_COUNT     0xffffffff
+#define PIO_UART_TX_BUF_SIZE      256
+
+#define PIO_UART_BAUDRATE_MIN     300
+#define PIO_UART_BAUDRATE_MAX     1000000              // 100 bytes per poll period
+
+typedef struct {
+    PIO                   pio;
+    int                   sm_tx;
+    int                   sm_rx;
+    int                   rx_dma;
+    int                   tx_dma;
+    dma_rx_ring_t         rx;                      // wr written by pio_uart_timer_cb(), rd by cdc_pio_uart_thread()
+    volatile bool         tx_pending;              // TX DMA has been started by cdc_pio_uart_thread()
+    volatile bool         connected;
+    uint32_t              baudrate;
+} pio_uart_t;
+
+static pio_uart_t             m_pio_uart[OPT_PIO_UART_N];
+static uint8_t                rx_ring[OPT_PIO_UART_N][PIO_UART_RX_RING_SIZE] __attribute__((aligned(PIO_UART_RX_RING_SIZE)));
+static uint8_t                tx_buf[OPT_PIO_UART_N][PIO_UART_TX_BUF_SIZE];
+static struct repeating_timer pio_uart_timer;
+
+static const uint8_t          tx_pins[] = PIO_UART_TX_PINS;
+static const uint8_t          rx_pins[] = PIO_UART_RX_PINS;
+
+static_assert(sizeof(tx_pins) >= OPT_PIO_UART_N  &&  sizeof(rx_pins) >= OPT_PIO_UART_N, "PIO_UART_TX_PINS/PIO_UART_RX_PINS too short");
+
+static TaskHandle_t           task_pio_uart = NULL;
+
+/// event flags, bit n is the event for channel n
+static EventGroupHandle_t     events;
+
+
+
+static bool pio_uart_is_connected(uint32_t n)
+/**
+ * Someone is listening: either the CDC or a TCP client.
+ */
+{
+#if OPT_NET_UART_SERVER
+    return m_pio_uart[n].connected  ||  net_uart_is_connected(1 + n);
+#else
+    return m_pio_uart[n].connected;
+#endif
+}   // pio_uart_is_connected
+
+
+
+static bool pio_uart_timer_cb(struct repeating_timer *t)
+/**
+ * Publish the DMA write positions of the RX rings, check the PIO error flags and wake up
+ * cdc_pio_uart_thread() if something has changed for a channel.
+ *
+ * Context: timer IRQ
+ */
+{
+    EventBits_t ev = 0;
+
+    for (uint32_t n = 0;  n < OPT_PIO_UART_N;  ++n) {
+        pio_uart_t *u = m_pio_uart + n;
+        bool finished = !dma_channel_is_busy(u->rx_dma);
+        uint32_t delta = dma_rx_ring_poll(&u->rx, dma_hw->ch[u->rx_dma].transfer_count, finished);
+
+        if (finished) {
+            // happens after PIO_UART_RX_DMA_COUNT bytes, write address continues in the ring
+            dma_channel_set_trans_count(u->rx_dma, PIO_UART_RX_DMA_COUNT, true);
+        }
+
+        if (u->pio->irq & (1u << (4 + u->sm_rx))) {
+            // framing error or break, set by "irq 4 rel" in pio_uart_rx
+            u->pio->irq = 1u << (4 + u->sm_rx);
+            stats_inc(STATS_PIO_UART_FRAMING);
+        }
+        if (u->pio->fdebug & (1u << (PIO_FDEBUG_RXSTALL_LSB + u->sm_rx))) {
+            // RX FIFO full, at least one character lost
+            u->pio->fdebug = 1u << (PIO_FDEBUG_RXSTALL_LSB + u->sm_rx);
+            stats_inc(STATS_PIO_UART_RX_OVERRUN);
+        }
+
+        if (delta != 0) {
+            ev |= 1u << n;
+        }
+        if (u->tx_pending  &&  !dma_channel_is_busy(u->tx_dma)) {
+            ev |= 1u << n;
+        }
+    }
+
+    if (ev != 0) {
+        BaseType_t task_woken, res;
+
+        task_woken = pdFALSE;
+        res = xEventGroupSetBitsFromISR(events, ev, &task_woken);
+        if (res != pdFAIL) {
+            portYIELD_FROM_ISR(task_woken);
+        }
+    }
+    return true;
+}   // pio_uart_timer_cb
+
+
+
+static uint32_t pio_uart_rx_chunk(uint32_t n, const uint8_t **data)
+/**
+ * Get the next linear chunk of received data out of the RX ring of channel \a n.
+ * Overwritten data is skipped and counted.
+ */
+{
+    uint32_t offs, lost, cnt;
+
+    cnt = dma_rx_ring_chunk(&m_pio_uart[n].rx, &offs, &lost);
+    if (lost != 0) {
+        stats_add(STATS_DROP_PIO_UART_RX_RING, lost);
+    }
+    *data = rx_ring[n] + offs;
+    return cnt;
+}   // pio_uart_rx_chunk
+
+
+
+static void pio_uart_to_host(uint32_t n)
+/**
+ * Transmit received characters target -> probe -> host, either via TCP or CDC.
+ */
+{
+    const uint8_t *data;
+    uint32_t cnt;
+    uint32_t max_cnt;
+
+#if OPT_NET_UART_SERVER
+    if (net_uart_is_connected(1 + n)) {
+        max_cnt = net_uart_send(1 + n, NULL, 0);
+        cnt = MIN(max_cnt, pio_uart_rx_chunk(n, &data));
+        if (cnt != 0) {
+            net_uart_send(1 + n, data, cnt);
+            dma_rx_ring_consume(&m_pio_uart[n].rx, cnt);
+        }
+        return;
+    }
+#endif
+
+    max_cnt = tud_cdc_n_write_available(CDC_PIO_UART_N(n));
+    cnt = MIN(max_cnt, pio_uart_rx_chunk(n, &data));
+    if (cnt != 0) {
+        tud_cdc_n_write(CDC_PIO_UART_N(n), data, cnt);
+        dma_rx_ring_consume(&m_pio_uart[n].rx, cnt);
+    }
+    if (dma_rx_ring_is_empty(&m_pio_uart[n].rx)) {
+        tud_cdc_n_write_flush(CDC_PIO_UART_N(n));
+    }
+}   // pio_uart_to_host
+
+
+
+static bool pio_uart_to_target(uint32_t n)
+/**
+ * If the TX DMA is idle, read a block from TCP or CDC into \a tx_buf and start DMA.
+ *
+ * \return true -> there is still data pending
+ */
+{
+    pio_uart_t *u = m_pio_uart + n;
+    uint32_t cnt = 0;
+
+    if (dma_channel_is_busy(u->tx_dma)) {
+        return true;
+    }
+    u->tx_pending = false;
+
+#if OPT_NET_UART_SERVER
+    if (net_uart_is_connected(1 + n)) {
+        cnt = xStreamBufferReceive(net_uart_stream_to_target(1 + n), tx_buf[n], PIO_UART_TX_BUF_SIZE, 0);
+        if (cnt != 0) {
+            net_uart_target_ready(1 + n);
+        }
+    }
+#endif
+    if (cnt == 0  &&  tud_cdc_n_available(CDC_PIO_UART_N(n)) != 0) {
+        cnt = tud_cdc_n_read(CDC_PIO_UART_N(n), tx_buf[n], PIO_UART_TX_BUF_SIZE);
+    }
+
+    if (cnt != 0) {
+        u->tx_pending = true;
+        dma_channel_transfer_from_buffer_now(u->tx_dma, tx_buf[n], cnt);
+    }
+    return cnt != 0;
+}   // pio_uart_to_target
+
+
+
+static void cdc_pio_uart_thread(void *ptr)
+{
+    TickType_t wait = pdMS_TO_TICKS(1000);
+
+    for (;;) {
+        xEventGroupWaitBits(events, (1u << OPT_PIO_UART_N) - 1, pdTRUE, pdFALSE, wait);
+
+        wait = pdMS_TO_TICKS(1000);
+        for (uint32_t n = 0;  n < OPT_PIO_UART_N;  ++n) {
+            if ( !pio_uart_is_connected(n)) {
+                // drop received data while nobody is listening
+                m_pio_uart[n].rx.rd = m_pio_uart[n].rx.wr;
+                continue;
+            }
+
+            pio_uart_to_host(n);
+            if (pio_uart_to_target(n)) {
+                // poll until TX DMA is finished or the host has no more data
+                wait = pdMS_TO_TICKS(10);
+            }
+        }
+    }
+}   // cdc_pio_uart_thread
+
+
+
+uint32_t cdc_pio_uart_set_baudrate(uint32_t n, uint32_t baudrate)
+/**
+ * Set baudrate of PIO UART \a n.  Both state machines run with 8 cycles per bit.
+ *
+ * \return the baudrate actually set
+ */
+{
+    pio_uart_t *u = m_pio_uart + n;
+
+    baudrate = MAX(PIO_UART_BAUDRATE_MIN, MIN(PIO_UART_BAUDRATE_MAX, baudrate));
+    pio_uart_set_baudrate(u->pio, u->sm_tx, baudrate);
+    pio_uart_set_baudrate(u->pio, u->sm_rx, baudrate);
+    u->baudrate = baudrate;
+    return baudrate;
+}   // cdc_pio_uart_set_baudrate
+
+
+
+void cdc_pio_uart_notify(uint32_t n)
+/**
+ * Wake up cdc_pio_uart_thread(), e.g. on TCP connect or new data from TCP.
+ */
+{
+    xEventGroupSetBits(events, 1u << n);
+}   // cdc_pio_uart_notify
+
+
+
+void cdc_pio_uart_line_coding_cb(uint32_t n, cdc_line_coding_t const* line_coding)
+/**
+ * Only the bitrate is taken over, format is fixed to 8N1.
+ */
+{
+    cdc_pio_uart_set_baudrate(n, line_coding->bit_rate);
+}   // cdc_pio_uart_line_coding_cb
+
+
+
+void cdc_pio_uart_line_state_cb(uint32_t n, bool dtr, bool rts)
+/**
+ * Flush tinyusb buffers on connect/disconnect.
+ */
+{
+    tud_cdc_n_write_clear(CDC_PIO_UART_N(n));
+    tud_cdc_n_read_flush(CDC_PIO_UART_N(n));
+    m_pio_uart[n].connected = (dtr  ||  rts);
+    cdc_pio_uart_notify(n);
+}   // cdc_pio_uart_line_state_cb
+
+
+
+void cdc_pio_uart_tx_complete_cb(uint32_t n)
+{
+    cdc_pio_uart_notify(n);
+}   // cdc_pio_uart_tx_complete_cb
+
+
+
+void cdc_pio_uart_rx_cb(uint32_t n)
+{
+    cdc_pio_uart_notify(n);
+}   // cdc_pio_uart_rx_cb
+
+
+
+static bool pio_uart_claim(pio_uart_t *u)
+/**
+ * Find two free state machines on a PIO which can also hold the UART programs.
+ * Programs are loaded once per PIO.
+ */
+{
+    static const PIO pios[] = {
+        pio0,
+#if !OPT_SIGROK
+        pio1,
+#endif
+    };
+    static int tx_offset[2] = { -1, -1 };
+    static int rx_offset[2] = { -1, -1 };
+
+    for (uint32_t i = 0;  i < count_of(pios);  ++i) {
+        PIO pio = pios[i];
+        uint32_t pio_ndx = pio_get_index(pio);
+        int sm_tx, sm_rx;
+
+        if (tx_offset[pio_ndx] < 0) {
+            if ( !pio_can_add_program(pio, &pio_uart_tx_program)) {
+                continue;
+            }
+            tx_offset[pio_ndx] = pio_add_program(pio, &pio_uart_tx_program);
+        }
+        if (rx_offset[pio_ndx] < 0) {
+            if ( !pio_can_add_program(pio, &pio_uart_rx_program)) {
+                continue;
+            }
+            rx_offset[pio_ndx] = pio_add_program(pio, &pio_uart_rx_program);
+        }
+
+        sm_tx = pio_claim_unused_sm(pio, false);
+        if (sm_tx < 0) {
+            continue;
+        }
+        sm_rx = pio_claim_unused_sm(pio, false);
+        if (sm_rx < 0) {
+            pio_sm_unclaim(pio, sm_tx);
+            continue;
+        }
+
+        u->pio   = pio;
+        u->sm_tx = sm_tx;
+        u->sm_rx = sm_rx;
+        pio_uart_tx_program_init(pio, sm_tx, tx_offset[pio_ndx], tx_pins[u - m_pio_uart], u->baudrate);
+        pio_uart_rx_program_init(pio, sm_rx, rx_offset[pio_ndx], rx_pins[u - m_pio_uart], u->baudrate);
+        return true;
+    }
+    return false;
+}   // pio_uart_claim
+
+
+
+void cdc_pio_uart_init(uint32_t task_prio)
+{
+    events = xEventGroupCreate();
+
+    // reserve state machines which are used without claiming them
+    if ( !pio_sm_is_claimed(PROBE_PIO, PROBE_SM)) {
+        pio_sm_claim(PROBE_PIO, PROBE_SM);
+    }
+#if !OPT_SIGROK
+    if ( !pio_sm_is_claimed(pio1, 0)) {
+        pio_sm_claim(pio1, 0);                                 // WS2812
+    }
+#endif
+
+    for (uint32_t n = 0;  n < OPT_PIO_UART_N;  ++n) {
+        pio_uart_t *u = m_pio_uart + n;
+        dma_channel_config c;
+
+        u->baudrate = PIO_UART_BAUDRATE;
+        if ( !pio_uart_claim(u)) {
+            picoprobe_error("cdc_pio_uart_init: no PIO resources for PIO UART %lu\n", n);
+            panic("cdc_pio_uart_init: no PIO resources");
+        }
+        picoprobe_info("PIO UART %lu: pio%u, SM %d/%d, TX GPIO%u, RX GPIO%u\n", n, pio_get_index(u->pio),
+                       u->sm_tx, u->sm_rx, tx_pins[n], rx_pins[n]);
+
+        // receive via DMA into rx_ring, the received byte is in the MSB of the FIFO entry
+        dma_rx_ring_init(&u->rx, PIO_UART_RX_RING_SIZE, PIO_UART_RX_MARGIN, PIO_UART_RX_DMA_COUNT);
+        u->rx_dma = dma_claim_unused_channel(true);
+        c = dma_channel_get_default_config(u->rx_dma);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, PIO_UART_RX_RING_BITS);
+        channel_config_set_dreq(&c, pio_get_dreq(u->pio, u->sm_rx, false));
+        dma_channel_configure(u->rx_dma, &c, rx_ring[n], (io_rw_8 *)&u->pio->rxf[u->sm_rx] + 3,
+                              PIO_UART_RX_DMA_COUNT, true);
+
+        // transmit via DMA from tx_buf, completion is polled
+        u->tx_dma = dma_claim_unused_channel(true);
+        c = dma_channel_get_default_config(u->tx_dma);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, pio_get_dreq(u->pio, u->sm_tx, true));
+        dma_channel_configure(u->tx_dma, &c, &u->pio->txf[u->sm_tx], tx_buf[n], 0, false);
+    }
+
+    add_repeating_timer_us(-PIO_UART_POLL_US, pio_uart_timer_cb, NULL, &pio_uart_timer);
+
+    xTaskCreate(cdc_pio_uart_thread, "CDC-PioUart", configMINIMAL_STACK_SIZE, NULL, task_prio, &task_pio_uart);
+    for (uint32_t n = 0;  n < OPT_PIO_UART_N;  ++n) {
+        cdc_pio_uart_line_state_cb(n, false, false);
+    }
+}   // cdc_pio_uart_init
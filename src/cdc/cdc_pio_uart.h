@@ -0,0 +1,46 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#ifndef CDC_PIO_UART_H
+#define CDC_PIO_UART_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tusb.h"
+
+#if OPT_PIO_UART_N
+    void cdc_pio_uart_init(uint32_t task_prio);
+
+    uint32_t cdc_pio_uart_set_baudrate(uint32_t n, uint32_t baudrate);
+    void cdc_pio_uart_notify(uint32_t n);
+
+    void cdc_pio_uart_line_state_cb(uint32_t n, bool dtr, bool rts);
+    void cdc_pio_uart_line_coding_cb(uint32_t n, cdc_line_coding_t const* line_coding);
+    void cdc_pio_uart_tx_complete_cb(uint32_t n);
+    void cdc_pio_uart_rx_cb(uint32_t n);
+#endif
+
+#endif
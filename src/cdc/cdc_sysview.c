@@ -34,6 +34,7 @@
 
 #include "picoprobe_config.h"
 #include "rtt_io.h"
+#include "stats_counter.h"
 
 
 #define STREAM_SYSVIEW_SIZE      4096
@@ -200,6 +201,7 @@ uint32_t net_sysview_send(const uint8_t *buf, uint32_t cnt)
         }
         else {
             r = xStreamBufferSend(stream_sysview, buf, cnt, pdMS_TO_TICKS(1000));
+            stats_add(STATS_DROP_SYSVIEW, cnt - r);
         }
 
         xEventGroupSetBits(events, EV_STREAM);
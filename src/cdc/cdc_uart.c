@@ -29,12 +29,12 @@
  * Target -> Probe -> Host
  * -----------------------
  * * target -> probe
- *   * UART: interrupt handler on_uart_rx() to cdc_uart_put_into_stream()
- *   * RTT: (rtt_console) to cdc_uart_write()
- *   * UART/RTT data is written into \a stream_uart via
+ *   * UART: DMA into the ring \a uart_rx_ring, the write index is published periodically
+ *     by uart_rx_timer_cb() which also wakes up cdc_thread()
+ *   * RTT: (rtt_console) to cdc_uart_write() which writes into \a stream_uart
  * * probe -> host: cdc_thread()
- *   * data is fetched from \a stream_uart and then put into a CDC
- *     in cdc_thread()
+ *   * data is taken in linear chunks directly out of \a uart_rx_ring and from \a stream_uart
+ *     and then put into a CDC in cdc_thread()
  *
  * Host -> Probe -> Target
  * -----------------------
@@ -42,10 +42,24 @@
  *   * data is received from CDC in cdc_thread()
  * * probe -> target
  *   * data is first tried to be transmitted via RTT
- *   * if that was not successful (no RTT_CB), data is transmitted via UART to the target
+ *   * if that was not successful (no RTT_CB), data is read in blocks directly into the ring
+ *     \a uart_tx_ring which is transmitted via DMA to the UART.  A transfer is started immediately
+ *     if DMA is idle, so single keystrokes are not delayed.  uart_tx_dma_handler() starts the next
+ *     chunk on completion
+ *
+ * TCP (OPT_NET_UART_SERVER)
+ * -------------------------
+ * * while a TCP client is connected, target data goes in blocks to net_uart_send() instead of CDC
+ * * data from TCP is taken in blocks from net_uart_stream_to_target(0) into \a uart_tx_ring,
+ *   the TCP window is opened by net_uart_target_ready(0)
+ *
+ * Event stream (OPT_EVENT_STREAM)
+ * -------------------------------
+ * * uart_rx_timer_cb() additionally puts newly received data with a timestamp into the event stream
  */
 
 #include <pico/stdlib.h>
+#include "hardware/dma.h"
 #include "FreeRTOS.h"
 #include "stream_buffer.h"
 #include "task.h"
@@ -56,6 +70,16 @@
 #include "picoprobe_config.h"
 #include "led.h"
 #include "rtt_io.h"
+#include "stats_counter.h"
+#include "dma_rx_ring.h"
+#include "dma_tx_ring.h"
+#if OPT_NET_UART_SERVER
+    #include "net/net_uart.h"
+#endif
+#if OPT_EVENT_STREAM
+    #include "hardware/clocks.h"
+    #include "event_stream.h"
+#endif
 
 
 #define STREAM_UART_SIZE      4096
@@ -67,35 +91,316 @@ static StreamBufferHandle_t   stream_uart;
 static volatile bool m_connected = false;
 
 
+#define UART_RX_RING_BITS     12
+#define UART_RX_RING_SIZE     (1U << UART_RX_RING_BITS)
+#define UART_RX_RING_MASK     (UART_RX_RING_SIZE - 1)
+#define UART_RX_MARGIN        512                      // DMA may run ahead of the published write index by one poll period
+#define UART_RX_POLL_US       1000
+#define UART_RX_DMA_COUNT     0xffffffff
+
+static uint8_t                uart_rx_ring[UART_RX_RING_SIZE] __attribute__((aligned(UART_RX_RING_SIZE)));
+static int                    uart_rx_dma;
+static dma_rx_ring_t          uart_rx;                 // wr written by uart_rx_timer_cb(), rd by cdc_thread()
+static struct repeating_timer uart_rx_timer;
+
+#define UART_TX_RING_SIZE     1024
+
+static uint8_t                uart_tx_ring[UART_TX_RING_SIZE];
+static int                    uart_tx_dma;
+static dma_tx_ring_t          uart_tx;                 // modified under critical section
+
+
 #define EV_TX_COMPLETE        0x01
 #define EV_STREAM             0x02
 #define EV_RX                 0x04
+#define EV_NET                0x08
+#define EV_UART_TX            0x10
+#define EV_ALL                (EV_TX_COMPLETE | EV_STREAM | EV_RX | EV_NET | EV_UART_TX)
 
 /// event flags
 static EventGroupHandle_t     events;
 
 
 
+static bool cdc_uart_is_connected(void)
+/**
+ * Someone is listening: either the CDC or a TCP client.
+ */
+{
+#if OPT_NET_UART_SERVER
+    return m_connected  ||  net_uart_is_connected(0);
+#else
+    return m_connected;
+#endif
+}   // cdc_uart_is_connected
+
+
+
+static uint32_t uart_rx_chunk(const uint8_t **data)
+/**
+ * Get the next linear chunk of received UART data out of \a uart_rx_ring.
+ * If the reader is too slow, the oldest data has already been overwritten by DMA.  In this case
+ * the read index is moved forward and the lost bytes are counted.
+ *
+ * \param data  pointer to the chunk
+ * \return      number of bytes in the chunk
+ */
+{
+    uint32_t offs, lost, cnt;
+
+    cnt = dma_rx_ring_chunk(&uart_rx, &offs, &lost);
+    if (lost != 0) {
+        stats_add(STATS_DROP_UART_RX_RING, lost);
+    }
+    *data = uart_rx_ring + offs;
+    return cnt;
+}   // uart_rx_chunk
+
+
+
+static void uart_rx_consume(uint32_t cnt)
+{
+    dma_rx_ring_consume(&uart_rx, cnt);
+}   // uart_rx_consume
+
+
+
+#if OPT_EVENT_STREAM
+static void uart_rx_event(uint32_t wr, uint32_t delta, uint64_t now)
+/**
+ * Put \a delta bytes received at \a wr into the event stream.  The bytes have been received back to back
+ * before \a now, so the timestamp is the estimated start of the first character (10 bit times each).
+ *
+ * Context: timer IRQ
+ */
+{
+    static uint64_t last_ts;
+    uart_hw_t *hw = uart_get_hw(PICOPROBE_UART_INTERFACE);
+    uint64_t char_ns = (2500000000ULL * (64 * hw->ibrd + hw->fbrd)) / clock_get_hz(clk_peri);
+    uint64_t ts = now - (delta * char_ns) / 1000;
+
+    ts = MAX(ts, last_ts);
+    while (delta != 0) {
+        uint32_t ndx = wr & UART_RX_RING_MASK;
+        uint32_t n = MIN(delta, MIN(EVENT_STREAM_PAYLOAD_MAX, UART_RX_RING_SIZE - ndx));
+
+        event_stream_put(EVENT_SRC_UART, ts, uart_rx_ring + ndx, n);
+        ts += (n * char_ns) / 1000;
+        wr += n;
+        delta -= n;
+    }
+    last_ts = ts;
+}   // uart_rx_event
+#endif
+
+
+
+static bool uart_rx_timer_cb(struct repeating_timer *t)
+/**
+ * Publish the DMA write position of \a uart_rx_ring and wake up cdc_thread() if there is new data.
+ * Instead of an interrupt per FIFO level this runs every UART_RX_POLL_US, which is fine as long as
+ * less than UART_RX_MARGIN bytes are received during one period (3MBaud -> 300 bytes).
+ *
+ * Context: timer IRQ
+ */
+{
+    // the transfer count (unlike the write address) tells a full lap of the ring from no data
+    bool finished = !dma_channel_is_busy(uart_rx_dma);
+    uint32_t delta = dma_rx_ring_poll(&uart_rx, dma_hw->ch[uart_rx_dma].transfer_count, finished);
+
+    if (finished) {
+        // happens after UART_RX_DMA_COUNT bytes, write address continues in the ring
+        dma_channel_set_trans_count(uart_rx_dma, UART_RX_DMA_COUNT, true);
+    }
+
+    if (uart_get_hw(PICOPROBE_UART_INTERFACE)->rsr & UART_UARTRSR_OE_BITS) {
+        // UART FIFO overrun, at least one character lost
+        uart_get_hw(PICOPROBE_UART_INTERFACE)->rsr = 0;
+        stats_inc(STATS_UART_RX_OVERRUN);
+    }
+
+#if OPT_EVENT_STREAM
+    {
+        uint64_t now = time_us_64();
+
+        if (delta != 0) {
+            // on overflow only the newest bytes are still in the ring
+            uint32_t n = MIN(delta, UART_RX_RING_SIZE - UART_RX_MARGIN);
+
+            uart_rx_event(uart_rx.wr - n, n, now);
+        }
+        // bytes published by the next call have been started after this (conservative)
+        event_stream_watermark(EVENT_SRC_UART, now - UART_RX_POLL_US);
+    }
+#endif
+
+    if (delta != 0) {
+        BaseType_t task_woken, res;
+
+        led_state(LS_UART_RX_DATA);
+
+        task_woken = pdFALSE;
+        res = xEventGroupSetBitsFromISR(events, EV_STREAM, &task_woken);
+        if (res != pdFAIL) {
+            portYIELD_FROM_ISR(task_woken);
+        }
+    }
+    return true;
+}   // uart_rx_timer_cb
+
+
+
+static void uart_tx_dma_handler(void)
+/**
+ * DMA has finished a chunk: free it and start the next one.
+ *
+ * Context: DMA IRQ (shared)
+ */
+{
+    if (dma_channel_get_irq1_status(uart_tx_dma)) {
+        UBaseType_t saved;
+        BaseType_t task_woken, res;
+        uint32_t offs, len;
+
+        dma_channel_acknowledge_irq1(uart_tx_dma);
+
+        saved = taskENTER_CRITICAL_FROM_ISR();
+        if (dma_tx_ring_done(&uart_tx, &offs, &len)) {
+            dma_channel_transfer_from_buffer_now(uart_tx_dma, uart_tx_ring + offs, len);
+        }
+        taskEXIT_CRITICAL_FROM_ISR(saved);
+
+        task_woken = pdFALSE;
+        res = xEventGroupSetBitsFromISR(events, EV_UART_TX, &task_woken);
+        if (res != pdFAIL) {
+            portYIELD_FROM_ISR(task_woken);
+        }
+    }
+}   // uart_tx_dma_handler
+
+
+
+static uint32_t uart_tx_space(uint8_t **data)
+/**
+ * Get the next linear free chunk of \a uart_tx_ring.
+ *
+ * \param data  pointer to the chunk
+ * \return      number of bytes which can be written into the chunk
+ */
+{
+    uint32_t offs, cnt;
+
+    cnt = dma_tx_ring_space(&uart_tx, &offs);
+    *data = uart_tx_ring + offs;
+    return cnt;
+}   // uart_tx_space
+
+
+
+static void uart_tx_commit(uint32_t cnt)
+/**
+ * \a cnt bytes have been written into the chunk given by uart_tx_space(), start transmission.
+ */
+{
+    if (cnt != 0) {
+        uint32_t offs, len;
+
+        led_state(LS_UART_TX_DATA);
+
+        taskENTER_CRITICAL();
+        if (dma_tx_ring_commit(&uart_tx, cnt, &offs, &len)) {
+            // DMA was idle: start immediately
+            dma_channel_transfer_from_buffer_now(uart_tx_dma, uart_tx_ring + offs, len);
+        }
+        taskEXIT_CRITICAL();
+    }
+}   // uart_tx_commit
+
+
+
+#if OPT_NET_UART_SERVER
+static bool net_to_target(void)
+/**
+ * Transfer data from TCP into \a uart_tx_ring.
+ *
+ * \return true -> there is still data pending
+ */
+{
+    StreamBufferHandle_t stream = net_uart_stream_to_target(0);
+    uint8_t *data;
+    uint32_t cnt;
+
+    if ( !net_uart_is_connected(0)) {
+        return false;
+    }
+
+    cnt = uart_tx_space(&data);
+    if (cnt != 0) {
+        cnt = xStreamBufferReceive(stream, data, cnt, 0);
+        if (cnt != 0) {
+            uart_tx_commit(cnt);
+            net_uart_target_ready(0);
+        }
+    }
+    return !xStreamBufferIsEmpty(stream);
+}   // net_to_target
+#endif
+
+
+
+static uint32_t host_write_available(void)
+{
+#if OPT_NET_UART_SERVER
+    if (net_uart_is_connected(0)) {
+        return net_uart_send(0, NULL, 0);
+    }
+#endif
+    return tud_cdc_n_write_available(CDC_UART_N);
+}   // host_write_available
+
+
+
+static void host_write(const uint8_t *buf, uint32_t cnt)
+/**
+ * Transmit characters target -> probe -> host, either via TCP or CDC.
+ */
+{
+#if OPT_NET_UART_SERVER
+    if (net_uart_is_connected(0)) {
+        net_uart_send(0, buf, cnt);
+        return;
+    }
+#endif
+    tud_cdc_n_write(CDC_UART_N, buf, cnt);
+}   // host_write
+
+
+
 static void cdc_thread(void *ptr)
 {
     static uint8_t cdc_tx_buf[CFG_TUD_CDC_TX_BUFSIZE];
+    bool net_pending = false;
 
     for (;;) {
         uint32_t cdc_rx_chars;
 
-        if ( !m_connected) {
+        if ( !cdc_uart_is_connected()) {
             // wait here until connected (and until my terminal program is ready)
-            while ( !m_connected) {
-                xEventGroupWaitBits(events, EV_TX_COMPLETE | EV_STREAM | EV_RX, pdTRUE, pdFALSE, pdMS_TO_TICKS(1000));
+            while ( !cdc_uart_is_connected()) {
+                xEventGroupWaitBits(events, EV_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(1000));
             }
             vTaskDelay(pdMS_TO_TICKS(100));
         }
 
         cdc_rx_chars = tud_cdc_n_available(CDC_UART_N);
-        if (cdc_rx_chars == 0  &&  xStreamBufferIsEmpty(stream_uart)) {
+        if (net_pending) {
+            // wait for free space in uart_tx_ring
+            xEventGroupWaitBits(events, EV_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(10));
+        }
+        else if (cdc_rx_chars == 0  &&  dma_rx_ring_is_empty(&uart_rx)  &&  xStreamBufferIsEmpty(stream_uart)) {
             // -> nothing left to do: sleep for a long time
             tud_cdc_n_write_flush(CDC_UART_N);
-            xEventGroupWaitBits(events, EV_TX_COMPLETE | EV_STREAM | EV_RX, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+            xEventGroupWaitBits(events, EV_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
         }
         else if (cdc_rx_chars != 0) {
             // wait a short period if there are characters host -> probe -> target
@@ -103,37 +408,42 @@ static void cdc_thread(void *ptr)
         }
         else {
             // wait until transmission via USB has finished
-            xEventGroupWaitBits(events, EV_TX_COMPLETE | EV_STREAM | EV_RX, pdTRUE, pdFALSE, pdMS_TO_TICKS(100));
+            xEventGroupWaitBits(events, EV_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(100));
         }
 
         //
         // probe -> host
         //
-        if ( !xStreamBufferIsEmpty(stream_uart)) {
-            //
-            // transmit characters target -> picoprobe -> host
-            //
-            size_t cnt;
-            size_t max_cnt;
-
-            max_cnt = tud_cdc_n_write_available(CDC_UART_N);
-            if (max_cnt != 0) {
-                max_cnt = MIN(sizeof(cdc_tx_buf), max_cnt);
-                cnt = xStreamBufferReceive(stream_uart, cdc_tx_buf, max_cnt, pdMS_TO_TICKS(500));
+        {
+            const uint8_t *data;
+            uint32_t cnt;
+            uint32_t max_cnt;
+
+            max_cnt = host_write_available();
+
+            cnt = uart_rx_chunk(&data);
+            cnt = MIN(max_cnt, cnt);
+            if (cnt != 0) {
+                host_write(data, cnt);
+                uart_rx_consume(cnt);
+                max_cnt -= cnt;
+            }
+
+            cnt = MIN(max_cnt, sizeof(cdc_tx_buf));
+            if (cnt != 0  &&  !xStreamBufferIsEmpty(stream_uart)) {
+                cnt = xStreamBufferReceive(stream_uart, cdc_tx_buf, cnt, 0);
                 if (cnt != 0) {
-                    tud_cdc_n_write(CDC_UART_N, cdc_tx_buf, cnt);
+                    host_write(cdc_tx_buf, cnt);
                 }
             }
-        }
-        else {
-            tud_cdc_n_write_flush(CDC_UART_N);
+
+            if (dma_rx_ring_is_empty(&uart_rx)  &&  xStreamBufferIsEmpty(stream_uart)) {
+                tud_cdc_n_write_flush(CDC_UART_N);
+            }
         }
 
         //
         // host -> probe -> target
-        // -----------------------
-        // Characters are transferred bytewise to keep delays into the other direction low.
-        // So this is not a high throughput solution...
         //
         cdc_rx_chars = tud_cdc_n_available(CDC_UART_N);
         if (cdc_rx_chars != 0) {
@@ -152,23 +462,28 @@ static void cdc_thread(void *ptr)
             else {
                 //
                 // -> data is going thru UART
-                //    assure that the UART has free buffer, otherwise wait (for a short moment)
+                //    read as much as possible directly into uart_tx_ring, if it is full wait for DMA
                 //
-                if ( !uart_is_writable(PICOPROBE_UART_INTERFACE)) {
-                    xEventGroupWaitBits(events, EV_TX_COMPLETE | EV_STREAM | EV_RX, pdTRUE, pdFALSE, pdMS_TO_TICKS(1));
+                uint8_t *data;
+                uint32_t cnt;
+
+                cnt = uart_tx_space(&data);
+                if (cnt == 0) {
+                    xEventGroupWaitBits(events, EV_UART_TX, pdTRUE, pdFALSE, pdMS_TO_TICKS(10));
                 }
                 else {
-                    uint8_t ch;
-                    uint32_t tx_len;
-
-                    tx_len = tud_cdc_n_read(CDC_UART_N, &ch, sizeof(ch));
-                    if (tx_len != 0) {
-                        led_state(LS_UART_TX_DATA);
-                        uart_write_blocking(PICOPROBE_UART_INTERFACE, &ch, tx_len);
-                    }
+                    cnt = tud_cdc_n_read(CDC_UART_N, data, cnt);
+                    uart_tx_commit(cnt);
                 }
             }
         }
+
+#if OPT_NET_UART_SERVER
+        //
+        // TCP -> probe -> target
+        //
+        net_pending = net_to_target();
+#endif
     }
 }   // cdc_thread
 
@@ -198,6 +513,16 @@ void cdc_uart_line_state_cb(bool dtr, bool rts)
 
 
 
+void cdc_uart_notify(void)
+/**
+ * Wake up cdc_thread(), e.g. on TCP connect or new data from TCP.
+ */
+{
+    xEventGroupSetBits(events, EV_NET);
+}   // cdc_uart_notify
+
+
+
 void cdc_uart_tx_complete_cb(void)
 {
     xEventGroupSetBits(events, EV_TX_COMPLETE);
@@ -219,7 +544,7 @@ static uint32_t cdc_uart_put_into_stream(const void *data, size_t len, bool in_i
 {
     uint32_t r = 0;
 
-    if ( !m_connected) {
+    if ( !cdc_uart_is_connected()) {
         size_t available = xStreamBufferSpacesAvailable(stream_uart);
         for (;;) {
             uint8_t dummy[64];
@@ -238,6 +563,7 @@ static uint32_t cdc_uart_put_into_stream(const void *data, size_t len, bool in_i
                 break;
             }
             available += n;
+            stats_add(STATS_DROP_UART, n);
         }
     }
     if (in_isr) {
@@ -246,44 +572,13 @@ static uint32_t cdc_uart_put_into_stream(const void *data, size_t len, bool in_i
     else {
         r = xStreamBufferSend(stream_uart, data, len, 0);     // drop characters in worst case
     }
+    stats_add(STATS_DROP_UART, len - r);
 
     return r;
 }   // cdc_uart_put_into_stream
 
 
 
-void on_uart_rx(void)
-{
-    uint8_t buf[40];
-    uint32_t cnt;
-    uint8_t ch;
-
-    cnt = 0;
-    while (uart_is_readable(PICOPROBE_UART_INTERFACE)) {
-        ch = (uint8_t)uart_getc(PICOPROBE_UART_INTERFACE);
-        if (cnt < sizeof(buf)) {
-            buf[cnt++] = ch;
-        }
-    }
-
-    if (cnt != 0) {
-        led_state(LS_UART_RX_DATA);
-        cdc_uart_put_into_stream(buf, cnt, true);
-    }
-
-    {
-        BaseType_t task_woken, res;
-
-        task_woken = pdFALSE;
-        res = xEventGroupSetBitsFromISR(events, EV_STREAM, &task_woken);
-        if (res != pdFAIL) {
-            portYIELD_FROM_ISR(task_woken);
-        }
-    }
-}   // on_uart_rx
-
-
-
 uint32_t cdc_uart_write(const uint8_t *buf, uint32_t cnt)
 /**
  * Send characters from console RTT channel into stream.
@@ -326,10 +621,40 @@ void cdc_uart_init(uint32_t task_prio)
     uart_set_format(PICOPROBE_UART_INTERFACE, 8, 1, UART_PARITY_NONE);
     uart_set_fifo_enabled(PICOPROBE_UART_INTERFACE, true);
 
-    int UART_IRQ = (PICOPROBE_UART_INTERFACE == uart0) ? UART0_IRQ : UART1_IRQ;
-    irq_set_exclusive_handler(UART_IRQ, on_uart_rx);
-    irq_set_enabled(UART_IRQ, true);
-    uart_set_irq_enables(PICOPROBE_UART_INTERFACE, true, false);
+    // receive via DMA into uart_rx_ring, uart_init() has already enabled the DMA requests of the UART
+    {
+        dma_channel_config c;
+
+        dma_rx_ring_init(&uart_rx, UART_RX_RING_SIZE, UART_RX_MARGIN, UART_RX_DMA_COUNT);
+        uart_rx_dma = dma_claim_unused_channel(true);
+        c = dma_channel_get_default_config(uart_rx_dma);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, UART_RX_RING_BITS);
+        channel_config_set_dreq(&c, uart_get_dreq(PICOPROBE_UART_INTERFACE, false));
+        dma_channel_configure(uart_rx_dma, &c, uart_rx_ring, &uart_get_hw(PICOPROBE_UART_INTERFACE)->dr,
+                              UART_RX_DMA_COUNT, true);
+        add_repeating_timer_us(-UART_RX_POLL_US, uart_rx_timer_cb, NULL, &uart_rx_timer);
+    }
+
+    // transmit via DMA from uart_tx_ring, DMA_IRQ_0 is used exclusively by sigrok
+    {
+        dma_channel_config c;
+
+        dma_tx_ring_init(&uart_tx, UART_TX_RING_SIZE);
+        uart_tx_dma = dma_claim_unused_channel(true);
+        c = dma_channel_get_default_config(uart_tx_dma);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, uart_get_dreq(PICOPROBE_UART_INTERFACE, true));
+        dma_channel_configure(uart_tx_dma, &c, &uart_get_hw(PICOPROBE_UART_INTERFACE)->dr, uart_tx_ring, 0, false);
+
+        irq_add_shared_handler(DMA_IRQ_1, uart_tx_dma_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        dma_channel_set_irq1_enabled(uart_tx_dma, true);
+        irq_set_enabled(DMA_IRQ_1, true);
+    }
 
     /* UART needs to preempt USB as if we don't, characters get lost */
     xTaskCreate(cdc_thread, "CDC-TargetUart", configMINIMAL_STACK_SIZE, NULL, task_prio, &task_uart);
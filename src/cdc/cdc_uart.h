@@ -38,6 +38,7 @@
     void cdc_uart_line_coding_cb(cdc_line_coding_t const* line_coding);
     void cdc_uart_tx_complete_cb(void);
     void cdc_uart_rx_cb(void);
+    void cdc_uart_notify(void);
 #endif
 
 #endif
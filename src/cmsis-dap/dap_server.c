@@ -32,6 +32,7 @@
 
 #include "FreeRTOS.h"
 #include "event_groups.h"
+#include "semphr.h"
 #include "task.h"
 
 #include "tusb.h"
@@ -43,11 +44,18 @@
 #include "DAP.h"
 #include "led.h"
 #include "sw_lock.h"
+#include "stats_counter.h"
+#include "stats_histogram.h"
+#if OPT_EVENT_STREAM
+    #include "event_stream.h"
+#endif
 
 
 #if OPT_CMSIS_DAPV2
     static TaskHandle_t        dap_taskhandle = NULL;
     static EventGroupHandle_t  dap_events;
+    static volatile uint32_t   dap_rx_us;                // arrival of the first request not yet read by dap_task()
+    static volatile bool       dap_rx_pending;
 #endif
 
 
@@ -76,9 +84,14 @@
 #define _DAP_PACKET_COUNT_HID       1
 #define _DAP_PACKET_SIZE_HID        64
 
+// used by the DAP library, set from the transport of the request by dap_server_execute()
 uint8_t  dap_packet_count = _DAP_PACKET_COUNT_UNKNOWN;
 uint16_t dap_packet_size  = _DAP_PACKET_SIZE_UNKNOWN;
 
+#if OPT_CMSIS_DAPV1  ||  OPT_CMSIS_DAPV2  ||  OPT_NET_DAP_SERVER
+    static SemaphoreHandle_t   dap_execute_mutex;   // serializes requests of the transports
+#endif
+
 #if (CFG_TUD_VENDOR_RX_BUFSIZE < _DAP_PACKET_SIZE_OPENOCD  ||  CFG_TUD_VENDOR_RX_BUFSIZE < _DAP_PACKET_SIZE_PYOCD)
     #error "increase CFG_TUD_VENDOR_RX_BUFSIZE"
 #endif
@@ -92,10 +105,80 @@ uint16_t dap_packet_size  = _DAP_PACKET_SIZE_UNKNOWN;
 
 
 
+#if OPT_CMSIS_DAPV1  ||  OPT_CMSIS_DAPV2  ||  OPT_NET_DAP_SERVER
+static void dap_count_request(const uint8_t *request)
+/**
+ * Count DAP requests by command ID.  Commands in ID_DAP_ExecuteCommands are not counted individually.
+ */
+{
+    uint8_t id = request[0];
+
+    stats_inc(STATS_DAP_REQUEST);
+    if (id < STATS_DAP_CMD_IDS) {
+        stats_inc(STATS_DAP_CMD_0 + id);
+    }
+    else if (id >= ID_DAP_Vendor0  &&  id <= ID_DAP_Vendor31) {
+        stats_inc(STATS_DAP_CMD_VENDOR);
+    }
+    else {
+        stats_inc(STATS_DAP_CMD_OTHER);
+    }
+}   // dap_count_request
+
+
+
+static void dap_hist_add_exec(const uint8_t *request, uint32_t duration_us)
+/**
+ * Add execution time of a DAP request to the histogram of its command ID.
+ */
+{
+    uint8_t id = request[0];
+
+    stats_hist_add((id < STATS_DAP_CMD_IDS) ? HIST_DAP_EXEC_0 + id : HIST_DAP_EXEC_OTHER, duration_us);
+}   // dap_hist_add_exec
+#endif
+
+
+
+#if OPT_CMSIS_DAPV1  ||  OPT_CMSIS_DAPV2  ||  OPT_NET_DAP_SERVER
+uint32_t dap_server_execute(const dap_transport_t *transport, const uint8_t *request, uint8_t *response)
+/**
+ * Execute a DAP request including counters and histogram.
+ * The DAP library takes packet count/size from globals, so they are set from \a transport
+ * for the duration of the request.  Requests of the different transports are serialized.
+ * Locking of the SWD interface is up to the caller.
+ *
+ * \return same as DAP_ExecuteCommand()
+ */
+{
+    uint32_t start_us;
+    uint32_t resp_len;
+
+    xSemaphoreTake(dap_execute_mutex, portMAX_DELAY);
+
+    dap_packet_count = transport->packet_count;
+    dap_packet_size  = transport->packet_size;
+
+    start_us = time_us_32();
+    dap_count_request(request);
+    resp_len = DAP_ExecuteCommand(request, response);
+    dap_hist_add_exec(request, time_us_32() - start_us);
+
+    xSemaphoreGive(dap_execute_mutex);
+    return resp_len;
+}   // dap_server_execute
+#endif
+
+
+
 #if OPT_CMSIS_DAPV2
 void tud_vendor_rx_cb(uint8_t itf)
 {
     if (itf == 0) {
+        if ( !dap_rx_pending) {
+            dap_rx_us = time_us_32();
+            dap_rx_pending = true;
+        }
         xEventGroupSetBits(dap_events, 0x01);
     }
 }   // tud_vendor_rx_cb
@@ -104,6 +187,8 @@ void tud_vendor_rx_cb(uint8_t itf)
 
 
 #if OPT_CMSIS_DAPV2
+static dap_transport_t dap_v2_transport;
+
 /**
  * CMSIS-DAP task.
  * Receive DAP requests, execute them via DAP_ExecuteCommand() and transmit the response.
@@ -125,22 +210,26 @@ void dap_task(void *ptr)
     bool swd_disconnect_requested = false;
     uint32_t last_request_us = 0;
     uint32_t rx_len = 0;
+    uint32_t rx_arrival_us = 0;
     daptool_t tool = E_DAPTOOL_UNKNOWN;
 
-    dap_packet_count = _DAP_PACKET_COUNT_UNKNOWN;
-    dap_packet_size  = _DAP_PACKET_SIZE_UNKNOWN;
+    dap_v2_transport.packet_count = _DAP_PACKET_COUNT_UNKNOWN;
+    dap_v2_transport.packet_size  = _DAP_PACKET_SIZE_UNKNOWN;
     for (;;) {
         // disconnect after 1s without data
         if (swd_disconnect_requested  &&  time_us_32() - last_request_us > 1000000) {
             if (swd_connected) {
                 swd_connected = false;
                 picoprobe_info("=================================== DAPv2 disconnect target\n");
+#if OPT_EVENT_STREAM
+                event_stream_probe(EVENT_PROBE_DISCONNECT, "DAPv2");
+#endif
                 led_state(LS_DAPV2_DISCONNECTED);
                 sw_unlock("DAPv2");
             }
             swd_disconnect_requested = false;
-            dap_packet_count = _DAP_PACKET_COUNT_UNKNOWN;
-            dap_packet_size  = _DAP_PACKET_SIZE_UNKNOWN;
+            dap_v2_transport.packet_count = _DAP_PACKET_COUNT_UNKNOWN;
+            dap_v2_transport.packet_size  = _DAP_PACKET_SIZE_UNKNOWN;
             tool = DAP_FingerprintTool(NULL, 0);
         }
 
@@ -148,6 +237,10 @@ void dap_task(void *ptr)
 
         if (tud_vendor_available())
         {
+            if (rx_len == 0) {
+                rx_arrival_us = dap_rx_us;
+            }
+            dap_rx_pending = false;
             rx_len += tud_vendor_read(RxDataBuffer + rx_len, sizeof(RxDataBuffer));
 
             if (rx_len != 0)
@@ -166,30 +259,34 @@ void dap_task(void *ptr)
                     if (tool == E_DAPTOOL_UNKNOWN) {
                         tool = DAP_FingerprintTool(RxDataBuffer, request_len);
                         if (tool == E_DAPTOOL_OPENOCD) {
-                            dap_packet_count = _DAP_PACKET_COUNT_OPENOCD;
-                            dap_packet_size  = _DAP_PACKET_SIZE_OPENOCD;
+                            dap_v2_transport.packet_count = _DAP_PACKET_COUNT_OPENOCD;
+                            dap_v2_transport.packet_size  = _DAP_PACKET_SIZE_OPENOCD;
                         }
                         else if (tool == E_DAPTOOL_PYOCD) {
-                            dap_packet_count = _DAP_PACKET_COUNT_PYOCD;
-                            dap_packet_size  = _DAP_PACKET_SIZE_PYOCD;
+                            dap_v2_transport.packet_count = _DAP_PACKET_COUNT_PYOCD;
+                            dap_v2_transport.packet_size  = _DAP_PACKET_SIZE_PYOCD;
                         }
                         else if (tool == E_DAPTOOL_PROBERS) {
-                            dap_packet_count = _DAP_PACKET_COUNT_PROBERS;
-                            dap_packet_size  = _DAP_PACKET_SIZE_PROBERS;
+                            dap_v2_transport.packet_count = _DAP_PACKET_COUNT_PROBERS;
+                            dap_v2_transport.packet_size  = _DAP_PACKET_SIZE_PROBERS;
                         }
                     }
 
                     //
                     // initiate SWD connect / disconnect
                     //
-                    if ( !swd_connected  &&  RxDataBuffer[0] != ID_DAP_Info) {
+                    if ( !swd_connected  &&  RxDataBuffer[0] != ID_DAP_Info  &&  !DAP_IS_VENDOR_STATS_COMMAND(RxDataBuffer[0])) {
                         if (sw_lock("DAPv2", true)) {
                             swd_connected = true;
                             picoprobe_info("=================================== DAPv2 connect target, host %s, buffer: %dx%dbytes\n",
                                     (tool == E_DAPTOOL_OPENOCD) ? "OpenOCD with two big buffers" :
                                      (tool == E_DAPTOOL_PYOCD) ? "pyOCD with single big buffer"  :
-                                      (tool == E_DAPTOOL_PROBERS) ? "probe-rs" : "UNKNOWN", dap_packet_count, dap_packet_size);
+                                      (tool == E_DAPTOOL_PROBERS) ? "probe-rs" : "UNKNOWN",
+                                    dap_v2_transport.packet_count, dap_v2_transport.packet_size);
                             led_state(LS_DAPV2_CONNECTED);
+#if OPT_EVENT_STREAM
+                            event_stream_probe(EVENT_PROBE_CONNECT, "DAPv2");
+#endif
                         }
                     }
                     if (RxDataBuffer[0] == ID_DAP_Disconnect  ||  RxDataBuffer[0] == ID_DAP_Info  ||  RxDataBuffer[0] == ID_DAP_HostStatus) {
@@ -229,7 +326,8 @@ void dap_task(void *ptr)
                         }
                         picoprobe_info_out("\n");
 #else
-                        resp_len = DAP_ExecuteCommand(RxDataBuffer, TxDataBuffer);
+                        stats_hist_add(HIST_DAP_QUEUE, time_us_32() - rx_arrival_us);
+                        resp_len = dap_server_execute(&dap_v2_transport, RxDataBuffer, TxDataBuffer);
 #endif
 
 //                        picoprobe_info(">>>(%lx) %d %d %d %d\n", resp_len, TxDataBuffer[0], TxDataBuffer[1], TxDataBuffer[2], TxDataBuffer[3]);
@@ -305,6 +403,11 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
 
 
 #if OPT_CMSIS_DAPV1
+// this is the minimum version which should always work
+static const dap_transport_t dap_v1_transport = {
+    .packet_count = _DAP_PACKET_COUNT_HID,
+    .packet_size  = _DAP_PACKET_SIZE_HID,
+};
 static bool hid_swd_connected;
 static bool hid_swd_disconnect_requested;
 static TimerHandle_t     timer_hid_disconnect = NULL;
@@ -316,6 +419,9 @@ static void hid_disconnect(TimerHandle_t xTimer)
     if (hid_swd_disconnect_requested  &&  hid_swd_connected) {
         hid_swd_connected = false;
         picoprobe_info("=================================== DAPv1 disconnect target\n");
+#if OPT_EVENT_STREAM
+        event_stream_probe(EVENT_PROBE_DISCONNECT, "DAPv1");
+#endif
         led_state(LS_DAPV1_DISCONNECTED);
         sw_unlock("DAPv1");
     }
@@ -358,19 +464,18 @@ void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t rep
     //
     // initiate SWD connect / disconnect
     //
-    if ( !hid_swd_connected  &&  RxDataBuffer[0] != ID_DAP_Info) {
+    if ( !hid_swd_connected  &&  RxDataBuffer[0] != ID_DAP_Info  &&  !DAP_IS_VENDOR_STATS_COMMAND(RxDataBuffer[0])) {
         if (sw_lock("DAPv1", true)) {
             hid_swd_connected = true;
             picoprobe_info("=================================== DAPv1 connect target\n");
+#if OPT_EVENT_STREAM
+            event_stream_probe(EVENT_PROBE_CONNECT, "DAPv1");
+#endif
             led_state(LS_DAPV1_CONNECTED);
         }
     }
     if (RxDataBuffer[0] == ID_DAP_Disconnect  ||  RxDataBuffer[0] == ID_DAP_Info  ||  RxDataBuffer[0] == ID_DAP_HostStatus) {
         hid_swd_disconnect_requested = true;
-
-        // this is the minimum version which should always work
-        dap_packet_count = _DAP_PACKET_COUNT_HID;
-        dap_packet_size  = _DAP_PACKET_SIZE_HID;
     }
     else {
         hid_swd_disconnect_requested = false;
@@ -403,7 +508,7 @@ void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t rep
         }
         picoprobe_info_out("\n");
 #else
-        uint32_t res = DAP_ExecuteCommand(RxDataBuffer, TxDataBuffer);
+        uint32_t res = dap_server_execute(&dap_v1_transport, RxDataBuffer, TxDataBuffer);
 #endif
         tud_hid_report(0, TxDataBuffer, res & 0xffff);
     }
@@ -416,6 +521,13 @@ void dap_server_init(uint32_t task_prio)
 {
     picoprobe_debug("dap_server_init(%u)\n", (unsigned)task_prio);
 
+#if OPT_CMSIS_DAPV1  ||  OPT_CMSIS_DAPV2  ||  OPT_NET_DAP_SERVER
+    dap_execute_mutex = xSemaphoreCreateMutex();
+    if (dap_execute_mutex == NULL) {
+        panic("dap_server_init: cannot create dap_execute_mutex\n");
+    }
+#endif
+
 #if OPT_CMSIS_DAPV2
     dap_events = xEventGroupCreate();
     xTaskCreate(dap_task, "CMSIS-DAPv2", configMINIMAL_STACK_SIZE, NULL, task_prio, &dap_taskhandle);
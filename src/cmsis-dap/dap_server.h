@@ -35,7 +35,15 @@
 #endif
 
 
+/// DAP packet parameters of a transport (CMSIS-DAPv1/v2, TCP), reported to the host via ID_DAP_Info
+typedef struct {
+    uint8_t  packet_count;
+    uint16_t packet_size;
+} dap_transport_t;
+
+
 void dap_server_init(uint32_t task_prio);
+uint32_t dap_server_execute(const dap_transport_t *transport, const uint8_t *request, uint8_t *response);
 
 
 #ifdef __cplusplus
@@ -205,6 +205,19 @@ static uint32_t DAP_Check_TransferBlock(const uint8_t *request, uint32_t request
  */
 __WEAK uint32_t DAP_Check_ProcessVendorCommand(const uint8_t *request, uint32_t request_len)
 {
+    if (request[0] == ID_DAP_VENDOR_STATS  ||  request[0] == ID_DAP_VENDOR_HIST)
+    {
+        return 1 + 2;
+    }
+    if (request[0] == ID_DAP_VENDOR_FLASH)
+    {
+        if (request_len < 1 + 1  ||  (request[1] == DAP_VENDOR_FLASH_WRITE  &&  request_len < 1 + 1 + 4 + 1))
+        {
+            return DAP_CHECK_ABORT;
+        }
+        return 1 + DAP_VendorFlashRequestLength(request + 1);
+    }
+
     // actually this should result in an assertion (thanks to the protocol definition without length spec)
     return 1;
 }   // DAP_Check_ProcessVendorCommand
@@ -472,5 +485,6 @@ bool DAP_OfflineCommand(const uint8_t *request_data)
             ||  *request_data == ID_DAP_HostStatus
             ||  *request_data == ID_DAP_Connect
             ||  *request_data == ID_DAP_Disconnect
-            ||  *request_data == ID_DAP_SWJ_Clock;          // this is not true, but unfortunately pyOCD does it
+            ||  *request_data == ID_DAP_SWJ_Clock           // this is not true, but unfortunately pyOCD does it
+            ||  DAP_IS_VENDOR_STATS_COMMAND(*request_data);
 }   // DAP_OfflineCommand
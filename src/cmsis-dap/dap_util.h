@@ -39,6 +39,24 @@ typedef enum {
 
 static const uint32_t DAP_CHECK_ABORT = 99999999;
 
+// vendor commands, see dap_vendor.c
+#define ID_DAP_VENDOR_STATS         ID_DAP_Vendor0
+#define ID_DAP_VENDOR_HIST          ID_DAP_Vendor1
+#define ID_DAP_VENDOR_STATS_RESET   ID_DAP_Vendor2
+#define ID_DAP_VENDOR_FLASH         ID_DAP_Vendor3
+
+// operations of ID_DAP_VENDOR_FLASH
+#define DAP_VENDOR_FLASH_OPEN       0
+#define DAP_VENDOR_FLASH_WRITE      1
+#define DAP_VENDOR_FLASH_CLOSE      2
+
+// request length of ID_DAP_VENDOR_FLASH without ID, request points behind the ID
+#define DAP_VendorFlashRequestLength(request)  \
+    (((request)[0] == DAP_VENDOR_FLASH_WRITE) ? 1U + 4U + 1U + (request)[5] : 1U)
+
+// vendor commands which do not require a target connection
+#define DAP_IS_VENDOR_STATS_COMMAND(id)  ((id) >= ID_DAP_VENDOR_STATS  &&  (id) <= ID_DAP_VENDOR_STATS_RESET)
+
 uint32_t DAP_GetCommandLength(const uint8_t *request_data, uint32_t request_len);
 daptool_t DAP_FingerprintTool(const uint8_t *request, uint32_t request_len);
 bool DAP_OfflineCommand(const uint8_t *request_data);
@@ -0,0 +1,222 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Vendor specific CMSIS-DAP commands.  This replaces CMSIS_5/CMSIS/DAP/Firmware/Source/DAP_vendor.c
+ * which is only a template.
+ *
+ * Length of the requests is checked in DAP_Check_ProcessVendorCommand() in dap_util.c.
+ *
+ * ID_DAP_VENDOR_STATS - read the counter snapshot, format see stats_counter.h
+ *    request:  ID, offset[15:0]
+ *    response: ID, cnt, data[cnt]
+ *    A request with offset 0 takes a new snapshot, requests with offset != 0 read the remaining
+ *    parts of it.  The snapshot is complete if cnt is less than the maximum possible payload.
+ *
+ * ID_DAP_VENDOR_HIST - read the latency histograms, format see stats_histogram.h
+ *    request:  ID, offset[15:0]
+ *    response: ID, cnt, data[cnt]
+ *    Same as ID_DAP_VENDOR_STATS, but data is taken from the live histograms.
+ *
+ * ID_DAP_VENDOR_STATS_RESET - reset counters and histograms
+ *    request:  ID
+ *    response: ID, DAP_OK
+ *
+ * ID_DAP_VENDOR_FLASH - program the target flash with the probe's flash algorithm
+ *    request:  ID, DAP_VENDOR_FLASH_OPEN
+ *              ID, DAP_VENDOR_FLASH_WRITE, addr[31:0], cnt, data[cnt]
+ *              ID, DAP_VENDOR_FLASH_CLOSE
+ *    response: ID, DAP_OK/DAP_ERROR, error_t
+ *    Same path as drag-n-drop via flash_manager/target_flash, so generic targets are programmed with
+ *    the FLM stored by flm_loader.c.  Erase is done on demand by sector.  OPEN redetects the target,
+ *    CLOSE writes pending data and resets the target.
+ */
+
+#include <string.h>
+
+#include <pico/stdlib.h>
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "dap_util.h"
+#include "stats_counter.h"
+#include "stats_histogram.h"
+
+#include "target_board.h"
+#include "error.h"
+#include "flash_intf.h"
+#include "flash_manager.h"
+
+
+static uint8_t  stats_snapshot_buf[STATS_SNAPSHOT_SIZE];
+static uint32_t stats_snapshot_len;
+static bool     flash_is_open;
+
+
+
+static uint32_t DAP_VendorStats(const uint8_t *request, uint8_t *response)
+/**
+ * Return a part of the counter snapshot.
+ *
+ * \return number of bytes in response
+ */
+{
+    uint32_t offset;
+    uint32_t cnt;
+
+    offset = (uint32_t)request[0] | ((uint32_t)request[1] << 8);
+    if (offset == 0) {
+        stats_snapshot_len = stats_snapshot(stats_snapshot_buf, sizeof(stats_snapshot_buf));
+    }
+
+    cnt = (offset < stats_snapshot_len) ? stats_snapshot_len - offset : 0;
+    cnt = MIN(cnt, (uint32_t)dap_packet_size - 2);
+    cnt = MIN(cnt, 255);
+
+    response[0] = (uint8_t)cnt;
+    memcpy(response + 1, stats_snapshot_buf + offset, cnt);
+    return 1 + cnt;
+}   // DAP_VendorStats
+
+
+
+static uint32_t DAP_VendorHist(const uint8_t *request, uint8_t *response)
+/**
+ * Return a part of the histogram snapshot.
+ *
+ * \return number of bytes in response
+ */
+{
+    uint32_t offset;
+    uint32_t cnt;
+
+    offset = (uint32_t)request[0] | ((uint32_t)request[1] << 8);
+    cnt = MIN((uint32_t)dap_packet_size - 2, 255);
+    cnt = stats_hist_read(response + 1, offset, cnt);
+
+    response[0] = (uint8_t)cnt;
+    return 1 + cnt;
+}   // DAP_VendorHist
+
+
+
+static uint32_t DAP_VendorFlash(const uint8_t *request, uint8_t *response)
+/**
+ * Open/write/close a flash session on the target.
+ *
+ * \return number of bytes in response
+ */
+{
+    error_t sts;
+
+    switch (request[0]) {
+        case DAP_VENDOR_FLASH_OPEN:
+            if (flash_is_open) {
+                // previous session was not closed, e.g. tool aborted
+                flash_manager_uninit();
+                flash_is_open = false;
+            }
+            if (g_board_info.prerun_board_config != NULL) {
+                g_board_info.prerun_board_config();
+            }
+            if (g_board_info.target_cfg->flash_regions[0].flash_algo == NULL) {
+                sts = ERROR_ALGO_MISSING;
+            }
+            else {
+                flash_manager_set_page_erase(true);
+                sts = flash_manager_init(flash_intf_target);
+                flash_is_open = (sts == ERROR_SUCCESS);
+            }
+            break;
+
+        case DAP_VENDOR_FLASH_WRITE:
+            if ( !flash_is_open) {
+                sts = ERROR_INTERNAL;
+            }
+            else {
+                uint32_t addr = (uint32_t)request[1]         | ((uint32_t)request[2] << 8)
+                              | ((uint32_t)request[3] << 16) | ((uint32_t)request[4] << 24);
+
+                sts = flash_manager_data(addr, request + 6, request[5]);
+            }
+            break;
+
+        case DAP_VENDOR_FLASH_CLOSE:
+            sts = flash_is_open ? flash_manager_uninit() : ERROR_INTERNAL;
+            flash_is_open = false;
+            break;
+
+        default:
+            sts = ERROR_INTERNAL;
+            break;
+    }
+
+    response[0] = (sts == ERROR_SUCCESS) ? DAP_OK : DAP_ERROR;
+    response[1] = (uint8_t)sts;
+    return 2;
+}   // DAP_VendorFlash
+
+
+
+/**
+ * Process vendor command
+ *
+ * \param request   pointer to request data
+ * \param response  pointer to response data
+ * \return          number of bytes in response (lower 16 bits), number of bytes in request (upper 16 bits)
+ */
+uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *response)
+{
+    uint32_t num = (1U << 16) | 1U;
+
+    *response++ = *request;        // copy Command ID
+
+    switch (*request++) {
+        case ID_DAP_VENDOR_STATS:
+            num += (2U << 16) + DAP_VendorStats(request, response);
+            break;
+
+        case ID_DAP_VENDOR_HIST:
+            num += (2U << 16) + DAP_VendorHist(request, response);
+            break;
+
+        case ID_DAP_VENDOR_STATS_RESET:
+            stats_reset();
+            stats_hist_reset();
+            *response = DAP_OK;
+            num += 1;
+            break;
+
+        case ID_DAP_VENDOR_FLASH:
+            num += (DAP_VendorFlashRequestLength(request) << 16) + DAP_VendorFlash(request, response);
+            break;
+
+        default:
+            *(response - 1) = ID_DAP_Invalid;
+            break;
+    }
+
+    return num;
+}   // DAP_ProcessVendorCommand
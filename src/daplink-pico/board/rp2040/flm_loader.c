@@ -0,0 +1,398 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Storage of a CMSIS-Pack flash algorithm (.FLM) in the probe flash and setup of a generic
+ * target with it.
+ *
+ * The FLM is dropped onto the MSC drive.  Its sectors are stored directly into a reserved flash
+ * area of the probe below the minIni storage.  The algorithm is used on the next target detection
+ * if no other target has been recognized.
+ *
+ * Memory layout of the algorithm on the target (starting at ram_regions[0].start):
+ * - algo blob (breakpoint, code, data)
+ * - program buffer(s), second one only if RAM is big enough
+ * - stack
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+#include <pico/flash.h>
+#include <hardware/flash.h>
+
+#include "picoprobe_config.h"
+#include "minIni/minIniConfig.h"
+
+#include "target_board.h"
+
+#include "flm_loader.h"
+#include "flm_parser.h"
+
+
+
+#define FLM_STORE_SIZE          (64 * 1024)
+#define FLM_STORE_ADDR          (MININI_CONFIG_FLASH_NVM_ADDR_START - FLM_STORE_SIZE)
+#define FLM_STORE_DATA_ADDR     (FLM_STORE_ADDR + FLASH_SECTOR_SIZE)
+#define FLM_STORE_DATA_MAX      (FLM_STORE_SIZE - FLASH_SECTOR_SIZE)
+#define FLM_STORE_MAGIC         0x314d4c46                                // "FLM1"
+
+#define FLM_BLOB_MAX_SIZE       (8 * 1024)
+#define FLM_PROGRAM_BUFFER_MAX  1024
+#define FLM_STACK_SIZE          1024
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+} flm_store_hdr_t;
+
+// generated algo, members are const, so it is filled via memcpy()
+static program_target_t   flm_algo;
+static sector_info_t      flm_sectors[FLM_SECTORS_MAX];
+static uint32_t           flm_blob[FLM_BLOB_MAX_SIZE / sizeof(uint32_t)];
+static char               flm_dev_name[sizeof(((flm_info_t *)0)->dev_name)];
+
+// receiving a FLM via MSC, sectors are collected by their offset to the sector with the ELF header
+#define FLM_RX_SECTOR_SIZE_MIN  512
+#define FLM_RX_SECTORS_MAX      (FLM_STORE_DATA_MAX / FLM_RX_SECTOR_SIZE_MIN)
+
+static bool               rx_active;
+static uint32_t           rx_lba_start;
+static uint32_t           rx_sector_size;
+static uint32_t           rx_size;
+static uint32_t           rx_sector_map[(FLM_RX_SECTORS_MAX + 31) / 32];   // received sectors
+static uint32_t           rx_page_map;                                     // pages already in flash
+static int                rx_page_ndx;                                     // page in rx_page, -1 -> none
+static bool               rx_page_dirty;
+__attribute__((aligned(4)))
+static uint8_t            rx_page[FLASH_SECTOR_SIZE];
+static uint32_t           rx_page_offs;
+
+// upload window as seen by the MSC write callback, see flm_loader_msc_accept()
+static bool               accept_active;
+static uint32_t           accept_lba_start;
+static uint32_t           accept_sector_size;
+
+
+
+static void flm_flash_sector(void *param)
+{
+    flash_range_erase(rx_page_offs, FLASH_SECTOR_SIZE);
+    flash_range_program(rx_page_offs, rx_page, FLASH_SECTOR_SIZE);
+}   // flm_flash_sector
+
+
+
+/**
+ * Write \a rx_page into the probe flash at \a addr.
+ */
+static bool flm_write_page(uint32_t addr)
+{
+    int r;
+
+    rx_page_offs = addr - XIP_BASE;
+    r = flash_safe_execute(flm_flash_sector, NULL, 100);
+    if (r != PICO_OK) {
+        picoprobe_error("flm_write_page: cannot write to 0x%08x (%d)\n", (unsigned)addr, r);
+        return false;
+    }
+    return true;
+}   // flm_write_page
+
+
+
+/**
+ * Setup the generic target \a cfg with the stored flash algorithm.
+ * Flash region, sector information and flash algo are taken from the FLM.
+ *
+ * \return true if a valid algorithm is available
+ */
+bool flm_loader_setup_target(target_cfg_t *cfg)
+{
+    const flm_store_hdr_t *hdr = (const flm_store_hdr_t *)FLM_STORE_ADDR;
+    flm_info_t info;
+    uint32_t ram_start = cfg->ram_regions[0].start;
+    uint32_t ram_end   = cfg->ram_regions[0].end;
+    uint32_t buffer_size;
+    uint32_t buffer;
+    uint32_t buffer_2nd;
+    uint32_t stack;
+
+    if (hdr->magic != FLM_STORE_MAGIC  ||  hdr->size > FLM_STORE_DATA_MAX)
+        return false;
+
+    if ( !flm_parse((const uint8_t *)FLM_STORE_DATA_ADDR, hdr->size, flm_blob, sizeof(flm_blob), &info)) {
+        picoprobe_error("flm_loader_setup_target: stored FLM is invalid\n");
+        return false;
+    }
+
+    // layout in target RAM
+    buffer_size = MIN(info.page_size, FLM_PROGRAM_BUFFER_MAX);
+    buffer      = ram_start + ((info.blob_size + 7) & ~7);
+    buffer_2nd  = buffer + buffer_size;
+    stack       = buffer_2nd + buffer_size + FLM_STACK_SIZE;
+    if (stack > ram_end) {
+        // no room for double buffering
+        buffer_2nd = 0;
+        stack      = buffer + buffer_size + FLM_STACK_SIZE;
+        if (stack > ram_end) {
+            picoprobe_error("flm_loader_setup_target: target RAM too small for '%s'\n", info.dev_name);
+            return false;
+        }
+    }
+
+    {
+        const program_target_t algo = {
+            .init                 = ram_start + info.init,
+            .uninit               = ram_start + info.uninit,
+            .erase_chip           = ram_start + info.erase_chip,
+            .erase_sector         = ram_start + info.erase_sector,
+            .program_page         = ram_start + info.program_page,
+            .verify               = (info.verify != 0) ? ram_start + info.verify : 0,
+            .sys_call_s = {
+                .breakpoint       = ram_start + 1,
+                .static_base      = ram_start + info.static_base,
+                .stack_pointer    = stack,
+            },
+            .program_buffer       = buffer,
+            .algo_start           = ram_start,
+            .algo_size            = info.blob_size,
+            .algo_blob            = flm_blob,
+            .program_buffer_size  = buffer_size,
+            .algo_flags           = 0,
+            .program_buffer_2nd   = buffer_2nd,
+        };
+        memcpy(&flm_algo, &algo, sizeof(algo));
+    }
+
+    for (uint32_t n = 0;  n < info.sector_cnt;  ++n) {
+        const sector_info_t sector = { .start = info.sectors[n].start, .size = info.sectors[n].size };
+        memcpy(flm_sectors + n, &sector, sizeof(sector));
+    }
+
+    strcpy(flm_dev_name, info.dev_name);
+
+    cfg->sectors_info                = flm_sectors;
+    cfg->sector_info_length          = info.sector_cnt;
+    cfg->flash_regions[0].start      = info.dev_addr;
+    cfg->flash_regions[0].end        = info.dev_addr + info.dev_size;
+    cfg->flash_regions[0].flags      = kRegionIsDefault;
+    cfg->flash_regions[0].flash_algo = &flm_algo;
+    cfg->target_part_number          = flm_dev_name;
+    cfg->rt_uf2_id                   = UF2_ID_ANY;
+
+    picoprobe_info("FLM: '%s' @ 0x%08x, %u KB, page %u, algo %u bytes%s\n", info.dev_name,
+                   (unsigned)info.dev_addr, (unsigned)(info.dev_size / 1024), (unsigned)info.page_size,
+                   (unsigned)info.blob_size, (buffer_2nd != 0) ? ", double buffered" : "");
+    return true;
+}   // flm_loader_setup_target
+
+
+
+/**
+ * Check if all sectors in [\a first, \a last) have been received.
+ */
+static bool flm_rx_complete(uint32_t first, uint32_t last)
+{
+    for (uint32_t n = first;  n < last;  ++n) {
+        if ((rx_sector_map[n / 32] & (1u << (n % 32))) == 0)
+            return false;
+    }
+    return true;
+}   // flm_rx_complete
+
+
+
+/**
+ * Write \a rx_page to the FLM store if it has been modified.
+ */
+static bool flm_rx_flush_page(void)
+{
+    if (rx_page_dirty) {
+        if ( !flm_write_page(FLM_STORE_DATA_ADDR + rx_page_ndx * FLASH_SECTOR_SIZE))
+            return false;
+        rx_page_map  |= 1u << rx_page_ndx;
+        rx_page_dirty = false;
+    }
+    return true;
+}   // flm_rx_flush_page
+
+
+
+/**
+ * Put the sector \a ndx of the FLM into \a rx_page.  If the sector belongs to another page, the current
+ * page is flushed and the new one is loaded (it could have been written partially before).
+ * A page is written as soon as it is complete.
+ */
+static bool flm_rx_store_sector(uint32_t ndx, const uint8_t *sector)
+{
+    uint32_t offs = ndx * rx_sector_size;
+    int page = offs / FLASH_SECTOR_SIZE;
+    uint32_t page_end;
+
+    if (page != rx_page_ndx) {
+        if ( !flm_rx_flush_page())
+            return false;
+        if (rx_page_map & (1u << page))
+            memcpy(rx_page, (const uint8_t *)FLM_STORE_DATA_ADDR + page * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+        else
+            memset(rx_page, 0xff, FLASH_SECTOR_SIZE);
+        rx_page_ndx = page;
+    }
+
+    memcpy(rx_page + offs % FLASH_SECTOR_SIZE, sector, rx_sector_size);
+    rx_sector_map[ndx / 32] |= 1u << (ndx % 32);
+    rx_page_dirty = true;
+
+    page_end = MIN((page + 1) * FLASH_SECTOR_SIZE, rx_size + rx_sector_size - 1);
+    if (flm_rx_complete(page * FLASH_SECTOR_SIZE / rx_sector_size, page_end / rx_sector_size))
+        return flm_rx_flush_page();
+    return true;
+}   // flm_rx_store_sector
+
+
+
+/**
+ * Check in the MSC write callback if a sector belongs to a FLM upload.  The sector is then stored by
+ * flm_loader_msc_write() in the target writer thread: erasing/programming the probe flash takes
+ * several ms per sector and must not block the USB task.
+ *
+ * A sector with an ELF header starts a new upload window, the following sectors are accepted if they
+ * are inside of it.  Validity of the FLM is checked by flm_loader_msc_write().
+ *
+ * \return true if the sector belongs to a FLM upload
+ */
+bool flm_loader_msc_accept(uint32_t lba, const uint8_t *sector, uint32_t sector_size)
+{
+    if (flm_elf_size(sector, sector_size) != 0) {
+        accept_active      = true;
+        accept_lba_start   = lba;
+        accept_sector_size = sector_size;
+        return true;
+    }
+    return accept_active  &&  sector_size == accept_sector_size
+           &&  lba >= accept_lba_start  &&  lba - accept_lba_start < FLM_STORE_DATA_MAX / accept_sector_size;
+}   // flm_loader_msc_accept
+
+
+
+/**
+ * Check if a sector written to MSC belongs to a FLM file and store it.
+ * Called by the target writer thread for sectors accepted by flm_loader_msc_accept().
+ *
+ * A FLM file is recognized by the ELF header in its first sector, another ELF header restarts the upload.
+ * The following sectors are stored by their offset to the first one, so the host may write them in any
+ * order and interleave FAT/directory writes.  The file is contiguous on the drive, because
+ * the cluster size is bigger than the FLM store.
+ *
+ * \return true if the sector has been consumed
+ */
+bool flm_loader_msc_write(uint32_t lba, const uint8_t *sector, uint32_t sector_size)
+{
+    uint32_t size;
+
+    size = flm_elf_size(sector, sector_size);
+    if (size != 0) {
+        if (rx_active) {
+            picoprobe_info("FLM: new ELF header, upload restarted\n");
+            rx_active = false;
+        }
+
+        picoprobe_info("FLM: receiving %u bytes\n", (unsigned)size);
+        if (size > FLM_STORE_DATA_MAX) {
+            picoprobe_error("flm_loader_msc_write: FLM too big (%u bytes)\n", (unsigned)size);
+            return false;
+        }
+        if (sector_size < FLM_RX_SECTOR_SIZE_MIN  ||  FLASH_SECTOR_SIZE % sector_size != 0) {
+            picoprobe_error("flm_loader_msc_write: unsupported sector size %u\n", (unsigned)sector_size);
+            return false;
+        }
+
+        // invalidate stored algorithm
+        memset(rx_page, 0xff, sizeof(rx_page));
+        if ( !flm_write_page(FLM_STORE_ADDR))
+            return false;
+
+        rx_active      = true;
+        rx_lba_start   = lba;
+        rx_sector_size = sector_size;
+        rx_size        = size;
+        rx_page_map    = 0;
+        rx_page_ndx    = -1;
+        rx_page_dirty  = false;
+        memset(rx_sector_map, 0, sizeof(rx_sector_map));
+    }
+    else if ( !rx_active  ||  sector_size != rx_sector_size
+             ||  lba < rx_lba_start  ||  lba - rx_lba_start >= FLM_STORE_DATA_MAX / rx_sector_size) {
+        // not part of the FLM, e.g. FAT or directory
+        return false;
+    }
+
+    if ( !flm_rx_store_sector(lba - rx_lba_start, sector)) {
+        rx_active = false;
+        return true;
+    }
+
+    if (flm_rx_complete(0, (rx_size + rx_sector_size - 1) / rx_sector_size)) {
+        flm_info_t info;
+
+        if ( !flm_rx_flush_page()) {
+            rx_active = false;
+            return true;
+        }
+
+        // section headers are available now, sections could follow them
+        size = flm_elf_size((const uint8_t *)FLM_STORE_DATA_ADDR, rx_size);
+        if (size == 0  ||  size > FLM_STORE_DATA_MAX) {
+            picoprobe_error("flm_loader_msc_write: invalid FLM size (%u bytes)\n", (unsigned)size);
+            rx_active = false;
+        }
+        else if (size > rx_size) {
+            // wait for the remaining sections
+            rx_size = size;
+        }
+        else {
+            rx_active = false;
+            if (flm_parse((const uint8_t *)FLM_STORE_DATA_ADDR, rx_size, flm_blob, sizeof(flm_blob), &info)) {
+                const flm_store_hdr_t hdr = { .magic = FLM_STORE_MAGIC, .size = rx_size };
+
+                memset(rx_page, 0xff, sizeof(rx_page));
+                memcpy(rx_page, &hdr, sizeof(hdr));
+                if (flm_write_page(FLM_STORE_ADDR)) {
+                    picoprobe_info("FLM: stored '%s', used on next target detection\n", info.dev_name);
+                }
+                if (g_board_info.target_cfg->flash_regions[0].flash_algo == &flm_algo) {
+                    // flm_blob has been overwritten, so the current target gets the new algorithm immediately
+                    flm_loader_setup_target(g_board_info.target_cfg);
+                }
+            }
+            else {
+                picoprobe_error("flm_loader_msc_write: invalid FLM\n");
+            }
+        }
+    }
+    return true;
+}   // flm_loader_msc_write
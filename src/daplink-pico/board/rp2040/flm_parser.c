@@ -0,0 +1,328 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Parser for CMSIS-Pack flash algorithms (.FLM).
+ *
+ * FLM files are position independent ELF files (ARM, 32bit, little endian) with the sections
+ * - PrgCode: algorithm code, linked to address 0
+ * - PrgData: RW data and zero init data (the latter as SHT_NOBITS)
+ * - DevDscr: the FlashDevice descriptor
+ * The entry points are taken from the symbol table.
+ *
+ * The generated algo blob is layouted like the DAPLink flash_blob.c files: a breakpoint instruction
+ * followed by the algorithm code and data.  The blob has to be loaded at the start of target RAM.
+ *
+ * This module has no dependencies to the probe, so it can be used on the host as well.
+ */
+
+#include <string.h>
+
+#include "flm_parser.h"
+
+
+#define ELF_HDR_SIZE            52
+#define ELF_SHDR_SIZE           40
+#define ELF_SYM_SIZE            16
+#define ELF_EM_ARM              40
+#define ELF_SHT_SYMTAB          2
+#define ELF_SHT_NOBITS          8
+
+#define FLM_BLOB_BKPT           0xE00ABE00                      // BKPT 0 + endless loop, see DAPLink flash_blob.c
+#define FLM_DEV_NAME_OFFS       2
+#define FLM_DEV_ADDR_OFFS       132
+#define FLM_DEV_SIZE_OFFS       136
+#define FLM_DEV_PAGE_OFFS       140
+#define FLM_DEV_EMPTY_OFFS      148
+#define FLM_DEV_SECTORS_OFFS    160
+#define FLM_SECTOR_END          0xffffffff
+
+
+typedef struct {
+    uint32_t name;
+    uint32_t type;
+    uint32_t addr;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t link;
+} elf_shdr_t;
+
+
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}   // rd16
+
+
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}   // rd32
+
+
+
+static bool elf_header_valid(const uint8_t *elf, uint32_t len)
+{
+    return     len >= ELF_HDR_SIZE
+           &&  elf[0] == 0x7f  &&  elf[1] == 'E'  &&  elf[2] == 'L'  &&  elf[3] == 'F'
+           &&  elf[4] == 1                                          // ELFCLASS32
+           &&  elf[5] == 1                                          // ELFDATA2LSB
+           &&  rd16(elf + 0x12) == ELF_EM_ARM
+           &&  rd16(elf + 0x2e) == ELF_SHDR_SIZE;
+}   // elf_header_valid
+
+
+
+static bool elf_get_shdr(const uint8_t *elf, uint32_t elf_size, uint32_t ndx, elf_shdr_t *sh)
+{
+    uint32_t shoff = rd32(elf + 0x20);
+    uint32_t shnum = rd16(elf + 0x30);
+    uint32_t pos;
+    const uint8_t *p;
+
+    if (ndx >= shnum)
+        return false;
+    pos = shoff + ndx * ELF_SHDR_SIZE;
+    if (pos < shoff  ||  pos > elf_size  ||  elf_size - pos < ELF_SHDR_SIZE)
+        return false;
+
+    p = elf + pos;
+    sh->name   = rd32(p + 0);
+    sh->type   = rd32(p + 4);
+    sh->addr   = rd32(p + 12);
+    sh->offset = rd32(p + 16);
+    sh->size   = rd32(p + 20);
+    sh->link   = rd32(p + 24);
+
+    if (sh->type != ELF_SHT_NOBITS) {
+        if (sh->offset > elf_size  ||  sh->size > elf_size - sh->offset)
+            return false;
+    }
+    return true;
+}   // elf_get_shdr
+
+
+
+static bool elf_str_equal(const uint8_t *elf, const elf_shdr_t *strtab, uint32_t name, const char *s)
+{
+    uint32_t len = strlen(s);
+
+    if (name >= strtab->size  ||  strtab->size - name < len + 1)
+        return false;
+    return memcmp(elf + strtab->offset + name, s, len + 1) == 0;
+}   // elf_str_equal
+
+
+
+/**
+ * Determine the size of an ELF file.
+ * If \a len covers only the ELF header, the end of the section header table is returned.  If the
+ * section headers are included, the end of the last section is taken into account as well.
+ *
+ * \return size of the ELF file, 0 if \a elf does not point to an ARM ELF file or if offsets/sizes
+ *         in the headers are out of range
+ */
+uint32_t flm_elf_size(const uint8_t *elf, uint32_t len)
+{
+    uint32_t size;
+    uint32_t shoff;
+    uint32_t shnum;
+
+    if ( !elf_header_valid(elf, len))
+        return 0;
+
+    // all values are untrusted, so every sum is checked for wrap around
+    shoff = rd32(elf + 0x20);
+    shnum = rd16(elf + 0x30);                                   // shnum * ELF_SHDR_SIZE cannot overflow
+    if (shoff > UINT32_MAX - shnum * ELF_SHDR_SIZE)
+        return 0;
+    size = shoff + shnum * ELF_SHDR_SIZE;
+
+    if (shoff <= len  &&  shnum * ELF_SHDR_SIZE <= len - shoff) {
+        // section header table is available
+        for (uint32_t n = 0;  n < shnum;  ++n) {
+            const uint8_t *sh = elf + shoff + n * ELF_SHDR_SIZE;
+            uint32_t offset = rd32(sh + 16);
+            uint32_t sh_size = rd32(sh + 20);
+
+            if (rd32(sh + 4) == ELF_SHT_NOBITS)
+                continue;
+            if (offset > UINT32_MAX - sh_size)
+                return 0;
+            if (offset + sh_size > size)
+                size = offset + sh_size;
+        }
+    }
+    return size;
+}   // flm_elf_size
+
+
+
+/**
+ * Parse a flash algorithm and create the algo blob.
+ *
+ * \param elf            FLM file contents
+ * \param elf_size       size of \a elf
+ * \param blob           destination of the algo blob
+ * \param blob_max_size  size of \a blob in bytes
+ * \param info           extracted information
+ * \return true if \a elf is a valid flash algorithm and the blob fits into \a blob
+ */
+bool flm_parse(const uint8_t *elf, uint32_t elf_size, uint32_t *blob, uint32_t blob_max_size, flm_info_t *info)
+{
+    elf_shdr_t shstrtab;
+    elf_shdr_t symtab = { 0 };
+    elf_shdr_t strtab;
+    elf_shdr_t devdscr = { 0 };
+    bool have_code = false;
+    bool have_data = false;
+    bool have_symtab = false;
+    bool have_devdscr = false;
+    uint32_t shnum;
+    uint32_t code_end = 0;
+
+    memset(info, 0, sizeof(*info));
+
+    if ( !elf_header_valid(elf, elf_size))
+        return false;
+    if ( !elf_get_shdr(elf, elf_size, rd16(elf + 0x32), &shstrtab)  ||  shstrtab.type == ELF_SHT_NOBITS)
+        return false;
+
+    //
+    // find sections and calculate blob size
+    //
+    shnum = rd16(elf + 0x30);
+    for (uint32_t n = 0;  n < shnum;  ++n) {
+        elf_shdr_t sh;
+
+        if ( !elf_get_shdr(elf, elf_size, n, &sh))
+            return false;
+
+        if (elf_str_equal(elf, &shstrtab, sh.name, "PrgCode")  ||  elf_str_equal(elf, &shstrtab, sh.name, "PrgData")) {
+            if (sh.addr + sh.size < sh.addr)
+                return false;
+            if (sh.addr + sh.size > code_end)
+                code_end = sh.addr + sh.size;
+            if (elf_str_equal(elf, &shstrtab, sh.name, "PrgCode")) {
+                have_code = true;
+            }
+            else if ( !have_data) {
+                have_data = true;
+                info->static_base = FLM_BLOB_HEADER_SIZE + sh.addr;
+            }
+        }
+        else if (elf_str_equal(elf, &shstrtab, sh.name, "DevDscr")) {
+            devdscr = sh;
+            have_devdscr = true;
+        }
+        else if (sh.type == ELF_SHT_SYMTAB) {
+            symtab = sh;
+            have_symtab = true;
+        }
+    }
+
+    if ( !have_code  ||  !have_devdscr  ||  !have_symtab)
+        return false;
+    if (devdscr.type == ELF_SHT_NOBITS  ||  devdscr.size < FLM_DEV_SECTORS_OFFS + 8)
+        return false;
+    if ( !elf_get_shdr(elf, elf_size, symtab.link, &strtab)  ||  strtab.type == ELF_SHT_NOBITS)
+        return false;
+
+    info->blob_size = FLM_BLOB_HEADER_SIZE + ((code_end + 3) & ~3);
+    if (info->blob_size > blob_max_size  ||  info->blob_size < code_end)
+        return false;
+    if ( !have_data)
+        info->static_base = info->blob_size;
+
+    //
+    // create blob: header + code + data, zero init data is cleared
+    //
+    memset(blob, 0, info->blob_size);
+    blob[0] = FLM_BLOB_BKPT;
+    for (uint32_t n = 0;  n < shnum;  ++n) {
+        elf_shdr_t sh;
+
+        elf_get_shdr(elf, elf_size, n, &sh);
+        if (sh.type != ELF_SHT_NOBITS
+            &&  (elf_str_equal(elf, &shstrtab, sh.name, "PrgCode")  ||  elf_str_equal(elf, &shstrtab, sh.name, "PrgData"))) {
+            memcpy((uint8_t *)blob + FLM_BLOB_HEADER_SIZE + sh.addr, elf + sh.offset, sh.size);
+        }
+    }
+
+    //
+    // get entry points from the symbol table
+    //
+    for (uint32_t pos = 0;  pos + ELF_SYM_SIZE <= symtab.size;  pos += ELF_SYM_SIZE) {
+        const uint8_t *sym = elf + symtab.offset + pos;
+        uint32_t name  = rd32(sym + 0);
+        uint32_t value = FLM_BLOB_HEADER_SIZE + rd32(sym + 4);
+
+        if (elf_str_equal(elf, &strtab, name, "Init"))
+            info->init = value;
+        else if (elf_str_equal(elf, &strtab, name, "UnInit"))
+            info->uninit = value;
+        else if (elf_str_equal(elf, &strtab, name, "EraseChip"))
+            info->erase_chip = value;
+        else if (elf_str_equal(elf, &strtab, name, "EraseSector"))
+            info->erase_sector = value;
+        else if (elf_str_equal(elf, &strtab, name, "ProgramPage"))
+            info->program_page = value;
+        else if (elf_str_equal(elf, &strtab, name, "Verify"))
+            info->verify = value;
+    }
+
+    if (info->init == 0  ||  info->uninit == 0  ||  info->erase_chip == 0  ||  info->erase_sector == 0  ||  info->program_page == 0)
+        return false;
+
+    //
+    // FlashDevice descriptor
+    //
+    {
+        const uint8_t *dev = elf + devdscr.offset;
+
+        memcpy(info->dev_name, dev + FLM_DEV_NAME_OFFS, sizeof(info->dev_name) - 1);
+        info->dev_addr     = rd32(dev + FLM_DEV_ADDR_OFFS);
+        info->dev_size     = rd32(dev + FLM_DEV_SIZE_OFFS);
+        info->page_size    = rd32(dev + FLM_DEV_PAGE_OFFS);
+        info->erased_value = dev[FLM_DEV_EMPTY_OFFS];
+
+        for (uint32_t pos = FLM_DEV_SECTORS_OFFS;  pos + 8 <= devdscr.size;  pos += 8) {
+            uint32_t size = rd32(dev + pos);
+            uint32_t addr = rd32(dev + pos + 4);
+
+            if (size == FLM_SECTOR_END  ||  size == 0)
+                break;
+            if (info->sector_cnt >= FLM_SECTORS_MAX)
+                return false;
+            info->sectors[info->sector_cnt].start = info->dev_addr + addr;
+            info->sectors[info->sector_cnt].size  = size;
+            ++info->sector_cnt;
+        }
+    }
+
+    return info->sector_cnt != 0  &&  info->dev_size != 0  &&  info->page_size != 0;
+}   // flm_parse
@@ -0,0 +1,79 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _FLM_PARSER_H
+#define _FLM_PARSER_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+#define FLM_SECTORS_MAX             16                 // max number of different sector sizes taken from the FlashDevice descriptor
+#define FLM_BLOB_HEADER_SIZE        4                  // breakpoint instruction in front of the algorithm code
+
+
+/**
+ * Information extracted from a CMSIS-Pack flash algorithm (.FLM).
+ * Function entries and \a static_base are offsets into the algo blob (including header), 0 if not available.
+ * Sector addresses are absolute.
+ */
+typedef struct {
+    uint32_t blob_size;                     // size of algo blob in bytes (header + code + data + zero init)
+    uint32_t init;
+    uint32_t uninit;
+    uint32_t erase_chip;
+    uint32_t erase_sector;
+    uint32_t program_page;
+    uint32_t verify;
+    uint32_t static_base;
+
+    char     dev_name[32];                  // truncated FlashDevice.DevName
+    uint32_t dev_addr;                      // FlashDevice.DevAdr
+    uint32_t dev_size;                      // FlashDevice.szDev
+    uint32_t page_size;                     // FlashDevice.szPage
+    uint8_t  erased_value;                  // FlashDevice.valEmpty
+    uint32_t sector_cnt;
+    struct {
+        uint32_t start;
+        uint32_t size;
+    } sectors[FLM_SECTORS_MAX];
+} flm_info_t;
+
+
+uint32_t flm_elf_size(const uint8_t *elf, uint32_t len);
+bool flm_parse(const uint8_t *elf, uint32_t elf_size, uint32_t *blob, uint32_t blob_max_size, flm_info_t *info);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
@@ -47,6 +47,7 @@
 #include "target_board.h"
 #include "target_rp2040.h"
 #include "program_flash_generic.h"
+#include "flm_loader.h"
 
 #include "probe.h"
 #include "minIni/minIni.h"
@@ -117,7 +118,7 @@ target_cfg_t target_device_generic = {
     .target_part_number             = "cortex_m",
     .rt_family_id                   = kStub_SWSysReset_FamilyID,
     .rt_board_id                    = "ffff",
-    .rt_uf2_id                      = 0,                               // this also implies no write operation
+    .rt_uf2_id                      = 0,                               // this also implies no write operation (unless an FLM is loaded)
     .rt_max_swd_khz                 = 10000,
     .rt_swd_khz                     = 2000,
 };
@@ -271,9 +272,10 @@ void pico_prerun_board_config(void)
         target_device = target_device_generic;             // holds already all values
         search_family();
         if (target_set_state(ATTACH)) {
-            // set generic device
+            // set generic device, flash algorithm is taken from a stored FLM (if available)
             strcpy(board_vendor, "Generic");
             strcpy(board_name, "Generic");
+            flm_loader_setup_target(&target_device);
         }
         else {
             // Disconnected!
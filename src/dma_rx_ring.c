@@ -0,0 +1,96 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Receive rings written by DMA (target UART, PIO UARTs).
+ *
+ * The write position is not taken from the write address of the DMA channel, because the address cannot tell
+ * a full lap of the ring from no data at all.  Instead the transfer counter of the channel is used, which
+ * gives the total number of received bytes.  The channel is restarted with \a dma_count if it has finished.
+ *
+ * No hardware access here, the caller passes the register contents, so this is covered by the host tests.
+ */
+
+#include "dma_rx_ring.h"
+
+
+
+void dma_rx_ring_init(dma_rx_ring_t *r, uint32_t size, uint32_t margin, uint32_t dma_count)
+{
+    r->size      = size;
+    r->margin    = margin;
+    r->dma_count = dma_count;
+    r->dma_base  = 0;
+    r->wr        = 0;
+    r->rd        = 0;
+}   // dma_rx_ring_init
+
+
+
+uint32_t dma_rx_ring_poll(dma_rx_ring_t *r, uint32_t trans_count, bool dma_finished)
+/**
+ * Publish the write position.
+ *
+ * \param trans_count   remaining transfer count of the DMA channel
+ * \param dma_finished  the channel has finished (read before \a trans_count) and is restarted with
+ *                      \a dma_count by the caller after this call
+ * \return number of new bytes, could be more than the ring size
+ */
+{
+    uint32_t wr = r->dma_base + (r->dma_count - trans_count);
+    uint32_t delta = wr - r->wr;
+
+    if (dma_finished) {
+        r->dma_base = wr;
+    }
+    r->wr = wr;
+    return delta;
+}   // dma_rx_ring_poll
+
+
+
+uint32_t dma_rx_ring_chunk(dma_rx_ring_t *r, uint32_t *offs, uint32_t *lost)
+/**
+ * Get the next linear chunk of received data.
+ * If the reader is too slow, the oldest data has already been overwritten by DMA.  In this case
+ * the read position is moved forward and the lost bytes are returned for counting.
+ *
+ * \param offs  offset of the chunk in the ring
+ * \param lost  number of bytes skipped
+ * \return      number of bytes in the chunk
+ */
+{
+    uint32_t avail = r->wr - r->rd;
+
+    *lost = 0;
+    if (avail > r->size - r->margin) {
+        *lost = avail - (r->size - r->margin);
+        r->rd += *lost;
+        avail -= *lost;
+    }
+
+    *offs = r->rd & (r->size - 1);
+    return (avail < r->size - *offs) ? avail : r->size - *offs;
+}   // dma_rx_ring_chunk
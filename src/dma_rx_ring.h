@@ -0,0 +1,74 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _DMA_RX_RING_H
+#define _DMA_RX_RING_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/**
+ * Position bookkeeping of a receive ring which is written endlessly by DMA (ring mode of the channel).
+ * All positions are free running byte counts.
+ */
+typedef struct {
+    uint32_t          size;                 // size of the ring, power of 2
+    uint32_t          margin;               // DMA may run ahead of the published write position by this
+    uint32_t          dma_count;            // transfer count of a DMA (re)start
+    uint32_t          dma_base;             // total bytes received at the last DMA (re)start
+    volatile uint32_t wr;                   // total bytes received, published by dma_rx_ring_poll()
+    uint32_t          rd;                   // total bytes consumed
+} dma_rx_ring_t;
+
+
+void dma_rx_ring_init(dma_rx_ring_t *r, uint32_t size, uint32_t margin, uint32_t dma_count);
+uint32_t dma_rx_ring_poll(dma_rx_ring_t *r, uint32_t trans_count, bool dma_finished);
+uint32_t dma_rx_ring_chunk(dma_rx_ring_t *r, uint32_t *offs, uint32_t *lost);
+
+
+static inline void dma_rx_ring_consume(dma_rx_ring_t *r, uint32_t cnt)
+{
+    r->rd += cnt;
+}   // dma_rx_ring_consume
+
+
+static inline bool dma_rx_ring_is_empty(const dma_rx_ring_t *r)
+{
+    return r->wr == r->rd;
+}   // dma_rx_ring_is_empty
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
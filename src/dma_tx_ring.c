@@ -0,0 +1,109 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Transmit rings emptied by DMA (target UART).
+ *
+ * The writer fills the free linear part of the ring and commits it, the DMA completion IRQ frees
+ * the transmitted chunk.  Both return the next chunk if DMA has to be started, so a transfer is
+ * running whenever there is data.  Writer and IRQ may run on different cores, so the caller has
+ * to protect dma_tx_ring_commit() and dma_tx_ring_done() with a critical section.
+ *
+ * No hardware access here, so this is covered by the host tests.
+ */
+
+#include "dma_tx_ring.h"
+
+
+
+void dma_tx_ring_init(dma_tx_ring_t *r, uint32_t size)
+{
+    r->size    = size;
+    r->wr      = 0;
+    r->rd      = 0;
+    r->dma_len = 0;
+}   // dma_tx_ring_init
+
+
+
+static bool dma_tx_ring_kick(dma_tx_ring_t *r, uint32_t *offs, uint32_t *len)
+/**
+ * If DMA is idle, take the next linear chunk for transmission.
+ */
+{
+    uint32_t avail = r->wr - r->rd;
+
+    if (r->dma_len != 0  ||  avail == 0) {
+        return false;
+    }
+
+    *offs = r->rd & (r->size - 1);
+    *len = (avail < r->size - *offs) ? avail : r->size - *offs;
+    r->dma_len = *len;
+    return true;
+}   // dma_tx_ring_kick
+
+
+
+uint32_t dma_tx_ring_space(const dma_tx_ring_t *r, uint32_t *offs)
+/**
+ * Get the next linear free chunk of the ring.
+ *
+ * \param offs  offset of the chunk in the ring
+ * \return      number of bytes which can be written into the chunk
+ */
+{
+    uint32_t space = r->size - (r->wr - r->rd);
+
+    *offs = r->wr & (r->size - 1);
+    return (space < r->size - *offs) ? space : r->size - *offs;
+}   // dma_tx_ring_space
+
+
+
+bool dma_tx_ring_commit(dma_tx_ring_t *r, uint32_t cnt, uint32_t *offs, uint32_t *len)
+/**
+ * \a cnt bytes have been written into the chunk given by dma_tx_ring_space().
+ *
+ * \return true -> DMA has to be started with \a len bytes at \a offs
+ */
+{
+    r->wr += cnt;
+    return dma_tx_ring_kick(r, offs, len);
+}   // dma_tx_ring_commit
+
+
+
+bool dma_tx_ring_done(dma_tx_ring_t *r, uint32_t *offs, uint32_t *len)
+/**
+ * The running DMA transfer has finished, free its chunk.
+ *
+ * \return true -> DMA has to be started with \a len bytes at \a offs
+ */
+{
+    r->rd += r->dma_len;
+    r->dma_len = 0;
+    return dma_tx_ring_kick(r, offs, len);
+}   // dma_tx_ring_done
@@ -0,0 +1,61 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _DMA_TX_RING_H
+#define _DMA_TX_RING_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/**
+ * Position bookkeeping of a transmit ring which is emptied in linear chunks by DMA.
+ * All positions are free running byte counts.
+ */
+typedef struct {
+    uint32_t          size;                 // size of the ring, power of 2
+    volatile uint32_t wr;                   // total bytes put into the ring
+    volatile uint32_t rd;                   // total bytes transmitted
+    volatile uint32_t dma_len;              // length of the running DMA transfer, 0 -> idle
+} dma_tx_ring_t;
+
+
+void dma_tx_ring_init(dma_tx_ring_t *r, uint32_t size);
+uint32_t dma_tx_ring_space(const dma_tx_ring_t *r, uint32_t *offs);
+bool dma_tx_ring_commit(dma_tx_ring_t *r, uint32_t cnt, uint32_t *offs, uint32_t *len);
+bool dma_tx_ring_done(dma_tx_ring_t *r, uint32_t *offs, uint32_t *len);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+/**
+ * Merged timestamped event stream: target UART, RTT console and probe events.
+ *
+ * Every source has its own FIFO of complete frames with non-decreasing timestamps.
+ * event_stream_read() merges the FIFOs by timestamp: the oldest head frame is released only if
+ * no empty source can still deliver an older frame, i.e. the watermarks (time up to which a source
+ * has delivered everything) of all empty sources are beyond it.  A watermark older than
+ * EVENT_STREAM_MAX_DELAY_US does not hold back the others, e.g. RTT without a target.
+ * Probe events are put with the current time, so they never hold back the others.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "picoprobe_config.h"
+#include "event_stream.h"
+#include "stats_counter.h"
+
+
+#define EVENT_STREAM_MAX_DELAY_US   100000
+
+typedef struct {
+    uint8_t           *buf;
+    uint32_t           size;                         // power of 2
+    volatile uint32_t  wr;                           // total bytes written, under lock
+    volatile uint32_t  rd;                           // total bytes read, by event_stream_read() only
+    uint64_t           watermark_us;                 // under lock
+} event_fifo_t;
+
+static uint8_t fifo_buf_probe[512];
+static uint8_t fifo_buf_uart[4096];
+static uint8_t fifo_buf_rtt[2048];
+static uint8_t fifo_buf_sigrok[2048];
+
+static event_fifo_t fifos[EVENT_SRC_CNT] = {
+    [EVENT_SRC_PROBE]  = { .buf = fifo_buf_probe,  .size = sizeof(fifo_buf_probe) },
+    [EVENT_SRC_UART]   = { .buf = fifo_buf_uart,   .size = sizeof(fifo_buf_uart) },
+    [EVENT_SRC_RTT]    = { .buf = fifo_buf_rtt,    .size = sizeof(fifo_buf_rtt) },
+    [EVENT_SRC_SIGROK] = { .buf = fifo_buf_sigrok, .size = sizeof(fifo_buf_sigrok) },
+};
+
+
+
+static void fifo_copy_in(event_fifo_t *f, uint32_t pos, const void *data, uint32_t len)
+{
+    uint32_t ndx = pos & (f->size - 1);
+    uint32_t n = MIN(len, f->size - ndx);
+
+    memcpy(f->buf + ndx, data, n);
+    memcpy(f->buf, (const uint8_t *)data + n, len - n);
+}   // fifo_copy_in
+
+
+
+static void fifo_copy_out(const event_fifo_t *f, uint32_t pos, void *data, uint32_t len)
+{
+    uint32_t ndx = pos & (f->size - 1);
+    uint32_t n = MIN(len, f->size - ndx);
+
+    memcpy(data, f->buf + ndx, n);
+    memcpy((uint8_t *)data + n, f->buf, len - n);
+}   // fifo_copy_out
+
+
+
+bool event_stream_put(event_src_t src, uint64_t ts_us, const void *data, uint32_t len)
+/**
+ * Append a frame to the FIFO of \a src.  Payload is truncated to EVENT_STREAM_PAYLOAD_MAX.
+ * The FIFOs are shared between tasks and ISRs on both cores, so every access is done under the
+ * ISR variant of the critical section.
+ *
+ * \param src    source of the data
+ * \param ts_us  timestamp of the first payload byte, must not be older than the previous one of \a src
+ * \return false -> frame dropped because FIFO is full
+ */
+{
+    event_fifo_t *f = fifos + src;
+    uint8_t hdr[EVENT_STREAM_HEADER_SIZE];
+    UBaseType_t saved;
+    bool r = false;
+
+    len = MIN(len, EVENT_STREAM_PAYLOAD_MAX);
+    hdr[0] = EVENT_STREAM_SYNC;
+    hdr[1] = (uint8_t)src;
+    hdr[2] = (uint8_t)len;
+    hdr[3] = (uint8_t)(len >> 8);
+    for (uint32_t i = 0;  i < 6;  ++i) {
+        hdr[4 + i] = (uint8_t)(ts_us >> (8 * i));
+    }
+
+    saved = taskENTER_CRITICAL_FROM_ISR();
+    if (f->size - (f->wr - f->rd) >= EVENT_STREAM_HEADER_SIZE + len) {
+        fifo_copy_in(f, f->wr, hdr, EVENT_STREAM_HEADER_SIZE);
+        fifo_copy_in(f, f->wr + EVENT_STREAM_HEADER_SIZE, data, len);
+        __compiler_memory_barrier();
+        f->wr += EVENT_STREAM_HEADER_SIZE + len;
+        r = true;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(saved);
+
+    if ( !r) {
+        stats_add(STATS_DROP_EVENTS, len);
+    }
+    return r;
+}   // event_stream_put
+
+
+
+void event_stream_watermark(event_src_t src, uint64_t ts_us)
+/**
+ * \a src has delivered everything up to \a ts_us, frames following later will be younger.
+ */
+{
+    UBaseType_t saved;
+
+    saved = taskENTER_CRITICAL_FROM_ISR();
+    fifos[src].watermark_us = ts_us;
+    taskEXIT_CRITICAL_FROM_ISR(saved);
+}   // event_stream_watermark
+
+
+
+void event_stream_probe(event_probe_t event, const char *origin)
+/**
+ * Put a probe event with the current time.  \a origin is a short ASCII tag, e.g. "DAPv2".
+ */
+{
+    uint8_t payload[16];
+    uint32_t len;
+
+    payload[0] = (uint8_t)event;
+    len = MIN(strlen(origin), sizeof(payload) - 1);
+    memcpy(payload + 1, origin, len);
+    event_stream_put(EVENT_SRC_PROBE, time_us_64(), payload, len + 1);
+}   // event_stream_probe
+
+
+
+uint32_t event_stream_read(uint8_t *buf, uint32_t max_len)
+/**
+ * Merge frames of all sources by timestamp into \a buf.  Only complete frames are copied.
+ *
+ * Context: single reader
+ *
+ * \return number of bytes copied
+ */
+{
+    uint64_t now = time_us_64();
+    uint64_t watermark[EVENT_SRC_CNT];
+    uint32_t n = 0;
+
+    {
+        UBaseType_t saved;
+
+        saved = taskENTER_CRITICAL_FROM_ISR();
+        for (uint32_t src = 0;  src < EVENT_SRC_CNT;  ++src) {
+            watermark[src] = fifos[src].watermark_us;
+        }
+        taskEXIT_CRITICAL_FROM_ISR(saved);
+    }
+
+    for (;;) {
+        int next = -1;
+        uint64_t next_ts = UINT64_MAX;
+        uint32_t next_len = 0;
+        uint64_t limit = UINT64_MAX;
+
+        for (uint32_t src = 0;  src < EVENT_SRC_CNT;  ++src) {
+            event_fifo_t *f = fifos + src;
+
+            if (f->wr != f->rd) {
+                uint8_t hdr[EVENT_STREAM_HEADER_SIZE];
+                uint64_t ts = 0;
+
+                __compiler_memory_barrier();
+                fifo_copy_out(f, f->rd, hdr, sizeof(hdr));
+                for (uint32_t i = 0;  i < 6;  ++i) {
+                    ts |= (uint64_t)hdr[4 + i] << (8 * i);
+                }
+                if (ts < next_ts) {
+                    next     = src;
+                    next_ts  = ts;
+                    next_len = EVENT_STREAM_HEADER_SIZE + hdr[2] + (hdr[3] << 8);
+                }
+            }
+            else if (src != EVENT_SRC_PROBE  &&  now - watermark[src] < EVENT_STREAM_MAX_DELAY_US) {
+                limit = MIN(limit, watermark[src]);
+            }
+        }
+
+        if (next < 0) {
+            break;
+        }
+        if (next_ts > limit  &&  now - next_ts < EVENT_STREAM_MAX_DELAY_US) {
+            // an empty source may still deliver an older frame
+            break;
+        }
+        if (n + next_len > max_len) {
+            break;
+        }
+
+        fifo_copy_out(fifos + next, fifos[next].rd, buf + n, next_len);
+        fifos[next].rd += next_len;
+        n += next_len;
+    }
+    return n;
+}   // event_stream_read
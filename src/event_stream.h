@@ -0,0 +1,91 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _EVENT_STREAM_H
+#define _EVENT_STREAM_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/**
+ * Sources of the merged event stream.  Numbering is part of the frame format.
+ */
+typedef enum {
+    EVENT_SRC_PROBE,                                     // probe events, payload is event_probe_t + ASCII origin
+    EVENT_SRC_UART,                                      // target UART data
+    EVENT_SRC_RTT,                                       // RTT console data (channel 0)
+    EVENT_SRC_SIGROK,                                    // sigrok protocol decoder frames, see sigrok_decode.h
+
+    EVENT_SRC_CNT
+} event_src_t;
+
+
+/**
+ * Probe events, first payload byte of EVENT_SRC_PROBE frames.
+ */
+typedef enum {
+    EVENT_PROBE_CONNECT = 1,                             // DAP/MSC/... took over the target
+    EVENT_PROBE_DISCONNECT,
+    EVENT_PROBE_RESET_ASSERT,                            // target reset pin
+    EVENT_PROBE_RESET_RELEASE,
+    EVENT_PROBE_TARGET_FOUND,                            // RTT console found the target
+    EVENT_PROBE_TARGET_LOST,
+} event_probe_t;
+
+
+/**
+ * Frame format, all values are little endian:
+ *
+ * offset  size
+ *    0      1    sync EVENT_STREAM_SYNC
+ *    1      1    source, see \a event_src_t
+ *    2      2    payload length n
+ *    4      6    timestamp in us (time_us_64() of the probe, lower 48 bits)
+ *   10      n    payload
+ */
+#define EVENT_STREAM_SYNC           0xa5
+#define EVENT_STREAM_HEADER_SIZE    10
+#define EVENT_STREAM_PAYLOAD_MAX    256
+
+
+bool     event_stream_put(event_src_t src, uint64_t ts_us, const void *data, uint32_t len);
+void     event_stream_watermark(event_src_t src, uint64_t ts_us);
+void     event_stream_probe(event_probe_t event, const char *origin);
+uint32_t event_stream_read(uint8_t *buf, uint32_t max_len);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
@@ -52,6 +52,16 @@
 #else
     #define __OPT_TARGET_UART
 #endif
+#if OPT_PIO_UART_N
+    #define __OPT_PIO_UART            " [CDC: PIO UART]"
+#else
+    #define __OPT_PIO_UART
+#endif
+#if OPT_EVENT_STREAM
+    #define __OPT_EVENT_STREAM        " [CDC: events]"
+#else
+    #define __OPT_EVENT_STREAM
+#endif
 #if OPT_SIGROK
     #define __OPT_SIGROK              " [CDC: sigrok]"
 #else
@@ -97,11 +107,41 @@
 #else
     #define __OPT_NET_SYSVIEW_SERVER
 #endif
+#if OPT_NET_STATS_SERVER
+    #define __OPT_NET_STATS_SERVER    " Stats"
+#else
+    #define __OPT_NET_STATS_SERVER
+#endif
+#if OPT_NET_RTT_SERVER
+    #define __OPT_NET_RTT_SERVER      " RTT"
+#else
+    #define __OPT_NET_RTT_SERVER
+#endif
+#if OPT_NET_DAP_SERVER
+    #define __OPT_NET_DAP_SERVER      " DAP"
+#else
+    #define __OPT_NET_DAP_SERVER
+#endif
+#if OPT_NET_UART_SERVER
+    #define __OPT_NET_UART_SERVER     " UART"
+#else
+    #define __OPT_NET_UART_SERVER
+#endif
 #if OPT_NET_ECHO_SERVER
     #define __OPT_NET_ECHO_SERVER     " Echo"
 #else
     #define __OPT_NET_ECHO_SERVER
 #endif
+#if OPT_NET_SIGROK_SERVER
+    #define __OPT_NET_SIGROK_SERVER   " Sigrok"
+#else
+    #define __OPT_NET_SIGROK_SERVER
+#endif
+#if OPT_NET_EVENTS_SERVER
+    #define __OPT_NET_EVENTS_SERVER   " Events"
+#else
+    #define __OPT_NET_EVENTS_SERVER
+#endif
 #if OPT_NET_IPERF_SERVER
     #define __OPT_NET_IPERF_SERVER    " IPerf"
 #else
@@ -113,8 +153,11 @@
  * CONFIG_FEATURES
  */
 #define CONFIG_FEATURES()  __OPT_CMSIS_DAPV1 __OPT_CMSIS_DAPV2 __OPT_MSC __OPT_TARGET_UART __OPT_SIGROK           \
-                           __OPT_PROBE_DEBUG_OUT __OPT_CDC_SYSVIEW                                                \
-                           __OPT_NET_CONF __OPT_NET_SYSVIEW_SERVER __OPT_NET_ECHO_SERVER __OPT_NET_IPERF_SERVER __OPT_NET_CONF_END
+                           __OPT_PIO_UART __OPT_EVENT_STREAM __OPT_PROBE_DEBUG_OUT __OPT_CDC_SYSVIEW              \
+                           __OPT_NET_CONF __OPT_NET_SYSVIEW_SERVER __OPT_NET_STATS_SERVER __OPT_NET_RTT_SERVER    \
+                           __OPT_NET_DAP_SERVER __OPT_NET_UART_SERVER __OPT_NET_EVENTS_SERVER                     \
+                           __OPT_NET_SIGROK_SERVER __OPT_NET_ECHO_SERVER __OPT_NET_IPERF_SERVER                   \
+                           __OPT_NET_CONF_END
 
 /**
  * CONFIG_BOARD
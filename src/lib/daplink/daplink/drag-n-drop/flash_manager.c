@@ -26,6 +26,7 @@
 #include "util.h"
 #include "error.h"
 #include "settings.h"
+#include "target_board.h"
 
 // Set to 1 to enable debugging
 #define DEBUG_FLASH_MANAGER     0
@@ -37,6 +38,10 @@
     #define flash_manager_printf(...)
 #endif
 
+// Number of sectors tracked by the erase map in page erase mode.
+// Sectors beyond this limit are erased each time they are entered.
+#define ERASE_MAP_SECTORS       1024
+
 typedef enum {
     STATE_CLOSED,
     STATE_OPEN,
@@ -55,12 +60,15 @@ static uint32_t current_write_block_size;
 static uint32_t current_sector_addr;
 static uint32_t current_sector_size;
 static uint32_t last_addr;
+static uint32_t erase_map[ERASE_MAP_SECTORS / 32];
 static const flash_intf_t *intf;
 static state_t state = STATE_CLOSED;
 
 static bool flash_intf_valid(const flash_intf_t *flash_intf);
 static error_t flush_current_block(uint32_t addr);
 static error_t setup_next_sector(uint32_t addr);
+static bool erase_map_index(uint32_t addr, uint32_t *index);
+static bool erase_map_test_and_set(uint32_t addr);
 
 error_t flash_manager_init(const flash_intf_t *flash_intf)
 {
@@ -88,6 +96,7 @@ error_t flash_manager_init(const flash_intf_t *flash_intf)
     current_sector_addr = 0;
     current_sector_size = 0;
     last_addr = 0;
+    memset(erase_map, 0, sizeof(erase_map));
     intf = flash_intf;
     // Initialize flash
     status = intf->init();
@@ -319,8 +328,9 @@ static error_t setup_next_sector(uint32_t addr)
     // Setup global variables
     current_sector_addr = ROUND_DOWN(addr, sector_size);
     current_sector_size = sector_size;
-    current_write_block_addr = current_sector_addr;
     current_write_block_size = MIN(sector_size, sizeof(buf));
+    // addr is not necessarily the start of the sector (gaps in the image, revisited sectors)
+    current_write_block_addr = ROUND_DOWN(addr, current_write_block_size);
 
     //check flash algo every sector change, addresses with different flash algo should be sector aligned
     if (intf->flash_algo_set) {
@@ -331,8 +341,8 @@ static error_t setup_next_sector(uint32_t addr)
         }
     }
 
-    if (page_erase_enabled) {
-        // Erase the current sector
+    if (page_erase_enabled && !erase_map_test_and_set(current_sector_addr)) {
+        // Erase the current sector (only once, sectors may be revisited with non-increasing addresses)
         status = intf->erase_sector(current_sector_addr);
         flash_manager_printf("    intf->erase_sector(addr=0x%lx) ret=%i\r\n", current_sector_addr, status);
         if (ERROR_SUCCESS != status) {
@@ -349,3 +359,61 @@ static error_t setup_next_sector(uint32_t addr)
                          current_write_block_size, current_sector_size, min_prog_size);
     return ERROR_SUCCESS;
 }
+
+// Calculate a linear sector index from the sector layout of the target.
+// The layout is taken from sectors_info, each entry applies up to the start of the next entry.
+static bool erase_map_index(uint32_t addr, uint32_t *index)
+{
+    const target_cfg_t *cfg = g_board_info.target_cfg;
+    uint32_t base = 0;
+    int i;
+
+    if ((0 == cfg) || (0 == cfg->sectors_info) || (0 == cfg->sector_info_length)) {
+        uint32_t sector_size = intf->erase_sector_size(addr);
+
+        if (0 == sector_size) {
+            return false;
+        }
+        *index = addr / sector_size;
+        return *index < ERASE_MAP_SECTORS;
+    }
+
+    if (addr < cfg->sectors_info[0].start) {
+        return false;
+    }
+
+    for (i = 0; i < (int)cfg->sector_info_length; i++) {
+        const sector_info_t *info = &cfg->sectors_info[i];
+        bool last = (i + 1 == (int)cfg->sector_info_length);
+
+        if (0 == info->size) {
+            return false;
+        }
+        if (last || addr < cfg->sectors_info[i + 1].start) {
+            *index = base + (addr - info->start) / info->size;
+            return *index < ERASE_MAP_SECTORS;
+        }
+        base += (cfg->sectors_info[i + 1].start - info->start) / info->size;
+    }
+    return false;
+}
+
+// Returns true if the sector containing addr has already been erased, marks it as erased otherwise.
+// Sectors which cannot be tracked are always reported as not erased.
+static bool erase_map_test_and_set(uint32_t addr)
+{
+    uint32_t index;
+    uint32_t mask;
+
+    if (!erase_map_index(addr, &index)) {
+        return false;
+    }
+
+    mask = 1u << (index % 32);
+    if (erase_map[index / 32] & mask) {
+        flash_manager_printf("    sector(addr=0x%lx) already erased\r\n", addr);
+        return true;
+    }
+    erase_map[index / 32] |= mask;
+    return false;
+}
@@ -37,6 +37,9 @@
 
 #define DEFAULT_PROGRAM_PAGE_MIN_SIZE   (256u)
 
+//! Max size of program_buffer_size for double buffered programming (copy of pending data for verify)
+#define PENDING_PAGE_MAX_SIZE           (1024u)
+
 typedef enum {
     STATE_CLOSED,
     STATE_OPEN,
@@ -52,6 +55,7 @@ static uint32_t target_flash_program_page_min_size(uint32_t addr);
 static uint32_t target_flash_erase_sector_size(uint32_t addr);
 static uint8_t target_flash_busy(void);
 static error_t target_flash_set(uint32_t addr);
+static error_t target_flash_wait_pending(void);
 
 static const flash_intf_t flash_intf = {
     target_flash_init,
@@ -80,6 +84,15 @@ static region_info_t * default_region = NULL;
 //saved flash start from flash algo
 static uint32_t flash_start = 0;
 
+//double buffering: page which is currently programmed by the target
+static bool pending_page = false;
+static uint32_t pending_addr;
+static uint32_t pending_size;
+static uint32_t pending_buffer;
+static uint32_t next_buffer;
+__attribute__((aligned(4)))
+static uint8_t pending_data[PENDING_PAGE_MAX_SIZE];
+
 static program_target_t * get_flash_algo(uint32_t addr)
 {
     region_info_t * flash_region = g_board_info.target_cfg->flash_regions;
@@ -137,8 +150,12 @@ static error_t target_flash_set(uint32_t addr)
         return ERROR_ALGO_MISSING;
     }
     if(current_flash_algo != new_flash_algo){
-        //run uninit to last func
-        error_t status = flash_func_start(FLASH_FUNC_NOP);
+        //finish outstanding page and run uninit to last func
+        error_t status = target_flash_wait_pending();
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+        status = flash_func_start(FLASH_FUNC_NOP);
         if (status != ERROR_SUCCESS) {
             return status;
         }
@@ -159,6 +176,8 @@ static error_t target_flash_init()
         last_flash_func = FLASH_FUNC_NOP;
 
         current_flash_algo = NULL;
+        pending_page = false;
+        next_buffer = 0;
 
         if (0 == target_set_state(RESET_PROGRAM)) {
             return ERROR_RESET;
@@ -184,7 +203,10 @@ static error_t target_flash_init()
 static error_t target_flash_uninit(void)
 {
     if (g_board_info.target_cfg) {
-        error_t status = flash_func_start(FLASH_FUNC_NOP);
+        error_t status = target_flash_wait_pending();
+        if (status == ERROR_SUCCESS) {
+            status = flash_func_start(FLASH_FUNC_NOP);
+        }
         if (status != ERROR_SUCCESS) {
             return status;
         }
@@ -207,6 +229,109 @@ static error_t target_flash_uninit(void)
     }
 }
 
+// Verify a page which has been programmed from the target buffer at buffer_addr.
+// data is the local copy of the page.
+static error_t target_flash_verify_page(program_target_t * flash, uint32_t addr, const uint8_t *data, uint32_t size, uint32_t buffer_addr)
+{
+    if (flash->verify != 0) {
+        error_t status = flash_func_start(FLASH_FUNC_VERIFY);
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+        flash_algo_return_t return_type;
+        if ((flash->algo_flags & kAlgoVerifyReturnsAddress) != 0) {
+            return_type = FLASHALGO_RETURN_POINTER;
+        } else {
+            return_type = FLASHALGO_RETURN_BOOL;
+        }
+        if (!swd_flash_syscall_exec(&flash->sys_call_s, flash->verify, addr, size, buffer_addr, 0, return_type)) {
+            return ERROR_WRITE_VERIFY;
+        }
+    } else {
+        while (size > 0) {
+            uint8_t rb_buf[16];
+            uint32_t verify_size = MIN(size, sizeof(rb_buf));
+            if (!swd_read_memory(addr, rb_buf, verify_size)) {
+                return ERROR_ALGO_DATA_SEQ;
+            }
+            if (memcmp(data, rb_buf, verify_size) != 0) {
+                return ERROR_WRITE_VERIFY;
+            }
+            addr += verify_size;
+            data += verify_size;
+            size -= verify_size;
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+// Wait until the page started by target_flash_program_page_double_buffered() has been programmed.
+// Must be called before any other flash algo function is executed on the target.
+static error_t target_flash_wait_pending(void)
+{
+    program_target_t * flash = current_flash_algo;
+
+    if (!pending_page) {
+        return ERROR_SUCCESS;
+    }
+    pending_page = false;
+
+    if (!swd_flash_syscall_wait(pending_addr, pending_size, FLASHALGO_RETURN_BOOL)) {
+        return ERROR_WRITE;
+    }
+
+    if (config_get_automation_allowed()) {
+        return target_flash_verify_page(flash, pending_addr, pending_data, pending_size, pending_buffer);
+    }
+    return ERROR_SUCCESS;
+}
+
+// Program with two target buffers: while the target programs one page, the next page is
+// downloaded into the other buffer.  The last page is left running on the target, so the
+// caller can prepare further data in the meantime.  It is finished by target_flash_wait_pending().
+static error_t target_flash_program_page_double_buffered(program_target_t * flash, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    error_t status;
+
+    while (size > 0) {
+        uint32_t write_size = MIN(size, flash->program_buffer_size);
+        uint32_t buffer_addr = (next_buffer == 0) ? flash->program_buffer : flash->program_buffer_2nd;
+
+        // Write page to the free buffer while the target may still program the other one
+        if (!swd_write_memory(buffer_addr, (uint8_t *)buf, write_size)) {
+            pending_page = false;
+            return ERROR_ALGO_DATA_SEQ;
+        }
+
+        status = target_flash_wait_pending();
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
+        status = flash_func_start(FLASH_FUNC_PROGRAM);
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
+        // Start flash programming, result is checked on the next call of target_flash_wait_pending()
+        if (!swd_flash_syscall_start(&flash->sys_call_s, flash->program_page, addr, write_size, buffer_addr, 0)) {
+            return ERROR_WRITE;
+        }
+        memcpy(pending_data, buf, write_size);
+        pending_addr = addr;
+        pending_size = write_size;
+        pending_buffer = buffer_addr;
+        pending_page = true;
+        next_buffer ^= 1;
+
+        addr += write_size;
+        buf += write_size;
+        size -= write_size;
+    }
+
+    return ERROR_SUCCESS;
+}
+
 static error_t target_flash_program_page(uint32_t addr, const uint8_t *buf, uint32_t size)
 {
     if (g_board_info.target_cfg) {
@@ -224,8 +349,11 @@ static error_t target_flash_program_page(uint32_t addr, const uint8_t *buf, uint
             }
         }
 
-        status = flash_func_start(FLASH_FUNC_PROGRAM);
+        if (flash->program_buffer_2nd != 0 && flash->program_buffer_size <= sizeof(pending_data)) {
+            return target_flash_program_page_double_buffered(flash, addr, buf, size);
+        }
 
+        status = target_flash_wait_pending();
         if (status != ERROR_SUCCESS) {
             return status;
         }
@@ -233,6 +361,12 @@ static error_t target_flash_program_page(uint32_t addr, const uint8_t *buf, uint
         while (size > 0) {
             uint32_t write_size = MIN(size, flash->program_buffer_size);
 
+            // (again) after the verify of the previous page
+            status = flash_func_start(FLASH_FUNC_PROGRAM);
+            if (status != ERROR_SUCCESS) {
+                return status;
+            }
+
             // Write page to buffer
             if (!swd_write_memory(flash->program_buffer, (uint8_t *)buf, write_size)) {
                 return ERROR_ALGO_DATA_SEQ;
@@ -317,6 +451,11 @@ static error_t target_flash_erase_sector(uint32_t addr)
             return ERROR_ERASE_SECTOR;
         }
 
+        status = target_flash_wait_pending();
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
         status = flash_func_start(FLASH_FUNC_ERASE);
 
         if (status != ERROR_SUCCESS) {
@@ -336,9 +475,13 @@ static error_t target_flash_erase_sector(uint32_t addr)
 static error_t target_flash_erase_chip(void)
 {
     if (g_board_info.target_cfg){
-        error_t status = ERROR_SUCCESS;
+        error_t status = target_flash_wait_pending();
         region_info_t * flash_region = g_board_info.target_cfg->flash_regions;
 
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
         for (; flash_region->start != 0 || flash_region->end != 0; ++flash_region) {
             program_target_t *new_flash_algo = get_flash_algo(flash_region->start);
             if ((new_flash_algo != NULL) && ((new_flash_algo->algo_flags & kAlgoSkipChipErase) != 0)) {
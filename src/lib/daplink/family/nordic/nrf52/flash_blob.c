@@ -75,7 +75,8 @@ static const program_target_t flash_nrf52 = {
     .algo_start = 0x20000000,
     .algo_size = 0x00000150,
     .algo_blob = nRF52832AA_FLM,
-    .program_buffer_size = 512 // should be USBD_MSC_BlockSize
+    .program_buffer_size = 512, // should be USBD_MSC_BlockSize
+    .program_buffer_2nd = 0x20000400
 };
 
 static const program_target_t flash_nrf52833 = {
@@ -94,5 +95,6 @@ static const program_target_t flash_nrf52833 = {
     .algo_start = 0x20000000,
     sizeof(nRF52833_flash_algo),
     .algo_blob = nRF52833_flash_algo,
-    .program_buffer_size = 512 // should be USBD_MSC_BlockSize
+    .program_buffer_size = 512, // should be USBD_MSC_BlockSize
+    .program_buffer_2nd = 0x20000000 + 0x00000C00
 };
@@ -57,6 +57,7 @@ typedef struct __attribute__((__packed__)) {
     const uint32_t *algo_blob;
     const uint32_t  program_buffer_size;
     const uint32_t  algo_flags;         /*!< Combination of kAlgoVerifyReturnsAddress, kAlgoSingleInitType and kAlgoSkipChipErase*/
+    const uint32_t  program_buffer_2nd; /*!< Optional second program buffer of program_buffer_size for double buffering, 0 if not available */
 } program_target_t;
 
 typedef struct __attribute__((__packed__)) {
@@ -38,6 +38,9 @@ enum _target_config_version {
 //! This can vary from target to target and should be in the structure or flash blob
 #define TARGET_AUTO_INCREMENT_PAGE_SIZE    (1024)
 
+//! rt_uf2_id value which accepts UF2 files of any family
+#define UF2_ID_ANY                         (0xffffffff)
+
 //! Additional flash and ram regions
 #define MAX_REGIONS (10)
 
@@ -60,6 +60,12 @@
 #if OPT_CDC_SYSVIEW
     #include "cdc/cdc_sysview.h"
 #endif
+#if OPT_PIO_UART_N
+    #include "cdc/cdc_pio_uart.h"
+#endif
+#if OPT_EVENT_STREAM
+    #include "cdc/cdc_events.h"
+#endif
 #if OPT_CMSIS_DAPV2
     #include "cmsis-dap/dap_server.h"
 #endif
@@ -95,6 +101,24 @@
     #if OPT_NET_SYSVIEW_SERVER
         #include "net/net_sysview.h"
     #endif
+    #if OPT_NET_STATS_SERVER
+        #include "net/net_stats.h"
+    #endif
+    #if OPT_NET_RTT_SERVER
+        #include "net/net_rtt.h"
+    #endif
+    #if OPT_NET_DAP_SERVER
+        #include "net/net_dap.h"
+    #endif
+    #if OPT_NET_UART_SERVER
+        #include "net/net_uart.h"
+    #endif
+    #if OPT_NET_EVENTS_SERVER
+        #include "net/net_events.h"
+    #endif
+    #if OPT_NET_SIGROK_SERVER
+        #include "net/net_sigrok.h"
+    #endif
 #endif
 
 #if OPT_PROBE_DEBUG_OUT_RTT
@@ -157,6 +181,16 @@ void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts)
         cdc_sysview_line_state_cb(dtr, rts);
     }
 #endif
+#if OPT_PIO_UART_N
+    if (itf >= CDC_PIO_UART_N(0)  &&  itf < CDC_PIO_UART_N(OPT_PIO_UART_N)) {
+        cdc_pio_uart_line_state_cb(itf - CDC_PIO_UART_N(0), dtr, rts);
+    }
+#endif
+#if OPT_EVENT_STREAM
+    if (itf == CDC_EVENTS_N) {
+        cdc_events_line_state_cb(dtr, rts);
+    }
+#endif
 }   // tud_cdc_line_state_cb
 
 
@@ -169,6 +203,11 @@ void tud_cdc_line_coding_cb(uint8_t itf, cdc_line_coding_t const* line_coding)
         cdc_uart_line_coding_cb(line_coding);
     }
 #endif
+#if OPT_PIO_UART_N
+    if (itf >= CDC_PIO_UART_N(0)  &&  itf < CDC_PIO_UART_N(OPT_PIO_UART_N)) {
+        cdc_pio_uart_line_coding_cb(itf - CDC_PIO_UART_N(0), line_coding);
+    }
+#endif
 }   // tud_cdc_line_coding_cb
 #endif
 
@@ -196,6 +235,11 @@ void tud_cdc_rx_cb(uint8_t itf)
         cdc_sysview_rx_cb();
     }
 #endif
+#if OPT_PIO_UART_N
+    if (itf >= CDC_PIO_UART_N(0)  &&  itf < CDC_PIO_UART_N(OPT_PIO_UART_N)) {
+        cdc_pio_uart_rx_cb(itf - CDC_PIO_UART_N(0));
+    }
+#endif
 }   // tud_cdc_rx_cb
 
 
@@ -222,6 +266,16 @@ void tud_cdc_tx_complete_cb(uint8_t itf)
         cdc_sysview_tx_complete_cb();
     }
 #endif
+#if OPT_PIO_UART_N
+    if (itf >= CDC_PIO_UART_N(0)  &&  itf < CDC_PIO_UART_N(OPT_PIO_UART_N)) {
+        cdc_pio_uart_tx_complete_cb(itf - CDC_PIO_UART_N(0));
+    }
+#endif
+#if OPT_EVENT_STREAM
+    if (itf == CDC_EVENTS_N) {
+        cdc_events_tx_complete_cb();
+    }
+#endif
 }   // tud_cdc_tx_complete_cb
 
 
@@ -381,6 +435,14 @@ void usb_thread(void *ptr)
     cdc_uart_init(UART_TASK_PRIO);
 #endif
 
+#if OPT_PIO_UART_N
+    cdc_pio_uart_init(UART_TASK_PRIO);
+#endif
+
+#if OPT_EVENT_STREAM
+    cdc_events_init(UART_TASK_PRIO);
+#endif
+
 #if OPT_CDC_SYSVIEW
     cdc_sysview_init(SYSVIEW_TASK_PRIO);
 #endif
@@ -400,12 +462,34 @@ void usb_thread(void *ptr)
     sigrok_init(SIGROK_TASK_PRIO);
 #endif
 
+#if OPT_CMSIS_DAPV1  ||  OPT_CMSIS_DAPV2  ||  OPT_NET_DAP_SERVER
+    dap_server_init(DAPV2_TASK_PRIO);
+#endif
+
 #if OPT_NET
     net_glue_init();
 
     #if OPT_NET_SYSVIEW_SERVER
         net_sysview_init();
     #endif
+    #if OPT_NET_STATS_SERVER
+        net_stats_init();
+    #endif
+    #if OPT_NET_RTT_SERVER
+        net_rtt_init();
+    #endif
+    #if OPT_NET_DAP_SERVER
+        net_dap_init(DAPV2_TASK_PRIO);
+    #endif
+    #if OPT_NET_UART_SERVER
+        net_uart_init();
+    #endif
+    #if OPT_NET_EVENTS_SERVER
+        net_events_init();
+    #endif
+    #if OPT_NET_SIGROK_SERVER
+        net_sigrok_init();
+    #endif
     #if OPT_NET_ECHO_SERVER
         net_echo_init();
     #endif
@@ -415,10 +499,6 @@ void usb_thread(void *ptr)
     #endif
 #endif
 
-#if OPT_CMSIS_DAPV2
-    dap_server_init(DAPV2_TASK_PRIO);
-#endif
-
 #if configGENERATE_RUN_TIME_STATS
     {
         TaskHandle_t task_stat_handle;
@@ -430,7 +510,8 @@ void usb_thread(void *ptr)
     //
     // This is the only place to set task affinity.
     // TODO ATTENTION core affinity
-    // Currently only "RTT-From" is running on an extra core (and "RTT-From" is a real hack).  This is because
+    // Currently only "RTT-From" and the sigrok encoder "SIGROK-Enc" are running on an extra core (and "RTT-From"
+    // is a real hack).  This is because
     // if RTT is running on a different thread than tinyusb/lwip (not sure), the probe is crashing very
     // fast on SystemView events in net_sysview_send()
     //
@@ -447,6 +528,7 @@ void usb_thread(void *ptr)
         for (uint32_t n = 0;  n < cnt;  ++n) {
             if (    strcmp(task_status[n].pcTaskName, "IDLE1") == 0
                 ||  strcmp(task_status[n].pcTaskName, "RTT-From") == 0
+                ||  strcmp(task_status[n].pcTaskName, "SIGROK-Enc") == 0
                 ||  strcmp(task_status[n].pcTaskName, "RTT-IO-Dont-Do-That") == 0
             ) {
                 // set it to core 1
@@ -44,6 +44,8 @@
 #include "probe.h"
 #include "msc_utils.h"
 #include "get_config.h"
+#include "flm_loader.h"
+#include "stats_counter.h"
 
 
 #define ADWORD(X)       (X) & 0xff, ((X) & 0xff00) >> 8, ((X) & 0xff0000) >> 16, ((X) & 0xff000000) >> 24
@@ -75,7 +77,8 @@
 "- CURRENT.UF2 mirrors the flash content of the target\r\n"                       \
 __OPT_MSC_RAM_UF2                                                                 \
 "- INFO_UF2.TXT holds some information about probe and target\r\n"                \
-"- drop a UF2 file to flash the target device\r\n"
+"- drop a UF2 file to flash the target device\r\n"                                \
+"- drop a CMSIS-Pack .FLM file to flash unknown Cortex-M devices\r\n"
 #define README_SIZE            (sizeof(README_CONTENTS) - 1)
 
 #define INDEXHTM_CONTENTS \
@@ -543,7 +546,7 @@ int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buff
 //        picoprobe_info("  INFO_UF2.TXT\n");
         n = snprintf(buf, sizeof(buf), INFOUF2_CONTENTS,
                      g_board_info.target_cfg->target_part_number,
-                     msc_target_is_writable() ? "" : " (READONLY)",
+                     msc_target_is_writable() ? "" : " (FLM only)",
                      g_board_info.board_name);
         for (int i = n;  i < sizeof(buf);  ++i) {
             buf[i] = ' ';
@@ -600,6 +603,9 @@ int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buff
         memset(buffer, 0, bufsize);
     }
 
+    if (r > 0) {
+        stats_add(STATS_MSC_SECTOR_READ, (r + BPB_BytsPerSec - 1) / BPB_BytsPerSec);
+    }
     return r;
 }   // tud_msc_read10_cb
 
@@ -611,7 +617,8 @@ bool tud_msc_is_writable_cb(uint8_t lun)
 
 //    picoprobe_info("tud_msc_is_writable_cb(%d)\n", lun);
 
-    return msc_target_is_writable();
+    // always writable: even a generic target without UF2 support accepts a flash algorithm (FLM)
+    return true;
 }   // tud_msc_is_writable_cb
 
 
@@ -662,8 +669,17 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t*
                 }
             }
         }
+        else if (flm_loader_msc_accept(lba, buffer, BPB_BytsPerSec)) {
+            // flash algorithm for generic targets, stored by the target writer thread
+            if (msc_flm_write_sector(lba, buffer, BPB_BytsPerSec)) {
+                r = BPB_BytsPerSec;
+            }
+        }
     }
 
+    if (r > 0) {
+        stats_add(STATS_MSC_SECTOR_WRITE, (r + BPB_BytsPerSec - 1) / BPB_BytsPerSec);
+    }
     last_write_ms = (uint32_t)(time_us_64() / 1000);
     return r;
 }   // tud_msc_write10_cb
@@ -36,6 +36,10 @@
 #include "msc_utils.h"
 #include "sw_lock.h"
 #include "led.h"
+#include "stats_counter.h"
+#if OPT_EVENT_STREAM
+    #include "event_stream.h"
+#endif
 
 #include "FreeRTOS.h"
 #include "message_buffer.h"
@@ -50,16 +54,24 @@
 #include "flash_intf.h"
 #include "flash_manager.h"
 #include "pico_target_utils.h"
+#include "flm_loader.h"
 
 
 #define DEBUG_MODULE    0
 
-// DAPLink needs bigger buffer
-#define TARGET_WRITER_THREAD_MSGBUFF_SIZE   (16 * sizeof(struct uf2_block) + 100)
+// DAPLink needs bigger buffer: incoming UF2 blocks are buffered while the target erases/programs a sector.
+// With double buffered programming the writer thread keeps the buffer drained during programming, but
+// a sector erase (e.g. 85ms on nRF52) still has to be absorbed without stalling the TinyUSB thread.
+#define TARGET_WRITER_THREAD_MSGBUFF_SIZE   (32 * (sizeof(struct uf2_block) + sizeof(size_t)))
+
+// Images up to this size are flashed with lazy sector erase instead of a chip erase.
+// This keeps the remaining flash contents (e.g. bootloader, settings) and is faster for small images.
+#define DAPLINK_PAGE_ERASE_MAX_IMAGE_SIZE   (32 * 1024)
 
 #define USE_DAPLINK()         (UF2_ID != RP2040_FAMILY_ID)
 #define UF2_ID                (g_board_info.target_cfg->rt_uf2_id)
 #define UF2_ID_IS_PRESENT()   (UF2_ID != 0)
+#define UF2_ID_IS_ANY()       (UF2_ID == UF2_ID_ANY)
 
 extern target_cfg_t target_device_rp2040;
 
@@ -70,6 +82,19 @@ extern target_cfg_t target_device_rp2040;
 #define TARGET_FLASH_START    (g_board_info.target_cfg->flash_regions[0].start)
 #define TARGET_FLASH_END      (g_board_info.target_cfg->flash_regions[0].end)
 
+// FLM sector for the probe flash, distinguished from UF2 blocks by its message length
+typedef struct {
+    uint32_t lba;
+    uint8_t  sector[512];
+} msc_flm_msg_t;
+
+typedef union {
+    struct uf2_block  uf2;
+    msc_flm_msg_t     flm;
+} msc_writer_msg_t;
+
+static_assert(sizeof(msc_flm_msg_t) != sizeof(struct uf2_block), "FLM message must be distinguishable from UF2 block");
+
 static TaskHandle_t           task_target_writer_thread;
 static MessageBufferHandle_t  msgbuff_target_writer_thread;
 static SemaphoreHandle_t      sema_swd_in_use;
@@ -255,6 +280,9 @@ static void target_disconnect(TimerHandle_t xTimer)
     if (xSemaphoreTake(sema_swd_in_use, 0)) {
         if (is_connected) {
             picoprobe_info("=================================== MSC disconnect target\n");
+#if OPT_EVENT_STREAM
+            event_stream_probe(EVENT_PROBE_DISCONNECT, "MSC");
+#endif
             led_state(LS_MSC_DISCONNECTED);
             if (had_write) {
                 if (USE_DAPLINK()) {
@@ -293,6 +321,9 @@ bool msc_target_connect(bool write_mode)
         ok = true;
         if ( !is_connected  ||  now_us - last_trigger_us > 1000*1000) {
             picoprobe_info("=================================== MSC connect target\n");
+#if OPT_EVENT_STREAM
+            event_stream_probe(EVENT_PROBE_CONNECT, "MSC");
+#endif
             led_state(LS_MSC_CONNECTED);
 
             ok = target_set_state(ATTACH);
@@ -318,7 +349,7 @@ static void setup_uf2_record(struct uf2_block *uf2, uint32_t target_addr, uint32
 {
     uf2->magic_start0 = UF2_MAGIC_START0;
     uf2->magic_start1 = UF2_MAGIC_START1;
-    uf2->flags        = UF2_ID_IS_PRESENT() ? UF2_FLAG_FAMILY_ID_PRESENT : 0;
+    uf2->flags        = (UF2_ID_IS_PRESENT()  &&  !UF2_ID_IS_ANY()) ? UF2_FLAG_FAMILY_ID_PRESENT : 0;
     uf2->target_addr  = target_addr;
     uf2->payload_size = payload_size;
     uf2->block_no     = block_no;
@@ -334,7 +365,7 @@ bool msc_is_uf2_record(const void *sector, uint32_t sector_size)
     const uint32_t payload_size = 256;
     bool r = false;
 
-    if (sector_size >= sizeof(struct uf2_block)) {
+    if (UF2_ID_IS_PRESENT()  &&  sector_size >= sizeof(struct uf2_block)) {
         const struct uf2_block *uf2 = (const struct uf2_block *)sector;
 
         if (    uf2->magic_start0 == UF2_MAGIC_START0
@@ -347,7 +378,7 @@ bool msc_is_uf2_record(const void *sector, uint32_t sector_size)
             &&  uf2->target_addr - payload_size * uf2->block_no + payload_size * uf2->num_blocks
                         <= TARGET_FLASH_END) {
             if ((uf2->flags & UF2_FLAG_FAMILY_ID_PRESENT) != 0) {
-                if (uf2->file_size == UF2_ID) {
+                if (uf2->file_size == UF2_ID  ||  UF2_ID_IS_ANY()) {
                     r = true;
                 }
             }
@@ -373,6 +404,25 @@ bool msc_target_write_memory(const struct uf2_block *uf2)
 
 
 
+//
+// send a FLM sector to \a target_writer_thread(), because writing it to the probe flash
+// would stall the USB task
+//
+bool msc_flm_write_sector(uint32_t lba, const uint8_t *sector, uint32_t sector_size)
+{
+    static msc_flm_msg_t msg;
+
+    if (sector_size != sizeof(msg.sector))
+        return false;
+
+    msg.lba = lba;
+    memcpy(msg.sector, sector, sector_size);
+    xMessageBufferSend(msgbuff_target_writer_thread, &msg, sizeof(msg), portMAX_DELAY);
+    return true;
+}   // msc_flm_write_sector
+
+
+
 bool msc_target_read_memory(struct uf2_block *uf2, uint32_t target_addr, uint32_t block_no, uint32_t num_blocks)
 {
     const uint32_t payload_size = 256;
@@ -391,22 +441,32 @@ bool msc_target_read_memory(struct uf2_block *uf2, uint32_t target_addr, uint32_
 
 void target_writer_thread(void *ptr)
 {
-    static struct uf2_block uf2;
+    static msc_writer_msg_t msg;
+    struct uf2_block *uf2 = &msg.uf2;
     size_t   len;
 
     for (;;) {
-        len = xMessageBufferReceive(msgbuff_target_writer_thread, &uf2, sizeof(uf2), portMAX_DELAY);
-        assert(len == 512);
+        len = xMessageBufferReceive(msgbuff_target_writer_thread, &msg, sizeof(msg), portMAX_DELAY);
+        if (len == sizeof(msg.flm)) {
+            // probe flash only, no target access
+            flm_loader_msc_write(msg.flm.lba, msg.flm.sector, sizeof(msg.flm.sector));
+            continue;
+        }
+        assert(len == sizeof(msg.uf2));
 
-//        picoprobe_info("target_writer_thread(0x%lx, %ld, %ld), %u\n", uf2.target_addr, uf2.block_no, uf2.num_blocks, len);
+//        picoprobe_info("target_writer_thread(0x%lx, %ld, %ld), %u\n", uf2->target_addr, uf2->block_no, uf2->num_blocks, len);
 
         xSemaphoreTake(sema_swd_in_use, portMAX_DELAY);
 
         if (must_initialize) {
             if (USE_DAPLINK()) {
                 error_t sts;
+                bool page_erase;
 
-//              flash_manager_set_page_erase(false);
+                page_erase = (uf2->num_blocks * uf2->payload_size <= DAPLINK_PAGE_ERASE_MAX_IMAGE_SIZE);
+                flash_manager_set_page_erase(page_erase);
+                picoprobe_info("flash_manager: %s erase for %u bytes\n", page_erase ? "sector" : "chip",
+                               (unsigned)(uf2->num_blocks * uf2->payload_size));
                 sts = flash_manager_init(flash_intf_target);
                 picoprobe_info("flash_manager_init = %d\n", sts);
                 if (sts == ERROR_SUCCESS) {
@@ -426,29 +486,31 @@ void target_writer_thread(void *ptr)
         }
 
         if (USE_DAPLINK()) {
-            flash_manager_data(uf2.target_addr, uf2.data, uf2.payload_size);
+            flash_manager_data(uf2->target_addr, uf2->data, uf2->payload_size);
         }
         else {
             uint32_t arg[3];
             uint32_t res;
 
-            arg[0] = uf2.target_addr;
+            arg[0] = uf2->target_addr;
             arg[1] = TARGET_RP2040_DATA;
-            arg[2] = uf2.payload_size;
+            arg[2] = uf2->payload_size;
 
 //          picoprobe_info("     0x%lx, 0x%lx, 0x%lx, %ld\n", TARGET_RP2040_FLASH_BLOCK, arg[0], arg[1], arg[2]);
 
-            if (swd_write_memory(TARGET_RP2040_DATA, (uint8_t *)uf2.data, uf2.payload_size)) {
+            if (swd_write_memory(TARGET_RP2040_DATA, (uint8_t *)uf2->data, uf2->payload_size)) {
                 rp2040_target_call_function(TARGET_RP2040_FLASH_BLOCK, arg, sizeof(arg) / sizeof(arg[0]), &res);
                 if (res & 0xf0000000) {
                     picoprobe_error("target_writer_thread: target operation returned 0x%x\n", (unsigned)res);
                 }
             }
             else {
-                picoprobe_error("target_writer_thread: failed to write to 0x%x/%d\n", (unsigned)uf2.target_addr, (unsigned)uf2.payload_size);
+                picoprobe_error("target_writer_thread: failed to write to 0x%x/%d\n", (unsigned)uf2->target_addr, (unsigned)uf2->payload_size);
             }
         }
 
+        stats_inc(STATS_MSC_UF2_BLOCK);
+
         xTimerReset(timer_disconnect, pdMS_TO_TICKS(10));    // the above operation could take several 100ms!
         xSemaphoreGive(sema_swd_in_use);
     }
@@ -456,6 +518,11 @@ void target_writer_thread(void *ptr)
 
 
 
+/**
+ * Check if the target accepts UF2 images.
+ * Targets without family ID (generic targets without flash algorithm) do not accept UF2 records,
+ * but the drive stays writable anyway to allow the upload of a flash algorithm (FLM).
+ */
 bool msc_target_is_writable(void)
 {
     return UF2_ID_IS_PRESENT();
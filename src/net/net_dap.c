@@ -0,0 +1,454 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// CMSIS-DAP over TCP
+// - framing follows OpenOCDs "cmsis-dap backend tcp": each request/response is prefixed by a header
+//   with signature, length and packet type, see net_dap_framer.c
+// - one client, default port NET_DAP_SERVER_PORT
+// - requests are executed by a dedicated task via dap_server_execute(), i.e. the same path as CMSIS-DAPv2
+// - up to NET_DAP_PACKET_COUNT requests can be in flight, the host learns this via ID_DAP_Info
+// - flow control: the TCP window is opened only for data which fits into the request stream
+// - e.g. openocd -c "adapter driver cmsis-dap; cmsis-dap backend tcp; cmsis-dap tcp host 192.168.14.1" ...
+//
+
+#include <string.h>
+
+#include <pico/stdlib.h>
+
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+#include "task.h"
+
+#include "lwip/debug.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/err.h"
+
+#include "picoprobe_config.h"
+#include "net_dap.h"
+#include "net_dap_framer.h"
+#include "cmsis-dap/dap_server.h"
+#include "cmsis-dap/dap_util.h"
+#include "DAP_config.h"
+#include "DAP.h"
+#include "led.h"
+#include "sw_lock.h"
+#if OPT_EVENT_STREAM
+    #include "event_stream.h"
+#endif
+
+
+#ifndef NET_DAP_SERVER_PORT
+    #define NET_DAP_SERVER_PORT     4441
+#endif
+
+#define STREAM_NET_DAP_SIZE         (NET_DAP_PACKET_COUNT * (NET_DAP_HEADER_SIZE + NET_DAP_PACKET_SIZE))
+#define STREAM_NET_DAP_TRIGGER      1
+
+typedef struct {
+    struct tcp_pcb       *pcb;
+    volatile bool         connected;
+    volatile bool         cleanup_pending;           // set on disconnect, cleared by net_dap_thread() after reset of streams
+    volatile bool         close_requested;           // net_dap_thread() found a framing error
+    bool                  block_call_back_message;
+    struct pbuf          *rx_pending;                // data from host which did not fit into stream_to_probe
+    StreamBufferHandle_t  stream_to_probe;
+    StreamBufferHandle_t  stream_to_host;
+} net_dap_t;
+
+static net_dap_t         m_dap;
+static net_dap_framer_t  m_framer;
+static TaskHandle_t      task_net_dap = NULL;
+
+static uint8_t           response_buf[NET_DAP_HEADER_SIZE + NET_DAP_PACKET_SIZE];
+
+// the TCP transport does not care about USB endpoint sizes
+static const dap_transport_t net_dap_transport = {
+    .packet_count = NET_DAP_PACKET_COUNT,
+    .packet_size  = NET_DAP_PACKET_SIZE,
+};
+
+
+
+static void net_dap_close(void)
+{
+    picoprobe_info("=================================== DAP-TCP disconnect\n");
+
+    if (m_dap.pcb != NULL) {
+        tcp_arg(m_dap.pcb, NULL);
+        tcp_sent(m_dap.pcb, NULL);
+        tcp_recv(m_dap.pcb, NULL);
+        tcp_err(m_dap.pcb, NULL);
+        tcp_poll(m_dap.pcb, NULL, 0);
+
+        if (tcp_close(m_dap.pcb) != ERR_OK) {
+            tcp_abort(m_dap.pcb);
+        }
+    }
+    if (m_dap.rx_pending != NULL) {
+        pbuf_free(m_dap.rx_pending);
+    }
+
+    m_dap.pcb = NULL;
+    m_dap.rx_pending = NULL;
+    m_dap.block_call_back_message = false;
+    m_dap.close_requested = false;
+    m_dap.cleanup_pending = true;
+    m_dap.connected = false;
+}   // net_dap_close
+
+
+
+static void net_dap_error(void *arg, err_t err)
+{
+    picoprobe_error("net_dap_error: %d\n", err);
+
+    // pcb is already freed
+    m_dap.pcb = NULL;
+    net_dap_close();
+}   // net_dap_error
+
+
+
+static void net_dap_try_send(void *ctx)
+/**
+ * Transfer responses into the TCP connection.
+ *
+ * Context: lwIP
+ */
+{
+    bool written = false;
+
+    m_dap.block_call_back_message = false;
+
+    if (m_dap.close_requested  &&  m_dap.connected) {
+        net_dap_close();
+        return;
+    }
+
+    while (m_dap.connected  &&  !xStreamBufferIsEmpty(m_dap.stream_to_host)) {
+        uint8_t tx_buf[256];
+        size_t cnt;
+        err_t err;
+
+        cnt = MIN(sizeof(tx_buf), tcp_sndbuf(m_dap.pcb));
+        if (cnt == 0) {
+            // continued by net_dap_sent()
+            break;
+        }
+        cnt = xStreamBufferReceive(m_dap.stream_to_host, tx_buf, cnt, 0);
+        err = tcp_write(m_dap.pcb, tx_buf, cnt, TCP_WRITE_FLAG_COPY);
+        if (err != ERR_OK) {
+            picoprobe_error("net_dap_try_send: %d\n", err);
+            net_dap_close();
+            return;
+        }
+        written = true;
+    }
+
+    if (written) {
+        tcp_output(m_dap.pcb);
+    }
+}   // net_dap_try_send
+
+
+
+static void net_dap_feed_probe(void *ctx)
+/**
+ * Put pending requests from host into \a stream_to_probe.
+ *
+ * Context: lwIP
+ */
+{
+    while (m_dap.connected  &&  m_dap.rx_pending != NULL) {
+        size_t cnt = MIN(m_dap.rx_pending->len, xStreamBufferSpacesAvailable(m_dap.stream_to_probe));
+
+        if (cnt == 0) {
+            // continued by net_dap_thread() via tcpip_try_callback()
+            break;
+        }
+        cnt = xStreamBufferSend(m_dap.stream_to_probe, m_dap.rx_pending->payload, cnt, 0);
+        tcp_recved(m_dap.pcb, cnt);
+        m_dap.rx_pending = pbuf_free_header(m_dap.rx_pending, cnt);
+    }
+}   // net_dap_feed_probe
+
+
+
+static err_t net_dap_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len)
+{
+    net_dap_try_send(NULL);
+    return ERR_OK;
+}   // net_dap_sent
+
+
+
+static err_t net_dap_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    if (p == NULL) {
+        // remote host closed connection
+        net_dap_close();
+        return ERR_OK;
+    }
+    if (err != ERR_OK) {
+        pbuf_free(p);
+        return err;
+    }
+
+    if (m_dap.rx_pending == NULL) {
+        m_dap.rx_pending = p;
+    }
+    else {
+        pbuf_cat(m_dap.rx_pending, p);
+    }
+    net_dap_feed_probe(NULL);
+    return ERR_OK;
+}   // net_dap_recv
+
+
+
+static err_t net_dap_poll(void *arg, struct tcp_pcb *tpcb)
+{
+    net_dap_feed_probe(NULL);
+    net_dap_try_send(NULL);
+    return ERR_OK;
+}   // net_dap_poll
+
+
+
+static err_t net_dap_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    if (err != ERR_OK  ||  newpcb == NULL) {
+        return ERR_VAL;
+    }
+    if (m_dap.pcb != NULL  ||  m_dap.cleanup_pending) {
+        picoprobe_error("net_dap_accept: server is busy\n");
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    picoprobe_info("=================================== DAP-TCP connect\n");
+
+    m_dap.pcb = newpcb;
+
+    tcp_arg(newpcb,  NULL);
+    tcp_err(newpcb,  net_dap_error);
+    tcp_recv(newpcb, net_dap_recv);
+    tcp_poll(newpcb, net_dap_poll, 1);
+    tcp_sent(newpcb, net_dap_sent);
+
+    m_dap.connected = true;
+    return ERR_OK;
+}   // net_dap_accept
+
+
+
+static void net_dap_trigger_send(void)
+{
+    if ( !m_dap.block_call_back_message) {
+        m_dap.block_call_back_message = true;
+        if (tcpip_try_callback(net_dap_try_send, NULL) != ERR_OK) {
+            m_dap.block_call_back_message = false;
+        }
+    }
+}   // net_dap_trigger_send
+
+
+
+static bool net_dap_send_response(uint16_t resp_len)
+/**
+ * Put header and response into \a stream_to_host.  Blocks until there is enough space or the
+ * connection has been closed.
+ */
+{
+    size_t len = NET_DAP_HEADER_SIZE + resp_len;
+    size_t sent = 0;
+
+    net_dap_framer_response_header(response_buf, resp_len);
+    while (sent < len) {
+        sent += xStreamBufferSend(m_dap.stream_to_host, response_buf + sent, len - sent, pdMS_TO_TICKS(100));
+        net_dap_trigger_send();
+        if ( !m_dap.connected) {
+            return false;
+        }
+    }
+    return true;
+}   // net_dap_send_response
+
+
+
+void net_dap_thread(void *ptr)
+{
+    bool swd_connected = false;
+    bool swd_disconnect_requested = false;
+    uint32_t last_request_us = 0;
+    bool framing_error = false;
+
+    for (;;) {
+        uint8_t *rx_buf;
+        uint32_t space;
+
+        //
+        // (re)initialize after the TCP connection has been closed, see net_dap_close()
+        //
+        if (m_dap.cleanup_pending) {
+            xStreamBufferReset(m_dap.stream_to_probe);
+            xStreamBufferReset(m_dap.stream_to_host);
+            net_dap_framer_init(&m_framer);
+            framing_error = false;
+            swd_disconnect_requested = true;
+            last_request_us = time_us_32() - 1000000;
+            m_dap.cleanup_pending = false;
+        }
+
+        // disconnect after 1s without data or if the client has gone
+        if (swd_disconnect_requested  &&  time_us_32() - last_request_us >= 1000000) {
+            if (swd_connected) {
+                swd_connected = false;
+                picoprobe_info("=================================== DAP-TCP disconnect target\n");
+#if OPT_EVENT_STREAM
+                event_stream_probe(EVENT_PROBE_DISCONNECT, "DAP-TCP");
+#endif
+                led_state(LS_DAPV2_DISCONNECTED);
+                sw_unlock("DAP-TCP");
+            }
+            swd_disconnect_requested = false;
+        }
+
+        // space == 0: NET_DAP_PACKET_COUNT requests are waiting, execute them first
+        rx_buf = net_dap_framer_rx_buf(&m_framer, &space);
+        if (space != 0) {
+            net_dap_framer_rx_done(&m_framer,
+                                   xStreamBufferReceive(m_dap.stream_to_probe, rx_buf, space, pdMS_TO_TICKS(100)));
+        }
+        if (m_dap.rx_pending != NULL) {
+            tcpip_try_callback(net_dap_feed_probe, NULL);
+        }
+
+        for (;;) {
+            const uint8_t *request;
+            uint16_t req_len;
+            uint32_t resp_len;
+
+            if (m_dap.cleanup_pending) {
+                break;
+            }
+            request = net_dap_framer_request(&m_framer, &req_len);
+            if (request == NULL) {
+                break;
+            }
+
+            last_request_us = time_us_32();
+
+            //
+            // initiate SWD connect / disconnect, same as dap_task()
+            //
+            if ( !swd_connected  &&  request[0] != ID_DAP_Info  &&  !DAP_IS_VENDOR_STATS_COMMAND(request[0])) {
+                if (sw_lock("DAP-TCP", true)) {
+                    swd_connected = true;
+                    picoprobe_info("=================================== DAP-TCP connect target, buffer: %dx%dbytes\n",
+                                   net_dap_transport.packet_count, net_dap_transport.packet_size);
+                    led_state(LS_DAPV2_CONNECTED);
+#if OPT_EVENT_STREAM
+                    event_stream_probe(EVENT_PROBE_CONNECT, "DAP-TCP");
+#endif
+                }
+            }
+            swd_disconnect_requested = (request[0] == ID_DAP_Disconnect  ||  request[0] == ID_DAP_Info
+                                        ||  request[0] == ID_DAP_HostStatus);
+
+            //
+            // execute request and send back response
+            //
+            if (swd_connected  ||  DAP_OfflineCommand(request)) {
+                resp_len = dap_server_execute(&net_dap_transport, request, response_buf + NET_DAP_HEADER_SIZE);
+            }
+            else {
+                // no SWD: answer with DAP_ERROR so that the host does not wait for a response
+                response_buf[NET_DAP_HEADER_SIZE + 0] = request[0];
+                response_buf[NET_DAP_HEADER_SIZE + 1] = DAP_ERROR;
+                resp_len = 2;
+            }
+
+            if ( !net_dap_send_response(resp_len & 0xffff)) {
+                break;
+            }
+
+            net_dap_framer_release(&m_framer);
+        }
+
+        if (m_framer.error  &&  !framing_error) {
+            picoprobe_error("net_dap_thread: invalid header\n");
+            framing_error = true;
+            m_dap.close_requested = true;
+            net_dap_trigger_send();
+        }
+    }
+}   // net_dap_thread
+
+
+
+void net_dap_init(uint32_t task_prio)
+{
+    struct tcp_pcb *pcb;
+    struct tcp_pcb *pcb_listen;
+    err_t err;
+
+    m_dap.stream_to_probe = xStreamBufferCreate(STREAM_NET_DAP_SIZE, STREAM_NET_DAP_TRIGGER);
+    m_dap.stream_to_host  = xStreamBufferCreate(STREAM_NET_DAP_SIZE, STREAM_NET_DAP_TRIGGER);
+    if (m_dap.stream_to_probe == NULL  ||  m_dap.stream_to_host == NULL) {
+        picoprobe_error("net_dap_init: cannot create streams\n");
+        return;
+    }
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL)
+    {
+        picoprobe_error("net_dap_init: cannot get pcb\n");
+        return;
+    }
+
+    err = tcp_bind(pcb, IP_ADDR_ANY, NET_DAP_SERVER_PORT);
+    if (err != ERR_OK)
+    {
+        picoprobe_error("net_dap_init: cannot bind, err:%d\n", err);
+        return;
+    }
+
+    pcb_listen = tcp_listen_with_backlog(pcb, 1);
+    if (pcb_listen == NULL)
+    {
+        tcp_close(pcb);
+        picoprobe_error("net_dap_init: cannot listen\n");
+        return;
+    }
+
+    tcp_accept(pcb_listen, net_dap_accept);
+
+    xTaskCreate(net_dap_thread, "DAP-TCP", configMINIMAL_STACK_SIZE, NULL, task_prio, &task_net_dap);
+}   // net_dap_init
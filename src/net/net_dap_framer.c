@@ -0,0 +1,180 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// Request framing of the CMSIS-DAP TCP server, see net_dap.c
+// - requests are reassembled independent of how the host data is split into pbufs / stream reads
+// - a header is checked as soon as it is complete: signature, type and 0 < length <= NET_DAP_PACKET_SIZE
+// - at most NET_DAP_PACKET_COUNT complete requests are buffered, further host data stays in TCP
+//   which closes the window
+// - no lwIP or FreeRTOS here, so the framing is covered by the host tests
+//
+
+#include <string.h>
+
+#include "net_dap_framer.h"
+
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}   // get_u32
+
+
+
+static uint32_t net_dap_framer_frame_len(net_dap_framer_t *f, uint32_t offs)
+/**
+ * Check the header at \a offs.
+ *
+ * \return length of the frame including header, 0 if the header is incomplete or invalid
+ */
+{
+    const uint8_t *hdr = f->buf + offs;
+    uint16_t len;
+
+    if (f->error  ||  f->rx_len - offs < NET_DAP_HEADER_SIZE) {
+        return 0;
+    }
+
+    len = hdr[4] | (hdr[5] << 8);
+    if (get_u32(hdr) != NET_DAP_SIGNATURE  ||  hdr[6] != NET_DAP_TYPE_REQUEST
+        ||  len == 0  ||  len > NET_DAP_PACKET_SIZE) {
+        f->error = true;
+        f->rx_len = 0;
+        return 0;
+    }
+    return NET_DAP_HEADER_SIZE + len;
+}   // net_dap_framer_frame_len
+
+
+
+static uint32_t net_dap_framer_requests(net_dap_framer_t *f)
+/**
+ * Check all complete headers in the buffer.
+ *
+ * \return number of complete requests
+ */
+{
+    uint32_t offs = 0;
+    uint32_t requests = 0;
+
+    for (;;) {
+        uint32_t frame_len = net_dap_framer_frame_len(f, offs);
+
+        if (frame_len == 0  ||  offs + frame_len > f->rx_len) {
+            break;
+        }
+        offs += frame_len;
+        ++requests;
+    }
+    return requests;
+}   // net_dap_framer_requests
+
+
+
+void net_dap_framer_init(net_dap_framer_t *f)
+{
+    f->rx_len = 0;
+    f->error = false;
+}   // net_dap_framer_init
+
+
+
+uint8_t *net_dap_framer_rx_buf(net_dap_framer_t *f, uint32_t *space)
+/**
+ * Get the free part of the receive buffer.  \a space is 0 if NET_DAP_PACKET_COUNT requests
+ * are waiting for execution.
+ * After an error the buffer is always available, received data is dropped.
+ */
+{
+    *space = (net_dap_framer_requests(f) >= NET_DAP_PACKET_COUNT) ? 0 : sizeof(f->buf) - f->rx_len;
+    return f->buf + f->rx_len;
+}   // net_dap_framer_rx_buf
+
+
+
+void net_dap_framer_rx_done(net_dap_framer_t *f, uint32_t len)
+/**
+ * \a len bytes have been written into the buffer from net_dap_framer_rx_buf().
+ * Headers are checked immediately, so \a error is set as soon as an invalid one is complete.
+ */
+{
+    if ( !f->error) {
+        f->rx_len += len;
+        net_dap_framer_requests(f);
+    }
+}   // net_dap_framer_rx_done
+
+
+
+const uint8_t *net_dap_framer_request(net_dap_framer_t *f, uint16_t *len)
+/**
+ * Get the next complete request.  It stays valid until net_dap_framer_release().
+ *
+ * \return pointer to the request, NULL if there is none (check \a error)
+ */
+{
+    uint32_t frame_len = net_dap_framer_frame_len(f, 0);
+
+    if (frame_len == 0  ||  frame_len > f->rx_len) {
+        return NULL;
+    }
+    *len = frame_len - NET_DAP_HEADER_SIZE;
+    return f->buf + NET_DAP_HEADER_SIZE;
+}   // net_dap_framer_request
+
+
+
+void net_dap_framer_release(net_dap_framer_t *f)
+/**
+ * Remove the request returned by net_dap_framer_request() from the buffer.
+ */
+{
+    uint32_t frame_len = net_dap_framer_frame_len(f, 0);
+
+    if (frame_len != 0  &&  frame_len <= f->rx_len) {
+        memmove(f->buf, f->buf + frame_len, f->rx_len - frame_len);
+        f->rx_len -= frame_len;
+    }
+}   // net_dap_framer_release
+
+
+
+void net_dap_framer_response_header(uint8_t *hdr, uint16_t len)
+/**
+ * Fill in the header of a response with \a len bytes.
+ */
+{
+    hdr[0] = (NET_DAP_SIGNATURE >>  0) & 0xff;
+    hdr[1] = (NET_DAP_SIGNATURE >>  8) & 0xff;
+    hdr[2] = (NET_DAP_SIGNATURE >> 16) & 0xff;
+    hdr[3] = (NET_DAP_SIGNATURE >> 24) & 0xff;
+    hdr[4] = len & 0xff;
+    hdr[5] = len >> 8;
+    hdr[6] = NET_DAP_TYPE_RESPONSE;
+    hdr[7] = 0;
+}   // net_dap_framer_response_header
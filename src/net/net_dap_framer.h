@@ -0,0 +1,70 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _NET_DAP_FRAMER_H
+#define _NET_DAP_FRAMER_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+// framing of OpenOCDs "cmsis-dap backend tcp": header with signature, length, type, reserved (little endian)
+#define NET_DAP_SIGNATURE           0x00504144                 // "DAP\0"
+#define NET_DAP_TYPE_REQUEST        0x01
+#define NET_DAP_TYPE_RESPONSE       0x02
+#define NET_DAP_HEADER_SIZE         8
+
+#define NET_DAP_PACKET_COUNT        4
+#define NET_DAP_PACKET_SIZE         512
+
+#define NET_DAP_FRAMER_BUF_SIZE     (NET_DAP_PACKET_COUNT * (NET_DAP_HEADER_SIZE + NET_DAP_PACKET_SIZE))
+
+typedef struct {
+    uint32_t              rx_len;                    // bytes in buf
+    bool                  error;                     // invalid header, further data is dropped until init
+    uint8_t               buf[NET_DAP_FRAMER_BUF_SIZE];
+} net_dap_framer_t;
+
+
+void net_dap_framer_init(net_dap_framer_t *f);
+uint8_t *net_dap_framer_rx_buf(net_dap_framer_t *f, uint32_t *space);
+void net_dap_framer_rx_done(net_dap_framer_t *f, uint32_t len);
+const uint8_t *net_dap_framer_request(net_dap_framer_t *f, uint16_t *len);
+void net_dap_framer_release(net_dap_framer_t *f);
+void net_dap_framer_response_header(uint8_t *hdr, uint16_t len);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// TCP server for the merged event stream
+// - one client on port NET_EVENTS_SERVER_PORT, data from the client is ignored
+// - while a client is connected, the event stream goes to TCP instead of the events CDC
+// - frame format see event_stream.h, e.g. "nc 192.168.14.1 19200 | xxd"
+//
+
+#include <pico/stdlib.h>
+
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+
+#include "lwip/debug.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/err.h"
+
+#include "picoprobe_config.h"
+#include "net_events.h"
+
+
+#ifndef NET_EVENTS_SERVER_PORT
+    #define NET_EVENTS_SERVER_PORT  19200
+#endif
+
+#define STREAM_NET_EVENTS_SIZE      4096
+#define STREAM_NET_EVENTS_TRIGGER   1
+
+static struct tcp_pcb        *m_pcb;
+static volatile bool          m_connected;
+static bool                   block_call_back_message;
+static StreamBufferHandle_t   stream_to_host;
+
+
+
+static void net_events_close(void)
+{
+    picoprobe_info("=================================== Events-TCP disconnect\n");
+
+    if (m_pcb != NULL) {
+        tcp_arg(m_pcb, NULL);
+        tcp_sent(m_pcb, NULL);
+        tcp_recv(m_pcb, NULL);
+        tcp_err(m_pcb, NULL);
+        tcp_poll(m_pcb, NULL, 0);
+
+        if (tcp_close(m_pcb) != ERR_OK) {
+            tcp_abort(m_pcb);
+        }
+    }
+
+    m_pcb = NULL;
+    m_connected = false;
+    block_call_back_message = false;
+    xStreamBufferReset(stream_to_host);
+}   // net_events_close
+
+
+
+static void net_events_error(void *arg, err_t err)
+{
+    picoprobe_error("net_events_error: %d\n", err);
+
+    // pcb is already freed
+    m_pcb = NULL;
+    net_events_close();
+}   // net_events_error
+
+
+
+static void net_events_try_send(void *ctx)
+/**
+ * Transfer frames from \a stream_to_host into the TCP connection.
+ *
+ * Context: lwIP
+ */
+{
+    bool written = false;
+
+    block_call_back_message = false;
+
+    while (m_connected  &&  !xStreamBufferIsEmpty(stream_to_host)) {
+        uint8_t tx_buf[256];
+        size_t cnt;
+        err_t err;
+
+        cnt = MIN(sizeof(tx_buf), tcp_sndbuf(m_pcb));
+        if (cnt == 0) {
+            // continued by net_events_sent()
+            break;
+        }
+        cnt = xStreamBufferReceive(stream_to_host, tx_buf, cnt, 0);
+        err = tcp_write(m_pcb, tx_buf, cnt, TCP_WRITE_FLAG_COPY);
+        if (err != ERR_OK) {
+            picoprobe_error("net_events_try_send: %d\n", err);
+            net_events_close();
+            return;
+        }
+        written = true;
+    }
+
+    if (written) {
+        tcp_output(m_pcb);
+    }
+}   // net_events_try_send
+
+
+
+static err_t net_events_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len)
+{
+    net_events_try_send(NULL);
+    return ERR_OK;
+}   // net_events_sent
+
+
+
+static err_t net_events_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    if (p == NULL) {
+        // remote host closed connection
+        net_events_close();
+        return ERR_OK;
+    }
+
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}   // net_events_recv
+
+
+
+static err_t net_events_poll(void *arg, struct tcp_pcb *tpcb)
+{
+    net_events_try_send(NULL);
+    return ERR_OK;
+}   // net_events_poll
+
+
+
+static err_t net_events_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    if (err != ERR_OK  ||  newpcb == NULL) {
+        return ERR_VAL;
+    }
+    if (m_pcb != NULL) {
+        picoprobe_error("net_events_accept: server is busy\n");
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    picoprobe_info("=================================== Events-TCP connect\n");
+
+    m_pcb = newpcb;
+    xStreamBufferReset(stream_to_host);
+
+    tcp_arg(newpcb,  NULL);
+    tcp_err(newpcb,  net_events_error);
+    tcp_recv(newpcb, net_events_recv);
+    tcp_poll(newpcb, net_events_poll, 1);
+    tcp_sent(newpcb, net_events_sent);
+
+    m_connected = true;
+    return ERR_OK;
+}   // net_events_accept
+
+
+
+bool net_events_is_connected(void)
+{
+    return m_connected;
+}   // net_events_is_connected
+
+
+
+uint32_t net_events_send(const uint8_t *buf, uint32_t cnt)
+/**
+ * Send frames of the event stream into the stream of the TCP connection.
+ *
+ * \param buf  pointer to the buffer to be sent, if NULL then remaining space in stream is returned
+ * \param cnt  number of bytes to be sent
+ * \return if \buf is NULL the remaining space in stream is returned, otherwise the number of bytes sent
+ */
+{
+    uint32_t r;
+
+    if (buf == NULL) {
+        return xStreamBufferSpacesAvailable(stream_to_host);
+    }
+    if ( !m_connected) {
+        return 0;
+    }
+
+    r = xStreamBufferSend(stream_to_host, buf, cnt, 0);
+
+    if ( !block_call_back_message) {
+        block_call_back_message = true;
+        if (tcpip_try_callback(net_events_try_send, NULL) != ERR_OK) {
+            block_call_back_message = false;
+        }
+    }
+    return r;
+}   // net_events_send
+
+
+
+void net_events_init(void)
+{
+    err_t err;
+    struct tcp_pcb *pcb;
+    struct tcp_pcb *pcb_listen;
+
+    stream_to_host = xStreamBufferCreate(STREAM_NET_EVENTS_SIZE, STREAM_NET_EVENTS_TRIGGER);
+    if (stream_to_host == NULL) {
+        picoprobe_error("net_events_init: cannot create stream_to_host\n");
+        return;
+    }
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL)
+    {
+        picoprobe_error("net_events_init: cannot get pcb\n");
+        return;
+    }
+
+    err = tcp_bind(pcb, IP_ADDR_ANY, NET_EVENTS_SERVER_PORT);
+    if (err != ERR_OK)
+    {
+        picoprobe_error("net_events_init: cannot bind, err:%d\n", err);
+        return;
+    }
+
+    pcb_listen = tcp_listen_with_backlog(pcb, 1);
+    if (pcb_listen == NULL)
+    {
+        tcp_close(pcb);
+        picoprobe_error("net_events_init: cannot listen\n");
+        return;
+    }
+
+    tcp_accept(pcb_listen, net_events_accept);
+}   // net_events_init
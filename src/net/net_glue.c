@@ -35,28 +35,67 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "hardware/sync.h"
+
 #include "picoprobe_config.h"
 
 #include "lwip/tcpip.h"
+#include "lwip/memp.h"
 #include "dhserver.h"
 
 #include "tusb.h"
 #include "device/usbd_pvt.h"             // for usbd_defer_func
 #include "tinyusb/net_device.h"
+#if OPT_NET_PROTO_NCM
+    #include "tinyusb/ncm.h"
+#endif
 
 #include "minIni/minIni.h"
+#include "net_release_ring.h"
+#include "net_xmt_queue.h"
 
 
 /// lwIP context
 static struct netif netif_data;
 
-/// Buffer for lwIP <- TinyUSB transmission
-static uint8_t  rcv_buff[CFG_TUD_NET_MTU + 10];    // MTU plus some margin
-static volatile uint16_t rcv_buff_len = 0;
+#if OPT_NET_PROTO_NCM
+    /// Custom pbuf referencing a datagram in an NCM receive NTB (lwIP <- TinyUSB transmission without copy)
+    typedef struct {
+        struct pbuf_custom pc;
+        void              *ntb_ref;                   // reference for tud_network_recv_release()
+    } rcv_pbuf_t;
 
-/// Buffer for lwIP -> TinyUSB transmission
-static uint8_t  xmt_buff[CFG_TUD_NET_MTU + 10];    // MTU plus some margin
-static volatile uint16_t xmt_buff_len = 0;
+    LWIP_MEMPOOL_DECLARE(RCV_PBUF, CFG_TUD_NCM_OUT_NTB_N * CFG_TUD_NCM_MAX_DATAGRAMS_PER_NTB, sizeof(rcv_pbuf_t), "NCM rcv pbuf")
+#else
+    /// Buffer for lwIP <- TinyUSB transmission
+    static uint8_t  rcv_buff[CFG_TUD_NET_MTU + 10];    // MTU plus some margin
+    static volatile uint16_t rcv_buff_len = 0;
+#endif
+
+/// Queue for lwIP -> TinyUSB transmission, index bookkeeping in net_xmt_queue.c.
+/// Several frames in the queue allow NCM to pack them into one NTB.
+#define XMT_QUEUE_N   4                            // must be a power of 2
+
+typedef struct {
+    uint16_t len;
+    uint8_t  data[CFG_TUD_NET_MTU + 10];           // MTU plus some margin
+} xmt_frame_t;
+
+static xmt_frame_t       xmt_frames[XMT_QUEUE_N];
+static net_xmt_queue_t   xmt_queue;
+
+/// Events lwIP -> TinyUSB.
+/// Events are collected lock-free by the lwIP thread (the only producer) and are processed by
+/// context_tinyusb_events().  TinyUSB gets at most one pending usbd_defer_func() call, so its event
+/// queue cannot overflow and no locking is required, also if lwIP and TinyUSB run on different cores.
+static volatile bool     usb_events_pending;       // context_tinyusb_events() is already deferred
+static volatile bool     usb_event_recv_renew;     // reception logic must be reenabled
+#if OPT_NET_PROTO_NCM
+    #define USB_RELEASE_N    32                    // must be a power of 2 and larger than the RCV_PBUF pool
+
+    static void               *usb_release_buf[USB_RELEASE_N];
+    static net_release_ring_t  usb_release_ring;    // datagrams for tud_network_recv_release()
+#endif
 
 #ifndef OPT_NET_192_168
     #define OPT_NET_192_168   14
@@ -97,23 +136,180 @@ void tud_network_init_cb(void)
  * initialize any network state back to the beginning
  */
 {
+#if !OPT_NET_PROTO_NCM
     rcv_buff_len = 0;
-    xmt_buff_len = 0;
+#endif
+    net_xmt_queue_flush(&xmt_queue);
 }   // tud_network_init_cb
 
 
 
-static void context_tinyusb_tud_network_recv_renew(void *param)
+static void context_tinyusb_linkoutput(void);
+
+static void context_tinyusb_events(void *param)
+/**
+ * Process all events signaled by lwIP.
+ *
+ * Context: TinyUSB
+ */
+{
+    usb_events_pending = false;
+    __dmb();
+
+#if OPT_NET_PROTO_NCM
+    void *ntb_ref;
+
+    while ((ntb_ref = net_release_ring_get(&usb_release_ring)) != NULL) {
+        tud_network_recv_release(ntb_ref);
+    }
+#endif
+
+    if (usb_event_recv_renew) {
+        usb_event_recv_renew = false;
+        tud_network_recv_renew();
+    }
+
+    if (net_xmt_queue_event(&xmt_queue)) {
+        context_tinyusb_linkoutput();
+    }
+}   // context_tinyusb_events
+
+
+
+static void net_glue_usb_wakeup(void)
+/**
+ * Trigger processing of signaled events in TinyUSB context.
+ *
+ * Context: lwIP
+ */
+{
+    __dmb();
+    if ( !usb_events_pending) {
+        usb_events_pending = true;
+        usbd_defer_func(context_tinyusb_events, NULL, false);
+    }
+}   // net_glue_usb_wakeup
+
+
+
+static void xmt_queue_wakeup(void *ctx)
+{
+    net_glue_usb_wakeup();
+}   // xmt_queue_wakeup
+
+
+
+static void net_glue_recv_renew(void)
 /**
  * Reenable reception logic in TinyUSB.
  *
+ * Context: lwIP
+ */
+{
+    usb_event_recv_renew = true;
+    net_glue_usb_wakeup();
+}   // net_glue_recv_renew
+
+
+
+#if OPT_NET_PROTO_NCM
+
+static void rcv_pbuf_free(struct pbuf *p)
+/**
+ * Free function of the custom pbufs, called by pbuf_free().
+ * The datagram is given back to the driver in TinyUSB context.
+ *
+ * Context: lwIP (TinyUSB if the datagram could not be delivered to lwIP, \a ntb_ref is NULL then)
+ */
+{
+    rcv_pbuf_t *rp = (rcv_pbuf_t *)p;
+    void *ntb_ref = rp->ntb_ref;
+
+    LWIP_MEMPOOL_FREE(RCV_PBUF, rp);
+
+    if (ntb_ref != NULL) {
+        bool ok = net_release_ring_put(&usb_release_ring, ntb_ref);
+
+        assert(ok);                                     // ring is larger than the RCV_PBUF pool
+        (void)ok;
+        net_glue_usb_wakeup();
+    }
+}   // rcv_pbuf_free
+
+
+
+static void net_glue_recv_retry(void *ptr)
+/**
+ * Reception has been stalled because of lack of pbufs.  Retry after lwIP has done its work.
+ *
+ * Context: lwIP
+ */
+{
+    net_glue_recv_renew();
+}   // net_glue_recv_retry
+
+
+
+bool tud_network_recv_ref_cb(const uint8_t *src, uint16_t size, void *ref)
+/**
+ * Wrap datagram (host ->) TinyUSB -> lwIP (-> application) into a custom pbuf without copy.
+ * The datagram is given back to the driver by rcv_pbuf_free().
+ *
  * Context: TinyUSB
+ *
+ * \return false if the datagram was not accepted, driver retries after the next tud_network_recv_release()
+ *         or reception of the next NTB
  */
 {
-    tud_network_recv_renew();
-}   // context_tinyusb_tud_network_recv_renew
+    //printf("tud_network_recv_ref_cb(%p,%u,%p)\n", src, size, ref);
 
+    rcv_pbuf_t *rp = (rcv_pbuf_t *)LWIP_MEMPOOL_ALLOC(RCV_PBUF);
+    if (rp == NULL) {
+        return false;
+    }
+
+    rp->pc.custom_free_function = rcv_pbuf_free;
+    rp->ntb_ref = ref;
+    struct pbuf *p = pbuf_alloced_custom(PBUF_RAW, size, PBUF_REF, &rp->pc, (void *)src, size);
+
+    if (tcpip_inpkt(p, &netif_data, ethernet_input) != ERR_OK) {
+        // lwIP mailbox full: datagram is not released by rcv_pbuf_free() but offered again by the driver
+        rp->ntb_ref = NULL;
+        pbuf_free(p);
+        return false;
+    }
+    return true;
+}   // tud_network_recv_ref_cb
+
+
+
+bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
+/**
+ * Copy datagram (host ->) TinyUSB -> lwIP (-> application).
+ * Used by the NCM driver if zero copy would block reception.
+ *
+ * Context: TinyUSB
+ *
+ * \return false if the datagram was not accepted
+ */
+{
+    //printf("tud_network_recv_cb(%p,%u)\n", src, size);
 
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, size, PBUF_POOL);
+
+    if (p == NULL) {
+        tcpip_try_callback(net_glue_recv_retry, NULL);
+        return false;
+    }
+
+    pbuf_take(p, src, size);
+    if (tcpip_inpkt(p, &netif_data, ethernet_input) != ERR_OK) {
+        pbuf_free(p);
+    }
+    return true;
+}   // tud_network_recv_cb
+
+#else
 
 static void net_glue_usb_to_lwip(void *ptr)
 /**
@@ -132,11 +328,7 @@ static void net_glue_usb_to_lwip(void *ptr)
             ethernet_input(p, &netif_data);
             pbuf_free(p);
             rcv_buff_len = 0;
-
-            taskDISABLE_INTERRUPTS();
-            // TODO not safe, because it does only block USB interrupts on operation
-            usbd_defer_func(context_tinyusb_tud_network_recv_renew, NULL, false);   // TODO this is actually not safe!
-            taskENABLE_INTERRUPTS();
+            net_glue_recv_renew();
         }
     }
 }   // net_glue_usb_to_lwip
@@ -161,13 +353,13 @@ bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
         assert(size < sizeof(rcv_buff));
         memcpy(rcv_buff, src, size);
         rcv_buff_len = size;
-        taskDISABLE_INTERRUPTS();
-        tcpip_try_callback(net_glue_usb_to_lwip, NULL);      // this seems to be safe
-        taskENABLE_INTERRUPTS();
+        tcpip_try_callback(net_glue_usb_to_lwip, NULL);
     }
     return true;
 }   // tud_network_recv_cb
 
+#endif
+
 
 
 uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg)
@@ -184,54 +376,77 @@ uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg)
 {
     //printf("!!!!!!!!!!!!!!tud_network_xmit_cb(%p,%p,%u)\n", dst, ref, arg);
 
-    uint16_t r = xmt_buff_len;
-    memcpy(dst, xmt_buff, xmt_buff_len);
-    xmt_buff_len = 0;
-    return r;
+    const xmt_frame_t *frame = (const xmt_frame_t *)ref;
+
+    memcpy(dst, frame->data, arg);
+    return arg;
 }   // tud_network_xmit_cb
 
 
-//// XXXX=0 - works, good performance also with ECM
-//// XXXX=1 - works ok, but there is a nested call to tud_task()
-//// XXXX=2 - works, but inconsistent transmission performance with ECM (lwIP seems to switch a delay between retries)
-#define XXXX 1
 
-static void context_tinyusb_linkoutput(void *param)
+static bool xmt_retry_pending;                     // context_tinyusb_linkoutput_retry() is deferred (TinyUSB only)
+
+static void context_tinyusb_linkoutput_retry(void *param)
+{
+    xmt_retry_pending = false;
+    context_tinyusb_linkoutput();
+}   // context_tinyusb_linkoutput_retry
+
+
+
+static bool context_tinyusb_xmit(void *ctx, uint32_t slot)
 /**
- * Put \a xmt_buff into TinyUSB.
+ * Hand one frame of \a xmt_queue to the driver.
  *
  * Context: TinyUSB
  */
 {
-#if XXXX == 0
-    if ( !tud_network_can_xmit(xmt_buff_len)) {
-//        printf("context_tinyusb_linkoutput: sleep\n");
-        vTaskDelay(pdMS_TO_TICKS(1));
-
-        taskDISABLE_INTERRUPTS();
-        usbd_defer_func(context_tinyusb_linkoutput, NULL, false);    // put yourself at end of TinyUSB event queue
-        taskENABLE_INTERRUPTS();
-    }
-    else {
-        tud_network_xmit(xmt_buff, xmt_buff_len);
-    }
-#elif XXXX == 1
-    // ATTENTION: lwiperf does not work with this and ECM, command line
-    //               iperf -c 192.168.14.1 -e -i 1 -M 1000 -l 8192 -r
-    //            kills the device
-    while ( !tud_network_can_xmit(xmt_buff_len)) {
-        //vTaskDelay(pdMS_TO_TICKS(1));
-        tud_task();
+    xmt_frame_t *frame = xmt_frames + slot;
+
+    if ( !tud_network_can_xmit(frame->len)) {
+        return false;
     }
-    tud_network_xmit(xmt_buff, xmt_buff_len);
-#else
-    assert(tud_network_can_xmit(xmt_buff_len));
-    tud_network_xmit(xmt_buff, xmt_buff_len);
+    tud_network_xmit(frame, frame->len);
+    return true;
+}   // context_tinyusb_xmit
+
+
+
+static void context_tinyusb_linkoutput(void)
+/**
+ * Put all frames of \a xmt_queue into TinyUSB.
+ * If the driver cannot take more, this is called again by tud_network_xmit_ready_cb() (NCM)
+ * or from the end of the TinyUSB event queue (ECM/RNDIS).
+ *
+ * Context: TinyUSB
+ */
+{
+    if ( !net_xmt_queue_drain(&xmt_queue)) {
+#if !OPT_NET_PROTO_NCM
+        if ( !xmt_retry_pending) {
+            xmt_retry_pending = true;
+            usbd_defer_func(context_tinyusb_linkoutput_retry, NULL, false);    // put yourself at end of TinyUSB event queue
+        }
 #endif
+    }
 }   // context_tinyusb_linkoutput
 
 
 
+#if OPT_NET_PROTO_NCM
+void tud_network_xmit_ready_cb(void)
+/**
+ * NCM driver has a free transmit NTB again.
+ *
+ * Context: TinyUSB
+ */
+{
+    context_tinyusb_linkoutput();
+}   // tud_network_xmit_ready_cb
+#endif
+
+
+
 static err_t linkoutput_fn(struct netif *netif, struct pbuf *p)
 /**
  * called by lwIP to transmit data to TinyUSB
@@ -243,26 +458,19 @@ static err_t linkoutput_fn(struct netif *netif, struct pbuf *p)
         return ERR_USE;
     }
 
-    if (xmt_buff_len != 0) {
-//        printf("linkoutput_fn: retry 1\n");
-        return ERR_USE;
-    }
-
-    // copy data into temp buffer
-    xmt_buff_len = pbuf_copy_partial(p, xmt_buff, p->tot_len, 0);
-    assert(xmt_buff_len < sizeof(xmt_buff));
+    int32_t slot = net_xmt_queue_slot(&xmt_queue);      // kicks TinyUSB if full
 
-#if XXXX == 2
-    if ( !tud_network_can_xmit(xmt_buff_len)) {
-        printf("linkoutput_fn: retry 2\n");
-        xmt_buff_len = 0;
+    if (slot < 0) {
+//        printf("linkoutput_fn: queue full\n");
         return ERR_USE;
     }
-#endif
 
-    taskDISABLE_INTERRUPTS();
-    usbd_defer_func(context_tinyusb_linkoutput, NULL, false);   // TODO this is actually not safe!
-    taskENABLE_INTERRUPTS();
+    // copy data into next free queue entry
+    xmt_frame_t *frame = xmt_frames + slot;
+
+    assert(p->tot_len <= sizeof(frame->data));
+    frame->len = pbuf_copy_partial(p, frame->data, p->tot_len, 0);
+    net_xmt_queue_commit(&xmt_queue);
 
     return ERR_OK;
 }   // linkoutput_fn
@@ -307,7 +515,12 @@ void net_glue_init(void)
 {
     struct netif *netif = &netif_data;
 
+    net_xmt_queue_init(&xmt_queue, XMT_QUEUE_N, context_tinyusb_xmit, xmt_queue_wakeup, NULL);
     tcpip_init(NULL, NULL);
+#if OPT_NET_PROTO_NCM
+    net_release_ring_init(&usb_release_ring, usb_release_buf, USB_RELEASE_N);
+    LWIP_MEMPOOL_INIT(RCV_PBUF);
+#endif
 
 	// fetch IP address from configuration
     net_192_168 = ini_getl(MININI_SECTION, MININI_VAR_NET, OPT_NET_192_168, MININI_FILENAME);
@@ -0,0 +1,90 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Hands datagram references of the NCM receive NTBs from lwIP (pbuf_free()) to TinyUSB
+ * (tud_network_recv_release()), see net_glue.c.  lwIP and TinyUSB may run on different cores.
+ *
+ * No TinyUSB or lwIP calls here, so this is covered by the host tests.
+ */
+
+#include <stddef.h>
+
+#include "hardware/sync.h"
+
+#include "net_release_ring.h"
+
+
+
+void net_release_ring_init(net_release_ring_t *r, void **buf, uint32_t n)
+{
+    r->buf = buf;
+    r->n   = n;
+    r->wr  = 0;
+    r->rd  = 0;
+}   // net_release_ring_init
+
+
+
+bool net_release_ring_put(net_release_ring_t *r, void *ref)
+/**
+ * Append \a ref.  The entry must be written before the consumer sees the new write index.
+ *
+ * \return false if the ring is full
+ *
+ * Context: producer
+ */
+{
+    if (r->wr - r->rd >= r->n) {
+        return false;
+    }
+    r->buf[r->wr & (r->n - 1)] = ref;
+    __dmb();
+    ++r->wr;
+    return true;
+}   // net_release_ring_put
+
+
+
+void *net_release_ring_get(net_release_ring_t *r)
+/**
+ * Take the oldest reference.  The entry must be read before the producer sees the new read index.
+ *
+ * \return the reference or NULL if the ring is empty
+ *
+ * Context: consumer
+ */
+{
+    void *ref;
+
+    if (r->rd == r->wr) {
+        return NULL;
+    }
+    __dmb();
+    ref = r->buf[r->rd & (r->n - 1)];
+    __dmb();
+    ++r->rd;
+    return ref;
+}   // net_release_ring_get
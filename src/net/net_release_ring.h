@@ -0,0 +1,60 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _NET_RELEASE_RING_H
+#define _NET_RELEASE_RING_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/**
+ * Ring of references handed from one thread to another.
+ * Single producer / single consumer, lock-free with free running indexes.
+ */
+typedef struct {
+    void            **buf;
+    uint32_t          n;                    // number of entries, power of 2
+    volatile uint32_t wr;                   // written by the producer only
+    volatile uint32_t rd;                   // written by the consumer only
+} net_release_ring_t;
+
+
+void  net_release_ring_init(net_release_ring_t *r, void **buf, uint32_t n);
+bool  net_release_ring_put(net_release_ring_t *r, void *ref);
+void *net_release_ring_get(net_release_ring_t *r);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// TCP server for RTT channels
+// - channel n is served on port NET_RTT_SERVER_PORT+n (19021 is SEGGERs RTT telnet port for channel 0)
+// - one client per channel
+// - if a client is connected to channel 0, the console goes to TCP instead of the target UART CDC
+// - the SysView channel is left to the SysView server
+// - e.g. "nc 192.168.14.1 19021"
+// - the streams are reset by the RTT thread (their other end), lwIP does not touch the streams of a new
+//   connection until this has happened
+//
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+
+#include "lwip/debug.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/err.h"
+
+#include "hardware/sync.h"
+
+#include "picoprobe_config.h"
+#include "net_rtt.h"
+#include "rtt_io.h"
+#include "stats_counter.h"
+
+
+#ifndef NET_RTT_SERVER_PORT
+    #define NET_RTT_SERVER_PORT     19021
+#endif
+
+#if OPT_NET_SYSVIEW_SERVER  ||  OPT_CDC_SYSVIEW
+    #define NET_RTT_CHANNEL_SYSVIEW 1
+#else
+    #define NET_RTT_CHANNEL_SYSVIEW -1
+#endif
+
+#define STREAM_NET_RTT_TO_HOST_SIZE      1024
+#define STREAM_NET_RTT_TO_TARGET_SIZE    128
+#define STREAM_NET_RTT_TRIGGER           1
+
+typedef struct {
+    uint16_t              channel;
+    struct tcp_pcb       *pcb;
+    volatile bool         connected;
+    volatile bool         streams_valid;             // streams have been reset by the RTT thread for this connection
+    bool                  block_call_back_message;
+    struct pbuf          *rx_pending;                // data from host which did not fit into stream_to_target
+    StreamBufferHandle_t  stream_to_host;
+    StreamBufferHandle_t  stream_to_target;
+} net_rtt_channel_t;
+
+static net_rtt_channel_t m_channel[NET_RTT_CHANNEL_N];
+
+
+
+static err_t net_rtt_close(net_rtt_channel_t *ch)
+/**
+ * Close the connection of \a ch.  Remaining data in the streams is dropped by the RTT thread
+ * on the next connection.
+ *
+ * \return ERR_ABRT if the pcb had to be aborted, this has to be returned by the calling lwIP callback
+ */
+{
+    err_t r = ERR_OK;
+
+    picoprobe_info("=================================== RTT %d disconnect\n", ch->channel);
+
+    if (ch->pcb != NULL) {
+        tcp_arg(ch->pcb, NULL);
+        tcp_sent(ch->pcb, NULL);
+        tcp_recv(ch->pcb, NULL);
+        tcp_err(ch->pcb, NULL);
+        tcp_poll(ch->pcb, NULL, 0);
+
+        if (tcp_close(ch->pcb) != ERR_OK) {
+            tcp_abort(ch->pcb);
+            r = ERR_ABRT;
+        }
+    }
+    if (ch->rx_pending != NULL) {
+        pbuf_free(ch->rx_pending);
+    }
+
+    ch->pcb = NULL;
+    ch->rx_pending = NULL;
+    ch->connected = false;
+    ch->streams_valid = false;
+    ch->block_call_back_message = false;
+    return r;
+}   // net_rtt_close
+
+
+
+static void net_rtt_error(void *arg, err_t err)
+{
+    net_rtt_channel_t *ch = (net_rtt_channel_t *)arg;
+
+    picoprobe_error("net_rtt_error: %d %d\n", ch->channel, err);
+
+    // pcb is already freed
+    ch->pcb = NULL;
+    net_rtt_close(ch);
+}   // net_rtt_error
+
+
+
+static void net_rtt_reset_streams(net_rtt_channel_t *ch)
+/**
+ * Drop data of a previous connection.  A stream buffer must not be reset while its other end is in use,
+ * so this is done by the RTT thread, while lwIP waits for \a streams_valid.
+ *
+ * Context: RTT
+ */
+{
+    if (ch->connected  &&  !ch->streams_valid) {
+        xStreamBufferReset(ch->stream_to_host);
+        xStreamBufferReset(ch->stream_to_target);
+        __dmb();
+        ch->streams_valid = true;
+    }
+}   // net_rtt_reset_streams
+
+
+
+static err_t net_rtt_try_send(net_rtt_channel_t *ch)
+/**
+ * Transfer data from the target into the TCP connection.
+ *
+ * \return ERR_ABRT if the connection has been aborted
+ *
+ * Context: lwIP
+ */
+{
+    bool written = false;
+
+    ch->block_call_back_message = false;
+
+    if ( !ch->streams_valid) {
+        // continued by net_rtt_send()
+        return ERR_OK;
+    }
+    __dmb();
+
+    while (ch->connected  &&  !xStreamBufferIsEmpty(ch->stream_to_host)) {
+        uint8_t tx_buf[256];
+        size_t cnt;
+        err_t err;
+
+        cnt = MIN(sizeof(tx_buf), tcp_sndbuf(ch->pcb));
+        if (cnt == 0) {
+            // continued by net_rtt_sent()
+            break;
+        }
+        cnt = xStreamBufferReceive(ch->stream_to_host, tx_buf, cnt, 0);
+        err = tcp_write(ch->pcb, tx_buf, cnt, TCP_WRITE_FLAG_COPY);
+        if (err != ERR_OK) {
+            picoprobe_error("net_rtt_try_send: %d %d\n", ch->channel, err);
+            return net_rtt_close(ch);
+        }
+        written = true;
+    }
+
+    if (written) {
+        tcp_output(ch->pcb);
+    }
+    return ERR_OK;
+}   // net_rtt_try_send
+
+
+
+static void net_rtt_try_send_cb(void *ctx)
+{
+    net_rtt_try_send((net_rtt_channel_t *)ctx);
+}   // net_rtt_try_send_cb
+
+
+
+static void net_rtt_feed_target(net_rtt_channel_t *ch)
+/**
+ * Put pending data from host into \a stream_to_target.  The TCP window is opened only
+ * for data which fitted into the stream, so a slow target throttles the host.
+ *
+ * Context: lwIP
+ */
+{
+    bool fed = false;
+
+    if ( !ch->streams_valid) {
+        // continued by net_rtt_target_ready()
+        return;
+    }
+    __dmb();
+
+    while (ch->rx_pending != NULL) {
+        size_t cnt = MIN(ch->rx_pending->len, xStreamBufferSpacesAvailable(ch->stream_to_target));
+
+        if (cnt == 0) {
+            // continued by net_rtt_target_ready()
+            break;
+        }
+        cnt = xStreamBufferSend(ch->stream_to_target, ch->rx_pending->payload, cnt, 0);
+        tcp_recved(ch->pcb, cnt);
+        ch->rx_pending = pbuf_free_header(ch->rx_pending, cnt);
+        fed = true;
+    }
+
+    if (fed) {
+        rtt_to_target_notify();
+    }
+}   // net_rtt_feed_target
+
+
+
+static void net_rtt_feed_target_cb(void *ctx)
+{
+    net_rtt_channel_t *ch = (net_rtt_channel_t *)ctx;
+
+    if (ch->connected) {
+        net_rtt_feed_target(ch);
+    }
+}   // net_rtt_feed_target_cb
+
+
+
+static err_t net_rtt_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len)
+{
+    return net_rtt_try_send((net_rtt_channel_t *)arg);
+}   // net_rtt_sent
+
+
+
+static err_t net_rtt_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    net_rtt_channel_t *ch = (net_rtt_channel_t *)arg;
+
+    if (p == NULL) {
+        // remote host closed connection
+        return net_rtt_close(ch);
+    }
+    if (err != ERR_OK) {
+        pbuf_free(p);
+        return err;
+    }
+
+    if (ch->rx_pending == NULL) {
+        ch->rx_pending = p;
+    }
+    else {
+        pbuf_cat(ch->rx_pending, p);
+    }
+    net_rtt_feed_target(ch);
+    return ERR_OK;
+}   // net_rtt_recv
+
+
+
+static err_t net_rtt_poll(void *arg, struct tcp_pcb *tpcb)
+{
+    net_rtt_channel_t *ch = (net_rtt_channel_t *)arg;
+
+    net_rtt_feed_target(ch);
+    return net_rtt_try_send(ch);
+}   // net_rtt_poll
+
+
+
+static err_t net_rtt_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    net_rtt_channel_t *ch = (net_rtt_channel_t *)arg;
+
+    if (err != ERR_OK  ||  newpcb == NULL) {
+        return ERR_VAL;
+    }
+    if (ch->pcb != NULL) {
+        picoprobe_error("net_rtt_accept: channel %d is busy\n", ch->channel);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    picoprobe_info("=================================== RTT %d connect\n", ch->channel);
+
+    ch->pcb = newpcb;
+    ch->streams_valid = false;
+
+    tcp_arg(newpcb,  ch);
+    tcp_err(newpcb,  net_rtt_error);
+    tcp_recv(newpcb, net_rtt_recv);
+    tcp_poll(newpcb, net_rtt_poll, 1);
+    tcp_sent(newpcb, net_rtt_sent);
+
+    ch->connected = true;
+    return ERR_OK;
+}   // net_rtt_accept
+
+
+
+bool net_rtt_is_connected(uint16_t channel)
+{
+    return channel < NET_RTT_CHANNEL_N  &&  m_channel[channel].connected;
+}   // net_rtt_is_connected
+
+
+
+uint32_t net_rtt_send(uint16_t channel, const uint8_t *buf, uint32_t cnt)
+/**
+ * Send characters from an RTT channel into the stream of its TCP connection.
+ *
+ * \param channel  RTT channel
+ * \param buf      pointer to the buffer to be sent, if NULL then remaining space in stream is returned
+ * \param cnt      number of bytes to be sent
+ * \return if \buf is NULL the remaining space in stream is returned, otherwise the number of bytes sent
+ */
+{
+    net_rtt_channel_t *ch = m_channel + channel;
+    uint32_t r;
+
+    net_rtt_reset_streams(ch);
+    if (buf == NULL) {
+        return xStreamBufferSpacesAvailable(ch->stream_to_host);
+    }
+    if ( !ch->connected) {
+        return 0;
+    }
+
+    r = xStreamBufferSend(ch->stream_to_host, buf, cnt, 0);
+    stats_add(STATS_DROP_NET_RTT, cnt - r);
+
+    if ( !ch->block_call_back_message) {
+        ch->block_call_back_message = true;
+        if (tcpip_try_callback(net_rtt_try_send_cb, ch) != ERR_OK) {
+            ch->block_call_back_message = false;
+        }
+    }
+    return r;
+}   // net_rtt_send
+
+
+
+StreamBufferHandle_t net_rtt_stream_to_target(uint16_t channel)
+/**
+ * Stream with data from the host.
+ *
+ * Context: RTT
+ */
+{
+    net_rtt_reset_streams(m_channel + channel);
+    return m_channel[channel].stream_to_target;
+}   // net_rtt_stream_to_target
+
+
+
+void net_rtt_target_ready(uint16_t channel)
+/**
+ * RTT has taken data out of \a stream_to_target, so pending data from the host can follow.
+ */
+{
+    if (m_channel[channel].rx_pending != NULL) {
+        tcpip_try_callback(net_rtt_feed_target_cb, m_channel + channel);
+    }
+}   // net_rtt_target_ready
+
+
+
+void net_rtt_init(void)
+{
+    for (uint16_t channel = 0;  channel < NET_RTT_CHANNEL_N;  ++channel) {
+        net_rtt_channel_t *ch = m_channel + channel;
+        struct tcp_pcb *pcb;
+        struct tcp_pcb *pcb_listen;
+        err_t err;
+
+        ch->channel = channel;
+        if (channel == NET_RTT_CHANNEL_SYSVIEW) {
+            continue;
+        }
+
+        ch->stream_to_host   = xStreamBufferCreate(STREAM_NET_RTT_TO_HOST_SIZE, STREAM_NET_RTT_TRIGGER);
+        ch->stream_to_target = xStreamBufferCreate(STREAM_NET_RTT_TO_TARGET_SIZE, STREAM_NET_RTT_TRIGGER);
+        if (ch->stream_to_host == NULL  ||  ch->stream_to_target == NULL) {
+            picoprobe_error("net_rtt_init: cannot create streams for channel %d\n", channel);
+            return;
+        }
+
+        pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+        if (pcb == NULL)
+        {
+            picoprobe_error("net_rtt_init: cannot get pcb\n");
+            return;
+        }
+
+        err = tcp_bind(pcb, IP_ADDR_ANY, NET_RTT_SERVER_PORT + channel);
+        if (err != ERR_OK)
+        {
+            picoprobe_error("net_rtt_init: cannot bind, err:%d\n", err);
+            return;
+        }
+
+        pcb_listen = tcp_listen_with_backlog(pcb, 1);
+        if (pcb_listen == NULL)
+        {
+            tcp_close(pcb);
+            picoprobe_error("net_rtt_init: cannot listen\n");
+            return;
+        }
+
+        tcp_arg(pcb_listen, ch);
+        tcp_accept(pcb_listen, net_rtt_accept);
+    }
+}   // net_rtt_init
@@ -0,0 +1,64 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _NET_RTT_H
+#define _NET_RTT_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+#define NET_RTT_CHANNEL_N           4                // RTT channels 0..3 are served on ports NET_RTT_SERVER_PORT+ch
+
+#ifndef NET_RTT_DROP_MASK
+    /// bit n set: data from target on channel n is dropped if the TCP client is too slow,
+    /// otherwise it is left in the target buffer (target side RTT mode decides then)
+    #define NET_RTT_DROP_MASK       0x00
+#endif
+#define NET_RTT_CHANNEL_DROPS(ch)   (((NET_RTT_DROP_MASK) >> (ch)) & 1)
+
+
+void net_rtt_init(void);
+bool net_rtt_is_connected(uint16_t channel);
+uint32_t net_rtt_send(uint16_t channel, const uint8_t *buf, uint32_t cnt);
+StreamBufferHandle_t net_rtt_stream_to_target(uint16_t channel);
+void net_rtt_target_ready(uint16_t channel);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+
+#endif
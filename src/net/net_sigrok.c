@@ -0,0 +1,312 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// TCP server for sigrok
+// - one client on port NET_SIGROK_SERVER_PORT, protocol is the same as on the sigrok CDC,
+//   commands are fed into the parser of cdc_sigrok.c
+// - while a client is connected, all sigrok output goes to TCP instead of the sigrok CDC
+// - sample data is written from the buffer of the sigrok encoder directly into lwIP (tcp_write() with copy),
+//   the writer waits until its buffer has been consumed
+// - libsigrok: "raspberrypi-pico:conn=tcp-raw/192.168.14.1/19300"
+//
+
+#include <pico/stdlib.h>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include "lwip/debug.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/err.h"
+
+#include "picoprobe_config.h"
+#include "net_sigrok.h"
+#include "pico-sigrok/cdc_sigrok.h"
+
+
+#ifndef NET_SIGROK_SERVER_PORT
+    #define NET_SIGROK_SERVER_PORT  19300
+#endif
+
+static struct tcp_pcb        *m_pcb;
+static volatile bool          m_connected;
+static SemaphoreHandle_t      sema_tx_done;
+
+/// buffer of the writer which is currently transferred into lwIP
+static const uint8_t         *m_tx_buf;
+static volatile uint32_t      m_tx_cnt;
+
+
+
+static void net_sigrok_tx_release(void)
+/**
+ * Release a waiting writer, remaining data is discarded.
+ *
+ * Context: lwIP
+ */
+{
+    if (m_tx_cnt != 0) {
+        m_tx_cnt = 0;
+        xSemaphoreGive(sema_tx_done);
+    }
+}   // net_sigrok_tx_release
+
+
+
+static err_t net_sigrok_close(void)
+/**
+ * Close the connection, a running acquisition is stopped and a waiting writer is released.
+ *
+ * \return ERR_ABRT if the pcb had to be aborted, this has to be returned by the calling lwIP callback
+ */
+{
+    err_t r = ERR_OK;
+
+    picoprobe_info("=================================== Sigrok-TCP disconnect\n");
+
+    if (m_pcb != NULL) {
+        tcp_arg(m_pcb, NULL);
+        tcp_sent(m_pcb, NULL);
+        tcp_recv(m_pcb, NULL);
+        tcp_err(m_pcb, NULL);
+        tcp_poll(m_pcb, NULL, 0);
+
+        if (tcp_close(m_pcb) != ERR_OK) {
+            tcp_abort(m_pcb);
+            r = ERR_ABRT;
+        }
+    }
+
+    if (m_connected) {
+        // stop a running acquisition like the host would do
+        cdc_sigrok_host_rx((const uint8_t *)"+", 1);
+    }
+
+    m_pcb = NULL;
+    m_connected = false;
+    net_sigrok_tx_release();
+    return r;
+}   // net_sigrok_close
+
+
+
+static void net_sigrok_error(void *arg, err_t err)
+{
+    picoprobe_error("net_sigrok_error: %d\n", err);
+
+    // pcb is already freed
+    m_pcb = NULL;
+    net_sigrok_close();
+}   // net_sigrok_error
+
+
+
+static err_t net_sigrok_try_send(void)
+/**
+ * Copy the buffer of the waiting writer into the TCP connection.  If the send buffer is full,
+ * the transfer is continued by net_sigrok_sent().
+ *
+ * Context: lwIP
+ *
+ * \return ERR_ABRT if the connection has been aborted
+ */
+{
+    uint32_t cnt;
+    err_t err;
+
+    if ( !m_connected) {
+        // connection has gone between net_sigrok_write() and this callback
+        net_sigrok_tx_release();
+        return ERR_OK;
+    }
+    if (m_tx_cnt == 0) {
+        return ERR_OK;
+    }
+
+    cnt = MIN(m_tx_cnt, tcp_sndbuf(m_pcb));
+    if (cnt == 0) {
+        return ERR_OK;
+    }
+
+    err = tcp_write(m_pcb, m_tx_buf, cnt, TCP_WRITE_FLAG_COPY);
+    if (err == ERR_MEM) {
+        // out of segments, retry with next ack
+        return ERR_OK;
+    }
+    if (err != ERR_OK) {
+        picoprobe_error("net_sigrok_try_send: %d\n", err);
+        return net_sigrok_close();
+    }
+    tcp_output(m_pcb);
+
+    m_tx_buf += cnt;
+    m_tx_cnt -= cnt;
+    if (m_tx_cnt == 0) {
+        xSemaphoreGive(sema_tx_done);
+    }
+    return ERR_OK;
+}   // net_sigrok_try_send
+
+
+
+static void net_sigrok_try_send_cb(void *ctx)
+{
+    net_sigrok_try_send();
+}   // net_sigrok_try_send_cb
+
+
+
+static err_t net_sigrok_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len)
+{
+    return net_sigrok_try_send();
+}   // net_sigrok_sent
+
+
+
+static err_t net_sigrok_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    if (p == NULL) {
+        // remote host closed connection
+        return net_sigrok_close();
+    }
+
+    for (struct pbuf *q = p;  q != NULL;  q = q->next) {
+        cdc_sigrok_host_rx((const uint8_t *)q->payload, q->len);
+    }
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}   // net_sigrok_recv
+
+
+
+static err_t net_sigrok_poll(void *arg, struct tcp_pcb *tpcb)
+{
+    return net_sigrok_try_send();
+}   // net_sigrok_poll
+
+
+
+static err_t net_sigrok_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    if (err != ERR_OK  ||  newpcb == NULL) {
+        return ERR_VAL;
+    }
+    if (m_pcb != NULL) {
+        picoprobe_error("net_sigrok_accept: server is busy\n");
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    picoprobe_info("=================================== Sigrok-TCP connect\n");
+
+    m_pcb = newpcb;
+
+    tcp_arg(newpcb,  NULL);
+    tcp_err(newpcb,  net_sigrok_error);
+    tcp_recv(newpcb, net_sigrok_recv);
+    tcp_poll(newpcb, net_sigrok_poll, 1);
+    tcp_sent(newpcb, net_sigrok_sent);
+
+    m_connected = true;
+    return ERR_OK;
+}   // net_sigrok_accept
+
+
+
+bool net_sigrok_is_connected(void)
+{
+    return m_connected;
+}   // net_sigrok_is_connected
+
+
+
+void net_sigrok_write(const void *buf, uint32_t cnt)
+/**
+ * Write data to the TCP connection.  The function returns after \a buf has been copied into lwIP
+ * or the connection has been closed.
+ * Only one task may write at a time.
+ */
+{
+    if ( !m_connected  ||  cnt == 0) {
+        return;
+    }
+
+    xSemaphoreTake(sema_tx_done, 0);
+    m_tx_buf = (const uint8_t *)buf;
+    m_tx_cnt = cnt;
+    if (tcpip_callback(net_sigrok_try_send_cb, NULL) != ERR_OK) {
+        m_tx_cnt = 0;
+        return;
+    }
+
+    while (m_tx_cnt != 0) {
+        xSemaphoreTake(sema_tx_done, pdMS_TO_TICKS(1000));
+    }
+}   // net_sigrok_write
+
+
+
+void net_sigrok_init(void)
+{
+    err_t err;
+    struct tcp_pcb *pcb;
+    struct tcp_pcb *pcb_listen;
+
+    sema_tx_done = xSemaphoreCreateBinary();
+    if (sema_tx_done == NULL) {
+        picoprobe_error("net_sigrok_init: cannot create sema_tx_done\n");
+        return;
+    }
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL)
+    {
+        picoprobe_error("net_sigrok_init: cannot get pcb\n");
+        return;
+    }
+
+    err = tcp_bind(pcb, IP_ADDR_ANY, NET_SIGROK_SERVER_PORT);
+    if (err != ERR_OK)
+    {
+        picoprobe_error("net_sigrok_init: cannot bind, err:%d\n", err);
+        return;
+    }
+
+    pcb_listen = tcp_listen_with_backlog(pcb, 1);
+    if (pcb_listen == NULL)
+    {
+        tcp_close(pcb);
+        picoprobe_error("net_sigrok_init: cannot listen\n");
+        return;
+    }
+
+    tcp_accept(pcb_listen, net_sigrok_accept);
+}   // net_sigrok_init
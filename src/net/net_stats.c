@@ -0,0 +1,117 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// TCP server for the counter snapshot
+// - each connection gets one binary snapshot (see stats_counter.h), then the connection is closed
+// - e.g. "nc 192.168.14.1 19100 | xxd"
+//
+
+#include "lwip/debug.h"
+#include "lwip/tcp.h"
+#include "lwip/err.h"
+
+#include "picoprobe_config.h"
+#include "net_stats.h"
+#include "stats_counter.h"
+
+
+#ifndef STATS_SERVER_PORT
+    #define STATS_SERVER_PORT       19100
+#endif
+
+
+
+static err_t stats_poll(void *arg, struct tcp_pcb *tpcb)
+/**
+ * Retry closing if it failed in stats_accept().
+ */
+{
+    if (tcp_close(tpcb) != ERR_OK) {
+        tcp_abort(tpcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}   // stats_poll
+
+
+
+static err_t stats_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    uint8_t buf[STATS_SNAPSHOT_SIZE];
+    uint32_t len;
+
+    if (err != ERR_OK  ||  newpcb == NULL) {
+        return ERR_VAL;
+    }
+
+    len = stats_snapshot(buf, sizeof(buf));
+    err = tcp_write(newpcb, buf, len, TCP_WRITE_FLAG_COPY);
+    if (err != ERR_OK) {
+        picoprobe_error("stats_accept: cannot write, err:%d\n", err);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    // tcp_close() sends the queued data before FIN
+    if (tcp_close(newpcb) != ERR_OK) {
+        tcp_poll(newpcb, stats_poll, 1);
+    }
+    return ERR_OK;
+}   // stats_accept
+
+
+
+void net_stats_init(void)
+{
+    err_t err;
+    struct tcp_pcb *pcb;
+    struct tcp_pcb *pcb_listen;
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL)
+    {
+        picoprobe_error("net_stats_init: cannot get pcb\n");
+        return;
+    }
+
+    err = tcp_bind(pcb, IP_ADDR_ANY, STATS_SERVER_PORT);
+    if (err != ERR_OK)
+    {
+        picoprobe_error("net_stats_init: cannot bind, err:%d\n", err);
+        return;
+    }
+
+    pcb_listen = tcp_listen_with_backlog(pcb, 1);
+    if (pcb_listen == NULL)
+    {
+        tcp_close(pcb);
+        picoprobe_error("net_stats_init: cannot listen\n");
+        return;
+    }
+
+    tcp_accept(pcb_listen, stats_accept);
+}   // net_stats_init
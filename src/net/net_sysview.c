@@ -23,15 +23,21 @@
  *
  */
 
+
 //----------------------------------------------------------------------------------------------------------------------
 //
 // TCP server for SystemView
 // - using NCM because it is driver free for Windows / Linux / iOS
 // - we leave the IPv6 stuff outside
+// - up to SYSVIEW_CLIENT_N clients: the first one is the SystemView App, data received from further clients
+//   (e.g. a recorder) is ignored
+// - data is transmitted directly from \a sysview_ring without copy, so ring space is freed only after
+//   all clients have acknowledged it.  A slow client slows down the others.
 //
 
+#include <string.h>
+
 #include "FreeRTOS.h"
-#include "stream_buffer.h"
 
 #include "lwip/debug.h"
 #include "lwip/stats.h"
@@ -39,9 +45,12 @@
 #include "lwip/tcpip.h"
 #include "lwip/err.h"
 
+#include "hardware/sync.h"
+
 #include "picoprobe_config.h"
 #include "net_sysview.h"
 #include "rtt_io.h"
+#include "stats_counter.h"
 
 
 /**
@@ -71,118 +80,210 @@ enum echo_states
     SVS_WAIT_HELLO,
     SVS_SEND_HELLO,
     SVS_READY,
+    SVS_CLOSING,                                     // closed, but ring data is still referenced by unacked segments
 };
 
-// only one client instance is possible
-static uint8_t m_state;
-struct tcp_pcb *m_pcb_client;
-static uint32_t m_xmt_cnt;
+#ifndef SYSVIEW_CLIENT_N
+    #define SYSVIEW_CLIENT_N            2            // client[0] is the SystemView App, others are observers
+#endif
+
+typedef struct {
+    struct tcp_pcb *pcb;
+    uint8_t         state;
+    uint16_t        hello_unacked;                   // bytes of \a sysview_hello not yet acknowledged
+    uint32_t        tx_pos;                          // ring position up to which data is given to tcp_write()
+    uint32_t        acked_pos;                       // ring position up to which data is acknowledged
+} sysview_client_t;
 
-#define STREAM_SYSVIEW_SIZE      4096
-#define STREAM_SYSVIEW_TRIGGER   32
+static sysview_client_t m_client[SYSVIEW_CLIENT_N];
 
-static StreamBufferHandle_t      stream_sysview_to_host;
+/// Ring buffer RTT -> clients.  Single producer (RTT thread) / single consumer (lwIP) with free running positions.
+#define SYSVIEW_RING_SIZE        8192                // must be a power of 2
+#define SYSVIEW_MIN_WRITE        TCP_MSS             // smaller chunks are written only if nothing is in flight
+
+static uint8_t           sysview_ring[SYSVIEW_RING_SIZE];
+static volatile uint32_t sysview_ring_wr;            // written by RTT thread only
+static volatile uint32_t sysview_ring_rd;            // written by lwIP only, minimum of all \a acked_pos
 
 static bool block_call_back_message;
-static bool block_call_to_tcp_output;
+
+
+
+static void sysview_update_ring_rd(void)
+/**
+ * Free ring space which has been acknowledged by all clients.
+ */
+{
+    uint32_t rd = sysview_ring_wr;
+
+    for (int i = 0;  i < SYSVIEW_CLIENT_N;  ++i) {
+        if ((m_client[i].state == SVS_READY  ||  m_client[i].state == SVS_CLOSING)
+            &&  (int32_t)(m_client[i].acked_pos - rd) < 0) {
+            rd = m_client[i].acked_pos;
+        }
+    }
+    __dmb();
+    sysview_ring_rd = rd;
+}   // sysview_update_ring_rd
 
 
 
 void sysview_error(void *arg, err_t err)
 {
+    sysview_client_t *client = (sysview_client_t *)arg;
+
     picoprobe_error("sysview_error: %d\n", err);
 
-    m_state = SVS_NONE;
+    // pcb is already freed
+    client->pcb = NULL;
+    client->state = SVS_NONE;
+    sysview_update_ring_rd();
 }   // sysview_error
 
 
 
-void sysview_close(struct tcp_pcb *tpcb)
+static void sysview_release(sysview_client_t *client)
+/**
+ * Detach \a client from its pcb and free its slot.
+ */
 {
-    //printf("sysview_close(%p): %d\n", tpcb, m_state);
-
-    picoprobe_info("=================================== SysView disconnect\n");
+    struct tcp_pcb *tpcb = client->pcb;
 
     tcp_arg(tpcb, NULL);
     tcp_sent(tpcb, NULL);
-    tcp_recv(tpcb, NULL);
     tcp_err(tpcb, NULL);
+
+    client->pcb = NULL;
+    client->state = SVS_NONE;
+    sysview_update_ring_rd();
+}   // sysview_release
+
+
+
+void sysview_close(sysview_client_t *client)
+/**
+ * Close the connection of \a client.
+ * Segments written without copy may still be retransmitted after tcp_close(), so the ring data stays
+ * pinned (\a acked_pos) until it is acknowledged or the pcb has gone (sysview_error()).
+ */
+{
+    struct tcp_pcb *tpcb = client->pcb;
+
+    //printf("sysview_close(%p): %d\n", tpcb, client->state);
+
+    picoprobe_info("=================================== SysView disconnect %d\n", (int)(client - m_client));
+
+    tcp_recv(tpcb, NULL);
     tcp_poll(tpcb, NULL, 0);
 
     tcp_close(tpcb);
 
-    xStreamBufferReset(stream_sysview_to_host);
-    
-    block_call_to_tcp_output = false;
-    block_call_back_message = false;
-
-    m_state = SVS_NONE;
+    if (client->state == SVS_READY  &&  client->acked_pos != client->tx_pos) {
+        client->state = SVS_CLOSING;
+    }
+    else {
+        sysview_release(client);
+    }
 }   // sysview_close
 
 
 
-static void sysview_try_send(void *ctx)
+static void sysview_client_send(sysview_client_t *client)
+/**
+ * Give new ring data to lwIP.  tcp_write() does not copy, the data stays in the ring until
+ * it has been acknowledged.
+ */
 {
-    block_call_back_message = false;
+    uint32_t wr = sysview_ring_wr;
+    bool written = false;
 
-    if ( !xStreamBufferIsEmpty(stream_sysview_to_host)) {
-        size_t cnt;
-        size_t max_cnt;
-        uint8_t tx_buf[512];
+    __dmb();
+    while (client->tx_pos != wr) {
+        uint32_t ndx = client->tx_pos % SYSVIEW_RING_SIZE;
+        uint32_t cnt = MIN(wr - client->tx_pos, SYSVIEW_RING_SIZE - ndx);
         err_t err;
 
-        max_cnt = tcp_sndbuf(m_pcb_client);
-        //printf("sysview_try_send: %d %d\n", xStreamBufferBytesAvailable(stream_sysview_to_host), max_cnt);
-        if (max_cnt != 0) {
-            max_cnt = MIN(sizeof(tx_buf), max_cnt);
-            cnt = xStreamBufferReceive(stream_sysview_to_host, tx_buf, max_cnt, pdMS_TO_TICKS(10));
-            if (cnt != 0) {
-                // the write has either 512 bytes (so send it) or the stream is empty (so send it as well)
-                err = tcp_write(m_pcb_client, tx_buf, cnt, TCP_WRITE_FLAG_COPY);
-                //printf("sysview_try_send: %d %d\n", cnt, block_call_to_tcp_output);
-                if (err != ERR_OK) {
-                    picoprobe_error("sysview_try_send/a: %d\n", err);
-                    sysview_close(m_pcb_client);
-                }
-                
-                if ( !block_call_to_tcp_output  &&  tcp_sndbuf(m_pcb_client) < 2 * TCP_SND_BUF / 4) {
-                    //printf("sysview_try_send: flush %d %d\n", tcp_sndbuf(m_pcb_client), 3 * TCP_SND_BUF / 4);
-                    block_call_to_tcp_output = true;
-                    tcp_output(m_pcb_client);
-                }
-                
-                if ( !xStreamBufferIsEmpty(stream_sysview_to_host)) {
-                    tcpip_callback_with_block(sysview_try_send, NULL, 0);
-                }
-            }
+        if (cnt < SYSVIEW_MIN_WRITE  &&  client->tx_pos != client->acked_pos  &&  wr - client->tx_pos == cnt) {
+            // wait for more data or the next acknowledge
+            break;
         }
-        else {
-//            printf("sysview_try_send: no tcp_sndbuf!!!!\n");
-            if ( !block_call_to_tcp_output) {
-                //printf("sysview_try_send: flush\n");
-                block_call_to_tcp_output = true;
-                tcp_output(m_pcb_client);
-            }
+        cnt = MIN(cnt, tcp_sndbuf(client->pcb));
+        if (cnt == 0) {
+            break;
+        }
+
+        err = tcp_write(client->pcb, sysview_ring + ndx, cnt, 0);
+        if (err == ERR_MEM) {
+            // out of segments, retry on next sysview_sent()
+            break;
+        }
+        if (err != ERR_OK) {
+            picoprobe_error("sysview_client_send: %d\n", err);
+            sysview_close(client);
+            return;
+        }
+        client->tx_pos += cnt;
+        written = true;
+        stats_inc(STATS_SYSVIEW_TX_WRITES);
+        stats_add(STATS_SYSVIEW_TX_BYTES, cnt);
+    }
+
+    if (written) {
+        tcp_output(client->pcb);
+    }
+}   // sysview_client_send
+
+
+
+static void sysview_try_send(void *ctx)
+{
+    block_call_back_message = false;
+
+    for (int i = 0;  i < SYSVIEW_CLIENT_N;  ++i) {
+        if (m_client[i].state == SVS_READY) {
+            sysview_client_send(m_client + i);
         }
     }
+    sysview_update_ring_rd();
 }   // sysview_try_send
 
 
 
 static err_t sysview_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len)
 {
-    //printf("sysview_sent(%p,%p,%d) %d\n", arg, tpcb, len, m_state);
+    sysview_client_t *client = (sysview_client_t *)arg;
+    uint16_t n;
+
+    //printf("sysview_sent(%p,%p,%d) %d\n", arg, tpcb, len, client->state);
 
-    block_call_to_tcp_output = false;
+    n = MIN(len, client->hello_unacked);
+    client->hello_unacked -= n;
+    client->acked_pos += len - n;
+
+    if (client->state == SVS_CLOSING) {
+        if (client->acked_pos == client->tx_pos) {
+            sysview_release(client);
+        }
+        else {
+            sysview_update_ring_rd();
+        }
+        return ERR_OK;
+    }
 
-    if (m_state == SVS_SEND_HELLO)
+    if (client->state == SVS_SEND_HELLO  &&  client->hello_unacked == 0)
     {
-        m_state = SVS_READY;
-        xStreamBufferReset(stream_sysview_to_host);
+        // start with current data
+        client->tx_pos = sysview_ring_wr;
+        client->acked_pos = client->tx_pos;
+        client->state = SVS_READY;
+        picoprobe_info("=================================== SysView ready %d\n", (int)(client - m_client));
     }
-    tcpip_callback_with_block(sysview_try_send, NULL, 0);
 
-    m_xmt_cnt = 0;
+    if (client->state == SVS_READY)
+    {
+        sysview_client_send(client);
+        sysview_update_ring_rd();
+    }
 
     return ERR_OK;
 }   // sysview_sent
@@ -191,16 +292,17 @@ static err_t sysview_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len)
 
 static err_t sysview_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
+    sysview_client_t *client = (sysview_client_t *)arg;
     err_t ret_err;
 
-    // printf("sysview_recv(%p,%p,%p,%d) %d\n", arg, tpcb, p, err, m_state);
+    // printf("sysview_recv(%p,%p,%p,%d) %d\n", arg, tpcb, p, err, client->state);
 
     if (p == NULL)
     {
         //
         // remote host closed connection
         //
-        sysview_close(tpcb);
+        sysview_close(client);
         ret_err = ERR_OK;
     }
     else if (err != ERR_OK)
@@ -215,7 +317,7 @@ static err_t sysview_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t
         }
         ret_err = err;
     }
-    else if (m_state == SVS_WAIT_HELLO)
+    else if (client->state == SVS_WAIT_HELLO)
     {
         //
         // expecting hello message
@@ -226,7 +328,8 @@ static err_t sysview_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t
             // invalid hello
             pbuf_free(p);
             tcp_abort(tpcb);
-            // TODO close here?
+            client->pcb = NULL;
+            client->state = SVS_NONE;
             ret_err = ERR_ABRT;
         }
         else
@@ -235,14 +338,15 @@ static err_t sysview_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t
             tcp_recved(tpcb, SYSVIEW_COMM_APP_HELLO_SIZE);
             pbuf_free(p);
             tcp_write(tpcb, sysview_hello, SYSVIEW_COMM_TARGET_HELLO_SIZE, 0);
-            m_state = SVS_SEND_HELLO;
+            client->hello_unacked = SYSVIEW_COMM_TARGET_HELLO_SIZE;
+            client->state = SVS_SEND_HELLO;
             ret_err = ERR_OK;
         }
     }
-    else if (m_state == SVS_READY)
+    else if (client->state == SVS_READY  &&  client == m_client + 0)
     {
         //
-        // send received data to RTT SysView
+        // send received data to RTT SysView (SystemView App only)
         //
         for (uint16_t ndx = 0;  ndx < p->len;  ++ndx)
         {
@@ -254,7 +358,7 @@ static err_t sysview_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t
     }
     else
     {
-        /* unknown svs->state, trash data  */
+        /* unknown svs->state or observer, trash data  */
         tcp_recved(tpcb, p->tot_len);
         pbuf_free(p);
         ret_err = ERR_OK;
@@ -266,10 +370,9 @@ static err_t sysview_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t
 
 err_t sysview_poll(void *arg, struct tcp_pcb *tpcb)
 {
-    //printf("sysview_poll(%p,%p) %d\n", arg, tpcb, m_state);
+    //printf("sysview_poll(%p,%p)\n", arg, tpcb);
 
-    //sysview_try_send(NULL);
-    tcpip_callback_with_block(sysview_try_send, NULL, 0);
+    sysview_try_send(NULL);
     return ERR_OK;
 }   // sysview_poll
 
@@ -277,15 +380,29 @@ err_t sysview_poll(void *arg, struct tcp_pcb *tpcb)
 
 static err_t sysview_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
 {
-    picoprobe_info("=================================== SysView connect\n");
+    sysview_client_t *client = NULL;
+
+    for (int i = 0;  i < SYSVIEW_CLIENT_N;  ++i) {
+        if (m_client[i].state == SVS_NONE) {
+            client = m_client + i;
+            break;
+        }
+    }
+    if (client == NULL) {
+        picoprobe_error("sysview_accept: too many clients\n");
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    picoprobe_info("=================================== SysView connect %d\n", (int)(client - m_client));
 
     /* commonly observed practice to call tcp_setprio(), why? */
     tcp_setprio(newpcb, TCP_PRIO_MAX);
 
-    m_state = SVS_WAIT_HELLO;
-    m_pcb_client = newpcb;
-    /* pass newly allocated svs to our callbacks */
-    tcp_arg(newpcb,  NULL);
+    client->pcb = newpcb;
+    client->state = SVS_WAIT_HELLO;
+    client->hello_unacked = 0;
+    tcp_arg(newpcb,  client);
     tcp_err(newpcb,  sysview_error);
     tcp_recv(newpcb, sysview_recv);
     tcp_poll(newpcb, sysview_poll, 0);
@@ -294,54 +411,63 @@ static err_t sysview_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
     return ERR_OK;
 }   // sysview_accept
 
-// TODO recheck here
 
 
 bool net_sysview_is_connected(void)
 {
-    return m_state == SVS_READY;
+    for (int i = 0;  i < SYSVIEW_CLIENT_N;  ++i) {
+        if (m_client[i].state == SVS_READY) {
+            return true;
+        }
+    }
+    return false;
 }   // net_sysview_is_connected
 
 
 
 uint32_t net_sysview_send(const uint8_t *buf, uint32_t cnt)
 /**
- * Send characters from SysView RTT channel into stream.
+ * Send characters from SysView RTT channel into ring.
  *
- * \param buf  pointer to the buffer to be sent, if NULL then remaining space in stream is returned
+ * \param buf  pointer to the buffer to be sent, if NULL then remaining space in ring is returned
  * \param cnt  number of bytes to be sent
- * \return if \buf is NULL the remaining space in stream is returned, otherwise the number of bytes sent
+ * \return if \buf is NULL the remaining space in ring is returned, otherwise the number of bytes sent
  */
 {
     uint32_t r = 0;
+    uint32_t wr = sysview_ring_wr;
+    uint32_t space = SYSVIEW_RING_SIZE - (wr - sysview_ring_rd);
 
 #if 0
-    if (m_state != SVS_NONE  &&  buf != NULL)
-        printf("net_sysview_send(%p,%lu) %d\n", buf, cnt, m_state);
+    if (buf != NULL)
+        printf("net_sysview_send(%p,%lu)\n", buf, cnt);
 #endif
 
     if (buf == NULL) {
-        r = xStreamBufferSpacesAvailable(stream_sysview_to_host);
+        r = space;
     }
-    else {
-        if ( !net_sysview_is_connected())
-        {
-            xStreamBufferReset(stream_sysview_to_host);
-        }
-        else
+    else if (net_sysview_is_connected()) {
+        uint32_t ndx = wr % SYSVIEW_RING_SIZE;
+        uint32_t n1;
+
+        r = MIN(cnt, space);
+        n1 = MIN(r, SYSVIEW_RING_SIZE - ndx);
+        memcpy(sysview_ring + ndx, buf, n1);
+        memcpy(sysview_ring, buf + n1, r - n1);
+        __dmb();
+        sysview_ring_wr = wr + r;
+        stats_add(STATS_DROP_SYSVIEW, cnt - r);
+
+        if ( !block_call_back_message)
         {
-            r = xStreamBufferSend(stream_sysview_to_host, buf, cnt, pdMS_TO_TICKS(1000));
-
-            if ( !block_call_back_message)
-            {
-                err_t err;
-
-                block_call_back_message = true;
-                err = tcpip_callback_with_block(sysview_try_send, NULL, 0);
-                if (err != ERR_OK) {
-                    picoprobe_error("net_sysview_send: error %d\n", err);
-                    sysview_close(m_pcb_client);
-                }
+            err_t err;
+
+            block_call_back_message = true;
+            stats_inc(STATS_SYSVIEW_WAKEUPS);
+            err = tcpip_callback_with_block(sysview_try_send, NULL, 0);
+            if (err != ERR_OK) {
+                picoprobe_error("net_sysview_send: error %d\n", err);
+                block_call_back_message = false;
             }
         }
     }
@@ -356,14 +482,6 @@ void net_sysview_init(void)
     err_t err;
     struct tcp_pcb *pcb;
 
-    //
-    // initialize some infrastructure
-    //
-    stream_sysview_to_host = xStreamBufferCreate(STREAM_SYSVIEW_SIZE, STREAM_SYSVIEW_TRIGGER);
-    if (stream_sysview_to_host == NULL) {
-        picoprobe_error("net_sysview_init: cannot create stream_sysview_to_host\n");
-    }
-
     //
     // initialize socket listener
     //
@@ -381,7 +499,7 @@ void net_sysview_init(void)
         return;
     }
 
-    m_pcb_listen = tcp_listen_with_backlog(pcb, 1);
+    m_pcb_listen = tcp_listen_with_backlog(pcb, SYSVIEW_CLIENT_N);
     if (m_pcb_listen == NULL)
     {
         if (pcb != NULL)
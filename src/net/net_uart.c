@@ -0,0 +1,520 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// TCP server for the target UARTs
+// - channel 0 is the target UART on port NET_UART_SERVER_PORT, additional PIO UARTs (OPT_PIO_UART_N)
+//   follow on the next ports
+// - one client per channel
+// - while a client is connected, data from the UART goes to TCP instead of the CDC
+// - telnet with the RFC2217 COM-PORT-OPTION is understood, so baudrate and line settings can be changed
+//   by the client, e.g. "pyserial-miniterm rfc2217://192.168.14.1:2217 115200"
+// - plain TCP clients work as well, e.g. "nc 192.168.14.1 2217", but a 0xff from the host is taken as
+//   telnet IAC.  0xff from the target is doubled only after the client has sent a telnet command
+// - flow control: the TCP window is opened only for data which fits into the stream to the target
+//
+
+#include <string.h>
+
+#include <pico/stdlib.h>
+
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+
+#include "lwip/debug.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/err.h"
+
+#include "picoprobe_config.h"
+#include "net_uart.h"
+#include "net_uart_telnet.h"
+#include "cdc/cdc_uart.h"
+#if OPT_PIO_UART_N
+    #include "cdc/cdc_pio_uart.h"
+#endif
+
+
+#ifndef NET_UART_SERVER_PORT
+    #define NET_UART_SERVER_PORT    2217                     // RFC2217 convention
+#endif
+
+#define STREAM_NET_UART_TO_HOST_SIZE     2048
+#define STREAM_NET_UART_TO_TARGET_SIZE   512
+#define STREAM_NET_UART_TRIGGER          1
+
+typedef struct {
+    uint16_t              channel;
+    struct tcp_pcb       *pcb;
+    volatile bool         connected;
+    bool                  block_call_back_message;
+    struct pbuf          *rx_pending;                // data from host which did not fit into stream_to_target
+    StreamBufferHandle_t  stream_to_host;
+    StreamBufferHandle_t  stream_to_target;
+    net_uart_telnet_t     telnet;
+
+    uint32_t              baudrate;                  // settings done via CDC are not reflected
+    uint32_t              data_bits;
+    uint32_t              stop_bits;
+    uart_parity_t         parity;
+} net_uart_t;
+
+static net_uart_t  m_uart[NET_UART_CHANNEL_N];
+
+
+
+static void net_uart_notify(net_uart_t *u)
+/**
+ * Wake up the thread which bridges the UART of the channel.
+ */
+{
+#if OPT_PIO_UART_N
+    if (u->channel != 0) {
+        cdc_pio_uart_notify(u->channel - 1);
+        return;
+    }
+#endif
+    cdc_uart_notify();
+}   // net_uart_notify
+
+
+
+static void net_uart_set_baudrate(net_uart_t *u, uint32_t baudrate)
+{
+#if OPT_PIO_UART_N
+    if (u->channel != 0) {
+        u->baudrate = cdc_pio_uart_set_baudrate(u->channel - 1, baudrate);
+        return;
+    }
+#endif
+    u->baudrate = uart_set_baudrate(PICOPROBE_UART_INTERFACE, baudrate);
+}   // net_uart_set_baudrate
+
+
+
+static bool net_uart_set_format(net_uart_t *u, uint32_t data_bits, uint32_t stop_bits, uart_parity_t parity)
+/**
+ * Change the line format.  PIO UARTs are fixed to 8N1.
+ *
+ * \return true -> format has been changed
+ */
+{
+    if (u->channel != 0) {
+        return false;
+    }
+
+    u->data_bits = data_bits;
+    u->stop_bits = stop_bits;
+    u->parity    = parity;
+    uart_set_format(PICOPROBE_UART_INTERFACE, data_bits, stop_bits, parity);
+    return true;
+}   // net_uart_set_format
+
+
+
+static void net_uart_close(net_uart_t *u)
+{
+    picoprobe_info("=================================== UART-TCP %d disconnect\n", u->channel);
+
+    if (u->pcb != NULL) {
+        tcp_arg(u->pcb, NULL);
+        tcp_sent(u->pcb, NULL);
+        tcp_recv(u->pcb, NULL);
+        tcp_err(u->pcb, NULL);
+        tcp_poll(u->pcb, NULL, 0);
+
+        if (tcp_close(u->pcb) != ERR_OK) {
+            tcp_abort(u->pcb);
+        }
+    }
+    if (u->rx_pending != NULL) {
+        pbuf_free(u->rx_pending);
+    }
+
+    u->pcb = NULL;
+    u->rx_pending = NULL;
+    u->connected = false;
+    u->block_call_back_message = false;
+    xStreamBufferReset(u->stream_to_host);
+    net_uart_notify(u);
+}   // net_uart_close
+
+
+
+static void net_uart_error(void *arg, err_t err)
+{
+    net_uart_t *u = (net_uart_t *)arg;
+
+    picoprobe_error("net_uart_error: %d %d\n", u->channel, err);
+
+    // pcb is already freed
+    u->pcb = NULL;
+    net_uart_close(u);
+}   // net_uart_error
+
+
+
+static void net_uart_reply(void *ctx, const uint8_t *buf, uint16_t len)
+/**
+ * Send a telnet reply to the client.  Replies are short, so a failing write is just ignored.
+ *
+ * Context: lwIP
+ */
+{
+    net_uart_t *u = (net_uart_t *)ctx;
+
+    if (u->pcb != NULL  &&  tcp_sndbuf(u->pcb) >= len) {
+        tcp_write(u->pcb, buf, len, TCP_WRITE_FLAG_COPY);
+    }
+}   // net_uart_reply
+
+
+
+static uint32_t net_uart_com_port(void *ctx, uint8_t cmd, uint32_t value)
+/**
+ * RFC2217 line settings.  \a value is RFC2217 encoded, 0 is a query.
+ *
+ * \return the current setting
+ */
+{
+    net_uart_t *u = (net_uart_t *)ctx;
+
+    switch (cmd) {
+        case RFC2217_SET_BAUDRATE:
+            if (value != 0) {
+                net_uart_set_baudrate(u, value);
+            }
+            return u->baudrate;
+
+        case RFC2217_SET_DATASIZE:
+            if (value >= 5  &&  value <= 8) {
+                net_uart_set_format(u, value, u->stop_bits, u->parity);
+            }
+            return u->data_bits;
+
+        case RFC2217_SET_PARITY:
+            if (value >= 1  &&  value <= 3) {
+                net_uart_set_format(u, u->data_bits, u->stop_bits,
+                                    (value == 1) ? UART_PARITY_NONE : ((value == 2) ? UART_PARITY_ODD : UART_PARITY_EVEN));
+            }
+            return (u->parity == UART_PARITY_NONE) ? 1 : ((u->parity == UART_PARITY_ODD) ? 2 : 3);
+
+        case RFC2217_SET_STOPSIZE:
+            if (value == 1  ||  value == 2) {
+                net_uart_set_format(u, u->data_bits, value, u->parity);
+            }
+            return u->stop_bits;
+    }
+    return 0;
+}   // net_uart_com_port
+
+
+
+static void net_uart_try_send(void *ctx)
+/**
+ * Transfer data from the target into the TCP connection.  If the client speaks telnet, IAC is doubled.
+ *
+ * Context: lwIP
+ */
+{
+    net_uart_t *u = (net_uart_t *)ctx;
+    bool written = false;
+
+    u->block_call_back_message = false;
+
+    while (u->connected  &&  !u->telnet.suspended  &&  !xStreamBufferIsEmpty(u->stream_to_host)) {
+        uint8_t tx_buf[256];
+        uint8_t raw[128];
+        size_t cnt;
+        size_t tx_len;
+        err_t err;
+
+        cnt = MIN(sizeof(raw), tcp_sndbuf(u->pcb) / 2);
+        if (cnt == 0) {
+            // continued by net_uart_sent()
+            break;
+        }
+        cnt = xStreamBufferReceive(u->stream_to_host, raw, cnt, 0);
+        tx_len = net_uart_telnet_escape(&u->telnet, raw, cnt, tx_buf);
+        err = tcp_write(u->pcb, tx_buf, tx_len, TCP_WRITE_FLAG_COPY);
+        if (err != ERR_OK) {
+            picoprobe_error("net_uart_try_send: %d %d\n", u->channel, err);
+            net_uart_close(u);
+            return;
+        }
+        written = true;
+    }
+
+    if (written) {
+        tcp_output(u->pcb);
+
+        // there is space in stream_to_host again
+        net_uart_notify(u);
+    }
+}   // net_uart_try_send
+
+
+
+static void net_uart_feed_target(net_uart_t *u)
+/**
+ * Run pending data from host through the telnet parser into \a stream_to_target.  Parsing stops if
+ * the stream is full, so a slow target throttles the host.
+ *
+ * Context: lwIP
+ */
+{
+    bool fed = false;
+
+    while (u->rx_pending != NULL) {
+        size_t space = xStreamBufferSpacesAvailable(u->stream_to_target);
+        uint8_t buf[64];
+        uint32_t used;
+        uint32_t n;
+
+        n = net_uart_telnet_feed(&u->telnet, (const uint8_t *)u->rx_pending->payload, u->rx_pending->len,
+                                 buf, MIN(sizeof(buf), space), &used);
+        if (used == 0) {
+            // continued by net_uart_target_ready()
+            break;
+        }
+        if (n != 0) {
+            xStreamBufferSend(u->stream_to_target, buf, n, 0);
+            fed = true;
+        }
+        tcp_recved(u->pcb, used);
+        u->rx_pending = pbuf_free_header(u->rx_pending, used);
+    }
+
+    if (u->pcb != NULL) {
+        // telnet replies
+        tcp_output(u->pcb);
+    }
+    if (fed) {
+        net_uart_notify(u);
+    }
+}   // net_uart_feed_target
+
+
+
+static void net_uart_feed_target_cb(void *ctx)
+{
+    net_uart_t *u = (net_uart_t *)ctx;
+
+    if (u->connected) {
+        net_uart_feed_target(u);
+    }
+}   // net_uart_feed_target_cb
+
+
+
+static err_t net_uart_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len)
+{
+    net_uart_try_send(arg);
+    return ERR_OK;
+}   // net_uart_sent
+
+
+
+static err_t net_uart_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    net_uart_t *u = (net_uart_t *)arg;
+
+    if (p == NULL) {
+        // remote host closed connection
+        net_uart_close(u);
+        return ERR_OK;
+    }
+    if (err != ERR_OK) {
+        pbuf_free(p);
+        return err;
+    }
+
+    if (u->rx_pending == NULL) {
+        u->rx_pending = p;
+    }
+    else {
+        pbuf_cat(u->rx_pending, p);
+    }
+    net_uart_feed_target(u);
+    return ERR_OK;
+}   // net_uart_recv
+
+
+
+static err_t net_uart_poll(void *arg, struct tcp_pcb *tpcb)
+{
+    net_uart_t *u = (net_uart_t *)arg;
+
+    net_uart_feed_target(u);
+    net_uart_try_send(u);
+    return ERR_OK;
+}   // net_uart_poll
+
+
+
+static err_t net_uart_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    net_uart_t *u = (net_uart_t *)arg;
+
+    if (err != ERR_OK  ||  newpcb == NULL) {
+        return ERR_VAL;
+    }
+    if (u->pcb != NULL) {
+        picoprobe_error("net_uart_accept: channel %d is busy\n", u->channel);
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    picoprobe_info("=================================== UART-TCP %d connect\n", u->channel);
+
+    u->pcb = newpcb;
+    net_uart_telnet_init(&u->telnet, net_uart_reply, net_uart_com_port, u);
+    xStreamBufferReset(u->stream_to_host);
+
+    tcp_arg(newpcb,  u);
+    tcp_err(newpcb,  net_uart_error);
+    tcp_recv(newpcb, net_uart_recv);
+    tcp_poll(newpcb, net_uart_poll, 1);
+    tcp_sent(newpcb, net_uart_sent);
+
+    u->connected = true;
+    net_uart_notify(u);
+    return ERR_OK;
+}   // net_uart_accept
+
+
+
+bool net_uart_is_connected(uint16_t channel)
+{
+    return channel < NET_UART_CHANNEL_N  &&  m_uart[channel].connected;
+}   // net_uart_is_connected
+
+
+
+uint32_t net_uart_send(uint16_t channel, const uint8_t *buf, uint32_t cnt)
+/**
+ * Send characters from a UART into the stream of its TCP connection.
+ *
+ * \param channel  UART channel, 0 is the target UART
+ * \param buf      pointer to the buffer to be sent, if NULL then remaining space in stream is returned
+ * \param cnt      number of bytes to be sent
+ * \return if \buf is NULL the remaining space in stream is returned, otherwise the number of bytes sent
+ */
+{
+    net_uart_t *u = m_uart + channel;
+    uint32_t r;
+
+    if (buf == NULL) {
+        return xStreamBufferSpacesAvailable(u->stream_to_host);
+    }
+    if ( !u->connected) {
+        return 0;
+    }
+
+    r = xStreamBufferSend(u->stream_to_host, buf, cnt, 0);
+
+    if ( !u->block_call_back_message) {
+        u->block_call_back_message = true;
+        if (tcpip_try_callback(net_uart_try_send, u) != ERR_OK) {
+            u->block_call_back_message = false;
+        }
+    }
+    return r;
+}   // net_uart_send
+
+
+
+StreamBufferHandle_t net_uart_stream_to_target(uint16_t channel)
+{
+    return m_uart[channel].stream_to_target;
+}   // net_uart_stream_to_target
+
+
+
+void net_uart_target_ready(uint16_t channel)
+/**
+ * Data has been taken out of \a stream_to_target, so pending data from the host can follow.
+ */
+{
+    if (m_uart[channel].rx_pending != NULL) {
+        tcpip_try_callback(net_uart_feed_target_cb, m_uart + channel);
+    }
+}   // net_uart_target_ready
+
+
+
+void net_uart_init(void)
+{
+    for (uint16_t channel = 0;  channel < NET_UART_CHANNEL_N;  ++channel) {
+        net_uart_t *u = m_uart + channel;
+        struct tcp_pcb *pcb;
+        struct tcp_pcb *pcb_listen;
+        err_t err;
+
+        u->channel   = channel;
+#if OPT_PIO_UART_N
+        u->baudrate  = (channel == 0) ? PICOPROBE_UART_BAUDRATE : PIO_UART_BAUDRATE;
+#else
+        u->baudrate  = PICOPROBE_UART_BAUDRATE;
+#endif
+        u->data_bits = 8;
+        u->stop_bits = 1;
+        u->parity    = UART_PARITY_NONE;
+
+        u->stream_to_host   = xStreamBufferCreate(STREAM_NET_UART_TO_HOST_SIZE, STREAM_NET_UART_TRIGGER);
+        u->stream_to_target = xStreamBufferCreate(STREAM_NET_UART_TO_TARGET_SIZE, STREAM_NET_UART_TRIGGER);
+        if (u->stream_to_host == NULL  ||  u->stream_to_target == NULL) {
+            picoprobe_error("net_uart_init: cannot create streams for channel %d\n", channel);
+            return;
+        }
+
+        pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+        if (pcb == NULL)
+        {
+            picoprobe_error("net_uart_init: cannot get pcb\n");
+            return;
+        }
+
+        err = tcp_bind(pcb, IP_ADDR_ANY, NET_UART_SERVER_PORT + channel);
+        if (err != ERR_OK)
+        {
+            picoprobe_error("net_uart_init: cannot bind, err:%d\n", err);
+            return;
+        }
+
+        pcb_listen = tcp_listen_with_backlog(pcb, 1);
+        if (pcb_listen == NULL)
+        {
+            tcp_close(pcb);
+            picoprobe_error("net_uart_init: cannot listen\n");
+            return;
+        }
+
+        tcp_arg(pcb_listen, u);
+        tcp_accept(pcb_listen, net_uart_accept);
+    }
+}   // net_uart_init
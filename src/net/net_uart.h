@@ -0,0 +1,61 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _NET_UART_H
+#define _NET_UART_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+#ifdef OPT_PIO_UART_N
+    #define NET_UART_CHANNEL_N      (1 + OPT_PIO_UART_N)     // target UART plus PIO UARTs on NET_UART_SERVER_PORT+ch
+#else
+    #define NET_UART_CHANNEL_N      1
+#endif
+
+
+void net_uart_init(void);
+bool net_uart_is_connected(uint16_t channel);
+uint32_t net_uart_send(uint16_t channel, const uint8_t *buf, uint32_t cnt);
+StreamBufferHandle_t net_uart_stream_to_target(uint16_t channel);
+void net_uart_target_ready(uint16_t channel);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+
+#endif
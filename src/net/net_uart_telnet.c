@@ -0,0 +1,282 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// Telnet / RFC2217 protocol of the UART TCP server, see net_uart.c
+// - the receive state machine strips telnet commands from the data of the host and answers them
+// - option negotiation: only BINARY, SGA and COM-PORT-OPTION are accepted
+// - COM-PORT-OPTION settings are delegated to the server, which knows the UART
+// - no lwIP or FreeRTOS here, so the protocol is covered by the host tests
+//
+
+#include <string.h>
+
+#include "net_uart_telnet.h"
+
+
+// telnet, see RFC854/RFC855
+#define TELNET_SE                   240
+#define TELNET_SB                   250
+#define TELNET_WILL                 251
+#define TELNET_WONT                 252
+#define TELNET_DO                   253
+#define TELNET_DONT                 254
+#define TELNET_IAC                  255
+
+#define TELNET_OPT_BINARY           0
+#define TELNET_OPT_SGA              3
+#define TELNET_OPT_COM_PORT         44
+
+
+
+void net_uart_telnet_init(net_uart_telnet_t *t, net_uart_telnet_reply_t reply, net_uart_telnet_com_port_t com_port, void *ctx)
+/**
+ * Reset the protocol state for a new connection.
+ */
+{
+    memset(t, 0, sizeof(*t));
+    t->reply    = reply;
+    t->com_port = com_port;
+    t->ctx      = ctx;
+    t->state    = TS_DATA;
+}   // net_uart_telnet_init
+
+
+
+static void net_uart_telnet_negotiate(net_uart_telnet_t *t, uint8_t verb, uint8_t option)
+/**
+ * Answer WILL/WONT/DO/DONT.  Only BINARY, SGA and COM-PORT-OPTION are accepted.
+ * Every option is answered once, which avoids negotiation loops (RFC854).
+ */
+{
+    uint64_t mask = (option < 64) ? (1ULL << option) : 0;
+    uint8_t reply[3] = { TELNET_IAC, 0, option };
+
+    if (verb == TELNET_WILL  ||  verb == TELNET_WONT) {
+        if (mask != 0  &&  (t->they_announced & mask) != 0) {
+            return;
+        }
+        t->they_announced |= mask;
+        reply[1] = (verb == TELNET_WILL  &&  (option == TELNET_OPT_BINARY  ||  option == TELNET_OPT_SGA
+                                              ||  option == TELNET_OPT_COM_PORT)) ? TELNET_DO : TELNET_DONT;
+    }
+    else {
+        if (mask != 0  &&  (t->we_announced & mask) != 0) {
+            return;
+        }
+        t->we_announced |= mask;
+        reply[1] = (verb == TELNET_DO  &&  (option == TELNET_OPT_BINARY  ||  option == TELNET_OPT_SGA)) ? TELNET_WILL : TELNET_WONT;
+    }
+    t->reply(t->ctx, reply, sizeof(reply));
+}   // net_uart_telnet_negotiate
+
+
+
+static void net_uart_telnet_com_port_option(net_uart_telnet_t *t, const uint8_t *sb, uint8_t len)
+/**
+ * Handle an RFC2217 subnegotiation.  \a sb points to the command byte after COM-PORT-OPTION.
+ * Values of 0 are queries, the answer is always the current setting.
+ */
+{
+    uint8_t cmd = sb[0];
+    uint8_t reply[4 + 2 * 4 + 2] = { TELNET_IAC, TELNET_SB, TELNET_OPT_COM_PORT, cmd + RFC2217_SERVER_OFFSET };
+    uint8_t value_buf[4];
+    uint32_t value = (len >= 2) ? sb[1] : 0;
+    uint32_t value_len = 1;
+    uint32_t reply_len = 4;
+
+    switch (cmd) {
+        case RFC2217_SET_BAUDRATE:
+            value = (len >= 5) ? ((uint32_t)sb[1] << 24) | ((uint32_t)sb[2] << 16) | ((uint32_t)sb[3] << 8) | sb[4] : 0;
+            value = t->com_port(t->ctx, cmd, value);
+            value_len = 4;
+            break;
+
+        case RFC2217_SET_DATASIZE:
+        case RFC2217_SET_PARITY:
+        case RFC2217_SET_STOPSIZE:
+            value = t->com_port(t->ctx, cmd, value);
+            break;
+
+        case RFC2217_SET_CONTROL:
+            // there is no flow control, break, DTR or RTS: queries get the fixed state, settings are echoed
+            if (value == 0) {
+                value = 1;                                   // no flow control
+            }
+            else if (value == 4  ||  value == 7  ||  value == 10) {
+                value = value + 2;                           // break off / DTR off / RTS off
+            }
+            break;
+
+        case RFC2217_FLOWCONTROL_SUSPEND:
+        case RFC2217_FLOWCONTROL_RESUME:
+            // no answer
+            t->suspended = (cmd == RFC2217_FLOWCONTROL_SUSPEND);
+            return;
+
+        default:
+            // PURGE-DATA, NOTIFY-LINESTATE, NOTIFY-MODEMSTATE and the masks are just acknowledged
+            break;
+    }
+
+    if (value_len == 4) {
+        value_buf[0] = (uint8_t)(value >> 24);
+        value_buf[1] = (uint8_t)(value >> 16);
+        value_buf[2] = (uint8_t)(value >> 8);
+        value_buf[3] = (uint8_t)value;
+    }
+    else {
+        value_buf[0] = (uint8_t)value;
+    }
+    // value bytes are data within the subnegotiation, so IAC has to be doubled
+    for (uint32_t i = 0;  i < value_len;  ++i) {
+        reply[reply_len++] = value_buf[i];
+        if (value_buf[i] == TELNET_IAC) {
+            reply[reply_len++] = TELNET_IAC;
+        }
+    }
+    reply[reply_len++] = TELNET_IAC;
+    reply[reply_len++] = TELNET_SE;
+    t->reply(t->ctx, reply, reply_len);
+}   // net_uart_telnet_com_port_option
+
+
+
+int net_uart_telnet_rx(net_uart_telnet_t *t, uint8_t ch)
+/**
+ * Telnet receive state machine.
+ *
+ * \return the data byte or -1 if \a ch was part of a telnet command
+ */
+{
+    switch (t->state) {
+        case TS_DATA:
+            if (ch == TELNET_IAC) {
+                t->state = TS_IAC;
+                return -1;
+            }
+            return ch;
+
+        case TS_IAC:
+            t->telnet = true;
+            if (ch == TELNET_IAC) {
+                t->state = TS_DATA;
+                return ch;
+            }
+            if (ch >= TELNET_WILL) {
+                t->verb = ch;
+                t->state = TS_OPTION;
+            }
+            else if (ch == TELNET_SB) {
+                t->sb_len = 0;
+                t->state = TS_SB;
+            }
+            else {
+                // NOP, GA etc. are ignored
+                t->state = TS_DATA;
+            }
+            return -1;
+
+        case TS_OPTION:
+            net_uart_telnet_negotiate(t, t->verb, ch);
+            t->state = TS_DATA;
+            return -1;
+
+        case TS_SB:
+            if (ch == TELNET_IAC) {
+                t->state = TS_SB_IAC;
+            }
+            else if (t->sb_len < sizeof(t->sb_buf)) {
+                t->sb_buf[t->sb_len++] = ch;
+            }
+            return -1;
+
+        case TS_SB_IAC:
+            if (ch == TELNET_IAC) {
+                if (t->sb_len < sizeof(t->sb_buf)) {
+                    t->sb_buf[t->sb_len++] = ch;
+                }
+                t->state = TS_SB;
+            }
+            else {
+                // TELNET_SE or protocol error: end of subnegotiation
+                if (t->sb_len >= 2  &&  t->sb_buf[0] == TELNET_OPT_COM_PORT) {
+                    net_uart_telnet_com_port_option(t, t->sb_buf + 1, t->sb_len - 1);
+                }
+                t->state = TS_DATA;
+            }
+            return -1;
+    }
+    return -1;
+}   // net_uart_telnet_rx
+
+
+
+uint32_t net_uart_telnet_feed(net_uart_telnet_t *t, const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_max,
+                              uint32_t *used)
+/**
+ * Run data from the host through the receive state machine.  Parsing stops as soon as \a out_max
+ * data bytes have been produced, so the rest of \a in stays with the caller (flow control).
+ *
+ * \param used  number of bytes taken from \a in
+ * \return number of data bytes in \a out
+ */
+{
+    uint32_t n = 0;
+    uint32_t i = 0;
+
+    while (i < in_len  &&  n < out_max) {
+        int ch = net_uart_telnet_rx(t, in[i++]);
+
+        if (ch >= 0) {
+            out[n++] = (uint8_t)ch;
+        }
+    }
+    *used = i;
+    return n;
+}   // net_uart_telnet_feed
+
+
+
+uint32_t net_uart_telnet_escape(const net_uart_telnet_t *t, const uint8_t *in, uint32_t cnt, uint8_t *out)
+/**
+ * Copy data for the host, IAC is doubled if the client speaks telnet.
+ * \a out must have room for 2 * \a cnt bytes.
+ *
+ * \return number of bytes in \a out
+ */
+{
+    uint32_t len = 0;
+
+    for (uint32_t i = 0;  i < cnt;  ++i) {
+        out[len++] = in[i];
+        if (in[i] == TELNET_IAC  &&  t->telnet) {
+            out[len++] = TELNET_IAC;
+        }
+    }
+    return len;
+}   // net_uart_telnet_escape
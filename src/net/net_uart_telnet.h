@@ -0,0 +1,93 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _NET_UART_TELNET_H
+#define _NET_UART_TELNET_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+// RFC2217 client to server commands, server answers with command + 100
+#define RFC2217_SET_BAUDRATE        1
+#define RFC2217_SET_DATASIZE        2
+#define RFC2217_SET_PARITY          3
+#define RFC2217_SET_STOPSIZE        4
+#define RFC2217_SET_CONTROL         5
+#define RFC2217_FLOWCONTROL_SUSPEND 8
+#define RFC2217_FLOWCONTROL_RESUME  9
+#define RFC2217_SERVER_OFFSET       100
+
+/// send \a len bytes of a telnet reply to the client
+typedef void (*net_uart_telnet_reply_t)(void *ctx, const uint8_t *buf, uint16_t len);
+
+/// RFC2217 SET-BAUDRATE/DATASIZE/PARITY/STOPSIZE: set \a value (RFC2217 encoding, 0 = query),
+/// return the current setting
+typedef uint32_t (*net_uart_telnet_com_port_t)(void *ctx, uint8_t cmd, uint32_t value);
+
+typedef enum {
+    TS_DATA,
+    TS_IAC,
+    TS_OPTION,
+    TS_SB,
+    TS_SB_IAC,
+} telnet_state_t;
+
+typedef struct {
+    net_uart_telnet_reply_t     reply;
+    net_uart_telnet_com_port_t  com_port;
+    void                       *ctx;
+
+    bool                  telnet;                    // client has sent telnet commands -> escape IAC
+    bool                  suspended;                 // RFC2217 FLOWCONTROL-SUSPEND
+
+    telnet_state_t        state;
+    uint8_t               verb;
+    uint8_t               sb_len;
+    uint8_t               sb_buf[8];
+    uint64_t              we_announced;              // bitmask of options answered with WILL/WONT
+    uint64_t              they_announced;            // bitmask of options answered with DO/DONT
+} net_uart_telnet_t;
+
+
+void net_uart_telnet_init(net_uart_telnet_t *t, net_uart_telnet_reply_t reply, net_uart_telnet_com_port_t com_port, void *ctx);
+int net_uart_telnet_rx(net_uart_telnet_t *t, uint8_t ch);
+uint32_t net_uart_telnet_feed(net_uart_telnet_t *t, const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_max,
+                              uint32_t *used);
+uint32_t net_uart_telnet_escape(const net_uart_telnet_t *t, const uint8_t *in, uint32_t cnt, uint8_t *out);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Queue for lwIP -> TinyUSB transmission (see net_glue.c).
+ *
+ * lwIP gets a slot, copies its frame into it and commits it.  TinyUSB drains the queue into the
+ * driver until the driver refuses a frame.  The driver calls again when it has a free transmit buffer.
+ * Several frames in the queue allow NCM to pack them into one NTB.
+ *
+ * No TinyUSB or lwIP calls here, so this is covered by the host tests.
+ */
+
+#include "hardware/sync.h"
+
+#include "net_xmt_queue.h"
+
+
+
+void net_xmt_queue_init(net_xmt_queue_t *q, uint32_t n, net_xmt_queue_xmit_t xmit, net_xmt_queue_wakeup_t wakeup, void *ctx)
+{
+    q->n      = n;
+    q->wr     = 0;
+    q->rd     = 0;
+    q->event  = false;
+    q->xmit   = xmit;
+    q->wakeup = wakeup;
+    q->ctx    = ctx;
+}   // net_xmt_queue_init
+
+
+
+int32_t net_xmt_queue_slot(net_xmt_queue_t *q)
+/**
+ * Get the slot for the next frame.
+ *
+ * If the queue is full, the consumer is kicked: if the driver refused the queue head while none of
+ * its transmit buffers was in flight, its ready callback never comes and the queue would stay full forever.
+ *
+ * \return slot number or -1 if the queue is full
+ *
+ * Context: producer
+ */
+{
+    if (q->wr - q->rd >= q->n) {
+        q->event = true;
+        q->wakeup(q->ctx);
+        return -1;
+    }
+    return (int32_t)(q->wr & (q->n - 1));
+}   // net_xmt_queue_slot
+
+
+
+void net_xmt_queue_commit(net_xmt_queue_t *q)
+/**
+ * The frame in the slot returned by net_xmt_queue_slot() is complete, pass it to the consumer.
+ *
+ * Context: producer
+ */
+{
+    __dmb();
+    ++q->wr;
+    q->event = true;
+    q->wakeup(q->ctx);
+}   // net_xmt_queue_commit
+
+
+
+bool net_xmt_queue_event(net_xmt_queue_t *q)
+/**
+ * Fetch and clear the event flag set by the producer.
+ *
+ * Context: consumer
+ */
+{
+    if ( !q->event) {
+        return false;
+    }
+    q->event = false;
+    return true;
+}   // net_xmt_queue_event
+
+
+
+bool net_xmt_queue_drain(net_xmt_queue_t *q)
+/**
+ * Hand all queued frames to the driver.
+ *
+ * \return false if the driver refused a frame, call again when the driver is ready
+ *
+ * Context: consumer
+ */
+{
+    while (q->rd != q->wr) {
+        __dmb();
+        if ( !q->xmit(q->ctx, q->rd & (q->n - 1))) {
+            return false;
+        }
+        __dmb();
+        ++q->rd;
+    }
+    return true;
+}   // net_xmt_queue_drain
+
+
+
+void net_xmt_queue_flush(net_xmt_queue_t *q)
+/**
+ * Drop all queued frames (driver reset).
+ *
+ * Context: consumer
+ */
+{
+    q->rd = q->wr;
+}   // net_xmt_queue_flush
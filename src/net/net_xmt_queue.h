@@ -0,0 +1,73 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _NET_XMT_QUEUE_H
+#define _NET_XMT_QUEUE_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/// hand the frame in \a slot to the driver, return false if the driver cannot take it now
+typedef bool (*net_xmt_queue_xmit_t)(void *ctx, uint32_t slot);
+
+/// trigger net_xmt_queue_event() in consumer context
+typedef void (*net_xmt_queue_wakeup_t)(void *ctx);
+
+/**
+ * Index bookkeeping of the lwIP -> TinyUSB frame queue.
+ * Single producer (lwIP) / single consumer (TinyUSB), lock-free with free running indexes.
+ * The frames themselves are owned by the caller, the queue hands out slot numbers.
+ */
+typedef struct {
+    uint32_t                n;                  // number of slots, power of 2
+    volatile uint32_t       wr;                 // written by the producer only
+    volatile uint32_t       rd;                 // written by the consumer only
+    volatile bool           event;              // consumer has to look at the queue
+    net_xmt_queue_xmit_t    xmit;
+    net_xmt_queue_wakeup_t  wakeup;
+    void                   *ctx;
+} net_xmt_queue_t;
+
+
+void    net_xmt_queue_init(net_xmt_queue_t *q, uint32_t n, net_xmt_queue_xmit_t xmit, net_xmt_queue_wakeup_t wakeup, void *ctx);
+int32_t net_xmt_queue_slot(net_xmt_queue_t *q);
+void    net_xmt_queue_commit(net_xmt_queue_t *q);
+bool    net_xmt_queue_event(net_xmt_queue_t *q);
+bool    net_xmt_queue_drain(net_xmt_queue_t *q);
+void    net_xmt_queue_flush(net_xmt_queue_t *q);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
@@ -57,6 +57,8 @@
 
 #include "net_device.h"
 #include "ncm.h"
+#include "ncm_recv.h"
+#include "stats_counter.h"
 
 
 #if !defined(tu_static)  ||  defined(ECLIPSE_GUI)
@@ -102,14 +104,6 @@ typedef struct {
     uint8_t     itf_data_alt;                      //!< ==0 -> no endpoints, i.e. no network traffic, ==1 -> normal operation with two endpoints (spec, chapter 5.3)
     uint8_t     rhport;                            //!< storage of \a rhport because some callbacks are done without it
 
-    // recv handling
-    CFG_TUSB_MEM_ALIGN recv_ntb_t  recv_ntb[RECV_NTB_N];              //!< actual recv NTBs
-    recv_ntb_t *recv_free_ntb[RECV_NTB_N];         //!< free list of recv NTBs
-    recv_ntb_t *recv_ready_ntb[RECV_NTB_N];        //!< NTBs waiting for transmission to glue logic
-    recv_ntb_t *recv_tinyusb_ntb;                  //!< buffer for the running transfer TinyUSB -> driver
-    recv_ntb_t *recv_glue_ntb;                     //!< buffer for the running transfer driver -> glue logic
-    uint16_t               recv_glue_ntb_datagram_ndx;        //!< index into \a recv_glue_ntb_datagram
-
     // xmit handling
     CFG_TUSB_MEM_ALIGN xmit_ntb_t  xmit_ntb[XMIT_NTB_N];              //!< actual xmit NTBs
     xmit_ntb_t *xmit_free_ntb[XMIT_NTB_N];         //!< free list of xmit NTBs
@@ -131,6 +125,15 @@ typedef struct {
 
 CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN tu_static ncm_interface_t ncm_interface;
 
+/**
+ * Receive NTBs and their bookkeeping (ncm_recv.c).  Both are outside of \a ncm_interface, because
+ * they survive a reset: lwIP may still hold datagrams of the NTBs.
+ */
+CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN tu_static recv_ntb_t recv_ntb[RECV_NTB_N];
+tu_static ncm_recv_t ncm_recv;
+
+TU_VERIFY_STATIC(RECV_NTB_N <= NCM_RECV_NTB_MAX, "too many receive NTBs");
+
 
 /**
  * This is the NTB parameter structure
@@ -463,78 +466,19 @@ static bool xmit_setup_next_glue_ntb(void)
 //
 
 
-static recv_ntb_t *recv_get_free_ntb(void)
-/**
- * Return pointer to an available receive buffer or NULL.
- * Returned buffer (if any) has the size \a CFG_TUD_NCM_OUT_NTB_MAX_SIZE.
- */
+static bool recv_ref_cb(void *ctx, const uint8_t *src, uint16_t size, void *ref)
 {
-    DEBUG_OUT("recv_get_free_ntb()\n");
-
-    for (int i = 0;  i < RECV_NTB_N;  ++i) {
-        if (ncm_interface.recv_free_ntb[i] != NULL) {
-            recv_ntb_t *free = ncm_interface.recv_free_ntb[i];
-            ncm_interface.recv_free_ntb[i] = NULL;
-            return free;
-        }
-    }
-    return NULL;
-}   // recv_get_free_ntb
+    (void)ctx;
+    return tud_network_recv_ref_cb(src, size, ref);
+}   // recv_ref_cb
 
 
 
-static recv_ntb_t *recv_get_next_ready_ntb(void)
-/**
- * Get the next NTB from the ready list (and remove it from the list).
- * If the ready list is empty, return NULL.
- */
+static bool recv_copy_cb(void *ctx, const uint8_t *src, uint16_t size)
 {
-    recv_ntb_t *r = NULL;
-
-    r = ncm_interface.recv_ready_ntb[0];
-    memmove(ncm_interface.recv_ready_ntb + 0, ncm_interface.recv_ready_ntb + 1, sizeof(ncm_interface.recv_ready_ntb) - sizeof(ncm_interface.recv_ready_ntb[0]));
-    ncm_interface.recv_ready_ntb[RECV_NTB_N - 1] = NULL;
-
-    DEBUG_OUT("recv_get_next_ready_ntb: %p\n", r);
-    return r;
-}   // recv_get_next_ready_ntb
-
-
-
-static void recv_put_ntb_into_free_list(recv_ntb_t *free_ntb)
-/**
- *
- */
-{
-    DEBUG_OUT("recv_put_ntb_into_free_list(%p)\n", free_ntb);
-
-    for (int i = 0;  i < RECV_NTB_N;  ++i) {
-        if (ncm_interface.recv_free_ntb[i] == NULL) {
-            ncm_interface.recv_free_ntb[i] = free_ntb;
-            return;
-        }
-    }
-    ERROR_OUT("(EE) recv_put_ntb_into_free_list - no entry in free list\n");  // this should not happen
-}   // recv_put_ntb_into_free_list
-
-
-
-static void recv_put_ntb_into_ready_list(recv_ntb_t *ready_ntb)
-/**
- * \a ready_ntb holds a validated NTB,
- * put this buffer into the waiting list.
- */
-{
-    DEBUG_OUT("recv_put_ntb_into_ready_list(%p) %d\n", ready_ntb, ready_ntb->nth.wBlockLength);
-
-    for (int i = 0;  i < RECV_NTB_N;  ++i) {
-        if (ncm_interface.recv_ready_ntb[i] == NULL) {
-            ncm_interface.recv_ready_ntb[i] = ready_ntb;
-            return;
-        }
-    }
-    ERROR_OUT("(EE) recv_put_ntb_into_ready_list: ready list full\n");  // this should not happen
-}   // recv_put_ntb_into_ready_list
+    (void)ctx;
+    return tud_network_recv_cb(src, size);
+}   // recv_copy_cb
 
 
 
@@ -549,180 +493,27 @@ static void recv_try_to_start_new_reception(uint8_t rhport)
     if (ncm_interface.itf_data_alt != 1) {
         return;
     }
-    if (ncm_interface.recv_tinyusb_ntb != NULL) {
+    if (ncm_recv.usb_ntb >= 0) {
         return;
     }
     if (usbd_edpt_busy(rhport, ncm_interface.ep_out)) {
         return;
     }
 
-    ncm_interface.recv_tinyusb_ntb = recv_get_free_ntb();
-    if (ncm_interface.recv_tinyusb_ntb == NULL) {
+    uint8_t *ntb = ncm_recv_start(&ncm_recv);
+    if (ntb == NULL) {
         return;
     }
 
     // initiate transfer
     DEBUG_OUT("  start reception\n");
-    bool r = usbd_edpt_xfer(rhport, ncm_interface.ep_out, ncm_interface.recv_tinyusb_ntb->data, CFG_TUD_NCM_OUT_NTB_MAX_SIZE);
+    bool r = usbd_edpt_xfer(rhport, ncm_interface.ep_out, ntb, CFG_TUD_NCM_OUT_NTB_MAX_SIZE);
     if ( !r) {
-        recv_put_ntb_into_free_list(ncm_interface.recv_tinyusb_ntb);
-        ncm_interface.recv_tinyusb_ntb = NULL;
+        ncm_recv_cancel(&ncm_recv);
     }
 }   // recv_try_to_start_new_reception
 
 
-
-static bool recv_validate_datagram(const recv_ntb_t *ntb, uint32_t len)
-/**
- * Validate incoming datagram.
- * \return true if valid
- *
- * \note
- *    \a ndp16->wNextNdpIndex != 0 is not supported
- */
-{
-    const nth16_t *nth16 = &(ntb->nth);
-
-    DEBUG_OUT("recv_validate_datagram(%p, %d)\n", ntb, (int)len);
-
-    //
-    // check header
-    //
-    if (nth16->wHeaderLength != sizeof(nth16_t))
-    {
-        ERROR_OUT("(EE) ill nth16 length: %d\n", nth16->wHeaderLength);
-        return false;
-    }
-    if (nth16->dwSignature != NTH16_SIGNATURE) {
-        ERROR_OUT("(EE) ill signature: 0x%08x\n", (unsigned)nth16->dwSignature);
-        return false;
-    }
-    if (len < sizeof(nth16_t) + sizeof(ndp16_t) + 2*sizeof(ndp16_datagram_t)) {
-        ERROR_OUT("(EE) ill min len: %d\n", len);
-        return false;
-    }
-    if (nth16->wBlockLength > len) {
-        ERROR_OUT("(EE) ill block length: %d > %d\n", nth16->wBlockLength, len);
-        return false;
-    }
-    if (nth16->wBlockLength > CFG_TUD_NCM_OUT_NTB_MAX_SIZE) {
-        ERROR_OUT("(EE) ill block length2: %d > %d\n", nth16->wBlockLength, CFG_TUD_NCM_OUT_NTB_MAX_SIZE);
-        return false;
-    }
-    if (nth16->wNdpIndex < sizeof(nth16)  ||  nth16->wNdpIndex > len - (sizeof(ndp16_t) + 2*sizeof(ndp16_datagram_t))) {
-        ERROR_OUT("(EE) ill position of first ndp: %d (%d)\n", nth16->wNdpIndex, len);
-        return false;
-    }
-
-    //
-    // check (first) NDP(16)
-    //
-    const ndp16_t *ndp16 = (const ndp16_t *)(ntb->data + nth16->wNdpIndex);
-
-    if (ndp16->wLength < sizeof(ndp16_t) + 2*sizeof(ndp16_datagram_t)) {
-        ERROR_OUT("(EE) ill ndp16 length: %d\n", ndp16->wLength);
-        return false;
-    }
-    if (ndp16->dwSignature != NDP16_SIGNATURE_NCM0  &&  ndp16->dwSignature != NDP16_SIGNATURE_NCM1) {
-        ERROR_OUT("(EE) ill signature: 0x%08x\n", (unsigned)ndp16->dwSignature);
-        return false;
-    }
-    if (ndp16->wNextNdpIndex != 0) {
-        ERROR_OUT("(EE) cannot handle wNextNdpIndex!=0 (%d)\n", ndp16->wNextNdpIndex);
-        return false;
-    }
-
-    const ndp16_datagram_t *ndp16_datagram = (const ndp16_datagram_t *)(ntb->data + nth16->wNdpIndex + sizeof(ndp16_t));
-    int ndx = 0;
-    uint16_t max_ndx = (uint16_t)((ndp16->wLength - sizeof(ndp16_t)) / sizeof(ndp16_datagram_t));
-
-    if (max_ndx > 2) {
-        // number of datagrams in NTB > 1
-        INFO_OUT("<< %d (%d)\n", max_ndx - 1, ntb->nth.wBlockLength);
-    }
-    if (ndp16_datagram[max_ndx-1].wDatagramIndex != 0  ||  ndp16_datagram[max_ndx-1].wDatagramLength != 0) {
-        INFO_OUT("  max_ndx != 0\n");
-        return false;
-    }
-    while (ndp16_datagram[ndx].wDatagramIndex != 0  &&  ndp16_datagram[ndx].wDatagramLength != 0) {
-        DEBUG_OUT("  << %d %d\n", ndp16_datagram[ndx].wDatagramIndex, ndp16_datagram[ndx].wDatagramLength);
-        if (ndp16_datagram[ndx].wDatagramIndex > len) {
-            ERROR_OUT("(EE) ill start of datagram[%d]: %d (%d)\n", ndx, ndp16_datagram[ndx].wDatagramIndex, len);
-            return false;
-        }
-        if (ndp16_datagram[ndx].wDatagramIndex + ndp16_datagram[ndx].wDatagramLength > len) {
-            ERROR_OUT("(EE) ill end of datagram[%d]: %d (%d)\n", ndx, ndp16_datagram[ndx].wDatagramIndex + ndp16_datagram[ndx].wDatagramLength, len);
-            return false;
-        }
-        ++ndx;
-    }
-
-#ifdef DEBUG_OUT_ENABLED
-    for (uint32_t i = 0;  i < len;  ++i) {
-        DEBUG_OUT(" %02x", ntb->data[i]);
-    }
-    DEBUG_OUT("\n");
-#endif
-
-    // -> ntb contains a valid packet structure
-    //    ok... I did not check for garbage within the datagram indices...
-    return true;
-}   // recv_validate_datagram
-
-
-
-static void recv_transfer_datagram_to_glue_logic(void)
-/**
- * Transfer the next (pending) datagram to the glue logic and return receive buffer if empty.
- */
-{
-    DEBUG_OUT("recv_transfer_datagram_to_glue_logic()\n");
-
-    if (ncm_interface.recv_glue_ntb == NULL) {
-        ncm_interface.recv_glue_ntb = recv_get_next_ready_ntb();
-        DEBUG_OUT("  new buffer for glue logic: %p\n", ncm_interface.recv_glue_ntb);
-        ncm_interface.recv_glue_ntb_datagram_ndx = 0;
-    }
-
-    if (ncm_interface.recv_glue_ntb != NULL) {
-        const ndp16_datagram_t *ndp16_datagram = (ndp16_datagram_t *)(ncm_interface.recv_glue_ntb->data
-                                                                    + ncm_interface.recv_glue_ntb->nth.wNdpIndex
-                                                                    + sizeof(ndp16_t));
-
-        if (ndp16_datagram[ncm_interface.recv_glue_ntb_datagram_ndx].wDatagramIndex == 0) {
-            ERROR_OUT("(EE) SOMETHING WENT WRONG 1\n");
-        }
-        else if (ndp16_datagram[ncm_interface.recv_glue_ntb_datagram_ndx].wDatagramLength == 0) {
-            ERROR_OUT("(EE) SOMETHING WENT WRONG 2\n");
-        }
-        else {
-            uint16_t datagramIndex  = ndp16_datagram[ncm_interface.recv_glue_ntb_datagram_ndx].wDatagramIndex;
-            uint16_t datagramLength = ndp16_datagram[ncm_interface.recv_glue_ntb_datagram_ndx].wDatagramLength;
-
-            DEBUG_OUT("  recv[%d] - %d %d\n", ncm_interface.recv_glue_ntb_datagram_ndx, datagramIndex, datagramLength);
-            if (tud_network_recv_cb(ncm_interface.recv_glue_ntb->data + datagramIndex, datagramLength)) {
-                //
-                // send datagram successfully to glue logic
-                //
-                DEBUG_OUT("    OK\n");
-                datagramIndex  = ndp16_datagram[ncm_interface.recv_glue_ntb_datagram_ndx + 1].wDatagramIndex;
-                datagramLength = ndp16_datagram[ncm_interface.recv_glue_ntb_datagram_ndx + 1].wDatagramLength;
-
-                if (datagramIndex != 0  &&  datagramLength != 0) {
-                    // -> next datagram
-                    ++ncm_interface.recv_glue_ntb_datagram_ndx;
-                }
-                else {
-                    // end of datagrams reached
-                    recv_put_ntb_into_free_list(ncm_interface.recv_glue_ntb);
-                    ncm_interface.recv_glue_ntb = NULL;
-                }
-            }
-        }
-    }
-}   // recv_transfer_datagram_to_glue_logic
-
-
 //-----------------------------------------------------------------------------
 //
 // all the tud_network_*() stuff (glue logic -> driver)
@@ -793,12 +584,30 @@ void tud_network_recv_renew(void)
 {
     DEBUG_OUT("tud_network_recv_renew()\n");
 
-    recv_transfer_datagram_to_glue_logic();
+    ncm_recv_deliver(&ncm_recv);
     recv_try_to_start_new_reception(ncm_interface.rhport);
 }   // tud_network_recv_renew
 
 
 
+void tud_network_recv_release(void *ref)
+/**
+ * The glue logic has finished with a datagram handed over by tud_network_recv_ref_cb().
+ * If this was the last datagram in use of its NTB, the NTB is reused for reception.
+ */
+{
+    DEBUG_OUT("tud_network_recv_release(%p)\n", ref);
+
+    if ( !ncm_recv_release(&ncm_recv, ref)) {
+        // must not happen, reference counts survive a reset
+        ERROR_OUT("(EE) tud_network_recv_release: unknown reference %p\n", ref);
+        return;
+    }
+    tud_network_recv_renew();
+}   // tud_network_recv_release
+
+
+
 void tud_network_recv_renew_r(uint8_t rhport)
 /**
  * Same as tud_network_recv_renew() but knows \a rhport
@@ -819,6 +628,9 @@ void netd_init(void)
 /**
  * Initialize the driver data structures.
  * Might be called several times.
+ *
+ * Datagrams handed over without copy may still be in use by lwIP (e.g. in a TCP queue) after a reset.
+ * So the receive NTBs are kept by ncm_recv_init() until the final tud_network_recv_release().
  */
 {
     DEBUG_OUT("netd_init()\n");
@@ -828,9 +640,7 @@ void netd_init(void)
     for (int i = 0;  i < XMIT_NTB_N;  ++i) {
         ncm_interface.xmit_free_ntb[i] = ncm_interface.xmit_ntb + i;
     }
-    for (int i = 0;  i < RECV_NTB_N;  ++i) {
-        ncm_interface.recv_free_ntb[i] = ncm_interface.recv_ntb + i;
-    }
+    ncm_recv_init(&ncm_recv, recv_ntb[0].data, sizeof(recv_ntb[0]), RECV_NTB_N, recv_ref_cb, recv_copy_cb, NULL);
 }   // netd_init
 
 
@@ -931,15 +741,15 @@ bool netd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_
         // - if there is a free receive buffer, initiate reception
         //
         DEBUG_OUT("  EP_OUT %d %d %d %u\n", rhport, ep_addr, result, (unsigned)xferred_bytes);
-        if ( !recv_validate_datagram( ncm_interface.recv_tinyusb_ntb, xferred_bytes)) {
-            // verification failed: ignore NTB and return it to free
-            ERROR_OUT("(EE) VALIDATION FAILED. WHAT CAN WE DO IN THIS CASE?\n");
+        const char *err = ncm_recv_done(&ncm_recv, xferred_bytes);
+        if (err != NULL) {
+            // verification failed: NTB is ignored and returned to free
+            ERROR_OUT("(EE) NTB validation failed: %s (%u)\n", err, (unsigned)xferred_bytes);
+            stats_inc(STATS_NCM_NTB_RECV_INVALID);
         }
         else {
-            // packet ok -> put it into ready list
-            recv_put_ntb_into_ready_list(ncm_interface.recv_tinyusb_ntb);
+            stats_inc(STATS_NCM_NTB_RECV);
         }
-        ncm_interface.recv_tinyusb_ntb = NULL;
         tud_network_recv_renew_r(rhport);
     }
     else if (ep_addr == ncm_interface.ep_in) {
@@ -950,11 +760,15 @@ bool netd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_
         // - if there is another transmit NTB waiting, try to start transmission
         //
         DEBUG_OUT("  EP_IN %d %u\n", ncm_interface.itf_data_alt, (unsigned)xferred_bytes);
+        if (ncm_interface.xmit_tinyusb_ntb != NULL) {
+            stats_inc(STATS_NCM_NTB_XMIT);               // ZLPs are not counted
+        }
         xmit_put_ntb_into_free_list(ncm_interface.xmit_tinyusb_ntb);
         ncm_interface.xmit_tinyusb_ntb = NULL;
         if ( !xmit_insert_required_zlp(rhport, xferred_bytes)) {
             xmit_start_if_possible(rhport);
         }
+        tud_network_xmit_ready_cb();
     }
     else if (ep_addr == ncm_interface.ep_notif) {
         //
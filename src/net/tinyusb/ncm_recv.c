@@ -0,0 +1,378 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Receive side of the NCM driver without TinyUSB: NTB validation and the way of the receive NTBs
+ * from reception to the glue logic and back (see ncm_recv_t).
+ *
+ * Datagrams are handed to the glue logic as references into their NTB, so several datagrams of an NTB may
+ * be in flight.  An NTB is reused after all its datagrams have been released.  Reference counts survive
+ * ncm_recv_init(), because lwIP may still hold datagrams after a USB reset.
+ *
+ * No TinyUSB or lwIP calls here, so this is covered by the host tests.
+ */
+
+#include <string.h>
+
+#include "ncm_recv.h"
+
+
+// NTB layout (16 bit NTB, little endian)
+#define NTH16_SIZE              12
+#define NTH16_SIGNATURE         0x484D434E
+#define NDP16_SIZE              8
+#define NDP16_SIGNATURE_NCM0    0x304D434E
+#define NDP16_SIGNATURE_NCM1    0x314D434E
+#define NDP16_DATAGRAM_SIZE     4
+#define NTB_MIN_SIZE            (NTH16_SIZE + NDP16_SIZE + 2 * NDP16_DATAGRAM_SIZE)
+
+
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}   // get_u16
+
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}   // get_u32
+
+
+
+static uint8_t *ntb_ptr(const ncm_recv_t *r, int ntb)
+{
+    return r->ntb_base + (uint32_t)ntb * r->ntb_size;
+}   // ntb_ptr
+
+
+
+const char *ncm_recv_validate(const uint8_t *ntb, uint32_t len, uint32_t max_size)
+/**
+ * Validate a received NTB.
+ *
+ * \return NULL if valid, otherwise the reason
+ *
+ * \note
+ *    only one NDP per NTB is supported (wNextNdpIndex == 0)
+ */
+{
+    uint32_t ndp;
+    uint32_t ndp_len;
+    uint32_t max_ndx;
+
+    //
+    // check header
+    //
+    if (len < NTB_MIN_SIZE) {
+        return "NTB too short";
+    }
+    if (get_u16(ntb + 4) != NTH16_SIZE) {
+        return "ill NTH16 length";
+    }
+    if (get_u32(ntb + 0) != NTH16_SIGNATURE) {
+        return "ill NTH16 signature";
+    }
+    if (get_u16(ntb + 8) > len  ||  get_u16(ntb + 8) > max_size) {
+        return "ill block length";
+    }
+    ndp = get_u16(ntb + 10);
+    if (ndp < NTH16_SIZE  ||  ndp > len - (NDP16_SIZE + 2 * NDP16_DATAGRAM_SIZE)) {
+        return "ill position of NDP16";
+    }
+
+    //
+    // check (first) NDP16
+    //
+    ndp_len = get_u16(ntb + ndp + 4);
+    if (ndp_len < NDP16_SIZE + 2 * NDP16_DATAGRAM_SIZE  ||  ndp + ndp_len > len) {
+        return "ill NDP16 length";
+    }
+    if (get_u32(ntb + ndp) != NDP16_SIGNATURE_NCM0  &&  get_u32(ntb + ndp) != NDP16_SIGNATURE_NCM1) {
+        return "ill NDP16 signature";
+    }
+    if (get_u16(ntb + ndp + 6) != 0) {
+        return "wNextNdpIndex != 0 not supported";
+    }
+
+    max_ndx = (ndp_len - NDP16_SIZE) / NDP16_DATAGRAM_SIZE;
+    if (get_u32(ntb + ndp + NDP16_SIZE + (max_ndx - 1) * NDP16_DATAGRAM_SIZE) != 0) {
+        return "NDP16 not terminated";
+    }
+
+    for (uint32_t ndx = 0;  ;  ++ndx) {
+        const uint8_t *datagram = ntb + ndp + NDP16_SIZE + ndx * NDP16_DATAGRAM_SIZE;
+        uint32_t index  = get_u16(datagram + 0);
+        uint32_t length = get_u16(datagram + 2);
+
+        if (index == 0  ||  length == 0) {
+            break;
+        }
+        if (index > len  ||  index + length > len) {
+            return "datagram outside of NTB";
+        }
+    }
+
+    // -> ntb contains a valid packet structure
+    //    ok... I did not check for garbage within the datagram indices...
+    return NULL;
+}   // ncm_recv_validate
+
+
+
+bool ncm_recv_datagram(const uint8_t *ntb, uint16_t ndx, uint16_t *index, uint16_t *length)
+/**
+ * Get position of datagram \a ndx of a validated NTB.
+ *
+ * \return false if there is no such datagram
+ */
+{
+    const uint8_t *datagram = ntb + get_u16(ntb + 10) + NDP16_SIZE + ndx * NDP16_DATAGRAM_SIZE;
+
+    *index  = get_u16(datagram + 0);
+    *length = get_u16(datagram + 2);
+    return *index != 0  &&  *length != 0;
+}   // ncm_recv_datagram
+
+
+
+static void put_into_free_list(ncm_recv_t *r, int ntb)
+{
+    if (r->free_mask & (1U << ntb)) {
+        ++r->errors;                                   // must not happen: NTB released twice
+    }
+    r->free_mask |= (1U << ntb);
+}   // put_into_free_list
+
+
+
+static void release_if_unused(ncm_recv_t *r, int ntb)
+/**
+ * Put \a ntb into the free list if all its datagrams have been handed to the glue logic and
+ * the glue logic has released all of them.
+ */
+{
+    if (ntb != r->glue_ntb  &&  ntb != r->usb_ntb  &&  r->ref_cnt[ntb] == 0) {
+        put_into_free_list(r, ntb);
+    }
+}   // release_if_unused
+
+
+
+static bool zero_copy_possible(const ncm_recv_t *r, int ntb)
+/**
+ * Datagrams of \a ntb are handed to the glue logic without copy only if another NTB stays available
+ * for reception.  Otherwise datagrams kept by lwIP (e.g. in the send queue of the echo server which
+ * is waiting for ACKs) could block reception completely.
+ */
+{
+    uint32_t pinned = 0;
+
+    for (uint32_t i = 0;  i < r->ntb_n;  ++i) {
+        if ((int)i != ntb  &&  r->ref_cnt[i] != 0) {
+            ++pinned;
+        }
+    }
+    return pinned + 1 < r->ntb_n;
+}   // zero_copy_possible
+
+
+
+void ncm_recv_init(ncm_recv_t *r, uint8_t *ntb_base, uint32_t ntb_size, uint32_t ntb_n,
+                   ncm_recv_ref_cb_t ref_cb, ncm_recv_copy_cb_t copy_cb, void *ctx)
+/**
+ * (Re)initialize the receive side, i.e. a running reception and NTBs not yet handed to the glue logic
+ * are dropped.  NTBs with datagrams still in use by the glue logic are freed by the final ncm_recv_release().
+ *
+ * \pre \a r must be zeroed before the first call
+ */
+{
+    r->ntb_base  = ntb_base;
+    r->ntb_size  = ntb_size;
+    r->ntb_n     = (ntb_n <= NCM_RECV_NTB_MAX) ? ntb_n : NCM_RECV_NTB_MAX;
+    r->ref_cb    = ref_cb;
+    r->copy_cb   = copy_cb;
+    r->ctx       = ctx;
+
+    r->ready_n   = 0;
+    r->usb_ntb   = -1;
+    r->glue_ntb  = -1;
+    r->glue_datagram_ndx = 0;
+    r->glue_zero_copy    = false;
+
+    r->free_mask = 0;
+    for (uint32_t i = 0;  i < r->ntb_n;  ++i) {
+        if (r->ref_cnt[i] == 0) {
+            r->free_mask |= (1U << i);
+        }
+    }
+}   // ncm_recv_init
+
+
+
+uint8_t *ncm_recv_start(ncm_recv_t *r)
+/**
+ * Get an NTB for the next reception.
+ *
+ * \return buffer for the NTB or NULL if a reception is already running or all NTBs are in use
+ */
+{
+    int ntb;
+
+    if (r->usb_ntb >= 0  ||  r->free_mask == 0) {
+        return NULL;
+    }
+    ntb = __builtin_ctz(r->free_mask);
+    r->free_mask &= ~(1U << ntb);
+    r->usb_ntb = (int8_t)ntb;
+    return ntb_ptr(r, ntb);
+}   // ncm_recv_start
+
+
+
+void ncm_recv_cancel(ncm_recv_t *r)
+/**
+ * The reception could not be started, give back its NTB.
+ */
+{
+    if (r->usb_ntb >= 0) {
+        int ntb = r->usb_ntb;
+
+        r->usb_ntb = -1;
+        put_into_free_list(r, ntb);
+    }
+}   // ncm_recv_cancel
+
+
+
+const char *ncm_recv_done(ncm_recv_t *r, uint32_t len)
+/**
+ * Reception of \a len bytes has finished.  A valid NTB is queued for the glue logic, an invalid one is freed.
+ *
+ * \return NULL if the NTB is valid, otherwise the reason
+ */
+{
+    const char *err;
+    int ntb = r->usb_ntb;
+
+    if (ntb < 0) {
+        ++r->errors;
+        return "no reception running";
+    }
+    r->usb_ntb = -1;
+
+    err = ncm_recv_validate(ntb_ptr(r, ntb), len, r->ntb_size);
+    if (err != NULL) {
+        put_into_free_list(r, ntb);
+    }
+    else {
+        r->ready[r->ready_n++] = (int8_t)ntb;
+    }
+    return err;
+}   // ncm_recv_done
+
+
+
+void ncm_recv_deliver(ncm_recv_t *r)
+/**
+ * Hand all pending datagrams to the glue logic and free NTBs which are no longer in use.
+ * Delivery stops if the glue logic does not accept a datagram, call again after the next
+ * ncm_recv_release() or reception.
+ */
+{
+    for (;;) {
+        uint16_t index;
+        uint16_t length;
+        uint8_t *data;
+        int ntb;
+
+        if (r->glue_ntb < 0) {
+            if (r->ready_n == 0) {
+                break;
+            }
+            r->glue_ntb = r->ready[0];
+            memmove(r->ready, r->ready + 1, --r->ready_n);
+            r->glue_datagram_ndx = 0;
+            r->glue_zero_copy = zero_copy_possible(r, r->glue_ntb);
+        }
+
+        ntb  = r->glue_ntb;
+        data = ntb_ptr(r, ntb);
+        if ( !ncm_recv_datagram(data, r->glue_datagram_ndx, &index, &length)) {
+            // end of datagrams reached
+            r->glue_ntb = -1;
+            release_if_unused(r, ntb);
+            continue;
+        }
+
+        if (r->glue_zero_copy) {
+            if (r->ref_cnt[ntb] == UINT8_MAX) {
+                // more datagrams in flight than the counter can hold, wait for releases
+                break;
+            }
+            ++r->ref_cnt[ntb];
+            if ( !r->ref_cb(r->ctx, data + index, length, data)) {
+                --r->ref_cnt[ntb];
+                break;
+            }
+        }
+        else {
+            if ( !r->copy_cb(r->ctx, data + index, length)) {
+                break;
+            }
+        }
+        ++r->glue_datagram_ndx;
+    }
+}   // ncm_recv_deliver
+
+
+
+bool ncm_recv_release(ncm_recv_t *r, void *ref)
+/**
+ * The glue logic has finished with a datagram handed over by the ref callback.
+ * If this was the last datagram in use of its NTB, the NTB is reused for reception.
+ *
+ * \return false if \a ref is unknown (counted in \a errors)
+ */
+{
+    uintptr_t offs = (uintptr_t)ref - (uintptr_t)r->ntb_base;
+    uint32_t ntb;
+
+    if ((uint8_t *)ref < r->ntb_base  ||  offs % r->ntb_size != 0  ||  offs / r->ntb_size >= r->ntb_n) {
+        ++r->errors;
+        return false;
+    }
+    ntb = (uint32_t)(offs / r->ntb_size);
+    if (r->ref_cnt[ntb] == 0) {
+        ++r->errors;
+        return false;
+    }
+
+    --r->ref_cnt[ntb];
+    release_if_unused(r, (int)ntb);
+    return true;
+}   // ncm_recv_release
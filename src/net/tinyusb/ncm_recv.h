@@ -0,0 +1,88 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _NCM_RECV_H
+#define _NCM_RECV_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+#define NCM_RECV_NTB_MAX            8            // upper limit of receive NTBs
+
+/// hand a datagram to the glue logic without copy, \a ref has to be given back with ncm_recv_release()
+typedef bool (*ncm_recv_ref_cb_t)(void *ctx, const uint8_t *src, uint16_t size, void *ref);
+
+/// hand a copy of a datagram to the glue logic
+typedef bool (*ncm_recv_copy_cb_t)(void *ctx, const uint8_t *src, uint16_t size);
+
+/**
+ * Bookkeeping of the NCM receive NTBs: free -> reception by TinyUSB -> ready (validated) -> datagrams
+ * handed to the glue logic -> free after the glue logic has released all datagrams of the NTB.
+ * NTBs are identified by their index.
+ */
+typedef struct {
+    uint8_t              *ntb_base;               // receive NTBs, \a ntb_size apart
+    uint32_t              ntb_size;
+    uint32_t              ntb_n;                  // number of NTBs, <= NCM_RECV_NTB_MAX
+    ncm_recv_ref_cb_t     ref_cb;
+    ncm_recv_copy_cb_t    copy_cb;
+    void                 *ctx;
+
+    uint32_t              free_mask;              // NTBs available for reception
+    int8_t                ready[NCM_RECV_NTB_MAX];   // validated NTBs, oldest first
+    uint8_t               ready_n;
+    int8_t                usb_ntb;                // NTB of the running reception, -1 -> none
+    int8_t                glue_ntb;               // NTB whose datagrams are handed to the glue logic, -1 -> none
+    uint16_t              glue_datagram_ndx;      // next datagram of \a glue_ntb
+    bool                  glue_zero_copy;         // datagrams of \a glue_ntb are handed over without copy
+    uint8_t               ref_cnt[NCM_RECV_NTB_MAX];   // datagrams per NTB still in use by the glue logic
+    uint32_t              errors;                 // unknown references and other things which must not happen
+} ncm_recv_t;
+
+
+void        ncm_recv_init(ncm_recv_t *r, uint8_t *ntb_base, uint32_t ntb_size, uint32_t ntb_n,
+                          ncm_recv_ref_cb_t ref_cb, ncm_recv_copy_cb_t copy_cb, void *ctx);
+uint8_t    *ncm_recv_start(ncm_recv_t *r);
+void        ncm_recv_cancel(ncm_recv_t *r);
+const char *ncm_recv_done(ncm_recv_t *r, uint32_t len);
+void        ncm_recv_deliver(ncm_recv_t *r);
+bool        ncm_recv_release(ncm_recv_t *r, void *ref);
+
+const char *ncm_recv_validate(const uint8_t *ntb, uint32_t len, uint32_t max_size);
+bool        ncm_recv_datagram(const uint8_t *ntb, uint16_t ndx, uint16_t *index, uint16_t *length);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
@@ -62,6 +62,9 @@ typedef enum
 // indicate to network driver that client has finished with the packet provided to network_recv_cb()
 void tud_network_recv_renew(void);
 
+// NCM only: indicate to network driver that client has finished with the datagram provided to network_recv_ref_cb()
+void tud_network_recv_release(void *ref);
+
 // poll network driver for its ability to accept another packet to transmit
 bool tud_network_can_xmit(uint16_t size);
 
@@ -75,9 +78,16 @@ void tud_network_xmit(void *ref, uint16_t arg);
 // client must provide this: return false if the packet buffer was not accepted
 bool tud_network_recv_cb(const uint8_t *src, uint16_t size);
 
+// NCM only: client must provide this: datagram is passed without copy and stays valid until
+// network_recv_release(ref) is called; return false if the datagram was not accepted
+bool tud_network_recv_ref_cb(const uint8_t *src, uint16_t size, void *ref);
+
 // client must provide this: copy from network stack packet pointer to dst
 uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg);
 
+// NCM only: client must provide this: driver has transmitted an NTB, network_can_xmit() might be true again
+void tud_network_xmit_ready_cb(void);
+
 //------------- ECM/RNDIS -------------//
 
 // client must provide this: initialize any network state back to the beginning
@@ -39,7 +39,11 @@
 
 #include "picoprobe_config.h"
 #include "sigrok_int.h"
+#include "sigrok_cmd.h"
 #include "cdc_sigrok.h"
+#if OPT_NET_SIGROK_SERVER
+    #include "net/net_sigrok.h"
+#endif
 
 
 
@@ -80,6 +84,10 @@ void cdc_sigrok_line_state_cb(bool dtr, bool rts)
 
 
 void cdc_sigrok_write(const char *buf, int length)
+/**
+ * Send data to the host.  If a TCP client is connected, data goes directly into its connection,
+ * otherwise into the stream to the sigrok CDC.
+ */
 {
 #if 0
     int i;
@@ -106,201 +114,26 @@ void cdc_sigrok_write(const char *buf, int length)
     }
 #endif
 
+#if OPT_NET_SIGROK_SERVER
+    if (net_sigrok_is_connected()) {
+        net_sigrok_write(buf, length);
+        return;
+    }
+#endif
+
     xStreamBufferSend(stream_sigrok, buf, length, portMAX_DELAY);
     xEventGroupSetBits(events, EV_STREAM);
 }   // cdc_sigrok_write
 
 
 
-//Process incoming character stream
-//Return true if the device rspstr has a response to send to host
-//Be sure that rspstr does not have \n  or \r.
-static bool process_char(sr_device_t *d, char charin)
+void cdc_sigrok_host_rx(const uint8_t *buf, uint32_t cnt)
+/**
+ * Feed characters from the host (CDC or TCP) into the command parser.
+ */
 {
-    int tmpint, tmpint2;
-    bool ret = false;
-
-    //set default rspstr for all commands that have a dataless ack
-    d->rspstr[0] = '*';
-    d->rspstr[1] = '\0';
-
-    //the reset character works by itself
-    if (charin == '*') {
-        sigrok_reset(d);
-        Dprintf("sigrok cmd '*' -> RESET %d\n", d->sample_and_send);
-        return false;
-    }
-    else if (charin == '\r'  ||  charin == '\n') {
-        d->cmdstr[d->cmdstr_ndx] = 0;
-        switch (d->cmdstr[0]) {
-            case 'i':
-                // identification
-                // SRPICO,AxxyDzz,02 - num analog, analog size, num digital,version
-                sprintf(d->rspstr, "SRPICO,A%02d1D%02d,02", SR_NUM_A_CHAN, SR_NUM_D_CHAN);
-                ret = true;
-                break;
-
-            case 'R':
-                // sampling rate
-                extern uint32_t probe_get_cpu_freq_khz(void);
-
-                tmpint = atol(&(d->cmdstr[1]));
-                if (tmpint >= 5000  &&  tmpint <= 1000 * probe_get_cpu_freq_khz() + 16) { //Add 16 to support cfg_bits
-                    d->sample_rate = tmpint;
-//                    Dprintf("SMPRATE= %lu\n", d->sample_rate);
-                    ret = true;
-                }
-                else {
-//                    Dprintf("unsupported smp rate %s\n", d->cmdstr);
-                    ret = false;
-                }
-                break;
-
-            case 'L':
-                // sample limit
-                tmpint = atol(&(d->cmdstr[1]));
-                if (tmpint > 0) {
-                    d->num_samples = tmpint;
-//                    Dprintf("NUMSMP=%lu\n", d->num_samples);
-                    ret = true;
-                }
-                else {
-//                    Dprintf("bad num samples %s\n", d->cmdstr);
-                    ret = false;
-                }
-                break;
-
-            case 'a':
-                // get analog scale
-                tmpint = atoi(&(d->cmdstr[1])); //extract channel number
-                if (tmpint >= 0) {
-                    //scale and offset are both in integer uVolts
-                    //separated by x
-                    sprintf(d->rspstr, "25700x0");  //3.3/(2^7) and 0V offset
-//                    Dprintf("ASCL%d\n", tmpint);
-                    ret = true;
-                }
-                else {
-//                    Dprintf("bad ascale %s\n", d->cmdstr);
-                    ret = false; //this will return a '*' causing the host to fail
-                }
-                break;
-
-            case 'F':
-                // fixed set of samples
-//                Dprintf("STRT_FIX\n");
-                d->continuous = false;
-                sigrok_tx_init(d);
-                ret = false;
-                break;
-
-            case 'C':
-                // continuous mode
-//                Dprintf("STRT_CONT\n");
-                d->continuous = true;
-                sigrok_tx_init(d);
-                ret = false;
-                break;
-
-            case 't':
-                // trigger -format tvxx where v is value and xx is two digit channel
-                /* HW trigger deprecated */
-                ret = true;
-                break;
-
-            case 'p':
-                // pretrigger count, this is a nop
-                tmpint = atoi(&(d->cmdstr[1]));
-//                Dprintf("Pre-trigger samples %d cmd %s\n", tmpint, d->cmdstr);
-                ret = true;
-                break;
-
-            case 'A':
-                // enable analog channel always a set
-                // format is Axyy where x is 0 for disabled, 1 for enabled and yy is channel #
-                tmpint = d->cmdstr[1] - '0'; //extract enable value
-                tmpint2 = atoi(&(d->cmdstr[2])); //extract channel number
-                if (tmpint >= 0  &&  tmpint <= 1  &&  tmpint2 >= 0  &&  tmpint2 <= 31) {  // TODO 31 is max bits
-                    d->a_mask = d->a_mask & ~(1 << tmpint2);
-                    d->a_mask = d->a_mask | (tmpint << tmpint2);
-//                    Dprintf("A%d EN %d Msk 0x%lX\n", tmpint2, tmpint, d->a_mask);
-                    ret = true;
-                }
-                else {
-                    ret = false;
-                }
-                break;
-
-            case 'D':
-                // enable digital channel always a set
-                // format is Dxyy where x is 0 for disabled, 1 for enabled and yy is channel #
-                tmpint = d->cmdstr[1] - '0'; //extract enable value
-                tmpint2 = atoi(&(d->cmdstr[2])); //extract channel number
-                if (tmpint >= 0  &&  tmpint <= 1  &&  tmpint2 >= 0  &&  tmpint2 < SR_NUM_D_CHAN) {
-                    d->d_mask = d->d_mask & ~(1 << tmpint2);
-                    d->d_mask = d->d_mask | (tmpint << tmpint2);
-
-                    d->d_mask_D4 = 0;
-                    for (int i = 0;  i < 8;  ++i) {
-                        d->d_mask_D4 |= (d->d_mask & 0x0f) << (4 * i);
-                    }
-//                    Dprintf("D%d EN %d Msk 0x%lX 0x%lX\n", tmpint2, tmpint, d->d_mask, d->d_mask_D4);
-                    ret = true;
-                }
-                else {
-                    ret = false;
-                }
-                break;
-
-            case 'N':
-                // return channel name
-                // format is N[AD]yy, A=analog, D=digital, yy is channel #
-                ret = false;
-                if (d->cmdstr_ndx >= 4) {
-                    tmpint = atoi(d->cmdstr + 2);
-                    if (d->cmdstr[1] == 'A'  &&  tmpint >= 0  &&  tmpint < SR_NUM_A_CHAN) {
-                        sprintf(d->rspstr, "ADC%d", tmpint);
-                        ret = true;
-                    }
-                    else if (d->cmdstr[1] == 'D'  &&  tmpint >= 0  &&  tmpint < SR_NUM_D_CHAN) {
-                        sprintf(d->rspstr, "GP%d", tmpint + SR_BASE_D_CHAN);
-                        ret = true;
-                    }
-                }
-                else if (d->cmdstr[1] == '?') {
-                    strcpy(d->rspstr, "ok");
-                    ret = true;
-                }
-                break;
-
-            default:
-                Dprintf("bad command %s\n", d->cmdstr);
-                ret = false;
-                break;
-        }
-
-        if (ret) {
-            Dprintf("sigrok cmd '%s' -> '%s' [OK]\n", d->cmdstr, d->rspstr);
-        }
-        else {
-            Dprintf("sigrok cmd '%s' -> '%s'\n", d->cmdstr, d->rspstr);
-        }
-
-        d->cmdstr_ndx = 0;
-    }
-    else {
-        //no CR/LF
-        if (d->cmdstr_ndx >= sizeof(d->cmdstr) - 1) {
-            d->cmdstr[sizeof(d->cmdstr) - 2] = 0;
-            Dprintf("Command overflow %s\n", d->cmdstr);
-            d->cmdstr_ndx = 0;
-        }
-        d->cmdstr[d->cmdstr_ndx++] = charin;
-        ret = false;
-    }
-    //default return 0 means to not send any kind of response
-    return ret;
-}   // process_char
+    sigrok_cmd_rx(&sr_dev, buf, cnt);
+}   // cdc_sigrok_host_rx
 
 
 
@@ -356,20 +189,7 @@ void cdc_sigrok_thread()
                 if (n == 0) {
                     break;
                 }
-
-                // The '+' is the only character we track during normal sampling because it can end
-                // a continuous trace.  A reset '*' should only be seen after we have completed normally
-                // or hit an error condition.
-                if (ch == '+') {
-                    sr_dev.sample_and_send = false;
-                    sr_dev.aborted         = false;        // clear the abort so we stop sending !!
-                }
-                else {
-                    if (process_char(&sr_dev, (char)ch)) {
-                        sr_dev.send_resp = true;
-                    }
-                }
-                sigrok_notify();
+                cdc_sigrok_host_rx(&ch, 1);
             }
         }
 
@@ -38,6 +38,7 @@
 #if OPT_SIGROK
     void cdc_sigrok_init(uint32_t task_prio);
     void cdc_sigrok_write(const char *buf, int length);
+    void cdc_sigrok_host_rx(const uint8_t *buf, uint32_t cnt);
     void cdc_sigrok_rx_cb(void);
     void cdc_sigrok_tx_complete_cb(void);
     void cdc_sigrok_line_state_cb(bool dtr, bool rts);
@@ -16,6 +16,7 @@
 #include "hardware/dma.h"
 #include "hardware/structs/bus_ctrl.h"
 #include "hardware/clocks.h"
+#include "hardware/sync.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -23,34 +24,41 @@
 
 #include "picoprobe_config.h"
 #include "led.h"
+#include "stats_counter.h"
 #include "sigrok_int.h"
+#include "sigrok_encode.h"
 #include "cdc_sigrok.h"
 #include "sigrok.h"
+#if OPT_EVENT_STREAM
+    #include "event_stream.h"
+#endif
+#if OPT_NET_SIGROK_SERVER
+    #include "net/net_sigrok.h"
+#endif
 #include "sigrok.pio.h"
 
 
 //NODMA is a debug mode that disables the DMA engine and prints raw PIO FIFO outputs
 //it is limited to testing a small number of samples equal to the PIO FIFO depths
 //#define NODMA 1
-//These two enable debug print outs of D4 generation, D4_DBG2 are consider higher verbosity
-//#define D4_DBG 1
-//#define D4_DBG2 2
 
 
-//The size of the buffer sent to the CDC serial
-//The TUD CDC buffer is only 256B so it doesn't help to have more than this.
-#define TX_BUF_SIZE 260
+//Number of DMA segments the capture buffer is split into for continuous or large captures.
+//Capture continues as long as encoding is no more than SR_DMA_SEGMENTS-2 segments behind.
+#ifndef SR_DMA_SEGMENTS
+    #define SR_DMA_SEGMENTS 4
+#endif
+
+//Part of the capture buffer used for the DMA segments in buffered mode ('B'), the remainder stores the encoded data
+#ifndef SR_DEEP_RING_SIZE
+    #define SR_DEEP_RING_SIZE (SR_DMA_BUF_SIZE / 4)
+#endif
+
+//Chunk size for the upload of the stored data after a buffered capture
+#define DEEP_UPLOAD_CHUNK 1024
 
-//This sets the point which we will send data from the txbuf to the usb cdc.
-//For the 5-21 channel RLE it must leave a spare ~83 entries to cover the case where
-//a new long steady input comes after deciding to not send a sample.
-//(Assuming 128KB samples per half, a max rle value of 1568 we can get
-//  256*1024/2/1568=83 max length rles on a steady input).
-//Other than that the value is not very specific because the usb tub code
-//implement a 256 entry FIFO that queues things up and sends max length 64B transactions
-//20 is arbitrarily picked to ensure that if we have even a little we send it so that
-//at least something goes across the link.
-#define TX_BUF_THRESH 64
+//PIO cycles per sample of the auto trigger programs, see sigrok.pio.  Faster fixed captures are done as burst.
+#define SR_PIO_TRIGGER_DELAY 7
 
 
 /// calculate DMA channel number from address
@@ -72,609 +80,317 @@ sr_device_t sr_dev;
 /// capture buffer, DMA writes into it
 __attribute__ ((aligned(4))) uint8_t capture_buf[SR_DMA_BUF_SIZE];    // 4byte aligned
 
-/// transmit buffer to USB
-uint8_t  txbuf[TX_BUF_SIZE];
+/// mask of used DMA channels (for interrupts handling)
+uint32_t dma_mask;
 
-/// index into \a txbuf
-uint16_t txbufidx;
+/// pointer to DMA status register for A0/A1, D0/D1
+volatile uint32_t *tstsa[2], *tstsd[2];
 
-/// read index into \a capture_buf
-uint32_t rxbufdidx;
+/// pointer to DMA write register for A0/A1, D0/D1
+volatile uint32_t *taddra[2], *taddrd[2];
 
-/// counter for RLE encoding
-uint32_t rlecnt;
+/// disable detection of overflow condition if the number of samples fit into the capture buffer
+bool mask_xfer_err;
 
-/// count of characters sent via USB
-uint32_t sent_cnt;
+//
+// Segment handoff between capture (sigrok_thread) and encoder (sigrok_encoder_thread).
+// Counters are free running, the buffer segment is "counter % sr_dev.seg_cnt", segment n is written
+// by the DMA channels A(n & 1)/D(n & 1).  seg_done is written by capture only, seg_encoded by the
+// encoder only, so the handoff does not need any locking.
+// While waiting for a trigger, segments are scanned but held back as pre-trigger history, so
+// seg_encoded may lag behind seg_scanned.
+//
+/// segments completely written by DMA and ready for encoding
+static volatile uint32_t seg_done;
 
-/// Number of bytes stored as DMA per slice, must be 1,2 or 4 to support aligned access
-/// This will be be zero for 1-4 digital channels.
-uint8_t d_dma_bps;
+/// segments encoded and transmitted (or dropped as too old for pre-trigger), the buffer space can be reused by DMA
+static volatile uint32_t seg_encoded;
 
-/// remaining samples in this half, conunts down from sr_dev::samples_per_half
-uint32_t samp_remain;
+/// segments handed to DMA (capture only)
+static uint32_t seg_armed;
 
-// last and current digital sample values - required for RLE encoding
-uint32_t lval, cval;
+/// segments required for the capture, UINT32_MAX in continuous mode or until the trigger fires.
+/// Set by capture at start and by the encoder when the trigger fires.
+static volatile uint32_t seg_needed;
 
-/// track the number of halves we have processed
-uint32_t num_halves;
+/// segments processed by the encoder, either trigger scanned or encoded (encoder only)
+static uint32_t seg_scanned;
 
-/// mask of used DMA channels (for interrupts handling)
-uint32_t dma_mask;
+/// first sample to encode in segment \a seg_scanned, non-zero only after the trigger has fired (encoder only)
+static uint32_t seg_first;
 
-/// pointer to DMA status register for A0/A1, D0/D1
-volatile uint32_t *tstsa0, *tstsa1, *tstsd0, *tstsd1;
+/// trigger is armed and has not yet fired
+static volatile bool trig_armed;
 
-/// pointer to DMA write register for A0/A1, D0/D1
-volatile uint32_t *taddra0, *taddra1, *taddrd0, *taddrd1;
+/// burst capture: fixed capture at a rate too high for the auto trigger which fits into the capture buffer.
+/// DMA runs without CPU intervention and stops the PIO at the end, encoding starts after capture.
+static volatile bool burst;
 
-/// are we processing the upper or lower half of the data buffers
-bool lowerhalf;
+/// mask written by the stop DMA channel into the PIO CTRL clear alias at the end of a burst
+static uint32_t burst_stop_mask;
 
-/// disable detection of overflow condition if the number of samples fit into the capture buffer
-bool mask_xfer_err;
+/// buffered mode: offset and size of the store for encoded data in \a capture_buf, behind the DMA segments
+static uint32_t deep_start, deep_size;
+
+/// buffered mode: bytes in the store (written by the encoder, read by capture after the encoder has stopped)
+static volatile uint32_t deep_len;
+
+/// protocol decoder replaces the encoders for this capture
+static volatile bool decoding;
+
+/// time_us_64() at capture start, base of the decoder frame timestamps
+static uint64_t capture_start_us;
+
+/// encoder is working on segments
+static volatile bool encoder_busy;
+
+/// encoding time and sample count of the current capture (encoder only)
+static uint32_t enc_time_us, enc_samples;
 
 /// handle for sigrok_thread()
 static TaskHandle_t task_sigrok;
 
+/// handle for sigrok_encoder_thread()
+static TaskHandle_t task_sigrok_enc;
+
 
 #define EV_CMD_RECEIVED       0x01
 #define EV_DMA_SIGNAL         0x02
+#define EV_SEG_DONE           0x04                 // capture -> encoder
+#define EV_SEG_ENCODED        0x08                 // encoder -> capture
 
 /// event flags
 static EventGroupHandle_t events;
 
 
 
-//This is an optimized transmit of trace data for configurations with 4 or fewer digital channels
-//and no analog.  Run length encoding (RLE) is used to send counts of repeated values to efficiently utilize
-//USB CDC link bandwidth.  This is the only mode where a given serial byte can have both sample information
-//and RLE counts.
-//Samples from PIO are dma'd in 32 bit words, each containing 8 samples of 4 bits (1 nibble).
-//RLE Encoding:
-//Values 0x80-0xFF encode an rle cnt of a previous value with a new value:
-//  Bit 7 is 1 to distinguish from the rle only values.
-//  Bits 6:4 indicate a run length up to 7 cycles of the previous value
-//  Bits 3:0 are the new value.
-//For longer runs, an RLE only encoding uses decimal values 48 to 127 (0x30 to 0x7F)
-//as x8 run length values of 8..640.
-//All other ASCII values (except from the abort and the end of run byte_cnt) are reserved.
-static void __TIME_CRITICAL_FUNCTION(send_slices_D4)(sr_device_t *d, uint8_t *dbuf)
+/**
+ * Output of the encoders.  Data goes to the host or, in buffered mode, into the store.
+ * If the store is full, capture is stopped and handled like an overflow.  Stored data is sent
+ * by deep_upload() after capture.
+ */
+void __TIME_CRITICAL_FUNCTION(sigrok_tx_write)(const uint8_t *buf, uint32_t cnt)
 {
-    uint8_t nibcurr,niblast;
-    uint32_t cword,lword; //current and last word
-    uint32_t *cptr;
-
-    txbufidx = 0;
-    //Don't optimize the first word (eight samples) perfectly, just send them to make the for loop easier,
-    //and setup the initial conditions for rle tracking
-    cptr = (uint32_t *)&(dbuf[0]);
-    cword = *cptr & d->d_mask_D4;
-#ifdef D4_DBG
-    Dprintf("Dbuf %p cptr %p data 0x%X\n",(void *)&(dbuf[0]),(void *) cptr,cword);
-#endif
-    lword = cword;
-    for (int j = 0;  j < 8;  j++) {
-        nibcurr = cword & 0x0f;
-        txbuf[j] = nibcurr | 0x80;
-        cword >>= 4;
-    }
-    niblast = nibcurr;
-    cptr = (uint32_t *)&(txbuf[0]);
-    txbufidx = 8;
-    rxbufdidx = 4;
-    rlecnt = 0;
-
-    if (d->samples_per_half <= 8) {
-        cdc_sigrok_write((char *)txbuf, txbufidx);
-        d->scnt += d->samples_per_half;
-        return;
-    }
-    //chngcnt=8;
-    //The total number of 4 bit samples remaining to process from this half.
-    //Subtract 8 because we processed the word above.
-    samp_remain = d->samples_per_half - 8;
-
-    //If in fixed sample (non-continous mode) only send the amount of samples requested
-    if ( !d->continuous  &&  d->scnt + samp_remain > d->num_samples) {
-        samp_remain = d->num_samples - d->scnt;
-        d->scnt += samp_remain;
-    }
-    else {
-        d->scnt += d->samples_per_half;
-    }
-    //Process one  word (8 samples) at a time.
-    for (int i = 0;  i < (samp_remain >> 3);  i++) {
-        cptr = (uint32_t *)&(dbuf[rxbufdidx]);
-        cword = *cptr & d->d_mask_D4;
-        rxbufdidx += 4;
-#ifdef D4_DBG2
-        Dprintf("dbuf0 %p dbufr %p cptr %p\n",dbuf,&(dbuf[rxbufdidx]),cptr);
-#endif
-        //Send maximal RLE counts in this outer section to the txbuf, and if we accumulate a few of them
-        //push to the device so that we don't accumulate large numbers
-        //of unsent RLEs.  That allows the host to process them gradually rather than in a flood
-        //when we get a value change.
-        while (rlecnt >= 640) {
-            txbuf[txbufidx++] = 127;
-            rlecnt -= 640;
-            if (txbufidx > 3){
-                cdc_sigrok_write((char *)txbuf, txbufidx);
-                sent_cnt += txbufidx;
-                txbufidx = 0;
-            }
-        }
-        //Coarse rle looks across the full word and allows a faster compare in cases with low activity factors
-        //We must make sure cword==lword and that all nibbles of cword are the same
-        if (cword == lword  &&  (cword >> 4) == (cword & 0x0FFFFFFF)) {
-            rlecnt += 8;
-#ifdef D4_DBG2
-            Dprintf("coarse word 0x%lX\n", cword);
-#endif
-        }
-        else {//if coarse rle didn't match
-#ifdef D4_DBG2
-            Dprintf("cword 0x%lX nibcurr 0x%X i %d rx idx %lu  rlecnt %lu\n", cword, nibcurr, i, rxbufdidx, rlecnt);
-#endif
-            lword = cword;
-            for (int j = 0;  j < 8;  j++) { //process all 8 nibbles
-                nibcurr = cword & 0x0f;
-                if (nibcurr == niblast) {
-                    rlecnt++;
-                }
-                else{
-                    //If the value changes we must push all remaining rles to the txbuf
-                    //chngcnt++;
-                    //Send intermediate 8..632 RLEs
-                    if (rlecnt > 7) {
-                        int rlemid = rlecnt & 0x3F8;
-                        txbuf[txbufidx++] = (rlemid >> 3) + 47;
-                    }
-                    //And finally the 0..7 rle along with the new value
-                    rlecnt &= 0x7;
-#ifdef D4_DBG2 //print when sample value changes
-                    Dprintf("VChang val 0x%X rlecnt %ld i%d j%d\n", nibcurr, rlecnt, i, j);
-#endif
-                    txbuf[txbufidx++] = 0x80 | nibcurr | (rlecnt << 4);
-                    rlecnt = 0;
-                }//nibcurr!=last
-                cword >>= 4;
-                niblast = nibcurr;
-            }
-        }
-#ifdef D4_DBG2
-        Dprintf("i %d rx idx %lu  rlecnt %lu\n", i, rxbufdidx, rlecnt);
-        Dprintf("i %u tx idx %d bufs 0x%X 0x%X 0x%X\n", i, txbufidx, txbuf[txbufidx-3], txbuf[txbufidx-2], txbuf[txbufidx-1]);
-#endif
-        //Emperically found that transmitting groups of around 32B gives optimum bandwidth
-        if (txbufidx >= 64) {
-            cdc_sigrok_write((char *)txbuf, txbufidx);
-            sent_cnt += txbufidx;
-            txbufidx = 0;
-        }
-    }//for i in samp_send>>3
-    //At the end of processing the half send any residual samples as we don't maintain state between the halves
-    //Maximal 640 values first
-    while (rlecnt >= 640) {
-        txbuf[txbufidx++] = 127;
-        rlecnt -= 640;
+    stats_add(STATS_SIGROK_TX_BYTES, cnt);
+    if ( !sr_dev.buffered) {
+        cdc_sigrok_write((const char *)buf, cnt);
     }
-    //Middle rles 8..632
-    if (rlecnt > 7) {
-        int rleend = rlecnt & 0x3F8;
-        txbuf[txbufidx++] = (rleend >> 3) + 47;
+    else if (deep_len + cnt <= deep_size) {
+        memcpy(capture_buf + deep_start + deep_len, buf, cnt);
+        deep_len += cnt;
     }
-    //1..7 RLE
-    //The rle and value encoding counts as both a sample count of rle and a new sample
-    //thus we must decrement rlecnt by 1 and resend the current value which will match the previous values
-    //(if the current value didn't match, the rlecnt would be 0).
-    if (rlecnt != 0) {
-        rlecnt &= 0x7;
-        rlecnt--;
-        txbuf[txbufidx++] = 0x80 | nibcurr | (rlecnt << 4);
-        rlecnt = 0;
+    else if (sr_dev.sample_and_send) {
+        Dprintf("***Abort store full*** %lu bytes, %lu samples\n", deep_len, sr_dev.scnt);
+        stats_inc(STATS_SIGROK_OVERFLOW);
+        sr_dev.aborted = true;
+        sr_dev.sample_and_send = false;
     }
-    if (txbufidx != 0) {
-        cdc_sigrok_write((char *)txbuf, txbufidx);
-        sent_cnt += txbufidx;
-        txbufidx = 0;
-    }
-}   // send_slices_D4
-
-
-
-//Send a digital sample of multiple bytes with the 7 bit encoding
-static void inline tx_d_samp(sr_device_t *d, uint32_t cval)
-{
-    for (uint32_t b = 0;  b < d->d_tx_bps;  b++) {
-        txbuf[txbufidx++] = cval | 0x80;
-        cval >>= 7;
-    }
-}   // tx_d_samp
+}   // sigrok_tx_write
 
 
 
-//Allow for 1,2 or 4B reads of sample data to reduce memory read overhead when
-//parsing digital sample data.  This function is correct for all uses, but if included
-//the compiled code is substantially slower to the point that digital only transfers
-//can't keep up with USB rate.  Thus it is only used by the send_slices_analog which is already
-//limited to 500khz, and in the starting send_slice_init.
-//
-// not used for D4 mode!
-//
-static uint32_t __TIME_CRITICAL_FUNCTION(get_cval)(uint8_t *dbuf)
+#if OPT_EVENT_STREAM
+/// timestamp of sample \a ndx of the current capture
+static uint64_t decode_ts_us(uint64_t ndx)
 {
-    uint32_t cval;
-
-    if (d_dma_bps == 1) {
-        cval = dbuf[rxbufdidx];
-        cval &= sr_dev.d_mask;
-    }
-    else if (d_dma_bps == 2) {
-        cval = (*((uint16_t *)(dbuf + rxbufdidx)));
-        cval &= sr_dev.d_mask;
-    }
-    else {
-        cval = (*((uint32_t *)(dbuf + rxbufdidx)));
-        cval &= sr_dev.d_mask;
-    }
-    rxbufdidx += d_dma_bps;
-    return cval;
-}   // get_cval
+    const uint32_t rate = sr_dev.sample_rate;
 
-
-
-/*RLE encoding for 5-21 channels has two ranges.
-Decimal 48 to  79 are RLEs of 1 to 32 respectively.
-Decimal 80 to 127 are (N-78)*32 thus 64,96..80,120..1568
-Note that it is the responsibility of the caller to
-forward txbuf bytes to USB to prevent txbufidx from overflowing the size
-of txbuf. We do not always push to USB to reduce its impact
-on performance.
- */
-static void __TIME_CRITICAL_FUNCTION(check_rle)(void)
-{
-    while (rlecnt >= 1568) {
-        txbuf[txbufidx++] = 127;
-        rlecnt -= 1568;
-    }
-    if (rlecnt > 32) {
-        uint16_t rlediv = rlecnt >> 5;
-        txbuf[txbufidx++] = rlediv + 78;//was 86;
-        rlecnt -= rlediv << 5;
-    }
-    if (rlecnt) {
-        txbuf[txbufidx++] = 47 + rlecnt;
-        rlecnt = 0;
-    }
-}   // check_rle
+    return capture_start_us + (ndx / rate) * 1000000 + ((ndx % rate) * 1000000) / rate;
+}   // decode_ts_us
+#endif
 
 
 
-//Send txbuf to usb based on an input threshold
-static void __TIME_CRITICAL_FUNCTION(check_tx_buf)(uint16_t cnt)
+/// output of the protocol decoder, frames go into the event stream
+static void decode_emit(void *ctx, uint64_t ndx, const uint8_t *frame, uint32_t len)
 {
-    if (txbufidx >= cnt) {
-        cdc_sigrok_write((char *)txbuf, txbufidx);
-        sent_cnt += txbufidx;
-        txbufidx = 0;
-    }
-}   // check_tx_buf
+#if OPT_EVENT_STREAM
+    event_stream_put(EVENT_SRC_SIGROK, decode_ts_us(ndx), frame, len);
+#endif
+}   // decode_emit
 
 
 
-//Common init for send_slices_1B/2B/4B, but not D4 or analog
-static void __TIME_CRITICAL_FUNCTION(send_slice_init)(sr_device_t *d, uint8_t *dbuf)
-{
-    rxbufdidx = 0;
-    //Adjust the number of samples to send if there are more in the dma buffer
-    //then we need.
-    samp_remain = d->samples_per_half;
-    if ( !d->continuous  &&  d->scnt + samp_remain > d->num_samples) {
-        samp_remain = d->num_samples - d->scnt;
-        d->scnt += samp_remain;
-    }
-    else {
-        d->scnt += d->samples_per_half;
-    }
-    txbufidx = 0;
-    //Always send the first sample to establish a previous value for RLE
-    //the use of get_cval is inefficient, but only done once per half buffer
-    lval = get_cval(dbuf);
-    tx_d_samp(d, lval);
-    samp_remain--;
-    rlecnt = 0;
-}   // send_slice_init
-
-
-
-//There are three very similar functions send_slices_1B/2B/4B.
-//Each of which  is very similar but exist because if a common function
-//is used with the get_cval in the inner loop, the performance drops
-//substantially.  Thus each function has a 1,2, or 4B aligned read respectively.
-//We can just always read a 4B value because the core doesn't support non-aligned accesses.
-//These must be marked noinline to ensure they remain separate functions for good performance
-//1B is 5-8 channels
-static void __TIME_CRITICAL_FUNCTION(send_slices_1B)(sr_device_t *d, uint8_t *dbuf)
+/**
+ * Run the protocol decoder over a completed segment of the capture buffer.  Nothing is sent to the host,
+ * in fixed mode decoding stops after the requested number of samples.
+ */
+static void __TIME_CRITICAL_FUNCTION(decode_segment)(sr_device_t *d, uint32_t seg, uint32_t samples)
 {
-    send_slice_init(d, dbuf);
-    for (int s = 0;  s < samp_remain;  s++) {
-        cval = dbuf[rxbufdidx++];
-        cval &= sr_dev.d_mask;
-        if (cval == lval) {
-            rlecnt++;
-        }
-        else {
-            check_rle();
-            tx_d_samp(d, cval);
-            check_tx_buf(TX_BUF_THRESH);
-        }
-        lval = cval;
+    if ( !d->continuous  &&  samples > d->num_samples - d->scnt) {
+        samples = d->num_samples - d->scnt;
     }
-    check_rle();
-    check_tx_buf(1);
-}   // send_slices_1B
-
-
+    sr_decode_samples(&d->decoder, sigrok_seg_d_addr(d, capture_buf, seg, 0), d_dma_bps, samples);
+    d->scnt += samples;
+#if OPT_EVENT_STREAM
+    event_stream_watermark(EVENT_SRC_SIGROK, decode_ts_us(sr_decode_pending(&d->decoder)));
+#endif
 
-//2B is 9-16 channels
-static void __TIME_CRITICAL_FUNCTION(send_slices_2B)(sr_device_t *d, uint8_t *dbuf)
-{
-    send_slice_init(d, dbuf);
-    for (int s = 0;  s < samp_remain;  s++) {
-        cval = (*((uint16_t *)(dbuf + rxbufdidx)));
-        cval &= sr_dev.d_mask;
-        rxbufdidx += 2;
-        if (cval == lval) {
-            rlecnt++;
-        }
-        else {
-            check_rle();
-            tx_d_samp(d, cval);
-            check_tx_buf(TX_BUF_THRESH);
-        }
-        lval = cval;
+    if ( !d->continuous  &&  d->scnt >= d->num_samples) {
+        d->sample_and_send = false;
     }
-    check_rle();
-    check_tx_buf(1);
-}   // send_slices_2B
+}   // decode_segment
 
 
 
-//4B is 17-21 channels and is the only one that must mask invalid bits which are captured by DMA
-static void __TIME_CRITICAL_FUNCTION(send_slices_4B)(sr_device_t *d, uint8_t *dbuf)
+/// DMA channels of pair \a ch are running (only channels of enabled inputs are considered)
+static bool dma_pair_running(sr_device_t *d, uint32_t ch)
 {
-    send_slice_init(d, dbuf);
-    for (int s = 0;  s < samp_remain;  s++) {
-        cval = (*((uint32_t *)(dbuf + rxbufdidx)));
-        cval &= sr_dev.d_mask;
-        rxbufdidx += 4;
-        if (cval == lval) {
-            rlecnt++;
-        }
-        else {
-            check_rle();
-            tx_d_samp(d, cval);
-            check_tx_buf(TX_BUF_THRESH);
-        }
-        lval = cval;
-    }
-    check_rle();
-    check_tx_buf(1);
-}   // send_slices_4B
+    return     (d->a_mask == 0  ||  DMA_IS_BUSY(tstsa[ch]))
+           &&  (d->d_mask == 0  ||  DMA_IS_BUSY(tstsd[ch]));
+}   // dma_pair_running
 
 
 
-//Slice transmit code, used for all cases with any analog channels
-//All digital channels for one slice are sent first in 7 bit bytes using values 0x80 to 0xFF
-//Analog channels are sent next, with each channel taking one 7 bit byte using values 0x80 to 0xFF.
-//This does not support run length encoding because it's not clear how to define RLE on analog signals
-static void __TIME_CRITICAL_FUNCTION(send_slices_analog)(sr_device_t *d, uint8_t *dbuf, uint8_t *abuf)
+/**
+ * Hand free segments of the capture buffer to the idle DMA channel pair.
+ *
+ * Segment n is written by channel pair n & 1, the pair of the next segment is chained to the pair
+ * which is currently running.  When chaining happens the original target address is not restored,
+ * so the write address is rewritten here.  A segment is free if the encoder has finished it.
+ * After chaining it is checked that the running pair is still active (or has already triggered the new one),
+ * otherwise the chain has not been established in time and samples are lost.
+ * Capture also stops if encoding is too far behind and no free segment was available in time.
+ * Note that we must use the "alias" versions of the DMA CSRs to prevent writes from triggering them.
+ *
+ * \return false on overflow
+ */
+static bool seg_arm(sr_device_t *d)
 {
-    uint32_t rxbufaidx = 0;
-
-    rxbufdidx = 0;
-    samp_remain = d->samples_per_half;
-    if ( !d->continuous  &&  d->scnt + samp_remain > d->num_samples) {
-        samp_remain = d->num_samples - d->scnt;
-        d->scnt += samp_remain;
-    }
-    else {
-        d->scnt += d->samples_per_half;
-    }
-    txbufidx = 0;
-    for (int s = 0;  s < samp_remain;  s++) {
-        if (d->d_mask != 0) {
-            cval = get_cval(dbuf);
-            tx_d_samp(d, cval);
-//            Dprintf("s %d cv %lX bps %d idx t %d r %ld\n", s, cval, d_dma_bps, txbufidx, rxbufdidx);
+    while (    seg_armed - seg_done == 1
+           &&  seg_armed - seg_encoded < d->seg_cnt
+           &&  seg_armed < seg_needed) {
+        uint32_t ch    = seg_armed & 1;
+        uint32_t other = ch ^ 1;
+        uint32_t seg   = seg_armed % d->seg_cnt;
+
+        *taddra[ch] = (uint32_t)&(capture_buf[d->abuf_start + seg * d->a_size]);
+        *taddrd[ch] = (uint32_t)&(capture_buf[d->dbuf_start + seg * d->d_size]);
+        DMA_SET_CHAIN_TO(tstsa[other][1], DMA_ADDR_TO_CHANNEL_NO(tstsa[ch]));
+        DMA_SET_CHAIN_TO(tstsd[other][1], DMA_ADDR_TO_CHANNEL_NO(tstsd[ch]));
+        ++seg_armed;
+
+        if ( !dma_pair_running(d, other)  &&  !dma_pair_running(d, ch)) {
+            return false;
         }
-        for (uint32_t i = 0;  i < d->a_chan_cnt;  i++) {
-            txbuf[txbufidx] = (abuf[rxbufaidx] >> 1) | 0x80;
-            txbufidx++;
-            rxbufaidx++;
-//            Dprintf("av %X cnt %d idx t %d r %ld\n", abuf[rxbufaidx-1], d->a_chan_cnt, txbufidx, rxbufaidx);
-        }
-        //Since this doesn't support RLEs we don't need to buffer
-        //extra bytes to prevent txbuf overflow, but this value
-        //works well anyway
-        check_tx_buf(TX_BUF_THRESH);
     }
-    check_tx_buf(1);
-}   // send_slices_analog
+    return seg_armed != seg_done  ||  seg_armed >= seg_needed;
+}   // seg_arm
 
 
 
 /**
- * See if a given half's DMA engines are idle and if so process the data, update the write pointer and
- * ensure that when done the other dma is still busy indicating we didn't lose data.
+ * Check if DMA segments are complete, hand them to the encoder and rearm the DMA.
  *
- * Use two dma controllers where each writes half of the trace space.
- * When one half finishes we send it's data while the other dma controller writes to the other half.
- * We rely on DMA chaining where one completing dma engine triggers the next.
- * When chaining happens the original target address is not restored so we must rewrite the starting address.
- * Also when chaining is enabled we can get into an infinite loop where we ping pong between each other.
- * and it is possible that if the other DMA controller finishes before we have send our half of the data that
- * our DMA controller will startup and overwrite our data.  That is the DMA overflow condition.
- * We don't actually overflow the DMA, but instead we fail to establish proper chaining to keep the
- * ping pong going.
+ * Capture and encoding are decoupled: sigrok_thread() takes care of DMA and runs on core 0 (because of the
+ * DMA interrupt), sigrok_encoder_thread() encodes and transmits finished segments on core 1.
+ * If capture runs out of free segments, samples are lost and capture is aborted.  This is the
+ * DMA overflow condition.  PIO/ADC FIFO overflows are also detected here.
  * The only way to avoid the overflow condition is to reduce the sampling rate so that the transmit of samples
  * can keep up, or do a fixed sample that fits into the sample buffer.
- * When we first enter the loop it is assumed that the other controller is not chained to us so that if we don't
- * process in time then our DMA controller won't be started by the other.  That assumption is maintained by
- * always pointing our DMA engine to itself so tht in the next function call it is the "other" controller.
- * We then process our half's samples and send to USB.
- * When done we confirm that the other channel is still active, and if so we know we haven't overflowed and thus
- * can establish the chain from the other channel to us.  If the other channel is not still active, or if the
- * PIO/ADC FIFOs indicates an RXstall condition which indicates PIO lost samples, then we abort.
  * Note that in all cases we should never actually send any corrupted data we just send less than what was requested.
- * Note that we must use the "alias" versions of the DMA CSRs to prevent writes from triggering them.
- * Since we swap the csr pointers we determine the other half from the address offsets.
- *
- * \return  0->no change, 1->buffers must be switched, -1->abort
  */
-static int __TIME_CRITICAL_FUNCTION(check_half)(sr_device_t *d,
-                                                volatile uint32_t *dma_a_sts_idle,  volatile uint32_t *dma_a_sts_other,
-                                                volatile uint32_t *dma_d_sts_idle,  volatile uint32_t *dma_d_sts_other,
-                                                volatile uint32_t *dma_a_addr_idle, volatile uint32_t *dma_d_addr_idle,
-                                                uint8_t *d_start_addr, uint8_t *a_start_addr,
-                                                bool mask_xfer_err)
+static void __TIME_CRITICAL_FUNCTION(dma_check)(sr_device_t *d)
 {
-    if (DMA_IS_BUSY(dma_a_sts_idle)  ||  DMA_IS_BUSY(dma_d_sts_idle)) {
-        //
-        // DMA is still running
-        // -> do nothing (I'm a fan of positive logic)
-        //
-        return 0;
+    if ( !d->sample_and_send  ||  !d->all_started  ||  seg_done >= seg_needed) {
+        return;
     }
 
-    led_state(LS_SIGROK_RUNNING);
+    while (seg_done != seg_armed) {
+        uint32_t ch = seg_done & 1;
 
-    //
-    // From here on the parameter names are correct:
-    // - the idle channel is really idle and the corresponding data block has to be transferred to the host
-    // - the other channel is now active and must be checked that it is still active at end of transmission
-    //
-    uint32_t dma_a_chan = DMA_ADDR_TO_CHANNEL_NO(dma_a_sts_idle);
-    uint32_t dma_d_chan = DMA_ADDR_TO_CHANNEL_NO(dma_d_sts_idle);
-
-//        Dprintf("my stts pre a 0x%lX d 0x%lX\n", *dma_a_sts_idle, *dma_d_sts_idle);
+        if (DMA_IS_BUSY(tstsa[ch])  ||  DMA_IS_BUSY(tstsd[ch])) {
+            break;
+        }
 
-    // disable chain_to of idle channel - use aliases to prevent trigger
-    // chain_to will be enabled on the next round below when the idle channel is the other channel
-    DMA_SET_CHAIN_TO(dma_a_sts_idle[1], dma_a_chan);
-    DMA_SET_CHAIN_TO(dma_d_sts_idle[1], dma_d_chan);
+        // burst: PIO has been stopped by DMA after the last segment, so a stall means lost samples
+        if (burst  &&  seg_done + 1 >= seg_needed  &&  PIO_RX_HAS_STALLED(SIGROK_PIO, SIGROK_SM)) {
+            Dprintf("***Abort PIO RXSTALL in burst*** segment %lu\n", seg_done);
+            stats_inc(STATS_SIGROK_OVERFLOW);
+            d->aborted = true;
+            d->sample_and_send = false;
+            return;
+        }
 
-    // reset address write address register of the idle channel for next round
-    *dma_a_addr_idle = (uint32_t)a_start_addr;
-    *dma_d_addr_idle = (uint32_t)d_start_addr;
+        // disable chain_to of the idle pair, it will be reenabled when the other pair gets armed
+        DMA_SET_CHAIN_TO(tstsa[ch][1], DMA_ADDR_TO_CHANNEL_NO(tstsa[ch]));
+        DMA_SET_CHAIN_TO(tstsd[ch][1], DMA_ADDR_TO_CHANNEL_NO(tstsd[ch]));
 
-    if (d->a_mask != 0) {
-        send_slices_analog(d, d_start_addr, a_start_addr);
-    }
-    else if (d_dma_bps == 0) {
-        send_slices_D4(d, d_start_addr);
-    }
-    else if (d_dma_bps == 1) {
-        send_slices_1B(d, d_start_addr);
-    }
-    else if (d_dma_bps == 2) {
-        send_slices_2B(d, d_start_addr);
-    }
-    else {
-        send_slices_4B(d, d_start_addr);
+        __mem_fence_release();
+        ++seg_done;
+        xEventGroupSetBits(events, EV_SEG_DONE);
+        led_state(trig_armed ? LS_SIGROK_WAIT : LS_SIGROK_RUNNING);
     }
 
-    if ( !d->continuous  &&  d->scnt >= d->num_samples) {
-        d->sample_and_send = false;
+    if (seg_done >= seg_needed) {
+        // all required samples are captured
+        return;
     }
 
-    // enable chain_to of the other channel, because the idle channel is now free - use aliases to prevent trigger
-    DMA_SET_CHAIN_TO(dma_a_sts_other[1], dma_a_chan);
-    DMA_SET_CHAIN_TO(dma_d_sts_other[1], dma_d_chan);
-
-    num_halves++;
-
     //
     // now check, if there has been some kind of error/overflow
     //
+    bool dma_ok = seg_arm(d);
     bool pio_ok = (d->d_mask == 0  ||  !PIO_RX_HAS_STALLED(SIGROK_PIO, SIGROK_SM));
 
     volatile uint32_t *adcfcs;
     adcfcs = (volatile uint32_t *)(ADC_BASE + ADC_FCS_OFFSET);
     bool adc_ok = (d->a_mask == 0  ||  (*adcfcs & (ADC_FCS_OVER_BITS | ADC_FCS_UNDER_BITS)) == 0);
 
-    //Ensure other dma is still busy, if not that means we have samples from PIO/ADC that could be lost.
-    //It's only an error if we haven't already gotten the samples we need, or if we are processing the first
-    //half and all the remaining samples we need are in the 2nd half.
-    //Note that in continuous mode num_samples isn't defined.
-    bool other_dma_running =     (d->a_mask == 0  ||  DMA_IS_BUSY(dma_a_sts_other))
-                             &&  (d->d_mask == 0  ||  DMA_IS_BUSY(dma_d_sts_other));
-
-//        Dprintf("pf 0x%lX 0x%lX %d\n", *dma_a_sts_other, *dma_d_sts_other, other_dma_running);
-
-    if (mask_xfer_err  ||  (adc_ok  &&  pio_ok  &&  other_dma_running)) {
-        // -> everything ok, caller must switch buffer
-//            Dprintf("h\n");
-        return 1;
+    if (mask_xfer_err  ||  (adc_ok  &&  pio_ok  &&  dma_ok)) {
+        return;
     }
 
     //
     // error condition - abort!
+    // "!!!" is sent by sigrok_thread() after the encoder has stopped
     //
     if ( !pio_ok) {
-        Dprintf("***Abort PIO RXSTALL*** half %lu\n", num_halves);
+        Dprintf("***Abort PIO RXSTALL*** segment %lu\n", seg_done);
     }
-    if ( !other_dma_running) {
-        Dprintf("***Abort DMA overflow*** half %lu\n", num_halves);
+    if ( !dma_ok) {
+        Dprintf("***Abort DMA overflow*** segment %lu, encoded %lu\n", seg_done, seg_encoded);
     }
     if ( !adc_ok) {
-        Dprintf("***Abort ADC overflow*** half %lu\n", num_halves);
+        Dprintf("***Abort ADC overflow*** segment %lu\n", seg_done);
     }
+    stats_inc(STATS_SIGROK_OVERFLOW);
     d->aborted = true;
-    //Issue end of trace markers to host
-    //The main loop also sends these periodically until the host is done..
-    cdc_sigrok_write("!!!", 3);
-//    Dprintf("scnt %lu\n", d->scnt);
-//    Dprintf("a st %lu msk %lu\n", *dma_a_sts_other, d->a_mask);
-//    Dprintf("d st %lu msk %lu\n", *dma_d_sts_other, d->d_mask);
-    return -1;
-}   // check_half
+    d->sample_and_send = false;
+}   // dma_check
 
 
 
-//Check if dma activity is complete.  This was split out to allow core1 to do the monitoring
-//and slice processing and leave usb interrupt handling to core 0, but doing so did not improve
-//streaming performance, so it's left in core0.
-static void __TIME_CRITICAL_FUNCTION(dma_check)(sr_device_t *d)
+/**
+ * Wait until the encoder has stopped.
+ * Must be done before sigrok_thread() writes to the CDC, because the stream buffer allows only one writer.
+ */
+static void encoder_wait_idle(void)
 {
-//    Dprintf("dma_check: %d %d %lu %lu %d\n", d->sample_and_send, d->all_started, d->scnt, d->num_samples, d->continuous);
-    if (d->sample_and_send  &&  d->all_started  &&  (d->scnt < d->num_samples  ||  d->continuous)) {
-        int ret;
-
-        if (lowerhalf) {
-            ret = check_half(&sr_dev, tstsa0, tstsa1, tstsd0, tstsd1, taddra0, taddrd0,
-                             &(capture_buf[d->dbuf0_start]), &(capture_buf[d->abuf0_start]), mask_xfer_err);
-            if (ret == 1) {
-                lowerhalf = false;
-            }
-            else if (ret < 0) {
-                d->sample_and_send = false;
-            }
-        }
-        if ( !lowerhalf) {
-            ret = check_half(&sr_dev, tstsa1, tstsa0, tstsd1, tstsd0, taddra1, taddrd1,
-                             &(capture_buf[d->dbuf1_start]), &(capture_buf[d->abuf1_start]), mask_xfer_err);
-            if (ret == 1) {
-                lowerhalf = true;
-            }
-            else if (ret < 0) {
-                d->sample_and_send = false;
-            }
-        }
+    while (encoder_busy) {
+        vTaskDelay(pdMS_TO_TICKS(1));
     }
-}   // dma_check
+}   // encoder_wait_idle
+
+
+
+/**
+ * Send the data of a buffered capture to the host.  Can be called repeatedly, data is sent only once.
+ */
+static void deep_upload(void)
+{
+    uint32_t ndx, n;
+
+    encoder_wait_idle();
+    if (deep_len != 0) {
+        Dprintf("upload %lu bytes of %lu samples\n", deep_len, sr_dev.scnt);
+    }
+    for (ndx = 0;  ndx < deep_len;  ndx += n) {
+        n = MIN(deep_len - ndx, DEEP_UPLOAD_CHUNK);
+        cdc_sigrok_write((const char *)capture_buf + deep_start + ndx, n);
+    }
+    deep_len = 0;
+}   // deep_upload
 
 
 
@@ -716,7 +432,7 @@ static void dma_handler(void)
  */
 static void setup_pio(void)
 {
-    const uint32_t trigger_delay = 7;      // see sigrok.pio
+    const uint32_t trigger_delay = SR_PIO_TRIGGER_DELAY;
     uint32_t sample_rate_khz = 0;
     pio_sm_config pio_conf;
     uint offset;
@@ -727,10 +443,11 @@ static void setup_pio(void)
 
     pio_clear_instruction_memory(SIGROK_PIO);
 
-    if (sr_dev.sample_rate / 1000 <= f_clk_sys / trigger_delay  &&  sr_dev.a_mask == 0) {
+    if (sr_dev.sample_rate / 1000 <= f_clk_sys / trigger_delay  &&  sr_dev.a_mask == 0  &&  !trig_armed) {
         //
         // Auto triggering for 4/8/16bit: acquisition is triggered if there are changes on the enabled input lines
         // TODO currently no auto trigger with analog/digital signal mix
+        // Not used with a host defined trigger, because pre-trigger samples must be captured without gaps
         //
         Dprintf("Capturing with auto trigger\n");
         if (sr_dev.pin_count == 4) {
@@ -810,8 +527,8 @@ static void setup_pio(void)
  */
 static void sigrok_thread(void *ptr)
 {
-    dma_channel_config acfg0, acfg1, pcfg0, pcfg1;
-    uint admachan0, admachan1, pdmachan0, pdmachan1;
+    dma_channel_config acfg0, acfg1, pcfg0, pcfg1, scfg;
+    uint admachan0, admachan1, pdmachan0, pdmachan1, pstopchan;
 
     vTaskDelay(pdMS_TO_TICKS(100));
     uint32_t f_clk_adc = frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_ADC);
@@ -845,6 +562,7 @@ static void sigrok_thread(void *ptr)
     admachan1 = dma_claim_unused_channel(true);
     pdmachan0 = dma_claim_unused_channel(true);
     pdmachan1 = dma_claim_unused_channel(true);
+    pstopchan = dma_claim_unused_channel(true);
     dma_mask = (1 << admachan0)  |  (1 << admachan1)  |  (1 << pdmachan0)  |  (1 << pdmachan1);
 
     acfg0 = dma_channel_get_default_config(admachan0);
@@ -852,6 +570,14 @@ static void sigrok_thread(void *ptr)
     pcfg0 = dma_channel_get_default_config(pdmachan0);
     pcfg1 = dma_channel_get_default_config(pdmachan1);
 
+    //Stop channel for bursts: chained to the last digital channel, it disables the sigrok state machine
+    //with one write into the clear alias of the PIO CTRL register
+    scfg = dma_channel_get_default_config(pstopchan);
+    channel_config_set_transfer_data_size(&scfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&scfg, false);
+    channel_config_set_write_increment(&scfg, false);
+    burst_stop_mask = 1u << (PIO_CTRL_SM_ENABLE_LSB + SIGROK_SM);
+
     //ADC transfer 8 bytes, PIO transfer the 4B default
     channel_config_set_transfer_data_size(&acfg0, DMA_SIZE_8);
     channel_config_set_transfer_data_size(&acfg1, DMA_SIZE_8);
@@ -881,15 +607,15 @@ static void sigrok_thread(void *ptr)
     tcountdbga0 = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan0 + DMA_CH0_DBG_TCR_OFFSET); //DMA_TRANS_COUNT DBGoffset
     tcountdbgd0 = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan0 + DMA_CH0_DBG_TCR_OFFSET); //DMA_TRANS_COUNT DBGoffset
 
-    taddra0 = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan0 + DMA_CH0_WRITE_ADDR_OFFSET);
-    taddra1 = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan1 + DMA_CH0_WRITE_ADDR_OFFSET);
-    taddrd0 = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan0 + DMA_CH0_WRITE_ADDR_OFFSET);
-    taddrd1 = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan1 + DMA_CH0_WRITE_ADDR_OFFSET);
+    taddra[0] = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan0 + DMA_CH0_WRITE_ADDR_OFFSET);
+    taddra[1] = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan1 + DMA_CH0_WRITE_ADDR_OFFSET);
+    taddrd[0] = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan0 + DMA_CH0_WRITE_ADDR_OFFSET);
+    taddrd[1] = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan1 + DMA_CH0_WRITE_ADDR_OFFSET);
 
-    tstsa0 = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan0 + DMA_CH0_CTRL_TRIG_OFFSET);
-    tstsa1 = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan1 + DMA_CH0_CTRL_TRIG_OFFSET);
-    tstsd0 = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan0 + DMA_CH0_CTRL_TRIG_OFFSET);
-    tstsd1 = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan1 + DMA_CH0_CTRL_TRIG_OFFSET);
+    tstsa[0] = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan0 + DMA_CH0_CTRL_TRIG_OFFSET);
+    tstsa[1] = (volatile uint32_t *)(DMA_BASE + 0x40 * admachan1 + DMA_CH0_CTRL_TRIG_OFFSET);
+    tstsd[0] = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan0 + DMA_CH0_CTRL_TRIG_OFFSET);
+    tstsd[1] = (volatile uint32_t *)(DMA_BASE + 0x40 * pdmachan1 + DMA_CH0_CTRL_TRIG_OFFSET);
 
     dma_set_irq0_channel_mask_enabled(dma_mask, true);
     irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
@@ -927,15 +653,16 @@ static void sigrok_thread(void *ptr)
 //        Dprintf("ss %d %d\n", sr_dev.sample_and_send, sr_dev.all_started);
 
         //
-        // Wait until either there is something coming from cdc_sigrok or the DMA
-        // tells us, that half a buffer is ready for data transfer (during data acquisition)
+        // Wait until either there is something coming from cdc_sigrok, the DMA
+        // tells us, that a segment is complete or the encoder has freed a segment (during data acquisition)
         //
-        xEventGroupWaitBits(events, EV_DMA_SIGNAL | EV_CMD_RECEIVED, pdTRUE, pdFALSE, pdMS_TO_TICKS(100)); // portMAX_DELAY);
+        xEventGroupWaitBits(events, EV_DMA_SIGNAL | EV_CMD_RECEIVED | EV_SEG_ENCODED, pdTRUE, pdFALSE, pdMS_TO_TICKS(100)); // portMAX_DELAY);
 
         if (sr_dev.send_resp) {
             //
             // send command response to host
             //
+            encoder_wait_idle();
             cdc_sigrok_write(sr_dev.rspstr, strnlen(sr_dev.rspstr, sizeof(sr_dev.rspstr)));
             sr_dev.send_resp = false;
         }
@@ -949,73 +676,66 @@ static void sigrok_thread(void *ptr)
 
             Dprintf("------------------------------------- data acquisition initializing...\n");
 
-            //Only boost frequency during a sample so that average device power is less.
-            //It's not clear that this is needed because rp2040 is pretty low power, but it can't hurt...
-            lowerhalf = true;
+            encoder_wait_idle();
+            xEventGroupClearBits(events, EV_SEG_DONE | EV_SEG_ENCODED);
+#if OPT_NET_SIGROK_SERVER
+            txbufthresh = net_sigrok_is_connected() ? TX_BUF_THRESH_NET : TX_BUF_THRESH;
+#endif
 
             //Sample rate must always be even.  Pulseview code enforces this
             //because a frequency step of 2 is required to get a pulldown to specify
             //the sample rate, but sigrok cli can still pass it.
             sr_dev.sample_rate &= 0xfffffffe;
 
+            //The protocol decoder replaces sample transmission.  It works on digital only captures with all
+            //decoder channels enabled.  Decoded data is small, so there is no need for buffered mode.
+            decoding = false;
+            if (sr_decode_is_active(&sr_dev.decoder)) {
+                if (sr_dev.a_mask != 0  ||  (sr_decode_mask(&sr_dev.decoder) & ~sr_dev.d_mask) != 0) {
+                    Dprintf("decoder needs its channels enabled and no analog channels\n");
+                }
+                else if ( !sr_decode_start(&sr_dev.decoder, sr_dev.sample_rate, decode_emit, NULL)) {
+                    Dprintf("sample rate too low for the decoder\n");
+                }
+                else {
+                    decoding = true;
+                    sr_dev.buffered = false;
+                }
+            }
+
+            //Host defined triggers are evaluated on digital channels and only for fixed sample counts
+            trig_armed = !decoding  &&  !sr_dev.continuous  &&  sr_dev.d_mask != 0  &&  sr_trigger_is_active(&sr_dev.trigger);
+
             //Adjust up and align to 4 to avoid rounding errors etc
             if (sr_dev.num_samples < 16) {
                 sr_dev.num_samples = 16;
             }
             sr_dev.num_samples = (sr_dev.num_samples + 3) & 0xFFFFFFFC;
 
-            //Divide capture buf evenly based on channel enables
-            //d_size is aligned to 4 bytes because pio operates on words
-            //These are the sizes for each half buffer in bytes
-            //Calculate relative size in terms of nibbles which is the smallest unit, thus a_chan_cnt is multiplied by 2
-            //Nibble size storage is only allow for D4 mode with no analog channels enabled
-            //For instance a D0..D5 with A0 would give 1/2 the storage to digital and 1/2 to analog
-            uint32_t d_nibbles, a_nibbles, t_nibbles; //digital, analog and total nibbles
-            d_nibbles = sr_dev.d_nps;  //digital is in groups of 4 bits
-            a_nibbles = sr_dev.a_chan_cnt * 2; //1 byte per sample
-            t_nibbles = d_nibbles + a_nibbles;
-
-            //total buf size must be a multiple of a_nibbles*2, d_nibbles*8, and t_nibbles so that division is always
-            //in whole samples
-            //Also set a multiple of 32  because the dma buffer is split in half, and
-            //the PIO does writes on 4B boundaries, and then a 4x factor for any other size/alignment issues
-            uint32_t chunk_size = t_nibbles * 32;
-            if (a_nibbles != 0)
-                chunk_size *= a_nibbles;
-            if (d_nibbles != 0)
-                chunk_size *= d_nibbles;
-            uint32_t dig_bytes_per_chunk = chunk_size * d_nibbles / t_nibbles;
-            uint32_t dig_samples_per_chunk = d_nibbles ? (dig_bytes_per_chunk * 2) / d_nibbles : 0;
-            uint32_t chunk_samples = d_nibbles ? dig_samples_per_chunk  : (chunk_size * 2) / a_nibbles;
-            //total chunks in entire buffer-round to 2 since we split it in half
-            uint32_t buff_chunks = (SR_DMA_BUF_SIZE / chunk_size) & 0xFFFFFFFE;
-            //round up and force power of two since we cut it in half
-            uint32_t chunks_needed = ((sr_dev.num_samples / chunk_samples) + 2) & 0xFFFFFFFE;
-//            Dprintf("Initial buf calcs nibbles d %lu a %lu t %lu\n", d_nibbles, a_nibbles, t_nibbles);
-//            Dprintf("chunk size %lu samples %lu buff %lu needed %lu\n", chunk_size, chunk_samples, buff_chunks, chunks_needed);
-//            Dprintf("dbytes per chunk %lu dig samples per chunk %lu\n", dig_bytes_per_chunk, dig_samples_per_chunk);
-            //If all of the samples we need fit in two half buffers or less then we can mask the error
-            //logic that is looking for cases where we didn't send one half buffer to the host before
-            //the 2nd buffer ended because we only use each half buffer once.
-            mask_xfer_err = false;
-            //If requested samples are smaller than the buffer, reduce the size so that the
-            //transfer completes sooner.
-            //Also, mask the sending of aborts if the requested number of samples fit into RAM
-            //Don't do this in continuous mode as the final size is unknown
-            if ( !sr_dev.continuous) {
-                if (buff_chunks > chunks_needed) {
-                    mask_xfer_err = true;
-                    buff_chunks = chunks_needed;
-//                    Dprintf("Reduce buf chunks to %ld\n", buff_chunks);
+            //buffered mode needs at least two chunks for the DMA segments, otherwise fall back to streaming
+            if (sr_dev.buffered  &&  SR_DEEP_RING_SIZE / sigrok_seg_chunk_size(&sr_dev) < 2) {
+                Dprintf("buffered capture not possible with this channel setup\n");
+                sr_dev.buffered = false;
+            }
+            //If all of the samples we need fit in two segments, mask the error logic that is looking for
+            //cases where we didn't send one segment to the host before the other one ended, because each
+            //segment is used only once.
+            //Don't do this in continuous mode as the final size is unknown, same with a trigger or in buffered mode
+            mask_xfer_err = sigrok_seg_layout(&sr_dev, sr_dev.buffered ? SR_DEEP_RING_SIZE : SR_DMA_BUF_SIZE, SR_DMA_SEGMENTS,
+                                              !sr_dev.continuous  &&  !trig_armed  &&  !sr_dev.buffered);
+            if (trig_armed) {
+                //Pre-trigger samples are held in the capture buffer.  One segment is scanned by the
+                //encoder and two belong to the DMA, the remaining ones can hold the pre-trigger history.
+                uint32_t pretrig_max = (sr_dev.seg_cnt > 3) ? (sr_dev.seg_cnt - 3) * sr_dev.samples_per_seg : 0;
+
+                if (sr_dev.pretrig_samples > pretrig_max) {
+                    Dprintf("pre-trigger samples limited from %lu to %lu\n", sr_dev.pretrig_samples, pretrig_max);
+                    sr_dev.pretrig_samples = pretrig_max;
                 }
+                sr_trigger_arm(&sr_dev.trigger);
             }
-            //Give dig and analog equal fractions
-            //This is the size of each half buffer in bytes
-            sr_dev.d_size = (buff_chunks * chunk_size * d_nibbles) / (t_nibbles * 2);
-            sr_dev.a_size = (buff_chunks * chunk_size * a_nibbles) / (t_nibbles * 2);
-            sr_dev.samples_per_half = (chunk_samples * buff_chunks) / 2;
-//            Dprintf("Final sizes d %ld a %ld mask err %d samples per half %ld\n",
-//                    sr_dev.d_size, sr_dev.a_size, mask_xfer_err, sr_dev.samples_per_half);
+//            Dprintf("Final sizes d %ld a %ld mask err %d samples per segment %ld\n",
+//                    sr_dev.d_size, sr_dev.a_size, mask_xfer_err, sr_dev.samples_per_seg);
 
             //Clear any previous ADC over/underflow
             volatile uint32_t *adcfcs;
@@ -1028,24 +748,46 @@ static void sigrok_thread(void *ptr)
             dma_channel_abort(admachan1);
             dma_channel_abort(pdmachan0);
             dma_channel_abort(pdmachan1);
+            dma_channel_abort(pstopchan);
 
-            //Enable the initial chaining from the first half to 2nd, further chains are enabled based
-            //on whether we can parse each half in time.
+            //Enable the initial chaining from the first segment to 2nd, further chains are enabled based
+            //on whether the encoder has freed the next segment, see seg_arm()
             channel_config_set_chain_to(&acfg0, admachan1);
             channel_config_set_chain_to(&pcfg0, pdmachan1);
+            channel_config_set_chain_to(&pcfg1, pdmachan1);
 
-            num_halves = 0;
-            sr_dev.dbuf0_start = 0;
             sent_cnt = 0;
-            sr_dev.dbuf1_start = sr_dev.d_size;
-            sr_dev.abuf0_start = sr_dev.dbuf1_start + sr_dev.d_size;
-            sr_dev.abuf1_start = sr_dev.abuf0_start + sr_dev.a_size;
+            enc_time_us = 0;
+            enc_samples = 0;
+            seg_done = 0;
+            seg_encoded = 0;
+            seg_armed = 2;
+            seg_scanned = 0;
+            seg_first = 0;
+            if (sr_dev.continuous  ||  trig_armed) {
+                seg_needed = UINT32_MAX;
+            }
+            else {
+                seg_needed = (sr_dev.num_samples + sr_dev.samples_per_seg - 1) / sr_dev.samples_per_seg;
+            }
+
+            //Burst if the capture fits and is too fast for the auto trigger: the DMA channel of the last segment
+            //is chained to the stop channel
+            burst =     mask_xfer_err  &&  sr_dev.a_mask == 0  &&  sr_dev.d_mask != 0
+                    &&  sr_dev.sample_rate / 1000 > frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_SYS) / SR_PIO_TRIGGER_DELAY;
+            if (burst) {
+                Dprintf("burst capture of %lu segments\n", seg_needed);
+                channel_config_set_chain_to((seg_needed == 1) ? &pcfg0 : &pcfg1, pstopchan);
+                dma_channel_configure(pstopchan, &scfg, hw_clear_alias(&SIGROK_PIO->ctrl), &burst_stop_mask, 1, false);
+            }
+            deep_start = sr_dev.abuf_start + sr_dev.seg_cnt * sr_dev.a_size;
+            deep_size  = sr_dev.buffered ? SR_DMA_BUF_SIZE - deep_start : 0;
+            deep_len   = 0;
 
 //            Dprintf("starting d_nps %u a_chan_cnt %u d_size %lu a_size %lu a_mask %lX\n",
 //                    sr_dev.d_nps, sr_dev.a_chan_cnt, sr_dev.d_size, sr_dev.a_size, sr_dev.a_mask);
-//            Dprintf("start offsets d0 0x%lX d1 0x%lX a0 0x%lX a1 0x%lX samperhalf %lu\n",
-//                    sr_dev.dbuf0_start, sr_dev.dbuf1_start, sr_dev.abuf0_start, sr_dev.abuf1_start, sr_dev.samples_per_half);
-//            Dprintf("starting data buf values 0x%X 0x%X\n", capture_buf[sr_dev.dbuf0_start], capture_buf[sr_dev.dbuf1_start]);
+//            Dprintf("start offsets d 0x%lX a 0x%lX segments %lu sampperseg %lu\n",
+//                    sr_dev.dbuf_start, sr_dev.abuf_start, sr_dev.seg_cnt, sr_dev.samples_per_seg);
 
             if (sr_dev.a_chan_cnt != 0) {
                 adc_run(false);
@@ -1091,8 +833,8 @@ static void sigrok_thread(void *ptr)
 
                 //set chan0 to immediate trigger (but without adc_run it shouldn't start), chan1 is chained to it.
                 // channel, config, write_addr,read_addr,transfer_count,trigger)
-                dma_channel_configure(admachan0, &acfg0, &(capture_buf[sr_dev.abuf0_start]), &adc_hw->fifo, sr_dev.a_size, true);
-                dma_channel_configure(admachan1, &acfg1, &(capture_buf[sr_dev.abuf1_start]), &adc_hw->fifo, sr_dev.a_size, false);
+                dma_channel_configure(admachan0, &acfg0, &(capture_buf[sr_dev.abuf_start]), &adc_hw->fifo, sr_dev.a_size, true);
+                dma_channel_configure(admachan1, &acfg1, &(capture_buf[sr_dev.abuf_start + sr_dev.a_size]), &adc_hw->fifo, sr_dev.a_size, false);
                 adc_fifo_drain();
             }
 
@@ -1142,8 +884,8 @@ static void sigrok_thread(void *ptr)
                 channel_config_set_dreq(&pcfg1, pio_get_dreq(SIGROK_PIO, SIGROK_SM, false));
 
                 //                      number    config             buffer target                  piosm                    xfer size       trigger
-                dma_channel_configure(pdmachan0, &pcfg0, &(capture_buf[sr_dev.dbuf0_start]), &SIGROK_PIO->rxf[SIGROK_SM], sr_dev.d_size >> 2, true);
-                dma_channel_configure(pdmachan1, &pcfg1, &(capture_buf[sr_dev.dbuf1_start]), &SIGROK_PIO->rxf[SIGROK_SM], sr_dev.d_size >> 2, false);
+                dma_channel_configure(pdmachan0, &pcfg0, &(capture_buf[sr_dev.dbuf_start]), &SIGROK_PIO->rxf[SIGROK_SM], sr_dev.d_size >> 2, true);
+                dma_channel_configure(pdmachan1, &pcfg1, &(capture_buf[sr_dev.dbuf_start + sr_dev.d_size]), &SIGROK_PIO->rxf[SIGROK_SM], sr_dev.d_size >> 2, false);
 #endif
             }
 
@@ -1166,19 +908,18 @@ static void sigrok_thread(void *ptr)
                 Dprintf("\n\nERROR: DMAA1 should start with 0 tcount\n\n");
             }
 
-//            Dprintf("dma addr start d 0x%lX 0x%lX a 0x%lX 0x%lX\n", *taddrd0, *taddrd1, *taddra0, *taddra1);
+//            Dprintf("dma addr start d 0x%lX 0x%lX a 0x%lX 0x%lX\n", *taddrd[0], *taddrd[1], *taddra[0], *taddra[1]);
 //            Dprintf("capture_buf base %p\n", capture_buf);
-//            Dprintf("capture_buf dig %p %p\n", &(capture_buf[sr_dev.dbuf0_start]), &(capture_buf[sr_dev.dbuf1_start]));
-//            Dprintf("capture_buf analog %p %p\n", &(capture_buf[sr_dev.abuf0_start]), &(capture_buf[sr_dev.abuf1_start]));
 
 //            Dprintf("DMA channel assignments a %d %d d %d %d\n", admachan0, admachan1, pdmachan0, pdmachan1);
-//            Dprintf("DMA ctr reg addrs a %p %p d %p %p\n", (void *)tstsa0, (void *)tstsa1, (void *)tstsd0, (void *)tstsd1);
-//            Dprintf("DMA ctrl reg a 0x%lX 0x%lX d 0x%lX 0x%lX\n", *tstsa0, *tstsa1, *tstsd0, *tstsd1);
+//            Dprintf("DMA ctr reg addrs a %p %p d %p %p\n", (void *)tstsa[0], (void *)tstsa[1], (void *)tstsd[0], (void *)tstsd[1]);
+//            Dprintf("DMA ctrl reg a 0x%lX 0x%lX d 0x%lX 0x%lX\n", *tstsa[0], *tstsa[1], *tstsd[0], *tstsd[1]);
 
             Dprintf("------------------------------------- data acquisition ready\n");
 
             //Enable logic and analog close together for best possible alignment
             //warning - do not put printfs or similar things here...
+            capture_start_us = time_us_64();
             if (sr_dev.a_mask != 0  &&  sr_dev.d_mask != 0) {
                 adc_run(true);
                 pio_sm_set_enabled(SIGROK_PIO, SIGROK_SM, true);
@@ -1196,9 +937,15 @@ static void sigrok_thread(void *ptr)
 
         dma_check( &sr_dev);
 
+        //Buffered mode: capture has ended, now send the stored data (also the part before an abort)
+        if (sr_dev.buffered  &&  !sr_dev.sample_and_send  &&  sr_dev.all_started) {
+            deep_upload();
+        }
+
         //In high verbosity modes the host can miss the "!" so send these until it sends a "+"
         if (sr_dev.aborted) {
             Dprintf("------------------------------------- data acquisition abort\n");
+            encoder_wait_idle();
             cdc_sigrok_write("!!!", 3);
             vTaskDelay(pdMS_TO_TICKS(200));
         }
@@ -1207,6 +954,16 @@ static void sigrok_thread(void *ptr)
         if ( !sr_dev.sample_and_send  &&  sr_dev.all_started) {
             Dprintf("------------------------------------- data acquisition finished\n");
 
+            encoder_wait_idle();
+            if (decoding) {
+                sr_decode_flush(&sr_dev.decoder);
+                decoding = false;
+            }
+            if (enc_time_us != 0) {
+                Dprintf("encoded %lu samples in %lums, %lukS/s\n",
+                        enc_samples, enc_time_us / 1000, (uint32_t)((1000ULL * enc_samples) / enc_time_us));
+            }
+
             //The end of sequence byte_cnt uses a "$<byte_cnt>+" format.
             //Send the byte_cnt to ensure no bytes were lost
             if ( !sr_dev.aborted) {
@@ -1244,6 +1001,7 @@ static void sigrok_thread(void *ptr)
             dma_channel_abort(admachan1);
             dma_channel_abort(pdmachan0);
             dma_channel_abort(pdmachan1);
+            dma_channel_abort(pstopchan);
             sr_dev.all_started = false;
             led_state(LS_SIGROK_STOPPED);
 
@@ -1252,17 +1010,114 @@ static void sigrok_thread(void *ptr)
 //            Dprintf("Complete: SRate %lu NSmp %lu\n", sr_dev.sample_rate, sr_dev.num_samples);
 //            Dprintf("Cont %d bcnt %lu\n", sr_dev.continuous, sent_cnt);
 //            Dprintf("DMsk 0x%lX AMsk 0x%lX\n", sr_dev.d_mask, sr_dev.a_mask);
-//            Dprintf("Half buffers %lu sampperhalf %lu\n", num_halves, sr_dev.samples_per_half);
+//            Dprintf("Segments %lu sampperseg %lu\n", seg_done, sr_dev.samples_per_seg);
         }
     }
 }   // sigrok_thread
 
 
 
+/**
+ * Scan the next completed segment for the trigger condition.
+ * As long as the trigger does not fire, segments which are too old to hold pre-trigger samples are
+ * given back to the DMA.  If it fires, encoding is set up to start \a sr_dev.pretrig_samples before
+ * the trigger point (or at the oldest sample still available) and capture is limited to the segments
+ * required for the requested number of samples.
+ */
+static void trigger_scan(sr_device_t *d)
+{
+    const uint32_t sps = d->samples_per_seg;
+    uint32_t pos, pre;
+    int32_t ndx;
+
+    ndx = sr_trigger_scan(&d->trigger, sigrok_seg_d_addr(d, capture_buf, seg_scanned % d->seg_cnt, 0), d_dma_bps, d->d_mask, sps);
+    if (ndx < 0) {
+        const uint32_t held = (d->pretrig_samples + sps - 1) / sps;
+
+        ++seg_scanned;
+        if (seg_scanned - seg_encoded > held) {
+            __mem_fence_release();
+            seg_encoded = seg_scanned - held;
+        }
+        return;
+    }
+
+    // position of the first sample to send relative to the oldest held segment
+    pos = (seg_scanned - seg_encoded) * sps + ndx;
+    pre = (d->pretrig_samples < pos) ? d->pretrig_samples : pos;
+    pos -= pre;
+    if (d_dma_bps == 0) {
+        pos &= ~7;                                   // D4 encoding works on whole words
+    }
+    Dprintf("trigger at segment %lu sample %ld, sending from segment %lu sample %lu\n",
+            seg_scanned, ndx, seg_encoded + pos / sps, pos % sps);
+
+    seg_scanned = seg_encoded + pos / sps;
+    seg_first   = pos % sps;
+    seg_needed  = seg_scanned + (seg_first + d->num_samples + sps - 1) / sps;
+    trig_armed  = false;
+    __mem_fence_release();
+    seg_encoded = seg_scanned;
+}   // trigger_scan
+
+
+
+/**
+ * Encoder task of sigrok.
+ * Encodes and transmits segments completed by the capture in sigrok_thread().  It runs on core 1 (see main.c),
+ * so encoding and USB/CDC transmission do not delay the DMA handling.
+ * If a trigger is armed, segments are scanned by trigger_scan() first and encoding starts with the
+ * pre-trigger samples after it has fired.  With a protocol decoder, segments are decoded instead.
+ * Per segment encoding time and sample count go into the stats counters, their quotient is the sustained
+ * encoder rate.
+ */
+static void sigrok_encoder_thread(void *ptr)
+{
+    for (;;) {
+        xEventGroupWaitBits(events, EV_SEG_DONE, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        encoder_busy = true;
+        __mem_fence_acquire();
+        while (sr_dev.sample_and_send  &&  seg_scanned != seg_done  &&  ( !burst  ||  seg_done >= seg_needed)) {
+            __mem_fence_acquire();
+            if (trig_armed) {
+                trigger_scan(&sr_dev);
+            }
+            else {
+                uint32_t scnt = sr_dev.scnt;
+                uint32_t t0 = time_us_32();
+                uint32_t dt;
+
+                if (decoding) {
+                    decode_segment(&sr_dev, seg_scanned % sr_dev.seg_cnt, sr_dev.samples_per_seg);
+                }
+                else {
+                    sigrok_encode_segment(&sr_dev, capture_buf, seg_scanned % sr_dev.seg_cnt, seg_first, sr_dev.samples_per_seg - seg_first);
+                }
+                dt = time_us_32() - t0;
+                enc_time_us += dt;
+                enc_samples += sr_dev.scnt - scnt;
+                stats_add(STATS_SIGROK_ENCODE_US, dt);
+                stats_add(STATS_SIGROK_SAMPLES, sr_dev.scnt - scnt);
+
+                seg_first = 0;
+                ++seg_scanned;
+                __mem_fence_release();
+                seg_encoded = seg_scanned;
+            }
+            xEventGroupSetBits(events, EV_SEG_ENCODED);
+        }
+        encoder_busy = false;
+    }
+}   // sigrok_encoder_thread
+
+
+
 void sigrok_init(uint32_t task_prio)
 {
     events = xEventGroupCreate();
     xTaskCreate(sigrok_thread, "SIGROK", configMINIMAL_STACK_SIZE, NULL, task_prio, &task_sigrok);
+    xTaskCreate(sigrok_encoder_thread, "SIGROK-Enc", configMINIMAL_STACK_SIZE, NULL, task_prio, &task_sigrok_enc);
 
     cdc_sigrok_init(task_prio);
 }   // sigrok_init
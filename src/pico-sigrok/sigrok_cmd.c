@@ -0,0 +1,298 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Command parser of the sigrok-pico protocol.
+ *
+ * Commands arrive via CDC or TCP, the response is left in the device's \a rspstr and sent by the
+ * capture side.  There is no hardware access in here, so the parser is also built for the host tests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "picoprobe_config.h"
+#include "sigrok_int.h"
+#include "sigrok_cmd.h"
+
+
+// CPU clock limits the sample rate, see probe.c
+extern uint32_t probe_get_cpu_freq_khz(void);
+
+
+
+//Process incoming character stream
+//Return true if the device rspstr has a response to send to host
+//Be sure that rspstr does not have \n  or \r.
+bool sigrok_cmd_char(sr_device_t *d, char charin)
+{
+    int tmpint, tmpint2;
+    bool ret = false;
+
+    //set default rspstr for all commands that have a dataless ack
+    d->rspstr[0] = '*';
+    d->rspstr[1] = '\0';
+
+    //the reset character works by itself
+    if (charin == '*') {
+        sigrok_reset(d);
+        Dprintf("sigrok cmd '*' -> RESET %d\n", d->sample_and_send);
+        return false;
+    }
+    else if (charin == '\r'  ||  charin == '\n') {
+        d->cmdstr[d->cmdstr_ndx] = 0;
+        switch (d->cmdstr[0]) {
+            case 'i':
+                // identification
+                // SRPICO,AxxyDzz,02 - num analog, analog size, num digital,version
+                sprintf(d->rspstr, "SRPICO,A%02d1D%02d,02", SR_NUM_A_CHAN, SR_NUM_D_CHAN);
+                ret = true;
+                break;
+
+            case 'R':
+                // sampling rate
+                tmpint = atol(&(d->cmdstr[1]));
+                if (tmpint >= 5000  &&  (uint32_t)tmpint <= 1000 * probe_get_cpu_freq_khz() + 16) { //Add 16 to support cfg_bits
+                    d->sample_rate = tmpint;
+//                    Dprintf("SMPRATE= %lu\n", d->sample_rate);
+                    ret = true;
+                }
+                else {
+//                    Dprintf("unsupported smp rate %s\n", d->cmdstr);
+                    ret = false;
+                }
+                break;
+
+            case 'L':
+                // sample limit
+                tmpint = atol(&(d->cmdstr[1]));
+                if (tmpint > 0) {
+                    d->num_samples = tmpint;
+//                    Dprintf("NUMSMP=%lu\n", d->num_samples);
+                    ret = true;
+                }
+                else {
+//                    Dprintf("bad num samples %s\n", d->cmdstr);
+                    ret = false;
+                }
+                break;
+
+            case 'a':
+                // get analog scale
+                tmpint = atoi(&(d->cmdstr[1])); //extract channel number
+                if (tmpint >= 0) {
+                    //scale and offset are both in integer uVolts
+                    //separated by x
+                    sprintf(d->rspstr, "25700x0");  //3.3/(2^7) and 0V offset
+//                    Dprintf("ASCL%d\n", tmpint);
+                    ret = true;
+                }
+                else {
+//                    Dprintf("bad ascale %s\n", d->cmdstr);
+                    ret = false; //this will return a '*' causing the host to fail
+                }
+                break;
+
+            case 'F':
+                // fixed set of samples
+//                Dprintf("STRT_FIX\n");
+                d->continuous = false;
+                d->buffered   = false;
+                sigrok_tx_init(d);
+                ret = false;
+                break;
+
+            case 'B':
+                // buffered fixed set of samples, data is sent after capture
+//                Dprintf("STRT_BUF\n");
+                d->continuous = false;
+                d->buffered   = true;
+                sigrok_tx_init(d);
+                ret = false;
+                break;
+
+            case 'C':
+                // continuous mode
+//                Dprintf("STRT_CONT\n");
+                d->continuous = true;
+                d->buffered   = false;
+                sigrok_tx_init(d);
+                ret = false;
+                break;
+
+            case 't':
+                // trigger condition - format tvxx where v is 0/1 for level, r/f/e for rising/falling/any edge
+                // and xx is two digit channel.  Condition is added to the current stage
+                tmpint2 = atoi(&(d->cmdstr[2])); //extract channel number
+                if (d->cmdstr_ndx >= 3  &&  tmpint2 >= 0  &&  tmpint2 < SR_NUM_D_CHAN) {
+                    ret = sr_trigger_add(&d->trigger, d->cmdstr[1], tmpint2);
+                }
+                else {
+                    ret = false;
+                }
+//                Dprintf("Trigger %s -> %d\n", d->cmdstr, ret);
+                break;
+
+            case 'T':
+                // next trigger stage, following 't' conditions must match after the current stage has matched
+                ret = sr_trigger_next_stage(&d->trigger);
+                break;
+
+            case 'p':
+                // pretrigger count, limited by the capture buffer at acquisition start
+                tmpint = atoi(&(d->cmdstr[1]));
+                if (tmpint >= 0) {
+                    d->pretrig_samples = tmpint;
+                    ret = true;
+                }
+                else {
+                    ret = false;
+                }
+//                Dprintf("Pre-trigger samples %d cmd %s\n", tmpint, d->cmdstr);
+                break;
+
+            case 'P':
+                // protocol decoder - format Pu<rx>,<baud> / Ps<clk>,<mosi>,<miso>,<cs>,<mode> / Pi<scl>,<sda>, P0 disables.
+                // Decoded frames are sent via the event stream instead of the samples
+#if OPT_EVENT_STREAM
+                ret = sr_decode_config(&d->decoder, &(d->cmdstr[1]), SR_NUM_D_CHAN);
+#else
+                ret = false;
+#endif
+//                Dprintf("Decoder %s -> %d\n", d->cmdstr, ret);
+                break;
+
+            case 'A':
+                // enable analog channel always a set
+                // format is Axyy where x is 0 for disabled, 1 for enabled and yy is channel #
+                tmpint = d->cmdstr[1] - '0'; //extract enable value
+                tmpint2 = atoi(&(d->cmdstr[2])); //extract channel number
+                if (tmpint >= 0  &&  tmpint <= 1  &&  tmpint2 >= 0  &&  tmpint2 <= 31) {  // TODO 31 is max bits
+                    d->a_mask = d->a_mask & ~(1 << tmpint2);
+                    d->a_mask = d->a_mask | (tmpint << tmpint2);
+//                    Dprintf("A%d EN %d Msk 0x%lX\n", tmpint2, tmpint, d->a_mask);
+                    ret = true;
+                }
+                else {
+                    ret = false;
+                }
+                break;
+
+            case 'D':
+                // enable digital channel always a set
+                // format is Dxyy where x is 0 for disabled, 1 for enabled and yy is channel #
+                tmpint = d->cmdstr[1] - '0'; //extract enable value
+                tmpint2 = atoi(&(d->cmdstr[2])); //extract channel number
+                if (tmpint >= 0  &&  tmpint <= 1  &&  tmpint2 >= 0  &&  tmpint2 < SR_NUM_D_CHAN) {
+                    d->d_mask = d->d_mask & ~(1 << tmpint2);
+                    d->d_mask = d->d_mask | (tmpint << tmpint2);
+
+                    d->d_mask_D4 = 0;
+                    for (int i = 0;  i < 8;  ++i) {
+                        d->d_mask_D4 |= (d->d_mask & 0x0f) << (4 * i);
+                    }
+//                    Dprintf("D%d EN %d Msk 0x%lX 0x%lX\n", tmpint2, tmpint, d->d_mask, d->d_mask_D4);
+                    ret = true;
+                }
+                else {
+                    ret = false;
+                }
+                break;
+
+            case 'N':
+                // return channel name
+                // format is N[AD]yy, A=analog, D=digital, yy is channel #
+                ret = false;
+                if (d->cmdstr_ndx >= 4) {
+                    tmpint = atoi(d->cmdstr + 2);
+                    if (d->cmdstr[1] == 'A'  &&  tmpint >= 0  &&  tmpint < SR_NUM_A_CHAN) {
+                        sprintf(d->rspstr, "ADC%d", tmpint);
+                        ret = true;
+                    }
+                    else if (d->cmdstr[1] == 'D'  &&  tmpint >= 0  &&  tmpint < SR_NUM_D_CHAN) {
+                        sprintf(d->rspstr, "GP%d", tmpint + SR_BASE_D_CHAN);
+                        ret = true;
+                    }
+                }
+                else if (d->cmdstr[1] == '?') {
+                    strcpy(d->rspstr, "ok");
+                    ret = true;
+                }
+                break;
+
+            default:
+                Dprintf("bad command %s\n", d->cmdstr);
+                ret = false;
+                break;
+        }
+
+        if (ret) {
+            Dprintf("sigrok cmd '%s' -> '%s' [OK]\n", d->cmdstr, d->rspstr);
+        }
+        else {
+            Dprintf("sigrok cmd '%s' -> '%s'\n", d->cmdstr, d->rspstr);
+        }
+
+        d->cmdstr_ndx = 0;
+    }
+    else {
+        //no CR/LF
+        if (d->cmdstr_ndx >= sizeof(d->cmdstr) - 1) {
+            d->cmdstr[sizeof(d->cmdstr) - 2] = 0;
+            Dprintf("Command overflow %s\n", d->cmdstr);
+            d->cmdstr_ndx = 0;
+        }
+        d->cmdstr[d->cmdstr_ndx++] = charin;
+        ret = false;
+    }
+    //default return 0 means to not send any kind of response
+    return ret;
+}   // sigrok_cmd_char
+
+
+
+void sigrok_cmd_rx(sr_device_t *d, const uint8_t *buf, uint32_t cnt)
+/**
+ * Feed characters from the host into the command parser and notify the capture side after each of them.
+ */
+{
+    for (uint32_t n = 0;  n < cnt;  ++n) {
+        // The '+' is the only character we track during normal sampling because it can end
+        // a continuous trace.  A reset '*' should only be seen after we have completed normally
+        // or hit an error condition.
+        if (buf[n] == '+') {
+            d->sample_and_send = false;
+            d->aborted         = false;        // clear the abort so we stop sending !!
+        }
+        else {
+            if (sigrok_cmd_char(d, (char)buf[n])) {
+                d->send_resp = true;
+            }
+        }
+        sigrok_notify();
+    }
+}   // sigrok_cmd_rx
@@ -0,0 +1,490 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * On-probe protocol decoders for sigrok captures.
+ *
+ * Decoders work on the capture buffer like the encoders, but emit decoded frames instead of samples.
+ * Evaluation is change driven: unchanged 32 bit words of the capture buffer are skipped as a whole,
+ * the protocol state machines see only the samples where one of their channels changes.  UART bits are
+ * sampled at computed bit centers, the level in between two changes is known to be constant.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sigrok_decode.h"
+
+
+#define CH_UART_RX      0
+#define CH_SPI_CLK      0
+#define CH_SPI_MOSI     1
+#define CH_SPI_MISO     2
+#define CH_SPI_CS       3
+#define CH_I2C_SCL      0
+#define CH_I2C_SDA      1
+
+
+
+static inline uint32_t chbit(const sr_decoder_t *dec, uint32_t val, uint32_t n)
+{
+    return (dec->ch[n] >= 0) ? (val >> dec->ch[n]) & 1 : 0;
+}   // chbit
+
+
+
+static void frame_flush(sr_decoder_t *dec)
+{
+    if (dec->frame_len != 0  ||  dec->frame[1] != 0) {
+        dec->frame[0] = (uint8_t)dec->type;
+        dec->emit(dec->emit_ctx, dec->frame_ndx, dec->frame, 2 + dec->frame_len);
+    }
+    dec->frame_len     = 0;
+    dec->frame[1]      = 0;
+    dec->frame_started = false;
+}   // frame_flush
+
+
+
+static void frame_start(sr_decoder_t *dec, uint64_t ndx)
+{
+    dec->frame_ndx     = ndx;
+    dec->frame_started = true;
+}   // frame_start
+
+
+
+static void frame_put(sr_decoder_t *dec, uint64_t ndx, uint8_t b0, uint8_t b1, uint32_t n)
+{
+    if (dec->frame_len + n > SR_DECODE_FRAME_MAX) {
+        frame_flush(dec);
+    }
+    if (dec->frame_len == 0  &&  !dec->frame_started) {
+        dec->frame_ndx = ndx;
+    }
+    dec->frame_started = true;
+    dec->frame[2 + dec->frame_len++] = b0;
+    if (n > 1) {
+        dec->frame[2 + dec->frame_len++] = b1;
+    }
+}   // frame_put
+
+
+
+/// sample index of the center of bit \a k of the current UART character (0 = start bit, 9 = stop bit)
+static inline uint64_t uart_point(const sr_decoder_t *dec, uint32_t k)
+{
+    return dec->bit_start + (((uint64_t)(2 * k + 1) * dec->spb_fp) >> 17);
+}   // uart_point
+
+
+
+/**
+ * Evaluate all UART bit centers before \a limit, RX had \a level up to there.
+ */
+static void uart_resolve(sr_decoder_t *dec, uint64_t limit, uint32_t level)
+{
+    while (dec->active) {
+        uint64_t pt = uart_point(dec, dec->bitcnt);
+
+        if (pt >= limit) {
+            break;
+        }
+        if (dec->bitcnt == 0) {
+            if (level != 0) {
+                // glitch, start bit not valid at its center
+                dec->active = false;
+                break;
+            }
+        }
+        else if (dec->bitcnt <= 8) {
+            dec->sh0 |= level << (dec->bitcnt - 1);
+        }
+        else {
+            frame_put(dec, dec->bit_start, (uint8_t)dec->sh0, 0, 1);
+            if (level == 0) {
+                dec->frame[1] |= SR_DECODE_FLAG_ERROR;
+            }
+            dec->active   = false;
+            dec->idle_end = pt + ((20 * (uint64_t)dec->spb_fp) >> 16);
+            break;
+        }
+        ++dec->bitcnt;
+    }
+
+    if ( !dec->active  &&  dec->frame_len != 0  &&  limit > dec->idle_end) {
+        frame_flush(dec);
+    }
+}   // uart_resolve
+
+
+
+static void uart_change(sr_decoder_t *dec, uint64_t ndx, uint32_t prev, uint32_t val)
+{
+    uint32_t rx_prev = chbit(dec, prev, CH_UART_RX);
+
+    uart_resolve(dec, ndx, rx_prev);
+    if ( !dec->active  &&  rx_prev != 0  &&  chbit(dec, val, CH_UART_RX) == 0) {
+        dec->active    = true;
+        dec->bitcnt    = 0;
+        dec->sh0       = 0;
+        dec->bit_start = ndx;
+    }
+}   // uart_change
+
+
+
+static void spi_change(sr_decoder_t *dec, uint64_t ndx, uint32_t prev, uint32_t val)
+{
+    const uint32_t sample_edge = (dec->spi_mode == 0  ||  dec->spi_mode == 3) ? 1 : 0;
+    uint32_t clk = chbit(dec, val, CH_SPI_CLK);
+    bool sel_prev = dec->ch[CH_SPI_CS] < 0  ||  chbit(dec, prev, CH_SPI_CS) == 0;
+    bool sel      = dec->ch[CH_SPI_CS] < 0  ||  chbit(dec, val, CH_SPI_CS) == 0;
+
+    if (sel_prev  &&  clk != chbit(dec, prev, CH_SPI_CLK)  &&  clk == sample_edge) {
+        dec->sh0 = (dec->sh0 << 1) | chbit(dec, val, CH_SPI_MOSI);
+        dec->sh1 = (dec->sh1 << 1) | chbit(dec, val, CH_SPI_MISO);
+        if (++dec->bitcnt >= 8) {
+            frame_put(dec, ndx, (uint8_t)dec->sh0, (uint8_t)dec->sh1, 2);
+            dec->bitcnt = 0;
+            dec->sh0    = 0;
+            dec->sh1    = 0;
+        }
+    }
+
+    if (sel != sel_prev) {
+        if (sel) {
+            frame_start(dec, ndx);
+        }
+        else {
+            if (dec->bitcnt != 0) {
+                dec->frame[1] |= SR_DECODE_FLAG_ERROR;
+            }
+            frame_flush(dec);
+        }
+        dec->bitcnt = 0;
+        dec->sh0    = 0;
+        dec->sh1    = 0;
+    }
+}   // spi_change
+
+
+
+static void i2c_change(sr_decoder_t *dec, uint64_t ndx, uint32_t prev, uint32_t val)
+{
+    uint32_t scl_prev = chbit(dec, prev, CH_I2C_SCL);
+    uint32_t scl      = chbit(dec, val, CH_I2C_SCL);
+    uint32_t sda_prev = chbit(dec, prev, CH_I2C_SDA);
+    uint32_t sda      = chbit(dec, val, CH_I2C_SDA);
+
+    if (scl_prev  &&  scl  &&  sda != sda_prev) {
+        // the SCL rise in front of START/STOP has already been taken as a data bit
+        if (dec->active  &&  dec->bitcnt > 1) {
+            dec->frame[1] |= SR_DECODE_FLAG_ERROR;
+        }
+        if (sda == 0) {
+            // (repeated) START
+            if (dec->active) {
+                dec->frame[1] |= SR_DECODE_FLAG_RESTART;
+                frame_flush(dec);
+            }
+            frame_start(dec, ndx);
+            dec->active = true;
+        }
+        else if (dec->active) {
+            // STOP
+            frame_flush(dec);
+            dec->active = false;
+        }
+        dec->bitcnt = 0;
+        dec->sh0    = 0;
+    }
+    else if (dec->active  &&  !scl_prev  &&  scl) {
+        if (dec->bitcnt < 8) {
+            dec->sh0 = (dec->sh0 << 1) | sda;
+            ++dec->bitcnt;
+        }
+        else {
+            frame_put(dec, ndx, (uint8_t)dec->sh0, (uint8_t)sda, 2);
+            dec->bitcnt = 0;
+            dec->sh0    = 0;
+        }
+    }
+}   // i2c_change
+
+
+
+static inline __attribute__((always_inline)) uint32_t get_sample(const uint8_t *buf, const uint32_t bps, uint32_t ndx)
+{
+    if (bps == 0) {
+        return (buf[ndx >> 1] >> (4 * (ndx & 1))) & 0x0f;
+    }
+    else if (bps == 1) {
+        return buf[ndx];
+    }
+    else if (bps == 2) {
+        return ((const uint16_t *)buf)[ndx];
+    }
+    return ((const uint32_t *)buf)[ndx];
+}   // get_sample
+
+
+
+/**
+ * Scan loop, instantiated for each sample size so that the compiler can resolve \a bps.
+ */
+static inline __attribute__((always_inline)) void scan(sr_decoder_t *dec, const uint8_t *buf, const uint32_t bps,
+                                                       uint32_t samples)
+{
+    const uint32_t per_word = (bps == 0) ? 8 : 4 / bps;
+    const uint32_t rep = (bps == 0) ? 0x11111111 : ((bps == 1) ? 0x01010101 : ((bps == 2) ? 0x00010001 : 0x00000001));
+    const uint32_t mask = sr_decode_mask(dec);
+    const uint32_t wmask = mask * rep;
+    uint32_t last = dec->last;
+    uint32_t i = 0;
+
+    if ( !dec->primed  &&  samples != 0) {
+        last = get_sample(buf, bps, 0) & mask;
+        dec->primed = true;
+    }
+
+    while (i < samples) {
+        uint32_t val;
+
+        if ((i & (per_word - 1)) == 0  &&  i + per_word <= samples) {
+            if ((((const uint32_t *)buf)[i / per_word] & wmask) == last * rep) {
+                i += per_word;
+                continue;
+            }
+        }
+
+        val = get_sample(buf, bps, i) & mask;
+        if (val != last) {
+            if (dec->type == SR_DECODE_UART) {
+                uart_change(dec, dec->ndx + i, last, val);
+            }
+            else if (dec->type == SR_DECODE_SPI) {
+                spi_change(dec, dec->ndx + i, last, val);
+            }
+            else {
+                i2c_change(dec, dec->ndx + i, last, val);
+            }
+            last = val;
+        }
+        ++i;
+    }
+    dec->last = last;
+    dec->ndx += samples;
+}   // scan
+
+
+
+void sr_decode_clear(sr_decoder_t *dec)
+{
+    memset(dec, 0, sizeof(*dec));
+}   // sr_decode_clear
+
+
+
+static bool ch_valid(long ch, uint32_t num_chan, bool optional)
+{
+    return (ch >= 0  &&  ch < (long)num_chan)  ||  (optional  &&  ch == -1);
+}   // ch_valid
+
+
+
+/**
+ * Set the decoder from a configuration string:
+ * - "0" or "": off
+ * - "u<rx>,<baudrate>": UART
+ * - "s<clk>,<mosi>,<miso>,<cs>,<mode>": SPI, MOSI/MISO/CS can be -1 (unused)
+ * - "i<scl>,<sda>": I2C
+ *
+ * \return false if the string is invalid, the decoder is unchanged in this case
+ */
+bool sr_decode_config(sr_decoder_t *dec, const char *cfg, uint32_t num_chan)
+{
+    long v[5];
+    int cnt;
+    const char *p;
+    char *end;
+
+    if (cfg[0] == '\0'  ||  (cfg[0] == '0'  &&  cfg[1] == '\0')) {
+        sr_decode_clear(dec);
+        return true;
+    }
+
+    p = cfg + 1;
+    for (cnt = 0;  cnt < 5  &&  *p != '\0';  ++cnt) {
+        v[cnt] = strtol(p, &end, 10);
+        if (end == p  ||  (*end != ','  &&  *end != '\0')) {
+            return false;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    if (cfg[0] == 'u'  &&  cnt == 2  &&  ch_valid(v[0], num_chan, false)  &&  v[1] > 0) {
+        sr_decode_clear(dec);
+        dec->type     = SR_DECODE_UART;
+        dec->ch[0]    = v[0];
+        dec->ch[1]    = dec->ch[2] = dec->ch[3] = -1;
+        dec->baudrate = v[1];
+        return true;
+    }
+    if (cfg[0] == 's'  &&  cnt == 5  &&  ch_valid(v[0], num_chan, false)
+        &&  ch_valid(v[1], num_chan, true)  &&  ch_valid(v[2], num_chan, true)  &&  ch_valid(v[3], num_chan, true)
+        &&  (v[1] >= 0  ||  v[2] >= 0)  &&  v[4] >= 0  &&  v[4] <= 3) {
+        sr_decode_clear(dec);
+        dec->type     = SR_DECODE_SPI;
+        dec->ch[0]    = v[0];
+        dec->ch[1]    = v[1];
+        dec->ch[2]    = v[2];
+        dec->ch[3]    = v[3];
+        dec->spi_mode = v[4];
+        return true;
+    }
+    if (cfg[0] == 'i'  &&  cnt == 2  &&  ch_valid(v[0], num_chan, false)  &&  ch_valid(v[1], num_chan, false)) {
+        sr_decode_clear(dec);
+        dec->type     = SR_DECODE_I2C;
+        dec->ch[0]    = v[0];
+        dec->ch[1]    = v[1];
+        dec->ch[2]    = dec->ch[3] = -1;
+        return true;
+    }
+    return false;
+}   // sr_decode_config
+
+
+
+bool sr_decode_is_active(const sr_decoder_t *dec)
+{
+    return dec->type != SR_DECODE_NONE;
+}   // sr_decode_is_active
+
+
+
+/// channels used by the decoder
+uint32_t sr_decode_mask(const sr_decoder_t *dec)
+{
+    uint32_t mask = 0;
+
+    for (uint32_t n = 0;  n < sizeof(dec->ch);  ++n) {
+        if (dec->ch[n] >= 0) {
+            mask |= 1u << dec->ch[n];
+        }
+    }
+    return mask;
+}   // sr_decode_mask
+
+
+
+/**
+ * Reset the evaluation state before a capture.
+ *
+ * \return false if the sample rate is too low for the UART baudrate (less than 4 samples per bit)
+ */
+bool sr_decode_start(sr_decoder_t *dec, uint32_t sample_rate, sr_decode_emit_t emit, void *ctx)
+{
+    if (dec->type == SR_DECODE_NONE) {
+        return false;
+    }
+    if (dec->type == SR_DECODE_UART) {
+        dec->spb_fp = ((uint64_t)sample_rate << 16) / dec->baudrate;
+        if (dec->spb_fp < (4 << 16)) {
+            return false;
+        }
+    }
+    dec->emit          = emit;
+    dec->emit_ctx      = ctx;
+    dec->ndx           = 0;
+    dec->last          = 0;
+    dec->primed        = false;
+    dec->active        = false;
+    dec->bitcnt        = 0;
+    dec->sh0           = 0;
+    dec->sh1           = 0;
+    dec->idle_end      = 0;
+    dec->frame_len     = 0;
+    dec->frame[1]      = 0;
+    dec->frame_started = false;
+    return true;
+}   // sr_decode_start
+
+
+
+/**
+ * Decode the next \a samples samples.
+ *
+ * \param buf      sample data, must be word aligned
+ * \param bps      bytes per sample as stored by DMA: 1, 2, 4 or 0 for 4 bit samples (two per byte, low nibble first)
+ */
+void sr_decode_samples(sr_decoder_t *dec, const uint8_t *buf, uint32_t bps, uint32_t samples)
+{
+    if (bps == 0) {
+        scan(dec, buf, 0, samples);
+    }
+    else if (bps == 1) {
+        scan(dec, buf, 1, samples);
+    }
+    else if (bps == 2) {
+        scan(dec, buf, 2, samples);
+    }
+    else {
+        scan(dec, buf, 4, samples);
+    }
+
+    if (dec->type == SR_DECODE_UART) {
+        // bit centers up to the end of the data are known now
+        uart_resolve(dec, dec->ndx, chbit(dec, dec->last, CH_UART_RX));
+    }
+}   // sr_decode_samples
+
+
+
+/**
+ * Emit the frame under construction at the end of a capture.  An incomplete character/byte is dropped.
+ */
+void sr_decode_flush(sr_decoder_t *dec)
+{
+    if (dec->emit != NULL) {
+        frame_flush(dec);
+    }
+}   // sr_decode_flush
+
+
+
+/**
+ * Sample index before which all frames have been emitted.
+ */
+uint64_t sr_decode_pending(const sr_decoder_t *dec)
+{
+    if (dec->frame_len != 0  ||  dec->frame_started) {
+        return dec->frame_ndx;
+    }
+    if (dec->type == SR_DECODE_UART  &&  dec->active) {
+        return dec->bit_start;
+    }
+    return dec->ndx;
+}   // sr_decode_pending
@@ -0,0 +1,115 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SIGROK_DECODE_H
+#define SIGROK_DECODE_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+typedef enum {
+    SR_DECODE_NONE = 0,
+    SR_DECODE_UART,                                  //!< UART 8N1, LSB first
+    SR_DECODE_SPI,                                   //!< SPI with 8 bit words, MSB first
+    SR_DECODE_I2C,                                   //!< I2C
+} sr_decode_type_t;
+
+
+/**
+ * Decoded frame, all values are little endian:
+ *
+ * offset  size
+ *    0      1    decoder, see \a sr_decode_type_t
+ *    1      1    flags SR_DECODE_FLAG_*
+ *    2      n    data
+ *                - UART: received bytes, frame ends after an idle time of two characters
+ *                - SPI:  pairs of MOSI/MISO bytes, frame ends with CS deassert
+ *                - I2C:  pairs of byte/ACK bit (0 = ACK, 1 = NAK), the first byte is the address,
+ *                        frame ends with STOP or repeated START
+ *
+ * Frames are also split if data exceeds SR_DECODE_FRAME_MAX.
+ */
+#define SR_DECODE_FRAME_MAX        64
+
+#define SR_DECODE_FLAG_ERROR       0x01              //!< UART framing error, incomplete SPI/I2C byte
+#define SR_DECODE_FLAG_RESTART     0x02              //!< I2C frame ended with a repeated START
+
+
+/// output of a decoded frame, \a ndx is the sample index of its beginning
+typedef void (*sr_decode_emit_t)(void *ctx, uint64_t ndx, const uint8_t *frame, uint32_t len);
+
+
+typedef struct {
+    // configuration
+    sr_decode_type_t type;
+    int8_t   ch[4];                                  //!< UART: RX | SPI: CLK, MOSI, MISO, CS | I2C: SCL, SDA; -1 -> unused
+    uint8_t  spi_mode;                               //!< SPI mode 0..3
+    uint32_t baudrate;                               //!< UART baudrate
+
+    // set by sr_decode_start()
+    sr_decode_emit_t emit;
+    void    *emit_ctx;
+    uint32_t spb_fp;                                 //!< UART samples per bit, 16.16 fixed point
+
+    // evaluation state
+    uint64_t ndx;                                    //!< index of the next sample
+    uint32_t last;                                   //!< last sample (decoder channels only)
+    bool     primed;                                 //!< \a last is valid
+    bool     active;                                 //!< UART: receiving a character, I2C: inside a transaction
+    uint32_t bitcnt;
+    uint32_t sh0, sh1;                               //!< shift registers
+    uint64_t bit_start;                              //!< UART: start of the start bit
+    uint64_t idle_end;                               //!< UART: end of the idle time which ends a frame
+
+    // frame under construction
+    uint64_t frame_ndx;
+    bool     frame_started;                          //!< frame has been opened by CS assert / START
+    uint32_t frame_len;
+    uint8_t  frame[2 + SR_DECODE_FRAME_MAX];
+} sr_decoder_t;
+
+
+void     sr_decode_clear(sr_decoder_t *dec);
+bool     sr_decode_config(sr_decoder_t *dec, const char *cfg, uint32_t num_chan);
+bool     sr_decode_is_active(const sr_decoder_t *dec);
+uint32_t sr_decode_mask(const sr_decoder_t *dec);
+bool     sr_decode_start(sr_decoder_t *dec, uint32_t sample_rate, sr_decode_emit_t emit, void *ctx);
+void     sr_decode_samples(sr_decoder_t *dec, const uint8_t *buf, uint32_t bps, uint32_t samples);
+void     sr_decode_flush(sr_decoder_t *dec);
+uint64_t sr_decode_pending(const sr_decoder_t *dec);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
@@ -0,0 +1,550 @@
+//Raspberry Pi PICO/RP2040 code to implement a logic analyzer and oscilloscope
+
+/**
+ * Some Original code from the pico examples project:
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * Slice encoders of the sigrok-pico protocol.
+ *
+ * The encoders take the samples of a DMA segment out of the capture buffer and hand the
+ * encoded bytes to sigrok_tx_write().  There is no hardware access in here, so the encoders
+ * are also built for the host tests and benchmarks.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "picoprobe_config.h"
+#include "sigrok_int.h"
+#include "sigrok_encode.h"
+
+
+//These two enable debug print outs of D4 generation, D4_DBG2 are consider higher verbosity
+//#define D4_DBG 1
+//#define D4_DBG2 2
+
+
+/// transmit buffer to USB
+static uint8_t  txbuf[TX_BUF_SIZE];
+
+/// index into \a txbuf
+static uint16_t txbufidx;
+
+/// send threshold for \a txbuf, TX_BUF_THRESH or TX_BUF_THRESH_NET
+uint16_t txbufthresh = TX_BUF_THRESH;
+
+/// read index into \a capture_buf
+static uint32_t rxbufdidx;
+
+/// counter for RLE encoding
+static uint32_t rlecnt;
+
+/// count of characters sent via USB
+uint32_t sent_cnt;
+
+/// Number of bytes stored as DMA per slice, must be 1,2 or 4 to support aligned access
+/// This will be be zero for 1-4 digital channels.
+uint8_t d_dma_bps;
+
+/// remaining samples in this segment, conunts down from sr_dev::samples_per_seg
+static uint32_t samp_remain;
+
+// last and current digital sample values - required for RLE encoding
+static uint32_t lval, cval;
+
+
+
+//This is an optimized transmit of trace data for configurations with 4 or fewer digital channels
+//and no analog.  Run length encoding (RLE) is used to send counts of repeated values to efficiently utilize
+//USB CDC link bandwidth.  This is the only mode where a given serial byte can have both sample information
+//and RLE counts.
+//Samples from PIO are dma'd in 32 bit words, each containing 8 samples of 4 bits (1 nibble).
+//RLE Encoding:
+//Values 0x80-0xFF encode an rle cnt of a previous value with a new value:
+//  Bit 7 is 1 to distinguish from the rle only values.
+//  Bits 6:4 indicate a run length up to 7 cycles of the previous value
+//  Bits 3:0 are the new value.
+//For longer runs, an RLE only encoding uses decimal values 48 to 127 (0x30 to 0x7F)
+//as x8 run length values of 8..640.
+//All other ASCII values (except from the abort and the end of run byte_cnt) are reserved.
+static void __TIME_CRITICAL_FUNCTION(send_slices_D4)(sr_device_t *d, uint8_t *dbuf, uint32_t samples)
+{
+    uint8_t nibcurr,niblast;
+    uint32_t cword,lword; //current and last word
+    uint32_t *cptr;
+
+    txbufidx = 0;
+    //Don't optimize the first word (eight samples) perfectly, just send them to make the for loop easier,
+    //and setup the initial conditions for rle tracking
+    cptr = (uint32_t *)&(dbuf[0]);
+    cword = *cptr & d->d_mask_D4;
+#ifdef D4_DBG
+    Dprintf("Dbuf %p cptr %p data 0x%X\n",(void *)&(dbuf[0]),(void *) cptr,cword);
+#endif
+    lword = cword;
+    for (int j = 0;  j < 8;  j++) {
+        nibcurr = cword & 0x0f;
+        txbuf[j] = nibcurr | 0x80;
+        cword >>= 4;
+    }
+    niblast = nibcurr;
+    cptr = (uint32_t *)&(txbuf[0]);
+    txbufidx = 8;
+    rxbufdidx = 4;
+    rlecnt = 0;
+
+    //If in fixed sample (non-continous mode) only send the amount of samples requested.
+    //Whole words are sent, so the last word of a fixed capture may carry up to 7 samples more.
+    if ( !d->continuous  &&  d->scnt + samples > d->num_samples) {
+        samples = d->num_samples - d->scnt;
+    }
+    d->scnt += samples;
+
+    if (samples <= 8) {
+        sigrok_tx_write(txbuf, txbufidx);
+        sent_cnt += txbufidx;
+        return;
+    }
+    //chngcnt=8;
+    //The total number of 4 bit samples remaining to process from this segment.
+    //Subtract 8 because we processed the word above and round up to whole words.
+    samp_remain = (samples - 8 + 7) & ~7u;
+    //Process one  word (8 samples) at a time.
+    for (uint32_t i = 0;  i < (samp_remain >> 3);  i++) {
+        cptr = (uint32_t *)&(dbuf[rxbufdidx]);
+        cword = *cptr & d->d_mask_D4;
+        rxbufdidx += 4;
+#ifdef D4_DBG2
+        Dprintf("dbuf0 %p dbufr %p cptr %p\n",dbuf,&(dbuf[rxbufdidx]),cptr);
+#endif
+        //Send maximal RLE counts in this outer section to the txbuf, and if we accumulate a few of them
+        //push to the device so that we don't accumulate large numbers
+        //of unsent RLEs.  That allows the host to process them gradually rather than in a flood
+        //when we get a value change.
+        while (rlecnt >= 640) {
+            txbuf[txbufidx++] = 127;
+            rlecnt -= 640;
+            if (txbufidx > 3){
+                sigrok_tx_write(txbuf, txbufidx);
+                sent_cnt += txbufidx;
+                txbufidx = 0;
+            }
+        }
+        //Coarse rle looks across the full word and allows a faster compare in cases with low activity factors
+        //We must make sure cword==lword and that all nibbles of cword are the same
+        if (cword == lword  &&  (cword >> 4) == (cword & 0x0FFFFFFF)) {
+            rlecnt += 8;
+#ifdef D4_DBG2
+            Dprintf("coarse word 0x%lX\n", cword);
+#endif
+        }
+        else {//if coarse rle didn't match
+#ifdef D4_DBG2
+            Dprintf("cword 0x%lX nibcurr 0x%X i %d rx idx %lu  rlecnt %lu\n", cword, nibcurr, i, rxbufdidx, rlecnt);
+#endif
+            lword = cword;
+            for (int j = 0;  j < 8;  j++) { //process all 8 nibbles
+                nibcurr = cword & 0x0f;
+                if (nibcurr == niblast) {
+                    rlecnt++;
+                }
+                else{
+                    //If the value changes we must push all remaining rles to the txbuf
+                    //chngcnt++;
+                    //Send intermediate 8..632 RLEs
+                    if (rlecnt > 7) {
+                        int rlemid = rlecnt & 0x3F8;
+                        txbuf[txbufidx++] = (rlemid >> 3) + 47;
+                    }
+                    //And finally the 0..7 rle along with the new value
+                    rlecnt &= 0x7;
+#ifdef D4_DBG2 //print when sample value changes
+                    Dprintf("VChang val 0x%X rlecnt %ld i%d j%d\n", nibcurr, rlecnt, i, j);
+#endif
+                    txbuf[txbufidx++] = 0x80 | nibcurr | (rlecnt << 4);
+                    rlecnt = 0;
+                }//nibcurr!=last
+                cword >>= 4;
+                niblast = nibcurr;
+            }
+        }
+#ifdef D4_DBG2
+        Dprintf("i %d rx idx %lu  rlecnt %lu\n", i, rxbufdidx, rlecnt);
+        Dprintf("i %u tx idx %d bufs 0x%X 0x%X 0x%X\n", i, txbufidx, txbuf[txbufidx-3], txbuf[txbufidx-2], txbuf[txbufidx-1]);
+#endif
+        //Emperically found that transmitting groups of around 32B gives optimum bandwidth
+        if (txbufidx >= txbufthresh) {
+            sigrok_tx_write(txbuf, txbufidx);
+            sent_cnt += txbufidx;
+            txbufidx = 0;
+        }
+    }//for i in samp_send>>3
+    //At the end of processing the segment send any residual samples as we don't maintain state between the segments
+    //Maximal 640 values first
+    while (rlecnt >= 640) {
+        txbuf[txbufidx++] = 127;
+        rlecnt -= 640;
+    }
+    //Middle rles 8..632
+    if (rlecnt > 7) {
+        int rleend = rlecnt & 0x3F8;
+        txbuf[txbufidx++] = (rleend >> 3) + 47;
+    }
+    //1..7 RLE
+    //The rle and value encoding counts as both a sample count of rle and a new sample
+    //thus we must decrement rlecnt by 1 and resend the current value which will match the previous values
+    //(if the current value didn't match, the rlecnt would be 0).
+    //Multiples of 8 have been sent completely above.
+    rlecnt &= 0x7;
+    if (rlecnt != 0) {
+        rlecnt--;
+        txbuf[txbufidx++] = 0x80 | nibcurr | (rlecnt << 4);
+        rlecnt = 0;
+    }
+    if (txbufidx != 0) {
+        sigrok_tx_write(txbuf, txbufidx);
+        sent_cnt += txbufidx;
+        txbufidx = 0;
+    }
+}   // send_slices_D4
+
+
+
+//Send a digital sample of multiple bytes with the 7 bit encoding
+static inline void tx_d_samp(sr_device_t *d, uint32_t cval)
+{
+    for (uint32_t b = 0;  b < d->d_tx_bps;  b++) {
+        txbuf[txbufidx++] = cval | 0x80;
+        cval >>= 7;
+    }
+}   // tx_d_samp
+
+
+
+//Allow for 1,2 or 4B reads of sample data to reduce memory read overhead when
+//parsing digital sample data.  This function is correct for all uses, but if included
+//the compiled code is substantially slower to the point that digital only transfers
+//can't keep up with USB rate.  Thus it is only used by the send_slices_analog which is already
+//limited to 500khz, and in the starting send_slice_init.
+//
+// not used for D4 mode!
+//
+static uint32_t __TIME_CRITICAL_FUNCTION(get_cval)(uint8_t *dbuf)
+{
+    uint32_t cval;
+
+    if (d_dma_bps == 1) {
+        cval = dbuf[rxbufdidx];
+        cval &= sr_dev.d_mask;
+    }
+    else if (d_dma_bps == 2) {
+        cval = (*((uint16_t *)(dbuf + rxbufdidx)));
+        cval &= sr_dev.d_mask;
+    }
+    else {
+        cval = (*((uint32_t *)(dbuf + rxbufdidx)));
+        cval &= sr_dev.d_mask;
+    }
+    rxbufdidx += d_dma_bps;
+    return cval;
+}   // get_cval
+
+
+
+/*RLE encoding for 5-21 channels has two ranges.
+Decimal 48 to  79 are RLEs of 1 to 32 respectively.
+Decimal 80 to 127 are (N-78)*32 thus 64,96..80,120..1568
+Note that it is the responsibility of the caller to
+forward txbuf bytes to USB to prevent txbufidx from overflowing the size
+of txbuf. We do not always push to USB to reduce its impact
+on performance.
+ */
+static void __TIME_CRITICAL_FUNCTION(check_rle)(void)
+{
+    while (rlecnt >= 1568) {
+        txbuf[txbufidx++] = 127;
+        rlecnt -= 1568;
+    }
+    if (rlecnt > 32) {
+        uint16_t rlediv = rlecnt >> 5;
+        txbuf[txbufidx++] = rlediv + 78;//was 86;
+        rlecnt -= rlediv << 5;
+    }
+    if (rlecnt) {
+        txbuf[txbufidx++] = 47 + rlecnt;
+        rlecnt = 0;
+    }
+}   // check_rle
+
+
+
+//Send txbuf to usb based on an input threshold
+static void __TIME_CRITICAL_FUNCTION(check_tx_buf)(uint16_t cnt)
+{
+    if (txbufidx >= cnt) {
+        sigrok_tx_write(txbuf, txbufidx);
+        sent_cnt += txbufidx;
+        txbufidx = 0;
+    }
+}   // check_tx_buf
+
+
+
+//Common init for send_slices_1B/2B/4B, but not D4 or analog
+static void __TIME_CRITICAL_FUNCTION(send_slice_init)(sr_device_t *d, uint8_t *dbuf, uint32_t samples)
+{
+    rxbufdidx = 0;
+    //Adjust the number of samples to send if there are more in the dma buffer
+    //then we need.
+    samp_remain = samples;
+    if ( !d->continuous  &&  d->scnt + samp_remain > d->num_samples) {
+        samp_remain = d->num_samples - d->scnt;
+        d->scnt += samp_remain;
+    }
+    else {
+        d->scnt += samples;
+    }
+    txbufidx = 0;
+    //Always send the first sample to establish a previous value for RLE
+    //the use of get_cval is inefficient, but only done once per segment
+    lval = get_cval(dbuf);
+    tx_d_samp(d, lval);
+    samp_remain--;
+    rlecnt = 0;
+}   // send_slice_init
+
+
+
+//RLE step for one digital slice of send_slices_1B/2B/4B: equal values only increment the RLE count,
+//a changed value flushes the count and sends the new value.
+static inline __attribute__((always_inline)) void rle_d_samp(sr_device_t *d, uint32_t val)
+{
+    if (val == lval) {
+        rlecnt++;
+    }
+    else {
+        check_rle();
+        tx_d_samp(d, val);
+        check_tx_buf(txbufthresh);
+        lval = val;
+    }
+}   // rle_d_samp
+
+
+
+//There are three very similar functions send_slices_1B/2B/4B.
+//Each of which  is very similar but exist because if a common function
+//is used with the get_cval in the inner loop, the performance drops
+//substantially.  Thus each function has a 1,2, or 4B aligned read respectively.
+//We can just always read a 4B value because the core doesn't support non-aligned accesses.
+//These must be marked noinline to ensure they remain separate functions for good performance
+//
+//Change detection is done word parallel: one aligned 32 bit read holds 4 (1B) or 2 (2B) slices,
+//for 4B two words are checked together.  If all slices of the word(s) equal the last value, they
+//are simply added to the RLE count, otherwise the slices are run through rle_d_samp() one by one.
+//Transmit format is the same as for the per slice operation (see check_rle()), so the host side is unchanged.
+//Segments are word aligned, but with a trigger encoding may start anywhere in a segment.  So after the
+//first slice from send_slice_init() at most three (1B) or one (2B) slices have to be handled separately to get aligned.
+//
+//1B is 5-8 channels
+static void __TIME_CRITICAL_FUNCTION(send_slices_1B)(sr_device_t *d, uint8_t *dbuf, uint32_t samples)
+{
+    const uint32_t mask = sr_dev.d_mask * 0x01010101;
+    uint32_t remain;
+    uint32_t lword;
+    uint32_t w;
+
+    send_slice_init(d, dbuf, samples);
+    remain = samp_remain;
+    while (remain != 0  &&  ((uintptr_t)(dbuf + rxbufdidx) & 3) != 0) {
+        rle_d_samp(d, dbuf[rxbufdidx++] & sr_dev.d_mask);
+        remain--;
+    }
+    lword = lval * 0x01010101;
+    for ( ;  remain >= 4;  remain -= 4) {
+        w = *((uint32_t *)(dbuf + rxbufdidx)) & mask;
+        rxbufdidx += 4;
+        if (w == lword) {
+            rlecnt += 4;
+        }
+        else {
+            for (int j = 0;  j < 4;  j++) {
+                rle_d_samp(d, w & 0xff);
+                w >>= 8;
+            }
+            lword = lval * 0x01010101;
+        }
+    }
+    while (remain != 0) {
+        rle_d_samp(d, dbuf[rxbufdidx++] & sr_dev.d_mask);
+        remain--;
+    }
+    check_rle();
+    check_tx_buf(1);
+}   // send_slices_1B
+
+
+
+//2B is 9-16 channels
+static void __TIME_CRITICAL_FUNCTION(send_slices_2B)(sr_device_t *d, uint8_t *dbuf, uint32_t samples)
+{
+    const uint32_t mask = sr_dev.d_mask * 0x00010001;
+    uint32_t remain;
+    uint32_t lword;
+    uint32_t w;
+
+    send_slice_init(d, dbuf, samples);
+    remain = samp_remain;
+    if (remain != 0  &&  ((uintptr_t)(dbuf + rxbufdidx) & 3) != 0) {
+        rle_d_samp(d, *((uint16_t *)(dbuf + rxbufdidx)) & sr_dev.d_mask);
+        rxbufdidx += 2;
+        remain--;
+    }
+    lword = lval * 0x00010001;
+    for ( ;  remain >= 2;  remain -= 2) {
+        w = *((uint32_t *)(dbuf + rxbufdidx)) & mask;
+        rxbufdidx += 4;
+        if (w == lword) {
+            rlecnt += 2;
+        }
+        else {
+            rle_d_samp(d, w & 0xffff);
+            rle_d_samp(d, w >> 16);
+            lword = lval * 0x00010001;
+        }
+    }
+    if (remain != 0) {
+        rle_d_samp(d, *((uint16_t *)(dbuf + rxbufdidx)) & sr_dev.d_mask);
+        rxbufdidx += 2;
+    }
+    check_rle();
+    check_tx_buf(1);
+}   // send_slices_2B
+
+
+
+//4B is 17-21 channels and is the only one that must mask invalid bits which are captured by DMA
+static void __TIME_CRITICAL_FUNCTION(send_slices_4B)(sr_device_t *d, uint8_t *dbuf, uint32_t samples)
+{
+    const uint32_t mask = sr_dev.d_mask;
+    uint32_t remain;
+    uint32_t *wptr;
+
+    send_slice_init(d, dbuf, samples);
+    remain = samp_remain;
+    wptr = (uint32_t *)(dbuf + rxbufdidx);
+    for ( ;  remain >= 2;  remain -= 2) {
+        uint32_t w0 = wptr[0];
+        uint32_t w1 = wptr[1];
+
+        wptr += 2;
+        if (((w0 ^ lval) | (w1 ^ lval)) & mask) {
+            rle_d_samp(d, w0 & mask);
+            rle_d_samp(d, w1 & mask);
+        }
+        else {
+            rlecnt += 2;
+        }
+    }
+    if (remain != 0) {
+        rle_d_samp(d, *wptr++ & mask);
+    }
+    rxbufdidx = (uint8_t *)wptr - dbuf;
+    check_rle();
+    check_tx_buf(1);
+}   // send_slices_4B
+
+
+
+//Slice transmit code, used for all cases with any analog channels
+//All digital channels for one slice are sent first in 7 bit bytes using values 0x80 to 0xFF
+//Analog channels are sent next, with each channel taking one 7 bit byte using values 0x80 to 0xFF.
+//This does not support run length encoding because it's not clear how to define RLE on analog signals
+static void __TIME_CRITICAL_FUNCTION(send_slices_analog)(sr_device_t *d, uint8_t *dbuf, uint8_t *abuf, uint32_t samples)
+{
+    uint32_t rxbufaidx = 0;
+
+    rxbufdidx = 0;
+    samp_remain = samples;
+    if ( !d->continuous  &&  d->scnt + samp_remain > d->num_samples) {
+        samp_remain = d->num_samples - d->scnt;
+        d->scnt += samp_remain;
+    }
+    else {
+        d->scnt += samples;
+    }
+    txbufidx = 0;
+    for (uint32_t s = 0;  s < samp_remain;  s++) {
+        if (d->d_mask != 0) {
+            cval = get_cval(dbuf);
+            tx_d_samp(d, cval);
+//            Dprintf("s %d cv %lX bps %d idx t %d r %ld\n", s, cval, d_dma_bps, txbufidx, rxbufdidx);
+        }
+        for (uint32_t i = 0;  i < d->a_chan_cnt;  i++) {
+            txbuf[txbufidx] = (abuf[rxbufaidx] >> 1) | 0x80;
+            txbufidx++;
+            rxbufaidx++;
+//            Dprintf("av %X cnt %d idx t %d r %ld\n", abuf[rxbufaidx-1], d->a_chan_cnt, txbufidx, rxbufaidx);
+        }
+        //Since this doesn't support RLEs we don't need to buffer
+        //extra bytes to prevent txbuf overflow, but this value
+        //works well anyway
+        check_tx_buf(txbufthresh);
+    }
+    check_tx_buf(1);
+}   // send_slices_analog
+
+
+
+/**
+ * Encode and transmit \a samples slices.  \a dbuf and \a abuf point to the first digital and analog
+ * sample in the capture buffer.  In D4 mode \a dbuf must be word aligned.
+ */
+void __TIME_CRITICAL_FUNCTION(sigrok_encode_slices)(sr_device_t *d, uint8_t *dbuf, uint8_t *abuf, uint32_t samples)
+{
+    if (d->a_mask != 0) {
+        send_slices_analog(d, dbuf, abuf, samples);
+    }
+    else if (d_dma_bps == 0) {
+        send_slices_D4(d, dbuf, samples);
+    }
+    else if (d_dma_bps == 1) {
+        send_slices_1B(d, dbuf, samples);
+    }
+    else if (d_dma_bps == 2) {
+        send_slices_2B(d, dbuf, samples);
+    }
+    else {
+        send_slices_4B(d, dbuf, samples);
+    }
+}   // sigrok_encode_slices
+
+
+
+/// address of the digital samples of segment \a seg starting at sample \a first in the capture buffer \a buf
+uint8_t *sigrok_seg_d_addr(const sr_device_t *d, uint8_t *buf, uint32_t seg, uint32_t first)
+{
+    return &(buf[d->dbuf_start + seg * d->d_size + ((d_dma_bps == 0) ? first / 2 : first * d_dma_bps)]);
+}   // sigrok_seg_d_addr
+
+
+
+/**
+ * Encode and transmit the samples [first, first+samples) of a completed segment of the capture buffer \a buf.
+ * In D4 mode \a first must be a multiple of 8.  Sampling ends if a fixed capture has sent all of its samples.
+ */
+void __TIME_CRITICAL_FUNCTION(sigrok_encode_segment)(sr_device_t *d, uint8_t *buf, uint32_t seg, uint32_t first, uint32_t samples)
+{
+    uint8_t *d_start_addr = sigrok_seg_d_addr(d, buf, seg, first);
+    uint8_t *a_start_addr = &(buf[d->abuf_start + seg * d->a_size + first * d->a_chan_cnt]);
+
+    sigrok_encode_slices(d, d_start_addr, a_start_addr, samples);
+
+    if ( !d->continuous  &&  d->scnt >= d->num_samples) {
+        d->sample_and_send = false;
+    }
+}   // sigrok_encode_segment
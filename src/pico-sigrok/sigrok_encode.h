@@ -0,0 +1,87 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SIGROK_ENCODE_H
+#define SIGROK_ENCODE_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sigrok_int.h"
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+//The size of the buffer sent to the CDC serial
+//The TUD CDC buffer is only 256B so it doesn't help to have more than this.
+//For TCP the buffer is larger (see TX_BUF_THRESH_NET), because lwIP takes the data directly from it.
+#if OPT_NET_SIGROK_SERVER
+    #define TX_BUF_SIZE (260 - TX_BUF_THRESH + TX_BUF_THRESH_NET)
+#else
+    #define TX_BUF_SIZE 260
+#endif
+
+//This sets the point which we will send data from the txbuf to the usb cdc.
+//For the 5-21 channel RLE it must leave a spare ~83 entries to cover the case where
+//a new long steady input comes after deciding to not send a sample.
+//(Assuming 128KB samples per half, a max rle value of 1568 we can get
+//  256*1024/2/1568=83 max length rles on a steady input).
+//Other than that the value is not very specific because the usb tub code
+//implement a 256 entry FIFO that queues things up and sends max length 64B transactions
+//20 is arbitrarily picked to ensure that if we have even a little we send it so that
+//at least something goes across the link.
+#define TX_BUF_THRESH 64
+
+//Send threshold if a TCP client is connected: bigger chunks mean less handshaking with lwIP and better filled segments
+#define TX_BUF_THRESH_NET 1024
+
+
+/// send threshold for the transmit buffer, TX_BUF_THRESH or TX_BUF_THRESH_NET
+extern uint16_t txbufthresh;
+
+/// count of characters sent via USB
+extern uint32_t sent_cnt;
+
+/// Number of bytes stored as DMA per slice: 0 (D4), 1, 2 or 4
+extern uint8_t d_dma_bps;
+
+
+void sigrok_encode_slices(sr_device_t *d, uint8_t *dbuf, uint8_t *abuf, uint32_t samples);
+void sigrok_encode_segment(sr_device_t *d, uint8_t *buf, uint32_t seg, uint32_t first, uint32_t samples);
+uint8_t *sigrok_seg_d_addr(const sr_device_t *d, uint8_t *buf, uint32_t seg, uint32_t first);
+
+/// output of the encoders, provided by the capture side (sigrok.c)
+void sigrok_tx_write(const uint8_t *buf, uint32_t cnt);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
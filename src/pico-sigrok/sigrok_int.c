@@ -76,9 +76,13 @@ void sigrok_reset(sr_device_t *d)
 {
     d->sample_and_send = false;
     d->continuous      = false;
+    d->buffered        = false;
     d->aborted         = false;
     d->all_started     = false;
     d->scnt            = 0;
+    d->pretrig_samples = 0;
+    sr_trigger_clear(&d->trigger);
+    sr_decode_clear(&d->decoder);
 }   // sigrok_reset
 
 
@@ -97,3 +101,80 @@ void sigrok_full_reset(sr_device_t *d)
     d->d_nps       = 0;
     d->cmdstr_ndx  = 0;
 }   // sigrok_full_reset
+
+
+
+//Allocation unit of the capture buffer in bytes for the enabled channels
+uint32_t sigrok_seg_chunk_size(const sr_device_t *d)
+{
+    uint32_t d_nibbles = d->d_nps;             //digital is in groups of 4 bits
+    uint32_t a_nibbles = d->a_chan_cnt * 2;    //1 byte per sample
+    uint32_t chunk_size;
+
+    //total buf size must be a multiple of a_nibbles*2, d_nibbles*8, and t_nibbles so that division is always
+    //in whole samples
+    //Also set a multiple of 32  because the dma buffer is split into segments, and
+    //the PIO does writes on 4B boundaries, and then a 4x factor for any other size/alignment issues
+    chunk_size = (d_nibbles + a_nibbles) * 32;
+    if (a_nibbles != 0)
+        chunk_size *= a_nibbles;
+    if (d_nibbles != 0)
+        chunk_size *= d_nibbles;
+    return chunk_size;
+}   // sigrok_seg_chunk_size
+
+
+
+/**
+ * Divide \a buf_size bytes of the capture buffer into DMA segments based on channel enables:
+ * sets \a seg_cnt (2..seg_max), \a d_size, \a a_size, \a samples_per_seg, \a dbuf_start and \a abuf_start.
+ * The digital segments come first, followed by the analog ones.
+ *
+ * \param fit  if the requested \a num_samples fit, reduce to two segments which are filled only once
+ * \return true if the capture has been fitted into two segments
+ */
+bool sigrok_seg_layout(sr_device_t *d, uint32_t buf_size, uint32_t seg_max, bool fit)
+{
+    //Divide capture buf evenly based on channel enables
+    //d_size is aligned to 4 bytes because pio operates on words
+    //These are the sizes for each segment in bytes
+    //Calculate relative size in terms of nibbles which is the smallest unit, thus a_chan_cnt is multiplied by 2
+    //Nibble size storage is only allow for D4 mode with no analog channels enabled
+    //For instance a D0..D5 with A0 would give 1/2 the storage to digital and 1/2 to analog
+    uint32_t d_nibbles = d->d_nps;
+    uint32_t a_nibbles = d->a_chan_cnt * 2;
+    uint32_t t_nibbles = d_nibbles + a_nibbles;
+    uint32_t chunk_size = sigrok_seg_chunk_size(d);
+    uint32_t dig_bytes_per_chunk = chunk_size * d_nibbles / t_nibbles;
+    uint32_t dig_samples_per_chunk = d_nibbles ? (dig_bytes_per_chunk * 2) / d_nibbles : 0;
+    uint32_t chunk_samples = d_nibbles ? dig_samples_per_chunk  : (chunk_size * 2) / a_nibbles;
+    //total chunks in entire buffer, rounded to the number of segments below
+    uint32_t buff_chunks = buf_size / chunk_size;
+    //round up and force power of two since we cut it in half
+    uint32_t chunks_needed = ((d->num_samples / chunk_samples) + 2) & 0xFFFFFFFE;
+    bool fitted = false;
+
+    d->seg_cnt = seg_max;
+    //If requested samples are smaller than the buffer, reduce the size so that the
+    //transfer completes sooner.  Two segments are used, because both are armed from the beginning.
+    if (fit  &&  (buff_chunks & 0xFFFFFFFE) > chunks_needed) {
+        fitted = true;
+        d->seg_cnt = 2;
+        buff_chunks = chunks_needed;
+    }
+    else {
+        //at least two segments, each holding at least one chunk
+        while (d->seg_cnt > 2  &&  buff_chunks < d->seg_cnt) {
+            d->seg_cnt--;
+        }
+        buff_chunks -= buff_chunks % d->seg_cnt;
+    }
+    //Give dig and analog equal fractions
+    //This is the size of each segment in bytes
+    d->d_size = (buff_chunks * chunk_size * d_nibbles) / (t_nibbles * d->seg_cnt);
+    d->a_size = (buff_chunks * chunk_size * a_nibbles) / (t_nibbles * d->seg_cnt);
+    d->samples_per_seg = (chunk_samples * buff_chunks) / d->seg_cnt;
+    d->dbuf_start = 0;
+    d->abuf_start = d->seg_cnt * d->d_size;
+    return fitted;
+}   // sigrok_seg_layout
@@ -31,6 +31,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "sigrok_trigger.h"
+#include "sigrok_decode.h"
+
 
 #ifdef __cplusplus
     extern "C" {
@@ -78,7 +81,8 @@ typedef struct sr_device {
     uint32_t a_mask;                                 //!< enable mask for analog channels (bit 0..(SR_NUM_A_CHAN-1))
     uint32_t d_mask;                                 //!< enable mask for digital channels (bit 0..(SR_NUM_D_CHAN-1))
     uint32_t d_mask_D4;                              //!< enable mask for send_slices_D4() operation
-    uint32_t samples_per_half;                       //!< number of samples for one of the 4 dma target arrays
+    uint32_t samples_per_seg;                        //!< number of samples in one DMA segment
+    uint32_t seg_cnt;                                //!< number of DMA segments the capture buffer is split into
     uint8_t a_chan_cnt;                              //!< count of enabled analog channels
     uint8_t d_chan_cnt;                              //!< count of enabled digital channels
     uint8_t d_tx_bps;   //Digital Transmit bytes per slice
@@ -86,8 +90,12 @@ typedef struct sr_device {
     uint8_t pin_count;
     uint8_t d_nps; //digital nibbles per slice from a PIO/DMA perspective.
     uint32_t scnt; //number of samples sent
-    uint32_t d_size,a_size; //size of each of the two data buffers for each of a& d
-    uint32_t dbuf0_start,dbuf1_start,abuf0_start,abuf1_start; //starting memory pointers of adc buffers
+    uint32_t d_size,a_size; //size of one segment for each of a& d
+    uint32_t dbuf_start,abuf_start; //offsets of the digital and analog segment arrays in the capture buffer
+
+    sr_trigger_t trigger;                            //!< trigger stages, set by the host with 't'/'T'
+    uint32_t pretrig_samples;                        //!< samples to send before the trigger point, set by the host with 'p'
+    sr_decoder_t decoder;                            //!< on-probe protocol decoder, set by the host with 'P'
 
     uint32_t cmdstr_ndx;                             //!< index into \a cmdstr
     char cmdstr[30];                                 //!< used for parsing input
@@ -97,6 +105,7 @@ typedef struct sr_device {
     volatile bool all_started;                       //!< sampling and transmission has been started (incl initialization)
     volatile bool sample_and_send;                   //!< sample and send data
     volatile bool continuous;                        //!< continuous sample mode
+    volatile bool buffered;                          //!< buffered capture: encoded data is stored in RAM and sent after capture
     volatile bool aborted;                           //!< abort sampling and transmission (due to host command or overflow)
     volatile bool send_resp;                         //!< send the response string contained in \a rspstr
 } sr_device_t;
@@ -110,6 +119,8 @@ extern sr_device_t sr_dev;
 void sigrok_tx_init(sr_device_t *d);
 void sigrok_reset(sr_device_t *d);
 void sigrok_full_reset(sr_device_t *d);
+uint32_t sigrok_seg_chunk_size(const sr_device_t *d);
+bool sigrok_seg_layout(sr_device_t *d, uint32_t buf_size, uint32_t seg_max, bool fit);
 
 void sigrok_notify(void);
 
@@ -0,0 +1,257 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Trigger evaluation for sigrok.
+ *
+ * Triggers are evaluated on completed DMA segments of the capture buffer, see sigrok_encoder_thread().
+ * A stage is a set of level/edge conditions which must hold on the same sample, stages have to
+ * match one after the other.  Samples are only evaluated if they differ from the previous one
+ * (or if a stage has just matched), unchanged 32 bit words of the capture buffer are skipped
+ * as a whole, so long steady periods cost only a compare per word.
+ */
+
+#include <string.h>
+
+#include "sigrok_trigger.h"
+
+
+
+static bool stage_is_empty(const sr_trigger_stage_t *st)
+{
+    return (st->level_mask | st->rise | st->fall | st->edge) == 0;
+}   // stage_is_empty
+
+
+
+static inline __attribute__((always_inline)) bool stage_match(const sr_trigger_stage_t *st, uint32_t prev, uint32_t val)
+{
+    uint32_t changed = prev ^ val;
+
+    return     ((val ^ st->level_val) & st->level_mask) == 0
+           &&  (changed & st->edge) == st->edge
+           &&  (changed & val & st->rise) == st->rise
+           &&  (changed & ~val & st->fall) == st->fall;
+}   // stage_match
+
+
+
+static inline __attribute__((always_inline)) uint32_t get_sample(const uint8_t *buf, const uint32_t bps, uint32_t ndx)
+{
+    if (bps == 0) {
+        return (buf[ndx >> 1] >> (4 * (ndx & 1))) & 0x0f;
+    }
+    else if (bps == 1) {
+        return buf[ndx];
+    }
+    else if (bps == 2) {
+        return ((const uint16_t *)buf)[ndx];
+    }
+    return ((const uint32_t *)buf)[ndx];
+}   // get_sample
+
+
+
+/**
+ * Scan loop, instantiated for each sample size so that the compiler can resolve \a bps.
+ */
+static inline __attribute__((always_inline)) int32_t scan(sr_trigger_t *t, const uint8_t *buf, const uint32_t bps,
+                                                          uint32_t mask, uint32_t samples)
+{
+    const uint32_t per_word = (bps == 0) ? 8 : 4 / bps;
+    const uint32_t rep = (bps == 0) ? 0x11111111 : ((bps == 1) ? 0x01010101 : ((bps == 2) ? 0x00010001 : 0x00000001));
+    const uint32_t wmask = mask * rep;
+    const sr_trigger_stage_t *st = &t->stage[t->stage_act];
+    uint32_t last = t->last;
+    uint32_t i = 0;
+
+    if ( !t->primed  &&  samples != 0) {
+        // very first sample: no edge can be detected, but levels can match
+        last = get_sample(buf, bps, 0) & mask;
+        t->primed = true;
+    }
+
+    while (i < samples) {
+        uint32_t val;
+
+        if ( !t->eval_next  &&  (i & (per_word - 1)) == 0  &&  i + per_word <= samples) {
+            if ((((const uint32_t *)buf)[i / per_word] & wmask) == last * rep) {
+                i += per_word;
+                continue;
+            }
+        }
+
+        val = get_sample(buf, bps, i) & mask;
+        if (val != last  ||  t->eval_next) {
+            t->eval_next = false;
+            if (stage_match(st, last, val)) {
+                if (++t->stage_act >= t->stage_cnt) {
+                    t->last = val;
+                    return (int32_t)i;
+                }
+                st = &t->stage[t->stage_act];
+                t->eval_next = true;
+            }
+            last = val;
+        }
+        ++i;
+    }
+    t->last = last;
+    return -1;
+}   // scan
+
+
+
+/**
+ * Remove all trigger conditions.
+ */
+void sr_trigger_clear(sr_trigger_t *t)
+{
+    memset(t, 0, sizeof(*t));
+}   // sr_trigger_clear
+
+
+
+/**
+ * Add a condition for \a channel to the last stage.  A previous condition of the channel in this stage is replaced.
+ *
+ * \param cond  '0'/'1' for low/high level, 'r'/'f' for rising/falling edge, 'e' for any edge
+ * \return false if \a cond or \a channel is invalid
+ */
+bool sr_trigger_add(sr_trigger_t *t, char cond, uint32_t channel)
+{
+    sr_trigger_stage_t *st;
+    uint32_t bit;
+
+    if (channel >= 32) {
+        return false;
+    }
+    if (t->stage_cnt == 0) {
+        t->stage_cnt = 1;
+    }
+    st  = &t->stage[t->stage_cnt - 1];
+    bit = 1u << channel;
+
+    st->level_mask &= ~bit;
+    st->level_val  &= ~bit;
+    st->rise       &= ~bit;
+    st->fall       &= ~bit;
+    st->edge       &= ~bit;
+
+    switch (cond) {
+        case '0':
+            st->level_mask |= bit;
+            break;
+
+        case '1':
+            st->level_mask |= bit;
+            st->level_val  |= bit;
+            break;
+
+        case 'r':
+            st->rise |= bit;
+            break;
+
+        case 'f':
+            st->fall |= bit;
+            break;
+
+        case 'e':
+            st->edge |= bit;
+            break;
+
+        default:
+            return false;
+    }
+    return true;
+}   // sr_trigger_add
+
+
+
+/**
+ * Start a new stage, following conditions go into it.
+ *
+ * \return false if there is no room for another stage or the last stage has no conditions
+ */
+bool sr_trigger_next_stage(sr_trigger_t *t)
+{
+    if (t->stage_cnt == 0  ||  t->stage_cnt >= SR_TRIGGER_STAGES  ||  stage_is_empty(&t->stage[t->stage_cnt - 1])) {
+        return false;
+    }
+    ++t->stage_cnt;
+    return true;
+}   // sr_trigger_next_stage
+
+
+
+bool sr_trigger_is_active(const sr_trigger_t *t)
+{
+    for (uint32_t n = 0;  n < t->stage_cnt;  ++n) {
+        if ( !stage_is_empty(&t->stage[n])) {
+            return true;
+        }
+    }
+    return false;
+}   // sr_trigger_is_active
+
+
+
+/**
+ * Reset the evaluation state before a capture.  A trailing stage without conditions is dropped.
+ */
+void sr_trigger_arm(sr_trigger_t *t)
+{
+    while (t->stage_cnt != 0  &&  stage_is_empty(&t->stage[t->stage_cnt - 1])) {
+        --t->stage_cnt;
+    }
+    t->stage_act = 0;
+    t->primed    = false;
+    t->eval_next = true;
+    t->last      = 0;
+}   // sr_trigger_arm
+
+
+
+/**
+ * Continue trigger evaluation on the next \a samples samples.
+ *
+ * \param buf      sample data, must be word aligned
+ * \param bps      bytes per sample as stored by DMA: 1, 2, 4 or 0 for 4 bit samples (two per byte, low nibble first)
+ * \param mask     enabled channels
+ * \return index of the sample on which the last stage matched, -1 if the trigger did not fire
+ */
+int32_t sr_trigger_scan(sr_trigger_t *t, const uint8_t *buf, uint32_t bps, uint32_t mask, uint32_t samples)
+{
+    if (bps == 0) {
+        return scan(t, buf, 0, mask, samples);
+    }
+    else if (bps == 1) {
+        return scan(t, buf, 1, mask, samples);
+    }
+    else if (bps == 2) {
+        return scan(t, buf, 2, mask, samples);
+    }
+    return scan(t, buf, 4, mask, samples);
+}   // sr_trigger_scan
@@ -0,0 +1,82 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SIGROK_TRIGGER_H
+#define SIGROK_TRIGGER_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/// maximum number of sequential trigger stages
+#define SR_TRIGGER_STAGES   4
+
+
+/**
+ * One trigger stage.  It matches if all of its conditions hold on the same sample.
+ * Edge conditions compare against the previous sample.
+ */
+typedef struct {
+    uint32_t level_mask;                             //!< channels with a level condition
+    uint32_t level_val;                              //!< required levels of the channels in \a level_mask
+    uint32_t rise;                                   //!< channels which require a rising edge
+    uint32_t fall;                                   //!< channels which require a falling edge
+    uint32_t edge;                                   //!< channels which require any edge
+} sr_trigger_stage_t;
+
+
+/**
+ * Trigger definition and evaluation state.
+ * Stages must match one after the other, each on a later sample than the stage before.
+ */
+typedef struct {
+    sr_trigger_stage_t stage[SR_TRIGGER_STAGES];
+    uint8_t  stage_cnt;                              //!< number of defined stages, 0 -> no trigger
+    uint8_t  stage_act;                              //!< stage currently evaluated
+    bool     primed;                                 //!< \a last contains a valid sample
+    bool     eval_next;                              //!< evaluate the next sample even if it did not change
+    uint32_t last;                                   //!< last evaluated sample
+} sr_trigger_t;
+
+
+void    sr_trigger_clear(sr_trigger_t *t);
+bool    sr_trigger_add(sr_trigger_t *t, char cond, uint32_t channel);
+bool    sr_trigger_next_stage(sr_trigger_t *t);
+bool    sr_trigger_is_active(const sr_trigger_t *t);
+void    sr_trigger_arm(sr_trigger_t *t);
+int32_t sr_trigger_scan(sr_trigger_t *t, const uint8_t *buf, uint32_t bps, uint32_t mask, uint32_t samples);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
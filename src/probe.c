@@ -42,6 +42,10 @@
 
 #include "target_board.h"    // DAPLink
 
+#if OPT_EVENT_STREAM
+    #include "event_stream.h"
+#endif
+
 
 
 #define CTRL_WORD_WRITE(CNT, DATA)    (((DATA) << 13) + ((CNT) << 8) + (probe.offset + probe_offset_short_output))
@@ -196,6 +200,9 @@ void probe_reset_pin_set(uint32_t state)
  * set state of reset pin
  */
 {
+#if OPT_EVENT_STREAM
+    event_stream_probe((state == 0) ? EVENT_PROBE_RESET_ASSERT : EVENT_PROBE_RESET_RELEASE, "nRESET");
+#endif
 #if defined(PROBE_PIN_RESET)
     if (state == 0)
     {
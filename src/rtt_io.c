@@ -28,6 +28,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "pico/time.h"
+
 #include "FreeRTOS.h"
 #include "event_groups.h"
 #include "stream_buffer.h"
@@ -40,6 +42,7 @@
 #include "picoprobe_config.h"
 #include "rtt_io.h"
 #include "sw_lock.h"
+#include "stats_counter.h"
 #include "RTT/SEGGER_RTT.h"
 #if OPT_TARGET_UART
     #include "cdc/cdc_uart.h"
@@ -50,6 +53,12 @@
 #if OPT_NET_SYSVIEW_SERVER
     #include "net/net_sysview.h"
 #endif
+#if OPT_NET_RTT_SERVER
+    #include "net/net_rtt.h"
+#endif
+#if OPT_EVENT_STREAM
+    #include "event_stream.h"
+#endif
 #include "led.h"
 
 #if OPT_CDC_SYSVIEW  ||  OPT_NET_SYSVIEW_SERVER
@@ -93,6 +102,23 @@ static TimerHandle_t            timer_rtt_cb_verify;
     #define RTT_POLL_INT_MS     RTT_CONSOLE_POLL_INT_MS
 #endif
 
+#if OPT_NET_RTT_SERVER
+    #define CONSOLE_ON_NET()    net_rtt_is_connected(RTT_CHANNEL_CONSOLE)
+
+    static SEGGER_RTT_BUFFER_UP   aUpNet[NET_RTT_CHANNEL_N];
+    static SEGGER_RTT_BUFFER_DOWN aDownNet[NET_RTT_CHANNEL_N];
+
+    static uint32_t net_rtt_send_0(const uint8_t *buf, uint32_t cnt) { return net_rtt_send(0, buf, cnt); }
+    static uint32_t net_rtt_send_1(const uint8_t *buf, uint32_t cnt) { return net_rtt_send(1, buf, cnt); }
+    static uint32_t net_rtt_send_2(const uint8_t *buf, uint32_t cnt) { return net_rtt_send(2, buf, cnt); }
+    static uint32_t net_rtt_send_3(const uint8_t *buf, uint32_t cnt) { return net_rtt_send(3, buf, cnt); }
+
+    static const rtt_data_to_host net_rtt_data_to_host[] = { net_rtt_send_0, net_rtt_send_1, net_rtt_send_2, net_rtt_send_3 };
+    static_assert(sizeof(net_rtt_data_to_host) / sizeof(net_rtt_data_to_host[0]) == NET_RTT_CHANNEL_N, "adjust net_rtt_data_to_host[]");
+#else
+    #define CONSOLE_ON_NET()    false
+#endif
+
 
 
 static void rtt_cb_verify_timeout(TimerHandle_t xTimer)
@@ -142,12 +168,15 @@ static uint32_t search_for_rtt_cb(uint32_t prev_rtt_cb)
     uint8_t buf[1024];
     bool ok;
     uint32_t rtt_cb = 0;
+    uint32_t start_us;
 
     // check parameter
     if (prev_rtt_cb > TARGET_RAM_END - sizeof(seggerRTT)) {
         return 0;
     }
 
+    start_us = time_us_32();
+
     if (prev_rtt_cb != 0) {
         // fast search, saves a little SW traffic and a few ms
         ok = swd_read_memory(prev_rtt_cb, buf, sizeof(seggerRTT));
@@ -171,6 +200,12 @@ static uint32_t search_for_rtt_cb(uint32_t prev_rtt_cb)
             }
         }
     }
+
+    stats_inc(STATS_RTT_CB_SEARCH);
+    stats_add(STATS_RTT_CB_SEARCH_US, time_us_32() - start_us);
+    if (rtt_cb != 0) {
+        stats_inc(STATS_RTT_CB_FOUND);
+    }
     return rtt_cb;
 }   // search_for_rtt_cb
 
@@ -246,6 +281,8 @@ static uint32_t ft_rtt_cb;
 static uint8_t ft_buf[256];
 static uint32_t ft_cnt;
 static bool ft_ok;
+static uint64_t ft_time_us;                  // time of reading WrOff
+static bool ft_drained;                      // all data up to ft_time_us has been read
 
 static void rtt_from_target_thread(void *p)
 /**
@@ -264,11 +301,15 @@ static void rtt_from_target_thread(void *p)
         }
 
         ft_ok = swd_read_word(ft_rtt_cb + offsetof(SEGGER_RTT_CB, aUp[ft_channel].WrOff), (uint32_t *)&(ft_aUp->WrOff));
+        ft_time_us = time_us_64();
+        ft_drained = true;
 
         if (ft_ok  &&  ft_aUp->WrOff != ft_aUp->RdOff) {
             //
             // fetch data from target
             //
+            uint32_t pending = (ft_aUp->WrOff + ft_aUp->SizeOfBuffer - ft_aUp->RdOff) % ft_aUp->SizeOfBuffer;
+
             if (ft_aUp->WrOff > ft_aUp->RdOff) {
                 ft_cnt = MIN(ft_cnt, ft_aUp->WrOff - ft_aUp->RdOff);
             }
@@ -276,6 +317,7 @@ static void rtt_from_target_thread(void *p)
                 ft_cnt = MIN(ft_cnt, ft_aUp->SizeOfBuffer - ft_aUp->RdOff);
             }
             ft_cnt = MIN(ft_cnt, sizeof(ft_buf));
+            ft_drained = (ft_cnt == pending);
 
             memset(ft_buf, 0, sizeof(ft_buf));
             ft_ok = ft_ok  &&  swd_read_memory((uint32_t)ft_aUp->pBuffer + ft_aUp->RdOff, ft_buf, ft_cnt);
@@ -294,6 +336,30 @@ static void rtt_from_target_thread(void *p)
 
 
 
+#if OPT_EVENT_STREAM
+static void rtt_console_event(const uint8_t *buf, uint32_t cnt)
+/**
+ * Put console data into the event stream.  The target has written the data between the last read
+ * which emptied the buffer and this read, so the midpoint of both is taken as timestamp.
+ * The age is limited to keep the timestamp sane after a pause of the console polling.
+ */
+{
+    static uint64_t empty_us;
+
+    empty_us = MAX(empty_us, ft_time_us - 1000 * RTT_CONSOLE_POLL_INT_MS);
+    if (cnt != 0) {
+        event_stream_put(EVENT_SRC_RTT, empty_us + (ft_time_us - empty_us) / 2, buf, cnt);
+    }
+    if (ft_drained) {
+        // everything written before this read has been delivered
+        empty_us = ft_time_us;
+        event_stream_watermark(EVENT_SRC_RTT, ft_time_us);
+    }
+}   // rtt_console_event
+#endif
+
+
+
 #if INCLUDE_SYSVIEW
 static void rtt_from_target_reset(uint32_t rtt_cb, uint16_t channel, SEGGER_RTT_BUFFER_UP *aUp)
 /**
@@ -345,9 +411,18 @@ static bool rtt_from_target(uint32_t rtt_cb, uint16_t channel, SEGGER_RTT_BUFFER
         xEventGroupSetBits(events, EV_RTT_FROM_TARGET_STRT);
         xEventGroupWaitBits(events, EV_RTT_FROM_TARGET_END, pdTRUE, pdFALSE, portMAX_DELAY);
 
+#if OPT_EVENT_STREAM
+        if (channel == RTT_CHANNEL_CONSOLE  &&  ft_ok) {
+            rtt_console_event(ft_buf, ft_cnt);
+        }
+#endif
+
         if (ft_cnt != 0) {
             // redirect received data to host
             data_to_host(ft_buf, ft_cnt);
+            if (channel < STATS_RTT_CHANNELS) {
+                stats_add(STATS_RTT_FROM_TARGET_0 + channel, ft_cnt);
+            }
 
             led_state(LS_RTT_RX_DATA);
             *worked = true;
@@ -409,6 +484,9 @@ static bool rtt_to_target(uint32_t rtt_cb, StreamBufferHandle_t stream, uint16_t
             }
 
             ok = ok  &&  swd_write_word(rtt_cb + offsetof(SEGGER_RTT_CB, aDown[channel].WrOff), aDown->WrOff);
+            if (channel < STATS_RTT_CHANNELS) {
+                stats_add(STATS_RTT_TO_TARGET_0 + channel, num_bytes);
+            }
 
             //printf(" -> %u\n", aDown->WrOff);
         }
@@ -434,6 +512,11 @@ static void do_rtt_io(uint32_t rtt_cb, bool with_alive_check)
     bool ok_sysview_from_target = false;
     bool ok_sysview_to_target = false;
     bool net_sysview_was_connected = false;
+#endif
+#if OPT_NET_RTT_SERVER
+    bool ok_net_from_target[NET_RTT_CHANNEL_N] = { false };
+    bool ok_net_to_target[NET_RTT_CHANNEL_N] = { false };
+    bool net_rtt_was_connected[NET_RTT_CHANNEL_N] = { false };
 #endif
     bool ok = true;
 
@@ -467,6 +550,12 @@ static void do_rtt_io(uint32_t rtt_cb, bool with_alive_check)
             else {
                 working_uart = false;
 
+                if (CONSOLE_ON_NET()) {
+                    // console is served by the RTT TCP server, rediscover channel afterwards
+                    ok_console_from_target = false;
+                    ok_console_to_target = false;
+                }
+
                 if (ok_console_from_target)
                     ok = ok  &&  rtt_from_target(rtt_cb, RTT_CHANNEL_CONSOLE, &aUpConsole, cdc_uart_write, false, &working_uart);
 
@@ -501,13 +590,40 @@ static void do_rtt_io(uint32_t rtt_cb, bool with_alive_check)
         }
 #endif
 
+#if OPT_NET_RTT_SERVER
+        for (uint16_t ch = 0;  ch < NET_RTT_CHANNEL_N;  ++ch) {
+            bool working_net = false;
+
+            if ( !net_rtt_is_connected(ch)) {
+                net_rtt_was_connected[ch] = false;
+                continue;
+            }
+            if ( !net_rtt_was_connected[ch]) {
+                // (re)discover channel, because a copy of the channel might have been used by the console
+                net_rtt_was_connected[ch] = true;
+                ok_net_from_target[ch] = false;
+                ok_net_to_target[ch] = false;
+            }
+
+            if (ok_net_from_target[ch])
+                ok = ok  &&  rtt_from_target(rtt_cb, ch, aUpNet + ch, net_rtt_data_to_host[ch], !NET_RTT_CHANNEL_DROPS(ch), &working_net);
+
+            if (ok_net_to_target[ch]) {
+                ok = ok  &&  rtt_to_target(rtt_cb, net_rtt_stream_to_target(ch), ch, aDownNet + ch, &working_net);
+                net_rtt_target_ready(ch);
+            }
+
+            probe_rtt_cb = probe_rtt_cb  &&  !working_net;
+        }
+#endif
+
         //printf("%d %d\n", ok, probe_rtt_cb);
         if (ok  &&  probe_rtt_cb) {
             // did nothing -> check if RTT channels appeared
             #if OPT_TARGET_UART
-                if ( !ok_console_from_target)
+                if ( !ok_console_from_target  &&  !CONSOLE_ON_NET())
                     ok = ok  &&  rtt_check_channel_from_target(rtt_cb, RTT_CHANNEL_CONSOLE, &aUpConsole, &ok_console_from_target);
-                if ( !ok_console_to_target)
+                if ( !ok_console_to_target  &&  !CONSOLE_ON_NET())
                     ok = ok  &&  rtt_check_channel_to_target(rtt_cb, RTT_CHANNEL_CONSOLE, &aDownConsole, &ok_console_to_target);
             #endif
             #if INCLUDE_SYSVIEW
@@ -516,6 +632,14 @@ static void do_rtt_io(uint32_t rtt_cb, bool with_alive_check)
                 if ( !ok_sysview_to_target)
                     ok = ok  &&  rtt_check_channel_to_target(rtt_cb, RTT_CHANNEL_SYSVIEW, &aDownSysView, &ok_sysview_to_target);
             #endif
+            #if OPT_NET_RTT_SERVER
+                for (uint16_t ch = 0;  ch < NET_RTT_CHANNEL_N;  ++ch) {
+                    if (net_rtt_is_connected(ch)  &&  !ok_net_from_target[ch])
+                        ok = ok  &&  rtt_check_channel_from_target(rtt_cb, ch, aUpNet + ch, ok_net_from_target + ch);
+                    if (net_rtt_is_connected(ch)  &&  !ok_net_to_target[ch])
+                        ok = ok  &&  rtt_check_channel_to_target(rtt_cb, ch, aDownNet + ch, ok_net_to_target + ch);
+                }
+            #endif
 
             // -> delay
             xEventGroupWaitBits(events, EV_RTT_TO_TARGET, pdTRUE, pdFALSE, pdMS_TO_TICKS(RTT_POLL_INT_MS));
@@ -602,6 +726,9 @@ void rtt_io_thread(void *ptr)
             if (target_online) {
                 target_online = false;
                 picoprobe_info("=================================== Target lost\n");
+#if OPT_EVENT_STREAM
+                event_stream_probe(EVENT_PROBE_TARGET_LOST, "RTT");
+#endif
             }
             vTaskDelay(pdMS_TO_TICKS(1000));
         }
@@ -615,6 +742,11 @@ void rtt_io_thread(void *ptr)
             picoprobe_info("searching RTT_CB in 0x%08x..0x%08x, prev: 0x%08x\n",
                            (unsigned)TARGET_RAM_START, (unsigned)(TARGET_RAM_END - 1), (unsigned)rtt_cb);
             led_state(LS_TARGET_FOUND);
+#if OPT_EVENT_STREAM
+            if ( !target_online) {
+                event_stream_probe(EVENT_PROBE_TARGET_FOUND, "RTT");
+            }
+#endif
             target_online = true;
             rtt_cb_alive = false;
             rtt_cb = search_for_rtt_cb(rtt_cb);               // either verify previous RTT_CB or search for one
@@ -684,15 +816,30 @@ void rtt_send_byte(StreamBufferHandle_t stream, uint16_t channel, uint8_t ch, bo
         if (available < sizeof(ch)) {
             uint8_t dummy;
             xStreamBufferReceive(stream, &dummy, sizeof(dummy), 0);
+            stats_inc(STATS_DROP_RTT);
             picoprobe_error("rtt_console_send_byte: drop byte on channel %d\n", channel);
         }
     }
-    xStreamBufferSend(stream, &ch, sizeof(ch), 0);
+    if (xStreamBufferSend(stream, &ch, sizeof(ch), 0) != sizeof(ch)) {
+        stats_inc(STATS_DROP_RTT);
+    }
     xEventGroupSetBits(events, EV_RTT_TO_TARGET);
 }   // rtt_send_byte
 
 
 
+void rtt_to_target_notify(void)
+/**
+ * Wake up RTT IO because there is new data in a stream to the target.
+ */
+{
+    if (events != NULL) {
+        xEventGroupSetBits(events, EV_RTT_TO_TARGET);
+    }
+}   // rtt_to_target_notify
+
+
+
 void rtt_console_send_byte(uint8_t ch)
 {
     rtt_send_byte(stream_rtt_console_to_target, RTT_CHANNEL_CONSOLE, ch, false);
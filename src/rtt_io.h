@@ -39,6 +39,7 @@
 void rtt_console_init(uint32_t task_prio);
 void rtt_console_send_byte(uint8_t ch);
 bool rtt_console_cb_exists(void);
+void rtt_to_target_notify(void);
 
 #if OPT_NET_SYSVIEW_SERVER  ||  OPT_CDC_SYSVIEW
     void rtt_sysview_send_byte(uint8_t ch);
@@ -0,0 +1,105 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Lightweight counter registry for the hot paths (SWD, RTT, DAP, MSC, NCM, stream buffers).
+ *
+ * Counters are kept per core to avoid any locking in the hot paths.  Readers sum up
+ * the per core values, so a snapshot is not atomic but consistent enough for monitoring.
+ */
+
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "stats_counter.h"
+
+
+uint32_t stats_counter[NUM_CORES][STATS_CNT];
+
+
+
+uint32_t stats_get(stats_id_t id)
+/**
+ * Get the current value of a counter (sum over all cores).
+ */
+{
+    uint32_t r = 0;
+
+    for (uint32_t core = 0;  core < NUM_CORES;  ++core) {
+        r += stats_counter[core][id];
+    }
+    return r;
+}   // stats_get
+
+
+
+void stats_reset(void)
+{
+    memset(stats_counter, 0, sizeof(stats_counter));
+}   // stats_reset
+
+
+
+static uint8_t *put_u16(uint8_t *p, uint16_t val)
+{
+    *p++ = (uint8_t)(val >> 0);
+    *p++ = (uint8_t)(val >> 8);
+    return p;
+}   // put_u16
+
+
+
+static uint8_t *put_u32(uint8_t *p, uint32_t val)
+{
+    p = put_u16(p, (uint16_t)(val >>  0));
+    p = put_u16(p, (uint16_t)(val >> 16));
+    return p;
+}   // put_u32
+
+
+
+uint32_t stats_snapshot(uint8_t *buf, uint32_t buf_size)
+/**
+ * Write a binary snapshot of all counters into \a buf.  Format is described in stats_counter.h.
+ *
+ * \return number of bytes written, 0 if \a buf_size is too small
+ */
+{
+    uint8_t *p = buf;
+
+    if (buf_size < STATS_SNAPSHOT_SIZE) {
+        return 0;
+    }
+
+    p = put_u32(p, STATS_SNAPSHOT_MAGIC);
+    p = put_u16(p, STATS_SNAPSHOT_VERSION);
+    p = put_u16(p, STATS_CNT);
+    p = put_u32(p, to_ms_since_boot(get_absolute_time()));
+    for (uint32_t id = 0;  id < STATS_CNT;  ++id) {
+        p = put_u32(p, stats_get((stats_id_t)id));
+    }
+    return p - buf;
+}   // stats_snapshot
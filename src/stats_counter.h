@@ -0,0 +1,162 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _STATS_COUNTER_H
+#define _STATS_COUNTER_H
+
+
+#include <stdint.h>
+
+#include "pico/platform.h"
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/**
+ * Counter identifiers.
+ * Numbering is part of the snapshot format, so append new counters at the end of their group
+ * and increment \a STATS_SNAPSHOT_VERSION if the layout changes.
+ */
+#define STATS_RTT_CHANNELS          4
+#define STATS_DAP_CMD_IDS           32                   // ID_DAP_Info..ID_DAP_SWO_Data and some spare
+
+typedef enum {
+    // SWD: SWD_Transfer() and DAPLink swd_host.c
+    STATS_SWD_TRANSFER,
+    STATS_SWD_ACK_WAIT,
+    STATS_SWD_ACK_FAULT,
+    STATS_SWD_ACK_ERROR,                                 // protocol or parity error
+    STATS_SWD_RETRY,                                     // retries in swd_host.c
+
+    // RTT: bytes per channel
+    STATS_RTT_FROM_TARGET_0,
+    STATS_RTT_TO_TARGET_0 = STATS_RTT_FROM_TARGET_0 + STATS_RTT_CHANNELS,
+    STATS_RTT_LAST        = STATS_RTT_TO_TARGET_0 + STATS_RTT_CHANNELS - 1,
+
+    // CMSIS-DAP: requests per command ID
+    STATS_DAP_REQUEST,
+    STATS_DAP_CMD_0,
+    STATS_DAP_CMD_VENDOR = STATS_DAP_CMD_0 + STATS_DAP_CMD_IDS,
+    STATS_DAP_CMD_OTHER,                                 // ID_DAP_ExecuteCommands, ID_DAP_QueueCommands & invalid IDs
+
+    // MSC
+    STATS_MSC_SECTOR_READ,
+    STATS_MSC_SECTOR_WRITE,
+    STATS_MSC_UF2_BLOCK,
+
+    // NCM
+    STATS_NCM_NTB_RECV,
+    STATS_NCM_NTB_RECV_INVALID,
+    STATS_NCM_NTB_XMIT,
+
+    // StreamBuffer: dropped bytes
+    STATS_DROP_UART,
+    STATS_DROP_DEBUG,
+    STATS_DROP_RTT,
+    STATS_DROP_SYSVIEW,
+    STATS_DROP_NET_RTT,
+
+    // target UART receive
+    STATS_DROP_UART_RX_RING,                             // bytes overwritten in the DMA ring before they were read
+    STATS_UART_RX_OVERRUN,                               // UART FIFO overruns (DMA too late)
+
+    // PIO UARTs
+    STATS_DROP_PIO_UART_RX_RING,                         // bytes overwritten in the DMA rings before they were read
+    STATS_PIO_UART_RX_OVERRUN,                           // RX FIFO overruns (DMA too late)
+    STATS_PIO_UART_FRAMING,                              // framing errors / breaks
+
+    // event stream
+    STATS_DROP_EVENTS,                                   // payload bytes dropped because a source FIFO was full
+
+    // sigrok
+    STATS_SIGROK_SAMPLES,                                // samples encoded and sent
+    STATS_SIGROK_ENCODE_US,                              // time spent for encoding/sending in us
+    STATS_SIGROK_OVERFLOW,                               // captures aborted because of DMA/PIO/ADC overflow or full store
+    STATS_SIGROK_TX_BYTES,                               // bytes produced by the encoder
+
+    // SystemView TCP server
+    STATS_SYSVIEW_TX_BYTES,                              // bytes given to tcp_write(), all clients
+    STATS_SYSVIEW_TX_WRITES,                             // tcp_write() calls
+    STATS_SYSVIEW_WAKEUPS,                               // lwIP callbacks posted by the RTT thread
+
+    // RTT control block
+    STATS_RTT_CB_SEARCH,                                 // calls of search_for_rtt_cb()
+    STATS_RTT_CB_SEARCH_US,                              // time spent for searching in us
+    STATS_RTT_CB_FOUND,                                  // searches which found a control block
+
+    STATS_CNT
+} stats_id_t;
+
+
+/**
+ * Binary snapshot, all values little endian:
+ *
+ * offset  size
+ *    0      4    magic STATS_SNAPSHOT_MAGIC
+ *    4      2    version STATS_SNAPSHOT_VERSION
+ *    6      2    number of counters N
+ *    8      4    uptime in ms
+ *   12    4*N    counters in the order of \a stats_id_t
+ */
+#define STATS_SNAPSHOT_MAGIC        0x53504159           // "YAPS"
+#define STATS_SNAPSHOT_VERSION      1
+#define STATS_SNAPSHOT_HEADER_SIZE  12
+#define STATS_SNAPSHOT_SIZE         (STATS_SNAPSHOT_HEADER_SIZE + 4 * STATS_CNT)
+
+
+extern uint32_t stats_counter[NUM_CORES][STATS_CNT];
+
+
+/**
+ * Add \a n to a counter.
+ * Each core increments only its own row, so no lock or atomic operation is required.
+ * An increment may get lost if a task is preempted by another task/ISR on the same core
+ * incrementing the same counter, which is acceptable for statistics.
+ */
+static inline void stats_add(stats_id_t id, uint32_t n)
+{
+    stats_counter[get_core_num()][id] += n;
+}   // stats_add
+
+static inline void stats_inc(stats_id_t id)
+{
+    stats_add(id, 1);
+}   // stats_inc
+
+
+uint32_t stats_get(stats_id_t id);
+void     stats_reset(void);
+uint32_t stats_snapshot(uint8_t *buf, uint32_t buf_size);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+
+#endif
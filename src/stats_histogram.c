@@ -0,0 +1,146 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * log2 latency histograms for CMSIS-DAP requests and SWD transfers.
+ *
+ * Measurement is done with time_us_32(), so SWD transfers typically end up in the lower buckets.
+ * Histograms can be read via CMSIS-DAP vendor command or printed on the debug CDC.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "picoprobe_config.h"
+#include "stats_histogram.h"
+
+
+uint32_t stats_hist[HIST_CNT][STATS_HIST_BUCKETS];
+
+
+
+void stats_hist_reset(void)
+{
+    memset(stats_hist, 0, sizeof(stats_hist));
+}   // stats_hist_reset
+
+
+
+static uint8_t snapshot_byte(uint32_t pos)
+/**
+ * Get a single byte of the binary snapshot.
+ */
+{
+    uint32_t val;
+
+    if (pos < STATS_HIST_HEADER_SIZE) {
+        switch (pos / 2) {
+            case 0:  val = STATS_HIST_MAGIC;          break;
+            case 1:  val = STATS_HIST_MAGIC >> 16;    break;
+            case 2:  val = STATS_HIST_VERSION;        break;
+            case 3:  val = HIST_CNT;                  break;
+            case 4:  val = STATS_HIST_BUCKETS;        break;
+            default: val = 0;                         break;
+        }
+        return (uint8_t)(val >> (8 * (pos & 1)));
+    }
+
+    pos -= STATS_HIST_HEADER_SIZE;
+    val = stats_hist[pos / (4 * STATS_HIST_BUCKETS)][(pos / 4) % STATS_HIST_BUCKETS];
+    return (uint8_t)(val >> (8 * (pos & 3)));
+}   // snapshot_byte
+
+
+
+uint32_t stats_hist_read(uint8_t *buf, uint32_t offset, uint32_t cnt)
+/**
+ * Read a part of the binary snapshot (format see stats_histogram.h).
+ * The snapshot is taken from the live data, so parts read at different times are not consistent.
+ *
+ * \return number of bytes written into \a buf
+ */
+{
+    uint32_t n;
+
+    for (n = 0;  n < cnt  &&  offset + n < STATS_HIST_SNAPSHOT_SIZE;  ++n) {
+        buf[n] = snapshot_byte(offset + n);
+    }
+    return n;
+}   // stats_hist_read
+
+
+
+static const char *hist_name(uint32_t id, char *buf, uint32_t buf_size)
+{
+    static const char *swd_names[] = {"swd_dp_write", "swd_ap_write", "swd_dp_read", "swd_ap_read"};
+
+    if (id == HIST_DAP_QUEUE) {
+        return "dap_queue";
+    }
+    else if (id < HIST_DAP_EXEC_OTHER) {
+        snprintf(buf, buf_size, "dap_exec_0x%02x", (unsigned)(id - HIST_DAP_EXEC_0));
+        return buf;
+    }
+    else if (id == HIST_DAP_EXEC_OTHER) {
+        return "dap_exec_other";
+    }
+    return swd_names[id - HIST_SWD_DP_WRITE];
+}   // hist_name
+
+
+
+void stats_hist_print(void)
+/**
+ * Print all non-empty histograms.  Column n shows the number of events with a duration < 2^n us.
+ */
+{
+    char line[16 + 7 * STATS_HIST_BUCKETS + 1];
+    char name[16];
+    uint32_t n;
+
+    n = snprintf(line, sizeof(line), "%-15s", "us <");
+    for (uint32_t bucket = 0;  bucket < STATS_HIST_BUCKETS - 1;  ++bucket) {
+        n += snprintf(line + n, sizeof(line) - n, " %6u", 1U << bucket);
+    }
+    snprintf(line + n, sizeof(line) - n, "   more");
+    picoprobe_info("%s\n", line);
+
+    for (uint32_t id = 0;  id < HIST_CNT;  ++id) {
+        uint32_t sum = 0;
+
+        for (uint32_t bucket = 0;  bucket < STATS_HIST_BUCKETS;  ++bucket) {
+            sum += stats_hist[id][bucket];
+        }
+        if (sum == 0) {
+            continue;
+        }
+
+        n = snprintf(line, sizeof(line), "%-15s", hist_name(id, name, sizeof(name)));
+        for (uint32_t bucket = 0;  bucket < STATS_HIST_BUCKETS;  ++bucket) {
+            n += snprintf(line + n, sizeof(line) - n, " %6u", (unsigned)stats_hist[id][bucket]);
+        }
+        picoprobe_info("%s\n", line);
+    }
+}   // stats_hist_print
@@ -0,0 +1,108 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _STATS_HISTOGRAM_H
+#define _STATS_HISTOGRAM_H
+
+
+#include <stdint.h>
+
+#include "stats_counter.h"
+
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/**
+ * Histogram identifiers.  Numbering is part of the snapshot format.
+ */
+typedef enum {
+    HIST_DAP_QUEUE,                                      // CMSIS-DAPv2: USB arrival -> start of execution
+    HIST_DAP_EXEC_0,                                     // execution time per command ID
+    HIST_DAP_EXEC_OTHER = HIST_DAP_EXEC_0 + STATS_DAP_CMD_IDS,
+    HIST_SWD_DP_WRITE,                                   // SWD_Transfer(), order is given by request[1:0]
+    HIST_SWD_AP_WRITE,
+    HIST_SWD_DP_READ,
+    HIST_SWD_AP_READ,
+
+    HIST_CNT
+} stats_hist_id_t;
+
+
+/**
+ * log2 buckets in us: bucket 0 counts 0us, bucket n counts [2^(n-1), 2^n - 1]us, the last bucket
+ * counts everything above.
+ */
+#define STATS_HIST_BUCKETS          16
+
+
+/**
+ * Binary snapshot, all values little endian:
+ *
+ * offset  size
+ *    0      4    magic STATS_HIST_MAGIC
+ *    4      2    version STATS_HIST_VERSION
+ *    6      2    number of histograms N
+ *    8      2    number of buckets B
+ *   10      2    reserved
+ *   12   4*N*B   bucket counters, histogram by histogram in the order of \a stats_hist_id_t
+ */
+#define STATS_HIST_MAGIC            0x48504159           // "YAPH"
+#define STATS_HIST_VERSION          1
+#define STATS_HIST_HEADER_SIZE      12
+#define STATS_HIST_SNAPSHOT_SIZE    (STATS_HIST_HEADER_SIZE + 4 * HIST_CNT * STATS_HIST_BUCKETS)
+
+
+extern uint32_t stats_hist[HIST_CNT][STATS_HIST_BUCKETS];
+
+
+/**
+ * Count \a us in histogram \a id.
+ * There is no locking, concurrent updates of the same bucket may lose a count.
+ */
+static inline void stats_hist_add(stats_hist_id_t id, uint32_t us)
+{
+    uint32_t bucket = (us == 0) ? 0 : 32 - __builtin_clz(us);
+
+    if (bucket >= STATS_HIST_BUCKETS) {
+        bucket = STATS_HIST_BUCKETS - 1;
+    }
+    ++stats_hist[id][bucket];
+}   // stats_hist_add
+
+
+void     stats_hist_reset(void);
+uint32_t stats_hist_read(uint8_t *buf, uint32_t offset, uint32_t cnt);
+void     stats_hist_print(void);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+
+#endif
@@ -28,6 +28,8 @@
 #include "DAP_config.h"
 #include "DAP.h"
 #include "probe.h"
+#include "stats_counter.h"
+#include "stats_histogram.h"
 
 
 
@@ -135,6 +137,7 @@ uint8_t __TIME_CRITICAL_FUNCTION(SWD_Transfer)(uint32_t request, uint32_t *data)
                                     };
 	uint8_t prq = 0;
 	uint8_t ack;
+	uint32_t start_us = time_us_32();
 
 	if (DAP_Data.clock_delay != cached_delay) {
 		probe_set_swclk_freq_khz(MAKE_KHZ(DAP_Data.fast_clock, DAP_Data.clock_delay), true);
@@ -242,6 +245,18 @@ uint8_t __TIME_CRITICAL_FUNCTION(SWD_Transfer)(uint32_t request, uint32_t *data)
         // post: cleaned up and "SWD in write mode"
 	}
 
+    stats_hist_add(HIST_SWD_DP_WRITE + (request & (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW)), time_us_32() - start_us);
+    stats_inc(STATS_SWD_TRANSFER);
+    if (ack == DAP_TRANSFER_WAIT) {
+        stats_inc(STATS_SWD_ACK_WAIT);
+    }
+    else if (ack == DAP_TRANSFER_FAULT) {
+        stats_inc(STATS_SWD_ACK_FAULT);
+    }
+    else if (ack != DAP_TRANSFER_OK) {
+        stats_inc(STATS_SWD_ACK_ERROR);
+    }
+
     //
     // debugging output
     //
@@ -55,6 +55,15 @@ enum
 #if OPT_CDC_SYSVIEW
     STRID_INTERFACE_CDC_SYSVIEW,
 #endif
+#if OPT_PIO_UART_N >= 1
+    STRID_INTERFACE_CDC_PIO_UART0,
+#endif
+#if OPT_PIO_UART_N >= 2
+    STRID_INTERFACE_CDC_PIO_UART1,
+#endif
+#if OPT_EVENT_STREAM
+    STRID_INTERFACE_CDC_EVENTS,
+#endif
 };
 
 
@@ -133,6 +142,18 @@ enum
 #if OPT_CDC_SYSVIEW
     ITF_NUM_CDC_SYSVIEW_COM,
     ITF_NUM_CDC_SYSVIEW_DATA,
+#endif
+#if OPT_PIO_UART_N >= 1
+    ITF_NUM_CDC_PIO_UART0_COM,
+    ITF_NUM_CDC_PIO_UART0_DATA,
+#endif
+#if OPT_PIO_UART_N >= 2
+    ITF_NUM_CDC_PIO_UART1_COM,
+    ITF_NUM_CDC_PIO_UART1_DATA,
+#endif
+#if OPT_EVENT_STREAM
+    ITF_NUM_CDC_EVENTS_COM,
+    ITF_NUM_CDC_EVENTS_DATA,
 #endif
     ITF_NUM_TOTAL
 };
@@ -177,8 +198,24 @@ enum
     CDC_SYSVIEW_NOTIFICATION_EP_CNT,
     CDC_SYSVIEW_DATA_EP_CNT,
 #endif
+#if OPT_PIO_UART_N >= 1
+    CDC_PIO_UART0_NOTIFICATION_EP_CNT,
+    CDC_PIO_UART0_DATA_EP_CNT,
+#endif
+#if OPT_PIO_UART_N >= 2
+    CDC_PIO_UART1_NOTIFICATION_EP_CNT,
+    CDC_PIO_UART1_DATA_EP_CNT,
+#endif
+#if OPT_EVENT_STREAM
+    CDC_EVENTS_NOTIFICATION_EP_CNT,
+    CDC_EVENTS_DATA_EP_CNT,
+#endif
+    EP_CNT_TOTAL
 };
 
+// RP2040 has 16 endpoints (incl. EP0), too many CDCs enabled -> disable something else
+TU_VERIFY_STATIC(EP_CNT_TOTAL <= 16, "too many USB endpoints, check OPT_PIO_UART_N/OPT_EVENT_STREAM");
+
 
 #if OPT_CMSIS_DAPV2
     #define PROBE_VENDOR_OUT_EP_NUM         (PROBE_VENDOR_OUT_EP_CNT + 0x00)
@@ -221,6 +258,21 @@ enum
     #define CDC_SYSVIEW_DATA_OUT_EP_NUM     (CDC_SYSVIEW_DATA_EP_CNT + 0x00)
     #define CDC_SYSVIEW_DATA_IN_EP_NUM      (CDC_SYSVIEW_DATA_EP_CNT + 0x80)
 #endif
+#if OPT_PIO_UART_N >= 1
+    #define CDC_PIO_UART0_NOTIFICATION_EP_NUM (CDC_PIO_UART0_NOTIFICATION_EP_CNT + 0x80)
+    #define CDC_PIO_UART0_DATA_OUT_EP_NUM   (CDC_PIO_UART0_DATA_EP_CNT + 0x00)
+    #define CDC_PIO_UART0_DATA_IN_EP_NUM    (CDC_PIO_UART0_DATA_EP_CNT + 0x80)
+#endif
+#if OPT_PIO_UART_N >= 2
+    #define CDC_PIO_UART1_NOTIFICATION_EP_NUM (CDC_PIO_UART1_NOTIFICATION_EP_CNT + 0x80)
+    #define CDC_PIO_UART1_DATA_OUT_EP_NUM   (CDC_PIO_UART1_DATA_EP_CNT + 0x00)
+    #define CDC_PIO_UART1_DATA_IN_EP_NUM    (CDC_PIO_UART1_DATA_EP_CNT + 0x80)
+#endif
+#if OPT_EVENT_STREAM
+    #define CDC_EVENTS_NOTIFICATION_EP_NUM  (CDC_EVENTS_NOTIFICATION_EP_CNT + 0x80)
+    #define CDC_EVENTS_DATA_OUT_EP_NUM      (CDC_EVENTS_DATA_EP_CNT + 0x00)
+    #define CDC_EVENTS_DATA_IN_EP_NUM       (CDC_EVENTS_DATA_EP_CNT + 0x80)
+#endif
 
 
 #if OPT_NET_PROTO_RNDIS
@@ -288,6 +340,15 @@ static uint8_t const desc_configuration[] =
 #if OPT_CDC_SYSVIEW
     TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_SYSVIEW_COM, STRID_INTERFACE_CDC_SYSVIEW, CDC_SYSVIEW_NOTIFICATION_EP_NUM, 64, CDC_SYSVIEW_DATA_OUT_EP_NUM, CDC_SYSVIEW_DATA_IN_EP_NUM, 64),
 #endif
+#if OPT_PIO_UART_N >= 1
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_PIO_UART0_COM, STRID_INTERFACE_CDC_PIO_UART0, CDC_PIO_UART0_NOTIFICATION_EP_NUM, 64, CDC_PIO_UART0_DATA_OUT_EP_NUM, CDC_PIO_UART0_DATA_IN_EP_NUM, 64),
+#endif
+#if OPT_PIO_UART_N >= 2
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_PIO_UART1_COM, STRID_INTERFACE_CDC_PIO_UART1, CDC_PIO_UART1_NOTIFICATION_EP_NUM, 64, CDC_PIO_UART1_DATA_OUT_EP_NUM, CDC_PIO_UART1_DATA_IN_EP_NUM, 64),
+#endif
+#if OPT_EVENT_STREAM
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_EVENTS_COM, STRID_INTERFACE_CDC_EVENTS, CDC_EVENTS_NOTIFICATION_EP_NUM, 64, CDC_EVENTS_DATA_OUT_EP_NUM, CDC_EVENTS_DATA_IN_EP_NUM, 64),
+#endif
 };
 
 
@@ -333,6 +394,15 @@ static char const* string_desc_arr[] =
 #if OPT_CDC_SYSVIEW
     [STRID_INTERFACE_CDC_SYSVIEW]  = "YAPicoprobe CDC-SysView",           // Interface descriptor for SysView CDC
 #endif
+#if OPT_PIO_UART_N >= 1
+    [STRID_INTERFACE_CDC_PIO_UART0] = "YAPicoprobe CDC-UART1",            // Interface descriptor for CDC of PIO UART 0
+#endif
+#if OPT_PIO_UART_N >= 2
+    [STRID_INTERFACE_CDC_PIO_UART1] = "YAPicoprobe CDC-UART2",            // Interface descriptor for CDC of PIO UART 1
+#endif
+#if OPT_EVENT_STREAM
+    [STRID_INTERFACE_CDC_EVENTS]   = "YAPicoprobe CDC-Events",            // Interface descriptor for the merged event stream
+#endif
 };
 
 static uint16_t _desc_str[32];
@@ -0,0 +1,284 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Benchmark of the compression in buffered capture mode ('B'): typical bus signals sampled with 10MS/s
+ * are encoded segment by segment into a store like the one behind the DMA ring.  Prints compression
+ * ratio against the raw capture, encoder time per sample and the resulting capture depth of the store.
+ * The stored data is decoded again, so the benchmark also fails if the round trip breaks.
+ * Host timings, so the times are only relative for the RP2040.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+#include "test_sigrok.h"
+
+
+#define SAMPLE_RATE     10000000
+#define SAMPLES         1000000
+#define DEEP_RING_SIZE  (SR_DMA_BUF_SIZE / 4)                 // default SR_DEEP_RING_SIZE of sigrok.c
+#define STORE_SIZE      (SR_DMA_BUF_SIZE - DEEP_RING_SIZE)
+#define SEG_BYTES       (DEEP_RING_SIZE / 4)
+
+static uint8_t           capture[4 * SAMPLES] __attribute__((aligned(4)));
+static uint32_t          ref[SAMPLES];
+static uint32_t          decoded[SAMPLES + 100];
+static sr_test_decoder_t dec;
+static uint32_t          store_len;
+
+
+
+void sigrok_tx_write(const uint8_t *buf, uint32_t cnt)
+{
+    store_len += cnt;
+    sr_test_decode(&dec, buf, cnt, decoded, SAMPLES + 100, NULL);
+}   // sigrok_tx_write
+
+
+
+static uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}   // hash32
+
+
+
+/// 1kHz clock on ch0
+static uint32_t sig_clock(uint32_t i)
+{
+    return (i / (SAMPLE_RATE / 2000)) & 1;
+}   // sig_clock
+
+
+
+/// 50kHz PWM with 30% duty cycle on ch0, inverted on ch1
+static uint32_t sig_pwm(uint32_t i)
+{
+    uint32_t on = (i % (SAMPLE_RATE / 50000)) < 3 * SAMPLE_RATE / 50000 / 10;
+
+    return on | (!on << 1);
+}   // sig_pwm
+
+
+
+/// 115200 baud UART, TX on ch0 with 50% load, RX on ch1 with 10% load
+static uint32_t sig_uart(uint32_t i)
+{
+    uint32_t bit = (uint32_t)((uint64_t)i * 115200 / SAMPLE_RATE);
+    uint32_t val = 0;
+
+    for (uint32_t ch = 0;  ch < 2;  ++ch) {
+        uint32_t period = (ch == 0) ? 20 : 100;
+        uint32_t frame = bit / period;
+        uint32_t pos = bit % period;
+        uint32_t level = 1;
+
+        if (pos == 0) {
+            level = 0;
+        }
+        else if (pos <= 8) {
+            level = (hash32(2 * frame + ch) >> (pos - 1)) & 1;
+        }
+        val |= level << ch;
+    }
+    return val;
+}   // sig_uart
+
+
+
+/// 1MHz SPI mode 0: CLK ch0, MOSI ch1, CS ch2, MISO ch3, bursts of 4 bytes every 1ms
+static uint32_t sig_spi(uint32_t i)
+{
+    const uint32_t half = SAMPLE_RATE / 2000000;
+    uint32_t burst = i / (SAMPLE_RATE / 1000);
+    uint32_t t = i % (SAMPLE_RATE / 1000);
+    uint32_t clk, bit;
+
+    if (t < 10  ||  t >= 10 + 64 * half + 10) {
+        return 0x4;
+    }
+    if (t >= 10 + 64 * half) {
+        return 0x0;
+    }
+    t -= 10;
+    clk = (t / half) & 1;
+    bit = 31 - t / (2 * half);
+    return clk | (((hash32(2 * burst) >> bit) & 1) << 1) | (((hash32(2 * burst + 1) >> bit) & 1) << 3);
+}   // sig_spi
+
+
+
+/// 400kHz I2C: SCL ch0, SDA ch1, address + 2 bytes every 1ms
+static uint32_t sig_i2c(uint32_t i)
+{
+    const uint32_t bit_len = SAMPLE_RATE / 400000;
+    uint32_t xfer = i / (SAMPLE_RATE / 1000);
+    uint32_t t = i % (SAMPLE_RATE / 1000);
+    uint32_t n, sda;
+
+    if (t < bit_len / 2) {
+        return 0x1;                                  // START: SDA low while SCL high
+    }
+    t -= bit_len / 2;
+    n = t / bit_len;
+    if (n < 27) {
+        uint32_t scl = (t % bit_len) >= bit_len / 2;
+
+        if (n % 9 == 8) {
+            sda = 0;                                 // ACK
+        }
+        else {
+            sda = (hash32(xfer) >> (8 * (n / 9) + 7 - n % 9)) & 1;
+        }
+        return scl | (sda << 1);
+    }
+    if (n == 27  &&  (t % bit_len) < bit_len / 2) {
+        return 0x1;                                  // STOP: SDA rises while SCL high
+    }
+    return 0x3;
+}   // sig_i2c
+
+
+
+/// random data on all channels changing with 1% probability
+static uint32_t sig_random(uint32_t i)
+{
+    static uint32_t val;
+
+    if ((test_rand() & 0xffff) < 655) {
+        val = test_rand();
+    }
+    return val;
+}   // sig_random
+
+
+
+static void bench(uint32_t d_mask, const char *mode, uint32_t (*sig)(uint32_t), const char *name)
+{
+    uint32_t samples_per_seg;
+    uint64_t t0, t = UINT64_MAX;
+    double raw_bytes, ratio, raw_ms, store_ms;
+
+    sr_test_setup(d_mask, 0);
+    sr_dev.continuous  = false;
+    sr_dev.buffered    = true;
+    sr_dev.num_samples = SAMPLES;
+    samples_per_seg = ((d_dma_bps == 0) ? 2 * SEG_BYTES : SEG_BYTES / d_dma_bps) & ~7u;
+
+    for (uint32_t i = 0;  i < SAMPLES;  ++i) {
+        uint32_t raw = sig(i);
+
+        ref[i] = raw & d_mask;
+        switch (d_dma_bps) {
+            case 0:
+                if ((i & 1) == 0) {
+                    capture[i / 2] = raw & 0x0f;
+                }
+                else {
+                    capture[i / 2] |= (raw & 0x0f) << 4;
+                }
+                break;
+            case 1:
+                capture[i] = raw;
+                break;
+            case 2:
+                memcpy(capture + 2 * i, &raw, 2);
+                break;
+            default:
+                memcpy(capture + 4 * i, &raw, 4);
+                break;
+        }
+    }
+
+    for (int rep = 0;  rep < 3;  ++rep) {
+        memset(&dec, 0, sizeof(dec));
+        store_len = 0;
+        sent_cnt = 0;
+        sr_dev.scnt = 0;
+        t0 = test_now_ns();
+        for (uint32_t pos = 0;  pos < SAMPLES;  pos += samples_per_seg) {
+            uint32_t n = MIN(samples_per_seg, SAMPLES - pos);
+
+            sigrok_encode_slices(&sr_dev, capture + ((d_dma_bps == 0) ? pos / 2 : pos * d_dma_bps), NULL, n);
+        }
+        t = MIN(t, test_now_ns() - t0);
+
+        if (dec.error  ||  dec.cnt != SAMPLES  ||  memcmp(decoded, ref, sizeof(ref)) != 0) {
+            fprintf(stderr, "%s %s: round trip failed, decoded %u samples%s\n", mode, name, dec.cnt,
+                    dec.error ? ", format error" : "");
+            ++test_failures;
+            return;
+        }
+    }
+
+    raw_bytes = (d_dma_bps == 0) ? SAMPLES / 2.0 : (double)SAMPLES * d_dma_bps;
+    ratio = raw_bytes / store_len;
+    raw_ms = 1e3 * (STORE_SIZE / (raw_bytes / SAMPLES)) / SAMPLE_RATE;
+    store_ms = 1e3 * (STORE_SIZE / ((double)store_len / SAMPLES)) / SAMPLE_RATE;
+    printf("%-8s %-8s ratio %8.1f, %7.4f bytes/sample, %5.2f ns/sample, depth %9.1f ms (raw %5.2f ms)\n",
+           mode, name, ratio, (double)store_len / SAMPLES, (double)t / SAMPLES, store_ms, raw_ms);
+}   // bench
+
+
+
+int main(void)
+{
+    static const struct {
+        uint32_t d_mask;
+        const char *name;
+    } modes[] = {
+        { 0xf,      "D4 4ch" },
+        { 0xff,     "1B 8ch" },
+        { 0xffff,   "2B 16ch" },
+        { 0x1fffff, "4B 21ch" },
+    };
+    static const struct {
+        uint32_t (*sig)(uint32_t);
+        const char *name;
+    } signals[] = {
+        { sig_clock,  "clock" },
+        { sig_pwm,    "pwm" },
+        { sig_uart,   "uart" },
+        { sig_spi,    "spi" },
+        { sig_i2c,    "i2c" },
+        { sig_random, "rand 1%" },
+    };
+
+    printf("%uMS/s, store %u bytes, depth is the capture time which fits into the store\n",
+           SAMPLE_RATE / 1000000, STORE_SIZE);
+    for (uint32_t m = 0;  m < sizeof(modes) / sizeof(modes[0]);  ++m) {
+        for (uint32_t s = 0;  s < sizeof(signals) / sizeof(signals[0]);  ++s) {
+            bench(modes[m].d_mask, modes[m].name, signals[s].sig, signals[s].name);
+        }
+    }
+    return test_result("bench_sigrok_buffered");
+}   // main
@@ -0,0 +1,129 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Benchmark of the sigrok encoders in MS/s, the way sigrok_encoder_thread() runs them:
+ * continuous capture, segments of a quarter of the capture buffer, output copied into a
+ * transmit ring.  The sustained rate is also limited by the link, estimated here with 1 MByte/s
+ * for CDC on USB full speed.  Host timings, so the numbers are only relative for the RP2040.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+#include "test_sigrok.h"
+
+
+#define SEGMENTS        4
+#define SEG_BYTES       (SR_DMA_BUF_SIZE / SEGMENTS)
+#define LINK_BYTES_S    1000000.0
+
+static uint8_t  capture[SR_DMA_BUF_SIZE] __attribute__((aligned(4)));
+static uint8_t  acapture[SR_DMA_BUF_SIZE];
+static uint32_t ref[2 * SR_DMA_BUF_SIZE];
+static uint8_t  tx_ring[4096];
+static uint32_t tx_pos;
+
+
+
+void sigrok_tx_write(const uint8_t *buf, uint32_t cnt)
+{
+    uint32_t ndx = tx_pos % sizeof(tx_ring);
+    uint32_t n = MIN(cnt, sizeof(tx_ring) - ndx);
+
+    memcpy(tx_ring + ndx, buf, n);
+    memcpy(tx_ring, buf + n, cnt - n);
+    tx_pos += cnt;
+}   // sigrok_tx_write
+
+
+
+static void bench(uint32_t d_mask, uint32_t a_mask, uint32_t activity, const char *name)
+{
+    uint32_t bytes_per_sample = (d_dma_bps == 0) ? 1 : d_dma_bps;
+    uint32_t samples_per_seg, samples;
+    uint64_t t0, t = UINT64_MAX;
+    double ms_s, link_ms_s, bps;
+
+    sr_test_setup(d_mask, a_mask);
+    if (d_dma_bps == 0) {
+        samples_per_seg = 2 * SEG_BYTES;
+    }
+    else {
+        bytes_per_sample = d_dma_bps + sr_dev.a_chan_cnt;
+        samples_per_seg = SEG_BYTES / bytes_per_sample;
+    }
+    samples_per_seg &= ~7u;
+    samples = SEGMENTS * samples_per_seg;
+    sr_test_capture(capture, ref, samples, activity);
+    for (uint32_t i = 0;  i < samples * sr_dev.a_chan_cnt;  ++i) {
+        acapture[i] = (uint8_t)test_rand();
+    }
+
+    for (int rep = 0;  rep < 5;  ++rep) {
+        tx_pos = 0;
+        t0 = test_now_ns();
+        for (uint32_t seg = 0;  seg < SEGMENTS;  ++seg) {
+            uint32_t first = seg * samples_per_seg;
+            uint8_t *dbuf = capture + ((d_dma_bps == 0) ? first / 2 : first * d_dma_bps);
+
+            sigrok_encode_slices(&sr_dev, dbuf, acapture + first * sr_dev.a_chan_cnt, samples_per_seg);
+        }
+        t = MIN(t, test_now_ns() - t0);
+    }
+
+    ms_s = 1e3 * samples / t;
+    bps = (double)tx_pos / samples;
+    link_ms_s = LINK_BYTES_S / bps / 1e6;
+    printf("%-12s activity %5.2f%%: encoder %8.1f MS/s, %6.3f bytes/sample, link %8.3f MS/s -> sustained %8.3f MS/s\n",
+           name, 100.0 * activity / 65536, ms_s, bps, link_ms_s, MIN(ms_s, link_ms_s));
+    CHECK(tx_pos != 0);
+}   // bench
+
+
+
+int main(void)
+{
+    static const struct {
+        uint32_t d_mask;
+        uint32_t a_mask;
+        const char *name;
+    } modes[] = {
+        { 0xf,      0,   "D4 4ch" },
+        { 0xff,     0,   "1B 8ch" },
+        { 0xffff,   0,   "2B 16ch" },
+        { 0x1fffff, 0,   "4B 21ch" },
+        { 0xff,     0x7, "8ch + 3 ADC" },
+    };
+    static const uint32_t activity[] = { 0, 66, 655, 6554, 32768 };
+
+    for (uint32_t m = 0;  m < sizeof(modes) / sizeof(modes[0]);  ++m) {
+        for (uint32_t a = 0;  a < sizeof(activity) / sizeof(activity[0]);  ++a) {
+            bench(modes[m].d_mask, modes[m].a_mask, activity[a], modes[m].name);
+        }
+    }
+    return test_result("bench_sigrok_encode");
+}   // main
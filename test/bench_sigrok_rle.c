@@ -0,0 +1,161 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Benchmark of the word parallel RLE change detection of send_slices_1B/2B/4B against a per slice
+ * reference encoder (the way sigrok-pico did it before).  Both must produce the same byte stream.
+ * Timings are host timings, so only the ratio is meaningful for the RP2040.  The benchmark is built
+ * without auto vectorization, because the Cortex-M0+ has no SIMD unit.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+#include "test_sigrok.h"
+
+
+#define SAMPLES         200000
+#define OUT_MAX         (6 * SAMPLES)
+
+static uint8_t  capture[4 * SAMPLES] __attribute__((aligned(4)));
+static uint32_t ref[SAMPLES];
+static uint8_t  out[OUT_MAX], out_ref[OUT_MAX];
+static uint32_t out_len;
+static bool     collect;
+
+
+
+void sigrok_tx_write(const uint8_t *buf, uint32_t cnt)
+{
+    if (collect  &&  out_len + cnt <= OUT_MAX) {
+        memcpy(out + out_len, buf, cnt);
+    }
+    out_len += cnt;
+}   // sigrok_tx_write
+
+
+
+static inline uint32_t ref_slice(const uint8_t *dbuf, uint32_t i)
+{
+    if (d_dma_bps == 1) {
+        return dbuf[i] & sr_dev.d_mask;
+    }
+    else if (d_dma_bps == 2) {
+        return ((const uint16_t *)dbuf)[i] & sr_dev.d_mask;
+    }
+    return ((const uint32_t *)dbuf)[i] & sr_dev.d_mask;
+}   // ref_slice
+
+
+
+static uint32_t ref_encode(const uint8_t *dbuf, uint32_t cnt, uint8_t *buf)
+/**
+ * Per slice RLE encoder: every slice is read out of the capture buffer, masked and compared
+ * with the previous one.
+ */
+{
+    uint32_t n = 0;
+    uint32_t rle = 0;
+    uint32_t last = ref_slice(dbuf, 0);
+
+#define REF_SAMPLE(v)   do { uint32_t _v = (v);                                   \
+                             for (uint32_t b = 0;  b < sr_dev.d_tx_bps;  ++b) {   \
+                                 buf[n++] = (_v & 0x7f) | 0x80;                   \
+                                 _v >>= 7;                                        \
+                             } } while (0)
+#define REF_RLE()       do { while (rle >= 1568) { buf[n++] = 127;  rle -= 1568; }         \
+                             if (rle > 32) { buf[n++] = (rle >> 5) + 78;  rle &= 31; }     \
+                             if (rle != 0) { buf[n++] = 47 + rle;  rle = 0; } } while (0)
+
+    REF_SAMPLE(last);
+    for (uint32_t i = 1;  i < cnt;  ++i) {
+        uint32_t v = ref_slice(dbuf, i);
+
+        if (v == last) {
+            ++rle;
+        }
+        else {
+            REF_RLE();
+            last = v;
+            REF_SAMPLE(last);
+        }
+    }
+    REF_RLE();
+    return n;
+#undef REF_SAMPLE
+#undef REF_RLE
+}   // ref_encode
+
+
+
+static void bench(uint32_t d_mask, uint32_t activity, const char *name)
+{
+    uint64_t t0, t_enc = UINT64_MAX, t_ref = UINT64_MAX;
+    uint32_t ref_len = 0;
+
+    sr_test_setup(d_mask, 0);
+    sr_test_capture(capture, ref, SAMPLES, activity);
+
+    // same output
+    collect = true;
+    out_len = 0;
+    sigrok_encode_slices(&sr_dev, capture, NULL, SAMPLES);
+    ref_len = ref_encode(capture, SAMPLES, out_ref);
+    CHECK_EQ(out_len, ref_len);
+    CHECK(memcmp(out, out_ref, ref_len) == 0);
+    collect = false;
+
+    for (int rep = 0;  rep < 5;  ++rep) {
+        t0 = test_now_ns();
+        sigrok_encode_slices(&sr_dev, capture, NULL, SAMPLES);
+        t_enc = MIN(t_enc, test_now_ns() - t0);
+
+        t0 = test_now_ns();
+        ref_encode(capture, SAMPLES, out_ref);
+        t_ref = MIN(t_ref, test_now_ns() - t0);
+    }
+
+    printf("%-8s activity %5.2f%%: %7.1f bytes/1000 samples, word parallel %7.1f MS/s, per slice %7.1f MS/s (x%.1f)\n",
+           name, 100.0 * activity / 65536, 1000.0 * ref_len / SAMPLES,
+           1e3 * SAMPLES / t_enc, 1e3 * SAMPLES / t_ref, (double)t_ref / t_enc);
+}   // bench
+
+
+
+int main(void)
+{
+    static const uint32_t masks[] = { 0xff, 0xffff, 0x1fffff };
+    static const char *names[] = { "1B 8ch", "2B 16ch", "4B 21ch" };
+    static const uint32_t activity[] = { 0, 7, 66, 655, 6554, 32768 };
+
+    for (int m = 0;  m < 3;  ++m) {
+        for (int a = 0;  a < 6;  ++a) {
+            bench(masks[m], activity[a], names[m]);
+        }
+    }
+    return test_result("bench_sigrok_rle");
+}   // main
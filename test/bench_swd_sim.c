@@ -0,0 +1,142 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Benchmark of the SWD stack against the target model: memory reads/writes via swd_host.c
+ * and SWD_Transfer() of sw_dp_pio.c.
+ *
+ * Wire time is taken from the SWCLK cycles the simulated probe clocked out, so the KByte/s
+ * columns are the upper limit for the given SWCLK without USB and PIO overhead.  "cycles/word"
+ * shows the protocol overhead of a transfer (46 cycles for a 32 bit data word with turnaround 1),
+ * "host us" the CPU time of the simulation which is only of interest when changing the model.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "DAP.h"
+#include "swd_host.h"
+
+#include "swd_target.h"
+#include "probe_sim.h"
+
+
+#define RAM_START       0x20000000
+#define RAM_SIZE        (64 * 1024)
+#define BLOCK_SIZE      RAM_SIZE
+
+static swd_target_t target;
+static uint8_t buf[BLOCK_SIZE];
+
+
+
+typedef struct {
+    uint64_t cycles;
+    uint32_t transfers;
+    uint64_t host_ns;
+} bench_t;
+
+
+
+static void bench_start(bench_t *b)
+{
+    b->cycles    = probe_sim_stats.cycles;
+    b->transfers = target.transfers;
+    b->host_ns   = test_now_ns();
+}   // bench_start
+
+
+
+static void bench_print(const char *name, bench_t *b, uint32_t bytes)
+{
+    static const uint32_t swclk_khz[] = { 10000, 25000 };
+    uint64_t cycles = probe_sim_stats.cycles - b->cycles;
+    uint32_t transfers = target.transfers - b->transfers;
+    uint64_t host_ns = test_now_ns() - b->host_ns;
+
+    printf("%-16s %8u %10llu", name, transfers, (unsigned long long)cycles);
+    if (bytes == 0) {
+        printf("\n");
+        return;
+    }
+    printf(" %8.1f %8.2f", (double)cycles / (bytes / 4), (double)transfers / (bytes / 4));
+    for (uint32_t i = 0;  i < sizeof(swclk_khz) / sizeof(swclk_khz[0]);  ++i) {
+        printf(" %9.1f", bytes / 1024.0 / (cycles / (swclk_khz[i] * 1000.0)));
+    }
+    printf(" %9.0f\n", host_ns / 1000.0);
+}   // bench_print
+
+
+
+int main(void)
+{
+    static const swd_target_cfg_t cfg = {
+        .dpidr           = 0x2ba01477,
+        .pwrup_delay     = 1,
+        .flash_start     = 0x00000000,
+        .flash_size      = 4096,
+        .flash_page_size = 4096,
+        .ram_start       = RAM_START,
+        .ram_size        = RAM_SIZE,
+    };
+    bench_t b;
+    uint32_t v;
+
+    swd_target_init(&target, &cfg);
+    probe_sim_attach(&target);
+    for (uint32_t i = 0;  i < sizeof(buf);  ++i) {
+        buf[i] = (uint8_t)test_rand();
+    }
+
+    printf("%u KByte RAM, turnaround %u\n", BLOCK_SIZE / 1024, target.cfg.turnaround);
+    printf("operation       transfers     cycles  cyc/word xfer/word  10MHz[KB/s] 25MHz[KB/s]  host us\n");
+
+    bench_start(&b);
+    CHECK(swd_init_debug());
+    bench_print("connect", &b, 0);
+
+    bench_start(&b);
+    CHECK(swd_write_memory(RAM_START, buf, sizeof(buf)));
+    bench_print("write block", &b, sizeof(buf));
+
+    bench_start(&b);
+    CHECK(swd_read_memory(RAM_START, buf, sizeof(buf)));
+    bench_print("read block", &b, sizeof(buf));
+
+    bench_start(&b);
+    CHECK(swd_write_memory(RAM_START + 1, buf, 4096));
+    bench_print("write unaligned", &b, 4096);
+
+    bench_start(&b);
+    for (uint32_t a = 0;  a < 4096;  a += 4) {
+        CHECK(swd_read_word(RAM_START + a, &v));
+    }
+    bench_print("read word", &b, 4096);
+
+    CHECK_EQ(target.contention, 0);
+    CHECK_EQ(probe_sim_stats.fifo_errors, 0);
+    swd_target_free(&target);
+    return test_result("bench_swd_sim");
+}   // main
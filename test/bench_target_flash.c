@@ -0,0 +1,98 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Benchmark of the DAPLink target programming: throughput of single vs double buffered programming
+ * for several page programming times of the modelled target (see test_target_flash.h).
+ *
+ * An image arrives as UF2 blocks (256 bytes) which are handed to flash_manager like the MSC writer
+ * thread does it.  Reception of a block takes USB_NS_PER_BLOCK, SWD download SWD_NS_PER_BYTE.
+ * With double buffering reception and download of the next page overlap with programming.
+ * Time is virtual, so the numbers are reproducible.
+ */
+
+#include "test_target_flash.h"
+#include "flash_manager.h"
+
+
+#define IMAGE_SIZE          (64 * 1024)
+#define USB_NS_PER_BLOCK    250000                   // 256 bytes/UF2 block with ~1MByte/s of MSC writes
+#define SWD_NS_PER_BYTE     400                      // ~2.5MByte/s with SWCLK 25MHz
+
+
+static uint8_t image[IMAGE_SIZE];
+
+
+
+/// program the image, returns the virtual time in ns
+static uint64_t program(program_target_t *algo, uint32_t program_ns)
+{
+    uint64_t t0;
+
+    tf.program_ns      = program_ns;
+    tf.erase_ns        = 0;                          // erase is the same for both, exclude it
+    tf.call_ns         = 20000;
+    tf.swd_ns_per_byte = SWD_NS_PER_BYTE;
+    tf_setup(algo);
+
+    flash_manager_set_page_erase(true);
+    CHECK_EQ(flash_manager_init(flash_intf_target), ERROR_SUCCESS);
+    t0 = tf.now_ns;
+    for (uint32_t a = 0;  a < IMAGE_SIZE;  a += 256) {
+        tf.now_ns += USB_NS_PER_BLOCK;
+        CHECK_EQ(flash_manager_data(a, image + a, 256), ERROR_SUCCESS);
+    }
+    CHECK_EQ(flash_manager_uninit(), ERROR_SUCCESS);
+
+    CHECK(memcmp(tf.flash, image, IMAGE_SIZE) == 0);
+    CHECK_EQ(tf.violations, 0);
+    return tf.now_ns - t0;
+}   // program
+
+
+
+int main(void)
+{
+    static const uint32_t program_us[] = { 250, 1000, 2000, 4000, 8000 };
+
+    for (uint32_t i = 0;  i < sizeof(image);  ++i) {
+        image[i] = (uint8_t)test_rand();
+    }
+
+    printf("%u KByte image, %u byte pages, USB %u us/UF2 block, SWD %u ns/byte\n",
+           IMAGE_SIZE / 1024, TF_PAGE_SIZE, USB_NS_PER_BLOCK / 1000, SWD_NS_PER_BYTE);
+    printf("program/page    single [KByte/s]    double [KByte/s]    speedup\n");
+    for (uint32_t i = 0;  i < sizeof(program_us) / sizeof(program_us[0]);  ++i) {
+        uint64_t t_single = program(&tf_algo_single, 1000 * program_us[i]);
+        uint64_t t_double = program(&tf_algo_double, 1000 * program_us[i]);
+        double kbs_single = IMAGE_SIZE / 1024.0 / (t_single / 1e9);
+        double kbs_double = IMAGE_SIZE / 1024.0 / (t_double / 1e9);
+
+        printf("%8u us       %10.1f          %10.1f          %5.2f\n",
+               program_us[i], kbs_single, kbs_double, kbs_double / kbs_single);
+        CHECK(t_double <= t_single);
+    }
+    return test_result("bench_target_flash");
+}   // main
@@ -0,0 +1,5 @@
+// host model of lwIP: lwip/debug.h
+#ifndef _LWIP_SIM_DEBUG_H
+#define _LWIP_SIM_DEBUG_H
+
+#endif
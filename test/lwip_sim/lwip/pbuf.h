@@ -0,0 +1,20 @@
+// host model of lwIP: lwip/pbuf.h, pbufs are allocated with malloc() and counted
+#ifndef _LWIP_SIM_PBUF_H
+#define _LWIP_SIM_PBUF_H
+
+#include <stdint.h>
+
+struct pbuf {
+    struct pbuf *next;
+    void        *payload;
+    uint16_t     tot_len;
+    uint16_t     len;
+    uint8_t      ref;
+};
+
+uint8_t      pbuf_free(struct pbuf *p);
+void         pbuf_cat(struct pbuf *head, struct pbuf *tail);
+struct pbuf *pbuf_free_header(struct pbuf *q, uint16_t size);
+uint16_t     pbuf_copy_partial(const struct pbuf *p, void *dataptr, uint16_t len, uint16_t offset);
+
+#endif
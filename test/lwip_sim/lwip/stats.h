@@ -0,0 +1,5 @@
+// host model of lwIP: lwip/stats.h
+#ifndef _LWIP_SIM_STATS_H
+#define _LWIP_SIM_STATS_H
+
+#endif
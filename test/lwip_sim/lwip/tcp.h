@@ -0,0 +1,82 @@
+// host model of lwIP: lwip/tcp.h, see lwip_sim.h
+#ifndef _LWIP_SIM_TCP_H
+#define _LWIP_SIM_TCP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+
+#define TCP_MSS                 1460
+#define TCP_SND_BUF             (4 * TCP_MSS)
+#define TCP_WND                 (4 * TCP_MSS)
+#define TCP_PRIO_MAX            127
+#define TCP_WRITE_FLAG_COPY     0x01
+#define TCP_WRITE_FLAG_MORE     0x02
+
+#define IPADDR_TYPE_ANY         46U
+#define IP_ADDR_ANY             NULL
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_accept_fn)(void *arg, struct tcp_pcb *newpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *tpcb, uint16_t len);
+typedef err_t (*tcp_poll_fn)(void *arg, struct tcp_pcb *tpcb);
+typedef void  (*tcp_err_fn)(void *arg, err_t err);
+
+/// segment written without TCP_WRITE_FLAG_COPY, must stay unchanged until acknowledged
+typedef struct lwip_sim_ref {
+    struct lwip_sim_ref *next;
+    const uint8_t       *data;
+    uint16_t             len;
+    uint8_t             *copy;
+} lwip_sim_ref_t;
+
+struct tcp_pcb {
+    void           *callback_arg;
+    tcp_accept_fn   accept;
+    tcp_recv_fn     recv;
+    tcp_sent_fn     sent;
+    tcp_poll_fn     poll;
+    tcp_err_fn      errf;
+    uint8_t         pollinterval;
+    uint16_t        port;
+    bool            listening;
+
+    // model state
+    uint16_t        snd_buf;                ///< tcp_sndbuf()
+    uint32_t        unacked;                ///< written, not yet acknowledged
+    uint32_t        recved;                 ///< sum of tcp_recved(), i.e. window opened by the application
+    uint8_t        *tx;                     ///< all data written by the application
+    uint32_t        tx_len;
+    lwip_sim_ref_t *refs;
+    uint32_t        outputs;                ///< tcp_output() calls
+    bool            closed;                 ///< tcp_close() succeeded
+    bool            aborted;                ///< tcp_abort() called, pcb is gone
+    bool            freed;                  ///< pcb is gone (abort, error callback)
+    err_t           close_result;           ///< injected result of tcp_close()
+    err_t           write_result;           ///< injected result of tcp_write()
+};
+
+#define tcp_sndbuf(pcb)     ((pcb)->snd_buf)
+
+struct tcp_pcb *tcp_new_ip_type(uint8_t type);
+err_t           tcp_bind(struct tcp_pcb *pcb, const void *ipaddr, uint16_t port);
+struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, uint8_t backlog);
+void            tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept);
+void            tcp_arg(struct tcp_pcb *pcb, void *arg);
+void            tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv);
+void            tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent);
+void            tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, uint8_t interval);
+void            tcp_err(struct tcp_pcb *pcb, tcp_err_fn err);
+void            tcp_setprio(struct tcp_pcb *pcb, uint8_t prio);
+void            tcp_nagle_disable(struct tcp_pcb *pcb);
+void            tcp_recved(struct tcp_pcb *pcb, uint16_t len);
+err_t           tcp_write(struct tcp_pcb *pcb, const void *dataptr, uint16_t len, uint8_t apiflags);
+err_t           tcp_output(struct tcp_pcb *pcb);
+err_t           tcp_close(struct tcp_pcb *pcb);
+void            tcp_abort(struct tcp_pcb *pcb);
+
+#endif
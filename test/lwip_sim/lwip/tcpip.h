@@ -0,0 +1,13 @@
+// host model of lwIP: lwip/tcpip.h, callbacks are queued and executed by lwip_sim_run()
+#ifndef _LWIP_SIM_TCPIP_H
+#define _LWIP_SIM_TCPIP_H
+
+#include "lwip/err.h"
+
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+err_t tcpip_try_callback(tcpip_callback_fn function, void *ctx);
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx);
+#define tcpip_callback_with_block(function, ctx, block)     tcpip_callback(function, ctx)
+
+#endif
@@ -0,0 +1,742 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Host model of the lwIP raw TCP API, FreeRTOS stream buffers and semaphores, see lwip_sim.h.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip_sim.h"
+
+
+#define LISTEN_N        8
+#define CALLBACK_N      64
+
+
+lwip_sim_stats_t   lwip_sim_stats;
+lwip_sim_thread_t  lwip_sim_thread;
+uint32_t           lwip_sim_callback_limit = CALLBACK_N;
+void             (*lwip_sim_blocked)(void);
+
+static struct tcp_pcb *listeners[LISTEN_N];
+
+static struct {
+    tcpip_callback_fn  function;
+    void              *ctx;
+} callbacks[CALLBACK_N];
+static uint32_t callback_n;
+
+struct lwip_sim_stream {
+    uint8_t  *buf;
+    size_t    size;
+    size_t    rd;
+    size_t    len;
+};
+
+struct lwip_sim_sema {
+    bool      given;
+};
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// pbuf
+//
+
+struct pbuf *lwip_sim_pbuf(const void *data, uint16_t len)
+{
+    struct pbuf *p = malloc(sizeof(struct pbuf) + len);
+
+    p->next    = NULL;
+    p->payload = p + 1;
+    p->tot_len = len;
+    p->len     = len;
+    p->ref     = 1;
+    memcpy(p->payload, data, len);
+    ++lwip_sim_stats.pbufs;
+    return p;
+}   // lwip_sim_pbuf
+
+
+
+uint8_t pbuf_free(struct pbuf *p)
+{
+    uint8_t cnt = 0;
+
+    while (p != NULL  &&  --p->ref == 0) {
+        struct pbuf *next = p->next;
+
+        free(p);
+        --lwip_sim_stats.pbufs;
+        ++cnt;
+        p = next;
+    }
+    return cnt;
+}   // pbuf_free
+
+
+
+void pbuf_cat(struct pbuf *head, struct pbuf *tail)
+{
+    struct pbuf *p;
+
+    for (p = head;  p->next != NULL;  p = p->next) {
+        p->tot_len += tail->tot_len;
+    }
+    p->tot_len += tail->tot_len;
+    p->next = tail;
+}   // pbuf_cat
+
+
+
+struct pbuf *pbuf_free_header(struct pbuf *q, uint16_t size)
+{
+    struct pbuf *p = q;
+    uint16_t free_left = size;
+
+    while (free_left != 0  &&  p != NULL) {
+        if (free_left >= p->len) {
+            struct pbuf *f = p;
+
+            free_left -= p->len;
+            p = p->next;
+            f->next = NULL;
+            pbuf_free(f);
+        }
+        else {
+            p->payload = (uint8_t *)p->payload + free_left;
+            p->len     -= free_left;
+            p->tot_len -= free_left;
+            free_left = 0;
+        }
+    }
+    return p;
+}   // pbuf_free_header
+
+
+
+uint16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, uint16_t len, uint16_t offset)
+{
+    uint16_t copied = 0;
+
+    for ( ;  p != NULL  &&  copied < len;  p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        uint16_t n = p->len - offset;
+
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        memcpy((uint8_t *)dataptr + copied, (const uint8_t *)p->payload + offset, n);
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}   // pbuf_copy_partial
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// TCP
+//
+
+static struct tcp_pcb *pcb_new(void)
+{
+    struct tcp_pcb *pcb = calloc(1, sizeof(struct tcp_pcb));
+
+    pcb->snd_buf = TCP_SND_BUF;
+    return pcb;
+}   // pcb_new
+
+
+
+static bool pcb_ok(struct tcp_pcb *pcb)
+{
+    if (pcb == NULL  ||  pcb->freed) {
+        ++lwip_sim_stats.use_after_free;
+        return false;
+    }
+    return true;
+}   // pcb_ok
+
+
+
+static err_t check_result(struct tcp_pcb *pcb, err_t err)
+/**
+ * A callback must return ERR_ABRT if and only if it has called tcp_abort().
+ */
+{
+    if ((err == ERR_ABRT) != pcb->aborted) {
+        ++lwip_sim_stats.abrt_errors;
+    }
+    return err;
+}   // check_result
+
+
+
+struct tcp_pcb *tcp_new_ip_type(uint8_t type)
+{
+    return pcb_new();
+}   // tcp_new_ip_type
+
+
+
+err_t tcp_bind(struct tcp_pcb *pcb, const void *ipaddr, uint16_t port)
+{
+    pcb->port = port;
+    return ERR_OK;
+}   // tcp_bind
+
+
+
+struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, uint8_t backlog)
+{
+    for (int i = 0;  i < LISTEN_N;  ++i) {
+        if (listeners[i] == NULL) {
+            listeners[i] = pcb;
+            pcb->listening = true;
+            return pcb;
+        }
+    }
+    return NULL;
+}   // tcp_listen_with_backlog
+
+
+
+void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept)
+{
+    pcb->accept = accept;
+}   // tcp_accept
+
+
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg)
+{
+    if (pcb_ok(pcb)) {
+        pcb->callback_arg = arg;
+    }
+}   // tcp_arg
+
+
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv)
+{
+    if (pcb_ok(pcb)) {
+        pcb->recv = recv;
+    }
+}   // tcp_recv
+
+
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent)
+{
+    if (pcb_ok(pcb)) {
+        pcb->sent = sent;
+    }
+}   // tcp_sent
+
+
+
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, uint8_t interval)
+{
+    if (pcb_ok(pcb)) {
+        pcb->poll = poll;
+        pcb->pollinterval = interval;
+    }
+}   // tcp_poll
+
+
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err)
+{
+    if (pcb_ok(pcb)) {
+        pcb->errf = err;
+    }
+}   // tcp_err
+
+
+
+void tcp_setprio(struct tcp_pcb *pcb, uint8_t prio)
+{
+    pcb_ok(pcb);
+}   // tcp_setprio
+
+
+
+void tcp_nagle_disable(struct tcp_pcb *pcb)
+{
+    pcb_ok(pcb);
+}   // tcp_nagle_disable
+
+
+
+void tcp_recved(struct tcp_pcb *pcb, uint16_t len)
+{
+    if (pcb_ok(pcb)) {
+        pcb->recved += len;
+    }
+}   // tcp_recved
+
+
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, uint16_t len, uint8_t apiflags)
+{
+    if ( !pcb_ok(pcb)) {
+        return ERR_CONN;
+    }
+    if (pcb->write_result != ERR_OK) {
+        return pcb->write_result;
+    }
+    if (pcb->closed) {
+        return ERR_CONN;
+    }
+    if (len > pcb->snd_buf) {
+        return ERR_MEM;
+    }
+
+    pcb->tx = realloc(pcb->tx, pcb->tx_len + len);
+    memcpy(pcb->tx + pcb->tx_len, dataptr, len);
+    pcb->tx_len  += len;
+    pcb->snd_buf -= len;
+    pcb->unacked += len;
+
+    if ((apiflags & TCP_WRITE_FLAG_COPY) == 0  &&  len != 0) {
+        lwip_sim_ref_t *ref = malloc(sizeof(lwip_sim_ref_t) + len);
+        lwip_sim_ref_t **last;
+
+        ref->next = NULL;
+        ref->data = dataptr;
+        ref->len  = len;
+        ref->copy = (uint8_t *)(ref + 1);
+        memcpy(ref->copy, dataptr, len);
+        for (last = &pcb->refs;  *last != NULL;  last = &(*last)->next)
+            ;
+        *last = ref;
+    }
+    return ERR_OK;
+}   // tcp_write
+
+
+
+err_t tcp_output(struct tcp_pcb *pcb)
+{
+    if ( !pcb_ok(pcb)) {
+        return ERR_CONN;
+    }
+    ++pcb->outputs;
+    return ERR_OK;
+}   // tcp_output
+
+
+
+static void pcb_gone(struct tcp_pcb *pcb)
+/**
+ * The pcb is freed by lwIP.  The memory is kept, so that later use is detected.
+ */
+{
+    while (pcb->refs != NULL) {
+        lwip_sim_ref_t *ref = pcb->refs;
+
+        pcb->refs = ref->next;
+        free(ref);
+    }
+    pcb->freed = true;
+}   // pcb_gone
+
+
+
+err_t tcp_close(struct tcp_pcb *pcb)
+{
+    if ( !pcb_ok(pcb)) {
+        return ERR_CONN;
+    }
+    if (pcb->listening) {
+        for (int i = 0;  i < LISTEN_N;  ++i) {
+            if (listeners[i] == pcb) {
+                listeners[i] = NULL;
+            }
+        }
+        pcb_gone(pcb);
+        return ERR_OK;
+    }
+    if (pcb->close_result != ERR_OK) {
+        return pcb->close_result;
+    }
+    pcb->closed = true;
+    pcb->recv = NULL;
+    if (pcb->unacked == 0) {
+        pcb_gone(pcb);
+    }
+    return ERR_OK;
+}   // tcp_close
+
+
+
+void tcp_abort(struct tcp_pcb *pcb)
+{
+    if ( !pcb_ok(pcb)) {
+        return;
+    }
+    pcb->aborted = true;
+    pcb_gone(pcb);
+    if (pcb->errf != NULL) {
+        pcb->errf(pcb->callback_arg, ERR_ABRT);
+    }
+}   // tcp_abort
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// remote side
+//
+
+void lwip_sim_init(void)
+{
+    memset(listeners, 0, sizeof(listeners));
+    memset(&lwip_sim_stats, 0, sizeof(lwip_sim_stats));
+    callback_n = 0;
+    lwip_sim_thread = LWIP_SIM_THREAD_LWIP;
+    lwip_sim_callback_limit = CALLBACK_N;
+    lwip_sim_blocked = NULL;
+}   // lwip_sim_init
+
+
+
+struct tcp_pcb *lwip_sim_connect(uint16_t port)
+/**
+ * A client connects to \a port.
+ *
+ * \return the pcb of the connection or NULL if the server has refused it
+ */
+{
+    for (int i = 0;  i < LISTEN_N;  ++i) {
+        struct tcp_pcb *l = listeners[i];
+
+        if (l != NULL  &&  l->port == port  &&  l->accept != NULL) {
+            struct tcp_pcb *pcb = pcb_new();
+            err_t err;
+
+            pcb->port = port;
+            pcb->callback_arg = l->callback_arg;
+            err = check_result(pcb, l->accept(l->callback_arg, pcb, ERR_OK));
+            return (err == ERR_OK) ? pcb : NULL;
+        }
+    }
+    return NULL;
+}   // lwip_sim_connect
+
+
+
+err_t lwip_sim_recv(struct tcp_pcb *pcb, const void *data, uint16_t len)
+/**
+ * Data from the client.  A pbuf which is not taken by the recv callback is freed.
+ */
+{
+    struct pbuf *p;
+    err_t err;
+
+    if ( !pcb_ok(pcb)  ||  pcb->recv == NULL) {
+        return ERR_CONN;
+    }
+    p = lwip_sim_pbuf(data, len);
+    err = check_result(pcb, pcb->recv(pcb->callback_arg, pcb, p, ERR_OK));
+    if (err != ERR_OK  &&  err != ERR_ABRT) {
+        ++lwip_sim_stats.recv_refused;
+        pbuf_free(p);
+    }
+    return err;
+}   // lwip_sim_recv
+
+
+
+err_t lwip_sim_recv_fin(struct tcp_pcb *pcb)
+/**
+ * Client has closed the connection.
+ */
+{
+    if ( !pcb_ok(pcb)  ||  pcb->recv == NULL) {
+        return ERR_CONN;
+    }
+    return check_result(pcb, pcb->recv(pcb->callback_arg, pcb, NULL, ERR_OK));
+}   // lwip_sim_recv_fin
+
+
+
+err_t lwip_sim_ack(struct tcp_pcb *pcb, uint32_t len)
+/**
+ * Client acknowledges \a len bytes (at most the unacknowledged ones), the sent callback is called.
+ * Data written without copy is checked against its state at tcp_write().
+ */
+{
+    err_t err = ERR_OK;
+
+    if ( !pcb_ok(pcb)) {
+        return ERR_CONN;
+    }
+    if (len > pcb->unacked) {
+        len = pcb->unacked;
+    }
+    pcb->unacked -= len;
+    pcb->snd_buf += len;
+
+    for (uint32_t left = len;  left != 0  &&  pcb->refs != NULL;  ) {
+        lwip_sim_ref_t *ref = pcb->refs;
+        uint32_t n = (left < ref->len) ? left : ref->len;
+
+        if (memcmp(ref->data, ref->copy, n) != 0) {
+            ++lwip_sim_stats.ref_modified;
+        }
+        left -= n;
+        if (n == ref->len) {
+            pcb->refs = ref->next;
+            free(ref);
+        }
+        else {
+            ref->data += n;
+            ref->copy += n;
+            ref->len  -= n;
+        }
+    }
+
+    while (len != 0  &&  pcb->sent != NULL  &&  !pcb->freed) {
+        uint16_t n = (len > 0xffff) ? 0xffff : len;
+
+        err = check_result(pcb, pcb->sent(pcb->callback_arg, pcb, n));
+        len -= n;
+    }
+    if (pcb->closed  &&  pcb->unacked == 0  &&  !pcb->freed) {
+        pcb_gone(pcb);
+    }
+    return err;
+}   // lwip_sim_ack
+
+
+
+err_t lwip_sim_poll(struct tcp_pcb *pcb)
+{
+    if ( !pcb_ok(pcb)  ||  pcb->poll == NULL) {
+        return ERR_OK;
+    }
+    return check_result(pcb, pcb->poll(pcb->callback_arg, pcb));
+}   // lwip_sim_poll
+
+
+
+void lwip_sim_error(struct tcp_pcb *pcb, err_t err)
+/**
+ * Connection is reset, the pcb is freed before the error callback is called.
+ */
+{
+    if ( !pcb_ok(pcb)) {
+        return;
+    }
+    pcb_gone(pcb);
+    if (pcb->errf != NULL) {
+        pcb->errf(pcb->callback_arg, err);
+    }
+}   // lwip_sim_error
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// tcpip thread
+//
+
+err_t tcpip_try_callback(tcpip_callback_fn function, void *ctx)
+{
+    if (callback_n >= lwip_sim_callback_limit) {
+        return ERR_MEM;
+    }
+    callbacks[callback_n].function = function;
+    callbacks[callback_n].ctx      = ctx;
+    ++callback_n;
+    return ERR_OK;
+}   // tcpip_try_callback
+
+
+
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx)
+{
+    return tcpip_try_callback(function, ctx);
+}   // tcpip_callback
+
+
+
+uint32_t lwip_sim_run(void)
+/**
+ * Execute the queued callbacks in lwIP context, including those queued meanwhile.
+ *
+ * \return number of executed callbacks
+ */
+{
+    lwip_sim_thread_t thread = lwip_sim_thread;
+    uint32_t n = 0;
+
+    lwip_sim_thread = LWIP_SIM_THREAD_LWIP;
+    while (callback_n != 0) {
+        tcpip_callback_fn function = callbacks[0].function;
+        void *ctx = callbacks[0].ctx;
+
+        memmove(callbacks, callbacks + 1, --callback_n * sizeof(callbacks[0]));
+        function(ctx);
+        ++n;
+    }
+    lwip_sim_stats.callbacks += n;
+    lwip_sim_thread = thread;
+    return n;
+}   // lwip_sim_run
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// stream buffers
+//
+
+StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t trigger)
+{
+    StreamBufferHandle_t s = calloc(1, sizeof(struct lwip_sim_stream));
+
+    s->buf  = malloc(size);
+    s->size = size;
+    return s;
+}   // xStreamBufferCreate
+
+
+
+size_t xStreamBufferSend(StreamBufferHandle_t s, const void *data, size_t len, TickType_t wait)
+{
+    size_t n = (len < s->size - s->len) ? len : s->size - s->len;
+
+    for (size_t i = 0;  i < n;  ++i) {
+        s->buf[(s->rd + s->len + i) % s->size] = ((const uint8_t *)data)[i];
+    }
+    s->len += n;
+    return n;
+}   // xStreamBufferSend
+
+
+
+size_t xStreamBufferReceive(StreamBufferHandle_t s, void *data, size_t len, TickType_t wait)
+{
+    size_t n = (len < s->len) ? len : s->len;
+
+    for (size_t i = 0;  i < n;  ++i) {
+        ((uint8_t *)data)[i] = s->buf[(s->rd + i) % s->size];
+    }
+    s->rd   = (s->rd + n) % s->size;
+    s->len -= n;
+    return n;
+}   // xStreamBufferReceive
+
+
+
+BaseType_t xStreamBufferReset(StreamBufferHandle_t s)
+{
+    s->rd  = 0;
+    s->len = 0;
+    ++lwip_sim_stats.stream_resets[lwip_sim_thread];
+    return pdTRUE;
+}   // xStreamBufferReset
+
+
+
+BaseType_t xStreamBufferIsEmpty(StreamBufferHandle_t s)
+{
+    return s->len == 0;
+}   // xStreamBufferIsEmpty
+
+
+
+size_t xStreamBufferSpacesAvailable(StreamBufferHandle_t s)
+{
+    return s->size - s->len;
+}   // xStreamBufferSpacesAvailable
+
+
+
+size_t xStreamBufferBytesAvailable(StreamBufferHandle_t s)
+{
+    return s->len;
+}   // xStreamBufferBytesAvailable
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// semaphores
+//
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return calloc(1, sizeof(struct lwip_sim_sema));
+}   // xSemaphoreCreateBinary
+
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+    if (s->given) {
+        return pdFALSE;
+    }
+    s->given = true;
+    return pdTRUE;
+}   // xSemaphoreGive
+
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait)
+/**
+ * If the semaphore is not available, the calling thread would block for up to \a wait ticks:
+ * let lwip_sim_blocked play the other threads once.
+ */
+{
+    if ( !s->given  &&  wait != 0) {
+        lwip_sim_thread_t thread = lwip_sim_thread;
+
+        ++lwip_sim_stats.blocked;
+        if (lwip_sim_blocked != NULL) {
+            lwip_sim_blocked();
+        }
+        else {
+            lwip_sim_run();
+        }
+        lwip_sim_thread = thread;
+    }
+    if ( !s->given) {
+        return pdFALSE;
+    }
+    s->given = false;
+    return pdTRUE;
+}   // xSemaphoreTake
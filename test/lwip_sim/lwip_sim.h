@@ -0,0 +1,87 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Host model of the lwIP raw TCP API and of FreeRTOS stream buffers for the tests of the TCP servers
+ * in src/net.  There is no protocol: the test plays the remote client with lwip_sim_connect(),
+ * lwip_sim_recv(), lwip_sim_ack() etc. and inspects the data written by the server in the pcb.
+ *
+ * The model checks the rules of the raw API which are easy to get wrong:
+ * - a callback returns ERR_ABRT if and only if it has aborted its pcb
+ * - a pcb is not used after it has gone (tcp_abort(), error callback, close completed)
+ * - data written without TCP_WRITE_FLAG_COPY stays unchanged until it is acknowledged
+ * - all pbufs are freed
+ *
+ * tcpip callbacks are queued and executed by lwip_sim_run().  Threads are not simulated, but the
+ * test tells the model on whose behalf it calls (\a lwip_sim_thread), so stream buffer resets
+ * can be attributed.  If a thread would block on a semaphore, \a lwip_sim_blocked is called instead:
+ * it plays lwIP and the client meanwhile (default: lwip_sim_run()).
+ */
+
+#ifndef _LWIP_SIM_H
+#define _LWIP_SIM_H
+
+#include <stdint.h>
+
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "semphr.h"
+#include "stream_buffer.h"
+
+
+typedef enum {
+    LWIP_SIM_THREAD_LWIP,
+    LWIP_SIM_THREAD_APP,                    ///< e.g. the RTT thread
+    LWIP_SIM_THREAD_N
+} lwip_sim_thread_t;
+
+typedef struct {
+    uint32_t  pbufs;                        ///< pbufs allocated and not yet freed
+    uint32_t  abrt_errors;                  ///< callback result does not match tcp_abort() of its pcb
+    uint32_t  use_after_free;               ///< calls with a pcb which has gone
+    uint32_t  ref_modified;                 ///< data written without copy changed before it was acknowledged
+    uint32_t  recv_refused;                 ///< recv callback did not take the pbuf
+    uint32_t  callbacks;                    ///< executed tcpip callbacks
+    uint32_t  blocked;                      ///< calls of lwip_sim_blocked
+    uint32_t  stream_resets[LWIP_SIM_THREAD_N];
+} lwip_sim_stats_t;
+
+extern lwip_sim_stats_t   lwip_sim_stats;
+extern lwip_sim_thread_t  lwip_sim_thread;
+extern uint32_t           lwip_sim_callback_limit;  ///< tcpip_try_callback() fails if this many are queued
+extern void             (*lwip_sim_blocked)(void);
+
+
+void            lwip_sim_init(void);
+struct pbuf    *lwip_sim_pbuf(const void *data, uint16_t len);
+struct tcp_pcb *lwip_sim_connect(uint16_t port);
+err_t           lwip_sim_recv(struct tcp_pcb *pcb, const void *data, uint16_t len);
+err_t           lwip_sim_recv_fin(struct tcp_pcb *pcb);
+err_t           lwip_sim_ack(struct tcp_pcb *pcb, uint32_t len);
+err_t           lwip_sim_poll(struct tcp_pcb *pcb);
+void            lwip_sim_error(struct tcp_pcb *pcb, err_t err);
+uint32_t        lwip_sim_run(void);
+
+#endif
@@ -0,0 +1,13 @@
+// host model of FreeRTOS semphr.h (binary semaphores), see lwip_sim.h
+#ifndef _LWIP_SIM_SEMPHR_H
+#define _LWIP_SIM_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+typedef struct lwip_sim_sema *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait);
+
+#endif
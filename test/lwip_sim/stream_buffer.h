@@ -0,0 +1,20 @@
+// host model of FreeRTOS stream_buffer.h, see lwip_sim.h
+#ifndef _LWIP_SIM_STREAM_BUFFER_H
+#define _LWIP_SIM_STREAM_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+typedef struct lwip_sim_stream *StreamBufferHandle_t;
+
+StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t trigger);
+size_t     xStreamBufferSend(StreamBufferHandle_t s, const void *data, size_t len, TickType_t wait);
+size_t     xStreamBufferReceive(StreamBufferHandle_t s, void *data, size_t len, TickType_t wait);
+BaseType_t xStreamBufferReset(StreamBufferHandle_t s);
+BaseType_t xStreamBufferIsEmpty(StreamBufferHandle_t s);
+size_t     xStreamBufferSpacesAvailable(StreamBufferHandle_t s);
+size_t     xStreamBufferBytesAvailable(StreamBufferHandle_t s);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2013-2021 ARM Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the License); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CMSIS-DAP configuration of the SWD simulation.  Same settings as include/DAP_config.h, but
+ * the pins are replaced by probe_sim.c which clocks the bits into the target model (swd_target.c).
+ * Packet size/count are constants, because there is no USB which negotiates them.
+ */
+
+#ifndef __DAP_CONFIG_H__
+#define __DAP_CONFIG_H__
+
+#include <stdbool.h>
+#include <string.h>
+#include <pico/stdlib.h>
+
+#include "cmsis_compiler.h"
+#include "picoprobe_config.h"
+#include "probe.h"
+
+
+#define CPU_CLOCK               (probe_get_cpu_freq_khz() * 1000U)
+#define IO_PORT_WRITE_CYCLES    1U
+#define DELAY_SLOW_CYCLES       1U
+
+#define DAP_SWD                 1
+#define DAP_JTAG                0
+#define DAP_JTAG_DEV_CNT        8U
+#define DAP_DEFAULT_PORT        1U
+#define DAP_DEFAULT_SWJ_CLOCK   (probe_get_swclk_freq_khz() * 1000U)
+
+#define DAP_PACKET_SIZE         512U
+#define DAP_PACKET_COUNT        2U
+
+#define SWO_UART                0
+#define SWO_UART_DRIVER         0
+#define SWO_UART_MAX_BAUDRATE   10000000U
+#define SWO_MANCHESTER          0
+#define SWO_BUFFER_SIZE         4096U
+#define SWO_STREAM              0
+
+#define TIMESTAMP_CLOCK         1000000U
+
+#define DAP_UART                0
+#define DAP_UART_DRIVER         0
+#define DAP_UART_RX_BUFFER_SIZE 1024U
+#define DAP_UART_TX_BUFFER_SIZE 1024U
+#define DAP_UART_USB_COM_PORT   0
+
+
+__STATIC_INLINE uint8_t DAP_GetVendorString (char *str)
+{
+    strcpy(str, "RaspberryPi");
+    return strlen(str) + 1;
+}
+
+__STATIC_INLINE uint8_t DAP_GetProductString (char *str)
+{
+    strcpy(str, "YAPicoprobe-sim");
+    return strlen(str) + 1;
+}
+
+__STATIC_INLINE uint8_t DAP_GetSerNumString (char *str)
+{
+    strcpy(str, "sim");
+    return strlen(str) + 1;
+}
+
+__STATIC_INLINE uint8_t DAP_GetTargetDeviceVendorString (char *str)
+{
+    (void)str;
+    return 0;
+}
+
+__STATIC_INLINE uint8_t DAP_GetTargetDeviceNameString (char *str)
+{
+    (void)str;
+    return 0;
+}
+
+__STATIC_INLINE uint8_t DAP_GetTargetBoardVendorString (char *str)
+{
+    (void)str;
+    return 0;
+}
+
+__STATIC_INLINE uint8_t DAP_GetTargetBoardNameString (char *str)
+{
+    (void)str;
+    return 0;
+}
+
+__STATIC_INLINE uint8_t DAP_GetProductFirmwareVersionString (char *str)
+{
+    (void)str;
+    return 0;
+}
+
+
+__STATIC_INLINE void PORT_JTAG_SETUP (void) {
+}
+
+// hack - zap our "stop doing divides everywhere" cache
+extern volatile uint32_t cached_delay;
+__STATIC_INLINE void PORT_SWD_SETUP (void) {
+    probe_init();
+    cached_delay = 0;
+}
+
+__STATIC_INLINE void PORT_OFF (void) {
+    probe_deinit();
+}
+
+
+// single pins are not used by sw_dp_pio.c, DAP_SWJ_Pins() gets the same answers as from the probe
+__STATIC_FORCEINLINE uint32_t PIN_SWCLK_TCK_IN  (void) { return 0U; }
+__STATIC_FORCEINLINE void     PIN_SWCLK_TCK_SET (void) {}
+__STATIC_FORCEINLINE void     PIN_SWCLK_TCK_CLR (void) {}
+__STATIC_FORCEINLINE uint32_t PIN_SWDIO_TMS_IN  (void) { return 0U; }
+__STATIC_FORCEINLINE void     PIN_SWDIO_TMS_SET (void) {}
+__STATIC_FORCEINLINE void     PIN_SWDIO_TMS_CLR (void) {}
+__STATIC_FORCEINLINE uint32_t PIN_SWDIO_IN      (void) { return 0U; }
+__STATIC_FORCEINLINE void     PIN_SWDIO_OUT     (uint32_t bit) { (void)bit; }
+__STATIC_FORCEINLINE void     PIN_SWDIO_OUT_ENABLE  (void) {}
+__STATIC_FORCEINLINE void     PIN_SWDIO_OUT_DISABLE (void) {}
+__STATIC_FORCEINLINE uint32_t PIN_TDI_IN  (void) { return 0U; }
+__STATIC_FORCEINLINE void     PIN_TDI_OUT (uint32_t bit) { (void)bit; }
+__STATIC_FORCEINLINE uint32_t PIN_TDO_IN  (void) { return 0U; }
+__STATIC_FORCEINLINE uint32_t PIN_nTRST_IN   (void) { return 0U; }
+__STATIC_FORCEINLINE void     PIN_nTRST_OUT  (uint32_t bit) { (void)bit; }
+
+__STATIC_FORCEINLINE uint32_t PIN_nRESET_IN(void)
+{
+    return probe_reset_pin_get();
+}   // PIN_nRESET_IN
+
+__STATIC_FORCEINLINE void PIN_nRESET_OUT(uint32_t bit)
+{
+    probe_reset_pin_set(bit);
+}   // PIN_nRESET_OUT
+
+
+__STATIC_INLINE void LED_CONNECTED_OUT (uint32_t bit) { (void)bit; }
+__STATIC_INLINE void LED_RUNNING_OUT (uint32_t bit) { (void)bit; }
+
+
+__STATIC_INLINE uint32_t TIMESTAMP_GET (void) {
+    return time_us_32();
+}
+
+
+__STATIC_INLINE void DAP_SETUP (void)
+{
+    extern void SWx_Configure(void);
+    static bool initialized;
+
+    if ( !initialized) {
+        initialized = true;
+        SWx_Configure();
+        probe_gpio_init();
+    }
+}
+
+__STATIC_INLINE uint8_t RESET_TARGET (void) {
+    return 0U;
+}
+
+#endif /* __DAP_CONFIG_H__ */
@@ -0,0 +1,174 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * probe.h for the SWD simulation, see probe_sim.h.
+ */
+
+#include <string.h>
+#include <pico/stdlib.h>
+
+#include "probe.h"
+#include "probe_sim.h"
+
+
+#define PIO_FIFO_DEPTH      4
+
+probe_sim_stats_t probe_sim_stats;
+
+static swd_target_t *sim_target;
+static uint32_t      rx_fifo[PIO_FIFO_DEPTH];
+static unsigned      rx_fifo_cnt;
+static uint32_t      swclk_freq_khz = 10000;
+static uint32_t      cpu_freq_khz = 120000;
+static uint32_t      reset_pin = 1;
+
+
+
+void probe_sim_attach(swd_target_t *target)
+{
+    sim_target  = target;
+    rx_fifo_cnt = 0;
+    reset_pin   = 1;
+    memset(&probe_sim_stats, 0, sizeof(probe_sim_stats));
+}   // probe_sim_attach
+
+
+
+void probe_set_cpu_freq_khz(uint32_t freq_khz)
+{
+    cpu_freq_khz = freq_khz;
+}   // probe_set_cpu_freq_khz
+
+
+
+uint32_t probe_get_cpu_freq_khz(void)
+{
+    return cpu_freq_khz;
+}   // probe_get_cpu_freq_khz
+
+
+
+uint32_t probe_get_swclk_freq_khz(void)
+{
+    return swclk_freq_khz;
+}   // probe_get_swclk_freq_khz
+
+
+
+void probe_set_swclk_freq_khz(uint32_t freq_khz, bool message)
+{
+    swclk_freq_khz = freq_khz;
+}   // probe_set_swclk_freq_khz
+
+
+
+/**
+ * Same as the PIO: bits are sent LSB first, bits beyond 32 are "zero".
+ */
+void probe_write_bits(uint bit_count, uint32_t data)
+{
+    ++probe_sim_stats.writes;
+    probe_sim_stats.cycles += bit_count;
+    for (uint i = 0;  i < bit_count;  ++i) {
+        swd_target_clock(sim_target, (i < 32) ? (data >> i) & 1 : 0);
+    }
+}   // probe_write_bits
+
+
+
+/**
+ * Same as the PIO: input is shifted in from the left, so the result of a read with
+ * less than 32 bits is in the upper bits of the FIFO entry.
+ */
+uint32_t probe_read_bits(uint bit_count, bool push, bool pull)
+{
+    uint32_t data = 0xffffffff;
+    uint32_t data_shifted;
+
+    ++probe_sim_stats.reads;
+    if (push) {
+        uint32_t isr = 0;
+
+        probe_sim_stats.cycles += bit_count;
+        for (uint i = 0;  i < bit_count;  ++i) {
+            isr = (isr >> 1) | ((uint32_t)swd_target_clock(sim_target, -1) << 31);
+        }
+        if (rx_fifo_cnt < PIO_FIFO_DEPTH) {
+            rx_fifo[rx_fifo_cnt++] = isr;
+        }
+        else {
+            ++probe_sim_stats.fifo_errors;
+        }
+    }
+    if (pull) {
+        if (rx_fifo_cnt != 0) {
+            data = rx_fifo[0];
+            memmove(rx_fifo, rx_fifo + 1, --rx_fifo_cnt * sizeof(rx_fifo[0]));
+        }
+        else {
+            ++probe_sim_stats.fifo_errors;
+        }
+    }
+    data_shifted = data;
+    if (bit_count < 32) {
+        data_shifted = data >> (32 - bit_count);
+    }
+    return data_shifted;
+}   // probe_read_bits
+
+
+
+void probe_gpio_init(void)
+{
+}   // probe_gpio_init
+
+
+
+void probe_init(void)
+{
+    ++probe_sim_stats.inits;
+}   // probe_init
+
+
+
+void probe_deinit(void)
+{
+}   // probe_deinit
+
+
+
+void probe_reset_pin_set(uint32_t state)
+{
+    reset_pin = state;
+    swd_target_reset_pin(sim_target, state == 0);
+}   // probe_reset_pin_set
+
+
+
+uint32_t probe_reset_pin_get(void)
+{
+    return reset_pin;
+}   // probe_reset_pin_get
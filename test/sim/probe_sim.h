@@ -0,0 +1,54 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * PIO layer of the SWD simulation: probe.h implemented on top of the target model in swd_target.c.
+ *
+ * probe_write_bits()/probe_read_bits() behave like the PIO state machine: read commands are queued
+ * with "push" and their results are fetched with "pull" from a FIFO of the same depth.
+ * SWCLK cycles are counted, so transfer times can be derived for a given SWCLK frequency.
+ */
+
+#ifndef _PROBE_SIM_H
+#define _PROBE_SIM_H
+
+#include <stdint.h>
+
+#include "swd_target.h"
+
+
+typedef struct {
+    uint64_t  cycles;                   ///< SWCLK cycles
+    uint32_t  writes;                   ///< probe_write_bits() calls
+    uint32_t  reads;                    ///< probe_read_bits() calls
+    uint32_t  fifo_errors;              ///< pull from empty or push into full FIFO
+    uint32_t  inits;                    ///< probe_init() calls
+} probe_sim_stats_t;
+
+extern probe_sim_stats_t probe_sim_stats;
+
+void probe_sim_attach(swd_target_t *target);
+
+#endif
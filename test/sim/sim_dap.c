@@ -0,0 +1,61 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Stand-in for the DAP_Data/DAP_Setup() part of CMSIS_5 DAP.c, which is required by sw_dp_pio.c and
+ * swd_host.c.  yapicoprobe_sim links the original DAP.c instead.
+ */
+
+#include "DAP_config.h"
+#include "DAP.h"
+
+
+DAP_Data_t DAP_Data;
+volatile uint8_t DAP_TransferAbort;
+
+
+
+/**
+ * Same defaults as DAP_Setup() of CMSIS-DAP V2.1.
+ */
+void DAP_Setup(void)
+{
+    uint32_t delay;
+
+    DAP_Data.debug_port           = 0U;
+    DAP_Data.transfer.idle_cycles = 0U;
+    DAP_Data.transfer.retry_count = 100U;
+    DAP_Data.transfer.match_retry = 0U;
+    DAP_Data.transfer.match_mask  = 0x00000000U;
+    DAP_Data.swd_conf.turnaround  = 1U;
+    DAP_Data.swd_conf.data_phase  = 0U;
+
+    // Set_Clock_Delay(DAP_DEFAULT_SWJ_CLOCK) for the slow path
+    delay = ((CPU_CLOCK / 2U) + (DAP_DEFAULT_SWJ_CLOCK - 1U)) / DAP_DEFAULT_SWJ_CLOCK;
+    DAP_Data.fast_clock  = 0U;
+    DAP_Data.clock_delay = (delay > IO_PORT_WRITE_CYCLES) ? (delay - IO_PORT_WRITE_CYCLES) / DELAY_SLOW_CYCLES : 1U;
+
+    DAP_SETUP();
+}   // DAP_Setup
@@ -0,0 +1,60 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Environment of swd_host.c in the SWD simulation: RTOS delay and target family hooks.
+ * Time advances only by osDelay(), the target model has no notion of time.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "DAP_config.h"
+#include "cmsis_os2.h"
+#include "target_family.h"
+
+
+const target_family_descriptor_t *g_target_family = NULL;
+
+
+
+void osDelay(uint32_t ticks)
+{
+    stub_time_us += 1000 * (uint64_t)ticks;
+}   // osDelay
+
+
+
+void swd_set_target_reset(uint8_t asserted)
+{
+    PIN_nRESET_OUT(asserted ? 0 : 1);
+}   // swd_set_target_reset
+
+
+
+uint32_t target_get_apsel(void)
+{
+    return 0;
+}   // target_get_apsel
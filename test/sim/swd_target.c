@@ -0,0 +1,811 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Behavioural SWD target model, see swd_target.h.
+ *
+ * Register layout and flags are taken from debug_cm.h, so the model speaks the same
+ * language as swd_host.c.  References are "ARM Debug Interface Architecture Specification ADIv5.0 to ADIv5.2"
+ * and "ARMv6-M Architecture Reference Manual".
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "swd_target.h"
+
+
+enum {
+    ST_IDLE,                          // waiting for a start bit
+    ST_REQUEST,                       // 8 bit request from the probe
+    ST_TURN_ACK,                      // turnaround before ACK
+    ST_ACK,                           // 3 bit ACK from the target
+    ST_RDATA,                         // 32 bit data + parity from the target
+    ST_TURN_WDATA,                    // turnaround before write data
+    ST_WDATA,                         // 32 bit data + parity from the probe
+    ST_TURN_END,                      // turnaround back to the probe
+    ST_NO_RESPONSE,                   // protocol error or lockout: wait for line reset
+};
+
+#define LINE_RESET_ONES     50
+
+// request bits
+#define REQ_APnDP           0x02
+#define REQ_RnW             0x04
+#define REQ_ADDR(req)       (((req) >> 1) & 0x0c)
+
+// ACK (LSB first on the wire)
+#define ACK_OK              1
+#define ACK_WAIT            2
+#define ACK_FAULT           4
+
+// DP registers / flags (debug_cm.h)
+#define DP_ABORT_DAPABORT   0x00000001
+#define DP_ABORT_STKCMPCLR  0x00000002
+#define DP_ABORT_STKERRCLR  0x00000004
+#define DP_ABORT_WDERRCLR   0x00000008
+#define DP_ABORT_ORUNERRCLR 0x00000010
+
+#define CS_STICKYORUN       0x00000002
+#define CS_STICKYCMP        0x00000010
+#define CS_STICKYERR        0x00000020
+#define CS_WDATAERR         0x00000080
+#define CS_STICKY           (CS_STICKYORUN | CS_STICKYCMP | CS_STICKYERR | CS_WDATAERR)
+#define CS_WRITABLE         0x54000f0d              // ORUNDETECT, TRNMODE, MASKLANE, C*REQ
+#define CS_CDBGPWRUPREQ     0x10000000
+#define CS_CSYSPWRUPREQ     0x40000000
+
+// MEM-AP
+#define CSW_SIZE_MASK       0x00000007
+#define CSW_ADDRINC_MASK    0x00000030
+#define CSW_DEVICEEN        0x00000040
+#define CSW_TRINPROG        0x00000080
+#define AP_BASE_VALUE       0xe00ff003
+#define AUTO_INC_PAGE       1024
+
+// core debug
+#define SCS_START           0xe000e000
+#define SCS_END             0xe000f000
+#define REG_CPUID           0xe000ed00
+#define REG_AIRCR           0xe000ed0c
+#define REG_DHCSR           0xe000edf0
+#define REG_DCRSR           0xe000edf4
+#define REG_DCRDR           0xe000edf8
+#define REG_DEMCR           0xe000edfc
+
+#define DHCSR_C_DEBUGEN     0x00000001
+#define DHCSR_C_HALT        0x00000002
+#define DHCSR_C_MASK        0x0000002f
+#define DHCSR_S_REGRDY      0x00010000
+#define DHCSR_S_HALT        0x00020000
+#define DHCSR_S_RESET_ST    0x02000000
+#define DHCSR_DBGKEY        0xa05f0000
+#define DCRSR_REGWnR        0x00010000
+#define DEMCR_VC_CORERESET  0x00000001
+#define AIRCR_VECTKEY       0x05fa0000
+#define AIRCR_VECTRESET     0x00000001
+#define AIRCR_SYSRESETREQ   0x00000004
+
+#define NVMC_END            (SWD_TARGET_NVMC_BASE + 0x1000)
+
+
+
+void swd_target_init(swd_target_t *t, const swd_target_cfg_t *cfg)
+{
+    memset(t, 0, sizeof(*t));
+    t->cfg = *cfg;
+    if (t->cfg.turnaround == 0) {
+        t->cfg.turnaround = 1;
+    }
+    t->flash = malloc(cfg->flash_size);
+    t->ram   = malloc(cfg->ram_size);
+    memset(t->flash, 0xff, cfg->flash_size);
+    memset(t->ram, 0x00, cfg->ram_size);
+
+    t->state         = ST_NO_RESPONSE;                // a line reset is required after power up
+    t->run_transfers = -1;
+}   // swd_target_init
+
+
+
+void swd_target_free(swd_target_t *t)
+{
+    free(t->flash);
+    free(t->ram);
+    t->flash = NULL;
+    t->ram   = NULL;
+}   // swd_target_free
+
+
+
+/**
+ * Pointer into target memory for the emulation of target code.
+ *
+ * \return pointer or NULL if [addr, addr+len) is not inside flash or RAM
+ */
+uint8_t *swd_target_mem(swd_target_t *t, uint32_t addr, uint32_t len)
+{
+    if (addr >= t->cfg.flash_start  &&  addr - t->cfg.flash_start <= t->cfg.flash_size
+        &&  len <= t->cfg.flash_size - (addr - t->cfg.flash_start)) {
+        return t->flash + (addr - t->cfg.flash_start);
+    }
+    if (addr >= t->cfg.ram_start  &&  addr - t->cfg.ram_start <= t->cfg.ram_size
+        &&  len <= t->cfg.ram_size - (addr - t->cfg.ram_start)) {
+        return t->ram + (addr - t->cfg.ram_start);
+    }
+    return NULL;
+}   // swd_target_mem
+
+
+
+static void core_resume(swd_target_t *t)
+{
+    t->halted = false;
+    ++t->resumes;
+    t->run_transfers = (t->cfg.run != NULL) ? t->cfg.run(t) : -1;
+}   // core_resume
+
+
+
+static void core_reset(swd_target_t *t)
+{
+    memset(t->reg, 0, sizeof(t->reg));
+    t->reg[16]  = 0x01000000;
+    t->reset_st = true;
+    if ((t->dhcsr & DHCSR_C_DEBUGEN) != 0  &&  (t->demcr & DEMCR_VC_CORERESET) != 0) {
+        t->halted = true;
+    }
+    else {
+        // executes the application which is not modelled
+        t->halted        = false;
+        t->run_transfers = -1;
+    }
+}   // core_reset
+
+
+
+void swd_target_reset_pin(swd_target_t *t, bool asserted)
+{
+    if (asserted  &&  !t->reset_asserted) {
+        t->halted = false;
+    }
+    else if ( !asserted  &&  t->reset_asserted) {
+        core_reset(t);
+    }
+    t->reset_asserted = asserted;
+}   // swd_target_reset_pin
+
+
+
+static bool nvmc_write(swd_target_t *t, uint32_t addr, uint32_t val)
+{
+    switch (addr) {
+        case SWD_TARGET_NVMC_CONFIG:
+            t->nvmc_config = val & 0x03;
+            return true;
+
+        case SWD_TARGET_NVMC_ERASEPAGE:
+            if (t->nvmc_config == 2  &&  val >= t->cfg.flash_start  &&  val - t->cfg.flash_start < t->cfg.flash_size) {
+                uint32_t offs = (val - t->cfg.flash_start) & ~(t->cfg.flash_page_size - 1);
+
+                memset(t->flash + offs, 0xff, t->cfg.flash_page_size);
+                ++t->flash_erases;
+            }
+            return true;
+
+        case SWD_TARGET_NVMC_ERASEALL:
+            if (t->nvmc_config == 2  &&  (val & 1) != 0) {
+                memset(t->flash, 0xff, t->cfg.flash_size);
+                t->flash_erases += t->cfg.flash_size / t->cfg.flash_page_size;
+            }
+            return true;
+
+        default:
+            return true;
+    }
+}   // nvmc_write
+
+
+
+static bool scs_read(swd_target_t *t, uint32_t addr, uint32_t *val)
+{
+    switch (addr) {
+        case REG_CPUID:
+            *val = SWD_TARGET_CPUID;
+            break;
+
+        case REG_DHCSR:
+            *val = t->dhcsr | (t->halted ? DHCSR_S_HALT | DHCSR_S_REGRDY : 0) | (t->reset_st ? DHCSR_S_RESET_ST : 0);
+            t->reset_st = false;
+            break;
+
+        case REG_DCRDR:
+            *val = t->dcrdr;
+            break;
+
+        case REG_DEMCR:
+            *val = t->demcr;
+            break;
+
+        default:
+            *val = 0;
+            break;
+    }
+    return true;
+}   // scs_read
+
+
+
+static bool scs_write(swd_target_t *t, uint32_t addr, uint32_t val)
+{
+    switch (addr) {
+        case REG_AIRCR:
+            if ((val & 0xffff0000) == AIRCR_VECTKEY  &&  (val & (AIRCR_SYSRESETREQ | AIRCR_VECTRESET)) != 0) {
+                core_reset(t);
+            }
+            break;
+
+        case REG_DHCSR:
+            if ((val & 0xffff0000) == DHCSR_DBGKEY) {
+                t->dhcsr = val & DHCSR_C_MASK;
+                if ((val & DHCSR_C_DEBUGEN) == 0) {
+                    if (t->halted) {
+                        core_resume(t);
+                    }
+                }
+                else if ((val & DHCSR_C_HALT) != 0) {
+                    t->halted = true;
+                }
+                else if (t->halted) {
+                    core_resume(t);
+                }
+            }
+            break;
+
+        case REG_DCRSR:
+            if (t->halted) {
+                uint32_t sel = val & 0x7f;
+
+                if (sel <= 16) {
+                    if ((val & DCRSR_REGWnR) != 0) {
+                        t->reg[sel] = t->dcrdr;
+                    }
+                    else {
+                        t->dcrdr = t->reg[sel];
+                    }
+                }
+            }
+            break;
+
+        case REG_DCRDR:
+            t->dcrdr = val;
+            break;
+
+        case REG_DEMCR:
+            t->demcr = val;
+            break;
+
+        default:
+            break;
+    }
+    return true;
+}   // scs_write
+
+
+
+/**
+ * Read an aligned word from the bus.
+ *
+ * \return false on bus error
+ */
+static bool bus_read(swd_target_t *t, uint32_t addr, uint32_t *val)
+{
+    const uint8_t *p;
+
+    addr &= ~3U;
+    p = swd_target_mem(t, addr, 4);
+    if (p != NULL) {
+        *val = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        return true;
+    }
+    if (addr >= SCS_START  &&  addr < SCS_END) {
+        return scs_read(t, addr, val);
+    }
+    if (addr >= SWD_TARGET_NVMC_BASE  &&  addr < NVMC_END) {
+        *val = (addr == SWD_TARGET_NVMC_CONFIG) ? t->nvmc_config : (addr == SWD_TARGET_NVMC_READY) ? 1 : 0;
+        return true;
+    }
+    return false;
+}   // bus_read
+
+
+
+/**
+ * Write the byte lanes \a mask of an aligned word.
+ * Flash is NOR: it can only be written if enabled in the NVMC and bits can only be cleared.
+ *
+ * \return false on bus error
+ */
+static bool bus_write(swd_target_t *t, uint32_t addr, uint32_t val, uint32_t mask)
+{
+    uint8_t *p;
+    bool is_flash;
+
+    addr &= ~3U;
+    p = swd_target_mem(t, addr, 4);
+    if (p != NULL) {
+        is_flash = (p >= t->flash  &&  p < t->flash + t->cfg.flash_size);
+        if (is_flash  &&  t->nvmc_config != 1) {
+            return false;
+        }
+        for (int i = 0;  i < 4;  ++i) {
+            if (mask & (1U << i)) {
+                if (is_flash) {
+                    p[i] &= (uint8_t)(val >> (8 * i));
+                    ++t->flash_writes;
+                }
+                else {
+                    p[i] = (uint8_t)(val >> (8 * i));
+                }
+            }
+        }
+        return true;
+    }
+    if (addr >= SCS_START  &&  addr < SCS_END) {
+        return scs_write(t, addr, val);
+    }
+    if (addr >= SWD_TARGET_NVMC_BASE  &&  addr < NVMC_END) {
+        return nvmc_write(t, addr, val);
+    }
+    return false;
+}   // bus_write
+
+
+
+/**
+ * Byte lanes of a MEM-AP access, data is on the lanes given by the address.
+ */
+static uint32_t ap_lanes(uint32_t csw, uint32_t addr)
+{
+    switch (csw & CSW_SIZE_MASK) {
+        case 0:   return 0x1U << (addr & 3);
+        case 1:   return 0x3U << (addr & 2);
+        default:  return 0xf;
+    }
+}   // ap_lanes
+
+
+
+static void ap_increment(swd_target_t *t)
+{
+    if ((t->csw & CSW_ADDRINC_MASK) != 0) {
+        uint32_t incr = 1U << (t->csw & CSW_SIZE_MASK);
+
+        // auto increment is only guaranteed inside a 1KByte page (ADIv5 7.2.2), the model wraps
+        t->tar = (t->tar & ~(AUTO_INC_PAGE - 1)) | ((t->tar + incr) & (AUTO_INC_PAGE - 1));
+    }
+}   // ap_increment
+
+
+
+static uint32_t ap_read(swd_target_t *t, uint32_t reg)
+{
+    uint32_t val = 0;
+
+    if ((t->select >> 24) != 0) {
+        // no such AP
+        return 0;
+    }
+
+    switch (reg) {
+        case 0x00:
+            val = t->csw | CSW_DEVICEEN;
+            break;
+
+        case 0x04:
+            val = t->tar;
+            break;
+
+        case 0x0c:
+            if ( !bus_read(t, t->tar, &val)) {
+                t->ctrl_stat |= CS_STICKYERR;
+                ++t->bus_errors;
+                val = 0;
+            }
+            ap_increment(t);
+            break;
+
+        case 0x10: case 0x14: case 0x18: case 0x1c:
+            if ( !bus_read(t, (t->tar & ~0x0fU) | (reg & 0x0c), &val)) {
+                t->ctrl_stat |= CS_STICKYERR;
+                ++t->bus_errors;
+                val = 0;
+            }
+            break;
+
+        case 0xf8:
+            val = AP_BASE_VALUE;
+            break;
+
+        case 0xfc:
+            val = SWD_TARGET_AP_IDR;
+            break;
+
+        default:
+            break;
+    }
+    return val;
+}   // ap_read
+
+
+
+static void ap_write(swd_target_t *t, uint32_t reg, uint32_t val)
+{
+    if ((t->select >> 24) != 0) {
+        return;
+    }
+
+    switch (reg) {
+        case 0x00:
+            t->csw = val & ~(CSW_DEVICEEN | CSW_TRINPROG);
+            break;
+
+        case 0x04:
+            t->tar = val;
+            break;
+
+        case 0x0c:
+            if ( !bus_write(t, t->tar, val, ap_lanes(t->csw, t->tar))) {
+                t->ctrl_stat |= CS_STICKYERR;
+                ++t->bus_errors;
+            }
+            ap_increment(t);
+            break;
+
+        case 0x10: case 0x14: case 0x18: case 0x1c:
+            if ( !bus_write(t, (t->tar & ~0x0fU) | (reg & 0x0c), val, 0xf)) {
+                t->ctrl_stat |= CS_STICKYERR;
+                ++t->bus_errors;
+            }
+            break;
+
+        default:
+            break;
+    }
+}   // ap_write
+
+
+
+static uint32_t dp_read(swd_target_t *t, uint32_t addr)
+{
+    switch (addr) {
+        case 0x0:
+            return t->cfg.dpidr;
+
+        case 0x4:
+            if ((t->select & 0x0f) == 1) {
+                // WCR
+                return (t->cfg.turnaround - 1) << 8;
+            }
+            if ((t->select & 0x0f) != 0) {
+                return 0;
+            }
+            if ((t->ctrl_stat & (CS_CDBGPWRUPREQ | CS_CSYSPWRUPREQ)) != 0  &&  t->pwrup_cnt < t->cfg.pwrup_delay) {
+                // not yet powered up
+                ++t->pwrup_cnt;
+                return t->ctrl_stat;
+            }
+            // CxxxPWRUPACK follow their requests
+            return t->ctrl_stat | ((t->ctrl_stat & (CS_CDBGPWRUPREQ | CS_CSYSPWRUPREQ)) << 1);
+
+        case 0x8:
+            return t->resend;
+
+        default:
+            return t->rdbuff;
+    }
+}   // dp_read
+
+
+
+static void dp_write(swd_target_t *t, uint32_t addr, uint32_t val)
+{
+    switch (addr) {
+        case 0x0:
+            if (val & DP_ABORT_DAPABORT) {
+                t->inject_wait = 0;
+            }
+            if (val & DP_ABORT_STKCMPCLR) {
+                t->ctrl_stat &= ~CS_STICKYCMP;
+            }
+            if (val & DP_ABORT_STKERRCLR) {
+                t->ctrl_stat &= ~CS_STICKYERR;
+            }
+            if (val & DP_ABORT_WDERRCLR) {
+                t->ctrl_stat &= ~CS_WDATAERR;
+            }
+            if (val & DP_ABORT_ORUNERRCLR) {
+                t->ctrl_stat &= ~CS_STICKYORUN;
+            }
+            break;
+
+        case 0x4:
+            if ((t->select & 0x0f) == 1) {
+                // WCR: new turnaround is used from the next request on
+                t->cfg.turnaround = ((val >> 8) & 0x03) + 1;
+            }
+            else if ((t->select & 0x0f) == 0) {
+                if ((val & (CS_CDBGPWRUPREQ | CS_CSYSPWRUPREQ)) == 0) {
+                    t->pwrup_cnt = 0;
+                }
+                t->ctrl_stat = (t->ctrl_stat & CS_STICKY) | (val & CS_WRITABLE);
+            }
+            break;
+
+        case 0x8:
+            t->select = val;
+            break;
+
+        default:
+            // TARGETSEL is not supported (DPv1)
+            break;
+    }
+}   // dp_write
+
+
+
+/**
+ * The request is complete: check it and decide about the ACK.
+ * Read data is fetched here, because it is sent right after the ACK.
+ */
+static void request_done(swd_target_t *t)
+{
+    uint8_t req = t->request;
+    bool is_ap  = (req & REQ_APnDP) != 0;
+    bool is_read = (req & REQ_RnW) != 0;
+    uint32_t addr = REQ_ADDR(req);
+    uint32_t parity = __builtin_popcount(req & 0x1e) & 1;
+
+    if ((req & 0x01) == 0  ||  (req & 0x40) != 0  ||  (req & 0x80) == 0  ||  parity != ((req >> 5) & 1)) {
+        // protocol error: no response until line reset
+        ++t->no_response;
+        t->state = ST_NO_RESPONSE;
+        return;
+    }
+
+    if (t->lockout) {
+        if (is_ap  ||  !is_read  ||  addr != 0) {
+            // after line reset only DPIDR can be read (ADIv5 5.4.1)
+            ++t->no_response;
+            t->state = ST_NO_RESPONSE;
+            return;
+        }
+        t->lockout = false;
+    }
+
+    ++t->transfers;
+    if (t->run_transfers > 0  &&  --t->run_transfers == 0) {
+        // core reached its breakpoint
+        t->halted = true;
+        t->run_transfers = -1;
+    }
+
+    if ((t->ctrl_stat & CS_STICKY) != 0
+        &&  !( !is_ap  &&  is_read  &&  addr == 0)
+        &&  !( !is_ap  &&  !is_read  &&  addr == 0)
+        &&  !( !is_ap  &&  is_read  &&  addr == 4)) {
+        t->ack = ACK_FAULT;
+        ++t->acks_fault;
+    }
+    else if (t->inject_wait != 0  &&  (is_ap  ||  (is_read  &&  addr == 0xc))) {
+        --t->inject_wait;
+        t->ack = ACK_WAIT;
+        ++t->acks_wait;
+    }
+    else {
+        t->ack = ACK_OK;
+        if (is_read) {
+            if (is_ap) {
+                // posted read: result of the previous AP read, this one goes to RDBUFF
+                t->rdata  = t->rdbuff;
+                t->rdbuff = ap_read(t, (t->select & 0xf0) | addr);
+            }
+            else {
+                t->rdata = dp_read(t, addr);
+            }
+            t->resend = t->rdata;
+        }
+    }
+
+    t->bit_cnt = 0;
+    t->state   = ST_TURN_ACK;
+}   // request_done
+
+
+
+static void write_done(swd_target_t *t)
+{
+    uint8_t req = t->request;
+    uint32_t parity = __builtin_popcount(t->shift) & 1;
+
+    if (parity != t->rdata) {
+        // data is discarded
+        t->ctrl_stat |= CS_WDATAERR;
+        ++t->wdata_errors;
+        return;
+    }
+
+    if (req & REQ_APnDP) {
+        ap_write(t, (t->select & 0xf0) | REQ_ADDR(req), t->shift);
+    }
+    else {
+        dp_write(t, REQ_ADDR(req), t->shift);
+    }
+}   // write_done
+
+
+
+/**
+ * One SWCLK cycle.
+ *
+ * \param swdio  value driven by the probe, -1 if the probe does not drive SWDIO
+ * \return       level of SWDIO (pulled up if nobody drives)
+ */
+int swd_target_clock(swd_target_t *t, int swdio)
+{
+    int drive = -1;
+    int line;
+
+    //
+    // output of the target
+    //
+    if (t->state == ST_ACK) {
+        drive = (t->ack >> t->bit_cnt) & 1;
+    }
+    else if (t->state == ST_RDATA) {
+        if (t->bit_cnt < 32) {
+            drive = (t->rdata >> t->bit_cnt) & 1;
+        }
+        else {
+            drive = (__builtin_popcount(t->rdata) & 1) ^ (t->inject_read_parity ? 1 : 0);
+            t->inject_read_parity = false;
+        }
+    }
+
+    if (swdio >= 0  &&  drive >= 0) {
+        ++t->contention;
+        line = swdio;
+    }
+    else {
+        line = (swdio >= 0) ? swdio : (drive >= 0) ? drive : 1;
+    }
+
+    //
+    // line reset: at least 50 cycles with SWDIO high driven by the probe, followed by a low bit
+    //
+    if (swdio == 1) {
+        if (++t->ones == LINE_RESET_ONES) {
+            t->state = ST_NO_RESPONSE;
+        }
+    }
+    else if (swdio == 0) {
+        if (t->ones >= LINE_RESET_ONES) {
+            ++t->line_resets;
+            t->ones    = 0;
+            t->lockout = true;
+            t->state   = ST_IDLE;
+            return line;
+        }
+        t->ones = 0;
+    }
+    else if (t->ones < LINE_RESET_ONES) {
+        t->ones = 0;
+    }
+
+    //
+    // protocol state machine
+    //
+    switch (t->state) {
+        case ST_IDLE:
+            if (swdio == 1) {
+                t->request = 1;
+                t->bit_cnt = 1;
+                t->state   = ST_REQUEST;
+            }
+            break;
+
+        case ST_REQUEST:
+            if (swdio < 0) {
+                ++t->undriven;
+            }
+            t->request |= (uint8_t)(line << t->bit_cnt);
+            if (++t->bit_cnt == 8) {
+                request_done(t);
+            }
+            break;
+
+        case ST_TURN_ACK:
+            if (++t->bit_cnt == t->cfg.turnaround) {
+                t->bit_cnt = 0;
+                t->state   = ST_ACK;
+            }
+            break;
+
+        case ST_ACK:
+            if (++t->bit_cnt == 3) {
+                t->bit_cnt = 0;
+                if (t->ack != ACK_OK) {
+                    t->state = ST_TURN_END;
+                }
+                else if (t->request & REQ_RnW) {
+                    t->state = ST_RDATA;
+                }
+                else {
+                    t->state = ST_TURN_WDATA;
+                }
+            }
+            break;
+
+        case ST_RDATA:
+            if (++t->bit_cnt == 33) {
+                t->bit_cnt = 0;
+                t->state   = ST_TURN_END;
+            }
+            break;
+
+        case ST_TURN_WDATA:
+            if (++t->bit_cnt == t->cfg.turnaround) {
+                t->bit_cnt = 0;
+                t->shift   = 0;
+                t->state   = ST_WDATA;
+            }
+            break;
+
+        case ST_WDATA:
+            if (swdio < 0) {
+                ++t->undriven;
+            }
+            if (t->bit_cnt < 32) {
+                t->shift |= (uint32_t)line << t->bit_cnt;
+                ++t->bit_cnt;
+            }
+            else {
+                t->rdata = line;                            // parity bit
+                write_done(t);
+                t->state = ST_IDLE;
+            }
+            break;
+
+        case ST_TURN_END:
+            if (++t->bit_cnt == t->cfg.turnaround) {
+                t->state = ST_IDLE;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return line;
+}   // swd_target_clock
@@ -0,0 +1,144 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Behavioural model of a Cortex-M target on the SWD wire, used by the host simulation in place
+ * of the PIO layer (see probe_sim.c).
+ *
+ * The model is clocked bit by bit and implements
+ * - the SWD line protocol: line reset, request/parity check, turnaround, ACK, data phase,
+ *   lockout after line reset until DPIDR has been read, no response on protocol errors
+ * - DP (ADIv5.2, DPv1): DPIDR, ABORT, CTRL/STAT with delayed power-up acknowledge and sticky flags,
+ *   SELECT, RESEND, RDBUFF, WCR (turnaround)
+ * - MEM-AP (AHB-AP) at APSEL 0: CSW, TAR with auto increment inside 1KByte, DRW, BD0..3, BASE, IDR,
+ *   posted reads, bus errors which set STICKYERR
+ * - memory: flash (NOR, programmed via an nRF52 NVMC like controller) and RAM
+ * - core debug: DHCSR, DCRSR, DCRDR, DEMCR, AIRCR, CPUID; halt/resume, vector catch on reset
+ *
+ * Code is not executed.  A resumed core calls \a run of the configuration, which can emulate
+ * e.g. a flash algorithm function and halt the core again after some transfers.
+ *
+ * WAIT responses and read parity errors can be injected.
+ */
+
+#ifndef _SWD_TARGET_H
+#define _SWD_TARGET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define SWD_TARGET_NVMC_BASE        0x4001e000
+#define SWD_TARGET_NVMC_READY       (SWD_TARGET_NVMC_BASE + 0x400)
+#define SWD_TARGET_NVMC_CONFIG      (SWD_TARGET_NVMC_BASE + 0x504)          // 0=read only, 1=write, 2=erase
+#define SWD_TARGET_NVMC_ERASEPAGE   (SWD_TARGET_NVMC_BASE + 0x508)
+#define SWD_TARGET_NVMC_ERASEALL    (SWD_TARGET_NVMC_BASE + 0x50c)
+
+#define SWD_TARGET_AP_IDR           0x04770031                               // AHB-AP of a Cortex-M0+
+#define SWD_TARGET_CPUID            0x410cc601                               // Cortex-M0+
+
+
+typedef struct swd_target swd_target_t;
+
+/// Called when the core is resumed.  Return number of SWD transfers until the core halts again
+/// (BKPT at LR), negative value: core keeps running.
+typedef int (*swd_target_run_t)(swd_target_t *t);
+
+typedef struct {
+    uint32_t          dpidr;
+    uint32_t          turnaround;               ///< must match the turnaround of the probe
+    uint32_t          pwrup_delay;              ///< CTRL/STAT reads until power-up is acknowledged
+    uint32_t          flash_start;
+    uint32_t          flash_size;
+    uint32_t          flash_page_size;
+    uint32_t          ram_start;
+    uint32_t          ram_size;
+    swd_target_run_t  run;
+} swd_target_cfg_t;
+
+struct swd_target {
+    swd_target_cfg_t  cfg;
+    uint8_t          *flash;
+    uint8_t          *ram;
+
+    // wire
+    int               state;
+    uint32_t          bit_cnt;
+    uint32_t          shift;
+    uint32_t          ones;
+    bool              lockout;
+    uint8_t           request;
+    uint8_t           ack;
+    uint32_t          rdata;
+
+    // DP / AP
+    uint32_t          ctrl_stat;
+    uint32_t          select;
+    uint32_t          resend;
+    uint32_t          rdbuff;
+    uint32_t          pwrup_cnt;
+    uint32_t          csw;
+    uint32_t          tar;
+
+    // core
+    uint32_t          dhcsr;                    ///< C_* bits
+    uint32_t          dcrdr;
+    uint32_t          demcr;
+    uint32_t          reg[17];                  ///< R0..R15, xPSR
+    bool              halted;
+    bool              reset_st;
+    bool              reset_asserted;
+    int               run_transfers;            ///< transfers until the running core halts, <0: forever
+    uint32_t          nvmc_config;
+
+    // fault injection
+    uint32_t          inject_wait;              ///< next AP/RDBUFF accesses answered with WAIT
+    bool              inject_read_parity;       ///< corrupt parity of the next read data phase
+
+    // statistics
+    uint32_t          transfers;
+    uint32_t          acks_wait;
+    uint32_t          acks_fault;
+    uint32_t          no_response;
+    uint32_t          line_resets;
+    uint32_t          contention;               ///< probe and target drove SWDIO at the same time
+    uint32_t          undriven;                 ///< nobody drove SWDIO while the target expected data
+    uint32_t          bus_errors;
+    uint32_t          wdata_errors;
+    uint32_t          flash_writes;             ///< programmed bytes
+    uint32_t          flash_erases;             ///< erased pages
+    uint32_t          resumes;
+};
+
+
+void swd_target_init(swd_target_t *t, const swd_target_cfg_t *cfg);
+void swd_target_free(swd_target_t *t);
+
+int swd_target_clock(swd_target_t *t, int swdio);
+void swd_target_reset_pin(swd_target_t *t, bool asserted);
+
+uint8_t *swd_target_mem(swd_target_t *t, uint32_t addr, uint32_t len);
+
+#endif
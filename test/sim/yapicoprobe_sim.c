@@ -0,0 +1,288 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * yapicoprobe_sim: CMSIS-DAP command processing of the firmware on the host.
+ *
+ * DAP.c of CMSIS_5 together with sw_dp_pio.c and swd_host.c runs against the SWD target model.
+ * Requests are handed to DAP_ExecuteCommand() like dap_server.c does it with the USB packets.
+ * The built-in scenario connects, powers up the debug port and writes/reads target RAM
+ * with DAP_Transfer/DAP_TransferBlock.  With "-v" requests and responses are dumped.
+ *
+ * Returns 0 if the responses and the target memory are as expected.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "DAP_config.h"
+#include "DAP.h"
+
+#include "swd_target.h"
+#include "probe_sim.h"
+
+
+#define RAM_START       0x20000000
+#define RAM_SIZE        (16 * 1024)
+#define BLOCK_WORDS     64
+
+static swd_target_t target;
+static bool verbose;
+static int failures;
+
+static uint8_t request[DAP_PACKET_SIZE];
+static uint8_t response[DAP_PACKET_SIZE];
+
+
+
+uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *response)
+{
+    *response = ID_DAP_Invalid;
+    return (1U << 16) | 1U;
+}   // DAP_ProcessVendorCommand
+
+
+
+static void dump(const char *what, const uint8_t *buf, uint32_t len)
+{
+    printf("%s", what);
+    for (uint32_t i = 0;  i < len;  ++i) {
+        printf(" %02x", buf[i]);
+    }
+    printf("\n");
+}   // dump
+
+
+
+/**
+ * Execute the request and compare the start of the response with \a expected.
+ *
+ * \return length of the response
+ */
+static uint32_t execute(const char *name, uint32_t req_len, const uint8_t *expected, uint32_t exp_len)
+{
+    uint32_t n;
+
+    memset(response, 0xee, sizeof(response));
+    n = DAP_ExecuteCommand(request, response);
+    if (verbose) {
+        printf("%s\n", name);
+        dump("  req:", request, req_len);
+        dump("  rsp:", response, n & 0xffff);
+    }
+    if ((n >> 16) != req_len  ||  (n & 0xffff) < exp_len  ||  memcmp(response, expected, exp_len) != 0) {
+        fprintf(stderr, "%s: unexpected response (req %u/%u, rsp %u)\n", name, n >> 16, req_len, n & 0xffff);
+        dump("  expected:", expected, exp_len);
+        dump("  got:     ", response, n & 0xffff);
+        ++failures;
+    }
+    return n & 0xffff;
+}   // execute
+
+
+
+static uint32_t put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return 4;
+}   // put_u32
+
+
+
+static void scenario(void)
+{
+    static const uint8_t jtag2swd[] = {
+        ID_DAP_SWJ_Sequence, 51, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    };
+    uint8_t exp[9 + 4 * BLOCK_WORDS];
+    uint32_t words[BLOCK_WORDS];
+    uint32_t n;
+
+    // DAP_Info: packet size
+    request[0] = ID_DAP_Info;
+    request[1] = 0xff;
+    exp[0] = ID_DAP_Info;
+    exp[1] = 2;
+    exp[2] = DAP_PACKET_SIZE & 0xff;
+    exp[3] = DAP_PACKET_SIZE >> 8;
+    execute("DAP_Info(packet size)", 2, exp, 4);
+
+    request[0] = ID_DAP_Connect;
+    request[1] = DAP_PORT_SWD;
+    exp[0] = ID_DAP_Connect;
+    exp[1] = DAP_PORT_SWD;
+    execute("DAP_Connect", 2, exp, 2);
+
+    request[0] = ID_DAP_TransferConfigure;
+    request[1] = 0;                                               // idle cycles
+    request[2] = 100;  request[3] = 0;                            // WAIT retries
+    request[4] = 0;    request[5] = 0;                            // match retries
+    exp[0] = ID_DAP_TransferConfigure;
+    exp[1] = DAP_OK;
+    execute("DAP_TransferConfigure", 6, exp, 2);
+
+    // line reset, JTAG-to-SWD, line reset, idle
+    exp[0] = ID_DAP_SWJ_Sequence;
+    exp[1] = DAP_OK;
+    memcpy(request, jtag2swd, sizeof(jtag2swd));
+    execute("DAP_SWJ_Sequence(line reset)", sizeof(jtag2swd), exp, 2);
+    request[0] = ID_DAP_SWJ_Sequence;
+    request[1] = 16;
+    request[2] = 0x9e;
+    request[3] = 0xe7;
+    execute("DAP_SWJ_Sequence(JTAG-to-SWD)", 4, exp, 2);
+    memcpy(request, jtag2swd, sizeof(jtag2swd));
+    execute("DAP_SWJ_Sequence(line reset)", sizeof(jtag2swd), exp, 2);
+    request[0] = ID_DAP_SWJ_Sequence;
+    request[1] = 8;
+    request[2] = 0x00;
+    execute("DAP_SWJ_Sequence(idle)", 3, exp, 2);
+
+    // DPIDR, clear errors, power up
+    n = 0;
+    request[n++] = ID_DAP_Transfer;
+    request[n++] = 0;                                             // DAP index
+    request[n++] = 5;
+    request[n++] = DAP_TRANSFER_RnW | DP_IDCODE;
+    request[n++] = DP_ABORT;
+    n += put_u32(request + n, 0x0000001e);
+    request[n++] = DP_SELECT;
+    n += put_u32(request + n, 0);
+    request[n++] = DP_CTRL_STAT;
+    n += put_u32(request + n, 0x50000000);
+    request[n++] = DAP_TRANSFER_RnW | DP_CTRL_STAT;
+    exp[0] = ID_DAP_Transfer;
+    exp[1] = 5;
+    exp[2] = DAP_TRANSFER_OK;
+    put_u32(exp + 3, target.cfg.dpidr);
+    put_u32(exp + 7, 0xf0000000);
+    execute("DAP_Transfer(DPIDR, ABORT, SELECT, CTRL/STAT)", n, exp, 11);
+
+    // CSW 32 bit with auto increment, TAR, then a block of words
+    for (uint32_t i = 0;  i < BLOCK_WORDS;  ++i) {
+        words[i] = 0x01020304 * (i + 1);
+    }
+    n = 0;
+    request[n++] = ID_DAP_Transfer;
+    request[n++] = 0;
+    request[n++] = 2;
+    request[n++] = DAP_TRANSFER_APnDP | 0x00;
+    n += put_u32(request + n, 0x23000052);
+    request[n++] = DAP_TRANSFER_APnDP | 0x04;
+    n += put_u32(request + n, RAM_START + 0x100);
+    exp[0] = ID_DAP_Transfer;
+    exp[1] = 2;
+    exp[2] = DAP_TRANSFER_OK;
+    execute("DAP_Transfer(CSW, TAR)", n, exp, 3);
+
+    n = 0;
+    request[n++] = ID_DAP_TransferBlock;
+    request[n++] = 0;
+    request[n++] = BLOCK_WORDS;
+    request[n++] = 0;
+    request[n++] = DAP_TRANSFER_APnDP | 0x0c;
+    for (uint32_t i = 0;  i < BLOCK_WORDS;  ++i) {
+        n += put_u32(request + n, words[i]);
+    }
+    exp[0] = ID_DAP_TransferBlock;
+    exp[1] = BLOCK_WORDS;
+    exp[2] = 0;
+    exp[3] = DAP_TRANSFER_OK;
+    execute("DAP_TransferBlock(write DRW)", n, exp, 4);
+    if (memcmp(swd_target_mem(&target, RAM_START + 0x100, sizeof(words)), words, sizeof(words)) != 0) {
+        fprintf(stderr, "DAP_TransferBlock(write DRW): target memory differs\n");
+        ++failures;
+    }
+
+    // read it back, the command is queued together with the TAR write
+    n = 0;
+    request[n++] = ID_DAP_ExecuteCommands;
+    request[n++] = 2;
+    request[n++] = ID_DAP_Transfer;
+    request[n++] = 0;
+    request[n++] = 1;
+    request[n++] = DAP_TRANSFER_APnDP | 0x04;
+    n += put_u32(request + n, RAM_START + 0x100);
+    request[n++] = ID_DAP_TransferBlock;
+    request[n++] = 0;
+    request[n++] = BLOCK_WORDS;
+    request[n++] = 0;
+    request[n++] = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | 0x0c;
+    exp[0] = ID_DAP_ExecuteCommands;
+    exp[1] = 2;
+    exp[2] = ID_DAP_Transfer;
+    exp[3] = 1;
+    exp[4] = DAP_TRANSFER_OK;
+    exp[5] = ID_DAP_TransferBlock;
+    exp[6] = BLOCK_WORDS;
+    exp[7] = 0;
+    exp[8] = DAP_TRANSFER_OK;
+    memcpy(exp + 9, words, sizeof(words));
+    execute("DAP_ExecuteCommands(TAR, DAP_TransferBlock(read DRW))", n, exp, 9 + sizeof(words));
+
+    request[0] = ID_DAP_Vendor31;
+    exp[0] = ID_DAP_Invalid;
+    execute("vendor command", 1, exp, 1);
+
+    request[0] = ID_DAP_Disconnect;
+    exp[0] = ID_DAP_Disconnect;
+    exp[1] = DAP_OK;
+    execute("DAP_Disconnect", 1, exp, 2);
+}   // scenario
+
+
+
+int main(int argc, char *argv[])
+{
+    static const swd_target_cfg_t cfg = {
+        .dpidr           = 0x2ba01477,
+        .flash_start     = 0x00000000,
+        .flash_size      = 4096,
+        .flash_page_size = 4096,
+        .ram_start       = RAM_START,
+        .ram_size        = RAM_SIZE,
+    };
+
+    verbose = (argc > 1  &&  strcmp(argv[1], "-v") == 0);
+
+    swd_target_init(&target, &cfg);
+    probe_sim_attach(&target);
+    DAP_Setup();
+
+    scenario();
+
+    if (target.contention != 0  ||  target.undriven != 0  ||  probe_sim_stats.fifo_errors != 0) {
+        fprintf(stderr, "wire protocol violated: contention %u, undriven %u, FIFO errors %u\n",
+                target.contention, target.undriven, probe_sim_stats.fifo_errors);
+        ++failures;
+    }
+    printf("yapicoprobe_sim: %u transfers, %llu SWCLK cycles: %s\n",
+           target.transfers, (unsigned long long)probe_sim_stats.cycles, (failures == 0) ? "ok" : "FAILED");
+    swd_target_free(&target);
+    return (failures == 0) ? 0 : 1;
+}   // main
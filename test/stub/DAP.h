@@ -0,0 +1,5 @@
+// host stub of CMSIS-DAP DAP.h: the DAPLink headers include it via debug_cm.h, nothing of it is used
+#ifndef _STUB_DAP_H
+#define _STUB_DAP_H
+
+#endif
@@ -0,0 +1,18 @@
+// host stub of FreeRTOS.h, only what the tested sources use
+#ifndef _STUB_FREERTOS_H
+#define _STUB_FREERTOS_H
+
+#include <stdint.h>
+
+typedef long          BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdFALSE       ((BaseType_t)0)
+#define pdTRUE        ((BaseType_t)1)
+
+typedef uint32_t      TickType_t;
+
+#define portMAX_DELAY           ((TickType_t)0xffffffff)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+
+#endif
@@ -0,0 +1,12 @@
+// host stub of CMSIS cmsis_compiler.h, only what the DAPLink sources use
+#ifndef _STUB_CMSIS_COMPILER_H
+#define _STUB_CMSIS_COMPILER_H
+
+#define __STATIC_INLINE         static inline
+#define __STATIC_FORCEINLINE    __attribute__((always_inline)) static inline
+#define __WEAK                  __attribute__((weak))
+#define __PACKED                __attribute__((packed))
+#define __USED                  __attribute__((used))
+#define __NO_RETURN             __attribute__((__noreturn__))
+
+#endif
@@ -0,0 +1,11 @@
+// host stub of the Pico SDK: hardware/sync.h
+#ifndef _STUB_HARDWARE_SYNC_H
+#define _STUB_HARDWARE_SYNC_H
+
+/// data memory barrier, also orders the accesses of the host threads in the stress tests
+static inline void __dmb(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif
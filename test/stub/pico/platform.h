@@ -0,0 +1,30 @@
+// host stub of the Pico SDK: pico/platform.h
+#ifndef _STUB_PICO_PLATFORM_H
+#define _STUB_PICO_PLATFORM_H
+
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+#define NUM_CORES                       2
+
+#define __time_critical_func(func)      func
+#define __not_in_flash_func(func)       func
+#define __compiler_memory_barrier()     __asm__ volatile ("" : : : "memory")
+
+#ifndef MIN
+    #define MIN(a, b)                   (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+    #define MAX(a, b)                   (((a) > (b)) ? (a) : (b))
+#endif
+
+/// core the test pretends to run on
+extern unsigned stub_core_num;
+
+static inline unsigned get_core_num(void)
+{
+    return stub_core_num;
+}
+
+#endif
@@ -0,0 +1,12 @@
+// host stub of the Pico SDK: pico/stdlib.h
+#ifndef _STUB_PICO_STDLIB_H
+#define _STUB_PICO_STDLIB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pico/platform.h"
+#include "pico/time.h"
+
+#endif
@@ -0,0 +1,32 @@
+// host stub of the Pico SDK: pico/time.h, time is set by the test
+#ifndef _STUB_PICO_TIME_H
+#define _STUB_PICO_TIME_H
+
+#include <stdint.h>
+
+typedef uint64_t absolute_time_t;
+
+/// current time in us, set by the test
+extern uint64_t stub_time_us;
+
+static inline uint64_t time_us_64(void)
+{
+    return stub_time_us;
+}
+
+static inline uint32_t time_us_32(void)
+{
+    return (uint32_t)stub_time_us;
+}
+
+static inline absolute_time_t get_absolute_time(void)
+{
+    return stub_time_us;
+}
+
+static inline uint32_t to_ms_since_boot(absolute_time_t t)
+{
+    return (uint32_t)(t / 1000);
+}
+
+#endif
@@ -0,0 +1,6 @@
+// variables of the host stubs
+#include <stdint.h>
+
+unsigned stub_core_num;
+uint64_t stub_time_us;
+int stub_critical_nesting;
@@ -0,0 +1,23 @@
+// host stub of FreeRTOS task.h: critical sections only count their nesting
+#ifndef _STUB_TASK_H
+#define _STUB_TASK_H
+
+#include "FreeRTOS.h"
+
+/// current nesting of critical sections, must be 0 between calls
+extern int stub_critical_nesting;
+
+static inline UBaseType_t taskENTER_CRITICAL_FROM_ISR(void)
+{
+    return (UBaseType_t)stub_critical_nesting++;
+}
+
+static inline void taskEXIT_CRITICAL_FROM_ISR(UBaseType_t saved)
+{
+    stub_critical_nesting = (int)saved;
+}
+
+#define taskENTER_CRITICAL()    (void)taskENTER_CRITICAL_FROM_ISR()
+#define taskEXIT_CRITICAL()     (--stub_critical_nesting)
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Minimal helpers for the host tests: checks which count failures instead of aborting,
+ * a reproducible pseudo random generator and a clock for benchmarks.
+ */
+
+#ifndef _TEST_H
+#define _TEST_H
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+
+static int test_failures;
+
+#define CHECK(cond)                                                                         \
+    do {                                                                                    \
+        if ( !(cond)) {                                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);        \
+            ++test_failures;                                                                \
+        }                                                                                   \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                      \
+    do {                                                                                    \
+        long long _a = (long long)(a), _b = (long long)(b);                                 \
+        if (_a != _b) {                                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n",               \
+                    __FILE__, __LINE__, #a, #b, _a, _b);                                    \
+            ++test_failures;                                                                \
+        }                                                                                   \
+    } while (0)
+
+
+/// result of main(), prints a summary line
+static inline int test_result(const char *name)
+{
+    printf("%s: %s\n", name, (test_failures == 0) ? "ok" : "FAILED");
+    return (test_failures == 0) ? 0 : 1;
+}   // test_result
+
+
+static uint32_t test_rand_state = 0x12345678;
+
+/// xorshift32, same sequence on every host
+static inline uint32_t test_rand(void)
+{
+    uint32_t x = test_rand_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    test_rand_state = x;
+    return x;
+}   // test_rand
+
+
+/// monotonic time in ns for benchmarks
+static inline uint64_t test_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}   // test_now_ns
+
+
+#endif
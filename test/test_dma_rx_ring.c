@@ -0,0 +1,254 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Model tests of the DMA receive ring bookkeeping (target UART, PIO UARTs).
+ *
+ * A simulated DMA channel in ring mode writes a reference sequence into a small ring and counts down
+ * its transfer counter.  The test plays timer callback (poll & restart) and reader and checks the
+ * received data and the accounting of overwritten bytes, also across a wrap of the 32 bit positions.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "dma_rx_ring.h"
+
+
+#define RING_SIZE     64
+#define RING_MARGIN   16
+
+
+typedef struct {
+    uint8_t   ring[RING_SIZE];
+    uint32_t  pos;                          // total bytes written
+    uint32_t  trans_count;
+} dma_model_t;
+
+static dma_model_t     dma;
+static dma_rx_ring_t   rx;
+static uint32_t        rx_read;
+static uint32_t        rx_lost;
+
+
+
+static uint8_t ref_byte(uint32_t pos)
+{
+    return (uint8_t)(pos ^ (pos >> 8) ^ (pos >> 16) ^ (pos >> 24)) * 0x9d + 1;
+}   // ref_byte
+
+
+
+static void model_init(uint32_t dma_count, uint32_t start)
+{
+    memset(&dma, 0, sizeof(dma));
+    dma.pos = start;
+    dma.trans_count = dma_count;
+
+    dma_rx_ring_init(&rx, RING_SIZE, RING_MARGIN, dma_count);
+    rx.dma_base = start;
+    rx.wr = start;
+    rx.rd = start;
+    rx_read = 0;
+    rx_lost = 0;
+}   // model_init
+
+
+
+static uint32_t model_dma(uint32_t cnt)
+/**
+ * DMA receives \a cnt bytes, it stops if the transfer count is exhausted.
+ * \return number of bytes actually written
+ */
+{
+    uint32_t n;
+
+    for (n = 0;  n < cnt  &&  dma.trans_count != 0;  ++n) {
+        dma.ring[dma.pos % RING_SIZE] = ref_byte(dma.pos);
+        ++dma.pos;
+        --dma.trans_count;
+    }
+    return n;
+}   // model_dma
+
+
+
+static uint32_t model_poll(void)
+/**
+ * Timer callback: publish and restart the DMA like uart_rx_timer_cb().
+ */
+{
+    bool finished = (dma.trans_count == 0);
+    uint32_t delta = dma_rx_ring_poll(&rx, dma.trans_count, finished);
+
+    if (finished) {
+        dma.trans_count = rx.dma_count;
+    }
+    CHECK_EQ(rx.wr, dma.pos);
+    return delta;
+}   // model_poll
+
+
+
+static void model_read(uint32_t max_cnt)
+/**
+ * Reader: take up to \a max_cnt bytes out of the ring and compare them with the reference.
+ */
+{
+    while (max_cnt != 0) {
+        uint32_t offs, lost, cnt;
+
+        cnt = dma_rx_ring_chunk(&rx, &offs, &lost);
+        rx_lost += lost;
+        CHECK(rx.wr - rx.rd <= RING_SIZE - RING_MARGIN);
+        if (cnt == 0) {
+            break;
+        }
+        CHECK(offs + cnt <= RING_SIZE);
+        CHECK_EQ(offs, rx.rd % RING_SIZE);
+
+        cnt = (cnt < max_cnt) ? cnt : max_cnt;
+        for (uint32_t i = 0;  i < cnt;  ++i) {
+            if (dma.ring[offs + i] != ref_byte(rx.rd + i)) {
+                CHECK_EQ(dma.ring[offs + i], ref_byte(rx.rd + i));
+                break;
+            }
+        }
+        dma_rx_ring_consume(&rx, cnt);
+        rx_read += cnt;
+        max_cnt -= cnt;
+    }
+}   // model_read
+
+
+
+static void test_laps(void)
+/**
+ * Exactly one or several laps between two polls: the write address of the DMA is the same as before,
+ * but the bytes must be published and the overwritten ones counted as lost.
+ */
+{
+    model_init(0xffffffff, 0);
+
+    CHECK_EQ(model_dma(10), 10);
+    CHECK_EQ(model_poll(), 10);
+    model_read(~0U);
+    CHECK_EQ(rx_read, 10);
+    CHECK_EQ(rx_lost, 0);
+
+    // one full lap
+    CHECK_EQ(model_dma(RING_SIZE), RING_SIZE);
+    CHECK_EQ(model_poll(), RING_SIZE);
+    CHECK(!dma_rx_ring_is_empty(&rx));
+    model_read(~0U);
+    CHECK_EQ(rx_read, 10 + RING_SIZE - RING_MARGIN);
+    CHECK_EQ(rx_lost, RING_MARGIN);
+    CHECK(dma_rx_ring_is_empty(&rx));
+
+    // three laps plus some bytes
+    CHECK_EQ(model_dma(3 * RING_SIZE + 5), 3 * RING_SIZE + 5);
+    CHECK_EQ(model_poll(), 3 * RING_SIZE + 5);
+    model_read(~0U);
+    CHECK_EQ(rx_read + rx_lost, 10 + 4 * RING_SIZE + 5);
+    CHECK_EQ(rx_lost, RING_MARGIN + 3 * RING_SIZE + 5 - (RING_SIZE - RING_MARGIN));
+
+    // nothing new
+    CHECK_EQ(model_poll(), 0);
+    CHECK(dma_rx_ring_is_empty(&rx));
+}   // test_laps
+
+
+
+static void test_slow_reader(void)
+/**
+ * Reader lags behind without a full lap between polls: only the bytes beyond the
+ * margin are dropped.
+ */
+{
+    model_init(0xffffffff, 0);
+
+    CHECK_EQ(model_dma(40), 40);
+    model_poll();
+    model_read(5);
+    CHECK_EQ(model_dma(40), 40);
+    model_poll();
+    model_read(~0U);
+    CHECK_EQ(rx_lost, 80 - 5 - (RING_SIZE - RING_MARGIN));
+    CHECK_EQ(rx_read + rx_lost, 80);
+}   // test_slow_reader
+
+
+
+static void test_random(uint32_t dma_count, uint32_t start)
+/**
+ * Random bursts, partly more than a lap, DMA restarts after \a dma_count bytes and the positions
+ * start at \a start.  DMA may run ahead of the last poll by less than the margin while the reader works.
+ */
+{
+    uint32_t received = 0;
+
+    model_init(dma_count, start);
+
+    for (int i = 0;  i < 20000;  ++i) {
+        uint32_t r = test_rand();
+        uint32_t burst;
+
+        if ((r & 0xff) < 8) {
+            burst = RING_SIZE + (r >> 8) % (3 * RING_SIZE);           // overflow
+        }
+        else {
+            burst = (r >> 8) % (RING_SIZE / 2);
+        }
+        received += model_dma(burst);
+        model_poll();
+
+        // DMA runs ahead a little before the reader gets its turn
+        received += model_dma((r >> 20) % RING_MARGIN);
+        model_read((r >> 24) % RING_SIZE + 1);
+    }
+
+    // drain
+    model_poll();
+    model_read(~0U);
+    CHECK(dma_rx_ring_is_empty(&rx));
+    CHECK_EQ(rx.wr, start + received);
+    CHECK_EQ(rx_read + rx_lost, received);
+    CHECK(rx_lost != 0);
+    CHECK(rx_read != 0);
+}   // test_random
+
+
+
+int main(void)
+{
+    test_laps();
+    test_slow_reader();
+    test_random(0xffffffff, 0);
+    test_random(0xffffffff, 0xfffff000);               // positions wrap
+    test_random(100, 0);                                // frequent DMA restarts
+    test_random(RING_SIZE, 0xffffff80);
+    return test_result("test_dma_rx_ring");
+}   // main
@@ -0,0 +1,222 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the DMA transmit ring state machine (target UART).
+ *
+ * Writer and a simulated DMA channel run interleaved at random.  The DMA "transmits" its chunk at
+ * completion, so data overwritten by the writer during a transfer would show up as corruption.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "dma_tx_ring.h"
+
+
+#define RING_SIZE     32
+
+
+static dma_tx_ring_t   tx;
+static uint8_t         ring[RING_SIZE];
+
+static bool            dma_busy;
+static uint32_t        dma_offs;
+static uint32_t        dma_len;
+static uint32_t        dma_starts;
+
+static uint32_t        written;                 // bytes given to the ring by the writer
+static uint32_t        transmitted;             // bytes seen on the "wire"
+
+
+
+static uint8_t ref_byte(uint32_t pos)
+{
+    return (uint8_t)(pos * 7 + (pos >> 8));
+}   // ref_byte
+
+
+
+static void dma_start(uint32_t offs, uint32_t len)
+{
+    CHECK( !dma_busy);
+    CHECK(len != 0);
+    CHECK(offs + len <= RING_SIZE);
+    CHECK_EQ(len, tx.dma_len);
+    dma_busy = true;
+    dma_offs = offs;
+    dma_len = len;
+    ++dma_starts;
+}   // dma_start
+
+
+
+static void model_init(uint32_t start)
+{
+    dma_tx_ring_init(&tx, RING_SIZE);
+    tx.wr = start;
+    tx.rd = start;
+    memset(ring, 0, sizeof(ring));
+    dma_busy = false;
+    dma_starts = 0;
+    written = 0;
+    transmitted = 0;
+}   // model_init
+
+
+
+static uint32_t model_write(uint32_t max_cnt)
+/**
+ * Writer like cdc_thread(): fill the free linear chunk and commit it.
+ */
+{
+    uint32_t offs, len, cnt;
+
+    cnt = dma_tx_ring_space(&tx, &offs);
+    CHECK(offs + cnt <= RING_SIZE);
+    CHECK(cnt <= RING_SIZE - (tx.wr - tx.rd));
+    cnt = (cnt < max_cnt) ? cnt : max_cnt;
+    for (uint32_t i = 0;  i < cnt;  ++i) {
+        ring[offs + i] = ref_byte(written + i);
+    }
+    written += cnt;
+
+    if (dma_tx_ring_commit(&tx, cnt, &offs, &len)) {
+        dma_start(offs, len);
+    }
+    else if (cnt != 0) {
+        // no DMA start only if a transfer is running
+        CHECK(dma_busy);
+    }
+    return cnt;
+}   // model_write
+
+
+
+static void model_dma_complete(void)
+/**
+ * DMA IRQ like uart_tx_dma_handler(): the chunk is on the wire, free it and start the next one.
+ */
+{
+    uint32_t offs, len;
+
+    CHECK(dma_busy);
+    for (uint32_t i = 0;  i < dma_len;  ++i) {
+        if (ring[dma_offs + i] != ref_byte(transmitted + i)) {
+            CHECK_EQ(ring[dma_offs + i], ref_byte(transmitted + i));
+            break;
+        }
+    }
+    transmitted += dma_len;
+    dma_busy = false;
+
+    if (dma_tx_ring_done(&tx, &offs, &len)) {
+        dma_start(offs, len);
+    }
+    else {
+        // DMA stops only if the ring is empty
+        CHECK_EQ(tx.wr, tx.rd);
+    }
+}   // model_dma_complete
+
+
+
+static void test_basic(void)
+{
+    uint32_t offs;
+
+    model_init(0);
+
+    // single keystroke is transmitted immediately
+    CHECK_EQ(model_write(1), 1);
+    CHECK(dma_busy);
+    CHECK_EQ(dma_len, 1);
+
+    // more data while DMA is running is queued
+    CHECK_EQ(model_write(5), 5);
+    CHECK_EQ(dma_starts, 1);
+    model_dma_complete();
+    CHECK(dma_busy);
+    CHECK_EQ(dma_len, 5);
+    model_dma_complete();
+    CHECK( !dma_busy);
+    CHECK_EQ(transmitted, 6);
+
+    // fill the ring completely
+    CHECK_EQ(model_write(RING_SIZE), RING_SIZE - 6);
+    CHECK_EQ(dma_len, RING_SIZE - 6);
+    CHECK_EQ(model_write(RING_SIZE), 6);
+    CHECK_EQ(dma_tx_ring_space(&tx, &offs), 0);
+    CHECK_EQ(model_write(RING_SIZE), 0);
+
+    // chunks end at the ring end
+    model_dma_complete();
+    CHECK_EQ(dma_offs, 0);
+    CHECK_EQ(dma_len, 6);
+    model_dma_complete();
+    CHECK( !dma_busy);
+    CHECK_EQ(transmitted, written);
+}   // test_basic
+
+
+
+static void test_random(uint32_t start)
+/**
+ * Writer and DMA completions at random, positions start at \a start.
+ */
+{
+    model_init(start);
+
+    for (int i = 0;  i < 100000;  ++i) {
+        uint32_t r = test_rand();
+
+        if ((r & 3) != 0) {
+            model_write((r >> 8) % (RING_SIZE + 8));
+        }
+        if (dma_busy  &&  (r & 0x30) != 0) {
+            model_dma_complete();
+        }
+        CHECK(tx.wr - tx.rd <= RING_SIZE);
+        CHECK_EQ(dma_busy, tx.dma_len != 0);
+    }
+
+    while (dma_busy) {
+        model_dma_complete();
+    }
+    CHECK_EQ(transmitted, written);
+    CHECK_EQ(tx.wr, start + written);
+    CHECK_EQ(tx.rd, tx.wr);
+}   // test_random
+
+
+
+int main(void)
+{
+    test_basic();
+    test_random(0);
+    test_random(0xfffffff0);                            // positions wrap
+    return test_result("test_dma_tx_ring");
+}   // main
@@ -0,0 +1,364 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the event stream: frame format, FIFO overflow and the merge by timestamp
+ * with the watermarks of empty sources.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/time.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "test.h"
+#include "event_stream.h"
+#include "stats_counter.h"
+
+
+extern int stub_critical_nesting;
+
+typedef struct {
+    int       src;
+    uint32_t  len;
+    uint64_t  ts;
+    uint8_t   payload[EVENT_STREAM_PAYLOAD_MAX];
+} frame_t;
+
+
+
+static uint32_t parse_frames(const uint8_t *buf, uint32_t len, frame_t *frames, uint32_t max_frames)
+/**
+ * Split the output of event_stream_read() into frames, the buffer must contain only complete frames.
+ */
+{
+    uint32_t cnt = 0;
+    uint32_t pos = 0;
+
+    while (pos < len  &&  cnt < max_frames) {
+        frame_t *f = frames + cnt++;
+
+        CHECK(len - pos >= EVENT_STREAM_HEADER_SIZE);
+        CHECK_EQ(buf[pos], EVENT_STREAM_SYNC);
+        f->src = buf[pos + 1];
+        f->len = buf[pos + 2] | (buf[pos + 3] << 8);
+        f->ts = 0;
+        for (int i = 0;  i < 6;  ++i) {
+            f->ts |= (uint64_t)buf[pos + 4 + i] << (8 * i);
+        }
+        CHECK(f->len <= EVENT_STREAM_PAYLOAD_MAX);
+        CHECK(len - pos >= EVENT_STREAM_HEADER_SIZE + f->len);
+        memcpy(f->payload, buf + pos + EVENT_STREAM_HEADER_SIZE, f->len);
+        pos += EVENT_STREAM_HEADER_SIZE + f->len;
+    }
+    CHECK_EQ(pos, len);
+    return cnt;
+}   // parse_frames
+
+
+
+static uint32_t read_frames(frame_t *frames, uint32_t max_frames)
+{
+    static uint8_t buf[16384];
+    uint32_t n = event_stream_read(buf, sizeof(buf));
+
+    CHECK_EQ(stub_critical_nesting, 0);
+    return parse_frames(buf, n, frames, max_frames);
+}   // read_frames
+
+
+
+static void drain(void)
+/**
+ * Empty all FIFOs and make every watermark stale.
+ */
+{
+    frame_t frames[64];
+
+    stub_time_us += 1000000;
+    while (read_frames(frames, 64) != 0)
+        ;
+}   // drain
+
+
+
+static void test_framer(void)
+{
+    static uint8_t big[EVENT_STREAM_PAYLOAD_MAX + 10];
+    frame_t frames[8];
+    uint32_t cnt;
+
+    drain();
+    for (uint32_t i = 0;  i < sizeof(big);  ++i) {
+        big[i] = (uint8_t)i;
+    }
+
+    // timestamp with more than 32 bits, only 48 are transmitted
+    CHECK(event_stream_put(EVENT_SRC_UART, 0x123456789abcULL, "abc", 3));
+    // empty payload
+    CHECK(event_stream_put(EVENT_SRC_RTT, 0x123456789abdULL, "", 0));
+    // payload is truncated
+    CHECK(event_stream_put(EVENT_SRC_SIGROK, 0x123456789abeULL, big, sizeof(big)));
+    CHECK_EQ(stub_critical_nesting, 0);
+
+    stub_time_us = 0x123456789abcULL + 1000000;
+    cnt = read_frames(frames, 8);
+    CHECK_EQ(cnt, 3);
+    CHECK_EQ(frames[0].src, EVENT_SRC_UART);
+    CHECK_EQ(frames[0].len, 3);
+    CHECK_EQ(frames[0].ts, 0x123456789abcULL);
+    CHECK(memcmp(frames[0].payload, "abc", 3) == 0);
+    CHECK_EQ(frames[1].src, EVENT_SRC_RTT);
+    CHECK_EQ(frames[1].len, 0);
+    CHECK_EQ(frames[2].src, EVENT_SRC_SIGROK);
+    CHECK_EQ(frames[2].len, EVENT_STREAM_PAYLOAD_MAX);
+    CHECK(memcmp(frames[2].payload, big, EVENT_STREAM_PAYLOAD_MAX) == 0);
+
+    // probe event: event code and truncated origin
+    event_stream_probe(EVENT_PROBE_RESET_ASSERT, "a-very-long-origin-tag");
+    cnt = read_frames(frames, 8);
+    CHECK_EQ(cnt, 1);
+    CHECK_EQ(frames[0].src, EVENT_SRC_PROBE);
+    CHECK_EQ(frames[0].ts, stub_time_us & 0xffffffffffffULL);
+    CHECK_EQ(frames[0].len, 16);
+    CHECK_EQ(frames[0].payload[0], EVENT_PROBE_RESET_ASSERT);
+    CHECK(memcmp(frames[0].payload + 1, "a-very-long-ori", 15) == 0);
+}   // test_framer
+
+
+
+static void test_overflow(void)
+/**
+ * A full FIFO drops frames and counts the payload, the reader gets only complete frames.
+ */
+{
+    uint8_t data[100] = { 0 };
+    uint32_t dropped = stats_counter[0][STATS_DROP_EVENTS] + stats_counter[1][STATS_DROP_EVENTS];
+    uint32_t put = 0;
+    frame_t frames[64];
+    uint32_t cnt = 0;
+
+    drain();
+    stub_core_num = 0;
+
+    // probe FIFO has 512 bytes -> 4 frames of 110 bytes
+    for (int i = 0;  i < 6;  ++i) {
+        put += event_stream_put(EVENT_SRC_PROBE, stub_time_us, data, sizeof(data));
+    }
+    CHECK_EQ(put, 4);
+    CHECK_EQ(stats_counter[0][STATS_DROP_EVENTS] + stats_counter[1][STATS_DROP_EVENTS] - dropped,
+             2 * sizeof(data));
+
+    // a buffer too small for a frame gets nothing
+    {
+        uint8_t small[EVENT_STREAM_HEADER_SIZE + sizeof(data) - 1];
+
+        CHECK_EQ(event_stream_read(small, sizeof(small)), 0);
+    }
+
+    // space is available again after reading, also across the end of the FIFO
+    for (int round = 0;  round < 10;  ++round) {
+        cnt = read_frames(frames, 64);
+        CHECK_EQ(cnt, (round == 0) ? 4 : 3);
+        for (int i = 0;  i < 3;  ++i) {
+            CHECK(event_stream_put(EVENT_SRC_PROBE, stub_time_us, data, sizeof(data)));
+        }
+    }
+    drain();
+}   // test_overflow
+
+
+
+static void test_merge(void)
+/**
+ * Frames of different sources are delivered in timestamp order.
+ */
+{
+    frame_t frames[8];
+    uint32_t cnt;
+
+    drain();
+    stub_time_us = 10000000;
+
+    event_stream_put(EVENT_SRC_UART, 9000100, "u1", 2);
+    event_stream_put(EVENT_SRC_UART, 9000300, "u2", 2);
+    event_stream_put(EVENT_SRC_RTT,  9000200, "r1", 2);
+    event_stream_put(EVENT_SRC_SIGROK, 9000250, "s1", 2);
+    event_stream_put(EVENT_SRC_PROBE, 9000050, "p1", 2);
+
+    cnt = read_frames(frames, 8);
+    CHECK_EQ(cnt, 5);
+    CHECK_EQ(frames[0].ts, 9000050);
+    CHECK_EQ(frames[1].ts, 9000100);
+    CHECK_EQ(frames[2].ts, 9000200);
+    CHECK_EQ(frames[3].ts, 9000250);
+    CHECK_EQ(frames[4].ts, 9000300);
+    CHECK_EQ(frames[4].src, EVENT_SRC_UART);
+}   // test_merge
+
+
+
+static void test_watermark(void)
+/**
+ * An empty source holds back younger frames of the others until its watermark has passed them,
+ * but not longer than the maximum delay (100ms).  The probe source never holds back.
+ */
+{
+    frame_t frames[8];
+    uint32_t cnt;
+
+    drain();
+    stub_time_us = 20000000;
+
+    event_stream_watermark(EVENT_SRC_RTT, 19999000);
+    event_stream_put(EVENT_SRC_UART, 19999500, "u1", 2);
+
+    // RTT may still deliver something older
+    CHECK_EQ(read_frames(frames, 8), 0);
+
+    // RTT delivers an older frame and its watermark passes the UART frame
+    event_stream_put(EVENT_SRC_RTT, 19999200, "r1", 2);
+    event_stream_watermark(EVENT_SRC_RTT, 19999600);
+    cnt = read_frames(frames, 8);
+    CHECK_EQ(cnt, 2);
+    CHECK_EQ(frames[0].src, EVENT_SRC_RTT);
+    CHECK_EQ(frames[1].src, EVENT_SRC_UART);
+
+    // watermark equal to the frame timestamp releases it
+    event_stream_put(EVENT_SRC_UART, 19999700, "u2", 2);
+    event_stream_watermark(EVENT_SRC_RTT, 19999700);
+    CHECK_EQ(read_frames(frames, 8), 1);
+
+    // a frame held back longer than the maximum delay is released
+    event_stream_put(EVENT_SRC_UART, 19999800, "u3", 2);
+    CHECK_EQ(read_frames(frames, 8), 0);
+    stub_time_us = 19999800 + 100000;
+    CHECK_EQ(read_frames(frames, 8), 1);
+
+    // a stale watermark (RTT without target) does not hold back
+    stub_time_us = 30000000;
+    event_stream_watermark(EVENT_SRC_UART, stub_time_us);
+    event_stream_put(EVENT_SRC_SIGROK, stub_time_us - 10, "s1", 2);
+    CHECK_EQ(read_frames(frames, 8), 1);
+
+    // an empty probe FIFO does not hold back
+    event_stream_watermark(EVENT_SRC_PROBE, 0);
+    event_stream_put(EVENT_SRC_SIGROK, stub_time_us - 5, "s2", 2);
+    CHECK_EQ(read_frames(frames, 8), 1);
+}   // test_watermark
+
+
+
+static void test_random(void)
+/**
+ * Sources with increasing timestamps and honest watermarks, reader with random buffer sizes:
+ * the output is sorted and complete.
+ */
+{
+    static uint8_t buf[1024];
+    uint64_t next_ts[EVENT_SRC_CNT];
+    uint32_t put_cnt[EVENT_SRC_CNT] = { 0 };
+    uint32_t seq[EVENT_SRC_CNT] = { 0 };
+    uint64_t last_ts = 0;
+    uint32_t got = 0, put = 0;
+
+    drain();
+    stub_time_us = 100000000;
+    for (int src = 0;  src < EVENT_SRC_CNT;  ++src) {
+        next_ts[src] = stub_time_us;
+        event_stream_watermark(src, stub_time_us);
+    }
+
+    for (int i = 0;  i < 20000;  ++i) {
+        uint32_t r = test_rand();
+        int src = r % EVENT_SRC_CNT;
+
+        stub_time_us += (r >> 8) % 50;
+        if (src == EVENT_SRC_PROBE) {
+            // probe events are put with the current time
+            next_ts[src] = stub_time_us;
+        }
+        next_ts[src] = MAX(next_ts[src], stub_time_us - (r >> 16) % 500);
+
+        if ((r & 0x80000000) != 0) {
+            uint8_t payload[8];
+
+            payload[0] = (uint8_t)put_cnt[src];
+            if (event_stream_put(src, next_ts[src], payload, 1 + (r >> 20) % 8)) {
+                ++put_cnt[src];
+                ++put;
+            }
+        }
+        else if (src != EVENT_SRC_PROBE) {
+            // everything up to shortly before now has been delivered
+            next_ts[src] = MAX(next_ts[src], stub_time_us - 100);
+            event_stream_watermark(src, next_ts[src] - 1);
+        }
+
+        if ((r & 0x0c000000) == 0) {
+            frame_t frames[128];
+            uint32_t cnt = parse_frames(buf, event_stream_read(buf, 1 + (r >> 8) % sizeof(buf)), frames, 128);
+
+            for (uint32_t k = 0;  k < cnt;  ++k) {
+                CHECK(frames[k].ts >= last_ts);
+                CHECK_EQ(frames[k].payload[0], (uint8_t)seq[frames[k].src]);
+                last_ts = frames[k].ts;
+                ++seq[frames[k].src];
+                ++got;
+            }
+        }
+    }
+
+    stub_time_us += 1000000;
+    for (;;) {
+        frame_t frames[128];
+        uint32_t cnt = parse_frames(buf, event_stream_read(buf, sizeof(buf)), frames, 128);
+
+        if (cnt == 0) {
+            break;
+        }
+        for (uint32_t k = 0;  k < cnt;  ++k) {
+            CHECK(frames[k].ts >= last_ts);
+            last_ts = frames[k].ts;
+            ++got;
+        }
+    }
+    CHECK_EQ(got, put);
+    CHECK(put > 1000);
+}   // test_random
+
+
+
+int main(void)
+{
+    test_framer();
+    test_overflow();
+    test_merge();
+    test_watermark();
+    test_random();
+    return test_result("test_event_stream");
+}   // main
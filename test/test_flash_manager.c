@@ -0,0 +1,346 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the DAPLink flash_manager with a fake flash_intf_t.
+ *
+ * The fake flash models erase (sector -> 0xff), program (page must be erased) and counts the calls,
+ * so the tests check the erase strategy (chip erase / lazy sector erase with erase map) and the
+ * resulting flash contents.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "flash_manager.h"
+#include "target_board.h"
+
+
+#define FLASH_SIZE          (1024 * 1024)
+#define PAGE_SIZE           256
+
+
+static uint8_t  flash[FLASH_SIZE];
+static uint8_t  image[FLASH_SIZE];
+static uint32_t erase_cnt[FLASH_SIZE / 1024];                 // per 1K block, sectors are multiples of 1K
+static uint32_t cnt_erase_sector, cnt_erase_chip, cnt_program;
+static uint32_t program_errors;
+
+static sector_info_t sectors[4];
+static target_cfg_t  test_cfg;
+const board_info_t   g_board_info = { .target_cfg = &test_cfg };
+
+
+
+void _util_assert(bool expression, const char *filename, uint16_t line)
+{
+    if ( !expression) {
+        fprintf(stderr, "util_assert %s:%u\n", filename, line);
+        ++test_failures;
+    }
+}   // _util_assert
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+//
+// fake flash
+//
+
+static uint32_t fake_erase_sector_size(uint32_t addr)
+{
+    uint32_t size = 0;
+
+    for (uint32_t i = 0;  i < test_cfg.sector_info_length;  ++i) {
+        if (addr >= sectors[i].start) {
+            size = sectors[i].size;
+        }
+    }
+    return (test_cfg.sector_info_length == 0) ? 4096 : size;
+}   // fake_erase_sector_size
+
+
+
+static error_t fake_init(void)
+{
+    return ERROR_SUCCESS;
+}   // fake_init
+
+
+
+static error_t fake_program_page(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    ++cnt_program;
+    for (uint32_t i = 0;  i < size;  ++i) {
+        if (flash[addr + i] != 0xff  &&  buf[i] != 0xff) {
+            ++program_errors;                                // programming a not erased cell
+        }
+        flash[addr + i] &= buf[i];
+    }
+    return ERROR_SUCCESS;
+}   // fake_program_page
+
+
+
+static error_t fake_erase_sector(uint32_t addr)
+{
+    uint32_t size = fake_erase_sector_size(addr);
+
+    CHECK_EQ(addr % size, 0);
+    ++cnt_erase_sector;
+    memset(flash + addr, 0xff, size);
+    for (uint32_t i = 0;  i < size / 1024;  ++i) {
+        ++erase_cnt[addr / 1024 + i];
+    }
+    return ERROR_SUCCESS;
+}   // fake_erase_sector
+
+
+
+static error_t fake_erase_chip(void)
+{
+    ++cnt_erase_chip;
+    memset(flash, 0xff, sizeof(flash));
+    return ERROR_SUCCESS;
+}   // fake_erase_chip
+
+
+
+static uint32_t fake_program_page_min_size(uint32_t addr)
+{
+    return PAGE_SIZE;
+}   // fake_program_page_min_size
+
+
+
+static uint8_t fake_flash_busy(void)
+{
+    return 0;
+}   // fake_flash_busy
+
+
+
+static const flash_intf_t fake_intf = {
+    .init                  = fake_init,
+    .uninit                = fake_init,
+    .program_page          = fake_program_page,
+    .erase_sector          = fake_erase_sector,
+    .erase_chip            = fake_erase_chip,
+    .program_page_min_size = fake_program_page_min_size,
+    .erase_sector_size     = fake_erase_sector_size,
+    .flash_busy            = fake_flash_busy,
+};
+
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+
+
+static void setup(const sector_info_t *layout, uint32_t layout_len)
+{
+    memset(flash, 0xa5, sizeof(flash));                      // "old" contents which must survive page erase
+    memset(erase_cnt, 0, sizeof(erase_cnt));
+    cnt_erase_sector = 0;
+    cnt_erase_chip   = 0;
+    cnt_program      = 0;
+    program_errors   = 0;
+
+    memset(&test_cfg, 0, sizeof(test_cfg));
+    memcpy(sectors, layout, layout_len * sizeof(sectors[0]));
+    test_cfg.sectors_info       = (layout_len != 0) ? sectors : NULL;
+    test_cfg.sector_info_length = layout_len;
+
+    for (uint32_t i = 0;  i < sizeof(image);  ++i) {
+        image[i] = (uint8_t)test_rand();
+    }
+}   // setup
+
+
+
+/// write [addr, addr+size) of \a image in UF2 sized blocks (256 bytes)
+static void write_range(uint32_t addr, uint32_t size)
+{
+    for (uint32_t a = addr;  a < addr + size;  a += 256) {
+        CHECK_EQ(flash_manager_data(a, image + a, 256), ERROR_SUCCESS);
+    }
+}   // write_range
+
+
+
+static bool flash_equals_image(uint32_t addr, uint32_t size)
+{
+    return memcmp(flash + addr, image + addr, size) == 0;
+}   // flash_equals_image
+
+
+
+static bool flash_untouched(uint32_t addr, uint32_t size)
+{
+    for (uint32_t i = 0;  i < size;  ++i) {
+        if (flash[addr + i] != 0xa5) {
+            return false;
+        }
+    }
+    return true;
+}   // flash_untouched
+
+
+
+/// default mode of DAPLink: chip erase on first sector
+static void test_chip_erase(void)
+{
+    static const sector_info_t layout[] = { {0, 4096} };
+
+    setup(layout, 1);
+    flash_manager_set_page_erase(false);
+    CHECK_EQ(flash_manager_init(&fake_intf), ERROR_SUCCESS);
+    write_range(0x2000, 0x3000);
+    write_range(0x5800, 0x100);                              // gap: continue in the middle of the next sector
+    CHECK_EQ(flash_manager_uninit(), ERROR_SUCCESS);
+
+    CHECK_EQ(cnt_erase_chip, 1);
+    CHECK_EQ(cnt_erase_sector, 0);
+    CHECK_EQ(program_errors, 0);
+    CHECK(flash_equals_image(0x2000, 0x3000));
+    CHECK(flash_equals_image(0x5800, 0x100));
+    CHECK_EQ(flash[0x1000], 0xff);                           // erased by chip erase
+    CHECK_EQ(flash[0x5000], 0xff);
+}   // test_chip_erase
+
+
+
+/// sector erase: only touched sectors are erased, each once, even if they are revisited
+static void test_lazy_erase_revisit(void)
+{
+    static const sector_info_t layout[] = { {0, 4096} };
+
+    setup(layout, 1);
+    flash_manager_set_page_erase(true);
+    CHECK_EQ(flash_manager_init(&fake_intf), ERROR_SUCCESS);
+    // non-increasing addresses: first half of two sectors, then the second halves
+    write_range(0x1000, 0x800);
+    write_range(0x2000, 0x800);
+    write_range(0x1800, 0x800);
+    write_range(0x2800, 0x800);
+    CHECK_EQ(flash_manager_uninit(), ERROR_SUCCESS);
+
+    CHECK_EQ(cnt_erase_chip, 0);
+    CHECK_EQ(cnt_erase_sector, 2);
+    CHECK_EQ(erase_cnt[0x1000 / 1024], 1);
+    CHECK_EQ(erase_cnt[0x2000 / 1024], 1);
+    CHECK_EQ(program_errors, 0);
+    CHECK(flash_equals_image(0x1000, 0x2000));
+    CHECK(flash_untouched(0, 0x1000));
+    CHECK(flash_untouched(0x3000, FLASH_SIZE - 0x3000));
+    CHECK_EQ(cnt_program, 0x2000 / 1024);                    // 1K blocks, each programmed once
+
+    // a new session starts with an empty erase map
+    CHECK_EQ(flash_manager_init(&fake_intf), ERROR_SUCCESS);
+    write_range(0x1000, 0x100);
+    CHECK_EQ(flash_manager_uninit(), ERROR_SUCCESS);
+    CHECK_EQ(erase_cnt[0x1000 / 1024], 2);
+}   // test_lazy_erase_revisit
+
+
+
+/// mixed sector sizes like STM32F4: index calculation via sectors_info
+static void test_lazy_erase_layout(void)
+{
+    static const sector_info_t layout[] = { {0, 16 * 1024}, {0x10000, 64 * 1024}, {0x20000, 128 * 1024} };
+
+    setup(layout, 3);
+    flash_manager_set_page_erase(true);
+    CHECK_EQ(flash_manager_init(&fake_intf), ERROR_SUCCESS);
+    write_range(0x0c000, 0x5000);                            // last 16K sector and into the 64K sector
+    write_range(0x40000, 0x400);                             // second 128K sector
+    write_range(0x15000, 0x400);                             // revisit the 64K sector
+    write_range(0x1f000, 0x1000);                            // end of the 64K sector
+    CHECK_EQ(flash_manager_uninit(), ERROR_SUCCESS);
+
+    CHECK_EQ(cnt_erase_sector, 3);
+    CHECK_EQ(erase_cnt[0x0c000 / 1024], 1);
+    CHECK_EQ(erase_cnt[0x10000 / 1024], 1);
+    CHECK_EQ(erase_cnt[0x40000 / 1024], 1);
+    CHECK_EQ(program_errors, 0);
+    CHECK(flash_equals_image(0x0c000, 0x5000));
+    CHECK(flash_equals_image(0x1f000, 0x1000));
+    CHECK(flash_equals_image(0x40000, 0x400));
+    CHECK(flash_equals_image(0x15000, 0x400));
+    CHECK(flash_untouched(0, 0xc000));
+    CHECK(flash_untouched(0x20000, 0x20000));
+}   // test_lazy_erase_layout
+
+
+
+/// without sectors_info the sector size of the interface is used
+static void test_lazy_erase_no_layout(void)
+{
+    setup(NULL, 0);
+    flash_manager_set_page_erase(true);
+    CHECK_EQ(flash_manager_init(&fake_intf), ERROR_SUCCESS);
+    write_range(0x3000, 0x100);
+    write_range(0x5000, 0x100);
+    write_range(0x3100, 0x100);
+    CHECK_EQ(flash_manager_uninit(), ERROR_SUCCESS);
+
+    CHECK_EQ(cnt_erase_sector, 2);
+    CHECK_EQ(program_errors, 0);
+    CHECK(flash_equals_image(0x3000, 0x200));
+    CHECK(flash_untouched(0x4000, 0x1000));
+}   // test_lazy_erase_no_layout
+
+
+
+/// sectors beyond the erase map are erased each time they are entered
+static void test_lazy_erase_beyond_map(void)
+{
+    static const sector_info_t layout[] = { {0, 1024} };
+    const uint32_t addr = 1024 * 1024 - 4096;               // sector index 1020..1023 is still inside the map
+
+    setup(layout, 1);
+    flash_manager_set_page_erase(true);
+    CHECK_EQ(flash_manager_init(&fake_intf), ERROR_SUCCESS);
+    write_range(addr, 0x200);
+    write_range(0, 0x100);
+    write_range(addr + 0x200, 0x200);
+    CHECK_EQ(flash_manager_uninit(), ERROR_SUCCESS);
+
+    CHECK_EQ(erase_cnt[addr / 1024], 1);
+    CHECK_EQ(program_errors, 0);
+    CHECK(flash_equals_image(addr, 0x400));
+}   // test_lazy_erase_beyond_map
+
+
+
+int main(void)
+{
+    test_chip_erase();
+    test_lazy_erase_revisit();
+    test_lazy_erase_layout();
+    test_lazy_erase_no_layout();
+    test_lazy_erase_beyond_map();
+    return test_result("test_flash_manager");
+}   // main
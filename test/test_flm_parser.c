@@ -0,0 +1,294 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the FLM parser with a synthetic flash algorithm.
+ *
+ * The ELF image is generated here: PrgCode, PrgData (with zero init part), DevDscr, symbol table.
+ * Besides a valid algorithm the tests feed truncated images and headers with offsets/sizes which
+ * wrap around 32 bit.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "flm_parser.h"
+
+
+#define SHT_PROGBITS        1
+#define SHT_SYMTAB          2
+#define SHT_STRTAB          3
+#define SHT_NOBITS          8
+
+#define SH_NUM              8
+#define SH_CODE             1
+#define SH_DEVDSCR          4
+#define SH_SHSTRTAB         7
+
+static uint8_t  elf[4096];
+static uint32_t elf_len;
+static uint32_t elf_shoff;
+
+
+
+static void wr16(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}   // wr16
+
+
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+    wr16(p, v);
+    wr16(p + 2, v >> 16);
+}   // wr32
+
+
+
+static uint32_t add(const void *data, uint32_t len)
+{
+    uint32_t offs = elf_len;
+
+    memcpy(elf + elf_len, data, len);
+    elf_len += len;
+    return offs;
+}   // add
+
+
+
+static void add_shdr(uint32_t name, uint32_t type, uint32_t addr, uint32_t offset, uint32_t size, uint32_t link)
+{
+    uint8_t sh[40] = { 0 };
+
+    wr32(sh + 0, name);
+    wr32(sh + 4, type);
+    wr32(sh + 12, addr);
+    wr32(sh + 16, offset);
+    wr32(sh + 20, size);
+    wr32(sh + 24, link);
+    wr32(sh + 32, 4);
+    add(sh, sizeof(sh));
+}   // add_shdr
+
+
+
+static uint8_t *shdr(uint32_t ndx)
+{
+    return elf + elf_shoff + 40 * ndx;
+}   // shdr
+
+
+
+/**
+ * Generate a flash algorithm with 64 bytes code, 4 bytes data, 8 bytes zero init and
+ * two sector sizes.
+ */
+static void make_flm(void)
+{
+    static const char shstr[] = "\0PrgCode\0PrgData\0DevDscr\0.symtab\0.strtab\0.shstrtab";
+    static const char *syms[] = { "Init", "UnInit", "EraseChip", "EraseSector", "ProgramPage" };
+    uint8_t code[64];
+    uint8_t data[4] = { 0x11, 0x22, 0x33, 0x44 };
+    uint8_t dev[184] = { 0 };
+    uint8_t symtab[16 * 6] = { 0 };
+    char strtab[64] = { 0 };
+    uint32_t strtab_len = 1;
+    uint32_t o_code, o_data, o_dev, o_sym, o_str, o_shstr;
+
+    memset(elf, 0, sizeof(elf));
+    elf_len = 52;
+
+    for (uint32_t n = 0;  n < sizeof(code);  ++n)
+        code[n] = n;
+
+    wr16(dev + 0, 0x101);
+    memcpy(dev + 2, "TestFlash", 9);
+    wr32(dev + 132, 0x08000000);
+    wr32(dev + 136, 0x100000);
+    wr32(dev + 140, 0x400);
+    dev[148] = 0xff;
+    wr32(dev + 160, 0x4000);
+    wr32(dev + 164, 0);
+    wr32(dev + 168, 0x20000);
+    wr32(dev + 172, 0x10000);
+    wr32(dev + 176, 0xffffffff);
+    wr32(dev + 180, 0xffffffff);
+
+    for (uint32_t n = 0;  n < sizeof(syms) / sizeof(syms[0]);  ++n) {
+        uint8_t *sym = symtab + 16 * (n + 1);
+
+        wr32(sym + 0, strtab_len);
+        wr32(sym + 4, 4 * n + 1);                                  // thumb
+        sym[12] = 0x12;
+        strcpy(strtab + strtab_len, syms[n]);
+        strtab_len += strlen(syms[n]) + 1;
+    }
+
+    o_code  = add(code, sizeof(code));
+    o_data  = add(data, sizeof(data));
+    o_dev   = add(dev, sizeof(dev));
+    o_sym   = add(symtab, sizeof(symtab));
+    o_str   = add(strtab, strtab_len);
+    o_shstr = add(shstr, sizeof(shstr));
+    elf_len = (elf_len + 3) & ~3;
+
+    elf_shoff = elf_len;
+    add_shdr(0, 0, 0, 0, 0, 0);
+    add_shdr(1, SHT_PROGBITS, 0, o_code, sizeof(code), 0);
+    add_shdr(9, SHT_PROGBITS, 64, o_data, sizeof(data), 0);
+    add_shdr(9, SHT_NOBITS, 68, o_data + sizeof(data), 8, 0);
+    add_shdr(17, SHT_PROGBITS, 0, o_dev, sizeof(dev), 0);
+    add_shdr(25, SHT_SYMTAB, 0, o_sym, sizeof(symtab), 6);
+    add_shdr(33, SHT_STRTAB, 0, o_str, strtab_len, 0);
+    add_shdr(41, SHT_STRTAB, 0, o_shstr, sizeof(shstr), 0);
+
+    memcpy(elf, "\x7f" "ELF\x01\x01\x01", 7);
+    wr16(elf + 0x10, 2);                                           // ET_EXEC
+    wr16(elf + 0x12, 40);                                          // EM_ARM
+    wr32(elf + 0x14, 1);
+    wr32(elf + 0x20, elf_shoff);
+    wr16(elf + 0x28, 52);
+    wr16(elf + 0x2e, 40);
+    wr16(elf + 0x30, SH_NUM);
+    wr16(elf + 0x32, SH_SHSTRTAB);
+}   // make_flm
+
+
+
+static void test_parse(void)
+{
+    uint32_t blob[256];
+    flm_info_t info;
+
+    make_flm();
+    CHECK(flm_parse(elf, elf_len, blob, sizeof(blob), &info));
+
+    CHECK_EQ(info.blob_size, FLM_BLOB_HEADER_SIZE + 76);
+    CHECK_EQ(info.init, FLM_BLOB_HEADER_SIZE + 1);
+    CHECK_EQ(info.uninit, FLM_BLOB_HEADER_SIZE + 5);
+    CHECK_EQ(info.erase_chip, FLM_BLOB_HEADER_SIZE + 9);
+    CHECK_EQ(info.erase_sector, FLM_BLOB_HEADER_SIZE + 13);
+    CHECK_EQ(info.program_page, FLM_BLOB_HEADER_SIZE + 17);
+    CHECK_EQ(info.verify, 0);
+    CHECK_EQ(info.static_base, FLM_BLOB_HEADER_SIZE + 64);
+    CHECK(strcmp(info.dev_name, "TestFlash") == 0);
+    CHECK_EQ(info.dev_addr, 0x08000000);
+    CHECK_EQ(info.dev_size, 0x100000);
+    CHECK_EQ(info.page_size, 0x400);
+    CHECK_EQ(info.erased_value, 0xff);
+    CHECK_EQ(info.sector_cnt, 2);
+    CHECK_EQ(info.sectors[0].start, 0x08000000);
+    CHECK_EQ(info.sectors[0].size, 0x4000);
+    CHECK_EQ(info.sectors[1].start, 0x08010000);
+    CHECK_EQ(info.sectors[1].size, 0x20000);
+
+    CHECK_EQ(blob[0], 0xE00ABE00);
+    CHECK_EQ(((uint8_t *)blob)[FLM_BLOB_HEADER_SIZE + 10], 10);    // code
+    CHECK_EQ(((uint8_t *)blob)[FLM_BLOB_HEADER_SIZE + 64], 0x11);  // data
+    CHECK_EQ(((uint8_t *)blob)[FLM_BLOB_HEADER_SIZE + 68], 0);     // zero init
+
+    // blob does not fit
+    CHECK( !flm_parse(elf, elf_len, blob, FLM_BLOB_HEADER_SIZE + 72, &info));
+    // truncated
+    CHECK( !flm_parse(elf, elf_len - 1, blob, sizeof(blob), &info));
+    CHECK( !flm_parse(elf, 51, blob, sizeof(blob), &info));
+}   // test_parse
+
+
+
+static void test_elf_size(void)
+{
+    make_flm();
+
+    // header only: end of section header table, which is the end of this file
+    CHECK_EQ(flm_elf_size(elf, 52), elf_len);
+    CHECK_EQ(flm_elf_size(elf, elf_len), elf_len);
+    CHECK_EQ(flm_elf_size(elf, 51), 0);
+
+    // section data behind the section headers is included as soon as the headers are available
+    wr32(shdr(SH_CODE) + 16, elf_len + 100);
+    CHECK_EQ(flm_elf_size(elf, 52), elf_len);
+    CHECK_EQ(flm_elf_size(elf, elf_len), elf_len + 164);
+
+    // NOBITS does not count
+    wr32(shdr(SH_CODE) + 4, SHT_NOBITS);
+    CHECK_EQ(flm_elf_size(elf, elf_len), elf_len);
+
+    // no ARM ELF
+    make_flm();
+    elf[0x12] = 3;
+    CHECK_EQ(flm_elf_size(elf, elf_len), 0);
+}   // test_elf_size
+
+
+
+static void test_wrap(void)
+{
+    uint32_t blob[256];
+    flm_info_t info;
+
+    // section header table wraps
+    make_flm();
+    wr32(elf + 0x20, 0xffffff00);
+    CHECK_EQ(flm_elf_size(elf, 52), 0);
+    CHECK_EQ(flm_elf_size(elf, elf_len), 0);
+    CHECK( !flm_parse(elf, elf_len, blob, sizeof(blob), &info));
+
+    // section header table starts behind the buffer, but does not wrap
+    make_flm();
+    wr32(elf + 0x20, 0xfffff000);
+    CHECK_EQ(flm_elf_size(elf, elf_len), 0xfffff000 + SH_NUM * 40);
+    CHECK( !flm_parse(elf, elf_len, blob, sizeof(blob), &info));
+
+    // section offset + size wraps
+    make_flm();
+    wr32(shdr(SH_DEVDSCR) + 16, 0xfffffff0);
+    wr32(shdr(SH_DEVDSCR) + 20, 0x100);
+    CHECK_EQ(flm_elf_size(elf, elf_len), 0);
+    CHECK( !flm_parse(elf, elf_len, blob, sizeof(blob), &info));
+
+    // section size beyond the file
+    make_flm();
+    wr32(shdr(SH_DEVDSCR) + 20, 0xffffff00);
+    CHECK_EQ(flm_elf_size(elf, elf_len), 52 + 64 + 4 + 0xffffff00);           // DevDscr follows code and data
+    CHECK( !flm_parse(elf, elf_len, blob, sizeof(blob), &info));
+
+    // load address + size of code wraps
+    make_flm();
+    wr32(shdr(SH_CODE) + 12, 0xfffffff0);
+    CHECK( !flm_parse(elf, elf_len, blob, sizeof(blob), &info));
+}   // test_wrap
+
+
+
+int main(void)
+{
+    test_parse();
+    test_elf_size();
+    test_wrap();
+    return test_result("test_flm_parser");
+}   // main
@@ -0,0 +1,613 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the NCM receive NTB bookkeeping (ncm_recv.c).
+ *
+ * The test plays TinyUSB (start/finish receptions of generated NTBs with 1..MAX_DATAGRAMS datagrams)
+ * and the glue logic with its limited pbuf pool, which releases the datagrams in random order.
+ * USB resets are injected at random points.  After every step the state of each NTB is checked:
+ * it must be in exactly one place, the reference counts must match the pbufs held and every NTB
+ * must be put into the free list exactly once per reception.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "net/tinyusb/ncm_recv.h"
+
+
+#define NTB_N_MAX       4
+#define NTB_SIZE        3200                    // CFG_TUD_NCM_OUT_NTB_MAX_SIZE
+#define MAX_DATAGRAMS   8                       // CFG_TUD_NCM_MAX_DATAGRAMS_PER_NTB
+#define POOL_N_MAX      (NTB_N_MAX * MAX_DATAGRAMS)
+#define DATAGRAM_MAX    300
+
+
+typedef struct {
+    const uint8_t  *src;
+    uint16_t        size;
+    void           *ref;
+} pbuf_t;
+
+static uint8_t      ntbs[NTB_N_MAX][NTB_SIZE];
+static ncm_recv_t   rx;
+static uint32_t     ntb_n;
+
+static pbuf_t       pool[POOL_N_MAX];          // RCV_PBUF pool of the glue logic
+static uint32_t     pool_n;
+static uint32_t     pool_size;
+static uint32_t     refuse_percent;            // glue logic refuses datagrams (mailbox full)
+static bool         count_refs;                // unlimited pool, references are only counted
+
+static uint32_t     seq_tx;                    // sequence number of the next generated datagram
+static uint32_t     seq_rx;                    // expected sequence number of the next delivered datagram
+static uint32_t     delivered;
+static uint32_t     dropped;
+static uint32_t     copied;
+
+static uint32_t     starts[NTB_N_MAX];         // receptions started with this NTB
+static uint32_t     frees[NTB_N_MAX];          // transitions into the free list
+static uint32_t     prev_free_mask;
+
+
+
+static uint8_t ref_byte(uint32_t seq, uint32_t i)
+{
+    return (uint8_t)((seq * 0x9d) ^ (i * 7) ^ (seq >> 8));
+}   // ref_byte
+
+
+
+static void put_u16(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}   // put_u16
+
+
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p + 0, v);
+    put_u16(p + 2, v >> 16);
+}   // put_u32
+
+
+
+static uint32_t make_ntb(uint8_t *ntb, uint32_t datagram_n, uint32_t *seq)
+/**
+ * Generate an NTB with \a datagram_n datagrams of random length, each starts with its sequence number.
+ * Layout like the Linux host driver: NTH16, datagrams, NDP16 at the end.
+ *
+ * \return length of the NTB
+ */
+{
+    uint32_t pos = 12;
+    uint32_t ndp;
+
+    for (uint32_t d = 0;  d < datagram_n;  ++d) {
+        uint32_t len = 4 + test_rand() % (DATAGRAM_MAX - 4);
+
+        pos = (pos + 3) & ~3U;
+        put_u32(ntb + pos, *seq);
+        for (uint32_t i = 4;  i < len;  ++i) {
+            ntb[pos + i] = ref_byte(*seq, i);
+        }
+        // datagram entries are written after the NDP position is known, remember them in place
+        put_u16(ntb + NTB_SIZE - 4 * (d + 1), pos);
+        put_u16(ntb + NTB_SIZE - 4 * (d + 1) + 2, len);
+        pos += len;
+        ++*seq;
+    }
+
+    ndp = (pos + 3) & ~3U;
+    put_u32(ntb + ndp, 0x304D434E);                             // "NCM0"
+    put_u16(ntb + ndp + 4, 8 + 4 * (datagram_n + 1));
+    put_u16(ntb + ndp + 6, 0);
+    for (uint32_t d = 0;  d < datagram_n;  ++d) {
+        memmove(ntb + ndp + 8 + 4 * d, ntb + NTB_SIZE - 4 * (d + 1), 4);
+    }
+    put_u32(ntb + ndp + 8 + 4 * datagram_n, 0);
+    pos = ndp + 8 + 4 * (datagram_n + 1);
+
+    put_u32(ntb + 0, 0x484D434E);                               // "NCMH"
+    put_u16(ntb + 4, 12);
+    put_u16(ntb + 6, 0);
+    put_u16(ntb + 8, pos);
+    put_u16(ntb + 10, ndp);
+    return pos;
+}   // make_ntb
+
+
+
+static void check_datagram(const uint8_t *src, uint16_t size)
+/**
+ * Datagram must be intact and in sequence.  Datagrams dropped by a reset are skipped.
+ */
+{
+    uint32_t seq = src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+    bool ok = true;
+
+    CHECK(seq >= seq_rx);
+    CHECK(seq < seq_tx);
+    for (uint32_t i = 4;  i < size;  ++i) {
+        ok = ok  &&  src[i] == ref_byte(seq, i);
+    }
+    CHECK(ok);
+    seq_rx = seq + 1;
+    ++delivered;
+}   // check_datagram
+
+
+
+static bool ref_cb(void *ctx, const uint8_t *src, uint16_t size, void *ref)
+{
+    if (count_refs) {
+        check_datagram(src, size);
+        return true;
+    }
+    if (pool_n >= pool_size  ||  test_rand() % 100 < refuse_percent) {
+        return false;
+    }
+    check_datagram(src, size);
+    pool[pool_n].src  = src;
+    pool[pool_n].size = size;
+    pool[pool_n].ref  = ref;
+    ++pool_n;
+    return true;
+}   // ref_cb
+
+
+
+static bool copy_cb(void *ctx, const uint8_t *src, uint16_t size)
+{
+    if (test_rand() % 100 < refuse_percent) {
+        return false;
+    }
+    check_datagram(src, size);
+    ++copied;
+    return true;
+}   // copy_cb
+
+
+
+static void check_state(void)
+/**
+ * Each NTB must be in exactly one state, reference counts must match the pbufs held by the glue logic
+ * and each reception must end with exactly one transition into the free list.
+ */
+{
+    CHECK_EQ(rx.errors, 0);
+
+    for (uint32_t ntb = 0;  ntb < ntb_n;  ++ntb) {
+        bool is_free  = (rx.free_mask & (1U << ntb)) != 0;
+        uint32_t held = 0;
+        uint32_t places;
+
+        for (uint32_t i = 0;  i < pool_n;  ++i) {
+            held += (pool[i].ref == ntbs[ntb]);
+        }
+        CHECK_EQ(rx.ref_cnt[ntb], held);
+
+        places = is_free + (rx.usb_ntb == (int)ntb) + (rx.glue_ntb == (int)ntb);
+        for (uint32_t i = 0;  i < rx.ready_n;  ++i) {
+            places += (rx.ready[i] == (int)ntb);
+        }
+        if (places == 0) {
+            // only held by the glue logic
+            CHECK(held != 0);
+        }
+        else {
+            CHECK_EQ(places, 1);
+        }
+        if (is_free) {
+            CHECK_EQ(held, 0);
+        }
+
+        if (is_free  &&  (prev_free_mask & (1U << ntb)) == 0) {
+            ++frees[ntb];
+        }
+        CHECK_EQ(frees[ntb], is_free ? starts[ntb] : starts[ntb] - 1);
+    }
+    CHECK_EQ(rx.free_mask >> ntb_n, 0);
+    prev_free_mask = rx.free_mask;
+}   // check_state
+
+
+
+static void release_pbuf(uint32_t i)
+{
+    const pbuf_t p = pool[i];
+    bool ok = true;
+
+    // the NTB must not have been reused while the datagram was in use
+    for (uint32_t n = 4;  n < p.size;  ++n) {
+        ok = ok  &&  p.src[n] == ref_byte(p.src[0] | (p.src[1] << 8) | (p.src[2] << 16) | ((uint32_t)p.src[3] << 24), n);
+    }
+    CHECK(ok);
+
+    pool[i] = pool[--pool_n];
+    CHECK(ncm_recv_release(&rx, p.ref));
+    ncm_recv_deliver(&rx);                                      // tud_network_recv_release() -> renew
+}   // release_pbuf
+
+
+
+static uint32_t pending_datagrams(void)
+/**
+ * Datagrams in ready NTBs and not yet delivered datagrams of the glue NTB, i.e. those dropped by a reset.
+ */
+{
+    uint32_t n = 0;
+    uint16_t index, length;
+
+    for (uint32_t i = 0;  i < rx.ready_n;  ++i) {
+        for (uint16_t d = 0;  ncm_recv_datagram(ntbs[(int)rx.ready[i]], d, &index, &length);  ++d) {
+            ++n;
+        }
+    }
+    if (rx.glue_ntb >= 0) {
+        for (uint16_t d = rx.glue_datagram_ndx;  ncm_recv_datagram(ntbs[(int)rx.glue_ntb], d, &index, &length);  ++d) {
+            ++n;
+        }
+    }
+    return n;
+}   // pending_datagrams
+
+
+
+static void model_init(uint32_t n, uint32_t pool, uint32_t refuse)
+{
+    memset(&rx, 0, sizeof(rx));
+    memset(starts, 0, sizeof(starts));
+    memset(frees, 0, sizeof(frees));
+    ntb_n = n;
+    pool_n = 0;
+    pool_size = pool;
+    refuse_percent = refuse;
+    seq_tx = seq_rx = 0;
+    delivered = dropped = copied = 0;
+
+    ncm_recv_init(&rx, ntbs[0], NTB_SIZE, ntb_n, ref_cb, copy_cb, NULL);
+    prev_free_mask = rx.free_mask;
+    CHECK_EQ(rx.free_mask, (1U << ntb_n) - 1);
+}   // model_init
+
+
+
+static void test_random(uint32_t n, uint32_t steps, uint32_t refuse)
+/**
+ * Random receptions, releases and resets.
+ */
+{
+    uint32_t resets = 0;
+    uint32_t invalid = 0;
+    uint32_t receptions = 0;
+
+    model_init(n, n * MAX_DATAGRAMS, refuse);
+
+    for (uint32_t step = 0;  step < steps;  ++step) {
+        uint32_t action = test_rand() % 100;
+
+        if (action < 40) {
+            // TinyUSB: start a reception or finish the running one
+            if (rx.usb_ntb < 0) {
+                uint8_t *buf = ncm_recv_start(&rx);
+
+                if (buf != NULL) {
+                    int ntb = (int)((buf - ntbs[0]) / NTB_SIZE);
+
+                    CHECK(buf == ntbs[ntb]);
+                    CHECK_EQ(rx.usb_ntb, ntb);
+                    ++starts[ntb];
+                    if (test_rand() % 20 == 0) {
+                        check_state();
+                        ncm_recv_cancel(&rx);                   // usbd_edpt_xfer() failed
+                    }
+                }
+            }
+            else {
+                uint8_t *buf = ntbs[(int)rx.usb_ntb];
+                uint32_t seq = seq_tx;
+                uint32_t len = make_ntb(buf, 1 + test_rand() % MAX_DATAGRAMS, &seq);
+                const char *err;
+
+                if (test_rand() % 20 == 0) {
+                    buf[test_rand() % 4] ^= 0x01;               // corrupt signature
+                    ++invalid;
+                    err = ncm_recv_done(&rx, len);
+                    CHECK(err != NULL);
+                }
+                else {
+                    seq_tx = seq;
+                    err = ncm_recv_done(&rx, len);
+                    CHECK(err == NULL);
+                    ++receptions;
+                }
+                ncm_recv_deliver(&rx);
+            }
+        }
+        else if (action < 95) {
+            // glue logic: release a random pbuf
+            if (pool_n != 0) {
+                release_pbuf(test_rand() % pool_n);
+            }
+            else {
+                ncm_recv_deliver(&rx);
+            }
+        }
+        else if (action < 97) {
+            // USB reset, also while a reception is running, lwIP keeps its pbufs
+            dropped += pending_datagrams();
+            ncm_recv_init(&rx, ntbs[0], NTB_SIZE, ntb_n, ref_cb, copy_cb, NULL);
+            ++resets;
+        }
+        check_state();
+    }
+
+    // finish: glue logic releases everything, nothing is received anymore
+    while (pool_n != 0  ||  rx.glue_ntb >= 0  ||  rx.ready_n != 0) {
+        refuse_percent = 0;
+        if (pool_n != 0) {
+            release_pbuf(test_rand() % pool_n);
+        }
+        else {
+            ncm_recv_deliver(&rx);
+        }
+        check_state();
+    }
+    ncm_recv_cancel(&rx);
+    check_state();
+
+    CHECK_EQ(rx.free_mask, (1U << ntb_n) - 1);
+    for (uint32_t ntb = 0;  ntb < ntb_n;  ++ntb) {
+        CHECK_EQ(rx.ref_cnt[ntb], 0);
+        CHECK_EQ(frees[ntb], starts[ntb]);
+    }
+    CHECK_EQ(delivered + dropped, seq_tx);
+    CHECK(receptions > steps / 10);
+    CHECK(resets > 0);
+    CHECK(invalid > 0);
+    CHECK(copied > 0);
+    CHECK(copied < delivered);
+}   // test_random
+
+
+
+static void test_reset_while_held(void)
+/**
+ * NTB with datagrams held by lwIP survives a reset and is freed by the last release only.
+ */
+{
+    uint32_t seq;
+    uint8_t *buf;
+
+    model_init(2, POOL_N_MAX, 0);
+
+    buf = ncm_recv_start(&rx);
+    CHECK(buf == ntbs[0]);
+    seq = seq_tx;
+    ncm_recv_done(&rx, make_ntb(buf, 3, &seq));
+    seq_tx = seq;
+    ncm_recv_deliver(&rx);
+    CHECK_EQ(pool_n, 3);
+    CHECK_EQ(rx.ref_cnt[0], 3);
+
+    ncm_recv_init(&rx, ntbs[0], NTB_SIZE, 2, ref_cb, copy_cb, NULL);
+    CHECK_EQ(rx.free_mask, 0x02);
+    CHECK_EQ(rx.ref_cnt[0], 3);
+
+    // NTB 0 is not available for reception until the last datagram is back
+    CHECK(ncm_recv_start(&rx) == ntbs[1]);
+    ncm_recv_cancel(&rx);
+    release_pbuf(1);
+    release_pbuf(0);
+    CHECK_EQ(rx.free_mask, 0x02);
+    release_pbuf(0);
+    CHECK_EQ(rx.free_mask, 0x03);
+    CHECK_EQ(rx.errors, 0);
+}   // test_reset_while_held
+
+
+
+static void test_copy_if_pinned(void)
+/**
+ * With the other NTB pinned by lwIP, datagrams are copied so that reception never stalls.
+ */
+{
+    uint32_t seq;
+
+    model_init(2, POOL_N_MAX, 0);
+
+    seq = seq_tx;
+    ncm_recv_done(&rx, make_ntb(ncm_recv_start(&rx), 2, &seq));
+    seq_tx = seq;
+    ncm_recv_deliver(&rx);
+    CHECK_EQ(pool_n, 2);
+
+    seq = seq_tx;
+    ncm_recv_done(&rx, make_ntb(ncm_recv_start(&rx), 4, &seq));
+    seq_tx = seq;
+    ncm_recv_deliver(&rx);
+    CHECK_EQ(pool_n, 2);
+    CHECK_EQ(copied, 4);
+    CHECK_EQ(rx.free_mask, 0x02);
+    CHECK(ncm_recv_start(&rx) == ntbs[1]);
+    ncm_recv_cancel(&rx);
+
+    while (pool_n != 0) {
+        release_pbuf(0);
+    }
+    CHECK_EQ(rx.free_mask, 0x03);
+    CHECK_EQ(delivered, 6);
+    CHECK_EQ(rx.errors, 0);
+}   // test_copy_if_pinned
+
+
+
+static void test_ref_overflow(void)
+/**
+ * More datagrams in one NTB than the uint8 reference counter can hold: delivery waits for releases.
+ */
+{
+    const uint32_t datagram_n = 300;
+    uint8_t *buf;
+    uint32_t ndp = 12 + 4 * datagram_n;
+    uint32_t len = ndp + 8 + 4 * (datagram_n + 1);
+    uint32_t released = 0;
+
+    model_init(2, 0, 0);
+    count_refs = true;
+
+    buf = ncm_recv_start(&rx);
+    put_u32(buf + 0, 0x484D434E);
+    put_u16(buf + 4, 12);
+    put_u16(buf + 8, len);
+    put_u16(buf + 10, ndp);
+    put_u32(buf + ndp, 0x314D434E);                             // "NCM1"
+    put_u16(buf + ndp + 4, 8 + 4 * (datagram_n + 1));
+    put_u16(buf + ndp + 6, 0);
+    for (uint32_t d = 0;  d < datagram_n;  ++d) {
+        put_u32(buf + 12 + 4 * d, d);
+        put_u16(buf + ndp + 8 + 4 * d, 12 + 4 * d);
+        put_u16(buf + ndp + 8 + 4 * d + 2, 4);
+    }
+    put_u32(buf + ndp + 8 + 4 * datagram_n, 0);
+    seq_tx = datagram_n;
+
+    CHECK(ncm_recv_done(&rx, len) == NULL);
+    ncm_recv_deliver(&rx);
+    CHECK_EQ(delivered, UINT8_MAX);
+    CHECK_EQ(rx.ref_cnt[0], UINT8_MAX);
+    CHECK_EQ(rx.glue_ntb, 0);
+
+    // each release lets one more datagram through
+    for (uint32_t i = 0;  i < 10;  ++i) {
+        CHECK(ncm_recv_release(&rx, ntbs[0]));
+        ++released;
+        ncm_recv_deliver(&rx);
+        CHECK_EQ(delivered, UINT8_MAX + i + 1);
+        CHECK_EQ(rx.ref_cnt[0], UINT8_MAX);
+    }
+    while (released < delivered) {
+        CHECK(ncm_recv_release(&rx, ntbs[0]));
+        ++released;
+        ncm_recv_deliver(&rx);
+        CHECK_EQ(rx.ref_cnt[0], delivered - released);
+    }
+    CHECK_EQ(delivered, datagram_n);
+    CHECK_EQ(rx.glue_ntb, -1);
+    CHECK_EQ(rx.free_mask, 0x03);
+    CHECK_EQ(rx.errors, 0);
+    count_refs = false;
+}   // test_ref_overflow
+
+
+
+static void test_bad_release(void)
+/**
+ * Unknown references and releases without a reference are rejected and counted.
+ */
+{
+    model_init(3, POOL_N_MAX, 0);
+
+    CHECK( !ncm_recv_release(&rx, ntbs[0]));                   // not in use
+    CHECK_EQ(rx.errors, 1);
+    CHECK( !ncm_recv_release(&rx, ntbs[0] + 1));               // not an NTB
+    CHECK( !ncm_recv_release(&rx, ntbs[3]));                   // beyond ntb_n
+    CHECK_EQ(rx.errors, 3);
+    CHECK_EQ(rx.free_mask, 0x07);
+
+    CHECK(ncm_recv_done(&rx, 100) != NULL);                    // no reception running
+    CHECK_EQ(rx.errors, 4);
+    CHECK_EQ(rx.free_mask, 0x07);
+
+    ncm_recv_init(&rx, ntbs[1], NTB_SIZE, 2, ref_cb, copy_cb, NULL);
+    CHECK( !ncm_recv_release(&rx, ntbs[0]));                   // before first NTB
+    CHECK_EQ(rx.errors, 5);
+}   // test_bad_release
+
+
+
+static void test_validate(void)
+/**
+ * Malformed NTBs are rejected.
+ */
+{
+    static uint8_t ntb[NTB_SIZE];
+    uint32_t seq = 0;
+    uint32_t len = make_ntb(ntb, 3, &seq);
+    uint32_t ndp = ntb[10] | (ntb[11] << 8);
+    uint8_t save[NTB_SIZE];
+
+    memcpy(save, ntb, sizeof(save));
+    CHECK(ncm_recv_validate(ntb, len, NTB_SIZE) == NULL);
+    CHECK(ncm_recv_validate(ntb, 27, NTB_SIZE) != NULL);                        // too short
+    CHECK(ncm_recv_validate(ntb, len - 1, NTB_SIZE) != NULL);                   // block length > len
+    CHECK(ncm_recv_validate(ntb, len, len - 1) != NULL);                        // block length > max
+
+#define CORRUPT(stmt)                                                           \
+    do {                                                                        \
+        memcpy(ntb, save, sizeof(ntb));                                         \
+        stmt;                                                                   \
+        CHECK(ncm_recv_validate(ntb, len, NTB_SIZE) != NULL);                   \
+    } while (0)
+
+    CORRUPT(ntb[3] = 'X');                                                      // NTH16 signature
+    CORRUPT(put_u16(ntb + 4, 16));                                              // NTH16 length
+    CORRUPT(put_u16(ntb + 10, 8));                                              // NDP inside NTH16
+    CORRUPT(put_u16(ntb + 10, len - 8));                                        // NDP behind end
+    CORRUPT(ntb[ndp + 3] = '2');                                                // NDP16 signature
+    CORRUPT(put_u16(ntb + ndp + 4, 8));                                         // NDP16 too short
+    CORRUPT(put_u16(ntb + ndp + 4, len - ndp + 4));                             // NDP16 behind end
+    CORRUPT(put_u16(ntb + ndp + 6, 12));                                        // wNextNdpIndex
+    CORRUPT(put_u32(ntb + ndp + 8 + 3 * 4, 0x00100100));                        // not terminated
+    CORRUPT(put_u16(ntb + ndp + 8 + 4 + 2, len));                               // datagram outside
+    CORRUPT(put_u16(ntb + ndp + 8 + 4, len));
+#undef CORRUPT
+
+    // NCM1 is fine as well
+    memcpy(ntb, save, sizeof(ntb));
+    ntb[ndp + 3] = '1';
+    CHECK(ncm_recv_validate(ntb, len, NTB_SIZE) == NULL);
+}   // test_validate
+
+
+
+int main(void)
+{
+    test_validate();
+    test_bad_release();
+    test_reset_while_held();
+    test_copy_if_pinned();
+    test_ref_overflow();
+    test_random(2, 200000, 0);
+    test_random(2, 200000, 10);
+    test_random(3, 200000, 10);
+    test_random(4, 100000, 30);
+    return test_result("test_ncm_recv");
+}   // main
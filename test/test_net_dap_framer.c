@@ -0,0 +1,333 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the request framing of the CMSIS-DAP TCP server.
+ *
+ * Host data is fed in chunks of varying size, which is what the server gets from the pbufs
+ * of a connection.  Checked are reassembly of split headers and requests, pipelined requests,
+ * the limit of NET_DAP_PACKET_COUNT buffered requests and the rejection of invalid headers.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "net/net_dap_framer.h"
+
+
+static net_dap_framer_t framer;
+
+
+
+static void header(uint8_t *buf, uint32_t signature, uint16_t len, uint8_t type)
+{
+    buf[0] = signature & 0xff;
+    buf[1] = (signature >> 8) & 0xff;
+    buf[2] = (signature >> 16) & 0xff;
+    buf[3] = signature >> 24;
+    buf[4] = len & 0xff;
+    buf[5] = len >> 8;
+    buf[6] = type;
+    buf[7] = 0;
+}   // header
+
+
+
+/// build a frame, return its length
+static uint32_t frame(uint8_t *buf, uint32_t signature, uint16_t len, uint8_t type, uint8_t seed)
+{
+    header(buf, signature, len, type);
+    for (uint32_t i = 0;  i < len;  ++i) {
+        buf[NET_DAP_HEADER_SIZE + i] = seed + i;
+    }
+    return NET_DAP_HEADER_SIZE + len;
+}   // frame
+
+
+
+static uint32_t request(uint8_t *buf, uint16_t len, uint8_t seed)
+{
+    return frame(buf, NET_DAP_SIGNATURE, len, NET_DAP_TYPE_REQUEST, seed);
+}   // request
+
+
+
+/// feed \a len bytes in chunks of at most \a chunk bytes, return the number of accepted bytes
+static uint32_t feed(const uint8_t *data, uint32_t len, uint32_t chunk)
+{
+    uint32_t pos = 0;
+
+    while (pos < len) {
+        uint32_t space;
+        uint8_t *buf = net_dap_framer_rx_buf(&framer, &space);
+        uint32_t n = len - pos;
+
+        if (n > chunk)
+            n = chunk;
+        if (n > space)
+            n = space;
+        if (n == 0)
+            break;
+        memcpy(buf, data + pos, n);
+        net_dap_framer_rx_done(&framer, n);
+        pos += n;
+    }
+    return pos;
+}   // feed
+
+
+
+static bool request_is(uint16_t len, uint8_t seed)
+{
+    const uint8_t *req;
+    uint16_t req_len = 0;
+
+    req = net_dap_framer_request(&framer, &req_len);
+    if (req == NULL  ||  req_len != len) {
+        return false;
+    }
+    for (uint32_t i = 0;  i < len;  ++i) {
+        if (req[i] != (uint8_t)(seed + i)) {
+            return false;
+        }
+    }
+    net_dap_framer_release(&framer);
+    return true;
+}   // request_is
+
+
+
+static bool no_request(void)
+{
+    uint16_t len;
+
+    return net_dap_framer_request(&framer, &len) == NULL;
+}   // no_request
+
+
+
+static void test_split(void)
+/**
+ * Split a request at every position, header included.
+ */
+{
+    uint8_t buf[NET_DAP_HEADER_SIZE + 20];
+    uint32_t len = request(buf, 20, 0x10);
+
+    for (uint32_t split = 1;  split < len;  ++split) {
+        net_dap_framer_init(&framer);
+        CHECK_EQ(feed(buf, split, len), split);
+        CHECK(no_request());
+        CHECK( !framer.error);
+        CHECK_EQ(feed(buf + split, len - split, len), len - split);
+        CHECK(request_is(20, 0x10));
+        CHECK(no_request());
+    }
+
+    // byte by byte
+    net_dap_framer_init(&framer);
+    CHECK_EQ(feed(buf, len, 1), len);
+    CHECK(request_is(20, 0x10));
+    CHECK_EQ(framer.rx_len, 0);
+}   // test_split
+
+
+
+static void test_pipelined(void)
+/**
+ * Requests of different size back to back, fed in random chunks.
+ */
+{
+    static const uint16_t sizes[] = { 1, 2, NET_DAP_PACKET_SIZE, 17, 64, NET_DAP_PACKET_SIZE - 1, 3 };
+    uint8_t stream[sizeof(sizes) / sizeof(sizes[0]) * (NET_DAP_HEADER_SIZE + NET_DAP_PACKET_SIZE)];
+    uint32_t stream_len = 0;
+    uint32_t pos = 0;
+    uint32_t next = 0;
+
+    for (uint32_t i = 0;  i < sizeof(sizes) / sizeof(sizes[0]);  ++i) {
+        stream_len += request(stream + stream_len, sizes[i], i);
+    }
+
+    for (int round = 0;  round < 50;  ++round) {
+        net_dap_framer_init(&framer);
+        pos = 0;
+        next = 0;
+        while (next < sizeof(sizes) / sizeof(sizes[0])) {
+            uint32_t n = feed(stream + pos, stream_len - pos, 1 + test_rand() % 700);
+
+            pos += n;
+            // take only some of the available requests
+            while (next < sizeof(sizes) / sizeof(sizes[0])  &&  (n == 0  ||  test_rand() % 2 == 0)) {
+                if (no_request()) {
+                    break;
+                }
+                CHECK(request_is(sizes[next], next));
+                ++next;
+            }
+            CHECK( !framer.error);
+            if (framer.error) {
+                return;
+            }
+        }
+        CHECK_EQ(pos, stream_len);
+        CHECK(no_request());
+        CHECK_EQ(framer.rx_len, 0);
+    }
+}   // test_pipelined
+
+
+
+static void test_packet_count(void)
+/**
+ * Not more than NET_DAP_PACKET_COUNT requests are accepted, the rest stays with the host.
+ */
+{
+    uint8_t stream[(NET_DAP_PACKET_COUNT + 2) * (NET_DAP_HEADER_SIZE + 4)];
+    uint32_t stream_len = 0;
+    uint32_t frame_len = NET_DAP_HEADER_SIZE + 4;
+    uint32_t space;
+    uint32_t n;
+
+    for (uint32_t i = 0;  i < NET_DAP_PACKET_COUNT + 2;  ++i) {
+        stream_len += request(stream + stream_len, 4, i);
+    }
+
+    net_dap_framer_init(&framer);
+    n = feed(stream, stream_len, stream_len);
+    CHECK_EQ(n, stream_len);                                // one chunk: the framer can't know before
+    net_dap_framer_rx_buf(&framer, &space);
+    CHECK_EQ(space, 0);
+
+    net_dap_framer_init(&framer);
+    n = feed(stream, stream_len, 3);
+    CHECK_EQ(n, NET_DAP_PACKET_COUNT * frame_len);
+    net_dap_framer_rx_buf(&framer, &space);
+    CHECK_EQ(space, 0);
+
+    CHECK(request_is(4, 0));
+    net_dap_framer_rx_buf(&framer, &space);
+    CHECK(space != 0);
+    n += feed(stream + n, stream_len - n, 3);
+    CHECK_EQ(n, (NET_DAP_PACKET_COUNT + 1) * frame_len);
+    CHECK(request_is(4, 1));
+    n += feed(stream + n, stream_len - n, 3);
+    CHECK_EQ(n, stream_len);
+
+    for (uint32_t i = 2;  i < NET_DAP_PACKET_COUNT + 2;  ++i) {
+        CHECK(request_is(4, i));
+    }
+    CHECK(no_request());
+}   // test_packet_count
+
+
+
+static void test_invalid_header(void)
+{
+    uint8_t buf[2 * (NET_DAP_HEADER_SIZE + NET_DAP_PACKET_SIZE + 1)];
+    uint32_t len;
+    uint32_t space;
+
+    // maximum size is ok
+    net_dap_framer_init(&framer);
+    len = request(buf, NET_DAP_PACKET_SIZE, 1);
+    CHECK_EQ(feed(buf, len, 100), len);
+    CHECK(request_is(NET_DAP_PACKET_SIZE, 1));
+
+    // oversize: detected with the header, payload is dropped
+    net_dap_framer_init(&framer);
+    len = request(buf, NET_DAP_PACKET_SIZE + 1, 1);
+    CHECK_EQ(feed(buf, NET_DAP_HEADER_SIZE, 100), NET_DAP_HEADER_SIZE);
+    CHECK(framer.error);
+    CHECK(no_request());
+    CHECK_EQ(feed(buf + NET_DAP_HEADER_SIZE, len - NET_DAP_HEADER_SIZE, 100), len - NET_DAP_HEADER_SIZE);
+    CHECK_EQ(framer.rx_len, 0);
+    net_dap_framer_rx_buf(&framer, &space);
+    CHECK_EQ(space, NET_DAP_FRAMER_BUF_SIZE);
+
+    net_dap_framer_init(&framer);
+    header(buf, NET_DAP_SIGNATURE, 0xffff, NET_DAP_TYPE_REQUEST);
+    CHECK_EQ(feed(buf, NET_DAP_HEADER_SIZE, 1), NET_DAP_HEADER_SIZE);
+    CHECK(framer.error);
+
+    // empty request
+    net_dap_framer_init(&framer);
+    len = request(buf, 0, 0);
+    feed(buf, len, 100);
+    CHECK(framer.error);
+
+    // bad signature, wrong byte order, wrong type
+    net_dap_framer_init(&framer);
+    len = frame(buf, 0x00504145, 4, NET_DAP_TYPE_REQUEST, 0);
+    feed(buf, len, 100);
+    CHECK(framer.error);
+    CHECK(no_request());
+
+    net_dap_framer_init(&framer);
+    len = frame(buf, 0x44415000, 4, NET_DAP_TYPE_REQUEST, 0);
+    feed(buf, len, 100);
+    CHECK(framer.error);
+
+    net_dap_framer_init(&framer);
+    len = frame(buf, NET_DAP_SIGNATURE, 4, NET_DAP_TYPE_RESPONSE, 0);
+    feed(buf, len, 100);
+    CHECK(framer.error);
+
+    // bad header behind a good one
+    net_dap_framer_init(&framer);
+    len = request(buf, 4, 0);
+    len += frame(buf + len, 0x12345678, 4, NET_DAP_TYPE_REQUEST, 0);
+    feed(buf, len, 5);
+    CHECK(framer.error);
+    CHECK(no_request());
+
+    // init recovers
+    net_dap_framer_init(&framer);
+    len = request(buf, 4, 7);
+    CHECK_EQ(feed(buf, len, 100), len);
+    CHECK(request_is(4, 7));
+}   // test_invalid_header
+
+
+
+static void test_response_header(void)
+{
+    static const uint8_t expected[NET_DAP_HEADER_SIZE] = { 'D', 'A', 'P', 0, 0x02, 0x01, NET_DAP_TYPE_RESPONSE, 0 };
+    uint8_t hdr[NET_DAP_HEADER_SIZE];
+
+    net_dap_framer_response_header(hdr, 0x102);
+    CHECK(memcmp(hdr, expected, sizeof(hdr)) == 0);
+}   // test_response_header
+
+
+
+int main(void)
+{
+    test_split();
+    test_pipelined();
+    test_packet_count();
+    test_invalid_header();
+    test_response_header();
+    return test_result("test_net_dap_framer");
+}   // main
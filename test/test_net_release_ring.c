@@ -0,0 +1,177 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the reference ring lwIP -> TinyUSB (net_release_ring.c).
+ *
+ * Besides the single threaded full/empty/wrap cases, producer and consumer run in two threads
+ * like lwIP and TinyUSB on the two cores.  The consumer must get every reference exactly once
+ * and in order.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "net/net_release_ring.h"
+
+
+#define RING_N_MAX      32                      // USB_RELEASE_N
+
+
+typedef struct {
+    net_release_ring_t  ring;
+    uint32_t            count;                  // number of references to transfer
+    uint32_t            full;                   // producer found the ring full
+    uint32_t            empty;                  // consumer found the ring empty
+} stress_t;
+
+static void *ring_buf[RING_N_MAX];
+
+
+
+static void *ref_of(uint32_t seq)
+{
+    return (void *)(uintptr_t)(seq * 8 + 8);
+}   // ref_of
+
+
+
+static void test_single(uint32_t n, uint32_t start)
+{
+    net_release_ring_t r;
+    uint32_t seq_put = 0;
+    uint32_t seq_get = 0;
+
+    net_release_ring_init(&r, ring_buf, n);
+    r.wr = start;
+    r.rd = start;
+
+    CHECK(net_release_ring_get(&r) == NULL);
+
+    for (uint32_t lap = 0;  lap < 10;  ++lap) {
+        // fill up
+        for (uint32_t i = 0;  i < n;  ++i) {
+            CHECK(net_release_ring_put(&r, ref_of(seq_put++)));
+        }
+        CHECK( !net_release_ring_put(&r, ref_of(999)));
+        CHECK_EQ(r.wr - r.rd, n);
+
+        // partially empty, refill
+        for (uint32_t i = 0;  i < n / 2 + lap % 2;  ++i) {
+            CHECK(net_release_ring_get(&r) == ref_of(seq_get++));
+        }
+        while (net_release_ring_put(&r, ref_of(seq_put))) {
+            ++seq_put;
+        }
+
+        // empty
+        for (void *ref;  (ref = net_release_ring_get(&r)) != NULL;  ) {
+            CHECK(ref == ref_of(seq_get++));
+        }
+        CHECK_EQ(seq_get, seq_put);
+        CHECK(net_release_ring_get(&r) == NULL);
+    }
+}   // test_single
+
+
+
+static void *producer(void *arg)
+/**
+ * lwIP: pbuf_free() of the received datagrams.
+ */
+{
+    stress_t *s = (stress_t *)arg;
+
+    for (uint32_t seq = 0;  seq < s->count;  ++seq) {
+        while ( !net_release_ring_put(&s->ring, ref_of(seq))) {
+            ++s->full;
+            if (s->full % 16 == 0) {
+                sched_yield();
+            }
+        }
+    }
+    return NULL;
+}   // producer
+
+
+
+static void test_threads(uint32_t n, uint32_t start, uint32_t count)
+/**
+ * The main thread is the consumer (TinyUSB: context_tinyusb_events()).
+ */
+{
+    stress_t s = { .count = count };
+    pthread_t thread;
+    uint32_t seq = 0;
+    uint32_t errors = 0;
+
+    net_release_ring_init(&s.ring, ring_buf, n);
+    s.ring.wr = start;
+    s.ring.rd = start;
+
+    CHECK_EQ(pthread_create(&thread, NULL, producer, &s), 0);
+    while (seq < count) {
+        void *ref = net_release_ring_get(&s.ring);
+
+        if (ref == NULL) {
+            ++s.empty;
+            if (s.empty % 16 == 0) {
+                sched_yield();
+            }
+            continue;
+        }
+        if (ref != ref_of(seq)) {
+            ++errors;
+        }
+        ++seq;
+    }
+    pthread_join(thread, NULL);
+
+    CHECK_EQ(errors, 0);
+    CHECK(net_release_ring_get(&s.ring) == NULL);
+    CHECK_EQ(s.ring.wr - start, count);
+    CHECK_EQ(s.ring.rd - start, count);
+    CHECK(s.empty > 0);
+    printf("ring %2u: %u references, producer found ring full %u times, consumer found it empty %u times\n",
+           (unsigned)n, (unsigned)count, (unsigned)s.full, (unsigned)s.empty);
+}   // test_threads
+
+
+
+int main(void)
+{
+    test_single(4, 0);
+    test_single(RING_N_MAX, 0);
+    test_single(4, 0xfffffffe);                        // indexes wrap
+    test_single(RING_N_MAX, 0xfffffff0);
+
+    test_threads(2, 0, 2000000);
+    test_threads(4, 0xfff00000, 2000000);              // indexes wrap
+    test_threads(RING_N_MAX, 0, 2000000);
+    return test_result("test_net_release_ring");
+}   // main
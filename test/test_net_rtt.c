@@ -0,0 +1,320 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the RTT TCP server (net_rtt.c) against the lwIP model in lwip_sim/.
+ *
+ * The test plays the TCP client and the RTT thread (rtt_io.c), which moves data between the target
+ * and the streams of the server.  Checked are data in both directions, flow control towards the target,
+ * the stream reset handshake between lwIP and the RTT thread on (re)connect and the ERR_ABRT rule
+ * if a callback has to abort its pcb.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "lwip_sim.h"
+#include "net/net_rtt.h"
+
+
+#define PORT            19021
+
+
+static uint32_t to_target_notifies;
+
+
+
+void rtt_to_target_notify(void)
+{
+    ++to_target_notifies;
+}   // rtt_to_target_notify
+
+
+
+static uint32_t rtt_from_target(uint16_t channel, const char *data)
+/**
+ * RTT thread: data from the target goes to the host.
+ */
+{
+    uint32_t n;
+
+    lwip_sim_thread = LWIP_SIM_THREAD_APP;
+    net_rtt_send(channel, NULL, 0);
+    n = net_rtt_send(channel, (const uint8_t *)data, strlen(data));
+    lwip_sim_thread = LWIP_SIM_THREAD_LWIP;
+    return n;
+}   // rtt_from_target
+
+
+
+static uint32_t rtt_to_target(uint16_t channel, char *buf, uint32_t size)
+/**
+ * RTT thread: target takes up to \a size bytes from the host.
+ */
+{
+    StreamBufferHandle_t s;
+    uint32_t n;
+
+    lwip_sim_thread = LWIP_SIM_THREAD_APP;
+    s = net_rtt_stream_to_target(channel);
+    n = xStreamBufferReceive(s, buf, size, 0);
+    net_rtt_target_ready(channel);
+    lwip_sim_thread = LWIP_SIM_THREAD_LWIP;
+    buf[n] = '\0';
+    return n;
+}   // rtt_to_target
+
+
+
+static bool tx_is(struct tcp_pcb *pcb, const char *expected)
+{
+    return pcb->tx_len == strlen(expected)  &&  memcmp(pcb->tx, expected, pcb->tx_len) == 0;
+}   // tx_is
+
+
+
+static void check_model(void)
+{
+    CHECK_EQ(lwip_sim_stats.abrt_errors, 0);
+    CHECK_EQ(lwip_sim_stats.use_after_free, 0);
+    CHECK_EQ(lwip_sim_stats.stream_resets[LWIP_SIM_THREAD_LWIP], 0);
+}   // check_model
+
+
+
+static void test_data(void)
+{
+    struct tcp_pcb *pcb;
+    struct tcp_pcb *pcb2;
+    char buf[64];
+
+    pcb = lwip_sim_connect(PORT);
+    CHECK(pcb != NULL);
+    CHECK(net_rtt_is_connected(0));
+    CHECK( !net_rtt_is_connected(1));
+
+    CHECK_EQ(rtt_from_target(0, "hello "), 6);
+    CHECK_EQ(rtt_from_target(0, "world"), 5);
+    CHECK_EQ(lwip_sim_run(), 1);                        // one callback for both
+    CHECK(tx_is(pcb, "hello world"));
+    CHECK(pcb->outputs > 0);
+
+    CHECK_EQ(lwip_sim_recv(pcb, "abc", 3), ERR_OK);
+    CHECK_EQ(rtt_to_target(0, buf, sizeof(buf) - 1), 3);
+    CHECK(strcmp(buf, "abc") == 0);
+    CHECK_EQ(pcb->recved, 3);
+    CHECK(to_target_notifies > 0);
+
+    // other channel is independent
+    pcb2 = lwip_sim_connect(PORT + 2);
+    CHECK(pcb2 != NULL);
+    CHECK(net_rtt_is_connected(2));
+    CHECK_EQ(rtt_from_target(2, "two"), 3);
+    lwip_sim_run();
+    CHECK(tx_is(pcb, "hello world"));
+    CHECK(tx_is(pcb2, "two"));
+    lwip_sim_recv_fin(pcb2);
+
+    // SysView channel has its own server
+    CHECK(lwip_sim_connect(PORT + 1) == NULL);
+
+    CHECK_EQ(lwip_sim_recv_fin(pcb), ERR_OK);
+    CHECK( !net_rtt_is_connected(0));
+    CHECK(pcb->closed);
+    check_model();
+}   // test_data
+
+
+
+static void test_flow_control(void)
+/**
+ * The window is opened only for data which fitted into the stream to the target.
+ */
+{
+    struct tcp_pcb *pcb = lwip_sim_connect(PORT + 2);
+    char data[300];
+    char buf[301];
+    uint32_t got = 0;
+
+    for (uint32_t i = 0;  i < sizeof(data);  ++i) {
+        data[i] = 'a' + i % 26;
+    }
+    CHECK_EQ(lwip_sim_recv(pcb, data, 200), ERR_OK);
+    CHECK_EQ(lwip_sim_recv(pcb, data + 200, 100), ERR_OK);
+    CHECK_EQ(pcb->recved, 0);                           // RTT thread has not yet seen the connection
+
+    for (int i = 0;  i < 20  &&  got < sizeof(data);  ++i) {
+        got += rtt_to_target(2, buf + got, 50);
+        lwip_sim_run();
+        CHECK(pcb->recved <= got + 128);
+    }
+    CHECK_EQ(got, sizeof(data));
+    CHECK(memcmp(buf, data, sizeof(data)) == 0);
+    CHECK_EQ(pcb->recved, sizeof(data));
+
+    CHECK_EQ(lwip_sim_recv_fin(pcb), ERR_OK);
+    CHECK_EQ(lwip_sim_stats.pbufs, 0);
+    check_model();
+}   // test_flow_control
+
+
+
+static void test_reconnect(void)
+/**
+ * Data of the previous connection is dropped by the RTT thread, not by lwIP.
+ */
+{
+    struct tcp_pcb *pcb;
+    char buf[64];
+    uint32_t resets;
+
+    pcb = lwip_sim_connect(PORT + 3);
+    CHECK_EQ(rtt_from_target(3, "x"), 1);
+    lwip_sim_run();
+    CHECK(tx_is(pcb, "x"));
+
+    // data which is not sent / not taken by the target on disconnect
+    pcb->snd_buf = 0;
+    CHECK_EQ(rtt_from_target(3, "old"), 3);
+    lwip_sim_run();
+    CHECK_EQ(lwip_sim_recv(pcb, "OLD", 3), ERR_OK);
+    CHECK_EQ(lwip_sim_recv_fin(pcb), ERR_OK);
+    CHECK( !net_rtt_is_connected(3));
+
+    // new connection: nothing happens with the streams until the RTT thread has reset them
+    resets = lwip_sim_stats.stream_resets[LWIP_SIM_THREAD_APP];
+    pcb = lwip_sim_connect(PORT + 3);
+    CHECK(pcb != NULL);
+    CHECK_EQ(lwip_sim_recv(pcb, "new", 3), ERR_OK);
+    CHECK_EQ(lwip_sim_poll(pcb), ERR_OK);
+    CHECK_EQ(pcb->tx_len, 0);
+    CHECK_EQ(pcb->recved, 0);
+
+    CHECK_EQ(rtt_from_target(3, "NEW"), 3);
+    CHECK_EQ(lwip_sim_stats.stream_resets[LWIP_SIM_THREAD_APP], resets + 2);
+    lwip_sim_run();
+    CHECK(tx_is(pcb, "NEW"));
+
+    CHECK_EQ(rtt_to_target(3, buf, sizeof(buf) - 1), 0);   // data is fed after net_rtt_target_ready()
+    lwip_sim_run();
+    CHECK_EQ(rtt_to_target(3, buf, sizeof(buf) - 1), 3);
+    CHECK(strcmp(buf, "new") == 0);
+
+    lwip_sim_recv_fin(pcb);
+    check_model();
+}   // test_reconnect
+
+
+
+static void test_abort(void)
+/**
+ * tcp_close() fails: the pcb is aborted and the callback has to return ERR_ABRT.
+ */
+{
+    struct tcp_pcb *pcb;
+
+    // remote close in recv
+    pcb = lwip_sim_connect(PORT);
+    pcb->close_result = ERR_MEM;
+    CHECK_EQ(lwip_sim_recv_fin(pcb), ERR_ABRT);
+    CHECK(pcb->aborted);
+    CHECK( !net_rtt_is_connected(0));
+
+    // write error in sent
+    pcb = lwip_sim_connect(PORT);
+    CHECK_EQ(rtt_from_target(0, "data"), 4);
+    lwip_sim_run();
+    CHECK(tx_is(pcb, "data"));
+    CHECK_EQ(rtt_from_target(0, "more"), 4);
+    pcb->write_result = ERR_CONN;
+    pcb->close_result = ERR_MEM;
+    CHECK_EQ(lwip_sim_ack(pcb, 4), ERR_ABRT);
+    CHECK(pcb->aborted);
+    CHECK( !net_rtt_is_connected(0));
+    lwip_sim_run();
+
+    // write error in poll
+    pcb = lwip_sim_connect(PORT);
+    pcb->snd_buf = 0;
+    CHECK_EQ(rtt_from_target(0, "data"), 4);
+    lwip_sim_run();
+    pcb->snd_buf = TCP_SND_BUF;
+    pcb->write_result = ERR_CONN;
+    pcb->close_result = ERR_MEM;
+    CHECK_EQ(lwip_sim_poll(pcb), ERR_ABRT);
+    CHECK( !net_rtt_is_connected(0));
+
+    // write error, close succeeds
+    pcb = lwip_sim_connect(PORT);
+    pcb->snd_buf = 0;
+    CHECK_EQ(rtt_from_target(0, "data"), 4);
+    lwip_sim_run();
+    pcb->snd_buf = TCP_SND_BUF;
+    pcb->write_result = ERR_CONN;
+    CHECK_EQ(lwip_sim_poll(pcb), ERR_OK);
+    CHECK(pcb->closed);
+    CHECK( !net_rtt_is_connected(0));
+
+    // connection reset by peer
+    pcb = lwip_sim_connect(PORT);
+    CHECK_EQ(lwip_sim_recv(pcb, "abc", 3), ERR_OK);     // pending, streams not yet valid
+    lwip_sim_error(pcb, ERR_RST);
+    CHECK( !net_rtt_is_connected(0));
+    lwip_sim_run();
+
+    CHECK_EQ(lwip_sim_stats.pbufs, 0);
+    check_model();
+}   // test_abort
+
+
+
+static void test_busy(void)
+{
+    struct tcp_pcb *pcb = lwip_sim_connect(PORT + 2);
+
+    CHECK(pcb != NULL);
+    CHECK(lwip_sim_connect(PORT + 2) == NULL);          // one client per channel
+    CHECK_EQ(rtt_from_target(2, "still here"), 10);
+    lwip_sim_run();
+    CHECK(tx_is(pcb, "still here"));
+    lwip_sim_recv_fin(pcb);
+    check_model();
+}   // test_busy
+
+
+
+int main(void)
+{
+    lwip_sim_init();
+    net_rtt_init();
+
+    test_data();
+    test_flow_control();
+    test_reconnect();
+    test_abort();
+    test_busy();
+    return test_result("test_net_rtt");
+}   // main
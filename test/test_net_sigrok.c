@@ -0,0 +1,296 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the sigrok TCP server (net_sigrok.c) against the lwIP model in lwip_sim/.
+ *
+ * net_sigrok_write() is what cdc_sigrok_write() calls while a client is connected: it hands its
+ * buffer to lwIP and blocks until lwIP has copied it.  While the writer blocks, the test plays lwIP
+ * and the client (client_blocked()), which acknowledge, stall, close or reset the connection.
+ * Commands of the client are recorded instead of being parsed by cdc_sigrok.c.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "lwip_sim.h"
+#include "net/net_sigrok.h"
+
+
+#define PORT            19300
+
+typedef enum {
+    CLIENT_ACK,                             ///< acknowledge everything
+    CLIENT_STALL,                           ///< acknowledge nothing
+    CLIENT_FIN,                             ///< close after \a client_after blocks
+    CLIENT_RST,                             ///< reset after \a client_after blocks
+    CLIENT_WRITE_ERROR,                     ///< tcp_write() fails after \a client_after blocks, then poll
+} client_mode_t;
+
+static struct tcp_pcb *client;
+static client_mode_t   client_mode;
+static uint32_t        client_after;
+static uint32_t        client_calls;
+
+static uint8_t         host_rx[64];
+static uint32_t        host_rx_len;
+
+
+
+void cdc_sigrok_host_rx(const uint8_t *buf, uint32_t cnt)
+{
+    CHECK(lwip_sim_thread == LWIP_SIM_THREAD_LWIP);
+    CHECK(host_rx_len + cnt <= sizeof(host_rx));
+    if (host_rx_len + cnt <= sizeof(host_rx)) {
+        memcpy(host_rx + host_rx_len, buf, cnt);
+        host_rx_len += cnt;
+    }
+}   // cdc_sigrok_host_rx
+
+
+
+static bool host_rx_is(const char *expected)
+{
+    bool r = (host_rx_len == strlen(expected)  &&  memcmp(host_rx, expected, host_rx_len) == 0);
+
+    host_rx_len = 0;
+    return r;
+}   // host_rx_is
+
+
+
+static void client_blocked(void)
+/**
+ * Writer waits for lwIP: run lwIP and let the client act.
+ */
+{
+    lwip_sim_run();
+
+    if (++client_calls > 1000) {
+        // writer hangs
+        CHECK(client_calls <= 1000);
+        exit(test_result("test_net_sigrok"));
+    }
+    if (client->freed) {
+        return;
+    }
+
+    if (client_after != 0  &&  --client_after == 0) {
+        if (client_mode == CLIENT_FIN) {
+            lwip_sim_recv_fin(client);
+        }
+        else if (client_mode == CLIENT_RST) {
+            lwip_sim_error(client, ERR_RST);
+        }
+        else if (client_mode == CLIENT_WRITE_ERROR) {
+            client->write_result = ERR_CONN;
+            lwip_sim_poll(client);
+        }
+    }
+    else if (client_mode == CLIENT_ACK  &&  client->unacked != 0) {
+        lwip_sim_ack(client, client->unacked);
+    }
+    else {
+        lwip_sim_poll(client);
+    }
+}   // client_blocked
+
+
+
+static void connect(client_mode_t mode, uint32_t after)
+{
+    client = lwip_sim_connect(PORT);
+    CHECK(client != NULL);
+    CHECK(net_sigrok_is_connected());
+    client_mode  = mode;
+    client_after = after;
+    client_calls = 0;
+}   // connect
+
+
+
+static void check_model(void)
+{
+    CHECK_EQ(lwip_sim_stats.abrt_errors, 0);
+    CHECK_EQ(lwip_sim_stats.use_after_free, 0);
+    CHECK_EQ(lwip_sim_stats.ref_modified, 0);
+    CHECK_EQ(lwip_sim_stats.pbufs, 0);
+}   // check_model
+
+
+
+static void test_write(void)
+{
+    static uint8_t data[3 * TCP_SND_BUF + 123];
+    uint32_t blocked = lwip_sim_stats.blocked;
+
+    for (uint32_t i = 0;  i < sizeof(data);  ++i) {
+        data[i] = test_rand();
+    }
+
+    connect(CLIENT_ACK, 0);
+    net_sigrok_write(data, sizeof(data));
+    CHECK(lwip_sim_stats.blocked > blocked);
+    CHECK_EQ(client->tx_len, sizeof(data));
+    CHECK(memcmp(client->tx, data, sizeof(data)) == 0);
+
+    // buffer can be reused as soon as net_sigrok_write() returns
+    memset(data, 0, sizeof(data));
+    net_sigrok_write("abc", 3);
+    CHECK_EQ(client->tx_len, sizeof(data) + 3);
+    lwip_sim_ack(client, client->unacked);
+    CHECK(memcmp(client->tx + sizeof(data), "abc", 3) == 0);
+
+    // commands go to the parser, nothing is sent back by the server itself
+    CHECK_EQ(lwip_sim_recv(client, "*i", 2), ERR_OK);
+    CHECK(host_rx_is("*i"));
+    CHECK_EQ(client->recved, 2);
+
+    // client closes: acquisition is stopped
+    CHECK_EQ(lwip_sim_recv_fin(client), ERR_OK);
+    CHECK( !net_sigrok_is_connected());
+    CHECK(host_rx_is("+"));
+
+    // output without client returns immediately
+    blocked = lwip_sim_stats.blocked;
+    net_sigrok_write("x", 1);
+    CHECK_EQ(lwip_sim_stats.blocked, blocked);
+    CHECK_EQ(lwip_sim_run(), 0);
+    check_model();
+}   // test_write
+
+
+
+static void test_close_while_writing(void)
+/**
+ * A writer waiting for a stalled connection is released by close and by reset.
+ */
+{
+    static uint8_t data[2 * TCP_SND_BUF];
+
+    connect(CLIENT_STALL, 0);
+    client_after = 5;
+    client_mode  = CLIENT_FIN;
+    net_sigrok_write(data, sizeof(data));
+    CHECK(client_calls < 1000);
+    CHECK( !net_sigrok_is_connected());
+    CHECK_EQ(client->tx_len, TCP_SND_BUF);
+    CHECK(host_rx_is("+"));
+
+    connect(CLIENT_RST, 3);
+    net_sigrok_write(data, sizeof(data));
+    CHECK(client_calls < 1000);
+    CHECK( !net_sigrok_is_connected());
+    CHECK(host_rx_is("+"));
+
+    // reset before lwIP has taken anything
+    connect(CLIENT_RST, 1);
+    client->snd_buf = 0;
+    net_sigrok_write(data, 10);
+    CHECK(client_calls < 1000);
+    CHECK_EQ(client->tx_len, 0);
+    CHECK(host_rx_is("+"));
+
+    lwip_sim_run();
+    check_model();
+}   // test_close_while_writing
+
+
+
+static void test_abort(void)
+/**
+ * tcp_close() fails: the pcb is aborted and the callback has to return ERR_ABRT.
+ */
+{
+    static uint8_t data[2 * TCP_SND_BUF];
+
+    // remote close
+    connect(CLIENT_ACK, 0);
+    client->close_result = ERR_MEM;
+    CHECK_EQ(lwip_sim_recv_fin(client), ERR_ABRT);
+    CHECK(client->aborted);
+    CHECK( !net_sigrok_is_connected());
+    CHECK(host_rx_is("+"));
+
+    // write error in sent: the next write has to wait for the ack of the previous one
+    connect(CLIENT_STALL, 0);
+    net_sigrok_write(data, 10);
+    client->snd_buf = 0;
+    client->write_result = ERR_CONN;
+    client->close_result = ERR_MEM;
+    client_mode = CLIENT_ACK;
+    net_sigrok_write(data, sizeof(data));
+    CHECK(client->aborted);
+    CHECK( !net_sigrok_is_connected());
+    CHECK(host_rx_is("+"));
+
+    // write error in poll, lwIP is out of segments before
+    connect(CLIENT_WRITE_ERROR, 2);
+    client->write_result = ERR_MEM;
+    client->close_result = ERR_MEM;
+    net_sigrok_write(data, sizeof(data));
+    CHECK(client->aborted);
+    CHECK( !net_sigrok_is_connected());
+    CHECK(host_rx_is("+"));
+
+    lwip_sim_run();
+    check_model();
+}   // test_abort
+
+
+
+static void test_busy(void)
+{
+    struct tcp_pcb *second;
+
+    connect(CLIENT_ACK, 0);
+    second = lwip_sim_connect(PORT);
+    CHECK(second == NULL);
+    CHECK(net_sigrok_is_connected());
+    CHECK_EQ(host_rx_len, 0);                           // refused client does not stop the acquisition
+
+    net_sigrok_write("ok", 2);
+    CHECK_EQ(client->tx_len, 2);
+    lwip_sim_recv_fin(client);
+    CHECK(host_rx_is("+"));
+    check_model();
+}   // test_busy
+
+
+
+int main(void)
+{
+    lwip_sim_init();
+    lwip_sim_blocked = client_blocked;
+    net_sigrok_init();
+
+    test_write();
+    test_close_while_writing();
+    test_abort();
+    test_busy();
+    return test_result("test_net_sigrok");
+}   // main
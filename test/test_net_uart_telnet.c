@@ -0,0 +1,319 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the telnet/RFC2217 protocol of the UART TCP server.
+ *
+ * Replies are collected in a buffer, the line settings are simulated.  Flow control is tested
+ * by feeding the host data with a varying amount of space in the stream to the target.
+ */
+
+#include <string.h>
+
+#include "pico/platform.h"
+
+#include "test.h"
+#include "net/net_uart_telnet.h"
+
+
+#define IAC     255
+#define SB      250
+#define SE      240
+#define WILL    251
+#define WONT    252
+#define DO      253
+#define DONT    254
+#define COM     44
+
+static net_uart_telnet_t telnet;
+static uint8_t  reply[256];
+static uint32_t reply_len;
+static uint32_t baudrate;
+static uint32_t data_bits;
+
+
+
+static void reply_cb(void *ctx, const uint8_t *buf, uint16_t len)
+{
+    CHECK(reply_len + len <= sizeof(reply));
+    if (reply_len + len <= sizeof(reply)) {
+        memcpy(reply + reply_len, buf, len);
+        reply_len += len;
+    }
+}   // reply_cb
+
+
+
+static uint32_t com_port_cb(void *ctx, uint8_t cmd, uint32_t value)
+{
+    CHECK(ctx == &telnet);
+    switch (cmd) {
+        case RFC2217_SET_BAUDRATE:
+            if (value != 0)
+                baudrate = value;
+            return baudrate;
+        case RFC2217_SET_DATASIZE:
+            if (value >= 5  &&  value <= 8)
+                data_bits = value;
+            return data_bits;
+        case RFC2217_SET_PARITY:
+            return 1;
+        case RFC2217_SET_STOPSIZE:
+            return 1;
+    }
+    return 0;
+}   // com_port_cb
+
+
+
+static void setup(void)
+{
+    net_uart_telnet_init(&telnet, reply_cb, com_port_cb, &telnet);
+    reply_len = 0;
+    baudrate  = 115200;
+    data_bits = 8;
+}   // setup
+
+
+
+/// feed everything without flow control, return the data bytes
+static uint32_t feed(const uint8_t *in, uint32_t len, uint8_t *out)
+{
+    uint32_t used;
+    uint32_t n = net_uart_telnet_feed(&telnet, in, len, out, 1024, &used);
+
+    CHECK_EQ(used, len);
+    return n;
+}   // feed
+
+
+
+static bool reply_is(const uint8_t *expected, uint32_t len)
+{
+    bool r = (reply_len == len  &&  memcmp(reply, expected, len) == 0);
+
+    reply_len = 0;
+    return r;
+}   // reply_is
+
+
+
+static void test_plain_data(void)
+{
+    static const uint8_t in[] = { 'a', IAC, IAC, 'b' };
+    static const uint8_t raw[] = { 'x', IAC, 'y' };
+    uint8_t out[16];
+
+    setup();
+
+    // plain client: no escape
+    CHECK_EQ(net_uart_telnet_escape(&telnet, raw, sizeof(raw), out), 3);
+    CHECK(memcmp(out, raw, 3) == 0);
+
+    // doubled IAC from the host is data and switches to telnet mode
+    CHECK_EQ(feed(in, sizeof(in), out), 3);
+    CHECK(out[0] == 'a'  &&  out[1] == IAC  &&  out[2] == 'b');
+    CHECK(telnet.telnet);
+    CHECK_EQ(reply_len, 0);
+
+    CHECK_EQ(net_uart_telnet_escape(&telnet, raw, sizeof(raw), out), 4);
+    CHECK(out[0] == 'x'  &&  out[1] == IAC  &&  out[2] == IAC  &&  out[3] == 'y');
+}   // test_plain_data
+
+
+
+static void test_negotiation(void)
+{
+    static const uint8_t in[] = { IAC, WILL, COM, IAC, DO, 0, IAC, DO, 1, IAC, WILL, 5,
+                                  IAC, WILL, COM, IAC, DO, 0,                           // answered only once
+                                  'z' };
+    static const uint8_t expected[] = { IAC, DO, COM, IAC, WILL, 0, IAC, WONT, 1, IAC, DONT, 5 };
+    uint8_t out[16];
+
+    setup();
+    CHECK_EQ(feed(in, sizeof(in), out), 1);
+    CHECK_EQ(out[0], 'z');
+    CHECK(reply_is(expected, sizeof(expected)));
+}   // test_negotiation
+
+
+
+static void test_com_port(void)
+{
+    uint8_t out[16];
+
+    setup();
+
+    {
+        // set baudrate 115200 = 0x0001c200
+        static const uint8_t in[] = { IAC, SB, COM, RFC2217_SET_BAUDRATE, 0x00, 0x01, 0xc2, 0x00, IAC, SE };
+        static const uint8_t expected[] = { IAC, SB, COM, 101, 0x00, 0x01, 0xc2, 0x00, IAC, SE };
+
+        baudrate = 9600;
+        CHECK_EQ(feed(in, sizeof(in), out), 0);
+        CHECK_EQ(baudrate, 115200);
+        CHECK(reply_is(expected, sizeof(expected)));
+    }
+    {
+        // value with escaped IAC from the host, the answer must be escaped as well: 0x0000ffff
+        static const uint8_t in[] = { IAC, SB, COM, RFC2217_SET_BAUDRATE, 0x00, 0x00, IAC, IAC, IAC, IAC, IAC, SE };
+        static const uint8_t expected[] = { IAC, SB, COM, 101, 0x00, 0x00, IAC, IAC, IAC, IAC, IAC, SE };
+
+        CHECK_EQ(feed(in, sizeof(in), out), 0);
+        CHECK_EQ(baudrate, 0xffff);
+        CHECK(reply_is(expected, sizeof(expected)));
+    }
+    {
+        // query
+        static const uint8_t in[] = { IAC, SB, COM, RFC2217_SET_BAUDRATE, 0, 0, 0, 0, IAC, SE };
+        static const uint8_t expected[] = { IAC, SB, COM, 101, 0x00, 0x00, IAC, IAC, IAC, IAC, IAC, SE };
+
+        CHECK_EQ(feed(in, sizeof(in), out), 0);
+        CHECK_EQ(baudrate, 0xffff);
+        CHECK(reply_is(expected, sizeof(expected)));
+    }
+    {
+        // data size: invalid value is answered with the current setting
+        static const uint8_t in[] = { IAC, SB, COM, RFC2217_SET_DATASIZE, 7, IAC, SE,
+                                      IAC, SB, COM, RFC2217_SET_DATASIZE, 9, IAC, SE };
+        static const uint8_t expected[] = { IAC, SB, COM, 102, 7, IAC, SE,
+                                            IAC, SB, COM, 102, 7, IAC, SE };
+
+        CHECK_EQ(feed(in, sizeof(in), out), 0);
+        CHECK_EQ(data_bits, 7);
+        CHECK(reply_is(expected, sizeof(expected)));
+    }
+    {
+        // control: query flow control, set DTR -> "DTR off"
+        static const uint8_t in[] = { IAC, SB, COM, RFC2217_SET_CONTROL, 0, IAC, SE,
+                                      IAC, SB, COM, RFC2217_SET_CONTROL, 7, IAC, SE };
+        static const uint8_t expected[] = { IAC, SB, COM, 105, 1, IAC, SE,
+                                            IAC, SB, COM, 105, 9, IAC, SE };
+
+        CHECK_EQ(feed(in, sizeof(in), out), 0);
+        CHECK(reply_is(expected, sizeof(expected)));
+    }
+    {
+        // flow control suspend/resume: no answer
+        static const uint8_t suspend[] = { IAC, SB, COM, RFC2217_FLOWCONTROL_SUSPEND, IAC, SE };
+        static const uint8_t resume[] = { IAC, SB, COM, RFC2217_FLOWCONTROL_RESUME, IAC, SE };
+
+        CHECK_EQ(feed(suspend, sizeof(suspend), out), 0);
+        CHECK(telnet.suspended);
+        CHECK_EQ(feed(resume, sizeof(resume), out), 0);
+        CHECK( !telnet.suspended);
+        CHECK_EQ(reply_len, 0);
+    }
+    {
+        // overlong subnegotiation is truncated and does not overflow
+        static const uint8_t in[] = { IAC, SB, COM, 12, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, IAC, SE, 'q' };
+
+        CHECK_EQ(feed(in, sizeof(in), out), 1);
+        CHECK_EQ(out[0], 'q');
+        CHECK_EQ(reply_len, 7);
+        reply_len = 0;
+    }
+}   // test_com_port
+
+
+
+/**
+ * Random host data with telnet commands, fed in random pieces with random space in the target stream.
+ * Data must arrive complete and in order, nothing beyond the space may be produced.
+ */
+static void test_flow_control(void)
+{
+    static uint8_t in[20000];
+    static uint8_t expected[20000];
+    static uint8_t received[20000];
+    uint32_t in_len = 0;
+    uint32_t expected_len = 0;
+    uint32_t received_len = 0;
+    uint32_t pos = 0;
+
+    setup();
+
+    while (in_len < sizeof(in) - 16) {
+        uint32_t r = test_rand() % 16;
+
+        if (r == 0) {
+            static const uint8_t cmd[] = { IAC, SB, COM, RFC2217_SET_BAUDRATE, 0, 0, IAC, IAC, 0, IAC, SE };
+
+            memcpy(in + in_len, cmd, sizeof(cmd));
+            in_len += sizeof(cmd);
+        }
+        else if (r == 1) {
+            static const uint8_t cmd[] = { IAC, DO, 3 };
+
+            memcpy(in + in_len, cmd, sizeof(cmd));
+            in_len += sizeof(cmd);
+        }
+        else if (r == 2) {
+            in[in_len++] = IAC;
+            in[in_len++] = IAC;
+            expected[expected_len++] = IAC;
+        }
+        else {
+            uint8_t ch = test_rand() % 255;
+
+            in[in_len++] = ch;
+            expected[expected_len++] = ch;
+        }
+    }
+
+    while (pos < in_len) {
+        uint32_t chunk = MIN(1 + test_rand() % 100, in_len - pos);
+        uint32_t space = test_rand() % 70;
+        uint32_t used;
+        uint32_t n;
+
+        n = net_uart_telnet_feed(&telnet, in + pos, chunk, received + received_len, space, &used);
+        CHECK(n <= space);
+        CHECK(used <= chunk);
+        if (space != 0  &&  used < chunk) {
+            // stopped only because the stream is full
+            CHECK_EQ(n, space);
+        }
+        received_len += n;
+        reply_len = 0;
+        pos += used;
+    }
+
+    CHECK_EQ(received_len, expected_len);
+    CHECK(memcmp(received, expected, expected_len) == 0);
+    CHECK( !telnet.suspended);
+    CHECK_EQ(baudrate, 0xff00);
+}   // test_flow_control
+
+
+
+int main(void)
+{
+    test_plain_data();
+    test_negotiation();
+    test_com_port();
+    test_flow_control();
+    return test_result("test_net_uart_telnet");
+}   // main
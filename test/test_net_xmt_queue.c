@@ -0,0 +1,280 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the lwIP -> TinyUSB frame queue (net_xmt_queue.c).
+ *
+ * The test plays lwIP (linkoutput_fn() of net_glue.c), the TinyUSB event handler and a driver which
+ * takes a few frames per transmit buffer and refuses the rest.  Frames carry a sequence number, so
+ * lost, duplicated or overwritten frames are detected.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "net/net_xmt_queue.h"
+
+
+#define QUEUE_N         4
+#define DRV_FRAMES      3                       // frames per transmit buffer of the driver
+
+
+static net_xmt_queue_t  q;
+static uint32_t         frames[QUEUE_N];        // frame content: sequence number
+
+static uint32_t         seq_tx;                 // next frame of the producer
+static uint32_t         seq_rx;                 // next expected frame at the driver
+static uint32_t         wakeups;
+static bool             events_pending;         // context_tinyusb_events() deferred
+
+static bool             drv_ready;              // driver has a free transmit buffer
+static uint32_t         drv_frames;             // frames in the current transmit buffer
+static bool             drv_in_flight;          // transmit buffer on the bus, ready callback follows
+
+
+
+static bool drv_xmit(void *ctx, uint32_t slot)
+{
+    CHECK(slot < QUEUE_N);
+    if ( !drv_ready) {
+        return false;
+    }
+    CHECK_EQ(frames[slot], seq_rx);
+    ++seq_rx;
+    drv_in_flight = true;
+    if (++drv_frames >= DRV_FRAMES) {
+        drv_ready = false;
+    }
+    return true;
+}   // drv_xmit
+
+
+
+static void wakeup(void *ctx)
+{
+    ++wakeups;
+    events_pending = true;
+}   // wakeup
+
+
+
+static void process_events(void)
+/**
+ * context_tinyusb_events() / context_tinyusb_linkoutput()
+ */
+{
+    if (events_pending) {
+        events_pending = false;
+        if (net_xmt_queue_event(&q)) {
+            net_xmt_queue_drain(&q);
+        }
+    }
+}   // process_events
+
+
+
+static void drv_done(void)
+/**
+ * Transmit buffer is on the wire, driver calls tud_network_xmit_ready_cb().
+ */
+{
+    if (drv_in_flight) {
+        drv_in_flight = false;
+        drv_frames = 0;
+        drv_ready = true;
+        net_xmt_queue_drain(&q);
+    }
+}   // drv_done
+
+
+
+static bool produce(void)
+/**
+ * linkoutput_fn()
+ */
+{
+    int32_t slot = net_xmt_queue_slot(&q);
+
+    if (slot < 0) {
+        return false;
+    }
+    CHECK(slot < QUEUE_N);
+    frames[slot] = seq_tx++;
+    net_xmt_queue_commit(&q);
+    return true;
+}   // produce
+
+
+
+static void model_init(uint32_t start)
+{
+    net_xmt_queue_init(&q, QUEUE_N, drv_xmit, wakeup, NULL);
+    q.wr = start;
+    q.rd = start;
+    memset(frames, 0xff, sizeof(frames));
+    seq_tx = 0;
+    seq_rx = 0;
+    wakeups = 0;
+    events_pending = false;
+    drv_ready = true;
+    drv_frames = 0;
+    drv_in_flight = false;
+}   // model_init
+
+
+
+static void test_empty(void)
+{
+    model_init(0);
+
+    CHECK( !net_xmt_queue_event(&q));
+    CHECK(net_xmt_queue_drain(&q));
+    CHECK_EQ(seq_rx, 0);
+
+    CHECK(produce());
+    CHECK_EQ(wakeups, 1);
+    CHECK(net_xmt_queue_event(&q));
+    CHECK( !net_xmt_queue_event(&q));
+    CHECK(net_xmt_queue_drain(&q));
+    CHECK_EQ(seq_rx, 1);
+    CHECK_EQ(q.rd, q.wr);
+    CHECK(net_xmt_queue_drain(&q));
+    CHECK_EQ(seq_rx, 1);
+}   // test_empty
+
+
+
+static void test_full(void)
+{
+    model_init(0);
+    drv_ready = false;
+
+    for (uint32_t i = 0;  i < QUEUE_N;  ++i) {
+        CHECK(produce());
+        process_events();
+    }
+    CHECK_EQ(q.wr - q.rd, QUEUE_N);
+    CHECK_EQ(seq_rx, 0);
+
+    // full: no slot, nothing overwritten
+    CHECK( !produce());
+    CHECK( !produce());
+    CHECK_EQ(q.wr - q.rd, QUEUE_N);
+    for (uint32_t i = 0;  i < QUEUE_N;  ++i) {
+        CHECK_EQ(frames[i], i);
+    }
+
+    // flush (driver reset) empties the queue
+    net_xmt_queue_flush(&q);
+    CHECK_EQ(q.rd, q.wr);
+    CHECK(produce());
+}   // test_full
+
+
+
+static void test_kick_on_full(void)
+/**
+ * The driver refused the queue head without having a transmit buffer in flight and becomes ready
+ * later without calling back.  The producer finds the queue full and has to kick the consumer.
+ */
+{
+    model_init(0);
+    drv_ready = false;
+
+    for (uint32_t i = 0;  i < QUEUE_N;  ++i) {
+        CHECK(produce());
+        process_events();
+    }
+    CHECK( !drv_in_flight);
+    drv_ready = true;                                   // silently, no ready callback
+
+    wakeups = 0;
+    CHECK( !produce());
+    CHECK_EQ(wakeups, 1);
+    process_events();
+    CHECK_EQ(seq_rx, DRV_FRAMES);
+    drv_done();
+    CHECK_EQ(seq_rx, QUEUE_N);
+    CHECK_EQ(q.rd, q.wr);
+    CHECK(produce());
+}   // test_kick_on_full
+
+
+
+static void test_random(uint32_t start, uint32_t steps)
+/**
+ * Producer, event handler and driver interleaved at random, with \a start the indexes wrap.
+ */
+{
+    uint32_t full = 0;
+
+    model_init(start);
+
+    for (uint32_t step = 0;  step < steps;  ++step) {
+        uint32_t action = test_rand() % 100;
+
+        if (action < 40) {
+            full += !produce();
+        }
+        else if (action < 70) {
+            process_events();
+        }
+        else if (action < 95) {
+            drv_done();
+        }
+        else if ( !drv_in_flight) {
+            drv_ready = true;                           // silently
+        }
+        CHECK(q.wr - q.rd <= QUEUE_N);
+        CHECK_EQ(q.rd - start, seq_rx);
+        CHECK_EQ(q.wr - start, seq_tx);
+    }
+
+    // drain: the producer keeps trying like lwIP retransmissions do
+    for (uint32_t i = 0;  i < 100  &&  seq_rx != seq_tx;  ++i) {
+        if ( !drv_in_flight) {
+            drv_ready = true;
+        }
+        produce();
+        process_events();
+        drv_done();
+    }
+    CHECK_EQ(seq_rx, seq_tx);
+    CHECK(seq_tx > steps / 10);
+    CHECK(full > 0);
+}   // test_random
+
+
+
+int main(void)
+{
+    test_empty();
+    test_full();
+    test_kick_on_full();
+    test_random(0, 100000);
+    test_random(0xfffffff0, 100000);                   // indexes wrap
+    return test_result("test_net_xmt_queue");
+}   // main
@@ -0,0 +1,509 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Framing model of the PIO UARTs.
+ *
+ * The programs in pio_uart.pio are assembled from the source and run by a small PIO model
+ * (only the instructions used there).  The TX state machine drives the line which is sampled by
+ * the RX state machine with its own clock, so baudrate mismatch, break and framing errors are
+ * checked against the real programs.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+
+#define PROG_MAX      32
+#define FIFO_MAX      4096
+#define BIT_TIME      8000                      // time units per bit of the TX side, 8 PIO cycles
+
+typedef enum { OP_JMP, OP_WAIT, OP_IN, OP_OUT, OP_PUSH, OP_PULL, OP_SET, OP_IRQ } op_t;
+typedef enum { COND_ALWAYS, COND_X_DEC, COND_PIN } cond_t;
+
+typedef struct {
+    op_t      op;
+    cond_t    cond;
+    int       arg;                      // jmp target, wait polarity, bit count, set value, irq number
+    int       side;                     // -1 -> no side-set
+    int       delay;
+    char      target[32];               // jmp label
+} insn_t;
+
+typedef struct {
+    char      name[32];
+    insn_t    insn[PROG_MAX];
+    int       len;
+} program_t;
+
+typedef struct {
+    const program_t *prog;
+    int       pc;
+    uint32_t  x;
+    uint32_t  isr, osr;
+    int       pin;                      // output pin (TX only)
+    uint32_t  fifo[FIFO_MAX];
+    int       fifo_rd, fifo_wr;
+    bool      irq4;
+    uint64_t  next;                     // time of the next cycle
+    uint32_t  period;                   // time of one cycle
+} sm_t;
+
+static program_t progs[4];
+static int       prog_cnt;
+
+static sm_t      sm_tx, sm_rx;
+
+
+
+static void resolve_labels(program_t *p, char labels[][32], const int *label_pc, int label_cnt)
+{
+    for (int i = 0;  i < p->len;  ++i) {
+        if (p->insn[i].op == OP_JMP) {
+            p->insn[i].arg = -1;
+            for (int l = 0;  l < label_cnt;  ++l) {
+                if (strcmp(labels[l], p->insn[i].target) == 0) {
+                    p->insn[i].arg = label_pc[l];
+                }
+            }
+            CHECK(p->insn[i].arg >= 0);
+        }
+    }
+}   // resolve_labels
+
+
+
+static void parse_insn(insn_t *in, char *s)
+{
+    char mnem[16] = "", a1[32] = "", a2[32] = "";
+    char *opt;
+
+    memset(in, 0, sizeof(*in));
+    in->side = -1;
+
+    opt = strchr(s, '[');
+    if (opt != NULL) {
+        in->delay = atoi(opt + 1);
+        *opt = '\0';
+    }
+    opt = strstr(s, " side ");
+    if (opt != NULL) {
+        in->side = atoi(opt + 6);
+        *opt = '\0';
+    }
+    for (opt = s;  *opt != '\0';  ++opt) {
+        if (*opt == ',') {
+            *opt = ' ';
+        }
+    }
+
+    sscanf(s, "%15s %31s %31s", mnem, a1, a2);
+    if (strcmp(mnem, "jmp") == 0) {
+        in->op = OP_JMP;
+        if (strcmp(a1, "x--") == 0) {
+            in->cond = COND_X_DEC;
+            strcpy(in->target, a2);
+        }
+        else if (strcmp(a1, "pin") == 0) {
+            in->cond = COND_PIN;
+            strcpy(in->target, a2);
+        }
+        else {
+            in->cond = COND_ALWAYS;
+            strcpy(in->target, a1);
+        }
+    }
+    else if (strcmp(mnem, "wait") == 0) {
+        in->op = OP_WAIT;
+        in->arg = atoi(a1);
+        CHECK(strcmp(a2, "pin") == 0);
+    }
+    else if (strcmp(mnem, "in") == 0  ||  strcmp(mnem, "out") == 0) {
+        in->op = (mnem[0] == 'i') ? OP_IN : OP_OUT;
+        in->arg = atoi(a2);
+        CHECK(strcmp(a1, "pins") == 0);
+    }
+    else if (strcmp(mnem, "push") == 0) {
+        in->op = OP_PUSH;
+    }
+    else if (strcmp(mnem, "pull") == 0) {
+        in->op = OP_PULL;
+    }
+    else if (strcmp(mnem, "set") == 0) {
+        in->op = OP_SET;
+        in->arg = atoi(a2);
+        CHECK(strcmp(a1, "x") == 0);
+    }
+    else if (strcmp(mnem, "irq") == 0) {
+        in->op = OP_IRQ;
+        in->arg = atoi(a1);
+    }
+    else {
+        fprintf(stderr, "unsupported instruction '%s'\n", mnem);
+        exit(1);
+    }
+}   // parse_insn
+
+
+
+static void parse_pio(const char *path)
+/**
+ * Minimal assembler for the subset of the PIO language used by pio_uart.pio.
+ */
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    char labels[PROG_MAX][32];
+    int label_pc[PROG_MAX];
+    int label_cnt = 0;
+    program_t *p = NULL;
+
+    if (f == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *s = line;
+        char *c;
+
+        if (strncmp(s, "% c-sdk", 7) == 0) {
+            break;
+        }
+        c = strpbrk(s, ";\r\n");
+        if (c != NULL) {
+            *c = '\0';
+        }
+        s += strspn(s, " \t");
+        if (*s == '\0') {
+            continue;
+        }
+
+        if (strncmp(s, ".program", 8) == 0) {
+            if (p != NULL) {
+                resolve_labels(p, labels, label_pc, label_cnt);
+            }
+            p = progs + prog_cnt++;
+            memset(p, 0, sizeof(*p));
+            sscanf(s + 8, "%31s", p->name);
+            label_cnt = 0;
+            continue;
+        }
+        if (*s == '.'  ||  p == NULL) {
+            // .side_set etc: side-set is always a single optional pin here
+            continue;
+        }
+
+        c = strchr(s, ':');
+        if (c != NULL) {
+            *c = '\0';
+            sscanf(s, "%31s", labels[label_cnt]);
+            label_pc[label_cnt++] = p->len;
+            s = c + 1 + strspn(c + 1, " \t");
+            if (*s == '\0') {
+                continue;
+            }
+        }
+        parse_insn(p->insn + p->len++, s);
+    }
+    fclose(f);
+
+    if (p != NULL) {
+        resolve_labels(p, labels, label_pc, label_cnt);
+    }
+}   // parse_pio
+
+
+
+static const program_t *find_program(const char *name)
+{
+    for (int i = 0;  i < prog_cnt;  ++i) {
+        if (strcmp(progs[i].name, name) == 0) {
+            return progs + i;
+        }
+    }
+    fprintf(stderr, "program %s not found\n", name);
+    exit(1);
+}   // find_program
+
+
+
+static void sm_init(sm_t *sm, const char *name, uint32_t period)
+{
+    memset(sm, 0, sizeof(*sm));
+    sm->prog = find_program(name);
+    sm->pin = 1;
+    sm->period = period;
+}   // sm_init
+
+
+
+static void sm_step(sm_t *sm, int pin_in)
+/**
+ * Execute one cycle: one instruction, a stall or nothing if a delay is pending.
+ * Shifts are to the right like configured by the c-sdk init functions.
+ */
+{
+    const insn_t *in = sm->prog->insn + sm->pc;
+    int next_pc = (sm->pc + 1) % sm->prog->len;         // default wrap is the whole program
+    bool stall = false;
+
+    if (in->side >= 0) {
+        sm->pin = in->side;
+    }
+
+    switch (in->op) {
+        case OP_JMP:
+            if (in->cond == COND_ALWAYS
+                ||  (in->cond == COND_X_DEC  &&  sm->x-- != 0)
+                ||  (in->cond == COND_PIN  &&  pin_in)) {
+                next_pc = in->arg;
+            }
+            break;
+
+        case OP_WAIT:
+            stall = (pin_in != in->arg);
+            break;
+
+        case OP_IN:
+            for (int i = 0;  i < in->arg;  ++i) {
+                sm->isr = (sm->isr >> 1) | ((uint32_t)pin_in << 31);
+            }
+            break;
+
+        case OP_OUT:
+            for (int i = 0;  i < in->arg;  ++i) {
+                sm->pin = sm->osr & 1;
+                sm->osr >>= 1;
+            }
+            break;
+
+        case OP_PUSH:
+            CHECK(sm->fifo_wr - sm->fifo_rd < FIFO_MAX);
+            sm->fifo[sm->fifo_wr++ % FIFO_MAX] = sm->isr;
+            sm->isr = 0;
+            break;
+
+        case OP_PULL:
+            stall = (sm->fifo_rd == sm->fifo_wr);
+            if ( !stall) {
+                sm->osr = sm->fifo[sm->fifo_rd++ % FIFO_MAX];
+            }
+            break;
+
+        case OP_SET:
+            sm->x = in->arg;
+            break;
+
+        case OP_IRQ:
+            CHECK_EQ(in->arg, 4);
+            sm->irq4 = true;
+            break;
+    }
+
+    if (stall) {
+        sm->next += sm->period;
+    }
+    else {
+        sm->pc = next_pc;
+        sm->next += (uint64_t)sm->period * (1 + in->delay);
+    }
+}   // sm_step
+
+
+
+/// line driven by a fixed waveform instead of the TX state machine: bit times, -1 terminated
+static const int *wave;
+static uint64_t   wave_start;
+
+static int line_level(uint64_t now)
+{
+    if (wave != NULL) {
+        uint64_t bit = (now - wave_start) / BIT_TIME;
+
+        for (uint64_t i = 0;  i <= bit;  ++i) {
+            if (wave[i] < 0) {
+                return 1;
+            }
+        }
+        return wave[bit];
+    }
+    return sm_tx.pin;
+}   // line_level
+
+
+
+static void run_until(uint64_t end)
+{
+    while (sm_tx.next < end  ||  sm_rx.next < end) {
+        if (sm_tx.next <= sm_rx.next) {
+            sm_step(&sm_tx, 0);
+        }
+        else {
+            sm_step(&sm_rx, line_level(sm_rx.next));
+        }
+    }
+}   // run_until
+
+
+
+static void loopback_init(int rx_ppm)
+/**
+ * TX at nominal baudrate, RX deviates by \a rx_ppm, both start at a random clock phase.
+ */
+{
+    sm_init(&sm_tx, "pio_uart_tx", BIT_TIME / 8);
+    sm_init(&sm_rx, "pio_uart_rx", (uint32_t)((int64_t)(BIT_TIME / 8) * (1000000 + rx_ppm) / 1000000));
+    sm_rx.next = test_rand() % sm_rx.period;
+    wave = NULL;
+}   // loopback_init
+
+
+
+static int rx_bytes(uint8_t *buf, int max)
+/**
+ * Bytes received so far, the data is in the MSB of a FIFO entry (read by DMA at offset 3).
+ */
+{
+    int n = 0;
+
+    while (sm_rx.fifo_rd != sm_rx.fifo_wr  &&  n < max) {
+        uint32_t v = sm_rx.fifo[sm_rx.fifo_rd++ % FIFO_MAX];
+
+        buf[n++] = (uint8_t)(v >> 24);
+    }
+    return n;
+}   // rx_bytes
+
+
+
+static void test_assembler(void)
+{
+    const program_t *tx = find_program("pio_uart_tx");
+    const program_t *rx = find_program("pio_uart_rx");
+
+    // instruction count is limited by the shared instruction memory (32 per PIO)
+    CHECK_EQ(tx->len, 4);
+    CHECK_EQ(rx->len, 9);
+    CHECK(tx->len + rx->len <= 32);
+}   // test_assembler
+
+
+
+static void test_loopback(int rx_ppm, int cnt, bool expect_ok)
+/**
+ * Transmit \a cnt random bytes with a baudrate mismatch of \a rx_ppm.
+ */
+{
+    uint8_t sent[FIFO_MAX], recv[FIFO_MAX];
+    int n;
+
+    loopback_init(rx_ppm);
+    for (int i = 0;  i < cnt;  ++i) {
+        sent[i] = (uint8_t)test_rand();
+        sm_tx.fifo[sm_tx.fifo_wr++] = sent[i];
+    }
+    run_until((uint64_t)(cnt + 2) * 10 * BIT_TIME * 11 / 10);
+
+    n = rx_bytes(recv, sizeof(recv));
+    if (expect_ok) {
+        CHECK_EQ(n, cnt);
+        CHECK(memcmp(sent, recv, cnt) == 0);
+        CHECK( !sm_rx.irq4);
+    }
+    else {
+        CHECK(n != cnt  ||  memcmp(sent, recv, cnt) != 0  ||  sm_rx.irq4);
+    }
+}   // test_loopback
+
+
+
+static void test_waveform(const int *w, const uint8_t *expect, int expect_cnt, bool framing_error)
+/**
+ * Feed the RX state machine with the bit sequence \a w.
+ */
+{
+    uint8_t recv[16];
+    int bits = 0;
+    int n;
+
+    while (w[bits] >= 0) {
+        ++bits;
+    }
+
+    loopback_init(0);
+    wave = w;
+    wave_start = 0;
+    sm_tx.next = UINT64_MAX;                    // TX not used
+    run_until((uint64_t)(bits + 20) * BIT_TIME);
+
+    n = rx_bytes(recv, sizeof(recv));
+    CHECK_EQ(n, expect_cnt);
+    CHECK(memcmp(recv, expect, n < expect_cnt ? n : expect_cnt) == 0);
+    CHECK_EQ(sm_rx.irq4, framing_error);
+}   // test_waveform
+
+
+
+static void test_framing(void)
+{
+    // idle, 0x55 8N1 LSB first, idle
+    static const int w_ok[]    = { 1, 1, 0, 1,0,1,0,1,0,1,0, 1, 1, -1 };
+    // stop bit low -> framing error, the byte is discarded
+    static const int w_stop[]  = { 1, 1, 0, 1,0,1,0,1,0,1,0, 0, 1, 1, -1 };
+    // break (line low for more than a character), then 0xa3
+    static const int w_break[] = { 1, 1, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 1, 1,
+                                   0, 1,1,0,0,0,1,0,1, 1, 1, -1 };
+    // two characters back to back: 0x00, 0xff
+    static const int w_b2b[]   = { 1, 0, 0,0,0,0,0,0,0,0, 1, 0, 1,1,1,1,1,1,1,1, 1, 1, -1 };
+    static const uint8_t e_ok[] = { 0x55 };
+    static const uint8_t e_break[] = { 0xa3 };
+    static const uint8_t e_b2b[] = { 0x00, 0xff };
+
+    test_waveform(w_ok, e_ok, 1, false);
+    test_waveform(w_stop, NULL, 0, true);
+    test_waveform(w_break, e_break, 1, true);
+    test_waveform(w_b2b, e_b2b, 2, false);
+}   // test_framing
+
+
+
+int main(void)
+{
+    parse_pio(PIO_UART_PIO);
+
+    test_assembler();
+    test_framing();
+    test_loopback(0, 1000, true);
+    test_loopback(25000, 1000, true);                  // RX 2.5% slow
+    test_loopback(-25000, 1000, true);                 // RX 2.5% fast
+    test_loopback(100000, 100, false);                 // 10% off is detected
+    test_loopback(-100000, 100, false);
+    return test_result("test_pio_uart");
+}   // main
@@ -0,0 +1,201 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Helpers for the sigrok host tests: device setup like the host commands do it, generated
+ * captures in the layout of the capture buffer and a reference decoder of the sigrok-pico
+ * wire format (like the libsigrok driver).
+ */
+
+#ifndef _TEST_SIGROK_H
+#define _TEST_SIGROK_H
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "sigrok_int.h"
+#include "sigrok_encode.h"
+
+
+sr_device_t sr_dev;
+
+
+/// set up \a sr_dev for a capture with the digital channels \a d_mask and the analog channels \a a_mask
+static inline void sr_test_setup(uint32_t d_mask, uint32_t a_mask)
+{
+    sr_device_t *d = &sr_dev;
+
+    sigrok_full_reset(d);
+    d->d_mask = d_mask;
+    d->a_mask = a_mask;
+    d->d_mask_D4 = 0;
+    for (int i = 0;  i < 8;  ++i) {
+        d->d_mask_D4 |= (d->d_mask & 0x0f) << (4 * i);
+    }
+    sigrok_tx_init(d);
+
+    if ((d->d_mask & 0x0000000f) == d->d_mask)
+        d->pin_count = 4;
+    else if ((d->d_mask & 0x000000ff) == d->d_mask)
+        d->pin_count = 8;
+    else if ((d->d_mask & 0x0000ffff) == d->d_mask)
+        d->pin_count = 16;
+    else
+        d->pin_count = 32;
+    if (d->pin_count == 4  &&  d->a_chan_cnt != 0) {
+        d->pin_count = 8;
+    }
+    d_dma_bps = d->pin_count >> 3;
+    d->continuous = true;
+    sent_cnt = 0;
+}   // sr_test_setup
+
+
+/// bytes of \a samples digital samples in the capture buffer
+static inline uint32_t sr_test_d_size(uint32_t samples)
+{
+    return (d_dma_bps == 0) ? (samples + 1) / 2 : samples * d_dma_bps;
+}   // sr_test_d_size
+
+
+/**
+ * Generate \a samples digital samples into \a ref (masked) and \a dbuf (capture buffer layout, with
+ * random values on the channels which are not enabled).  A sample changes with probability
+ * \a activity / 65536.
+ */
+static inline void sr_test_capture(uint8_t *dbuf, uint32_t *ref, uint32_t samples, uint32_t activity)
+{
+    uint32_t mask = (d_dma_bps == 0) ? 0x0f : (d_dma_bps == 4) ? 0xffffffff : (1u << (8 * d_dma_bps)) - 1;
+    uint32_t val = test_rand() & mask;
+
+    for (uint32_t i = 0;  i < samples;  ++i) {
+        uint32_t r = test_rand();
+        uint32_t raw;
+
+        if ((r & 0xffff) < activity) {
+            val = test_rand() & mask;
+        }
+        // channels which are not enabled toggle at random, they must not show up
+        raw = (val & sr_dev.d_mask) | (test_rand() & mask & ~sr_dev.d_mask);
+        ref[i] = val & sr_dev.d_mask;
+
+        switch (d_dma_bps) {
+            case 0:
+                if ((i & 1) == 0) {
+                    dbuf[i / 2] = raw;
+                }
+                else {
+                    dbuf[i / 2] |= raw << 4;
+                }
+                break;
+            case 1:
+                dbuf[i] = raw;
+                break;
+            case 2:
+                memcpy(dbuf + 2 * i, &raw, 2);
+                break;
+            default:
+                memcpy(dbuf + 4 * i, &raw, 4);
+                break;
+        }
+    }
+}   // sr_test_capture
+
+
+/**
+ * Reference decoder for the sigrok-pico wire format.  Decoded digital samples are appended to
+ * \a out, analog values (one byte per enabled channel) to \a aout.
+ */
+typedef struct {
+    uint32_t  cnt;                      // decoded samples
+    uint32_t  last;                     // last digital value
+    uint32_t  val;                      // digital value in progress
+    uint32_t  byte_ndx;                 // byte of the slice in progress
+    uint32_t  acnt;                     // decoded analog values
+    bool      error;
+} sr_test_decoder_t;
+
+static inline void sr_test_decode(sr_test_decoder_t *dec, const uint8_t *buf, uint32_t len,
+                                  uint32_t *out, uint32_t out_max, uint8_t *aout)
+{
+    const sr_device_t *d = &sr_dev;
+    uint32_t slice_bytes = d->d_tx_bps + d->a_chan_cnt;
+
+#define SR_TEST_EMIT(v)         do { if (dec->cnt < out_max) out[dec->cnt] = (v); ++dec->cnt; } while (0)
+
+    for (uint32_t i = 0;  i < len;  ++i) {
+        uint8_t b = buf[i];
+
+        if (d->a_mask == 0  &&  d_dma_bps == 0) {
+            // D4
+            if (b >= 0x80) {
+                for (uint32_t r = 0;  r < ((b >> 4) & 7);  ++r) {
+                    SR_TEST_EMIT(dec->last);
+                }
+                dec->last = b & 0x0f;
+                SR_TEST_EMIT(dec->last);
+            }
+            else if (b >= 48) {
+                for (uint32_t r = 0;  r < 8u * (b - 47);  ++r) {
+                    SR_TEST_EMIT(dec->last);
+                }
+            }
+            else {
+                dec->error = true;
+            }
+        }
+        else if (b >= 0x80) {
+            // slice: digital bytes first, then analog
+            if (dec->byte_ndx < d->d_tx_bps) {
+                dec->val |= (uint32_t)(b & 0x7f) << (7 * dec->byte_ndx);
+            }
+            else if (aout != NULL) {
+                aout[dec->acnt++] = b & 0x7f;
+            }
+            if (++dec->byte_ndx == slice_bytes) {
+                dec->last = dec->val;
+                SR_TEST_EMIT(dec->last);
+                dec->val = 0;
+                dec->byte_ndx = 0;
+            }
+        }
+        else if (b >= 48  &&  d->a_mask == 0  &&  dec->byte_ndx == 0) {
+            uint32_t rle = (b <= 79) ? b - 47u : (b - 78u) * 32;
+
+            for (uint32_t r = 0;  r < rle;  ++r) {
+                SR_TEST_EMIT(dec->last);
+            }
+        }
+        else {
+            dec->error = true;
+        }
+    }
+#undef SR_TEST_EMIT
+}   // sr_test_decode
+
+
+#endif
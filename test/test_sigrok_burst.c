@@ -0,0 +1,246 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the capture buffer layout and its unpacking for burst and ring captures: the buffer is split
+ * into segments by sigrok_seg_layout(), filled like the DMA does it and unpacked segment by segment with
+ * sigrok_encode_segment().  The result is decoded with the reference decoder of the wire format.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "test_sigrok.h"
+
+
+#define SEGMENTS        4                            // default SR_DMA_SEGMENTS of sigrok.c
+#define SAMPLES_MAX     (2 * SR_DMA_BUF_SIZE)
+
+static uint8_t           capture[SR_DMA_BUF_SIZE] __attribute__((aligned(4)));
+static uint8_t           dstream[4 * SAMPLES_MAX] __attribute__((aligned(4)));
+static uint8_t           astream[3 * SAMPLES_MAX];
+static uint32_t          ref[SAMPLES_MAX];
+static uint32_t          decoded[SAMPLES_MAX + 100];
+static uint8_t           adecoded[3 * SAMPLES_MAX];
+static sr_test_decoder_t dec;
+
+
+
+void sigrok_tx_write(const uint8_t *buf, uint32_t cnt)
+{
+    sr_test_decode(&dec, buf, cnt, decoded, SAMPLES_MAX + 100, adecoded);
+}   // sigrok_tx_write
+
+
+
+static void dma_fill(uint32_t seg_no)
+/**
+ * Copy the samples of segment number \a seg_no of the capture into its place in the ring, like the DMA does it.
+ */
+{
+    const sr_device_t *d = &sr_dev;
+    uint32_t seg = seg_no % d->seg_cnt;
+
+    memcpy(capture + d->dbuf_start + seg * d->d_size, dstream + seg_no * d->d_size, d->d_size);
+    memcpy(capture + d->abuf_start + seg * d->a_size, astream + seg_no * d->a_size, d->a_size);
+}   // dma_fill
+
+
+
+static void check_layout(uint32_t buf_size)
+{
+    const sr_device_t *d = &sr_dev;
+    uint32_t d_bytes = (d_dma_bps == 0) ? d->samples_per_seg / 2 : d->samples_per_seg * d_dma_bps;
+
+    CHECK(d->seg_cnt >= 2  &&  d->seg_cnt <= SEGMENTS);
+    CHECK(d->samples_per_seg != 0);
+    CHECK(d->seg_cnt * (d->d_size + d->a_size) <= buf_size);
+    CHECK_EQ(d->d_size % 4, 0);
+    CHECK_EQ(d->a_size % 4, 0);
+    CHECK_EQ(d->dbuf_start, 0);
+    CHECK_EQ(d->abuf_start, d->seg_cnt * d->d_size);
+    if (d->d_mask != 0) {
+        CHECK_EQ(d->d_size, d_bytes);
+    }
+    CHECK_EQ(d->a_size, d->samples_per_seg * d->a_chan_cnt);
+    if (d_dma_bps == 0) {
+        CHECK_EQ(d->samples_per_seg % 8, 0);         // D4 encoding works on whole words
+    }
+}   // check_layout
+
+
+
+static void check_capture(uint32_t d_mask, uint32_t a_mask, uint32_t num_samples, bool burst, const char *name)
+/**
+ * Fixed capture of \a num_samples.  A burst has to fit into two segments, DMA fills all of them before
+ * encoding starts.  Otherwise the segments of the ring are filled and encoded one after the other.
+ */
+{
+    sr_device_t *d = &sr_dev;
+    uint32_t seg_needed, total, expected;
+    bool fitted;
+
+    sr_test_setup(d_mask, a_mask);
+    d->continuous = false;
+    // like sigrok_thread(): at least 16 samples, multiple of 4
+    d->num_samples = (num_samples < 16) ? 16 : (num_samples + 3) & ~3u;
+
+    fitted = sigrok_seg_layout(d, SR_DMA_BUF_SIZE, SEGMENTS, burst);
+    CHECK_EQ(fitted, burst);
+    check_layout(SR_DMA_BUF_SIZE);
+    if (burst) {
+        CHECK_EQ(d->seg_cnt, 2);
+    }
+
+    seg_needed = (d->num_samples + d->samples_per_seg - 1) / d->samples_per_seg;
+    if (burst) {
+        // the stop DMA channel is chained to the digital channel of the last segment
+        CHECK(seg_needed >= 1  &&  seg_needed <= 2);
+    }
+    total = seg_needed * d->samples_per_seg;
+    if (total > SAMPLES_MAX) {
+        fprintf(stderr, "%s: %u samples do not fit the test\n", name, total);
+        ++test_failures;
+        return;
+    }
+
+    sr_test_capture(dstream, ref, total, 2000);
+    for (uint32_t i = 0;  i < total * d->a_chan_cnt;  ++i) {
+        astream[i] = (uint8_t)test_rand();
+    }
+    memset(capture, 0x55, sizeof(capture));
+    memset(&dec, 0, sizeof(dec));
+
+    if (burst) {
+        for (uint32_t seg_no = 0;  seg_no < seg_needed;  ++seg_no) {
+            dma_fill(seg_no);
+        }
+    }
+    for (uint32_t seg_no = 0;  seg_no < seg_needed  &&  d->sample_and_send;  ++seg_no) {
+        if ( !burst) {
+            dma_fill(seg_no);
+        }
+        sigrok_encode_segment(d, capture, seg_no % d->seg_cnt, 0, d->samples_per_seg);
+    }
+
+    // D4 sends whole words of 8 samples
+    expected = (d_dma_bps == 0  &&  d->a_mask == 0) ? (d->num_samples + 7) & ~7u : d->num_samples;
+    CHECK( !d->sample_and_send);
+    CHECK_EQ(d->scnt, d->num_samples);
+    if (dec.error  ||  dec.cnt != expected  ||  memcmp(decoded, ref, 4 * expected) != 0) {
+        fprintf(stderr, "%s: %u samples in %u segments of %u: decoded %u, expected %u%s\n", name, d->num_samples,
+                seg_needed, d->samples_per_seg, dec.cnt, expected, dec.error ? ", format error" : "");
+        ++test_failures;
+        return;
+    }
+    if (d->a_mask != 0) {
+        CHECK_EQ(dec.acnt, d->num_samples * d->a_chan_cnt);
+        for (uint32_t i = 0;  i < dec.acnt;  ++i) {
+            if (adecoded[i] != astream[i] >> 1) {
+                CHECK_EQ(adecoded[i], astream[i] >> 1);
+                break;
+            }
+        }
+    }
+}   // check_capture
+
+
+
+static void test_modes(uint32_t d_mask, uint32_t a_mask, const char *name)
+{
+    static const uint32_t counts[] = { 1, 16, 20, 100, 1000, 4092, 20004, 50000 };
+    uint32_t max_burst;
+
+    for (uint32_t n = 0;  n < sizeof(counts) / sizeof(counts[0]);  ++n) {
+        // sizes which don't fit are not a burst
+        sr_test_setup(d_mask, a_mask);
+        sr_dev.num_samples = counts[n];
+        if (sigrok_seg_layout(&sr_dev, SR_DMA_BUF_SIZE, SEGMENTS, true)) {
+            check_capture(d_mask, a_mask, counts[n], true, name);
+        }
+        check_capture(d_mask, a_mask, counts[n], false, name);
+    }
+
+    // largest burst: the capture buffer less one chunk
+    sr_test_setup(d_mask, a_mask);
+    max_burst = 0;
+    for (uint32_t step = 1u << 20;  step != 0;  step >>= 1) {
+        sr_dev.num_samples = max_burst + step;
+        if (sigrok_seg_layout(&sr_dev, SR_DMA_BUF_SIZE, SEGMENTS, true)) {
+            max_burst += step;
+        }
+    }
+    CHECK(max_burst > 0);
+    max_burst &= ~3u;
+    check_capture(d_mask, a_mask, max_burst, true, name);
+    check_capture(d_mask, a_mask, max_burst + 4, false, name);
+
+    // random sizes
+    for (int run = 0;  run < 20;  ++run) {
+        uint32_t n = 16 + test_rand() % (max_burst - 16);
+
+        check_capture(d_mask, a_mask, n, true, name);
+    }
+}   // test_modes
+
+
+
+static void test_small_buffer(void)
+/**
+ * The ring shrinks to two segments if the buffer holds only a few chunks (buffered mode uses only a part
+ * of the capture buffer for the DMA).
+ */
+{
+    uint32_t chunk;
+
+    sr_test_setup(0xff, 0x7);
+    chunk = sigrok_seg_chunk_size(&sr_dev);
+    sr_dev.num_samples = 1000000;
+    CHECK( !sigrok_seg_layout(&sr_dev, 3 * chunk + 10, SEGMENTS, true));
+    CHECK_EQ(sr_dev.seg_cnt, 3);
+    check_layout(3 * chunk + 10);
+    CHECK( !sigrok_seg_layout(&sr_dev, 2 * chunk, SEGMENTS, true));
+    CHECK_EQ(sr_dev.seg_cnt, 2);
+    check_layout(2 * chunk);
+    CHECK( !sigrok_seg_layout(&sr_dev, 9 * chunk, SEGMENTS, false));
+    CHECK_EQ(sr_dev.seg_cnt, 4);
+    check_layout(9 * chunk);
+}   // test_small_buffer
+
+
+
+int main(void)
+{
+    test_modes(0x3, 0, "D4 2ch");
+    test_modes(0xf, 0, "D4 4ch");
+    test_modes(0xff, 0, "1B 8ch");
+    test_modes(0xffff, 0, "2B 16ch");
+    test_modes(0x1fffff, 0, "4B 21ch");
+    test_modes(0xff, 0x1, "8ch + 1 ADC");
+    test_modes(0x3, 0x7, "2ch + 3 ADC");
+    test_small_buffer();
+    return test_result("test_sigrok_burst");
+}   // main
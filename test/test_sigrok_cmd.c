@@ -0,0 +1,335 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Loopback test of the sigrok command parser: command sequences like the libsigrok driver sends
+ * them go through sigrok_cmd_rx(), a stubbed transport collects the responses like the capture
+ * side does it on sigrok_notify().
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "sigrok_int.h"
+#include "sigrok_cmd.h"
+
+
+sr_device_t sr_dev;
+
+static char     host_rx[1024];                       // responses received by the host
+static uint32_t host_rx_len;
+static uint32_t notify_cnt;
+static uint32_t cpu_freq_khz = 125000;
+
+
+
+uint32_t probe_get_cpu_freq_khz(void)
+{
+    return cpu_freq_khz;
+}   // probe_get_cpu_freq_khz
+
+
+
+void sigrok_notify(void)
+/**
+ * Stubbed transport: send the pending response to the host.
+ */
+{
+    ++notify_cnt;
+    if (sr_dev.send_resp) {
+        uint32_t len = strnlen(sr_dev.rspstr, sizeof(sr_dev.rspstr));
+
+        CHECK(host_rx_len + len < sizeof(host_rx));
+        if (host_rx_len + len < sizeof(host_rx)) {
+            memcpy(host_rx + host_rx_len, sr_dev.rspstr, len);
+            host_rx_len += len;
+            host_rx[host_rx_len] = '\0';
+        }
+        sr_dev.send_resp = false;
+    }
+}   // sigrok_notify
+
+
+
+static void host_send(const char *s)
+{
+    sigrok_cmd_rx(&sr_dev, (const uint8_t *)s, strlen(s));
+}   // host_send
+
+
+
+static bool host_cmd(const char *s, const char *expected)
+/**
+ * Send \a s and compare the collected responses with \a expected, "" -> no response.
+ */
+{
+    host_rx_len = 0;
+    host_rx[0] = '\0';
+    host_send(s);
+    if (strcmp(host_rx, expected) != 0) {
+        fprintf(stderr, "command '%s': response '%s', expected '%s'\n", s, host_rx, expected);
+        ++test_failures;
+        return false;
+    }
+    return true;
+}   // host_cmd
+
+
+
+static void test_identify(void)
+{
+    sigrok_full_reset(&sr_dev);
+    host_cmd("*", "");
+    host_cmd("i\n", "SRPICO,A031D21,02");
+    host_cmd("i\r", "SRPICO,A031D21,02");
+    host_cmd("a0\n", "25700x0");
+    host_cmd("N?\n", "ok");
+    host_cmd("NA02\n", "ADC2");
+    host_cmd("NA03\n", "");
+    host_cmd("ND00\n", "GP2");
+    host_cmd("ND20\n", "GP22");
+    host_cmd("ND21\n", "");
+    host_cmd("NX00\n", "");
+    host_cmd("x\n", "");
+    CHECK_EQ(notify_cnt != 0, 1);
+}   // test_identify
+
+
+
+static void test_rate_and_limit(void)
+{
+    sigrok_full_reset(&sr_dev);
+    host_cmd("R1000000\n", "*");
+    CHECK_EQ(sr_dev.sample_rate, 1000000);
+    host_cmd("R4999\n", "");
+    CHECK_EQ(sr_dev.sample_rate, 1000000);
+    host_cmd("R125000016\n", "*");
+    CHECK_EQ(sr_dev.sample_rate, 125000016);
+    host_cmd("R125000017\n", "");
+    cpu_freq_khz = 200000;
+    host_cmd("R200000000\n", "*");
+    CHECK_EQ(sr_dev.sample_rate, 200000000);
+    cpu_freq_khz = 125000;
+
+    host_cmd("L5000\n", "*");
+    CHECK_EQ(sr_dev.num_samples, 5000);
+    host_cmd("L0\n", "");
+    host_cmd("L-1\n", "");
+    CHECK_EQ(sr_dev.num_samples, 5000);
+}   // test_rate_and_limit
+
+
+
+static void test_channels(void)
+{
+    sigrok_full_reset(&sr_dev);
+    host_cmd("A100\nA102\n", "**");
+    CHECK_EQ(sr_dev.a_mask, 0x5);
+    host_cmd("A000\n", "*");
+    CHECK_EQ(sr_dev.a_mask, 0x4);
+    host_cmd("A200\n", "");
+    CHECK_EQ(sr_dev.a_mask, 0x4);
+
+    host_cmd("D100\nD101\nD103\n", "***");
+    CHECK_EQ(sr_dev.d_mask, 0xb);
+    CHECK_EQ(sr_dev.d_mask_D4, 0xbbbbbbbb);
+    host_cmd("D120\n", "*");
+    CHECK_EQ(sr_dev.d_mask, 0x10000b);
+    CHECK_EQ(sr_dev.d_mask_D4, 0xbbbbbbbb);
+    host_cmd("D121\n", "");
+    host_cmd("D003\n", "*");
+    CHECK_EQ(sr_dev.d_mask, 0x100003);
+    CHECK_EQ(sr_dev.d_mask_D4, 0x33333333);
+}   // test_channels
+
+
+
+static void test_trigger(void)
+{
+    sigrok_full_reset(&sr_dev);
+    host_cmd("tr03\n", "*");
+    host_cmd("t005\n", "*");
+    host_cmd("T\n", "*");
+    host_cmd("tf03\n", "*");
+    host_cmd("t103\n", "*");                         // replaces the falling edge of the stage
+    host_cmd("te20\n", "*");
+    host_cmd("te21\n", "");
+    host_cmd("tx01\n", "");
+    host_cmd("t1\n", "");
+    CHECK_EQ(sr_dev.trigger.stage_cnt, 2);
+    CHECK_EQ(sr_dev.trigger.stage[0].rise, 0x8);
+    CHECK_EQ(sr_dev.trigger.stage[0].level_mask, 0x20);
+    CHECK_EQ(sr_dev.trigger.stage[0].level_val, 0x0);
+    CHECK_EQ(sr_dev.trigger.stage[1].fall, 0x0);
+    CHECK_EQ(sr_dev.trigger.stage[1].level_mask, 0x8);
+    CHECK_EQ(sr_dev.trigger.stage[1].level_val, 0x8);
+    CHECK_EQ(sr_dev.trigger.stage[1].edge, 0x100000);
+    CHECK(sr_trigger_is_active(&sr_dev.trigger));
+
+    host_cmd("T\nT\n", "*");                         // an empty stage can't be followed by another one
+    host_cmd("p1000\n", "*");
+    CHECK_EQ(sr_dev.pretrig_samples, 1000);
+    host_cmd("p-1\n", "");
+    CHECK_EQ(sr_dev.pretrig_samples, 1000);
+
+    // reset drops the trigger, but keeps the channel configuration
+    sr_dev.d_mask = 0xff;
+    host_cmd("*", "");
+    CHECK_EQ(sr_dev.trigger.stage_cnt, 0);
+    CHECK( !sr_trigger_is_active(&sr_dev.trigger));
+    CHECK_EQ(sr_dev.pretrig_samples, 0);
+    CHECK_EQ(sr_dev.d_mask, 0xff);
+}   // test_trigger
+
+
+
+static void test_decoder(void)
+{
+    sigrok_full_reset(&sr_dev);
+#if OPT_EVENT_STREAM
+    host_cmd("Pu03,115200\n", "*");
+    CHECK_EQ(sr_dev.decoder.type, SR_DECODE_UART);
+    CHECK_EQ(sr_dev.decoder.ch[0], 3);
+    CHECK_EQ(sr_dev.decoder.baudrate, 115200);
+    host_cmd("Ps0,1,2,3,1\n", "*");
+    CHECK_EQ(sr_dev.decoder.type, SR_DECODE_SPI);
+    CHECK_EQ(sr_dev.decoder.spi_mode, 1);
+    host_cmd("Ps0,1,2,3,4\n", "");
+    CHECK_EQ(sr_dev.decoder.type, SR_DECODE_SPI);
+    host_cmd("Pi21,0\n", "");
+    host_cmd("Pi4,5\n", "*");
+    CHECK_EQ(sr_dev.decoder.type, SR_DECODE_I2C);
+    host_cmd("P0\n", "*");
+    CHECK_EQ(sr_dev.decoder.type, SR_DECODE_NONE);
+    host_cmd("Pu03,115200\n*", "*");
+    CHECK_EQ(sr_dev.decoder.type, SR_DECODE_NONE);
+#else
+    host_cmd("Pu03,115200\n", "");
+#endif
+}   // test_decoder
+
+
+
+static void test_acquisition(void)
+/**
+ * Start / abort like during a capture: the mode commands have no response, '+' stops a continuous capture.
+ */
+{
+    sigrok_full_reset(&sr_dev);
+    host_cmd("D100\nD101\nA100\nR100000\nL1000\n", "*****");
+
+    host_cmd("C\n", "");
+    CHECK(sr_dev.continuous);
+    CHECK( !sr_dev.buffered);
+    CHECK(sr_dev.sample_and_send);
+    CHECK_EQ(sr_dev.d_chan_cnt, 2);
+    CHECK_EQ(sr_dev.a_chan_cnt, 1);
+    CHECK_EQ(sr_dev.d_nps, 2);                       // D4 is not used together with analog channels
+    CHECK_EQ(sr_dev.d_tx_bps, 1);
+
+    sr_dev.aborted = true;
+    host_cmd("+", "");
+    CHECK( !sr_dev.sample_and_send);
+    CHECK( !sr_dev.aborted);
+
+    host_cmd("*B\n", "");
+    CHECK( !sr_dev.continuous);
+    CHECK(sr_dev.buffered);
+    CHECK(sr_dev.sample_and_send);
+
+    host_cmd("*F\n", "");
+    CHECK( !sr_dev.continuous);
+    CHECK( !sr_dev.buffered);
+    CHECK(sr_dev.sample_and_send);
+    host_cmd("*", "");
+    CHECK( !sr_dev.sample_and_send);
+}   // test_acquisition
+
+
+
+static void test_framing(void)
+/**
+ * Commands split over several transfers, several commands per transfer and a command overflow.
+ */
+{
+    char buf[64];
+
+    sigrok_full_reset(&sr_dev);
+
+    host_rx_len = 0;
+    host_send("R20");
+    host_send("000");
+    host_send("0\r");
+    CHECK_EQ(sr_dev.sample_rate, 200000);
+    CHECK_EQ(host_rx_len, 1);
+
+    for (const char *p = "L77\ni\n";  *p != '\0';  ++p) {
+        host_rx_len = 0;
+        host_send((char[]){*p, '\0'});
+    }
+    CHECK_EQ(sr_dev.num_samples, 77);
+    CHECK(strcmp(host_rx, "SRPICO,A031D21,02") == 0);
+
+    // an overlong command is dropped, the parser continues with the following characters
+    memset(buf, 'L', sizeof(buf));
+    buf[40] = '\0';
+    host_send(buf);
+    CHECK(sr_dev.cmdstr_ndx < sizeof(sr_dev.cmdstr));
+    memset(buf, '9', sizeof(buf));
+    buf[sizeof(buf) - 1] = '\0';
+    host_send(buf);
+    CHECK(sr_dev.cmdstr_ndx < sizeof(sr_dev.cmdstr));
+    host_cmd("\n", "");
+    CHECK_EQ(sr_dev.num_samples, 77);
+    host_cmd("i\n", "SRPICO,A031D21,02");
+
+    // random garbage must neither overflow nor leave the parser in a bad state
+    for (int n = 0;  n < 100000;  ++n) {
+        uint8_t ch = (uint8_t)test_rand();
+
+        host_rx_len = 0;
+        sigrok_cmd_rx(&sr_dev, &ch, 1);
+        CHECK(sr_dev.cmdstr_ndx < sizeof(sr_dev.cmdstr));
+        CHECK(strnlen(sr_dev.rspstr, sizeof(sr_dev.rspstr)) < sizeof(sr_dev.rspstr));
+    }
+    host_cmd("\n*", "");
+    host_cmd("L123\n", "*");
+    CHECK_EQ(sr_dev.num_samples, 123);
+}   // test_framing
+
+
+
+int main(void)
+{
+    test_identify();
+    test_rate_and_limit();
+    test_channels();
+    test_trigger();
+    test_decoder();
+    test_acquisition();
+    test_framing();
+    return test_result("test_sigrok_cmd");
+}   // main
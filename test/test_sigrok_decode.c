@@ -0,0 +1,602 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the on-probe protocol decoders: generated UART, SPI and I2C waveforms are stored like the
+ * capture DMA does it (all sample sizes, random data on the channels not used by the decoder) and fed
+ * segment by segment into sr_decode_samples().  Emitted frames are compared with the expected ones
+ * including sample index and flags.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+#include "sigrok_decode.h"
+
+
+#define WAVE_MAX        (1 << 20)
+#define FRAMES_MAX      512
+#define NUM_CHAN        21                           // SR_NUM_D_CHAN
+
+typedef struct {
+    uint64_t ndx;
+    uint8_t  type;
+    uint8_t  flags;
+    uint32_t len;
+    uint8_t  data[SR_DECODE_FRAME_MAX];
+} frame_t;
+
+static uint32_t wave[WAVE_MAX];                      // generated samples
+static uint32_t wave_len;
+static uint32_t capture[WAVE_MAX];                   // capture buffer, word aligned
+
+static frame_t  frames[FRAMES_MAX];                  // emitted by the decoder
+static uint32_t frame_cnt;
+static frame_t  expected[FRAMES_MAX];
+static uint32_t expected_cnt;
+static bool     expected_open;                       // expected[expected_cnt - 1] takes further data
+static uint8_t  expected_type;
+
+
+
+static void emit(void *ctx, uint64_t ndx, const uint8_t *frame, uint32_t len)
+{
+    CHECK(len >= 2  &&  len <= 2 + SR_DECODE_FRAME_MAX);
+    if (frame_cnt != 0  &&  frame_cnt <= FRAMES_MAX) {
+        CHECK(ndx >= frames[frame_cnt - 1].ndx);
+    }
+    if (frame_cnt < FRAMES_MAX  &&  len >= 2  &&  len <= 2 + SR_DECODE_FRAME_MAX) {
+        frame_t *f = frames + frame_cnt;
+
+        f->ndx   = ndx;
+        f->type  = frame[0];
+        f->flags = frame[1];
+        f->len   = len - 2;
+        memcpy(f->data, frame + 2, len - 2);
+    }
+    ++frame_cnt;
+}   // emit
+
+
+
+static void wave_put(uint32_t val, uint32_t n)
+{
+    CHECK(wave_len + n <= WAVE_MAX);
+    while (n-- != 0  &&  wave_len < WAVE_MAX) {
+        wave[wave_len++] = val;
+    }
+}   // wave_put
+
+
+
+static void exp_reset(uint8_t type)
+{
+    expected_cnt  = 0;
+    expected_open = false;
+    expected_type = type;
+}   // exp_reset
+
+
+
+/// start an expected frame at sample \a ndx (CS assert, START)
+static void exp_start(uint64_t ndx)
+{
+    frame_t *f = expected + expected_cnt++;
+
+    memset(f, 0, sizeof(*f));
+    f->ndx  = ndx;
+    f->type = expected_type;
+    expected_open = true;
+}   // exp_start
+
+
+
+/// append \a n bytes of a character/word completed at sample \a ndx, a full frame is split
+static void exp_put(uint64_t ndx, uint8_t b0, uint8_t b1, uint32_t n)
+{
+    frame_t *f = expected + expected_cnt - 1;
+
+    if ( !expected_open  ||  f->len + n > SR_DECODE_FRAME_MAX) {
+        exp_start(ndx);
+        f = expected + expected_cnt - 1;
+    }
+    f->data[f->len++] = b0;
+    if (n > 1) {
+        f->data[f->len++] = b1;
+    }
+}   // exp_put
+
+
+
+static void exp_end(uint8_t flags)
+{
+    if (expected_cnt != 0) {
+        expected[expected_cnt - 1].flags |= flags;
+    }
+    expected_open = false;
+}   // exp_end
+
+
+
+static uint32_t pick_bps(uint32_t chans)
+{
+    static const uint32_t bps[] = { 0, 1, 2, 4 };
+
+    return (chans <= 4) ? bps[test_rand() % 4] : bps[1 + test_rand() % 3];
+}   // pick_bps
+
+
+
+/// random channel for a sample size of \a bps, not in \a used
+static int pick_ch(uint32_t bps, uint32_t *used)
+{
+    uint32_t n = (bps == 0) ? 4 : (8 * bps < NUM_CHAN) ? 8 * bps : NUM_CHAN;
+    uint32_t ch;
+
+    do {
+        ch = test_rand() % n;
+    } while (*used & (1u << ch));
+    *used |= 1u << ch;
+    return (int)ch;
+}   // pick_ch
+
+
+
+static void run(sr_decoder_t *dec, uint32_t bps, uint32_t sample_rate, bool noise)
+/**
+ * Store the waveform like the DMA does it and decode it in segments of random size.
+ */
+{
+    const uint32_t mask = sr_decode_mask(dec);
+    const uint32_t bps_mask = (bps == 0) ? 0x0f : (bps == 4) ? 0xffffffff : (1u << (8 * bps)) - 1;
+    uint8_t *buf = (uint8_t *)capture;
+    uint32_t pos;
+
+    memset(capture, 0, sizeof(capture));
+    for (uint32_t i = 0;  i < wave_len;  ++i) {
+        uint32_t val = wave[i] | (noise ? test_rand() & ~mask : 0);
+
+        CHECK((wave[i] & ~mask) == 0);
+        val &= bps_mask;
+        switch (bps) {
+            case 0:
+                buf[i / 2] |= val << (4 * (i & 1));
+                break;
+            case 1:
+                buf[i] = val;
+                break;
+            case 2:
+                ((uint16_t *)buf)[i] = val;
+                break;
+            default:
+                capture[i] = val;
+                break;
+        }
+    }
+
+    frame_cnt = 0;
+    CHECK(sr_decode_start(dec, sample_rate, emit, NULL));
+    for (pos = 0;  pos < wave_len;  ) {
+        // segments are word aligned
+        uint32_t n = 8 * (1 + test_rand() % 256);
+
+        if (n > wave_len - pos) {
+            n = wave_len - pos;
+        }
+        sr_decode_samples(dec, buf + ((bps == 0) ? pos / 2 : pos * bps), bps, n);
+        pos += n;
+        CHECK(sr_decode_pending(dec) <= pos);
+    }
+    sr_decode_flush(dec);
+    CHECK_EQ(sr_decode_pending(dec), wave_len);
+}   // run
+
+
+
+static bool compare(const char *name, int run_no)
+{
+    uint32_t n;
+
+    if (frame_cnt != expected_cnt) {
+        fprintf(stderr, "%s run %d: %u frames, expected %u\n", name, run_no, frame_cnt, expected_cnt);
+        ++test_failures;
+        return false;
+    }
+    for (n = 0;  n < frame_cnt  &&  n < FRAMES_MAX;  ++n) {
+        const frame_t *f = frames + n;
+        const frame_t *e = expected + n;
+
+        if (f->ndx != e->ndx  ||  f->type != e->type  ||  f->flags != e->flags  ||  f->len != e->len
+            ||  memcmp(f->data, e->data, e->len) != 0) {
+            fprintf(stderr, "%s run %d, frame %u: ndx %llu type %u flags 0x%x len %u, "
+                    "expected ndx %llu type %u flags 0x%x len %u%s\n",
+                    name, run_no, n, (unsigned long long)f->ndx, f->type, f->flags, f->len,
+                    (unsigned long long)e->ndx, e->type, e->flags, e->len,
+                    (f->len == e->len  &&  memcmp(f->data, e->data, e->len) != 0) ? ", data differs" : "");
+            ++test_failures;
+            return false;
+        }
+    }
+    return true;
+}   // compare
+
+
+
+static void test_config(void)
+{
+    sr_decoder_t dec;
+
+    sr_decode_clear(&dec);
+    CHECK( !sr_decode_is_active(&dec));
+    CHECK( !sr_decode_start(&dec, 1000000, emit, NULL));
+
+    CHECK(sr_decode_config(&dec, "u3,115200", NUM_CHAN));
+    CHECK_EQ(dec.type, SR_DECODE_UART);
+    CHECK_EQ(sr_decode_mask(&dec), 0x8);
+    CHECK(sr_decode_start(&dec, 460800, emit, NULL));
+    CHECK( !sr_decode_start(&dec, 460799, emit, NULL));        // less than 4 samples per bit
+
+    CHECK(sr_decode_config(&dec, "s0,1,-1,20,3", NUM_CHAN));
+    CHECK_EQ(dec.type, SR_DECODE_SPI);
+    CHECK_EQ(sr_decode_mask(&dec), 0x100003);
+    CHECK_EQ(dec.spi_mode, 3);
+    CHECK(sr_decode_config(&dec, "s0,-1,2,-1,0", NUM_CHAN));
+    CHECK_EQ(sr_decode_mask(&dec), 0x5);
+
+    CHECK(sr_decode_config(&dec, "i4,5", NUM_CHAN));
+    CHECK_EQ(dec.type, SR_DECODE_I2C);
+    CHECK_EQ(sr_decode_mask(&dec), 0x30);
+
+    // invalid configurations leave the decoder unchanged
+    CHECK( !sr_decode_config(&dec, "u21,9600", NUM_CHAN));
+    CHECK( !sr_decode_config(&dec, "u1,0", NUM_CHAN));
+    CHECK( !sr_decode_config(&dec, "u1", NUM_CHAN));
+    CHECK( !sr_decode_config(&dec, "u-1,9600", NUM_CHAN));
+    CHECK( !sr_decode_config(&dec, "s0,-1,-1,3,0", NUM_CHAN));  // neither MOSI nor MISO
+    CHECK( !sr_decode_config(&dec, "s0,1,2,3,4", NUM_CHAN));
+    CHECK( !sr_decode_config(&dec, "s0,1,2,3", NUM_CHAN));
+    CHECK( !sr_decode_config(&dec, "i0", NUM_CHAN));
+    CHECK( !sr_decode_config(&dec, "i0,x", NUM_CHAN));
+    CHECK( !sr_decode_config(&dec, "x0,1", NUM_CHAN));
+    CHECK_EQ(dec.type, SR_DECODE_I2C);
+    CHECK_EQ(sr_decode_mask(&dec), 0x30);
+
+    CHECK(sr_decode_config(&dec, "0", NUM_CHAN));
+    CHECK( !sr_decode_is_active(&dec));
+    CHECK(sr_decode_config(&dec, "i4,5", NUM_CHAN));
+    CHECK(sr_decode_config(&dec, "", NUM_CHAN));
+    CHECK( !sr_decode_is_active(&dec));
+}   // test_config
+
+
+
+static void uart_char(int ch, double spb, double *t, uint8_t data, uint32_t stop)
+/**
+ * UART character 8N1 starting at sample \a *t with \a spb samples per bit.
+ */
+{
+    for (uint32_t k = 0;  k < 10;  ++k) {
+        uint32_t level = (k == 0) ? 0 : (k <= 8) ? (data >> (k - 1)) & 1 : stop;
+
+        *t += spb;
+        wave_put((uint32_t)level << ch, (uint32_t)*t - wave_len);
+    }
+}   // uart_char
+
+
+
+static void uart_idle(int ch, double spb, double *t, double bits)
+{
+    *t += bits * spb;
+    wave_put(1u << ch, (uint32_t)*t - wave_len);
+}   // uart_idle
+
+
+
+static void test_uart(void)
+/**
+ * Random characters with random baudrates (4.5..45 samples per bit, +-2% mismatch) and gaps.
+ * An idle time of more than two characters ends a frame.
+ */
+{
+    for (int run_no = 0;  run_no < 300;  ++run_no) {
+        const uint32_t rate = 10000000;
+        uint32_t bps = pick_bps(1);
+        uint32_t used = 0;
+        int ch = pick_ch(bps, &used);
+        uint32_t baud = (uint32_t)(rate / (4.5 + (test_rand() % 400) / 10.0));
+        double spb = (double)rate / baud * (1.0 + ((int)(test_rand() % 81) - 40) / 2000.0);
+        uint32_t chars = 1 + test_rand() % 200;
+        sr_decoder_t dec;
+        char cfg[32];
+        double t;
+
+        sr_decode_clear(&dec);
+        snprintf(cfg, sizeof(cfg), "u%d,%u", ch, baud);
+        CHECK(sr_decode_config(&dec, cfg, NUM_CHAN));
+
+        exp_reset(SR_DECODE_UART);
+        wave_len = 0;
+        wave_put(1u << ch, 20 + test_rand() % 100);
+        t = wave_len;
+        for (uint32_t k = 0;  k < chars;  ++k) {
+            uint32_t r = test_rand() % 4;
+            uint8_t data = (uint8_t)test_rand();
+
+            if (k != 0  &&  r == 1) {
+                uart_idle(ch, spb, &t, (test_rand() % 180) / 10.0);
+            }
+            else if (k != 0  &&  r == 2) {
+                uart_idle(ch, spb, &t, 30 + test_rand() % 20);
+                exp_end(0);
+            }
+            exp_put(wave_len, data, 0, 1);
+            uart_char(ch, spb, &t, data, 1);
+        }
+        uart_idle(ch, spb, &t, 30);
+        wave_put(1u << ch, 64);
+        exp_end(0);
+
+        run(&dec, bps, rate, (run_no & 1) != 0);
+        if ( !compare("uart", run_no)) {
+            fprintf(stderr, "  channel %d, bps %u, baudrate %u, %.2f samples per bit\n", ch, bps, baud, spb);
+            return;
+        }
+    }
+}   // test_uart
+
+
+
+static void test_uart_errors(void)
+{
+    sr_decoder_t dec;
+    uint64_t start;
+    double t;
+
+    sr_decode_clear(&dec);
+    CHECK(sr_decode_config(&dec, "u2,100000", NUM_CHAN));
+    exp_reset(SR_DECODE_UART);
+    wave_len = 0;
+    wave_put(0x4, 50);
+    t = wave_len;
+
+    // framing error: stop bit low, the whole frame is flagged
+    exp_put(wave_len, 0x41, 0, 1);
+    uart_char(2, 10, &t, 0x41, 1);
+    exp_put(wave_len, 0x42, 0, 1);
+    uart_char(2, 10, &t, 0x42, 0);
+    uart_idle(2, 10, &t, 1);
+    exp_put(wave_len, 0x43, 0, 1);
+    uart_char(2, 10, &t, 0x43, 1);
+    uart_idle(2, 10, &t, 40);
+    exp_end(SR_DECODE_FLAG_ERROR);
+
+    // a glitch shorter than half a bit is no start bit
+    wave_put(0x0, 4);
+    t = wave_len;
+    uart_idle(2, 10, &t, 40);
+
+    exp_put(wave_len, 0x44, 0, 1);
+    uart_char(2, 10, &t, 0x44, 1);
+    uart_idle(2, 10, &t, 40);
+    exp_end(0);
+    run(&dec, 1, 1000000, false);
+    compare("uart errors", 0);
+
+    // a character in progress is pending, an incomplete one is dropped at the end
+    sr_decode_clear(&dec);
+    CHECK(sr_decode_config(&dec, "u0,100000", NUM_CHAN));
+    wave_len = 0;
+    wave_put(0x1, 32);
+    start = wave_len;
+    t = wave_len;
+    uart_char(0, 10, &t, 0x55, 1);
+    wave_len = start + 48;
+    memset(capture, 0, sizeof(capture));
+    for (uint32_t i = 0;  i < wave_len;  ++i) {
+        ((uint8_t *)capture)[i] = wave[i];
+    }
+    frame_cnt = 0;
+    CHECK(sr_decode_start(&dec, 1000000, emit, NULL));
+    sr_decode_samples(&dec, (uint8_t *)capture, 1, 32);
+    CHECK_EQ(sr_decode_pending(&dec), 32);
+    sr_decode_samples(&dec, (uint8_t *)capture + 32, 1, wave_len - 32);
+    CHECK_EQ(sr_decode_pending(&dec), start);
+    sr_decode_flush(&dec);
+    CHECK_EQ(frame_cnt, 0);
+}   // test_uart_errors
+
+
+
+static void test_spi(void)
+/**
+ * Random transfers in all SPI modes.  Frames are delimited by CS, an incomplete byte at CS deassert
+ * flags the frame.  Without CS a frame ends only if it is full.
+ */
+{
+    for (int run_no = 0;  run_no < 300;  ++run_no) {
+        uint32_t bps = pick_bps(4);
+        uint32_t used = 0;
+        int clk = pick_ch(bps, &used);
+        int mosi = pick_ch(bps, &used);
+        int miso = pick_ch(bps, &used);
+        int cs = pick_ch(bps, &used);
+        uint32_t mode = test_rand() % 4;
+        uint32_t cpol = mode >> 1;
+        uint32_t cpha = mode & 1;
+        uint32_t hp = 1 + test_rand() % 6;
+        uint32_t transfers = 1 + test_rand() % 8;
+        uint32_t idle;
+        sr_decoder_t dec;
+        char cfg[40];
+
+        switch (test_rand() % 6) {
+            case 0:
+                mosi = -1;
+                break;
+            case 1:
+                miso = -1;
+                break;
+            case 2:
+                cs = -1;
+                break;
+        }
+        sr_decode_clear(&dec);
+        snprintf(cfg, sizeof(cfg), "s%d,%d,%d,%d,%u", clk, mosi, miso, cs, mode);
+        CHECK(sr_decode_config(&dec, cfg, NUM_CHAN));
+
+        idle = (cpol << clk) | ((cs >= 0) ? 1u << cs : 0);
+        exp_reset(SR_DECODE_SPI);
+        wave_len = 0;
+        wave_put(idle, 10 + test_rand() % 20);
+        for (uint32_t tr = 0;  tr < transfers;  ++tr) {
+            uint32_t bytes = 1 + test_rand() % 40;
+            uint32_t extra_bits = (cs >= 0  &&  test_rand() % 4 == 0) ? 1 + test_rand() % 7 : 0;
+
+            if (cs >= 0) {
+                exp_start(wave_len);
+            }
+            wave_put(cpol << clk, hp);
+            for (uint32_t k = 0;  k <= bytes;  ++k) {
+                uint8_t mo = (uint8_t)test_rand();
+                uint8_t mi = (uint8_t)test_rand();
+                uint32_t bits = (k < bytes) ? 8 : extra_bits;
+
+                for (uint32_t j = 0;  j < bits;  ++j) {
+                    uint32_t b = 7 - j;
+                    uint32_t dv = ((mosi >= 0) ? ((mo >> b) & 1u) << mosi : 0) | ((miso >= 0) ? ((mi >> b) & 1u) << miso : 0);
+
+                    // the second half bit starts with the sampling edge
+                    wave_put(dv | ((cpha ? !cpol : cpol) << clk), hp);
+                    if (k < bytes  &&  j == 7) {
+                        exp_put(wave_len, (mosi >= 0) ? mo : 0, (miso >= 0) ? mi : 0, 2);
+                    }
+                    wave_put(dv | ((cpha ? cpol : !cpol) << clk), hp);
+                }
+            }
+            wave_put(cpol << clk, hp);
+            if (cs >= 0) {
+                exp_end(extra_bits ? SR_DECODE_FLAG_ERROR : 0);
+            }
+            wave_put(idle, 2 + test_rand() % 30);
+        }
+        exp_end(0);
+
+        run(&dec, bps, 1000000, (run_no & 1) != 0);
+        if ( !compare("spi", run_no)) {
+            fprintf(stderr, "  %s, bps %u, %u samples per half clock\n", cfg, bps, hp);
+            return;
+        }
+    }
+}   // test_spi
+
+
+
+static void test_i2c(void)
+/**
+ * Random transactions with ACK/NAK, repeated STARTs and truncated bytes.
+ */
+{
+    for (int run_no = 0;  run_no < 300;  ++run_no) {
+        uint32_t bps = pick_bps(2);
+        uint32_t used = 0;
+        int scl = pick_ch(bps, &used);
+        int sda = pick_ch(bps, &used);
+        uint32_t q = 1 + test_rand() % 5;
+        uint32_t transactions = 1 + test_rand() % 8;
+        sr_decoder_t dec;
+        char cfg[20];
+
+#define I2C(c, d)   wave_put(((uint32_t)(c) << scl) | ((uint32_t)(d) << sda), q)
+
+        sr_decode_clear(&dec);
+        snprintf(cfg, sizeof(cfg), "i%d,%d", scl, sda);
+        CHECK(sr_decode_config(&dec, cfg, NUM_CHAN));
+
+        exp_reset(SR_DECODE_I2C);
+        wave_len = 0;
+        wave_put((1u << scl) | (1u << sda), 10 + test_rand() % 20);
+        for (uint32_t tr = 0;  tr < transactions;  ++tr) {
+            uint32_t bytes = 1 + test_rand() % 40;
+            uint32_t extra_bits = (test_rand() % 5 == 0) ? 1 + test_rand() % 7 : 0;
+
+            // START: SDA falls while SCL is high
+            I2C(1, 1);
+            exp_start(wave_len);
+            I2C(1, 0);
+            for (uint32_t k = 0;  k <= bytes;  ++k) {
+                uint8_t val = (uint8_t)test_rand();
+                uint32_t ack = test_rand() & 1;
+                uint32_t bits = (k < bytes) ? 9 : extra_bits;
+
+                for (uint32_t j = 0;  j < bits;  ++j) {
+                    uint32_t b = (j < 8) ? (val >> (7 - j)) & 1 : ack;
+
+                    I2C(0, b);
+                    if (k < bytes  &&  j == 8) {
+                        exp_put(wave_len, val, ack, 2);
+                    }
+                    I2C(1, b);
+                    I2C(1, b);
+                    I2C(0, b);
+                }
+            }
+            if (tr + 1 < transactions  &&  test_rand() % 3 == 0) {
+                // repeated START follows, the SCL rise in front of it counts as data bit
+                exp_end(SR_DECODE_FLAG_RESTART | (extra_bits ? SR_DECODE_FLAG_ERROR : 0));
+                I2C(0, 1);
+                I2C(1, 1);
+                continue;
+            }
+            // STOP: SDA rises while SCL is high
+            I2C(0, 0);
+            I2C(1, 0);
+            exp_end(extra_bits ? SR_DECODE_FLAG_ERROR : 0);
+            I2C(1, 1);
+            wave_put((1u << scl) | (1u << sda), test_rand() % 20);
+        }
+#undef I2C
+
+        run(&dec, bps, 1000000, (run_no & 1) != 0);
+        if ( !compare("i2c", run_no)) {
+            fprintf(stderr, "  %s, bps %u, %u samples per quarter clock\n", cfg, bps, q);
+            return;
+        }
+    }
+}   // test_i2c
+
+
+
+int main(void)
+{
+    test_config();
+    test_uart();
+    test_uart_errors();
+    test_spi();
+    test_i2c();
+    return test_result("test_sigrok_decode");
+}   // main
@@ -0,0 +1,179 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Round trip tests of the sigrok slice encoders: generated captures are encoded segment by segment
+ * and decoded again with the reference decoder of the wire format.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "test_sigrok.h"
+
+
+#define SAMPLES_MAX     20000
+
+static uint8_t           capture[4 * SAMPLES_MAX + 8] __attribute__((aligned(4)));
+static uint8_t           acapture[3 * SAMPLES_MAX];
+static uint32_t          ref[SAMPLES_MAX];
+static uint32_t          decoded[SAMPLES_MAX + 100];
+static uint8_t           adecoded[3 * SAMPLES_MAX];
+static sr_test_decoder_t dec;
+static uint32_t          tx_bytes;
+
+
+
+void sigrok_tx_write(const uint8_t *buf, uint32_t cnt)
+{
+    // a chunk bigger than the transmit buffer means it has overflowed
+    CHECK(cnt <= TX_BUF_SIZE);
+    tx_bytes += cnt;
+    sr_test_decode(&dec, buf, cnt, decoded, SAMPLES_MAX + 100, adecoded);
+}   // sigrok_tx_write
+
+
+
+static void encode_and_check(uint32_t samples, uint32_t seg_size, uint32_t first, const char *name)
+/**
+ * Encode \a samples starting at \a first (e.g. the trigger point) in segments of \a seg_size samples.
+ */
+{
+    uint32_t pos = first;
+
+    memset(&dec, 0, sizeof(dec));
+    tx_bytes = 0;
+    sr_dev.scnt = 0;
+
+    while (pos < samples) {
+        uint32_t n = MIN(seg_size - pos % seg_size, samples - pos);
+        uint8_t *dbuf = capture + ((d_dma_bps == 0) ? pos / 2 : pos * d_dma_bps);
+
+        sigrok_encode_slices(&sr_dev, dbuf, acapture + pos * sr_dev.a_chan_cnt, n);
+        pos += n;
+    }
+
+    if (dec.error  ||  dec.cnt != samples - first  ||  memcmp(decoded, ref + first, 4 * (samples - first)) != 0) {
+        fprintf(stderr, "%s: %u samples from %u, segment %u: decoded %u%s\n", name, samples, first, seg_size,
+                dec.cnt, dec.error ? ", error" : "");
+    }
+    CHECK( !dec.error);
+    CHECK_EQ(dec.cnt, samples - first);
+    CHECK(memcmp(decoded, ref + first, 4 * (samples - first)) == 0);
+    CHECK_EQ(sent_cnt, tx_bytes);
+    sent_cnt = 0;
+}   // encode_and_check
+
+
+
+static void test_digital(uint32_t d_mask, const char *name)
+{
+    static const uint32_t activity[] = { 0, 30, 300, 3000, 30000, 65536 };
+
+    for (uint32_t a = 0;  a < sizeof(activity) / sizeof(activity[0]);  ++a) {
+        sr_test_setup(d_mask, 0);
+        sr_test_capture(capture, ref, SAMPLES_MAX, activity[a]);
+
+        encode_and_check(SAMPLES_MAX, 4096, 0, name);
+        encode_and_check(SAMPLES_MAX, SAMPLES_MAX, 0, name);
+        encode_and_check(5000, 1000, 0, name);
+        if (d_dma_bps != 0) {
+            // start after a trigger: not word aligned, D4 starts only on multiples of 8
+            for (uint32_t first = 1;  first < 8;  ++first) {
+                encode_and_check(3000, 1024, first, name);
+            }
+            // very short segments
+            encode_and_check(100, 1, 0, name);
+            encode_and_check(100, 3, 0, name);
+        }
+        else {
+            // D4 transmits whole words of 8 samples, segments are multiples of it
+            encode_and_check(3000, 1024, 8, name);
+            encode_and_check(96, 8, 0, name);
+            encode_and_check(96, 24, 0, name);
+        }
+    }
+}   // test_digital
+
+
+
+static void test_fixed(void)
+/**
+ * Fixed capture: only the requested number of samples is encoded, the rest of the segment is dropped.
+ */
+{
+    sr_test_setup(0xff, 0);
+    sr_test_capture(capture, ref, 4096, 3000);
+    sr_dev.continuous = false;
+    sr_dev.num_samples = 1000;
+
+    memset(&dec, 0, sizeof(dec));
+    sr_dev.scnt = 0;
+    sigrok_encode_slices(&sr_dev, capture, NULL, 4096);
+    CHECK_EQ(sr_dev.scnt, 1000);
+    CHECK_EQ(dec.cnt, 1000);
+    CHECK(memcmp(decoded, ref, 4 * 1000) == 0);
+}   // test_fixed
+
+
+
+static void test_analog(void)
+/**
+ * Analog channels are sent per slice without RLE, 7 bit per channel.
+ */
+{
+    sr_test_setup(0x3f, 0x5);
+
+    CHECK_EQ(sr_dev.a_chan_cnt, 2);
+    sr_test_capture(capture, ref, 2000, 3000);
+    for (uint32_t i = 0;  i < 2 * 2000;  ++i) {
+        acapture[i] = (uint8_t)test_rand();
+    }
+    encode_and_check(2000, 512, 0, "analog");
+    for (uint32_t i = 0;  i < 2 * 2000;  ++i) {
+        if (adecoded[i] != acapture[i] >> 1) {
+            CHECK_EQ(adecoded[i], acapture[i] >> 1);
+            break;
+        }
+    }
+}   // test_analog
+
+
+
+int main(void)
+{
+    test_digital(0x3, "D4 2ch");
+    test_digital(0xf, "D4 4ch");
+    test_digital(0x1f, "1B 5ch");
+    test_digital(0xff, "1B 8ch");
+    test_digital(0x1ff, "2B 9ch");
+    test_digital(0xffff, "2B 16ch");
+    test_digital(0x1ffff, "4B 17ch");
+    test_digital(0x1fffff, "4B 21ch");
+    test_fixed();
+    test_analog();
+    return test_result("test_sigrok_encode");
+}   // main
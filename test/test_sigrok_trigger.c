@@ -0,0 +1,326 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the sigrok trigger: sr_trigger_scan() on fixed sample streams with known trigger points
+ * and on random streams against a straightforward sample by sample reference, for all DMA sample sizes
+ * and with the streams split into segments like the capture does it.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "sigrok_trigger.h"
+
+
+#define SAMPLES_MAX     40000
+
+static uint32_t raw[SAMPLES_MAX];                    // capture buffer, word aligned
+static uint32_t ref[SAMPLES_MAX];                    // samples of the enabled channels
+
+
+
+static uint32_t bps_mask(uint32_t bps)
+{
+    return (bps == 0) ? 0x0f : (bps == 4) ? 0xffffffff : (1u << (8 * bps)) - 1;
+}   // bps_mask
+
+
+
+static void store(uint32_t bps, uint32_t ndx, uint32_t val)
+/**
+ * Store \a val as sample \a ndx in \a raw like the DMA does it.
+ */
+{
+    uint8_t *buf = (uint8_t *)raw;
+
+    switch (bps) {
+        case 0:
+            buf[ndx / 2] = (buf[ndx / 2] & (0xf0 >> (4 * (ndx & 1)))) | ((val & 0x0f) << (4 * (ndx & 1)));
+            break;
+        case 1:
+            buf[ndx] = val;
+            break;
+        case 2:
+            ((uint16_t *)buf)[ndx] = val;
+            break;
+        default:
+            raw[ndx] = val;
+            break;
+    }
+}   // store
+
+
+
+static void load(uint32_t bps, const uint32_t *samples, uint32_t cnt)
+{
+    memset(raw, 0, sizeof(raw));
+    for (uint32_t i = 0;  i < cnt;  ++i) {
+        store(bps, i, samples[i]);
+    }
+}   // load
+
+
+
+static int32_t ref_scan(const sr_trigger_t *t, const uint32_t *v, uint32_t samples)
+/**
+ * Reference: evaluate the stages on every sample, edges against the previous sample.
+ */
+{
+    uint32_t stage = 0;
+
+    for (uint32_t i = 0;  i < samples;  ++i) {
+        const sr_trigger_stage_t *st = &t->stage[stage];
+        uint32_t prev = (i == 0) ? v[0] : v[i - 1];
+        uint32_t val  = v[i];
+        bool match = true;
+
+        for (uint32_t ch = 0;  ch < 32;  ++ch) {
+            uint32_t bit = 1u << ch;
+            bool p = (prev & bit) != 0;
+            bool c = (val & bit) != 0;
+
+            if ((st->level_mask & bit)  &&  c != ((st->level_val & bit) != 0))
+                match = false;
+            if ((st->rise & bit)  &&  !( !p  &&  c))
+                match = false;
+            if ((st->fall & bit)  &&  !(p  &&  !c))
+                match = false;
+            if ((st->edge & bit)  &&  p == c)
+                match = false;
+        }
+        if (match  &&  ++stage >= t->stage_cnt) {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}   // ref_scan
+
+
+
+static int32_t scan_segments(sr_trigger_t *t, uint32_t bps, uint32_t mask, uint32_t samples, uint32_t seg)
+/**
+ * Scan \a samples in segments of \a seg samples (multiple of 8 to keep the segments word aligned).
+ * \return absolute sample index of the trigger point or -1
+ */
+{
+    sr_trigger_arm(t);
+    for (uint32_t pos = 0;  pos < samples;  pos += seg) {
+        uint32_t n = (seg < samples - pos) ? seg : samples - pos;
+        const uint8_t *buf = (const uint8_t *)raw + ((bps == 0) ? pos / 2 : pos * bps);
+        int32_t ndx = sr_trigger_scan(t, buf, bps, mask, n);
+
+        if (ndx >= 0) {
+            CHECK(ndx < (int32_t)n);
+            return (int32_t)pos + ndx;
+        }
+    }
+    return -1;
+}   // scan_segments
+
+
+
+static void check_fixed(uint32_t bps, const char *trg, const uint32_t *samples, uint32_t cnt, int32_t expected,
+                        const char *name)
+/**
+ * Set up the trigger from the host command string \a trg ("r0 12 T f0"...: condition + channel,
+ * 'T' starts the next stage) and scan \a samples with all segment sizes.
+ */
+{
+    sr_trigger_t t;
+    const char *p = trg;
+
+    sr_trigger_clear(&t);
+    while (*p != '\0') {
+        if (*p == ' ') {
+            ++p;
+        }
+        else if (*p == 'T') {
+            CHECK(sr_trigger_next_stage(&t));
+            ++p;
+        }
+        else {
+            CHECK(sr_trigger_add(&t, p[0], p[1] - '0'));
+            p += 2;
+        }
+    }
+
+    load(bps, samples, cnt);
+    for (uint32_t seg = 8;  seg <= 64;  seg += 8) {
+        int32_t ndx = scan_segments(&t, bps, bps_mask(bps), cnt, seg);
+
+        if (ndx != expected) {
+            fprintf(stderr, "%s, bps %u, segment %u: trigger at %d, expected %d\n", name, bps, seg, ndx, expected);
+            ++test_failures;
+            break;
+        }
+    }
+}   // check_fixed
+
+
+
+static void test_fixed(void)
+{
+    // a UART frame 0x55 on channel 0 with idle high, channel 1 toggles all the time
+    static const uint32_t uart[] = {
+        3, 1, 3, 1, 3, 1, 3, 1,   2, 0, 2, 0, 3, 1, 2, 0,   3, 1, 2, 0, 3, 1, 2, 0,
+        3, 1, 2, 0, 3, 1, 3, 1,   3, 1, 3, 1, 3, 1, 3, 1,
+    };
+    // SPI: chip select on channel 3 (low active), clock on channel 0, MOSI on channel 1
+    static const uint32_t spi[] = {
+        8, 8, 8, 8, 8, 8, 8, 8,   0, 0, 2, 3, 2, 3, 0, 1,   0, 1, 2, 3, 2, 3, 0, 1,   0, 0, 8, 8, 8, 8, 8, 8,
+        8, 8, 8, 8, 8, 8, 8, 8,   8, 8, 8, 8, 8, 8, 8, 8,
+    };
+    static const uint32_t steady[64] = {0};
+
+    for (uint32_t bps = 0;  bps <= 4;  bps = (bps == 0) ? 1 : 2 * bps) {
+        // start bit, noise on channel 1 must not matter
+        check_fixed(bps, "f0", uart, 40, 8, "uart start");
+        check_fixed(bps, "f0 11", uart, 40, 8, "uart start & ch1 high");
+        check_fixed(bps, "f0 01", uart, 40, -1, "uart start & ch1 low");
+        check_fixed(bps, "f0 T r0", uart, 40, 12, "uart first rising edge");
+        check_fixed(bps, "f0 T r0 T f0 T r0", uart, 40, 16, "uart stages");
+        check_fixed(bps, "e0 T e0 T e0 T", uart, 40, 14, "uart edges, trailing empty stage");
+        check_fixed(bps, "f0 T 00 T 10 T 10", uart, 40, 13, "uart stages on consecutive samples");
+        check_fixed(bps, "f0 T 10 T 12", uart, 40, -1, "uart stage never matching");
+        check_fixed(bps, "00 11", uart, 40, 8, "uart level only");
+        check_fixed(bps, "00 01", uart, 40, 9, "uart level only, both low");
+
+        // a level condition matches on the very first sample, an edge can't
+        check_fixed(bps, "13", spi, 48, 0, "spi idle level");
+        check_fixed(bps, "f3", spi, 48, 8, "spi cs assert");
+        check_fixed(bps, "03 r0 11", spi, 48, 11, "spi first clock with mosi");
+        check_fixed(bps, "03 r0 01", spi, 48, 15, "spi first clock without mosi");
+        check_fixed(bps, "f3 T r3", spi, 48, 26, "spi cs deassert");
+        check_fixed(bps, "r3", spi, 48, 26, "spi rising cs");
+        check_fixed(bps, "03 T 03 T 03", spi, 48, 10, "spi cs low on three samples");
+
+        check_fixed(bps, "00", steady, 64, 0, "steady low");
+        check_fixed(bps, "10", steady, 64, -1, "steady high");
+        check_fixed(bps, "e0", steady, 64, -1, "steady edge");
+    }
+
+    // no trigger defined: arm leaves no stage and the scan never fires
+    {
+        sr_trigger_t t;
+
+        sr_trigger_clear(&t);
+        CHECK( !sr_trigger_is_active(&t));
+        CHECK( !sr_trigger_next_stage(&t));
+        CHECK( !sr_trigger_add(&t, 'x', 0));
+        CHECK( !sr_trigger_add(&t, '1', 32));
+        CHECK( !sr_trigger_is_active(&t));
+        for (uint32_t n = 0;  n < SR_TRIGGER_STAGES - 1;  ++n) {
+            CHECK(sr_trigger_add(&t, '1', n));
+            CHECK(sr_trigger_next_stage(&t));
+        }
+        CHECK(sr_trigger_add(&t, '1', 0));
+        CHECK( !sr_trigger_next_stage(&t));
+        CHECK_EQ(t.stage_cnt, SR_TRIGGER_STAGES);
+    }
+}   // test_fixed
+
+
+
+static void test_random(uint32_t bps, uint32_t d_mask, uint32_t activity, const char *name)
+/**
+ * Random streams with random triggers: channels which are not enabled toggle at random and must be ignored.
+ * A sample changes with probability \a activity / 65536.
+ */
+{
+    const uint32_t mask = bps_mask(bps);
+    uint32_t fired = 0;
+
+    for (int run = 0;  run < 200;  ++run) {
+        uint32_t samples = 8 * (1 + test_rand() % (SAMPLES_MAX / 8));
+        uint32_t seg = 8 * (1 + test_rand() % 512);
+        uint32_t val = test_rand() & mask & d_mask;
+        uint32_t stages = 1 + test_rand() % SR_TRIGGER_STAGES;
+        int32_t expected, ndx;
+        sr_trigger_t t;
+
+        memset(raw, 0, sizeof(raw));
+        for (uint32_t i = 0;  i < samples;  ++i) {
+            if ((test_rand() & 0xffff) < activity) {
+                // change only a few channels, so that multi channel conditions still match now and then
+                val ^= (1u << (test_rand() % 32)) & mask & d_mask;
+                if ((test_rand() & 3) == 0) {
+                    val ^= (1u << (test_rand() % 32)) & mask & d_mask;
+                }
+            }
+            ref[i] = val;
+            store(bps, i, val | (test_rand() & mask & ~d_mask));
+        }
+
+        sr_trigger_clear(&t);
+        for (uint32_t s = 0;  s < stages;  ++s) {
+            uint32_t conds = 1 + test_rand() % 2;
+
+            for (uint32_t c = 0;  c < conds;  ++c) {
+                static const char cond[] = "01rfe";
+                uint32_t ch;
+
+                do {
+                    ch = test_rand() % 32;
+                } while (((1u << ch) & mask & d_mask) == 0);
+                CHECK(sr_trigger_add(&t, cond[test_rand() % 5], ch));
+            }
+            if (s + 1 < stages) {
+                CHECK(sr_trigger_next_stage(&t));
+            }
+        }
+
+        expected = ref_scan(&t, ref, samples);
+        ndx = scan_segments(&t, bps, d_mask, samples, seg);
+        if (ndx != expected) {
+            fprintf(stderr, "%s run %d: %u samples, segment %u, %u stages: trigger at %d, expected %d\n",
+                    name, run, samples, seg, stages, ndx, expected);
+            ++test_failures;
+            return;
+        }
+        fired += (expected >= 0);
+    }
+    // the streams must exercise both outcomes
+    CHECK(fired != 0);
+    CHECK(fired != 200);
+}   // test_random
+
+
+
+int main(void)
+{
+    test_fixed();
+
+    test_random(0, 0x3, 2000, "D4 2ch");
+    test_random(0, 0xf, 20000, "D4 4ch");
+    test_random(1, 0x1f, 300, "1B 5ch");
+    test_random(1, 0xff, 20000, "1B 8ch");
+    test_random(2, 0x1ff, 100, "2B 9ch");
+    test_random(2, 0xffff, 5000, "2B 16ch");
+    test_random(4, 0x1ffff, 1000, "4B 17ch");
+    test_random(4, 0x1fffff, 40000, "4B 21ch");
+    return test_result("test_sigrok_trigger");
+}   // main
@@ -0,0 +1,135 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the counter snapshot and the latency histograms.
+ */
+
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "test.h"
+#include "stats_counter.h"
+#include "stats_histogram.h"
+
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}   // get_u32
+
+
+
+static void test_counter_snapshot(void)
+{
+    uint8_t buf[STATS_SNAPSHOT_SIZE + 16];
+
+    stats_reset();
+    stub_time_us = 123456789;
+
+    stub_core_num = 0;
+    stats_add(STATS_SWD_TRANSFER, 10);
+    stats_inc(STATS_SIGROK_TX_BYTES);
+    stub_core_num = 1;
+    stats_add(STATS_SWD_TRANSFER, 5);
+    stats_add(STATS_SIGROK_TX_BYTES, 0xfffffffe);          // wraps around together with core 0
+
+    CHECK_EQ(stats_get(STATS_SWD_TRANSFER), 15);
+    CHECK_EQ(stats_get(STATS_SIGROK_TX_BYTES), 0xffffffff);
+
+    CHECK_EQ(stats_snapshot(buf, STATS_SNAPSHOT_SIZE - 1), 0);
+    CHECK_EQ(stats_snapshot(buf, sizeof(buf)), STATS_SNAPSHOT_SIZE);
+    CHECK_EQ(get_u32(buf + 0), STATS_SNAPSHOT_MAGIC);
+    CHECK_EQ(buf[4] | (buf[5] << 8), STATS_SNAPSHOT_VERSION);
+    CHECK_EQ(buf[6] | (buf[7] << 8), STATS_CNT);
+    CHECK_EQ(get_u32(buf + 8), 123456);
+    CHECK_EQ(get_u32(buf + STATS_SNAPSHOT_HEADER_SIZE + 4 * STATS_SWD_TRANSFER), 15);
+    CHECK_EQ(get_u32(buf + STATS_SNAPSHOT_HEADER_SIZE + 4 * STATS_SIGROK_TX_BYTES), 0xffffffff);
+    CHECK_EQ(get_u32(buf + STATS_SNAPSHOT_HEADER_SIZE + 4 * STATS_MSC_SECTOR_READ), 0);
+
+    stats_reset();
+    CHECK_EQ(stats_get(STATS_SWD_TRANSFER), 0);
+}   // test_counter_snapshot
+
+
+
+static void test_hist_buckets(void)
+{
+    static const struct { uint32_t us; uint32_t bucket; } cases[] = {
+        {0, 0}, {1, 1}, {2, 2}, {3, 2}, {4, 3}, {1023, 10}, {1024, 11},
+        {16383, 14}, {16384, 15}, {0xffffffff, 15},
+    };
+
+    for (uint32_t i = 0;  i < sizeof(cases) / sizeof(cases[0]);  ++i) {
+        stats_hist_reset();
+        stats_hist_add(HIST_SWD_AP_READ, cases[i].us);
+        CHECK_EQ(stats_hist[HIST_SWD_AP_READ][cases[i].bucket], 1);
+    }
+}   // test_hist_buckets
+
+
+
+static void test_hist_read(void)
+{
+    uint8_t full[STATS_HIST_SNAPSHOT_SIZE];
+    uint8_t part[STATS_HIST_SNAPSHOT_SIZE];
+    uint32_t offset, n;
+
+    stats_hist_reset();
+    for (uint32_t i = 0;  i < 1000;  ++i) {
+        stats_hist_add((stats_hist_id_t)(test_rand() % HIST_CNT), test_rand() % 100000);
+    }
+
+    CHECK_EQ(stats_hist_read(full, 0, sizeof(full) + 100), sizeof(full));
+    CHECK_EQ(get_u32(full), STATS_HIST_MAGIC);
+    CHECK_EQ(full[6] | (full[7] << 8), HIST_CNT);
+    CHECK_EQ(full[8] | (full[9] << 8), STATS_HIST_BUCKETS);
+    CHECK_EQ(get_u32(full + STATS_HIST_HEADER_SIZE + 4 * (HIST_DAP_QUEUE * STATS_HIST_BUCKETS + 3)),
+             stats_hist[HIST_DAP_QUEUE][3]);
+
+    // reading in odd sized parts like the DAP vendor command gives the same data
+    for (offset = 0;  offset < sizeof(part);  offset += n) {
+        n = stats_hist_read(part + offset, offset, 61);
+        CHECK(n != 0);
+        if (n == 0) {
+            break;
+        }
+    }
+    CHECK_EQ(offset, sizeof(part));
+    CHECK(memcmp(full, part, sizeof(full)) == 0);
+    CHECK_EQ(stats_hist_read(part, sizeof(part), 10), 0);
+}   // test_hist_read
+
+
+
+int main(void)
+{
+    test_counter_snapshot();
+    test_hist_buckets();
+    test_hist_read();
+    return test_result("test_stats");
+}   // main
@@ -0,0 +1,405 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the SWD stack against the behavioural target model: sw_dp_pio.c (SWD_Transfer & co)
+ * on top of probe_sim.c, and DAPLinks swd_host.c on top of that.
+ *
+ * The model checks the wire protocol bit by bit, so besides the functional results every test
+ * also checks that probe and target never drove SWDIO at the same time.
+ */
+
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "test.h"
+#include "DAP.h"
+#include "swd_host.h"
+#include "stats_counter.h"
+
+#include "swd_target.h"
+#include "probe_sim.h"
+
+
+#define FLASH_START     0x00000000
+#define FLASH_SIZE      (64 * 1024)
+#define FLASH_PAGE      4096
+#define RAM_START       0x20000000
+#define RAM_SIZE        (64 * 1024)
+#define UNMAPPED        0x30000000
+
+#define ALGO_ENTRY      0x20000021
+#define ALGO_BKPT       0x20000001
+
+static swd_target_t target;
+static swd_target_cfg_t target_cfg = {
+    .dpidr           = 0x2ba01477,
+    .turnaround      = 1,
+    .pwrup_delay     = 3,
+    .flash_start     = FLASH_START,
+    .flash_size      = FLASH_SIZE,
+    .flash_page_size = FLASH_PAGE,
+    .ram_start       = RAM_START,
+    .ram_size        = RAM_SIZE,
+};
+
+
+
+/// fresh target, probe and statistics
+static void sim_setup(swd_target_run_t run)
+{
+    swd_target_free(&target);
+    target_cfg.run = run;
+    swd_target_init(&target, &target_cfg);
+    probe_sim_attach(&target);
+    stats_reset();
+}   // sim_setup
+
+
+
+/// the wire protocol was obeyed by the probe
+static void check_wire(void)
+{
+    CHECK_EQ(target.contention, 0);
+    CHECK_EQ(target.undriven, 0);
+    CHECK_EQ(target.wdata_errors, 0);
+    CHECK_EQ(probe_sim_stats.fifo_errors, 0);
+}   // check_wire
+
+
+
+static void test_connect(void)
+{
+    uint32_t v;
+
+    sim_setup(NULL);
+
+    CHECK(swd_init_debug());
+    CHECK(target.line_resets >= 2);
+    CHECK_EQ(target.ctrl_stat & (CDBGPWRUPREQ | CSYSPWRUPREQ), CDBGPWRUPREQ | CSYSPWRUPREQ);
+    CHECK(target.pwrup_cnt >= target_cfg.pwrup_delay);
+    CHECK_EQ(stats_get(STATS_SWD_ACK_ERROR), 0);
+
+    CHECK(swd_read_dp(DP_IDCODE, &v));
+    CHECK_EQ(v, target_cfg.dpidr);
+    CHECK(swd_read_ap(AP_IDR, &v));
+    CHECK_EQ(v, SWD_TARGET_AP_IDR);
+    CHECK(swd_read_word(0xe000ed00, &v));
+    CHECK_EQ(v, SWD_TARGET_CPUID);
+    check_wire();
+}   // test_connect
+
+
+
+/**
+ * Without line reset or before DPIDR has been read the target does not answer.
+ * SWD_Transfer() has to report the protocol error and keep the wire in sync.
+ */
+static void test_lockout(void)
+{
+    static const uint8_t ones[8] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    static const uint8_t zero[1] = { 0x00 };
+    uint8_t swdi[1];
+    uint32_t v;
+
+    sim_setup(NULL);
+    swd_init();
+
+    CHECK_EQ(SWD_Transfer(SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_CTRL_STAT), &v), 0x07);
+
+    SWJ_Sequence(51, ones);
+    SWJ_Sequence(8, zero);
+    CHECK_EQ(target.line_resets, 1);
+    CHECK_EQ(SWD_Transfer(SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_CTRL_STAT), &v), 0x07);
+    CHECK_EQ(stats_get(STATS_SWD_ACK_ERROR), 2);
+
+    // same with SWD_Sequence(), idle line is pulled up
+    SWD_Sequence(51, ones, NULL);
+    SWD_Sequence(8, zero, NULL);
+    CHECK_EQ(target.line_resets, 2);
+    SWD_Sequence(SWD_SEQUENCE_DIN | 8, NULL, swdi);
+    CHECK_EQ(swdi[0], 0xff);
+    CHECK_EQ(SWD_Transfer(SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_IDCODE), &v), DAP_TRANSFER_OK);
+    CHECK_EQ(v, target_cfg.dpidr);
+    CHECK_EQ(SWD_Transfer(SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_CTRL_STAT), &v), DAP_TRANSFER_OK);
+
+    CHECK(JTAG2SWD());
+    CHECK_EQ(SWD_Transfer(SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_CTRL_STAT), &v), DAP_TRANSFER_OK);
+    CHECK_EQ(stats_get(STATS_SWD_ACK_ERROR), 2);
+    check_wire();
+}   // test_lockout
+
+
+
+/**
+ * Unaligned reads/writes of random length, block transfers must not cross the 1KByte
+ * auto increment boundary (the model wraps inside the page).
+ */
+static void test_memory(void)
+{
+    static uint8_t wbuf[4096 + 1];
+    static uint8_t rbuf[4096 + 1];
+
+    sim_setup(NULL);
+    CHECK(swd_init_debug());
+
+    for (int i = 0;  i < 200;  ++i) {
+        uint32_t len  = 1 + test_rand() % 4096;
+        uint32_t addr = RAM_START + test_rand() % (RAM_SIZE - len);
+        uint32_t offs = test_rand() & 1;                        // unaligned host buffer as well
+
+        for (uint32_t n = 0;  n < len;  ++n) {
+            wbuf[offs + n] = (uint8_t)test_rand();
+        }
+        CHECK(swd_write_memory(addr, wbuf + offs, len));
+        CHECK(memcmp(swd_target_mem(&target, addr, len), wbuf + offs, len) == 0);
+
+        memset(rbuf, 0, sizeof(rbuf));
+        CHECK(swd_read_memory(addr, rbuf + offs, len));
+        CHECK(memcmp(rbuf + offs, wbuf + offs, len) == 0);
+    }
+    CHECK_EQ(target.bus_errors, 0);
+    check_wire();
+}   // test_memory
+
+
+
+static void test_wait(void)
+{
+    uint32_t v;
+
+    sim_setup(NULL);
+    CHECK(swd_init_debug());
+    *(uint32_t *)swd_target_mem(&target, RAM_START + 0x100, 4) = 0xdeadbeef;
+
+    // WAITs are retried by swd_transfer_retry()
+    target.inject_wait = 5;
+    CHECK(swd_read_word(RAM_START + 0x100, &v));
+    CHECK_EQ(v, 0xdeadbeef);
+    CHECK_EQ(target.acks_wait, 5);
+    CHECK_EQ(stats_get(STATS_SWD_ACK_WAIT), 5);
+    CHECK_EQ(stats_get(STATS_SWD_RETRY), 5);
+
+    // ... but not forever, DAPABORT gets the target back
+    target.inject_wait = 1000;
+    CHECK( !swd_read_word(RAM_START + 0x100, &v));
+    CHECK(swd_write_dp(DP_ABORT, DAPABORT));
+    CHECK(swd_read_word(RAM_START + 0x100, &v));
+    CHECK_EQ(v, 0xdeadbeef);
+    check_wire();
+}   // test_wait
+
+
+
+static void test_fault(void)
+{
+    uint32_t v;
+
+    sim_setup(NULL);
+    CHECK(swd_init_debug());
+
+    // posted read: the bus error shows up with FAULT on RDBUFF
+    CHECK( !swd_read_word(UNMAPPED, &v));
+    CHECK_EQ(target.bus_errors, 1);
+    CHECK(target.acks_fault >= 1);
+    CHECK(stats_get(STATS_SWD_ACK_FAULT) >= 1);
+
+    // sticky until cleared
+    CHECK( !swd_read_word(RAM_START, &v));
+    CHECK(swd_read_dp(DP_CTRL_STAT, &v));
+    CHECK((v & STICKYERR) != 0);
+    CHECK(swd_clear_errors());
+    CHECK(swd_read_word(RAM_START, &v));
+
+    // flash is read only unless enabled in the NVMC
+    CHECK( !swd_write_word(FLASH_START, 0));
+    CHECK_EQ(target.bus_errors, 2);
+    CHECK(swd_clear_errors());
+    CHECK_EQ(*swd_target_mem(&target, FLASH_START, 1), 0xff);
+    check_wire();
+}   // test_fault
+
+
+
+static void test_parity(void)
+{
+    uint32_t v;
+
+    sim_setup(NULL);
+    CHECK(swd_init_debug());
+
+    target.inject_read_parity = true;
+    CHECK( !swd_read_dp(DP_IDCODE, &v));
+    CHECK_EQ(stats_get(STATS_SWD_ACK_ERROR), 1);
+
+    CHECK(swd_read_dp(DP_IDCODE, &v));
+    CHECK_EQ(v, target_cfg.dpidr);
+    check_wire();
+}   // test_parity
+
+
+
+/**
+ * Turnaround is changed via WCR, probe and target have to agree.
+ */
+static void test_turnaround(void)
+{
+    static uint8_t wbuf[256];
+    static uint8_t rbuf[256];
+    uint32_t v;
+
+    sim_setup(NULL);
+    CHECK(swd_init_debug());
+    for (uint32_t n = 0;  n < sizeof(wbuf);  ++n) {
+        wbuf[n] = (uint8_t)test_rand();
+    }
+
+    CHECK(swd_write_dp(DP_SELECT, CTRLSEL));
+    CHECK(swd_write_dp(DP_WCR, 0x00000100));
+    DAP_Data.swd_conf.turnaround = 2;
+    CHECK(swd_read_dp(DP_WCR, &v));
+    CHECK_EQ(v, 0x00000100);
+    CHECK(swd_write_memory(RAM_START + 3, wbuf, sizeof(wbuf)));
+    CHECK(swd_read_memory(RAM_START + 3, rbuf, sizeof(rbuf)));
+    CHECK(memcmp(rbuf, wbuf, sizeof(wbuf)) == 0);
+    check_wire();
+
+    // mismatch is detected
+    DAP_Data.swd_conf.turnaround = 1;
+    CHECK( !swd_read_memory(RAM_START + 3, rbuf, sizeof(rbuf)));
+}   // test_turnaround
+
+
+
+static void test_nvmc(void)
+{
+    static uint8_t page[256];
+    static uint8_t rbuf[256];
+    uint32_t v;
+
+    sim_setup(NULL);
+    CHECK(swd_init_debug());
+    for (uint32_t n = 0;  n < sizeof(page);  ++n) {
+        page[n] = (uint8_t)test_rand();
+    }
+
+    CHECK(swd_write_word(SWD_TARGET_NVMC_CONFIG, 1));
+    CHECK(swd_write_memory(FLASH_START + 0x1000, page, sizeof(page)));
+    CHECK(swd_write_word(FLASH_START + 0x1800, 0xff00ff00));
+    CHECK(swd_write_word(FLASH_START + 0x1800, 0x0ff00ff0));          // NOR: bits can only be cleared
+    CHECK(swd_write_word(SWD_TARGET_NVMC_CONFIG, 0));
+    CHECK_EQ(target.flash_writes, sizeof(page) + 8);
+
+    CHECK(swd_read_memory(FLASH_START + 0x1000, rbuf, sizeof(rbuf)));
+    CHECK(memcmp(rbuf, page, sizeof(page)) == 0);
+    CHECK(swd_read_word(FLASH_START + 0x1800, &v));
+    CHECK_EQ(v, 0x0f000f00);
+
+    CHECK(swd_write_word(SWD_TARGET_NVMC_CONFIG, 2));
+    CHECK(swd_write_word(SWD_TARGET_NVMC_ERASEPAGE, FLASH_START + 0x1000));
+    CHECK(swd_write_word(SWD_TARGET_NVMC_CONFIG, 0));
+    CHECK_EQ(target.flash_erases, 1);
+    CHECK(swd_read_word(FLASH_START + 0x1800, &v));
+    CHECK_EQ(v, 0xffffffff);
+    CHECK_EQ(target.bus_errors, 0);
+    check_wire();
+}   // test_nvmc
+
+
+
+/// emulates ProgramPage(adr=R0, sz=R1, buf=R2) of a flash algorithm
+static int algo_program_page(swd_target_t *t)
+{
+    uint8_t *dst = swd_target_mem(t, t->reg[0], t->reg[1]);
+    const uint8_t *src = swd_target_mem(t, t->reg[2], t->reg[1]);
+
+    if (t->reg[15] != ALGO_ENTRY  ||  t->reg[14] != ALGO_BKPT  ||  dst == NULL  ||  src == NULL) {
+        t->reg[0] = 1;
+    }
+    else {
+        for (uint32_t n = 0;  n < t->reg[1];  ++n) {
+            dst[n] &= src[n];
+        }
+        t->reg[0] = 0;
+    }
+    return 20;
+}   // algo_program_page
+
+
+
+static void test_syscall(void)
+{
+    static const program_syscall_t sys = {
+        .breakpoint    = ALGO_BKPT,
+        .static_base   = RAM_START + 0x400,
+        .stack_pointer = RAM_START + 0x1000,
+    };
+    static uint8_t page[512];
+
+    sim_setup(algo_program_page);
+    for (uint32_t n = 0;  n < sizeof(page);  ++n) {
+        page[n] = (uint8_t)test_rand();
+    }
+
+    CHECK(swd_set_target_state_hw(RESET_PROGRAM));
+    CHECK(target.halted);
+    CHECK( !target.reset_asserted);
+    CHECK_EQ(target.demcr, 0);
+
+    CHECK(swd_write_memory(RAM_START + 0x2000, page, sizeof(page)));
+    CHECK(swd_flash_syscall_exec(&sys, ALGO_ENTRY, FLASH_START + 0x4000, sizeof(page), RAM_START + 0x2000, 0,
+                                 FLASHALGO_RETURN_BOOL));
+    CHECK_EQ(target.resumes, 1);
+    CHECK(target.halted);
+    CHECK_EQ(target.reg[9], sys.static_base);
+    CHECK_EQ(target.reg[13], sys.stack_pointer);
+    CHECK(memcmp(swd_target_mem(&target, FLASH_START + 0x4000, sizeof(page)), page, sizeof(page)) == 0);
+
+    // failing function
+    CHECK( !swd_flash_syscall_exec(&sys, ALGO_ENTRY, UNMAPPED, sizeof(page), RAM_START + 0x2000, 0,
+                                   FLASHALGO_RETURN_BOOL));
+    CHECK_EQ(target.resumes, 2);
+    CHECK(target.halted);
+    check_wire();
+}   // test_syscall
+
+
+
+int main(void)
+{
+    test_connect();
+    test_lockout();
+    test_memory();
+    test_wait();
+    test_fault();
+    test_parity();
+    test_turnaround();
+    test_nvmc();
+    test_syscall();
+
+    swd_target_free(&target);
+    return test_result("test_swd_sim");
+}   // main
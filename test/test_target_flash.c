@@ -0,0 +1,283 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Tests of the double buffered target programming in DAPLink's target_flash.c against a modelled
+ * flash algo (see test_target_flash.h).
+ *
+ * Checked are the flash contents, that the target never gets a program buffer overwritten or a call
+ * while it is busy, that the last page is finished by uninit/erase and that errors of a pending page
+ * are reported by the next call.
+ */
+
+#include "test_target_flash.h"
+#include "flash_manager.h"
+
+
+static uint8_t image[TF_FLASH_SIZE];
+
+
+
+static void setup(program_target_t *algo)
+{
+    tf_setup(algo);
+    for (uint32_t i = 0;  i < sizeof(image);  ++i) {
+        image[i] = (uint8_t)test_rand();
+    }
+}   // setup
+
+
+
+static bool flash_equals_image(uint32_t addr, uint32_t size)
+{
+    return memcmp(tf.flash + addr, image + addr, size) == 0;
+}   // flash_equals_image
+
+
+
+static bool flash_erased(uint32_t addr, uint32_t size)
+{
+    for (uint32_t i = 0;  i < size;  ++i) {
+        if (tf.flash[addr + i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}   // flash_erased
+
+
+
+/// init, select the algo and erase [addr, addr+size)
+static void open_and_erase(uint32_t addr, uint32_t size)
+{
+    CHECK_EQ(flash_intf_target->init(), ERROR_SUCCESS);
+    CHECK_EQ(flash_intf_target->flash_algo_set(addr), ERROR_SUCCESS);
+    for (uint32_t a = addr;  a < addr + size;  a += TF_SECTOR_SIZE) {
+        CHECK_EQ(flash_intf_target->erase_sector(a), ERROR_SUCCESS);
+    }
+}   // open_and_erase
+
+
+
+/// in order pages: downloads overlap with programming, every page is verified
+static void test_sequential(program_target_t *algo, bool overlap)
+{
+    const uint32_t size = 8 * TF_SECTOR_SIZE;
+
+    setup(algo);
+    open_and_erase(0, size);
+    for (uint32_t a = 0;  a < size;  a += 1024) {
+        CHECK_EQ(flash_intf_target->program_page(a, image + a, 1024), ERROR_SUCCESS);
+    }
+    CHECK_EQ(flash_intf_target->uninit(), ERROR_SUCCESS);
+
+    CHECK(flash_equals_image(0, size));
+    CHECK(flash_erased(size, TF_FLASH_SIZE - size));
+    CHECK_EQ(tf.violations, 0);
+    CHECK( !tf.running);
+    CHECK_EQ(tf.cnt_program, size / TF_PAGE_SIZE);
+    if (algo->verify != 0) {
+        CHECK_EQ(tf.cnt_verify, size / TF_PAGE_SIZE);
+    }
+    else {
+        CHECK_EQ(tf.cnt_readback, size);
+    }
+    if (overlap) {
+        CHECK(tf.cnt_overlap >= size / TF_PAGE_SIZE - 1);
+    }
+    else {
+        CHECK_EQ(tf.cnt_overlap, 0);
+    }
+}   // test_sequential
+
+
+
+/// the last page is left running and finished by uninit
+static void test_uninit_finishes_pending(void)
+{
+    setup(&tf_algo_double);
+    open_and_erase(0, TF_SECTOR_SIZE);
+    CHECK_EQ(flash_intf_target->program_page(0x200, image + 0x200, TF_PAGE_SIZE), ERROR_SUCCESS);
+    CHECK(tf.running);
+    CHECK(flash_erased(0x200, TF_PAGE_SIZE));                // not yet taken effect
+    CHECK_EQ(flash_intf_target->uninit(), ERROR_SUCCESS);
+
+    CHECK( !tf.running);
+    CHECK(flash_equals_image(0x200, TF_PAGE_SIZE));
+    CHECK_EQ(tf.cnt_verify, 1);
+    CHECK_EQ(tf.violations, 0);
+}   // test_uninit_finishes_pending
+
+
+
+/// non-increasing and out of order addresses, with erase calls between the pages
+static void test_out_of_order(void)
+{
+    const uint32_t sectors = 16;
+    uint32_t order[16 * TF_SECTOR_SIZE / 1024];
+    const uint32_t blocks = sizeof(order) / sizeof(order[0]);
+
+    setup(&tf_algo_double);
+    for (uint32_t i = 0;  i < blocks;  ++i) {
+        order[i] = i;
+    }
+    for (uint32_t i = blocks - 1;  i > 0;  --i) {
+        uint32_t j = test_rand() % (i + 1);
+        uint32_t t = order[i];
+
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    // erase on demand: a sector is erased before its first block, while a page may be pending
+    CHECK_EQ(flash_intf_target->init(), ERROR_SUCCESS);
+    CHECK_EQ(flash_intf_target->flash_algo_set(0), ERROR_SUCCESS);
+    {
+        bool erased[16] = { false };
+
+        for (uint32_t i = 0;  i < blocks;  ++i) {
+            uint32_t a = order[i] * 1024;
+            uint32_t sector = a / TF_SECTOR_SIZE;
+
+            if ( !erased[sector]) {
+                CHECK_EQ(flash_intf_target->erase_sector(sector * TF_SECTOR_SIZE), ERROR_SUCCESS);
+                erased[sector] = true;
+            }
+            CHECK_EQ(flash_intf_target->program_page(a, image + a, 1024), ERROR_SUCCESS);
+        }
+    }
+    CHECK_EQ(flash_intf_target->uninit(), ERROR_SUCCESS);
+
+    CHECK(flash_equals_image(0, sectors * TF_SECTOR_SIZE));
+    CHECK_EQ(tf.cnt_erase, sectors);
+    CHECK_EQ(tf.violations, 0);
+}   // test_out_of_order
+
+
+
+/// UF2 blocks through flash_manager with lazy sector erase, sectors are revisited
+static void test_flash_manager(void)
+{
+    static const uint32_t ranges[][2] = {
+        { 0x3000, 0x800 }, { 0x1000, 0x800 }, { 0x3800, 0x800 }, { 0x1800, 0x800 },
+        { 0x8000, 0x2000 }, { 0x5000, 0x400 }, { 0x4000, 0x400 },
+    };
+
+    for (int verify_by_algo = 0;  verify_by_algo <= 1;  ++verify_by_algo) {
+        setup(verify_by_algo ? &tf_algo_double : &tf_algo_readback);
+        flash_manager_set_page_erase(true);
+        CHECK_EQ(flash_manager_init(flash_intf_target), ERROR_SUCCESS);
+        for (uint32_t r = 0;  r < sizeof(ranges) / sizeof(ranges[0]);  ++r) {
+            for (uint32_t a = ranges[r][0];  a < ranges[r][0] + ranges[r][1];  a += 256) {
+                CHECK_EQ(flash_manager_data(a, image + a, 256), ERROR_SUCCESS);
+            }
+        }
+        CHECK_EQ(flash_manager_uninit(), ERROR_SUCCESS);
+
+        for (uint32_t r = 0;  r < sizeof(ranges) / sizeof(ranges[0]);  ++r) {
+            CHECK(flash_equals_image(ranges[r][0], ranges[r][1]));
+        }
+        CHECK(flash_erased(0x0000, 0x1000));
+        CHECK(flash_erased(0x2000, 0x1000));
+        CHECK(flash_erased(0x4400, 0x0c00));
+        CHECK(flash_erased(0x5400, 0x2c00));
+        CHECK_EQ(tf.cnt_erase, 6);
+        CHECK_EQ(tf.violations, 0);
+        CHECK(tf.cnt_overlap != 0);
+    }
+}   // test_flash_manager
+
+
+
+/// errors of a pending page are reported by the next call which has to wait for it
+static void test_errors(void)
+{
+    for (int verify_by_algo = 0;  verify_by_algo <= 1;  ++verify_by_algo) {
+        program_target_t *algo = verify_by_algo ? &tf_algo_double : &tf_algo_readback;
+
+        // verify error in the middle: reported by the following program_page()
+        setup(algo);
+        tf.corrupt_addr = 0x0610;
+        open_and_erase(0, TF_SECTOR_SIZE);
+        CHECK_EQ(flash_intf_target->program_page(0x0000, image + 0x0000, 1024), ERROR_SUCCESS);
+        CHECK_EQ(flash_intf_target->program_page(0x0400, image + 0x0400, 1024), ERROR_SUCCESS);
+        CHECK_EQ(flash_intf_target->program_page(0x0800, image + 0x0800, 1024), ERROR_WRITE_VERIFY);
+        CHECK_EQ(tf.violations, 0);
+
+        // the next session starts clean
+        tf.corrupt_addr = 0;
+        open_and_erase(0, TF_SECTOR_SIZE);
+        CHECK_EQ(flash_intf_target->program_page(0x0000, image, TF_SECTOR_SIZE), ERROR_SUCCESS);
+        CHECK_EQ(flash_intf_target->uninit(), ERROR_SUCCESS);
+        CHECK(flash_equals_image(0, TF_SECTOR_SIZE));
+        CHECK_EQ(tf.violations, 0);
+
+        // verify error on the last page: reported by uninit()
+        setup(algo);
+        tf.corrupt_addr = 0x0b00;
+        open_and_erase(0, TF_SECTOR_SIZE);
+        CHECK_EQ(flash_intf_target->program_page(0x0800, image + 0x0800, 1024), ERROR_SUCCESS);
+        CHECK_EQ(flash_intf_target->uninit(), ERROR_WRITE_VERIFY);
+        CHECK( !tf.running);
+        CHECK_EQ(tf.violations, 0);
+
+        // program error on the last page: reported by erase_sector()/uninit()
+        setup(algo);
+        tf.fail_program_addr = 0x0600;
+        open_and_erase(0, 2 * TF_SECTOR_SIZE);
+        CHECK_EQ(flash_intf_target->program_page(0x0400, image + 0x0400, 1024), ERROR_SUCCESS);
+        CHECK_EQ(flash_intf_target->erase_sector(TF_SECTOR_SIZE), ERROR_WRITE);
+        CHECK( !tf.running);
+        CHECK_EQ(flash_intf_target->uninit(), ERROR_SUCCESS);
+        CHECK_EQ(tf.violations, 0);
+
+        setup(algo);
+        tf.fail_program_addr = 0x0600;
+        open_and_erase(0, TF_SECTOR_SIZE);
+        CHECK_EQ(flash_intf_target->program_page(0x0400, image + 0x0400, 1024), ERROR_SUCCESS);
+        CHECK_EQ(flash_intf_target->uninit(), ERROR_WRITE);
+        CHECK( !tf.running);
+        CHECK_EQ(tf.violations, 0);
+    }
+}   // test_errors
+
+
+
+int main(void)
+{
+    tf.program_ns      = 2000000;
+    tf.erase_ns        = 50000000;
+    tf.call_ns         = 20000;
+    tf.swd_ns_per_byte = 400;
+
+    test_sequential(&tf_algo_double, true);
+    test_sequential(&tf_algo_readback, true);
+    test_sequential(&tf_algo_single, false);
+    test_uninit_finishes_pending();
+    test_out_of_order();
+    test_flash_manager();
+    test_errors();
+    return test_result("test_target_flash");
+}   // main
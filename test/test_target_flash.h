@@ -0,0 +1,420 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2021 Raspberry Pi (Trading) Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * Fake target for the DAPLink target_flash tests: a programmer model behind swd_host.h.
+ *
+ * Flash algorithm calls are not executed but modelled: a started function (swd_flash_syscall_start())
+ * runs on the "target" for a configurable time and takes effect when its result is fetched
+ * (swd_flash_syscall_wait()).  So data overwritten in a program buffer while the target works on it
+ * ends up in flash.  Time is virtual and advanced by SWD transfers, algo calls and the test.
+ * Accesses which a real target would not tolerate (download into a busy buffer, calls while the
+ * algo is running, program without init...) are counted as violations.
+ */
+
+#ifndef _TEST_TARGET_FLASH_H
+#define _TEST_TARGET_FLASH_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "flash_intf.h"
+#include "settings.h"
+#include "swd_host.h"
+#include "target_board.h"
+#include "target_family.h"
+
+
+#define TF_FLASH_SIZE       (256 * 1024)
+#define TF_SECTOR_SIZE      4096
+#define TF_PAGE_SIZE        512
+#define TF_RAM_START        0x20000000
+#define TF_RAM_SIZE         0x4000
+#define TF_BUFFER_1         0x20001000
+#define TF_BUFFER_2         0x20001200
+
+// entry points of the modelled algo functions
+enum {
+    TF_ENTRY_INIT         = 0x20000001,
+    TF_ENTRY_UNINIT       = 0x20000011,
+    TF_ENTRY_ERASE_CHIP   = 0x20000021,
+    TF_ENTRY_ERASE_SECTOR = 0x20000031,
+    TF_ENTRY_PROGRAM_PAGE = 0x20000041,
+    TF_ENTRY_VERIFY       = 0x20000051,
+};
+
+typedef struct {
+    uint8_t  flash[TF_FLASH_SIZE];
+    uint8_t  ram[TF_RAM_SIZE];
+
+    // algo function which is currently running
+    bool     running;
+    uint32_t run_entry;
+    uint32_t run_args[3];
+    uint64_t run_done_ns;
+    uint32_t func;                                   // function given to init(), 0 after uninit()
+
+    // timing (virtual)
+    uint64_t now_ns;
+    uint32_t program_ns;                             // per page
+    uint32_t erase_ns;                               // per sector
+    uint32_t call_ns;                                // overhead of an algo call (registers, halt check)
+    uint32_t swd_ns_per_byte;                        // memory download/upload
+
+    // injected errors
+    uint32_t fail_program_addr;                      // program_page() of this page fails, 0 = none
+    uint32_t corrupt_addr;                           // this flash byte is programmed wrong, 0 = none
+
+    // statistics
+    uint32_t cnt_program;
+    uint32_t cnt_verify;
+    uint32_t cnt_readback;                           // bytes
+    uint32_t cnt_erase;
+    uint32_t cnt_init;
+    uint32_t cnt_overlap;                            // downloads while the target programmed
+    uint32_t violations;
+} tf_target_t;
+
+static tf_target_t tf;
+
+static uint32_t tf_algo_blob[4];
+
+program_target_t tf_algo_double = {
+    .init                = TF_ENTRY_INIT,
+    .uninit              = TF_ENTRY_UNINIT,
+    .erase_chip          = TF_ENTRY_ERASE_CHIP,
+    .erase_sector        = TF_ENTRY_ERASE_SECTOR,
+    .program_page        = TF_ENTRY_PROGRAM_PAGE,
+    .verify              = TF_ENTRY_VERIFY,
+    .sys_call_s          = { TF_RAM_START + 1, TF_RAM_START + 0x800, TF_RAM_START + 0xc00 },
+    .program_buffer      = TF_BUFFER_1,
+    .algo_start          = TF_RAM_START,
+    .algo_size           = sizeof(tf_algo_blob),
+    .algo_blob           = tf_algo_blob,
+    .program_buffer_size = TF_PAGE_SIZE,
+    .algo_flags          = kAlgoVerifyReturnsAddress,
+    .program_buffer_2nd  = TF_BUFFER_2,
+};
+
+program_target_t tf_algo_single = {
+    .init                = TF_ENTRY_INIT,
+    .uninit              = TF_ENTRY_UNINIT,
+    .erase_chip          = TF_ENTRY_ERASE_CHIP,
+    .erase_sector        = TF_ENTRY_ERASE_SECTOR,
+    .program_page        = TF_ENTRY_PROGRAM_PAGE,
+    .verify              = TF_ENTRY_VERIFY,
+    .sys_call_s          = { TF_RAM_START + 1, TF_RAM_START + 0x800, TF_RAM_START + 0xc00 },
+    .program_buffer      = TF_BUFFER_1,
+    .algo_start          = TF_RAM_START,
+    .algo_size           = sizeof(tf_algo_blob),
+    .algo_blob           = tf_algo_blob,
+    .program_buffer_size = TF_PAGE_SIZE,
+    .algo_flags          = kAlgoVerifyReturnsAddress,
+};
+
+/// same as tf_algo_double but without verify function: verify is done by reading back the flash
+program_target_t tf_algo_readback = {
+    .init                = TF_ENTRY_INIT,
+    .uninit              = TF_ENTRY_UNINIT,
+    .erase_chip          = TF_ENTRY_ERASE_CHIP,
+    .erase_sector        = TF_ENTRY_ERASE_SECTOR,
+    .program_page        = TF_ENTRY_PROGRAM_PAGE,
+    .sys_call_s          = { TF_RAM_START + 1, TF_RAM_START + 0x800, TF_RAM_START + 0xc00 },
+    .program_buffer      = TF_BUFFER_1,
+    .algo_start          = TF_RAM_START,
+    .algo_size           = sizeof(tf_algo_blob),
+    .algo_blob           = tf_algo_blob,
+    .program_buffer_size = TF_PAGE_SIZE,
+    .program_buffer_2nd  = TF_BUFFER_2,
+};
+
+static const sector_info_t tf_sectors[] = { { 0, TF_SECTOR_SIZE } };
+
+static target_cfg_t tf_cfg = {
+    .sectors_info       = tf_sectors,
+    .sector_info_length = 1,
+    .flash_regions      = { { 0, TF_FLASH_SIZE - 1, kRegionIsDefault, 0, &tf_algo_double } },
+};
+
+const board_info_t g_board_info = { .target_cfg = &tf_cfg };
+const target_family_descriptor_t *g_target_family = NULL;
+
+
+
+void _util_assert(bool expression, const char *filename, uint16_t line)
+{
+    if ( !expression) {
+        fprintf(stderr, "util_assert %s:%u\n", filename, line);
+        ++test_failures;
+    }
+}   // _util_assert
+
+
+
+uint8_t target_set_state(target_state_t state)
+{
+    if (state == RESET_PROGRAM) {
+        // reset and halt: a running algo is stopped, flash contents stay
+        tf.running = false;
+        tf.func    = 0;
+    }
+    return 1;
+}   // target_set_state
+
+
+
+uint8_t swd_off(void)
+{
+    return 1;
+}   // swd_off
+
+
+
+/// reset the target with erased flash and select the algo
+static void tf_setup(program_target_t *algo)
+{
+    uint32_t program_ns = tf.program_ns;
+    uint32_t erase_ns = tf.erase_ns;
+    uint32_t call_ns = tf.call_ns;
+    uint32_t swd_ns_per_byte = tf.swd_ns_per_byte;
+
+    memset(&tf, 0, sizeof(tf));
+    memset(tf.flash, 0xff, sizeof(tf.flash));
+    tf.program_ns      = program_ns;
+    tf.erase_ns        = erase_ns;
+    tf.call_ns         = call_ns;
+    tf.swd_ns_per_byte = swd_ns_per_byte;
+    tf_cfg.flash_regions[0].flash_algo = algo;
+}   // tf_setup
+
+
+
+static bool tf_overlaps(uint32_t a, uint32_t a_size, uint32_t b, uint32_t b_size)
+{
+    return a < b + b_size  &&  b < a + a_size;
+}   // tf_overlaps
+
+
+
+static uint8_t *tf_mem(uint32_t addr, uint32_t size)
+{
+    if (addr + size <= TF_FLASH_SIZE) {
+        return tf.flash + addr;
+    }
+    if (addr >= TF_RAM_START  &&  addr - TF_RAM_START + size <= TF_RAM_SIZE) {
+        return tf.ram + (addr - TF_RAM_START);
+    }
+    return NULL;
+}   // tf_mem
+
+
+
+uint8_t swd_write_memory(uint32_t address, uint8_t *data, uint32_t size)
+{
+    uint8_t *mem = tf_mem(address, size);
+
+    tf.now_ns += (uint64_t)size * tf.swd_ns_per_byte;
+    if (mem == NULL  ||  address < TF_RAM_START) {
+        ++tf.violations;
+        return 0;
+    }
+    if (tf.running) {
+        if (tf.run_entry == TF_ENTRY_PROGRAM_PAGE  &&  tf_overlaps(address, size, tf.run_args[2], tf.run_args[1])) {
+            ++tf.violations;                         // program buffer in use
+        }
+        ++tf.cnt_overlap;
+    }
+    memcpy(mem, data, size);
+    return 1;
+}   // swd_write_memory
+
+
+
+uint8_t swd_read_memory(uint32_t address, uint8_t *data, uint32_t size)
+{
+    uint8_t *mem = tf_mem(address, size);
+
+    tf.now_ns += (uint64_t)size * tf.swd_ns_per_byte;
+    if (mem == NULL  ||  tf.running) {
+        ++tf.violations;                             // flash is not readable while the algo works on it
+        return 0;
+    }
+    if (address < TF_FLASH_SIZE) {
+        tf.cnt_readback += size;
+    }
+    memcpy(data, mem, size);
+    return 1;
+}   // swd_read_memory
+
+
+
+uint8_t swd_flash_syscall_start(const program_syscall_t *sysCallParam, uint32_t entry, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4)
+{
+    tf.now_ns += tf.call_ns;
+    if (tf.running) {
+        ++tf.violations;                             // core is not halted
+        return 0;
+    }
+    tf.running     = true;
+    tf.run_entry   = entry;
+    tf.run_args[0] = arg1;
+    tf.run_args[1] = arg2;
+    tf.run_args[2] = arg3;
+    tf.run_done_ns = tf.now_ns;
+    if (entry == TF_ENTRY_PROGRAM_PAGE) {
+        tf.run_done_ns += tf.program_ns;
+    }
+    else if (entry == TF_ENTRY_ERASE_SECTOR) {
+        tf.run_done_ns += tf.erase_ns;
+    }
+    else if (entry == TF_ENTRY_ERASE_CHIP) {
+        tf.run_done_ns += (uint64_t)tf.erase_ns * (TF_FLASH_SIZE / TF_SECTOR_SIZE) / 4;
+    }
+    return 1;
+}   // swd_flash_syscall_start
+
+
+
+/// execute the modelled algo function, returns R0
+static uint32_t tf_execute(uint32_t entry, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+    switch (entry) {
+        case TF_ENTRY_INIT:
+            ++tf.cnt_init;
+            if (tf.func != 0) {
+                ++tf.violations;                     // init without uninit
+            }
+            tf.func = arg3;
+            return 0;
+
+        case TF_ENTRY_UNINIT:
+            if (tf.func != arg1) {
+                ++tf.violations;
+            }
+            tf.func = 0;
+            return 0;
+
+        case TF_ENTRY_ERASE_CHIP:
+            if (tf.func != FLASH_FUNC_ERASE) {
+                ++tf.violations;
+            }
+            memset(tf.flash, 0xff, sizeof(tf.flash));
+            return 0;
+
+        case TF_ENTRY_ERASE_SECTOR:
+            if (tf.func != FLASH_FUNC_ERASE  ||  arg1 % TF_SECTOR_SIZE != 0  ||  arg1 >= TF_FLASH_SIZE) {
+                ++tf.violations;
+                return 1;
+            }
+            ++tf.cnt_erase;
+            memset(tf.flash + arg1, 0xff, TF_SECTOR_SIZE);
+            return 0;
+
+        case TF_ENTRY_PROGRAM_PAGE: {
+            const uint8_t *src = tf_mem(arg3, arg2);
+
+            ++tf.cnt_program;
+            if (tf.func != FLASH_FUNC_PROGRAM  ||  src == NULL  ||  arg1 + arg2 > TF_FLASH_SIZE) {
+                ++tf.violations;
+                return 1;
+            }
+            if (tf.fail_program_addr != 0  &&  tf_overlaps(tf.fail_program_addr, 1, arg1, arg2)) {
+                return 1;
+            }
+            for (uint32_t i = 0;  i < arg2;  ++i) {
+                if (tf.flash[arg1 + i] != 0xff) {
+                    ++tf.violations;                 // not erased
+                }
+                tf.flash[arg1 + i] &= src[i];
+            }
+            if (tf.corrupt_addr != 0  &&  tf_overlaps(tf.corrupt_addr, 1, arg1, arg2)) {
+                tf.flash[tf.corrupt_addr] ^= 0x01;
+            }
+            return 0;
+        }
+
+        case TF_ENTRY_VERIFY: {
+            const uint8_t *src = tf_mem(arg3, arg2);
+
+            ++tf.cnt_verify;
+            if (tf.func != FLASH_FUNC_VERIFY  ||  src == NULL  ||  arg1 + arg2 > TF_FLASH_SIZE) {
+                ++tf.violations;
+                return 0;
+            }
+            for (uint32_t i = 0;  i < arg2;  ++i) {
+                if (tf.flash[arg1 + i] != src[i]) {
+                    return arg1 + i;                 // address of the first mismatch
+                }
+            }
+            return arg1 + arg2;
+        }
+
+        default:
+            ++tf.violations;
+            return 1;
+    }
+}   // tf_execute
+
+
+
+uint8_t swd_flash_syscall_wait(uint32_t arg1, uint32_t arg2, flash_algo_return_t return_type)
+{
+    uint32_t r0;
+
+    if ( !tf.running) {
+        ++tf.violations;
+        return 0;
+    }
+    if (tf.now_ns < tf.run_done_ns) {
+        tf.now_ns = tf.run_done_ns;
+    }
+    tf.now_ns += tf.call_ns;
+    tf.running = false;
+    if (arg1 != tf.run_args[0]  ||  arg2 != tf.run_args[1]) {
+        ++tf.violations;                             // result checked with other arguments than the call
+    }
+
+    r0 = tf_execute(tf.run_entry, tf.run_args[0], tf.run_args[1], tf.run_args[2]);
+    if (return_type == FLASHALGO_RETURN_POINTER) {
+        return r0 == arg1 + arg2;
+    }
+    return r0 == 0;
+}   // swd_flash_syscall_wait
+
+
+
+uint8_t swd_flash_syscall_exec(const program_syscall_t *sysCallParam, uint32_t entry, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, flash_algo_return_t return_type)
+{
+    if ( !swd_flash_syscall_start(sysCallParam, entry, arg1, arg2, arg3, arg4)) {
+        return 0;
+    }
+    return swd_flash_syscall_wait(arg1, arg2, return_type);
+}   // swd_flash_syscall_exec
+
+
+#endif